@@ -0,0 +1,117 @@
+/*
+ * linux/arch/arm/lib/copy-neon.c
+ *
+ * Runtime selection of the NEON copy routine for large memcpy() and
+ * copy_page() calls.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/gfp.h>
+#include <linux/hardirq.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <asm/neon.h>
+
+void *__memcpy_arm(void *dest, const void *src, size_t n);
+void *__memcpy_neon(void *dest, const void *src, size_t n);
+
+/*
+ * Smallest copy handed to NEON, tested at the entry of memcpy() and
+ * copy_page().  Stays out of reach until the boot time calibration.
+ */
+unsigned int neon_copy_min __read_mostly = UINT_MAX;
+
+/* Called by memcpy() for n >= neon_copy_min, copy_page() for PAGE_SIZE */
+void *memcpy_neon_large(void *dest, const void *src, size_t n)
+{
+	/* kernel mode NEON is not allowed in interrupt context */
+	if (in_interrupt())
+		return __memcpy_arm(dest, src, n);
+
+	kernel_neon_begin();
+	__memcpy_neon(dest, src, n);
+	kernel_neon_end();
+
+	return dest;
+}
+
+#define NEON_COPY_BENCH_ORDER	2
+#define NEON_COPY_BENCH_BYTES	(512 * 1024)
+
+static u64 __init neon_copy_rate(void *dst, const void *src, size_t n,
+				 bool neon)
+{
+	unsigned int i, loops = NEON_COPY_BENCH_BYTES / n;
+	ktime_t start;
+	s64 ns;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		if (neon) {
+			kernel_neon_begin();
+			__memcpy_neon(dst, src, n);
+			kernel_neon_end();
+		} else {
+			__memcpy_arm(dst, src, n);
+		}
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ? : 1;
+
+	/* MB/s */
+	return div64_s64((u64)loops * n * 1000, ns);
+}
+
+/*
+ * As the XOR block templates are, measure both routines over cache warm
+ * buffers, here for each power of two size up to the buffer size.  The
+ * cost of kernel_neon_begin() is included, though without user VFP state
+ * to save at this point.  NEON is used from the smallest size at which
+ * it wins at every larger size too.
+ */
+static int __init neon_copy_calibrate(void)
+{
+	unsigned int min = UINT_MAX;
+	unsigned long src, dst;
+	size_t n;
+
+	if (!cpu_has_neon())
+		return 0;
+
+	src = __get_free_pages(GFP_KERNEL, NEON_COPY_BENCH_ORDER);
+	dst = __get_free_pages(GFP_KERNEL, NEON_COPY_BENCH_ORDER);
+	if (!src || !dst)
+		goto out;
+
+	memset((void *)src, 0x5a, PAGE_SIZE << NEON_COPY_BENCH_ORDER);
+
+	for (n = PAGE_SIZE << NEON_COPY_BENCH_ORDER; n >= 256; n >>= 1) {
+		u64 arm, neon;
+
+		arm = neon_copy_rate((void *)dst, (void *)src, n, false);
+		neon = neon_copy_rate((void *)dst, (void *)src, n, true);
+
+		pr_info("neon copy: %6zu bytes: arm %5llu MB/s, neon %5llu MB/s\n",
+			n, arm, neon);
+
+		if (neon <= arm)
+			break;
+		min = n;
+	}
+
+	neon_copy_min = min;
+	if (min == UINT_MAX)
+		pr_info("neon copy: not used\n");
+	else
+		pr_info("neon copy: used from %u bytes\n", min);
+
+out:
+	free_pages(dst, NEON_COPY_BENCH_ORDER);
+	free_pages(src, NEON_COPY_BENCH_ORDER);
+	return 0;
+}
+late_initcall(neon_copy_calibrate);
@@ -0,0 +1,154 @@
+/*
+ * linux/arch/arm/lib/csum-neon.c
+ *
+ * Runtime selection of the NEON checksum routines for large
+ * csum_partial() and csum_partial_copy_nocheck() calls.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/gfp.h>
+#include <linux/hardirq.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <asm/checksum.h>
+#include <asm/neon.h>
+
+__wsum __csum_partial_arm(const void *buff, int len, __wsum sum);
+__wsum __csum_partial_copy_arm(const void *src, void *dst, int len,
+			       __wsum sum);
+__wsum __csum_partial_neon(const void *buff, int len, __wsum sum);
+__wsum __csum_partial_copy_neon(const void *src, void *dst, int len,
+				__wsum sum);
+
+#define NEON_CSUM_BLOCK		64
+
+/*
+ * Smallest length handed to NEON, tested at the entry of csum_partial()
+ * and csum_partial_copy_nocheck().  Stays out of reach until the boot
+ * time calibration.
+ */
+unsigned int neon_csum_min __read_mostly = UINT_MAX;
+
+/*
+ * Whole blocks are done with NEON, the tail by the ARM routine.  Interrupt
+ * context, where kernel mode NEON is not allowed, uses the ARM routine
+ * only: that covers the receive softirq, the process context users are
+ * transmit and the copy to user of received data.
+ */
+__wsum csum_partial_neon_large(const void *buff, int len, __wsum sum)
+{
+	int blocks = len & ~(NEON_CSUM_BLOCK - 1);
+
+	if (in_interrupt())
+		return __csum_partial_arm(buff, len, sum);
+
+	kernel_neon_begin();
+	sum = __csum_partial_neon(buff, blocks, sum);
+	kernel_neon_end();
+
+	return __csum_partial_arm(buff + blocks, len - blocks, sum);
+}
+
+__wsum csum_partial_copy_neon_large(const void *src, void *dst, int len,
+				    __wsum sum)
+{
+	int blocks = len & ~(NEON_CSUM_BLOCK - 1);
+
+	if (in_interrupt())
+		return __csum_partial_copy_arm(src, dst, len, sum);
+
+	kernel_neon_begin();
+	sum = __csum_partial_copy_neon(src, dst, blocks, sum);
+	kernel_neon_end();
+
+	return __csum_partial_copy_arm(src + blocks, dst + blocks,
+				       len - blocks, sum);
+}
+
+#define NEON_CSUM_BENCH_ORDER	2
+#define NEON_CSUM_BENCH_BYTES	(512 * 1024)
+
+static u64 __init neon_csum_rate(const void *buf, int len, bool neon)
+{
+	unsigned int i, loops = NEON_CSUM_BENCH_BYTES / len;
+	ktime_t start;
+	s64 ns;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		if (neon) {
+			kernel_neon_begin();
+			__csum_partial_neon(buf, len, 0);
+			kernel_neon_end();
+		} else {
+			__csum_partial_arm(buf, len, 0);
+		}
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ? : 1;
+
+	/* MB/s */
+	return div64_s64((u64)loops * len * 1000, ns);
+}
+
+/*
+ * Check the NEON sum against the ARM one, then measure both as for
+ * the copy routines: NEON is used from the smallest size at which it
+ * wins at every larger size too.
+ */
+static int __init neon_csum_calibrate(void)
+{
+	unsigned int min = UINT_MAX;
+	unsigned long buf;
+	u8 *p;
+	int i, len;
+
+	if (!cpu_has_neon())
+		return 0;
+
+	buf = __get_free_pages(GFP_KERNEL, NEON_CSUM_BENCH_ORDER);
+	if (!buf)
+		return 0;
+
+	p = (u8 *)buf;
+	for (i = 0; i < PAGE_SIZE << NEON_CSUM_BENCH_ORDER; i++)
+		p[i] = i * 31 + (i >> 8);
+
+	kernel_neon_begin();
+	i = csum_fold(__csum_partial_neon(p, PAGE_SIZE, 0)) !=
+	    csum_fold(__csum_partial_arm(p, PAGE_SIZE, 0));
+	kernel_neon_end();
+	if (i) {
+		pr_err("neon csum: wrong result, not used\n");
+		goto out;
+	}
+
+	for (len = PAGE_SIZE << NEON_CSUM_BENCH_ORDER; len >= 256; len >>= 1) {
+		u64 arm, neon;
+
+		arm = neon_csum_rate(p, len, false);
+		neon = neon_csum_rate(p, len, true);
+
+		pr_info("neon csum: %6d bytes: arm %5llu MB/s, neon %5llu MB/s\n",
+			len, arm, neon);
+
+		if (neon <= arm)
+			break;
+		min = len;
+	}
+
+	neon_csum_min = min;
+	if (min == UINT_MAX)
+		pr_info("neon csum: not used\n");
+	else
+		pr_info("neon csum: used from %u bytes\n", min);
+
+out:
+	free_pages(buf, NEON_CSUM_BENCH_ORDER);
+	return 0;
+}
+late_initcall(neon_csum_calibrate);
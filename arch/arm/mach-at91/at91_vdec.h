@@ -34,9 +34,21 @@
 #define   VDEC_DIR_ID                    0x10 /* 1: Disable interrupts for decoder; 0: Enable interrupts. */
 #define   VDEC_DIR_ABORT                 0x20
 #define   VDEC_DIR_ISET                 0x100 /* Decoder Interrupt Set. 0: Clears the Decoder Interrupt. */
+#define   VDEC_DIR_RDY                 0x1000 /* Picture decoded. */
+#define   VDEC_DIR_BUS                 0x2000 /* Bus error. */
+#define   VDEC_DIR_BUFF                0x4000 /* Stream buffer empty. */
+#define   VDEC_DIR_ERROR              0x10000 /* Stream error. */
+#define   VDEC_DIR_TIMEOUT            0x40000 /* Decoder timeout. */
+
+#define VDEC_STR      0x30       /* Stream (input) Base Address */
+#define VDEC_DST      0x34       /* Decoded Picture (output) Base Address */
+#define VDEC_REF(n)   (0x38 + 4 * (n)) /* Reference Picture Base Addresses, 0 to 15 */
+#define   VDEC_REF_FLAGS                  0x3 /* Low bits: field and top field first flags. */
+#define VDEC_NUM_REFS 16
 
 #define VDEC_PPIR     0xF0       /* Post Processor Interrupt Register */
 #define   VDEC_PPIR_PPE                     1 /* 1: Enable post-processor; 0: Disable post-processor */
+#define   VDEC_PPIR_PIPEN                 0x2 /* 1: Post-process the decoder output on the fly (pipeline mode). */
 #define   VDEC_PPIR_ID                   0x10 /* 1: Disable interrupts for post-processor; 0: Enable interrupts. */
 #define   VDEC_PPIR_ISET                0x100 /* Post-processor Interrupt Set. 0: Clears the post-processor Interrupt. */
 
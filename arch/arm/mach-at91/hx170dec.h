@@ -23,6 +23,7 @@
 
 #include <linux/ioctl.h>
 #include <linux/types.h>
+#include <linux/v4l2-controls.h>
 
 struct core_desc
 {
@@ -60,6 +61,38 @@ struct core_desc
 
 #define HX170DEC_IOX_ASIC_ID		_IOWR(HX170DEC_IOC_MAGIC, 20, __u32 *)
 
+/*
+ * Queued decoding: HX170DEC_IOCS_DEC_SUBMIT queues a decoder register set
+ * and returns right away, the decoder then runs the jobs of all the open
+ * files in turn. Each read() on the device returns completed jobs of the
+ * file in submission order, as struct hx170dec_job with the registers read
+ * back after the interrupt. poll() reports POLLIN when one is available.
+ */
+struct hx170dec_job
+{
+	__u32 id;    /* cookie given back on completion */
+	__u32 regs[60]; /* decoder registers, the ID register is ignored */
+};
+
+#define HX170DEC_IOCS_DEC_SUBMIT	_IOW(HX170DEC_IOC_MAGIC, 21, struct hx170dec_job)
+
+/*
+ * Pipelined decoding: the post-processor works on the decoder output as it
+ * is produced, scaling and converting it before it goes to memory. The
+ * job completes with the decoder interrupt, and read() returns it as
+ * struct hx170dec_pipe_job, with both register sets read back. The PP
+ * enable and pipeline enable bits are forced in the PP interrupt register,
+ * the PP interrupt is masked. The decoder output write can be disabled in
+ * the decoder registers, when only the post-processed picture is needed.
+ */
+struct hx170dec_pipe_job
+{
+	struct hx170dec_job dec;
+	__u32 pp_regs[41]; /* post-processor registers, the 5 last ones are ignored */
+};
+
+#define HX170DEC_IOCS_PIPE_SUBMIT	_IOW(HX170DEC_IOC_MAGIC, 22, struct hx170dec_pipe_job)
+
 /*
  * Following are not used yet:
  *
@@ -73,4 +106,21 @@ struct core_desc
 
 #define HX170DEC_IOC_MAXNR 29
 
+/*
+ * V4L2 mem2mem interface controls, latched into each OUTPUT buffer when it
+ * is queued:
+ *
+ * V4L2_CID_VDEC_G1_DEC_REGS: the 60 decoder registers, laid out as for
+ * HX170DEC_IOCS_DEC_PUSH_REG. The ID register is ignored, the stream and
+ * output picture base addresses are replaced by the ones of the OUTPUT and
+ * CAPTURE buffers of the job.
+ *
+ * V4L2_CID_VDEC_G1_REF_BUFS: for each of the 16 reference picture base
+ * registers, the index of the CAPTURE buffer holding that reference, or
+ * 0xff to keep the address given in the register array. The two low flag
+ * bits of the register are preserved.
+ */
+#define V4L2_CID_VDEC_G1_DEC_REGS	(V4L2_CID_USER_VDEC_G1_BASE + 0)
+#define V4L2_CID_VDEC_G1_REF_BUFS	(V4L2_CID_USER_VDEC_G1_BASE + 1)
+
 #endif /* !_HX170DEC_H_ */
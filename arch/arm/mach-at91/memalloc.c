@@ -19,43 +19,75 @@
  */
 
 #include <linux/module.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-contiguous.h>
 #include <linux/dma-mapping.h> /* dma_zalloc_coherent, dma_free_coherent */
 #include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 
 #include "memalloc.h"
 
+/*
+ * Pool size classes: page counts up to 4, then 4 classes per power of two,
+ * which wastes at most 25% of a block. The largest class is 64MB.
+ */
+#define MEMALLOC_NUM_CLASSES	52
+#define MEMALLOC_MAX_SIZE	(64 << 20)
+
+enum {
+	MEMALLOC_METHOD_COHERENT,	/* MEMALLOC_IOCXGETBUFFER */
+	MEMALLOC_METHOD_POOL,		/* MEMALLOC_IOCXALLOC */
+};
+
 struct memalloc_drv {
 	struct class *class;
 	struct device *dev;
 	int major;
 	struct list_head opened; /* list of opened files (memalloc_file_context) */
 	spinlock_t lock;
+
+	/* free blocks of MEMALLOC_METHOD_POOL, by size class */
+	struct mutex pool_lock;
+	struct list_head pool[MEMALLOC_NUM_CLASSES];
+	size_t pool_cached;
 };
 
 struct memalloc_file_context {
 	struct list_head n;
 	struct memalloc_drv *parent;
 	struct list_head blocks; /* list of allocated blocks (mem_block) */
-	spinlock_t lock;
+	struct mutex lock;
 	//unsigned int num_blocks;
 };
 
 struct memalloc_block {
-	struct list_head n;
+	struct list_head n; /* in the file blocks, or a pool free list */
+	struct kref ref;    /* file and exported dma-bufs */
+	struct memalloc_drv *parent;
 	dma_addr_t dma_handle;
-	void *virt_addr;
+	void *virt_addr;    /* MEMALLOC_METHOD_COHERENT only */
+	struct page *pages; /* MEMALLOC_METHOD_POOL only */
 	size_t size; /* page aligned */
 	int method;
+	int class;
+	bool cma;
 };
 
 static struct memalloc_drv memalloc_ing = {
 	.opened = LIST_HEAD_INIT(memalloc_ing.opened),
 	.lock = __SPIN_LOCK_UNLOCKED(memalloc_ing.lock),
+	.pool_lock = __MUTEX_INITIALIZER(memalloc_ing.pool_lock),
 };
 
+static unsigned long pool_max = 16 << 20;
+module_param(pool_max, ulong, 0644);
+MODULE_PARM_DESC(pool_max, "Bytes of freed blocks kept for reuse (default: 16MB)");
+
 /**
  * allocate_large_block - Allocate a physically contiguous memory area
  *
@@ -69,12 +101,15 @@ static int allocate_large_block(struct device *dev, struct memalloc_block **pp_b
 {
 	struct memalloc_block *p;
 
-	p = kmalloc(sizeof(struct memalloc_block), GFP_KERNEL);
+	p = kzalloc(sizeof(struct memalloc_block), GFP_KERNEL);
 	if (p == NULL) {
 		dev_info(dev, "unable to alloc block struct.\n");
 		return -ENOMEM;
 	}
 
+	kref_init(&p->ref);
+	p->parent = &memalloc_ing;
+	p->method = MEMALLOC_METHOD_COHERENT;
 	p->size = PAGE_ALIGN(*p_size);
 
 	/* Multiple of PAGE_SIZE */
@@ -101,6 +136,357 @@ static int free_large_block(struct device *dev, struct memalloc_block *p)
 	return 0;
 }
 
+/**
+ * memalloc_size_class - Round a size up to its pool size class
+ *
+ * @param p_size Wished size, rounded up to the class size on output
+ *
+ * @return the class index, negative value if the size is not supported
+ */
+static int memalloc_size_class(size_t *p_size)
+{
+	unsigned long pages = PAGE_ALIGN(*p_size) >> PAGE_SHIFT;
+	unsigned long step;
+	int k;
+
+	if (!pages || *p_size > MEMALLOC_MAX_SIZE)
+		return -EINVAL;
+
+	if (pages <= 4) {
+		*p_size = pages << PAGE_SHIFT;
+		return pages - 1;
+	}
+
+	/* pages is in ]2^k, 2^(k+1)], split in 4 steps */
+	k = fls_long(pages - 1) - 1;
+	step = 1UL << (k - 2);
+	pages = round_up(pages, step);
+	*p_size = pages << PAGE_SHIFT;
+
+	return 4 + (k - 2) * 4 + (pages / step - 5);
+}
+
+static void destroy_pool_block(struct memalloc_drv *m, struct memalloc_block *p)
+{
+	dma_unmap_page(m->dev, p->dma_handle, p->size, DMA_BIDIRECTIONAL);
+	if (!p->cma || !dma_release_from_contiguous(m->dev, p->pages,
+						    p->size >> PAGE_SHIFT))
+		free_pages_exact(page_address(p->pages), p->size);
+	kfree(p);
+}
+
+/**
+ * allocate_pool_block - Allocate a cacheable physically contiguous block
+ *
+ * Freed blocks of the same size class are reused first, then the block is
+ * taken from the CMA area, then from the page allocator.
+ *
+ * @param m driver
+ * @param pp_block Result block struct address
+ * @param p_size Wished size. Output is rounded up to the size class
+ * @param flags MEMALLOC_NO_ZERO to skip clearing the block
+ *
+ * @return 0 on success, negative value on error
+ */
+static int allocate_pool_block(struct memalloc_drv *m,
+		struct memalloc_block **pp_block, size_t *p_size,
+		unsigned flags)
+{
+	struct memalloc_block *p;
+	size_t size = *p_size;
+	int class, i;
+
+	class = memalloc_size_class(&size);
+	if (class < 0)
+		return class;
+
+	mutex_lock(&m->pool_lock);
+	p = list_first_entry_or_null(&m->pool[class], struct memalloc_block, n);
+	if (p) {
+		list_del(&p->n);
+		m->pool_cached -= p->size;
+	}
+	mutex_unlock(&m->pool_lock);
+
+	if (!p) {
+		p = kzalloc(sizeof(struct memalloc_block), GFP_KERNEL);
+		if (p == NULL)
+			return -ENOMEM;
+
+		p->parent = m;
+		p->method = MEMALLOC_METHOD_POOL;
+		p->class = class;
+		p->size = size;
+
+		p->pages = dma_alloc_from_contiguous(m->dev, size >> PAGE_SHIFT, 0);
+		p->cma = p->pages != NULL;
+		if (!p->pages) {
+			void *virt = alloc_pages_exact(size, GFP_KERNEL | __GFP_NOWARN);
+
+			if (virt)
+				p->pages = virt_to_page(virt);
+		}
+		if (!p->pages) {
+			dev_err(m->dev, "pool alloc failed (%zu)\n", size);
+			kfree(p);
+			return -ENOMEM;
+		}
+
+		/* Mapped once, the cache is maintained by the sync calls */
+		p->dma_handle = dma_map_page(m->dev, p->pages, 0, size,
+					     DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(m->dev, p->dma_handle)) {
+			p->dma_handle = 0;
+			if (!p->cma || !dma_release_from_contiguous(m->dev,
+					p->pages, size >> PAGE_SHIFT))
+				free_pages_exact(page_address(p->pages), size);
+			kfree(p);
+			return -ENOMEM;
+		}
+	}
+
+	/*
+	 * The device hands out bus addresses, it is for trusted users only:
+	 * skipping the clear is fine when the decoder overwrites the block.
+	 */
+	if (!(flags & MEMALLOC_NO_ZERO)) {
+		for (i = 0; i < (size >> PAGE_SHIFT); i++)
+			clear_highpage(p->pages + i);
+		dma_sync_single_for_device(m->dev, p->dma_handle, size,
+					   DMA_TO_DEVICE);
+	}
+
+	kref_init(&p->ref);
+
+	dev_dbg(m->dev, "pool alloc ok: PA=0x%llx SZ=%zu (requested %zu)\n",
+			(unsigned long long)p->dma_handle, p->size, *p_size);
+
+	*p_size = p->size;
+	*pp_block = p;
+	return 0;
+}
+
+static void memalloc_block_release(struct kref *ref)
+{
+	struct memalloc_block *p = container_of(ref, struct memalloc_block, ref);
+	struct memalloc_drv *m = p->parent;
+
+	if (p->method == MEMALLOC_METHOD_COHERENT) {
+		free_large_block(m->dev, p);
+		return;
+	}
+
+	mutex_lock(&m->pool_lock);
+	if (m->pool_cached + p->size <= pool_max) {
+		list_add(&p->n, &m->pool[p->class]);
+		m->pool_cached += p->size;
+		p = NULL;
+	}
+	mutex_unlock(&m->pool_lock);
+
+	if (p)
+		destroy_pool_block(m, p);
+}
+
+static void memalloc_block_put(struct memalloc_block *p)
+{
+	kref_put(&p->ref, memalloc_block_release);
+}
+
+/* Called with fc->lock held */
+static struct memalloc_block *memalloc_find_block(
+		struct memalloc_file_context *fc, unsigned long bus_address)
+{
+	struct memalloc_block *p;
+
+	list_for_each_entry(p, &fc->blocks, n) {
+		if ((unsigned long)p->dma_handle == bus_address)
+			return p;
+	}
+
+	return NULL;
+}
+
+/*
+ * dma-buf export of pool blocks
+ */
+
+static struct sg_table *memalloc_dmabuf_map(struct dma_buf_attachment *attach,
+		enum dma_data_direction dir)
+{
+	struct memalloc_block *p = attach->dmabuf->priv;
+	struct sg_table *sgt;
+
+	sgt = kmalloc(sizeof(*sgt), GFP_KERNEL);
+	if (!sgt)
+		return ERR_PTR(-ENOMEM);
+
+	if (sg_alloc_table(sgt, 1, GFP_KERNEL)) {
+		kfree(sgt);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	sg_set_page(sgt->sgl, p->pages, p->size, 0);
+	if (!dma_map_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir)) {
+		sg_free_table(sgt);
+		kfree(sgt);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	return sgt;
+}
+
+static void memalloc_dmabuf_unmap(struct dma_buf_attachment *attach,
+		struct sg_table *sgt, enum dma_data_direction dir)
+{
+	dma_unmap_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir);
+	sg_free_table(sgt);
+	kfree(sgt);
+}
+
+static void memalloc_dmabuf_release(struct dma_buf *dmabuf)
+{
+	memalloc_block_put(dmabuf->priv);
+}
+
+static int memalloc_dmabuf_begin_cpu_access(struct dma_buf *dmabuf,
+		size_t start, size_t len, enum dma_data_direction dir)
+{
+	struct memalloc_block *p = dmabuf->priv;
+
+	dma_sync_single_range_for_cpu(p->parent->dev, p->dma_handle, start,
+				      len, dir);
+	return 0;
+}
+
+static void memalloc_dmabuf_end_cpu_access(struct dma_buf *dmabuf,
+		size_t start, size_t len, enum dma_data_direction dir)
+{
+	struct memalloc_block *p = dmabuf->priv;
+
+	dma_sync_single_range_for_device(p->parent->dev, p->dma_handle, start,
+					 len, dir);
+}
+
+static void *memalloc_dmabuf_kmap_atomic(struct dma_buf *dmabuf,
+		unsigned long pgnum)
+{
+	struct memalloc_block *p = dmabuf->priv;
+
+	return kmap_atomic(p->pages + pgnum);
+}
+
+static void memalloc_dmabuf_kunmap_atomic(struct dma_buf *dmabuf,
+		unsigned long pgnum, void *vaddr)
+{
+	kunmap_atomic(vaddr);
+}
+
+static void *memalloc_dmabuf_kmap(struct dma_buf *dmabuf, unsigned long pgnum)
+{
+	struct memalloc_block *p = dmabuf->priv;
+
+	return kmap(p->pages + pgnum);
+}
+
+static void memalloc_dmabuf_kunmap(struct dma_buf *dmabuf, unsigned long pgnum,
+		void *vaddr)
+{
+	struct memalloc_block *p = dmabuf->priv;
+
+	kunmap(p->pages + pgnum);
+}
+
+static int memalloc_dmabuf_mmap(struct dma_buf *dmabuf,
+		struct vm_area_struct *vma)
+{
+	struct memalloc_block *p = dmabuf->priv;
+	size_t size = vma->vm_end - vma->vm_start;
+
+	if (vma->vm_pgoff + (size >> PAGE_SHIFT) > (p->size >> PAGE_SHIFT))
+		return -EINVAL;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       page_to_pfn(p->pages) + vma->vm_pgoff,
+			       size, vma->vm_page_prot);
+}
+
+static const struct dma_buf_ops memalloc_dmabuf_ops = {
+	.map_dma_buf = memalloc_dmabuf_map,
+	.unmap_dma_buf = memalloc_dmabuf_unmap,
+	.release = memalloc_dmabuf_release,
+	.begin_cpu_access = memalloc_dmabuf_begin_cpu_access,
+	.end_cpu_access = memalloc_dmabuf_end_cpu_access,
+	.kmap_atomic = memalloc_dmabuf_kmap_atomic,
+	.kunmap_atomic = memalloc_dmabuf_kunmap_atomic,
+	.kmap = memalloc_dmabuf_kmap,
+	.kunmap = memalloc_dmabuf_kunmap,
+	.mmap = memalloc_dmabuf_mmap,
+};
+
+static int memalloc_export(struct memalloc_drv *m, struct memalloc_block *p,
+		unsigned flags)
+{
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct dma_buf *dmabuf;
+	int fd;
+
+	exp_info.ops = &memalloc_dmabuf_ops;
+	exp_info.size = p->size;
+	exp_info.flags = O_RDWR;
+	exp_info.priv = p;
+
+	kref_get(&p->ref);
+	dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dmabuf)) {
+		memalloc_block_put(p);
+		return PTR_ERR(dmabuf);
+	}
+
+	/* From now on, the reference goes away with the dma-buf */
+	fd = dma_buf_fd(dmabuf, flags & O_CLOEXEC);
+	if (fd < 0)
+		dma_buf_put(dmabuf);
+
+	return fd;
+}
+
+static int memalloc_sync(struct memalloc_drv *m, struct memalloc_block *p,
+		const MemallocSyncParams *sync)
+{
+	enum dma_data_direction dir;
+
+	if (sync->offset > p->size || sync->size > p->size - sync->offset)
+		return -EINVAL;
+
+	/* Coherent blocks are never cached */
+	if (p->method == MEMALLOC_METHOD_COHERENT)
+		return 0;
+
+	switch (sync->flags & MEMALLOC_SYNC_RW) {
+	case MEMALLOC_SYNC_READ:
+		dir = DMA_FROM_DEVICE;
+		break;
+	case MEMALLOC_SYNC_WRITE:
+		dir = DMA_TO_DEVICE;
+		break;
+	case MEMALLOC_SYNC_RW:
+		dir = DMA_BIDIRECTIONAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sync->flags & MEMALLOC_SYNC_END)
+		dma_sync_single_range_for_device(m->dev, p->dma_handle,
+						 sync->offset, sync->size, dir);
+	else
+		dma_sync_single_range_for_cpu(m->dev, p->dma_handle,
+					      sync->offset, sync->size, dir);
+
+	return 0;
+}
+
 static long memalloc_ioctl(struct file *filp, unsigned int cmd,
 	unsigned long arg)
 {
@@ -109,6 +495,9 @@ static long memalloc_ioctl(struct file *filp, unsigned int cmd,
 
 	int ret = -EFAULT;
 	MemallocParams mem_params;
+	MemallocAllocParams alloc_params;
+	MemallocSyncParams sync_params;
+	MemallocExportParams export_params;
 	struct memalloc_block *p;
 	size_t sz;
 
@@ -117,7 +506,7 @@ static long memalloc_ioctl(struct file *filp, unsigned int cmd,
 
 	switch (cmd) {
 		case MEMALLOC_IOCXGETBUFFER:
-			spin_lock(&fc->lock);
+			mutex_lock(&fc->lock);
 			if (copy_from_user(&mem_params, (MemallocParams *)arg, sizeof(mem_params)))
 				dev_dbg(m->dev, "copy_from_user failed\n");
 
@@ -132,24 +521,74 @@ static long memalloc_ioctl(struct file *filp, unsigned int cmd,
 
 				list_add(&p->n, &fc->blocks);
 			}
-			spin_unlock(&fc->lock);
+			mutex_unlock(&fc->lock);
+			break;
+
+		case MEMALLOC_IOCXALLOC:
+			if (copy_from_user(&alloc_params, (MemallocAllocParams *)arg, sizeof(alloc_params)))
+				return -EFAULT;
+
+			sz = alloc_params.size;
+			ret = allocate_pool_block(m, &p, &sz, alloc_params.flags);
+			if (ret)
+				break;
+
+			alloc_params.busAddress = (unsigned long)p->dma_handle;
+			alloc_params.size = sz;
+			if (copy_to_user((MemallocAllocParams *)arg, &alloc_params, sizeof(alloc_params))) {
+				memalloc_block_put(p);
+				return -EFAULT;
+			}
+
+			mutex_lock(&fc->lock);
+			list_add(&p->n, &fc->blocks);
+			mutex_unlock(&fc->lock);
 			break;
 
 		case MEMALLOC_IOCSFREEBUFFER:
 			ret = -EINVAL;
-			spin_lock(&fc->lock);
+			mutex_lock(&fc->lock);
 			__get_user(mem_params.busAddress, (unsigned long *)arg);
 
 			/* find memalloc_block */
-			list_for_each_entry(p, &fc->blocks, n) {
-				if ((unsigned long)p->dma_handle == mem_params.busAddress) {
-					list_del(&p->n);
-					free_large_block(m->dev, p);
-					ret = 0;
-					break;
-				}
+			p = memalloc_find_block(fc, mem_params.busAddress);
+			if (p) {
+				list_del(&p->n);
+				memalloc_block_put(p);
+				ret = 0;
 			}
-			spin_unlock(&fc->lock);
+			mutex_unlock(&fc->lock);
+			break;
+
+		case MEMALLOC_IOCSSYNC:
+			if (copy_from_user(&sync_params, (MemallocSyncParams *)arg, sizeof(sync_params)))
+				return -EFAULT;
+
+			ret = -EINVAL;
+			mutex_lock(&fc->lock);
+			p = memalloc_find_block(fc, sync_params.busAddress);
+			if (p)
+				ret = memalloc_sync(m, p, &sync_params);
+			mutex_unlock(&fc->lock);
+			break;
+
+		case MEMALLOC_IOCXEXPORT:
+			if (copy_from_user(&export_params, (MemallocExportParams *)arg, sizeof(export_params)))
+				return -EFAULT;
+
+			ret = -EINVAL;
+			mutex_lock(&fc->lock);
+			p = memalloc_find_block(fc, export_params.busAddress);
+			if (p && p->method == MEMALLOC_METHOD_POOL)
+				ret = memalloc_export(m, p, export_params.flags);
+			mutex_unlock(&fc->lock);
+			if (ret < 0)
+				break;
+
+			export_params.fd = ret;
+			ret = 0;
+			if (copy_to_user((MemallocExportParams *)arg, &export_params, sizeof(export_params)))
+				ret = -EFAULT;
 			break;
 
 		default:
@@ -176,7 +615,7 @@ static int memalloc_open(struct inode *inode, struct file *filp)
 	}
 
 	INIT_LIST_HEAD(&fc->blocks);
-	spin_lock_init(&fc->lock);
+	mutex_init(&fc->lock);
 	fc->parent = m;
 
 	filp->private_data = fc;
@@ -197,7 +636,7 @@ static int memalloc_release(struct inode *inode, struct file *filp)
 
 	list_for_each_entry_safe(p, tmp, &fc->blocks, n) {
 		list_del(&p->n);
-		free_large_block(m->dev, p);
+		memalloc_block_put(p);
 	}
 
 	spin_lock(&m->lock);
@@ -224,21 +663,29 @@ static int memalloc_mmap (struct file *filp, struct vm_area_struct *vma)
 
 	int found = 0;
 	size_t size = vma->vm_end - vma->vm_start;
+	unsigned long pfn = 0;
 
 	/* Is this a memory chunk provided by our driver ? */
-	spin_lock(&fc->lock);
+	mutex_lock(&fc->lock);
 	list_for_each_entry(p, &fc->blocks, n) {
 		if (((u64)p->dma_handle == ((u64)vma->vm_pgoff << PAGE_SHIFT)) &&
 				(size <= p->size)) {
 			found = 1;
+			if (p->method == MEMALLOC_METHOD_POOL)
+				pfn = page_to_pfn(p->pages);
 			break;
 		}
 	}
-	spin_unlock(&fc->lock);
+	mutex_unlock(&fc->lock);
 
 	if (!found)
 		return -EPERM;
 
+	/* Pool blocks are mapped cached */
+	if (pfn)
+		return remap_pfn_range(vma, vma->vm_start, pfn, size,
+				       vma->vm_page_prot);
+
 	vma->vm_page_prot = phys_mem_access_prot(filp, vma->vm_pgoff,
 						 size,
 						 vma->vm_page_prot);
@@ -268,7 +715,10 @@ static struct file_operations memalloc_fops = {
 static int memalloc_init(void)
 {
 	struct memalloc_drv *m = &memalloc_ing;
-	int ret;
+	int ret, i;
+
+	for (i = 0; i < MEMALLOC_NUM_CLASSES; i++)
+		INIT_LIST_HEAD(&m->pool[i]);
 
 	m->major = register_chrdev(0, "memalloc", &memalloc_fops);
 	if (m->major < 0) {
@@ -290,6 +740,7 @@ static int memalloc_init(void)
 	}
 
 	m->dev->coherent_dma_mask = DMA_BIT_MASK(32);
+	m->dev->dma_mask = &m->dev->coherent_dma_mask;
 	dev_dbg(m->dev, "allocator with major = %d\n", m->major);
 
 	return 0;
@@ -303,6 +754,15 @@ module_init(memalloc_init);
 static void memalloc_exit(void)
 {
 	struct memalloc_drv *m = &memalloc_ing;
+	struct memalloc_block *p, *tmp;
+	int i;
+
+	for (i = 0; i < MEMALLOC_NUM_CLASSES; i++) {
+		list_for_each_entry_safe(p, tmp, &m->pool[i], n) {
+			list_del(&p->n);
+			destroy_pool_block(m, p);
+		}
+	}
 
 	device_destroy(m->class, MKDEV(m->major, 0));
 	class_destroy(m->class);
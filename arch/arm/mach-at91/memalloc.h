@@ -36,6 +36,9 @@
  */
 #define MEMALLOC_IOCXGETBUFFER         _IOWR(MEMALLOC_IOC_MAGIC, 1, MemallocParams*)
 #define MEMALLOC_IOCSFREEBUFFER        _IOW(MEMALLOC_IOC_MAGIC,  2, unsigned long)
+#define MEMALLOC_IOCXALLOC             _IOWR(MEMALLOC_IOC_MAGIC, 3, MemallocAllocParams*)
+#define MEMALLOC_IOCSSYNC              _IOW(MEMALLOC_IOC_MAGIC,  4, MemallocSyncParams*)
+#define MEMALLOC_IOCXEXPORT            _IOWR(MEMALLOC_IOC_MAGIC, 5, MemallocExportParams*)
 
 /*
  * ... more to come
@@ -51,4 +54,37 @@ typedef struct {
     unsigned size;
 } MemallocParams;
 
+/*
+ * MEMALLOC_IOCXALLOC blocks come from a pool of cacheable memory: they are
+ * mapped cached by mmap(), CPU accesses must be bracketed by
+ * MEMALLOC_IOCSSYNC calls. They are freed with MEMALLOC_IOCSFREEBUFFER and
+ * can be shared with other devices through MEMALLOC_IOCXEXPORT.
+ */
+#define MEMALLOC_NO_ZERO               (1 << 0) /* don't clear the block */
+
+typedef struct {
+    unsigned busAddress;
+    unsigned size;
+    unsigned flags;                    /* MEMALLOC_NO_ZERO */
+} MemallocAllocParams;
+
+#define MEMALLOC_SYNC_READ             (1 << 0)
+#define MEMALLOC_SYNC_WRITE            (2 << 0)
+#define MEMALLOC_SYNC_RW               (MEMALLOC_SYNC_READ | MEMALLOC_SYNC_WRITE)
+#define MEMALLOC_SYNC_START            (0 << 2) /* CPU access begins */
+#define MEMALLOC_SYNC_END              (1 << 2) /* CPU access ends */
+
+typedef struct {
+    unsigned busAddress;
+    unsigned offset;
+    unsigned size;
+    unsigned flags;                    /* MEMALLOC_SYNC_* */
+} MemallocSyncParams;
+
+typedef struct {
+    unsigned busAddress;
+    unsigned flags;                    /* O_CLOEXEC */
+    int fd;                            /* dma-buf file descriptor */
+} MemallocExportParams;
+
 #endif /* MEMALLOC_H */
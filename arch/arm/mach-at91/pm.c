@@ -11,10 +11,13 @@
  */
 
 #include <linux/gpio.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include <linux/suspend.h>
 #include <linux/sched.h>
 #include <linux/proc_fs.h>
 #include <linux/genalloc.h>
+#include <linux/atmel-sram.h>
 #include <linux/interrupt.h>
 #include <linux/sysfs.h>
 #include <linux/module.h>
@@ -22,6 +25,7 @@
 #include <linux/of_platform.h>
 #include <linux/of_address.h>
 #include <linux/platform_device.h>
+#include <linux/platform_data/cpuidle-at91.h>
 #include <linux/io.h>
 #include <linux/clk/at91_pmc.h>
 #include <linux/mfd/syscon.h>
@@ -33,6 +37,7 @@
 #include <asm/mach/irq.h>
 #include <asm/fncpy.h>
 #include <asm/cacheflush.h>
+#include <asm/suspend.h>
 
 #include "generic.h"
 #include "pm.h"
@@ -57,6 +62,7 @@ static struct {
 	unsigned long uhp_udp_mask;
 	int memctrl;
 	u32 ulp_mode;
+	u32 backup;
 } at91_pm_data;
 
 void __iomem *at91_ramc_base[2];
@@ -77,15 +83,50 @@ static int at91_pm_valid_state(suspend_state_t state)
 
 static suspend_state_t target_state;
 
+/*
+ * Suspend/resume timings, in microseconds, of the last transition.
+ * Timekeeping is suspended around at91_pm_enter(), so they cover the
+ * device phases only: from begin to prepare_late for the suspend, from
+ * wake to end for the resume.
+ */
+static struct {
+	ktime_t start;
+	u32 count;
+	u32 suspend_us;
+	u32 resume_us;
+	u32 fast_standby;
+} at91_pm_stats = {
+	.fast_standby = 1,
+};
+
 /*
  * Called after processes are frozen, but before we shutdown devices.
  */
 static int at91_pm_begin(suspend_state_t state)
 {
 	target_state = state;
+	at91_pm_stats.start = ktime_get();
+	return 0;
+}
+
+/*
+ * Called with the devices suspended, right before timekeeping is.
+ */
+static int at91_pm_prepare_late(void)
+{
+	at91_pm_stats.suspend_us = ktime_us_delta(ktime_get(),
+						  at91_pm_stats.start);
 	return 0;
 }
 
+/*
+ * Called once timekeeping is back, before resuming the devices.
+ */
+static void at91_pm_wake(void)
+{
+	at91_pm_stats.start = ktime_get();
+}
+
 /*
  * Verify that all the clocks are correct before entering
  * slow-clock mode.
@@ -136,29 +177,156 @@ int at91_suspend_entering_slow_clock(void)
 EXPORT_SYMBOL(at91_suspend_entering_slow_clock);
 
 static void (*at91_suspend_sram_fn)(void __iomem *pmc, void __iomem *ramc0,
-			  void __iomem *ramc1, int memctrl);
+			  void __iomem *ramc1, int memctrl,
+			  void __iomem *sfrbu, void __iomem *shdwc);
 
 extern void at91_pm_suspend_in_sram(void __iomem *pmc, void __iomem *ramc0,
-			    void __iomem *ramc1, int memctrl);
+			    void __iomem *ramc1, int memctrl,
+			    void __iomem *sfrbu, void __iomem *shdwc);
 extern u32 at91_pm_suspend_in_sram_sz;
 
+/*
+ * Backup mode hand-off, in the secure RAM that stays powered with VDDBU.
+ * On wake up, the bootloader finds suspended set: it takes the DDR out of
+ * self-refresh without initialising it, checks that canary points to
+ * AT91_PM_BU_CANARY and jumps to resume with the MMU off.
+ */
+struct at91_pm_bu {
+	int suspended;
+	unsigned long reserved;
+	phys_addr_t canary;
+	phys_addr_t resume;
+};
+
+#define AT91_PM_BU_CANARY	0xA5A5A5A5
+
+static struct at91_pm_bu *pm_bu;
+static unsigned long at91_pm_bu_canary = AT91_PM_BU_CANARY;
+static void __iomem *sfrbu;
+static void __iomem *shdwc;
+
+/*
+ * The PMC is reset in backup mode. The bootloader brings back the main
+ * clock, PLLA and MCK; the clocks the drivers enabled are restored here.
+ */
+static struct {
+	u32 scsr;
+	u32 pckr[3];
+	u32 usb;
+	u32 uckr;
+	u32 pcr[AT91_PMC_PCR_PID_MASK + 1];
+} at91_pmc_backup;
+
+static void at91_pmc_backup_save(void)
+{
+	int i;
+
+	at91_pmc_backup.scsr = readl(pmc + AT91_PMC_SCSR);
+	for (i = 0; i < ARRAY_SIZE(at91_pmc_backup.pckr); i++)
+		at91_pmc_backup.pckr[i] = readl(pmc + AT91_PMC_PCKR(i));
+	at91_pmc_backup.usb = readl(pmc + AT91_PMC_USB);
+	at91_pmc_backup.uckr = readl(pmc + AT91_CKGR_UCKR);
+
+	for (i = 0; i < ARRAY_SIZE(at91_pmc_backup.pcr); i++) {
+		writel(i, pmc + AT91_PMC_PCR);
+		at91_pmc_backup.pcr[i] = readl(pmc + AT91_PMC_PCR);
+	}
+}
+
+static void at91_pmc_backup_restore(void)
+{
+	u32 pcr;
+	int i;
+
+	if (at91_pmc_backup.uckr & AT91_PMC_UPLLEN) {
+		writel(at91_pmc_backup.uckr, pmc + AT91_CKGR_UCKR);
+		while (!(readl(pmc + AT91_PMC_SR) & AT91_PMC_LOCKU))
+			cpu_relax();
+	}
+	writel(at91_pmc_backup.usb, pmc + AT91_PMC_USB);
+
+	for (i = 0; i < ARRAY_SIZE(at91_pmc_backup.pckr); i++)
+		writel(at91_pmc_backup.pckr[i], pmc + AT91_PMC_PCKR(i));
+
+	/* Peripheral and generated clocks: dividers, sources and enables */
+	for (i = 0; i < ARRAY_SIZE(at91_pmc_backup.pcr); i++) {
+		pcr = at91_pmc_backup.pcr[i] & ~AT91_PMC_PCR_PID_MASK;
+		writel(pcr | i | AT91_PMC_PCR_CMD, pmc + AT91_PMC_PCR);
+	}
+
+	writel(at91_pmc_backup.scsr, pmc + AT91_PMC_SCER);
+	for (i = 0; i < ARRAY_SIZE(at91_pmc_backup.pckr); i++) {
+		if (!(at91_pmc_backup.scsr & (AT91_PMC_PCK0 << i)))
+			continue;
+		while (!(readl(pmc + AT91_PMC_SR) & (AT91_PMC_PCK0RDY << i)))
+			cpu_relax();
+	}
+}
+
+static int at91_suspend_finish(unsigned long val)
+{
+	flush_cache_all();
+	outer_disable();
+
+	at91_suspend_sram_fn(pmc, at91_ramc_base[0], at91_ramc_base[1],
+			     val, sfrbu, shdwc);
+
+	return 0;
+}
+
+/*
+ * The suspend code in SRAM doesn't return: the core state is saved for
+ * cpu_resume(), where the bootloader comes back to.
+ */
+static void at91_pm_backup(unsigned int pm_data)
+{
+	at91_pmc_backup_save();
+	pm_bu->suspended = 1;
+
+	cpu_suspend(pm_data | AT91_PM_BACKUP(AT91_PM_BACKUP_MODE),
+		    at91_suspend_finish);
+
+	/* The SRAM went down with VDDCORE */
+	at91_suspend_sram_fn = fncpy(at91_suspend_sram_fn,
+			&at91_pm_suspend_in_sram, at91_pm_suspend_in_sram_sz);
+
+	pm_bu->suspended = 0;
+	at91_pmc_backup_restore();
+	outer_resume();
+}
+
 static void at91_pm_suspend(suspend_state_t state)
 {
 	unsigned int pm_data = at91_pm_data.memctrl;
+	/*
+	 * In standby the clocks don't change and nothing touches the RAM
+	 * while it is in self-refresh, so the caches can keep their dirty
+	 * lines: skipping the full L1 and L2 clean saves most of the
+	 * suspend and resume time of short standby cycles.
+	 */
+	bool flush = state != PM_SUSPEND_STANDBY || !at91_pm_stats.fast_standby;
 
 	if (state == PM_SUSPEND_MEM) {
 		pm_data |= AT91_PM_MODE(AT91_PM_SLOW_CLOCK);
 		if (at91_pm_data.ulp_mode == ULP1_MODE)
 			pm_data |=  AT91_PM_ULP(AT91_PM_ULP1_MODE);
+
+		if (pm_bu && at91_pm_data.backup) {
+			at91_pm_backup(pm_data);
+			return;
+		}
 	}
 
-	flush_cache_all();
-	outer_disable();
+	if (flush) {
+		flush_cache_all();
+		outer_disable();
+	}
 
 	at91_suspend_sram_fn(pmc, at91_ramc_base[0],
-			     at91_ramc_base[1], pm_data);
+			     at91_ramc_base[1], pm_data, NULL, NULL);
 
-	outer_resume();
+	if (flush)
+		outer_resume();
 }
 
 static int at91_pm_enter(suspend_state_t state)
@@ -214,26 +382,50 @@ error:
 static void at91_pm_end(void)
 {
 	target_state = PM_SUSPEND_ON;
+	at91_pm_stats.resume_us = ktime_us_delta(ktime_get(),
+						 at91_pm_stats.start);
+	at91_pm_stats.count++;
 }
 
 
 static const struct platform_suspend_ops at91_pm_ops = {
 	.valid	= at91_pm_valid_state,
 	.begin	= at91_pm_begin,
+	.prepare_late = at91_pm_prepare_late,
 	.enter	= at91_pm_enter,
+	.wake	= at91_pm_wake,
 	.end	= at91_pm_end,
 };
 
+static void __init at91_pm_debugfs_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("at91_pm", NULL);
+	if (IS_ERR_OR_NULL(root))
+		return;
+
+	debugfs_create_bool("fast_standby", S_IRUGO | S_IWUSR, root,
+			    &at91_pm_stats.fast_standby);
+	debugfs_create_u32("count", S_IRUGO, root, &at91_pm_stats.count);
+	debugfs_create_u32("suspend_us", S_IRUGO, root,
+			   &at91_pm_stats.suspend_us);
+	debugfs_create_u32("resume_us", S_IRUGO, root,
+			   &at91_pm_stats.resume_us);
+	if (pm_bu)
+		debugfs_create_bool("backup", S_IRUGO | S_IWUSR, root,
+				    &at91_pm_data.backup);
+}
+
+static struct at91_cpuidle_data at91_cpuidle_data;
+
 static struct platform_device at91_cpuidle_device = {
 	.name = "cpuidle-at91",
+	.dev = {
+		.platform_data = &at91_cpuidle_data,
+	},
 };
 
-static void at91_pm_set_standby(void (*at91_standby)(void))
-{
-	if (at91_standby)
-		at91_cpuidle_device.dev.platform_data = at91_standby;
-}
-
 /*
  * The AT91RM9200 goes into self-refresh mode with this command, and will
  * terminate self-refresh automatically on the next SDRAM access.
@@ -323,11 +515,43 @@ static void at91sam9_sdram_standby(void)
 		at91_ramc_write(1, AT91_SDRAMC_LPR, saved_lpr1);
 }
 
+/*
+ * Self-refresh exit latencies, in microseconds, include the wakeup from
+ * WFI and the first refresh cycles of the SDRAM (tXSR), DDR2 or LPDDR
+ * (tXSRD, up to 200 memory clocks).  They are conservative figures for
+ * the slowest memory each controller is used with.  The residencies are
+ * the idle times above which the self-refresh power saving outweighs
+ * the cost of the refresh burst on exit.
+ */
+static const struct at91_cpuidle_state at91rm9200_idle = {
+	.standby		= at91rm9200_standby,
+	.exit_latency		= 5,
+	.target_residency	= 500,
+};
+
+static const struct at91_cpuidle_state at91sam9_sdram_idle = {
+	.standby		= at91sam9_sdram_standby,
+	.exit_latency		= 5,
+	.target_residency	= 500,
+};
+
+static const struct at91_cpuidle_state at91sam9g45_ddr_idle = {
+	.standby		= at91_ddr_standby,
+	.exit_latency		= 10,
+	.target_residency	= 2000,
+};
+
+static const struct at91_cpuidle_state sama5d3_ddr_idle = {
+	.standby		= at91_ddr_standby,
+	.exit_latency		= 8,
+	.target_residency	= 1500,
+};
+
 static const struct of_device_id ramc_ids[] __initconst = {
-	{ .compatible = "atmel,at91rm9200-sdramc", .data = at91rm9200_standby },
-	{ .compatible = "atmel,at91sam9260-sdramc", .data = at91sam9_sdram_standby },
-	{ .compatible = "atmel,at91sam9g45-ddramc", .data = at91_ddr_standby },
-	{ .compatible = "atmel,sama5d3-ddramc", .data = at91_ddr_standby },
+	{ .compatible = "atmel,at91rm9200-sdramc", .data = &at91rm9200_idle },
+	{ .compatible = "atmel,at91sam9260-sdramc", .data = &at91sam9_sdram_idle },
+	{ .compatible = "atmel,at91sam9g45-ddramc", .data = &at91sam9g45_ddr_idle },
+	{ .compatible = "atmel,sama5d3-ddramc", .data = &sama5d3_ddr_idle },
 	{ /*sentinel*/ }
 };
 
@@ -336,15 +560,15 @@ static __init void at91_dt_ramc(void)
 	struct device_node *np;
 	const struct of_device_id *of_id;
 	int idx = 0;
-	const void *standby = NULL;
+	const struct at91_cpuidle_state *idle = NULL;
 
 	for_each_matching_node_and_match(np, ramc_ids, &of_id) {
 		at91_ramc_base[idx] = of_iomap(np, 0);
 		if (!at91_ramc_base[idx])
 			panic(pr_fmt("unable to map ramc[%d] cpu registers\n"), idx);
 
-		if (!standby)
-			standby = of_id->data;
+		if (!idle)
+			idle = of_id->data;
 
 		idx++;
 	}
@@ -352,12 +576,12 @@ static __init void at91_dt_ramc(void)
 	if (!idx)
 		panic(pr_fmt("unable to find compatible ram controller node in dtb\n"));
 
-	if (!standby) {
+	if (!idle) {
 		pr_warn("ramc no standby function available\n");
 		return;
 	}
 
-	at91_pm_set_standby(standby);
+	at91_cpuidle_data.sr = *idle;
 }
 
 static void __init at91_pm_sram_init(void)
@@ -365,23 +589,8 @@ static void __init at91_pm_sram_init(void)
 	struct gen_pool *sram_pool;
 	phys_addr_t sram_pbase;
 	unsigned long sram_base;
-	struct device_node *node;
-	struct platform_device *pdev = NULL;
-
-	for_each_compatible_node(node, NULL, "mmio-sram") {
-		pdev = of_find_device_by_node(node);
-		if (pdev) {
-			of_node_put(node);
-			break;
-		}
-	}
-
-	if (!pdev) {
-		pr_warn("%s: failed to find sram device!\n", __func__);
-		return;
-	}
 
-	sram_pool = dev_get_gen_pool(&pdev->dev);
+	sram_pool = atmel_sram_get_pool();
 	if (!sram_pool) {
 		pr_warn("%s: sram pool unavailable!\n", __func__);
 		return;
@@ -509,26 +718,138 @@ static const struct of_device_id atmel_pmc_ids[] = {
 	{ /* sentinel */ },
 };
 
+/*
+ * Standby from SRAM with the master clock on the main clock: PLLA keeps
+ * running, only the bus and peripheral clocks slow down while waiting for
+ * the interrupt, so the wakeup only adds a master clock switch.
+ */
+static void at91_mck_standby(void)
+{
+	at91_suspend_sram_fn(pmc, at91_ramc_base[0], at91_ramc_base[1],
+			     at91_pm_data.memctrl |
+			     AT91_PM_MCK(AT91_PM_MCK_MAIN), NULL, NULL);
+}
+
+/*
+ * Peripherals clocked from MCK, among them the PIT and any TC channel not
+ * on the slow clock, run slower in that state, so it is only used when the
+ * board asks for it, having its clocksource and clockevents on clk32k.
+ */
+static void __init at91_pm_mck_idle_init(struct device_node *pmc_np)
+{
+	if (!at91_suspend_sram_fn || !at91_cpuidle_data.sr.standby ||
+	    !of_property_read_bool(pmc_np, "atmel,idle-mck-main-clock"))
+		return;
+
+	at91_cpuidle_data.mck.standby = at91_mck_standby;
+	at91_cpuidle_data.mck.exit_latency =
+		at91_cpuidle_data.sr.exit_latency + 20;
+	at91_cpuidle_data.mck.target_residency =
+		at91_cpuidle_data.sr.target_residency * 4;
+}
+
+/*
+ * Suspend-to-RAM goes to backup mode when "atmel.pm_backup=1" is given: it
+ * needs a bootloader that knows how to resume the kernel.
+ */
+static int __init at91_pm_backup_setup(char *str)
+{
+	return kstrtou32(str, 0, &at91_pm_data.backup);
+}
+early_param("atmel.pm_backup", at91_pm_backup_setup);
+
+static void __init at91_pm_backup_init(void)
+{
+	struct platform_device *pdev;
+	struct device_node *np;
+	struct gen_pool *sram_pool;
+
+	np = of_find_compatible_node(NULL, NULL, "atmel,sama5d2-sfrbu");
+	if (!np)
+		return;
+
+	sfrbu = of_iomap(np, 0);
+	of_node_put(np);
+	if (!sfrbu) {
+		pr_warn("%s: unable to map sfrbu\n", __func__);
+		return;
+	}
+
+	np = of_find_compatible_node(NULL, NULL, "atmel,sama5d2-shdwc");
+	if (!np)
+		goto unmap_sfrbu;
+
+	shdwc = of_iomap(np, 0);
+	of_node_put(np);
+	if (!shdwc) {
+		pr_warn("%s: unable to map shdwc\n", __func__);
+		goto unmap_sfrbu;
+	}
+
+	np = of_find_compatible_node(NULL, NULL, "atmel,sama5d2-securam");
+	if (!np)
+		goto unmap_shdwc;
+
+	pdev = of_find_device_by_node(np);
+	of_node_put(np);
+	if (!pdev) {
+		pr_warn("%s: securam device not found\n", __func__);
+		goto unmap_shdwc;
+	}
+
+	sram_pool = dev_get_gen_pool(&pdev->dev);
+	put_device(&pdev->dev);
+	if (!sram_pool) {
+		pr_warn("%s: securam pool unavailable!\n", __func__);
+		goto unmap_shdwc;
+	}
+
+	pm_bu = (void *)gen_pool_alloc(sram_pool, sizeof(struct at91_pm_bu));
+	if (!pm_bu) {
+		pr_warn("%s: unable to alloc securam!\n", __func__);
+		goto unmap_shdwc;
+	}
+
+	pm_bu->suspended = 0;
+	pm_bu->canary = virt_to_phys(&at91_pm_bu_canary);
+	pm_bu->resume = virt_to_phys(cpu_resume);
+
+	return;
+
+unmap_shdwc:
+	iounmap(shdwc);
+	shdwc = NULL;
+unmap_sfrbu:
+	iounmap(sfrbu);
+	sfrbu = NULL;
+}
+
 static void __init at91_pm_init(void)
 {
 	struct device_node *pmc_np;
 
-	if (at91_cpuidle_device.dev.platform_data)
-		platform_device_register(&at91_cpuidle_device);
-
 	pmc_np = of_find_matching_node(NULL, atmel_pmc_ids);
 	pmc = of_iomap(pmc_np, 0);
 	if (!pmc) {
 		pr_info("AT91: PM not supported, PMC not found\n");
-		return;
+		goto cpuidle;
 	}
 
 	at91_pm_sram_init();
 
-	if (at91_suspend_sram_fn)
+	if (at91_suspend_sram_fn) {
 		suspend_set_ops(&at91_pm_ops);
-	else
+		at91_pm_debugfs_init();
+	} else
 		pr_info("AT91: PM not supported, due to no SRAM allocated\n");
+
+	at91_pm_mck_idle_init(pmc_np);
+
+cpuidle:
+	if (at91_cpuidle_data.sr.standby)
+		platform_device_register(&at91_cpuidle_device);
+
+	of_node_put(pmc_np);
 }
 
 void __init at91rm9200_pm_init(void)
@@ -567,6 +888,7 @@ void __init at91sam9x5_pm_init(void)
 	at91_dt_ramc();
 	at91_pm_data.uhp_udp_mask = AT91SAM926x_PMC_UHP | AT91SAM926x_PMC_UDP;
 	at91_pm_data.memctrl = AT91_MEMCTRL_DDRSDR;
+	at91_pm_backup_init();
 	at91_pm_init();
 
 	if (readl(pmc + AT91_PMC_VERSION) >= SAMA5D2_PMC_VERSION)
@@ -46,4 +46,26 @@ extern void __iomem *at91_ramc_base[];
 #define AT91_PM_ULP0_MODE	0x00
 #define AT91_PM_ULP1_MODE	0x01
 
+/* standby only: master clock source while waiting for interrupt */
+#define AT91_PM_MCK_OFFSET	7
+#define AT91_PM_MCK_MASK	0x01
+#define AT91_PM_MCK(x)		(((x) & AT91_PM_MCK_MASK) << AT91_PM_MCK_OFFSET)
+
+#define AT91_PM_MCK_MAIN	0x01
+
+/* suspend-to-ram only: power the core down, the DDR stays in self-refresh */
+#define AT91_PM_BACKUP_OFFSET	8
+#define AT91_PM_BACKUP_MASK	0x01
+#define AT91_PM_BACKUP(x)	(((x) & AT91_PM_BACKUP_MASK) << AT91_PM_BACKUP_OFFSET)
+
+#define AT91_PM_BACKUP_MODE	0x01
+
+/* SAMA5D2 Special Function Registers for the backup area */
+#define AT91_SFRBU_DDRBUMCR	0x10			/* DDR BU Mode Control Register */
+#define		AT91_SFRBU_BUMEN	(1 << 0)	/* DDR pads kept in backup mode */
+
+#define AT91_SHDW_CR		0x00			/* Shut Down Control Register */
+#define		AT91_SHDW_SHDW		(1 << 0)	/* Shut Down command */
+#define		AT91_SHDW_KEY		(0xa5 << 24)	/* KEY Password */
+
 #endif
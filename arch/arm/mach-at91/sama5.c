@@ -7,9 +7,16 @@
  * Licensed under GPLv2 or later.
  */
 
+#include <linux/io.h>
+#include <linux/irq.h>
+#include <linux/irqchip.h>
 #include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/of_irq.h>
 #include <linux/of_platform.h>
+#include <linux/platform_device.h>
 
+#include <asm/hardware/cache-l2x0.h>
 #include <asm/mach/arch.h>
 #include <asm/mach/map.h>
 #include <asm/system_misc.h>
@@ -59,6 +66,51 @@ static const struct at91_soc sama5_socs[] = {
 	{ /* sentinel */ },
 };
 
+/*
+ * The overflow interrupt of the Cortex-A5 PMU is peripheral 2 of the AIC on
+ * the SAMA5D2 and SAMA5D4; it is not routed on the SAMA5D3. Without it perf
+ * can only count, so register the PMU here when the device tree doesn't.
+ */
+#define SAMA5_PMU_IRQ	2
+
+static const struct of_device_id sama5_pmu_aic_ids[] __initconst = {
+	{ .compatible = "atmel,sama5d2-aic" },
+	{ .compatible = "atmel,sama5d4-aic" },
+	{ /* sentinel */ },
+};
+
+static void __init sama5_pmu_init(void)
+{
+	struct of_phandle_args irq_data = { };
+	struct device_node *np;
+	unsigned int irq;
+
+	np = of_find_compatible_node(NULL, NULL, "arm,cortex-a5-pmu");
+	if (np) {
+		of_node_put(np);
+		return;
+	}
+
+	np = of_find_matching_node(NULL, sama5_pmu_aic_ids);
+	if (!np)
+		return;
+
+	/* Level high, lowest priority */
+	irq_data.np = np;
+	irq_data.args_count = 3;
+	irq_data.args[0] = SAMA5_PMU_IRQ;
+	irq_data.args[1] = IRQ_TYPE_LEVEL_HIGH;
+	irq_data.args[2] = 0;
+	irq = irq_create_of_mapping(&irq_data);
+	of_node_put(np);
+
+	if (irq) {
+		struct resource res = DEFINE_RES_IRQ(irq);
+
+		platform_device_register_simple("arm-pmu", -1, &res, 1);
+	}
+}
+
 static void __init sama5_dt_device_init(void)
 {
 	struct soc_device *soc;
@@ -70,6 +122,14 @@ static void __init sama5_dt_device_init(void)
 
 	of_platform_populate(NULL, of_default_bus_match_table, NULL, soc_dev);
 	at91sam9x5_pm_init();
+	sama5_pmu_init();
+
+	/*
+	 * The PMC scales the processor clock through PRES and MDIV without
+	 * touching MCK; the OPPs come from the cpu node.
+	 */
+	if (IS_ENABLED(CONFIG_CPUFREQ_DT))
+		platform_device_register_simple("cpufreq-dt", -1, NULL, 0);
 }
 
 static const char *sama5_dt_board_compat[] __initconst = {
@@ -83,6 +143,53 @@ DT_MACHINE_START(sama5_dt, "Atmel SAMA5")
 	.dt_compat	= sama5_dt_board_compat,
 MACHINE_END
 
+/*
+ * Default L2C-310 prefetching, for the streaming accesses of memcpy and
+ * the video and network DMA buffers: double linefills, prefetch hints
+ * dropped under load, instruction and data prefetch 8 lines ahead.  The
+ * L2C driver reads them back before the DT overrides (arm,double-linefill,
+ * arm,prefetch-offset, prefetch-data, ...) are applied.  The controller
+ * is r3p2 or later, so erratum 752271 does not apply.
+ */
+#define SAMA5_L2C_PREFETCH	(L310_PREFETCH_CTRL_DBL_LINEFILL | \
+				 L310_PREFETCH_CTRL_DBL_LINEFILL_INCR | \
+				 L310_PREFETCH_CTRL_PREFETCH_DROP | \
+				 L310_PREFETCH_CTRL_DATA_PREFETCH | \
+				 L310_PREFETCH_CTRL_INSTR_PREFETCH | 7)
+
+static void __init sama5_l2c_init(void)
+{
+	struct device_node *np;
+	void __iomem *base;
+	u32 val;
+
+	np = of_find_compatible_node(NULL, NULL, "arm,pl310-cache");
+	if (!np)
+		return;
+
+	base = of_iomap(np, 0);
+	of_node_put(np);
+	if (!base)
+		return;
+
+	/* Only writable before the cache is enabled */
+	if (!(readl_relaxed(base + L2X0_CTRL) & L2X0_CTRL_EN)) {
+		val = readl_relaxed(base + L310_PREFETCH_CTRL);
+		val &= ~L310_PREFETCH_CTRL_OFFSET_MASK;
+		writel_relaxed(val | SAMA5_L2C_PREFETCH,
+			       base + L310_PREFETCH_CTRL);
+	}
+
+	iounmap(base);
+}
+
+static void __init sama5_alt_init_irq(void)
+{
+	if (IS_ENABLED(CONFIG_CACHE_L2X0))
+		sama5_l2c_init();
+	irqchip_init();
+}
+
 static const char *sama5_alt_dt_board_compat[] __initconst = {
 	"atmel,sama5d2",
 	"atmel,sama5d4",
@@ -91,6 +198,7 @@ static const char *sama5_alt_dt_board_compat[] __initconst = {
 
 DT_MACHINE_START(sama5_alt_dt, "Atmel SAMA5")
 	/* Maintainer: Atmel */
+	.init_irq	= sama5_alt_init_irq,
 	.init_machine	= sama5_dt_device_init,
 	.dt_compat	= sama5_alt_dt_board_compat,
 	.l2c_aux_mask	= ~0UL,
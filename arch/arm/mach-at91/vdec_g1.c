@@ -29,46 +29,38 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
 
 #include "hx170dec.h"
 #include "at91_vdec.h"
+#include "vdec_g1.h"
+
+#define VDEC_MAX_JOBS                 16 /* jobs in flight per open file */
+#define VDEC_JOB_TIMEOUT_MS          500
 
-#define VDEC_MAX_CORES                 1 /* number of cores of the hardware IP */
-#define VDEC_NUM_REGS_DEC             60 /* number of registers of the Decoder part */
-#define VDEC_NUM_REGS_PP              41 /* number of registers of the Post Processor part */
-#define VDEC_DEC_FIRST_REG             0 /* first register (0-based) index */
-#define VDEC_DEC_LAST_REG             59 /* last register (0-based) index */
-#define VDEC_PP_FIRST_REG             60
-#define VDEC_PP_LAST_REG             100
-
-struct vdec_device {
-	void __iomem *mmio_base;
-	struct clk *clk;
-	struct device *dev;
-	int irq;
-	int num_cores;
-	unsigned long iobaseaddr;
-	unsigned long iosize;
-	wait_queue_head_t dec_wq;
-	wait_queue_head_t pp_wq;
-	bool dec_irq_done;
-	bool pp_irq_done;
-	struct semaphore dec_sem;
-	struct semaphore pp_sem;
-	struct file *dec_owner;
-	struct file *pp_owner;
-	u32 regs[VDEC_NUM_REGS_DEC + VDEC_NUM_REGS_PP];
-};
 static struct vdec_device *vdec6731_global;
 
-static inline void vdec_writel(const struct vdec_device *p, unsigned offset, u32 val)
-{
-	writel(val, p->mmio_base + offset);
-}
+struct vdec_file {
+	struct vdec_device *p;
+	struct list_head sched;      /* in vdec_device.job_sched while jobs are pending */
+	struct list_head pending;
+	struct list_head done;
+	int jobs;                    /* submitted and not read back yet */
+	wait_queue_head_t wq;
+};
+
+struct vdec_job {
+	struct list_head node;
+	struct vdec_file *vf;
+	bool orphan;                 /* the file is being closed */
+	bool pipe;                   /* HX170DEC_IOCS_PIPE_SUBMIT */
+	struct hx170dec_pipe_job desc;
+};
 
-static inline u32 vdec_readl(const struct vdec_device *p, unsigned offset)
+static size_t vdec_job_size(const struct vdec_job *job)
 {
-	return readl(p->mmio_base + offset);
+	return job->pipe ? sizeof(job->desc) : sizeof(job->desc.dec);
 }
 
 /**
@@ -112,14 +104,333 @@ static int vdec_regs_read(struct vdec_device *p, int begin, int end,
 	return 0;
 }
 
+/**
+ * Job queue
+ *
+ * Files with pending jobs are served round robin, one job at a time. The
+ * queue holds dec_sem from the first submitted job until it runs empty,
+ * which keeps the legacy reserve/push/wait users and the V4L2 interface
+ * away in the meantime. The same goes for pp_sem from the first pipelined
+ * job on.
+ */
+
+/* Called with job_lock held */
+static void vdec_job_run_next(struct vdec_device *p)
+{
+	struct vdec_file *vf;
+	struct vdec_job *job;
+	int i;
+
+	if (p->cur_job)
+		return;
+
+	if (list_empty(&p->job_sched)) {
+		p->jobs_hw = false;
+		if (p->jobs_pp) {
+			p->jobs_pp = false;
+			up(&p->pp_sem);
+		}
+		up(&p->dec_sem);
+		return;
+	}
+
+	vf = list_first_entry(&p->job_sched, struct vdec_file, sched);
+	job = list_first_entry(&vf->pending, struct vdec_job, node);
+	list_del(&job->node);
+	if (list_empty(&vf->pending))
+		list_del_init(&vf->sched);
+	else
+		list_move_tail(&vf->sched, &p->job_sched);
+
+	p->cur_job = job;
+
+	/*
+	 * The PP goes first, waiting for the decoder output. Its interrupt
+	 * is masked: the decoder one signals the end of both.
+	 */
+	if (job->pipe) {
+		for (i = VDEC_PP_LAST_REG - 5; i > VDEC_PP_FIRST_REG; i--)
+			vdec_writel(p, 4 * i,
+				    job->desc.pp_regs[i - VDEC_PP_FIRST_REG]);
+		vdec_writel(p, VDEC_PPIR,
+			    (job->desc.pp_regs[0] & ~VDEC_PPIR_ISET) |
+			    VDEC_PPIR_PPE | VDEC_PPIR_PIPEN | VDEC_PPIR_ID);
+	}
+
+	/* Skip VDEC_IDR, the Interrupt Register goes last */
+	for (i = VDEC_DEC_LAST_REG; i > VDEC_DEC_FIRST_REG; i--)
+		vdec_writel(p, 4 * i, job->desc.dec.regs[i]);
+}
+
+/* Called with job_lock held */
+static void vdec_job_complete(struct vdec_device *p)
+{
+	struct vdec_job *job = p->cur_job;
+	int i;
+
+	for (i = VDEC_DEC_LAST_REG; i >= VDEC_DEC_FIRST_REG; i--)
+		job->desc.dec.regs[i] = vdec_readl(p, 4 * i);
+
+	if (job->pipe) {
+		for (i = VDEC_PP_LAST_REG; i >= VDEC_PP_FIRST_REG; i--)
+			job->desc.pp_regs[i - VDEC_PP_FIRST_REG] =
+				vdec_readl(p, 4 * i);
+		/* Back to standalone mode, also stops the PP on timeout */
+		vdec_writel(p, VDEC_PPIR, VDEC_PPIR_ID);
+	}
+
+	p->cur_job = NULL;
+	if (job->orphan) {
+		wake_up(&job->vf->wq);
+		kfree(job);
+	} else {
+		list_add_tail(&job->node, &job->vf->done);
+		wake_up_interruptible(&job->vf->wq);
+	}
+
+	vdec_job_run_next(p);
+}
+
+static bool vdec_job_irq(struct vdec_device *p)
+{
+	bool handled = false;
+
+	spin_lock(&p->job_lock);
+	if (p->cur_job) {
+		vdec_job_complete(p);
+		handled = true;
+	}
+	spin_unlock(&p->job_lock);
+
+	return handled;
+}
+
+/* Called with job_lock held, when a job didn't make it to the queue */
+static void vdec_job_put_pp(struct vdec_device *p)
+{
+	if (p->jobs_pp && !p->jobs_hw) {
+		p->jobs_pp = false;
+		up(&p->pp_sem);
+	}
+}
+
+static int vdec_job_submit(struct vdec_file *vf, const void __user *argp,
+			   bool pipe)
+{
+	struct vdec_device *p = vf->p;
+	struct vdec_job *job;
+	bool busy;
+	int ret;
+
+	job = kmalloc(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	job->pipe = pipe;
+	if (copy_from_user(&job->desc, argp, vdec_job_size(job))) {
+		kfree(job);
+		return -EFAULT;
+	}
+	job->vf = vf;
+	job->orphan = false;
+
+	mutex_lock(&p->job_mutex);
+
+	/*
+	 * Only this function sets jobs_pp, under job_mutex, and the queue
+	 * can't release pp_sem before the job is in.
+	 */
+	spin_lock_irq(&p->job_lock);
+	if (pipe && !p->jobs_pp) {
+		spin_unlock_irq(&p->job_lock);
+		ret = down_interruptible(&p->pp_sem);
+		if (ret)
+			goto err_free;
+		spin_lock_irq(&p->job_lock);
+		p->jobs_pp = true;
+	}
+
+	if (vf->jobs >= VDEC_MAX_JOBS) {
+		vdec_job_put_pp(p);
+		spin_unlock_irq(&p->job_lock);
+		ret = -EBUSY;
+		goto err_free;
+	}
+	vf->jobs++;
+	list_add_tail(&job->node, &vf->pending);
+	if (list_empty(&vf->sched))
+		list_add_tail(&vf->sched, &p->job_sched);
+	busy = p->jobs_hw;
+	spin_unlock_irq(&p->job_lock);
+
+	/* Already running: the interrupt handler gets to this job */
+	if (busy) {
+		mutex_unlock(&p->job_mutex);
+		return 0;
+	}
+
+	ret = down_interruptible(&p->dec_sem);
+	spin_lock_irq(&p->job_lock);
+	if (ret) {
+		list_del(&job->node);
+		if (list_empty(&vf->pending))
+			list_del_init(&vf->sched);
+		vf->jobs--;
+		vdec_job_put_pp(p);
+		spin_unlock_irq(&p->job_lock);
+		goto err_free;
+	}
+	p->jobs_hw = true;
+	vdec_job_run_next(p);
+	spin_unlock_irq(&p->job_lock);
+
+	mutex_unlock(&p->job_mutex);
+	return 0;
+
+err_free:
+	mutex_unlock(&p->job_mutex);
+	kfree(job);
+	return ret;
+}
+
+static bool vdec_job_running(struct vdec_file *vf)
+{
+	struct vdec_device *p = vf->p;
+	bool running;
+
+	spin_lock_irq(&p->job_lock);
+	running = p->cur_job && p->cur_job->vf == vf;
+	spin_unlock_irq(&p->job_lock);
+
+	return running;
+}
+
+static void vdec_job_release(struct vdec_file *vf)
+{
+	struct vdec_device *p = vf->p;
+	struct vdec_job *job, *tmp;
+	bool running;
+
+	spin_lock_irq(&p->job_lock);
+	list_for_each_entry_safe(job, tmp, &vf->pending, node) {
+		list_del(&job->node);
+		kfree(job);
+	}
+	list_del_init(&vf->sched);
+	running = p->cur_job && p->cur_job->vf == vf;
+	if (running)
+		p->cur_job->orphan = true;
+	spin_unlock_irq(&p->job_lock);
+
+	/* The clock may go away with this file, let the decoder finish */
+	if (running && !wait_event_timeout(vf->wq, !vdec_job_running(vf),
+				msecs_to_jiffies(VDEC_JOB_TIMEOUT_MS))) {
+		spin_lock_irq(&p->job_lock);
+		if (p->cur_job && p->cur_job->vf == vf) {
+			dev_warn(p->dev, "decoder timeout, resetting\n");
+			vdec_writel(p, VDEC_DIR, VDEC_DIR_ID | VDEC_DIR_ABORT);
+			vdec_job_complete(p);
+		}
+		spin_unlock_irq(&p->job_lock);
+	}
+
+	list_for_each_entry_safe(job, tmp, &vf->done, node) {
+		list_del(&job->node);
+		kfree(job);
+	}
+}
+
 /**
  * Misc driver related
  */
 
+static ssize_t vdec_misc_read(struct file *filp, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct vdec_file *vf = filp->private_data;
+	struct vdec_device *p = vf->p;
+	struct vdec_job *job;
+	ssize_t done = 0;
+	size_t size;
+	int ret;
+
+	if (count < sizeof(job->desc.dec))
+		return -EINVAL;
+
+	while (count - done >= sizeof(job->desc.dec)) {
+		spin_lock_irq(&p->job_lock);
+		job = list_first_entry_or_null(&vf->done, struct vdec_job, node);
+		if (job) {
+			size = vdec_job_size(job);
+			if (count - done < size) {
+				spin_unlock_irq(&p->job_lock);
+				return done ? done : -EINVAL;
+			}
+			list_del(&job->node);
+		}
+		spin_unlock_irq(&p->job_lock);
+
+		if (!job) {
+			if (done)
+				break;
+			if (filp->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(vf->wq,
+						       !list_empty(&vf->done));
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		ret = copy_to_user(buf + done, &job->desc, size);
+		spin_lock_irq(&p->job_lock);
+		if (ret)
+			list_add(&job->node, &vf->done);
+		else
+			vf->jobs--;
+		spin_unlock_irq(&p->job_lock);
+		if (ret)
+			return done ? done : -EFAULT;
+
+		kfree(job);
+		done += size;
+	}
+
+	return done;
+}
+
+static unsigned int vdec_misc_poll(struct file *filp, poll_table *wait)
+{
+	struct vdec_file *vf = filp->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &vf->wq, wait);
+
+	spin_lock_irq(&vf->p->job_lock);
+	if (!list_empty(&vf->done))
+		mask |= POLLIN | POLLRDNORM;
+	if (vf->jobs < VDEC_MAX_JOBS)
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irq(&vf->p->job_lock);
+
+	return mask;
+}
+
 static int vdec_misc_open(struct inode *inode, struct file *filp)
 {
 	struct vdec_device *p = vdec6731_global;
-	filp->private_data = p;
+	struct vdec_file *vf;
+
+	vf = kzalloc(sizeof(*vf), GFP_KERNEL);
+	if (!vf)
+		return -ENOMEM;
+
+	vf->p = p;
+	INIT_LIST_HEAD(&vf->sched);
+	INIT_LIST_HEAD(&vf->pending);
+	INIT_LIST_HEAD(&vf->done);
+	init_waitqueue_head(&vf->wq);
+	filp->private_data = vf;
 
 	dev_dbg(p->dev, "open\n");
 	clk_prepare_enable(p->clk);
@@ -128,7 +439,11 @@ static int vdec_misc_open(struct inode *inode, struct file *filp)
 
 static int vdec_misc_release(struct inode *inode, struct file *filp)
 {
-	struct vdec_device *p = filp->private_data;
+	struct vdec_file *vf = filp->private_data;
+	struct vdec_device *p = vf->p;
+
+	vdec_job_release(vf);
+	kfree(vf);
 
 	if (p->dec_owner == filp) {
 		p->dec_irq_done = false;
@@ -217,6 +532,13 @@ static long vdec_misc_ioctl(struct file *filp, unsigned int cmd,
 			}
 			break;
 
+		case HX170DEC_IOCS_DEC_SUBMIT:
+			ret = vdec_job_submit(filp->private_data, argp, false);
+			break;
+		case HX170DEC_IOCS_PIPE_SUBMIT:
+			ret = vdec_job_submit(filp->private_data, argp, true);
+			break;
+
 		case HX170DEC_IOCX_DEC_WAIT:
 			if (copy_from_user(&core, (void *)arg, sizeof(struct core_desc))) {
 				dev_err(p->dev, "copy_from_user (dec wait) failed\n");
@@ -290,6 +612,8 @@ static long vdec_misc_ioctl(struct file *filp, unsigned int cmd,
 const struct file_operations vdec_misc_fops = {
 	.owner          =	THIS_MODULE,
 	.llseek         =	no_llseek,
+	.read           =	vdec_misc_read,
+	.poll           =	vdec_misc_poll,
 	.open           =	vdec_misc_open,
 	.release        =	vdec_misc_release,
 	.unlocked_ioctl =	vdec_misc_ioctl,
@@ -313,13 +637,23 @@ static irqreturn_t vdec_isr(int irq, void *dev_id)
 	int handled = 0;
 
 	/* interrupt status register read */
+	irq_status_pp = vdec_readl(p, VDEC_PPIR);
 	irq_status_dec = vdec_readl(p, VDEC_DIR);
 	if (irq_status_dec & VDEC_DIR_ISET) {
 		/* Clear IRQ */
 		vdec_writel(p, VDEC_DIR, irq_status_dec & ~VDEC_DIR_ISET);
 
-		p->dec_irq_done = true;
-		wake_up_interruptible(&p->dec_wq);
+		/* Queued jobs complete (and chain) there */
+		if (!vdec_job_irq(p) && !vdec_m2m_irq(p, irq_status_dec)) {
+			p->dec_irq_done = true;
+			wake_up_interruptible(&p->dec_wq);
+
+			/* Pipeline mode: the PP is done with the decoder */
+			if (irq_status_pp & VDEC_PPIR_PIPEN) {
+				p->pp_irq_done = true;
+				wake_up_interruptible(&p->pp_wq);
+			}
+		}
 		handled++;
 	}
 
@@ -403,6 +737,9 @@ static int __init vdec_probe(struct platform_device *pdev)
 	init_waitqueue_head(&p->pp_wq);
 	sema_init(&p->dec_sem, VDEC_MAX_CORES);
 	sema_init(&p->pp_sem, 1);
+	spin_lock_init(&p->job_lock);
+	mutex_init(&p->job_mutex);
+	INIT_LIST_HEAD(&p->job_sched);
 
 	ret = clk_prepare_enable(p->clk);
 	if (ret) {
@@ -421,6 +758,13 @@ static int __init vdec_probe(struct platform_device *pdev)
 	hwid = vdec_readl(p, VDEC_IDR);
 	clk_disable_unprepare(p->clk);
 
+	ret = vdec_m2m_init(p);
+	if (ret) {
+		dev_err(&pdev->dev, "unable to register the V4L2 interface\n");
+		misc_deregister(&vdec_misc_device);
+		return ret;
+	}
+
 	dev_warn(&pdev->dev, "Product ID: %#x (revision %d.%d.%d)\n", \
 			(hwid & VDEC_IDR_PROD_ID) >> 16,
 			(hwid & VDEC_IDR_MAJOR_VER) >> 12,
@@ -431,6 +775,9 @@ static int __init vdec_probe(struct platform_device *pdev)
 
 static int __exit vdec_remove(struct platform_device *pdev)
 {
+	struct vdec_device *p = platform_get_drvdata(pdev);
+
+	vdec_m2m_exit(p);
 	platform_set_drvdata(pdev, NULL);
 	misc_deregister(&vdec_misc_device);
 	return 0;
@@ -0,0 +1,97 @@
+/*
+ * On2/Hantro G1 decoder/pp driver (internal definitions).
+ *
+ * Copyright (C) 2009  Hantro Products Oy.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _VDEC_G1_H_
+#define _VDEC_G1_H_
+
+#include <linux/io.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define VDEC_MAX_CORES                 1 /* number of cores of the hardware IP */
+#define VDEC_NUM_REGS_DEC             60 /* number of registers of the Decoder part */
+#define VDEC_NUM_REGS_PP              41 /* number of registers of the Post Processor part */
+#define VDEC_DEC_FIRST_REG             0 /* first register (0-based) index */
+#define VDEC_DEC_LAST_REG             59 /* last register (0-based) index */
+#define VDEC_PP_FIRST_REG             60
+#define VDEC_PP_LAST_REG             100
+
+struct vdec_m2m;
+struct vdec_job;
+
+struct vdec_device {
+	void __iomem *mmio_base;
+	struct clk *clk;
+	struct device *dev;
+	int irq;
+	int num_cores;
+	unsigned long iobaseaddr;
+	unsigned long iosize;
+	wait_queue_head_t dec_wq;
+	wait_queue_head_t pp_wq;
+	bool dec_irq_done;
+	bool pp_irq_done;
+	struct semaphore dec_sem;
+	struct semaphore pp_sem;
+	struct file *dec_owner;
+	struct file *pp_owner;
+	u32 regs[VDEC_NUM_REGS_DEC + VDEC_NUM_REGS_PP];
+
+	/* Job queue, see HX170DEC_IOCS_DEC_SUBMIT */
+	spinlock_t job_lock;
+	struct mutex job_mutex;
+	struct list_head job_sched;
+	struct vdec_job *cur_job;
+	bool jobs_hw;
+	bool jobs_pp;                  /* the queue holds pp_sem too */
+
+	struct vdec_m2m *m2m;
+};
+
+static inline void vdec_writel(const struct vdec_device *p, unsigned offset, u32 val)
+{
+	writel(val, p->mmio_base + offset);
+}
+
+static inline u32 vdec_readl(const struct vdec_device *p, unsigned offset)
+{
+	return readl(p->mmio_base + offset);
+}
+
+#ifdef CONFIG_AT91_VDEC_G1_M2M
+int vdec_m2m_init(struct vdec_device *p);
+void vdec_m2m_exit(struct vdec_device *p);
+bool vdec_m2m_irq(struct vdec_device *p, u32 status);
+#else
+static inline int vdec_m2m_init(struct vdec_device *p)
+{
+	return 0;
+}
+
+static inline void vdec_m2m_exit(struct vdec_device *p)
+{
+}
+
+static inline bool vdec_m2m_irq(struct vdec_device *p, u32 status)
+{
+	return false;
+}
+#endif
+
+#endif /* !_VDEC_G1_H_ */
@@ -0,0 +1,816 @@
+/*
+ * On2/Hantro G1 decoder driver, V4L2 mem2mem interface.
+ *
+ * The decoder is driven in a stateless way: userspace parses the bitstream
+ * and provides the register set of each frame through a control, which is
+ * latched into the OUTPUT buffer when it is queued. The driver only fills
+ * in the buffer addresses, so both OUTPUT and CAPTURE buffers may be
+ * imported dma-bufs. Jobs are chained from the interrupt handler, which
+ * keeps the decoder busy as long as frames are queued.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <linux/clk.h>
+#include <linux/device.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-device.h>
+#include <media/v4l2-event.h>
+#include <media/v4l2-ioctl.h>
+#include <media/v4l2-mem2mem.h>
+#include <media/videobuf2-dma-contig.h>
+
+#include "hx170dec.h"
+#include "at91_vdec.h"
+#include "vdec_g1.h"
+
+#define VDEC_M2M_NAME		"vdec_g1"
+
+#define VDEC_M2M_MIN_WIDTH	48
+#define VDEC_M2M_MIN_HEIGHT	48
+#define VDEC_M2M_MAX_WIDTH	1920
+#define VDEC_M2M_MAX_HEIGHT	1088
+#define VDEC_M2M_DEF_WIDTH	1280
+#define VDEC_M2M_DEF_HEIGHT	720
+
+/* How long stop_streaming() waits for the frame being decoded */
+#define VDEC_M2M_TIMEOUT_MS	500
+
+#define VDEC_M2M_NO_REF		0xff
+
+struct vdec_m2m_fmt {
+	u32 fourcc;
+	const char *name;
+};
+
+/* The decoding mode itself is part of the register set */
+static const struct vdec_m2m_fmt vdec_m2m_src_fmts[] = {
+	{ V4L2_PIX_FMT_H264, "H.264" },
+	{ V4L2_PIX_FMT_MPEG4, "MPEG-4 part 2" },
+	{ V4L2_PIX_FMT_H263, "H.263" },
+	{ V4L2_PIX_FMT_MPEG2, "MPEG-2" },
+	{ V4L2_PIX_FMT_VP8, "VP8" },
+	{ V4L2_PIX_FMT_JPEG, "JPEG" },
+};
+
+static const struct vdec_m2m_fmt vdec_m2m_dst_fmt = {
+	V4L2_PIX_FMT_NV12, "Y/CbCr 4:2:0",
+};
+
+struct vdec_m2m {
+	struct vdec_device *vdec;
+	struct v4l2_device v4l2_dev;
+	struct video_device vfd;
+	struct v4l2_m2m_dev *m2m_dev;
+	void *alloc_ctx;
+
+	/* Serializes the ioctls and the vb2 queues */
+	struct mutex mutex;
+
+	/* Protects curr, which is only set while the decoder runs a job */
+	spinlock_t lock;
+	struct vdec_m2m_ctx *curr;
+	wait_queue_head_t job_wq;
+
+	/* Streaming queues, they hold the decoder against the misc device */
+	int users;
+};
+
+struct vdec_m2m_ctx {
+	struct v4l2_fh fh;
+	struct vdec_m2m *m2m;
+
+	struct v4l2_ctrl_handler hdl;
+	struct v4l2_ctrl *regs;
+	struct v4l2_ctrl *refs;
+
+	const struct vdec_m2m_fmt *src_fmt;
+	struct v4l2_pix_format src;
+	struct v4l2_pix_format dst;
+};
+
+/*
+ * Keeping the register set in the buffer lets userspace queue several
+ * frames ahead, each with its own parameters.
+ */
+struct vdec_m2m_buf {
+	struct v4l2_m2m_buffer mb;
+	u32 regs[VDEC_NUM_REGS_DEC];
+	u8 refs[VDEC_NUM_REFS];
+};
+
+static inline struct vdec_m2m_ctx *file_to_ctx(struct file *file)
+{
+	return container_of(file->private_data, struct vdec_m2m_ctx, fh);
+}
+
+static inline struct vdec_m2m_buf *vb_to_buf(struct vb2_buffer *vb)
+{
+	return container_of(vb, struct vdec_m2m_buf, mb.vb);
+}
+
+static const struct v4l2_ctrl_config vdec_m2m_regs_ctrl = {
+	.id = V4L2_CID_VDEC_G1_DEC_REGS,
+	.name = "G1 Decoder Registers",
+	.type = V4L2_CTRL_TYPE_U32,
+	.min = 0,
+	.max = 0xffffffff,
+	.step = 1,
+	.def = 0,
+	.dims = { VDEC_NUM_REGS_DEC },
+};
+
+static const struct v4l2_ctrl_config vdec_m2m_refs_ctrl = {
+	.id = V4L2_CID_VDEC_G1_REF_BUFS,
+	.name = "G1 Reference Buffers",
+	.type = V4L2_CTRL_TYPE_U8,
+	.min = 0,
+	.max = VDEC_M2M_NO_REF,
+	.step = 1,
+	.def = VDEC_M2M_NO_REF,
+	.dims = { VDEC_NUM_REFS },
+};
+
+/*
+ * Job handling
+ */
+
+static void vdec_m2m_job_done(struct vdec_m2m *m2m, struct vdec_m2m_ctx *ctx,
+			      enum vb2_buffer_state state)
+{
+	struct vb2_buffer *src, *dst;
+	unsigned long flags;
+
+	spin_lock_irqsave(&m2m->lock, flags);
+	if (m2m->curr != ctx) {
+		spin_unlock_irqrestore(&m2m->lock, flags);
+		return;
+	}
+	m2m->curr = NULL;
+	spin_unlock_irqrestore(&m2m->lock, flags);
+
+	src = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
+	dst = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
+	v4l2_m2m_buf_done(src, state);
+	v4l2_m2m_buf_done(dst, state);
+	wake_up(&m2m->job_wq);
+
+	/* Starts the next job right away, from the IRQ handler if needed */
+	v4l2_m2m_job_finish(m2m->m2m_dev, ctx->fh.m2m_ctx);
+}
+
+bool vdec_m2m_irq(struct vdec_device *p, u32 status)
+{
+	struct vdec_m2m *m2m = p->m2m;
+	struct vdec_m2m_ctx *ctx;
+
+	if (!m2m)
+		return false;
+
+	spin_lock(&m2m->lock);
+	ctx = m2m->curr;
+	spin_unlock(&m2m->lock);
+	if (!ctx)
+		return false;
+
+	if (!(status & VDEC_DIR_RDY))
+		dev_dbg(p->dev, "decoding error (DIR=%08x)\n", status);
+
+	vdec_m2m_job_done(m2m, ctx, status & VDEC_DIR_RDY ?
+			  VB2_BUF_STATE_DONE : VB2_BUF_STATE_ERROR);
+	return true;
+}
+
+static void vdec_m2m_device_run(void *priv)
+{
+	struct vdec_m2m_ctx *ctx = priv;
+	struct vdec_m2m *m2m = ctx->m2m;
+	struct vdec_device *p = m2m->vdec;
+	struct vb2_queue *cap_q;
+	struct vb2_buffer *src, *dst;
+	struct vdec_m2m_buf *buf;
+	unsigned long flags;
+	int i;
+
+	src = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+	dst = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	buf = vb_to_buf(src);
+	cap_q = v4l2_m2m_get_vq(ctx->fh.m2m_ctx, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+
+	dst->v4l2_buf.timestamp = src->v4l2_buf.timestamp;
+	dst->v4l2_buf.timecode = src->v4l2_buf.timecode;
+	dst->v4l2_buf.flags &= ~V4L2_BUF_FLAG_TSTAMP_SRC_MASK;
+	dst->v4l2_buf.flags |= src->v4l2_buf.flags &
+			       (V4L2_BUF_FLAG_TIMECODE |
+				V4L2_BUF_FLAG_TSTAMP_SRC_MASK);
+	vb2_set_plane_payload(dst, 0, ctx->dst.sizeimage);
+
+	buf->regs[VDEC_STR / 4] = vb2_dma_contig_plane_dma_addr(src, 0);
+	buf->regs[VDEC_DST / 4] = vb2_dma_contig_plane_dma_addr(dst, 0);
+	for (i = 0; i < VDEC_NUM_REFS; i++) {
+		u32 *reg = &buf->regs[VDEC_REF(i) / 4];
+		struct vb2_buffer *ref;
+
+		/* Checked against num_buffers when the buffer was queued */
+		if (buf->refs[i] == VDEC_M2M_NO_REF ||
+		    buf->refs[i] >= cap_q->num_buffers)
+			continue;
+
+		ref = cap_q->bufs[buf->refs[i]];
+		*reg = vb2_dma_contig_plane_dma_addr(ref, 0) |
+		       (*reg & VDEC_REF_FLAGS);
+	}
+
+	spin_lock_irqsave(&m2m->lock, flags);
+	m2m->curr = ctx;
+	spin_unlock_irqrestore(&m2m->lock, flags);
+
+	/* The Interrupt Register goes last, it starts the decoder */
+	for (i = VDEC_DEC_LAST_REG; i > VDEC_DIR / 4; i--)
+		vdec_writel(p, 4 * i, buf->regs[i]);
+	vdec_writel(p, VDEC_DIR, (buf->regs[VDEC_DIR / 4] | VDEC_DIR_DE) &
+		    ~(VDEC_DIR_ID | VDEC_DIR_ABORT | VDEC_DIR_ISET));
+}
+
+static void vdec_m2m_job_abort(void *priv)
+{
+	/*
+	 * Nothing to do: the decoder can't be stopped in the middle of a
+	 * frame, stop_streaming() waits for it to complete.
+	 */
+}
+
+static struct v4l2_m2m_ops vdec_m2m_ops = {
+	.device_run	= vdec_m2m_device_run,
+	.job_abort	= vdec_m2m_job_abort,
+};
+
+/*
+ * The decoder is shared with the misc device: the first streaming queue
+ * reserves it as a HX170DEC_IOCH_DEC_RESERVE would, the last one releases
+ * it.
+ */
+static int vdec_m2m_get_hw(struct vdec_m2m *m2m)
+{
+	struct vdec_device *p = m2m->vdec;
+	int ret;
+
+	if (m2m->users++)
+		return 0;
+
+	if (down_trylock(&p->dec_sem)) {
+		ret = -EBUSY;
+		goto err;
+	}
+
+	ret = clk_prepare_enable(p->clk);
+	if (ret) {
+		up(&p->dec_sem);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	m2m->users--;
+	return ret;
+}
+
+static void vdec_m2m_put_hw(struct vdec_m2m *m2m)
+{
+	struct vdec_device *p = m2m->vdec;
+
+	if (--m2m->users)
+		return;
+
+	clk_disable_unprepare(p->clk);
+	up(&p->dec_sem);
+}
+
+/*
+ * Queue operations
+ */
+
+static int vdec_m2m_queue_setup(struct vb2_queue *vq,
+				const struct v4l2_format *fmt,
+				unsigned int *nbuffers, unsigned int *nplanes,
+				unsigned int sizes[], void *alloc_ctxs[])
+{
+	struct vdec_m2m_ctx *ctx = vb2_get_drv_priv(vq);
+	unsigned int size;
+
+	if (V4L2_TYPE_IS_OUTPUT(vq->type))
+		size = ctx->src.sizeimage;
+	else
+		size = ctx->dst.sizeimage;
+
+	if (fmt && fmt->fmt.pix.sizeimage < size)
+		return -EINVAL;
+
+	*nplanes = 1;
+	sizes[0] = fmt ? fmt->fmt.pix.sizeimage : size;
+	alloc_ctxs[0] = ctx->m2m->alloc_ctx;
+
+	return 0;
+}
+
+static int vdec_m2m_buf_prepare(struct vb2_buffer *vb)
+{
+	struct vdec_m2m_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+	struct vdec_m2m_buf *buf = vb_to_buf(vb);
+	struct vb2_queue *cap_q;
+	int i;
+
+	if (!V4L2_TYPE_IS_OUTPUT(vb->vb2_queue->type)) {
+		if (vb2_plane_size(vb, 0) < ctx->dst.sizeimage)
+			return -EINVAL;
+
+		vb2_set_plane_payload(vb, 0, ctx->dst.sizeimage);
+		return 0;
+	}
+
+	if (!vb2_get_plane_payload(vb, 0))
+		return -EINVAL;
+
+	/* Latch the parameters of this frame */
+	v4l2_ctrl_lock(ctx->regs);
+	memcpy(buf->regs, ctx->regs->p_cur.p_u32, sizeof(buf->regs));
+	memcpy(buf->refs, ctx->refs->p_cur.p_u8, sizeof(buf->refs));
+	v4l2_ctrl_unlock(ctx->regs);
+
+	cap_q = v4l2_m2m_get_vq(ctx->fh.m2m_ctx, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+	for (i = 0; i < VDEC_NUM_REFS; i++) {
+		if (buf->refs[i] != VDEC_M2M_NO_REF &&
+		    buf->refs[i] >= cap_q->num_buffers)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void vdec_m2m_buf_queue(struct vb2_buffer *vb)
+{
+	struct vdec_m2m_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+
+	v4l2_m2m_buf_queue(ctx->fh.m2m_ctx, vb);
+}
+
+static int vdec_m2m_start_streaming(struct vb2_queue *q, unsigned count)
+{
+	struct vdec_m2m_ctx *ctx = vb2_get_drv_priv(q);
+	struct vb2_buffer *vb;
+	int ret;
+
+	ret = vdec_m2m_get_hw(ctx->m2m);
+	if (!ret)
+		return 0;
+
+	/* Give the buffers back as the queue is not started */
+	for (;;) {
+		if (V4L2_TYPE_IS_OUTPUT(q->type))
+			vb = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
+		else
+			vb = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
+		if (!vb)
+			break;
+		v4l2_m2m_buf_done(vb, VB2_BUF_STATE_QUEUED);
+	}
+
+	return ret;
+}
+
+static bool vdec_m2m_is_running(struct vdec_m2m *m2m,
+				struct vdec_m2m_ctx *ctx)
+{
+	unsigned long flags;
+	bool running;
+
+	spin_lock_irqsave(&m2m->lock, flags);
+	running = m2m->curr == ctx;
+	spin_unlock_irqrestore(&m2m->lock, flags);
+
+	return running;
+}
+
+static void vdec_m2m_stop_streaming(struct vb2_queue *q)
+{
+	struct vdec_m2m_ctx *ctx = vb2_get_drv_priv(q);
+	struct vdec_m2m *m2m = ctx->m2m;
+	struct vb2_buffer *vb;
+
+	if (!wait_event_timeout(m2m->job_wq, !vdec_m2m_is_running(m2m, ctx),
+				msecs_to_jiffies(VDEC_M2M_TIMEOUT_MS))) {
+		dev_warn(m2m->vdec->dev, "decoder timeout, resetting\n");
+		vdec_writel(m2m->vdec, VDEC_DIR, VDEC_DIR_ID | VDEC_DIR_ABORT);
+		vdec_m2m_job_done(m2m, ctx, VB2_BUF_STATE_ERROR);
+	}
+
+	for (;;) {
+		if (V4L2_TYPE_IS_OUTPUT(q->type))
+			vb = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
+		else
+			vb = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
+		if (!vb)
+			break;
+		v4l2_m2m_buf_done(vb, VB2_BUF_STATE_ERROR);
+	}
+
+	vdec_m2m_put_hw(m2m);
+}
+
+static struct vb2_ops vdec_m2m_qops = {
+	.queue_setup	 = vdec_m2m_queue_setup,
+	.buf_prepare	 = vdec_m2m_buf_prepare,
+	.buf_queue	 = vdec_m2m_buf_queue,
+	.start_streaming = vdec_m2m_start_streaming,
+	.stop_streaming  = vdec_m2m_stop_streaming,
+	.wait_prepare	 = vb2_ops_wait_prepare,
+	.wait_finish	 = vb2_ops_wait_finish,
+};
+
+static int vdec_m2m_queue_init(void *priv, struct vb2_queue *src_vq,
+			       struct vb2_queue *dst_vq)
+{
+	struct vdec_m2m_ctx *ctx = priv;
+	int ret;
+
+	src_vq->type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	src_vq->io_modes = VB2_MMAP | VB2_DMABUF;
+	src_vq->drv_priv = ctx;
+	src_vq->buf_struct_size = sizeof(struct vdec_m2m_buf);
+	src_vq->ops = &vdec_m2m_qops;
+	src_vq->mem_ops = &vb2_dma_contig_memops;
+	src_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+	src_vq->lock = &ctx->m2m->mutex;
+
+	ret = vb2_queue_init(src_vq);
+	if (ret)
+		return ret;
+
+	dst_vq->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	dst_vq->io_modes = VB2_MMAP | VB2_DMABUF;
+	dst_vq->drv_priv = ctx;
+	dst_vq->buf_struct_size = sizeof(struct vdec_m2m_buf);
+	dst_vq->ops = &vdec_m2m_qops;
+	dst_vq->mem_ops = &vb2_dma_contig_memops;
+	dst_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+	dst_vq->lock = &ctx->m2m->mutex;
+
+	return vb2_queue_init(dst_vq);
+}
+
+/*
+ * Format handling
+ */
+
+static const struct vdec_m2m_fmt *vdec_m2m_find_src_fmt(u32 fourcc)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(vdec_m2m_src_fmts); i++)
+		if (vdec_m2m_src_fmts[i].fourcc == fourcc)
+			return &vdec_m2m_src_fmts[i];
+
+	return NULL;
+}
+
+static void vdec_m2m_adjust_fmt(struct v4l2_pix_format *pix, bool src)
+{
+	unsigned int size;
+
+	pix->width = clamp_t(u32, ALIGN(pix->width, 16),
+			     VDEC_M2M_MIN_WIDTH, VDEC_M2M_MAX_WIDTH);
+	pix->height = clamp_t(u32, ALIGN(pix->height, 16),
+			      VDEC_M2M_MIN_HEIGHT, VDEC_M2M_MAX_HEIGHT);
+	pix->field = V4L2_FIELD_NONE;
+
+	/* Decoded pictures are NV12 macroblock aligned frames */
+	size = pix->width * pix->height * 3 / 2;
+
+	if (src) {
+		/*
+		 * A compressed frame hardly gets bigger than the decoded
+		 * one, let userspace pick a larger size if needed.
+		 */
+		pix->bytesperline = 0;
+		pix->sizeimage = PAGE_ALIGN(max(pix->sizeimage, size));
+	} else {
+		pix->pixelformat = vdec_m2m_dst_fmt.fourcc;
+		pix->bytesperline = pix->width;
+		pix->sizeimage = size;
+	}
+}
+
+static int vdec_m2m_querycap(struct file *file, void *priv,
+			     struct v4l2_capability *cap)
+{
+	struct vdec_m2m_ctx *ctx = file_to_ctx(file);
+
+	strlcpy(cap->driver, VDEC_M2M_NAME, sizeof(cap->driver));
+	strlcpy(cap->card, "Hantro G1 video decoder", sizeof(cap->card));
+	snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s",
+		 dev_name(ctx->m2m->vdec->dev));
+	cap->device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_STREAMING;
+	cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+
+	return 0;
+}
+
+static int vdec_m2m_enum_fmt_vid_out(struct file *file, void *priv,
+				     struct v4l2_fmtdesc *f)
+{
+	const struct vdec_m2m_fmt *fmt;
+
+	if (f->index >= ARRAY_SIZE(vdec_m2m_src_fmts))
+		return -EINVAL;
+
+	fmt = &vdec_m2m_src_fmts[f->index];
+	strlcpy(f->description, fmt->name, sizeof(f->description));
+	f->pixelformat = fmt->fourcc;
+	f->flags = V4L2_FMT_FLAG_COMPRESSED;
+
+	return 0;
+}
+
+static int vdec_m2m_enum_fmt_vid_cap(struct file *file, void *priv,
+				     struct v4l2_fmtdesc *f)
+{
+	if (f->index)
+		return -EINVAL;
+
+	strlcpy(f->description, vdec_m2m_dst_fmt.name, sizeof(f->description));
+	f->pixelformat = vdec_m2m_dst_fmt.fourcc;
+
+	return 0;
+}
+
+static int vdec_m2m_g_fmt_vid_out(struct file *file, void *priv,
+				  struct v4l2_format *f)
+{
+	f->fmt.pix = file_to_ctx(file)->src;
+
+	return 0;
+}
+
+static int vdec_m2m_g_fmt_vid_cap(struct file *file, void *priv,
+				  struct v4l2_format *f)
+{
+	f->fmt.pix = file_to_ctx(file)->dst;
+
+	return 0;
+}
+
+static int vdec_m2m_try_fmt_vid_out(struct file *file, void *priv,
+				    struct v4l2_format *f)
+{
+	if (!vdec_m2m_find_src_fmt(f->fmt.pix.pixelformat))
+		f->fmt.pix.pixelformat = vdec_m2m_src_fmts[0].fourcc;
+
+	vdec_m2m_adjust_fmt(&f->fmt.pix, true);
+
+	return 0;
+}
+
+static int vdec_m2m_try_fmt_vid_cap(struct file *file, void *priv,
+				    struct v4l2_format *f)
+{
+	vdec_m2m_adjust_fmt(&f->fmt.pix, false);
+	f->fmt.pix.colorspace = file_to_ctx(file)->src.colorspace;
+
+	return 0;
+}
+
+static int vdec_m2m_s_fmt_vid_out(struct file *file, void *priv,
+				  struct v4l2_format *f)
+{
+	struct vdec_m2m_ctx *ctx = file_to_ctx(file);
+	struct vb2_queue *vq;
+
+	vq = v4l2_m2m_get_vq(ctx->fh.m2m_ctx, f->type);
+	if (vb2_is_busy(vq))
+		return -EBUSY;
+
+	vdec_m2m_try_fmt_vid_out(file, priv, f);
+	ctx->src_fmt = vdec_m2m_find_src_fmt(f->fmt.pix.pixelformat);
+	ctx->src = f->fmt.pix;
+
+	/* The decoded picture follows the coded size */
+	vq = v4l2_m2m_get_vq(ctx->fh.m2m_ctx, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+	if (!vb2_is_busy(vq)) {
+		ctx->dst.width = ctx->src.width;
+		ctx->dst.height = ctx->src.height;
+		ctx->dst.colorspace = ctx->src.colorspace;
+		vdec_m2m_adjust_fmt(&ctx->dst, false);
+	}
+
+	return 0;
+}
+
+static int vdec_m2m_s_fmt_vid_cap(struct file *file, void *priv,
+				  struct v4l2_format *f)
+{
+	struct vdec_m2m_ctx *ctx = file_to_ctx(file);
+	struct vb2_queue *vq;
+
+	vq = v4l2_m2m_get_vq(ctx->fh.m2m_ctx, f->type);
+	if (vb2_is_busy(vq))
+		return -EBUSY;
+
+	vdec_m2m_try_fmt_vid_cap(file, priv, f);
+	ctx->dst = f->fmt.pix;
+
+	return 0;
+}
+
+static const struct v4l2_ioctl_ops vdec_m2m_ioctl_ops = {
+	.vidioc_querycap	= vdec_m2m_querycap,
+
+	.vidioc_enum_fmt_vid_cap = vdec_m2m_enum_fmt_vid_cap,
+	.vidioc_g_fmt_vid_cap	= vdec_m2m_g_fmt_vid_cap,
+	.vidioc_try_fmt_vid_cap	= vdec_m2m_try_fmt_vid_cap,
+	.vidioc_s_fmt_vid_cap	= vdec_m2m_s_fmt_vid_cap,
+
+	.vidioc_enum_fmt_vid_out = vdec_m2m_enum_fmt_vid_out,
+	.vidioc_g_fmt_vid_out	= vdec_m2m_g_fmt_vid_out,
+	.vidioc_try_fmt_vid_out	= vdec_m2m_try_fmt_vid_out,
+	.vidioc_s_fmt_vid_out	= vdec_m2m_s_fmt_vid_out,
+
+	.vidioc_reqbufs		= v4l2_m2m_ioctl_reqbufs,
+	.vidioc_create_bufs	= v4l2_m2m_ioctl_create_bufs,
+	.vidioc_querybuf	= v4l2_m2m_ioctl_querybuf,
+	.vidioc_qbuf		= v4l2_m2m_ioctl_qbuf,
+	.vidioc_dqbuf		= v4l2_m2m_ioctl_dqbuf,
+	.vidioc_expbuf		= v4l2_m2m_ioctl_expbuf,
+
+	.vidioc_streamon	= v4l2_m2m_ioctl_streamon,
+	.vidioc_streamoff	= v4l2_m2m_ioctl_streamoff,
+
+	.vidioc_subscribe_event = v4l2_ctrl_subscribe_event,
+	.vidioc_unsubscribe_event = v4l2_event_unsubscribe,
+};
+
+/*
+ * File operations
+ */
+
+static int vdec_m2m_open(struct file *file)
+{
+	struct vdec_m2m *m2m = video_drvdata(file);
+	struct vdec_m2m_ctx *ctx;
+	struct v4l2_ctrl_handler *hdl;
+	int ret;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	v4l2_fh_init(&ctx->fh, video_devdata(file));
+	file->private_data = &ctx->fh;
+	ctx->m2m = m2m;
+
+	hdl = &ctx->hdl;
+	v4l2_ctrl_handler_init(hdl, 2);
+	ctx->regs = v4l2_ctrl_new_custom(hdl, &vdec_m2m_regs_ctrl, NULL);
+	ctx->refs = v4l2_ctrl_new_custom(hdl, &vdec_m2m_refs_ctrl, NULL);
+	if (hdl->error) {
+		ret = hdl->error;
+		goto err_free_hdl;
+	}
+	ctx->fh.ctrl_handler = hdl;
+
+	ctx->src_fmt = &vdec_m2m_src_fmts[0];
+	ctx->src.pixelformat = ctx->src_fmt->fourcc;
+	ctx->src.width = VDEC_M2M_DEF_WIDTH;
+	ctx->src.height = VDEC_M2M_DEF_HEIGHT;
+	ctx->src.colorspace = V4L2_COLORSPACE_REC709;
+	vdec_m2m_adjust_fmt(&ctx->src, true);
+	ctx->dst = ctx->src;
+	vdec_m2m_adjust_fmt(&ctx->dst, false);
+
+	if (mutex_lock_interruptible(&m2m->mutex)) {
+		ret = -ERESTARTSYS;
+		goto err_free_hdl;
+	}
+	ctx->fh.m2m_ctx = v4l2_m2m_ctx_init(m2m->m2m_dev, ctx,
+					    &vdec_m2m_queue_init);
+	mutex_unlock(&m2m->mutex);
+	if (IS_ERR(ctx->fh.m2m_ctx)) {
+		ret = PTR_ERR(ctx->fh.m2m_ctx);
+		goto err_free_hdl;
+	}
+
+	v4l2_fh_add(&ctx->fh);
+
+	return 0;
+
+err_free_hdl:
+	v4l2_ctrl_handler_free(hdl);
+	v4l2_fh_exit(&ctx->fh);
+	kfree(ctx);
+	return ret;
+}
+
+static int vdec_m2m_release(struct file *file)
+{
+	struct vdec_m2m *m2m = video_drvdata(file);
+	struct vdec_m2m_ctx *ctx = file_to_ctx(file);
+
+	v4l2_fh_del(&ctx->fh);
+	v4l2_fh_exit(&ctx->fh);
+	mutex_lock(&m2m->mutex);
+	v4l2_m2m_ctx_release(ctx->fh.m2m_ctx);
+	mutex_unlock(&m2m->mutex);
+	v4l2_ctrl_handler_free(&ctx->hdl);
+	kfree(ctx);
+
+	return 0;
+}
+
+static const struct v4l2_file_operations vdec_m2m_fops = {
+	.owner		= THIS_MODULE,
+	.open		= vdec_m2m_open,
+	.release	= vdec_m2m_release,
+	.poll		= v4l2_m2m_fop_poll,
+	.unlocked_ioctl	= video_ioctl2,
+	.mmap		= v4l2_m2m_fop_mmap,
+};
+
+int vdec_m2m_init(struct vdec_device *p)
+{
+	struct vdec_m2m *m2m;
+	struct video_device *vfd;
+	int ret;
+
+	m2m = devm_kzalloc(p->dev, sizeof(*m2m), GFP_KERNEL);
+	if (!m2m)
+		return -ENOMEM;
+
+	m2m->vdec = p;
+	mutex_init(&m2m->mutex);
+	spin_lock_init(&m2m->lock);
+	init_waitqueue_head(&m2m->job_wq);
+
+	m2m->alloc_ctx = vb2_dma_contig_init_ctx(p->dev);
+	if (IS_ERR(m2m->alloc_ctx))
+		return PTR_ERR(m2m->alloc_ctx);
+
+	ret = v4l2_device_register(p->dev, &m2m->v4l2_dev);
+	if (ret)
+		goto err_cleanup_ctx;
+
+	m2m->m2m_dev = v4l2_m2m_init(&vdec_m2m_ops);
+	if (IS_ERR(m2m->m2m_dev)) {
+		ret = PTR_ERR(m2m->m2m_dev);
+		goto err_unregister_v4l2;
+	}
+
+	vfd = &m2m->vfd;
+	strlcpy(vfd->name, VDEC_M2M_NAME, sizeof(vfd->name));
+	vfd->vfl_dir = VFL_DIR_M2M;
+	vfd->fops = &vdec_m2m_fops;
+	vfd->ioctl_ops = &vdec_m2m_ioctl_ops;
+	vfd->release = video_device_release_empty;
+	vfd->lock = &m2m->mutex;
+	vfd->v4l2_dev = &m2m->v4l2_dev;
+	video_set_drvdata(vfd, m2m);
+
+	/* Set before the first job can be run by the interrupt handler */
+	p->m2m = m2m;
+
+	ret = video_register_device(vfd, VFL_TYPE_GRABBER, -1);
+	if (ret)
+		goto err_release_m2m;
+
+	v4l2_info(&m2m->v4l2_dev, "registered as /dev/video%d\n", vfd->num);
+
+	return 0;
+
+err_release_m2m:
+	p->m2m = NULL;
+	v4l2_m2m_release(m2m->m2m_dev);
+err_unregister_v4l2:
+	v4l2_device_unregister(&m2m->v4l2_dev);
+err_cleanup_ctx:
+	vb2_dma_contig_cleanup_ctx(m2m->alloc_ctx);
+	return ret;
+}
+
+void vdec_m2m_exit(struct vdec_device *p)
+{
+	struct vdec_m2m *m2m = p->m2m;
+
+	if (!m2m)
+		return;
+
+	video_unregister_device(&m2m->vfd);
+	v4l2_m2m_release(m2m->m2m_dev);
+	v4l2_device_unregister(&m2m->v4l2_dev);
+	vb2_dma_contig_cleanup_ctx(m2m->alloc_ctx);
+	p->m2m = NULL;
+}
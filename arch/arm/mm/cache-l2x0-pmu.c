@@ -0,0 +1,339 @@
+/*
+ * arch/arm/mm/cache-l2x0-pmu.c - L220/L310 event counters as a perf PMU
+ *
+ * The L220 and L310 have two 32-bit event counters sharing a global
+ * enable.  They are exposed as the "l2c_220" or "l2c_310" uncore PMU,
+ * counting system wide only; an hrtimer folds them into the 64-bit perf
+ * counts well before they overflow.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/errno.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/perf_event.h>
+#include <linux/printk.h>
+#include <linux/spinlock.h>
+
+#include <asm/hardware/cache-l2x0.h>
+
+#define L2X0_NUM_COUNTERS	2
+
+#define L2X0_EVENT_CNT_CTRL_ENABLE	BIT(0)
+
+#define L2X0_EVENT_CNT_CFG_SRC_SHIFT	2
+#define L2X0_EVENT_CNT_CFG_SRC_DISABLED	0
+
+/* 32-bit counters at most incremented once per L2 cycle */
+#define L2X0_PMU_POLL_PERIOD_MS		1000
+
+static void __iomem *l2x0_pmu_base;
+static unsigned l2x0_pmu_max_event;
+static struct pmu l2x0_pmu;
+static struct hrtimer l2x0_pmu_hrtimer;
+static struct perf_event *l2x0_pmu_events[L2X0_NUM_COUNTERS];
+static DEFINE_RAW_SPINLOCK(l2x0_pmu_lock);
+
+/* Counter 0 and 1 registers are laid out in reverse order */
+static unsigned l2x0_pmu_cfg_reg(int idx)
+{
+	return idx ? L2X0_EVENT_CNT1_CFG : L2X0_EVENT_CNT0_CFG;
+}
+
+static unsigned l2x0_pmu_val_reg(int idx)
+{
+	return idx ? L2X0_EVENT_CNT1_VAL : L2X0_EVENT_CNT0_VAL;
+}
+
+static void l2x0_pmu_counter_config(int idx, u32 src)
+{
+	writel_relaxed(src << L2X0_EVENT_CNT_CFG_SRC_SHIFT,
+		       l2x0_pmu_base + l2x0_pmu_cfg_reg(idx));
+}
+
+static void l2x0_pmu_event_update(struct perf_event *event)
+{
+	struct hw_perf_event *hw = &event->hw;
+	u64 prev, now;
+
+	do {
+		prev = local64_read(&hw->prev_count);
+		now = readl_relaxed(l2x0_pmu_base + l2x0_pmu_val_reg(hw->idx));
+	} while (local64_cmpxchg(&hw->prev_count, prev, now) != prev);
+
+	local64_add((now - prev) & 0xffffffff, &event->count);
+}
+
+static enum hrtimer_restart l2x0_pmu_poll(struct hrtimer *hrtimer)
+{
+	unsigned long flags;
+	int i;
+
+	raw_spin_lock_irqsave(&l2x0_pmu_lock, flags);
+	for (i = 0; i < L2X0_NUM_COUNTERS; i++)
+		if (l2x0_pmu_events[i])
+			l2x0_pmu_event_update(l2x0_pmu_events[i]);
+	raw_spin_unlock_irqrestore(&l2x0_pmu_lock, flags);
+
+	hrtimer_forward_now(hrtimer, ms_to_ktime(L2X0_PMU_POLL_PERIOD_MS));
+	return HRTIMER_RESTART;
+}
+
+static int l2x0_pmu_event_init(struct perf_event *event)
+{
+	struct perf_event *sibling;
+	int counters = 0;
+
+	if (event->attr.type != l2x0_pmu.type)
+		return -ENOENT;
+
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EOPNOTSUPP;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (!event->attr.config || event->attr.config > l2x0_pmu_max_event)
+		return -EINVAL;
+
+	/* A group has to fit in the two counters */
+	if (event->group_leader->pmu == &l2x0_pmu)
+		counters++;
+	list_for_each_entry(sibling, &event->group_leader->sibling_list,
+			    group_entry)
+		if (sibling->pmu == &l2x0_pmu)
+			counters++;
+	if (event->group_leader != event)
+		counters++;
+
+	if (counters > L2X0_NUM_COUNTERS)
+		return -EINVAL;
+
+	event->hw.idx = -1;
+
+	return 0;
+}
+
+static void l2x0_pmu_event_start(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hw = &event->hw;
+
+	if (WARN_ON_ONCE(!(hw->state & PERF_HES_STOPPED)))
+		return;
+
+	local64_set(&hw->prev_count,
+		    readl_relaxed(l2x0_pmu_base + l2x0_pmu_val_reg(hw->idx)));
+	l2x0_pmu_counter_config(hw->idx, event->attr.config);
+	hw->state = 0;
+}
+
+static void l2x0_pmu_event_stop(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hw = &event->hw;
+
+	if (hw->state & PERF_HES_STOPPED)
+		return;
+
+	l2x0_pmu_counter_config(hw->idx, L2X0_EVENT_CNT_CFG_SRC_DISABLED);
+	hw->state |= PERF_HES_STOPPED;
+
+	if (flags & PERF_EF_UPDATE) {
+		l2x0_pmu_event_update(event);
+		hw->state |= PERF_HES_UPTODATE;
+	}
+}
+
+static int l2x0_pmu_event_add(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hw = &event->hw;
+	unsigned long irqflags;
+	bool first;
+	int idx;
+
+	raw_spin_lock_irqsave(&l2x0_pmu_lock, irqflags);
+	for (idx = 0; idx < L2X0_NUM_COUNTERS; idx++)
+		if (!l2x0_pmu_events[idx])
+			break;
+	if (idx == L2X0_NUM_COUNTERS) {
+		raw_spin_unlock_irqrestore(&l2x0_pmu_lock, irqflags);
+		return -EAGAIN;
+	}
+	first = !l2x0_pmu_events[!idx];
+	l2x0_pmu_events[idx] = event;
+	raw_spin_unlock_irqrestore(&l2x0_pmu_lock, irqflags);
+
+	hw->idx = idx;
+	hw->state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	if (flags & PERF_EF_START)
+		l2x0_pmu_event_start(event, 0);
+
+	if (first) {
+		writel_relaxed(L2X0_EVENT_CNT_CTRL_ENABLE,
+			       l2x0_pmu_base + L2X0_EVENT_CNT_CTRL);
+		hrtimer_start(&l2x0_pmu_hrtimer,
+			      ms_to_ktime(L2X0_PMU_POLL_PERIOD_MS),
+			      HRTIMER_MODE_REL);
+	}
+
+	return 0;
+}
+
+static void l2x0_pmu_event_del(struct perf_event *event, int flags)
+{
+	struct hw_perf_event *hw = &event->hw;
+	unsigned long irqflags;
+	bool last;
+
+	l2x0_pmu_event_stop(event, PERF_EF_UPDATE);
+
+	raw_spin_lock_irqsave(&l2x0_pmu_lock, irqflags);
+	l2x0_pmu_events[hw->idx] = NULL;
+	last = !l2x0_pmu_events[!hw->idx];
+	raw_spin_unlock_irqrestore(&l2x0_pmu_lock, irqflags);
+
+	hw->idx = -1;
+
+	if (last) {
+		hrtimer_cancel(&l2x0_pmu_hrtimer);
+		writel_relaxed(0, l2x0_pmu_base + L2X0_EVENT_CNT_CTRL);
+	}
+}
+
+static void l2x0_pmu_event_read(struct perf_event *event)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&l2x0_pmu_lock, flags);
+	l2x0_pmu_event_update(event);
+	raw_spin_unlock_irqrestore(&l2x0_pmu_lock, flags);
+}
+
+PMU_FORMAT_ATTR(event, "config:0-3");
+
+static struct attribute *l2x0_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL,
+};
+
+static struct attribute_group l2x0_pmu_format_attr_group = {
+	.name = "format",
+	.attrs = l2x0_pmu_format_attrs,
+};
+
+#define L2X0_EVENT_ATTR(_name, _config)					\
+	PMU_EVENT_ATTR_STRING(_name, l2x0_event_attr_##_name,		\
+			      "event=" #_config)
+
+/* Event sources common to the L220 and L310 */
+L2X0_EVENT_ATTR(co, 0x1);
+L2X0_EVENT_ATTR(drhit, 0x2);
+L2X0_EVENT_ATTR(drreq, 0x3);
+L2X0_EVENT_ATTR(dwhit, 0x4);
+L2X0_EVENT_ATTR(dwreq, 0x5);
+L2X0_EVENT_ATTR(dwtreq, 0x6);
+L2X0_EVENT_ATTR(irhit, 0x7);
+L2X0_EVENT_ATTR(irreq, 0x8);
+L2X0_EVENT_ATTR(wa, 0x9);
+/* L310 only, prefetch and speculative read events */
+L2X0_EVENT_ATTR(ipfalloc, 0xa);
+L2X0_EVENT_ATTR(epfhit, 0xb);
+L2X0_EVENT_ATTR(epfalloc, 0xc);
+L2X0_EVENT_ATTR(srrcvd, 0xd);
+L2X0_EVENT_ATTR(srconf, 0xe);
+L2X0_EVENT_ATTR(epfrcvd, 0xf);
+
+#define L220_MAX_EVENT	0x9
+#define L310_MAX_EVENT	0xf
+
+static struct attribute *l2x0_pmu_event_attrs[] = {
+	&l2x0_event_attr_co.attr.attr,
+	&l2x0_event_attr_drhit.attr.attr,
+	&l2x0_event_attr_drreq.attr.attr,
+	&l2x0_event_attr_dwhit.attr.attr,
+	&l2x0_event_attr_dwreq.attr.attr,
+	&l2x0_event_attr_dwtreq.attr.attr,
+	&l2x0_event_attr_irhit.attr.attr,
+	&l2x0_event_attr_irreq.attr.attr,
+	&l2x0_event_attr_wa.attr.attr,
+	/* terminates the list on L220 */
+	&l2x0_event_attr_ipfalloc.attr.attr,
+	&l2x0_event_attr_epfhit.attr.attr,
+	&l2x0_event_attr_epfalloc.attr.attr,
+	&l2x0_event_attr_srrcvd.attr.attr,
+	&l2x0_event_attr_srconf.attr.attr,
+	&l2x0_event_attr_epfrcvd.attr.attr,
+	NULL,
+};
+
+static struct attribute_group l2x0_pmu_event_attr_group = {
+	.name = "events",
+	.attrs = l2x0_pmu_event_attrs,
+};
+
+static const struct attribute_group *l2x0_pmu_attr_groups[] = {
+	&l2x0_pmu_format_attr_group,
+	&l2x0_pmu_event_attr_group,
+	NULL,
+};
+
+/*
+ * Called by the L2C driver once the controller is set up, before perf
+ * is initialised: the PMU is registered later, from an initcall.
+ */
+void __init l2x0_pmu_register(void __iomem *base, u32 part)
+{
+	switch (part & L2X0_CACHE_ID_PART_MASK) {
+	case L2X0_CACHE_ID_PART_L220:
+		l2x0_pmu_max_event = L220_MAX_EVENT;
+		l2x0_pmu_event_attrs[L220_MAX_EVENT] = NULL;
+		break;
+	case L2X0_CACHE_ID_PART_L310:
+		l2x0_pmu_max_event = L310_MAX_EVENT;
+		break;
+	default:
+		return;
+	}
+
+	l2x0_pmu_base = base;
+}
+
+static __init int l2x0_pmu_init(void)
+{
+	int ret;
+
+	if (!l2x0_pmu_base)
+		return 0;
+
+	writel_relaxed(0, l2x0_pmu_base + L2X0_EVENT_CNT_CTRL);
+	l2x0_pmu_counter_config(0, L2X0_EVENT_CNT_CFG_SRC_DISABLED);
+	l2x0_pmu_counter_config(1, L2X0_EVENT_CNT_CFG_SRC_DISABLED);
+
+	hrtimer_init(&l2x0_pmu_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	l2x0_pmu_hrtimer.function = l2x0_pmu_poll;
+
+	l2x0_pmu = (struct pmu) {
+		.attr_groups = l2x0_pmu_attr_groups,
+		.task_ctx_nr = perf_invalid_context,
+		.event_init = l2x0_pmu_event_init,
+		.add = l2x0_pmu_event_add,
+		.del = l2x0_pmu_event_del,
+		.start = l2x0_pmu_event_start,
+		.stop = l2x0_pmu_event_stop,
+		.read = l2x0_pmu_event_read,
+	};
+
+	ret = perf_pmu_register(&l2x0_pmu, l2x0_pmu_max_event == L310_MAX_EVENT ?
+				"l2c_310" : "l2c_220", -1);
+	if (ret)
+		pr_err("L2C: failed to register the PMU: %d\n", ret);
+	else
+		pr_info("L2C: %d event counters registered with perf\n",
+			L2X0_NUM_COUNTERS);
+
+	return ret;
+}
+device_initcall(l2x0_pmu_init);
@@ -876,6 +876,8 @@ static int __init __l2c_init(const struct l2c_init_data *data,
 	pr_info("%s: CACHE_ID 0x%08x, AUX_CTRL 0x%08x\n",
 		data->type, cache_id, aux);
 
+	l2x0_pmu_register(l2x0_base, cache_id);
+
 	return 0;
 }
 
@@ -1149,6 +1151,28 @@ static void __init l2c310_of_parse(const struct device_node *np,
 		}
 	}
 
+	ret = of_property_read_u32(np, "prefetch-data", &val);
+	if (ret == 0) {
+		if (val)
+			*aux_val |= L310_AUX_CTRL_DATA_PREFETCH;
+		else
+			*aux_val &= ~L310_AUX_CTRL_DATA_PREFETCH;
+		*aux_mask &= ~L310_AUX_CTRL_DATA_PREFETCH;
+	} else if (ret != -EINVAL) {
+		pr_err("L2C-310 OF prefetch-data property value is missing\n");
+	}
+
+	ret = of_property_read_u32(np, "prefetch-instr", &val);
+	if (ret == 0) {
+		if (val)
+			*aux_val |= L310_AUX_CTRL_INSTR_PREFETCH;
+		else
+			*aux_val &= ~L310_AUX_CTRL_INSTR_PREFETCH;
+		*aux_mask &= ~L310_AUX_CTRL_INSTR_PREFETCH;
+	} else if (ret != -EINVAL) {
+		pr_err("L2C-310 OF prefetch-instr property value is missing\n");
+	}
+
 	prefetch = l2x0_saved_regs.prefetch_ctrl;
 
 	ret = of_property_read_u32(np, "arm,double-linefill", &val);
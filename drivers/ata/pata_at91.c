@@ -23,6 +23,10 @@
 #include <scsi/scsi_host.h>
 #include <linux/ata.h>
 #include <linux/clk.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/interrupt.h>
 #include <linux/libata.h>
 #include <linux/mfd/syscon.h>
 #include <linux/mfd/syscon/atmel-smc.h>
@@ -43,12 +47,20 @@
 #define ER_SMC_CALC		1
 #define ER_SMC_RECALC		2
 
+/* shorter transfers are not worth setting up a DMA for */
+#define DMA_MIN_LEN		ATA_SECT_SIZE
+/* a sector takes ~150us in PIO0, the device holds DRQ with IORDY */
+#define DMA_TIMEOUT_US		10000
+
 struct at91_ide_info {
 	unsigned long mode;
 	unsigned int cs;
+	int irq;
 	struct clk *mck;
 	void __iomem *ide_addr;
 	void __iomem *alt_addr;
+	dma_addr_t ide_phys;
+	struct dma_chan *dma;
 };
 
 /**
@@ -244,8 +256,9 @@ static void set_smc_timing(struct device *dev, struct ata_device *adev,
 	to_smc_format(&setup, &pulse, &cycle, &cs_pulse);
 	/* disable or enable waiting for IORDY signal */
 	use_iordy = ata_pio_need_iordy(adev);
-	if (use_iordy)
-		info->mode |= AT91_SMC_EXNWMODE_READY;
+	info->mode &= ~AT91_SMC_EXNWMODE;
+	info->mode |= use_iordy ? AT91_SMC_EXNWMODE_READY :
+				  AT91_SMC_EXNWMODE_DISABLE;
 
 	if (tdf_cycles > 15) {
 		tdf_cycles = 15;
@@ -287,28 +300,134 @@ static void pata_at91_set_piomode(struct ata_port *ap, struct ata_device *adev)
 	set_smc_timing(ap->dev, adev, info, &timing);
 }
 
-static unsigned int pata_at91_data_xfer_noirq(struct ata_device *dev,
+/*
+ * Move whole sectors between the data register and memory with the DMA
+ * controller: a memory to memory transfer with a fixed address on the
+ * device side.  Completion is polled, the data phase being short, which
+ * needs the DMA driver's tasklet to run: the interrupt handler path, with
+ * interrupts off, stays on PIO.
+ *
+ * The data register only takes halfword accesses, a word one would also
+ * hit the next task file register.  The DMA drivers pick the widest width
+ * the addresses and length allow, so the last halfword is left out of the
+ * transfer and done by the CPU.
+ */
+static int pata_at91_dma_xfer(struct at91_ide_info *info, unsigned char *buf,
+			      unsigned int buflen, int rw)
+{
+	enum dma_data_direction dir = rw == READ ? DMA_FROM_DEVICE :
+						   DMA_TO_DEVICE;
+	struct device *dev = info->dma->device->dev;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_interleaved_template *xt;
+	dma_cookie_t cookie;
+	dma_addr_t addr;
+	int timeout = DMA_TIMEOUT_US;
+	int ret = 0;
+
+	if (irqs_disabled() || buflen < DMA_MIN_LEN || buflen & 1 ||
+	    !virt_addr_valid(buf))
+		return -EINVAL;
+
+	xt = kzalloc(sizeof(*xt) + sizeof(xt->sgl[0]), GFP_ATOMIC);
+	if (!xt)
+		return -ENOMEM;
+
+	addr = dma_map_single(dev, buf, buflen, dir);
+	if (dma_mapping_error(dev, addr)) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	if (rw == READ) {
+		xt->src_start = info->ide_phys;
+		xt->dst_start = addr;
+		xt->dst_inc = true;
+		xt->dir = DMA_DEV_TO_MEM;
+	} else {
+		xt->src_start = addr;
+		xt->dst_start = info->ide_phys;
+		xt->src_inc = true;
+		xt->dir = DMA_MEM_TO_DEV;
+	}
+	xt->numf = 1;
+	xt->frame_size = 1;
+	xt->sgl[0].size = buflen - 2;
+
+	desc = dmaengine_prep_interleaved_dma(info->dma, xt, 0);
+	if (!desc) {
+		ret = -EIO;
+		goto unmap;
+	}
+
+	cookie = dmaengine_submit(desc);
+	dma_async_issue_pending(info->dma);
+
+	while (dma_async_is_tx_complete(info->dma, cookie, NULL, NULL) ==
+	       DMA_IN_PROGRESS) {
+		if (!timeout--) {
+			dmaengine_terminate_all(info->dma);
+			ret = -ETIMEDOUT;
+			break;
+		}
+		udelay(1);
+	}
+
+unmap:
+	dma_unmap_single(dev, addr, buflen, dir);
+
+	/* after the unmap, which would discard it when reading */
+	if (!ret) {
+		void __iomem *data_addr = info->ide_addr + ATA_REG_DATA;
+		__le16 *last = (__le16 *)(buf + buflen - 2);
+
+		if (rw == READ)
+			ioread16_rep(data_addr, last, 1);
+		else
+			iowrite16_rep(data_addr, last, 1);
+	}
+free:
+	kfree(xt);
+	return ret;
+}
+
+/*
+ * The task file registers are addressed through A0, which becomes a byte
+ * select in 16-bit mode, so none of them may be accessed while the data
+ * register is.  Only the port interrupt handler could do so: mask it,
+ * rather than all the interrupts, while the bus is switched.
+ */
+static unsigned int pata_at91_data_xfer(struct ata_device *dev,
 		unsigned char *buf, unsigned int buflen, int rw)
 {
 	struct at91_ide_info *info = dev->link->ap->host->private_data;
-	unsigned int consumed;
+	unsigned int consumed = buflen;
 	unsigned int mode;
-	unsigned long flags;
+	int ret;
+
+	if (info->irq)
+		disable_irq_nosync(info->irq);
 
-	local_irq_save(flags);
 	regmap_fields_read(fields.mode, info->cs, &mode);
 
 	/* set 16bit mode before writing data */
 	regmap_fields_write(fields.mode, info->cs, (mode & ~AT91_SMC_DBW) |
 			    AT91_SMC_DBW_16);
 
-	consumed = ata_sff_data_xfer(dev, buf, buflen, rw);
+	/* a partial transfer can't be restarted, leave it to error handling */
+	ret = info->dma ? pata_at91_dma_xfer(info, buf, buflen, rw) : -ENODEV;
+	if (ret == -ETIMEDOUT)
+		ata_dev_err(dev, "DMA data transfer timed out\n");
+	else if (ret)
+		consumed = ata_sff_data_xfer(dev, buf, buflen, rw);
 
 	/* restore 8bit mode after data is written */
 	regmap_fields_write(fields.mode, info->cs, (mode & ~AT91_SMC_DBW) |
 			    AT91_SMC_DBW_8);
 
-	local_irq_restore(flags);
+	if (info->irq)
+		enable_irq(info->irq);
+
 	return consumed;
 }
 
@@ -319,11 +438,21 @@ static struct scsi_host_template pata_at91_sht = {
 static struct ata_port_operations pata_at91_port_ops = {
 	.inherits	= &ata_sff_port_ops,
 
-	.sff_data_xfer	= pata_at91_data_xfer_noirq,
+	.sff_data_xfer	= pata_at91_data_xfer,
 	.set_piomode	= pata_at91_set_piomode,
 	.cable_detect	= ata_cable_40wire,
 };
 
+static struct dma_chan *pata_at91_request_dma(void)
+{
+	dma_cap_mask_t mask;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_INTERLEAVE, mask);
+
+	return dma_request_channel(mask, NULL, NULL);
+}
+
 static int at91sam9_smc_fields_init(struct device *dev)
 {
 	struct reg_field field = REG_FIELD(0, 0, 31);
@@ -401,7 +530,8 @@ static int pata_at91_probe(struct platform_device *pdev)
 	ap = host->ports[0];
 	ap->ops = &pata_at91_port_ops;
 	ap->flags |= ATA_FLAG_SLAVE_POSS;
-	ap->pio_mask = ATA_PIO4;
+	/* PIO5 and PIO6 are CompactFlash specific */
+	ap->pio_mask = ATA_PIO6;
 
 	if (!gpio_is_valid(irq)) {
 		ap->flags |= ATA_FLAG_PIO_POLLING;
@@ -427,6 +557,7 @@ static int pata_at91_probe(struct platform_device *pdev)
 		AT91_SMC_EXNWMODE_READY | AT91_SMC_BAT_SELECT |
 		AT91_SMC_DBW_8 | AT91_SMC_TDF_(0);
 
+	info->ide_phys = mem_res->start + CF_IDE_OFFSET;
 	info->ide_addr = devm_ioremap(dev,
 			mem_res->start + CF_IDE_OFFSET, CF_IDE_RES_SIZE);
 
@@ -457,14 +588,25 @@ static int pata_at91_probe(struct platform_device *pdev)
 
 	host->private_data = info;
 
+	if (gpio_is_valid(irq))
+		info->irq = gpio_to_irq(irq);
+
+	/* optional, any channel able to do fixed address transfers */
+	info->dma = pata_at91_request_dma();
+	if (info->dma)
+		ata_port_desc(ap, "DMA %s", dma_chan_name(info->dma));
+
 	ret = ata_host_activate(host, gpio_is_valid(irq) ? gpio_to_irq(irq) : 0,
 				gpio_is_valid(irq) ? ata_sff_interrupt : NULL,
 				irq_flags, &pata_at91_sht);
 	if (ret)
-		goto err_put;
+		goto err_dma;
 
 	return 0;
 
+err_dma:
+	if (info->dma)
+		dma_release_channel(info->dma);
 err_put:
 	clk_put(info->mck);
 	return ret;
@@ -484,6 +626,8 @@ static int pata_at91_remove(struct platform_device *pdev)
 	if (!info)
 		return 0;
 
+	if (info->dma)
+		dma_release_channel(info->dma);
 	clk_put(info->mck);
 
 	return 0;
@@ -65,6 +65,12 @@ struct driver_private {
  *	probed first.
  * @device - pointer back to the struct class that this structure is
  * associated with.
+ * @probe_stats - entry in the list of probed devices shown in debugfs.
+ * @probe_attempts - number of really_probe() calls for this device.
+ * @probe_defers - how many of them returned -EPROBE_DEFER.
+ * @probe_ns - time spent in them.
+ * @probe_ret - result of the last one.
+ * @defer_supplier - what the last deferred probe was waiting for.
  *
  * Nothing outside of the driver core should ever touch these fields.
  */
@@ -75,6 +81,12 @@ struct device_private {
 	struct klist_node knode_bus;
 	struct list_head deferred_probe;
 	struct device *device;
+	struct list_head probe_stats;
+	unsigned int probe_attempts;
+	unsigned int probe_defers;
+	u64 probe_ns;
+	int probe_ret;
+	enum probe_defer_supplier defer_supplier;
 };
 #define to_device_private_parent(obj)	\
 	container_of(obj, struct device_private, knode_parent)
@@ -110,7 +122,9 @@ extern void bus_remove_driver(struct device_driver *drv);
 
 extern void driver_detach(struct device_driver *drv);
 extern int driver_probe_device(struct device_driver *drv, struct device *dev);
+extern bool driver_allows_async_probing(struct device_driver *drv);
 extern void driver_deferred_probe_del(struct device *dev);
+extern void driver_probe_stats_del(struct device *dev);
 static inline int driver_match_device(struct device_driver *drv,
 				      struct device *dev)
 {
@@ -948,6 +948,7 @@ int device_private_init(struct device *dev)
 	klist_init(&dev->p->klist_children, klist_children_get,
 		   klist_children_put);
 	INIT_LIST_HEAD(&dev->p->deferred_probe);
+	INIT_LIST_HEAD(&dev->p->probe_stats);
 	return 0;
 }
 
@@ -1217,6 +1218,7 @@ void device_del(struct device *dev)
 	bus_remove_device(dev);
 	device_pm_remove(dev);
 	driver_deferred_probe_del(dev);
+	driver_probe_stats_del(dev);
 
 	/* Notify the platform of the removal, in case they
 	 * need to do anything...
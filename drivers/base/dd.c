@@ -25,10 +25,16 @@
 #include <linux/async.h>
 #include <linux/pm_runtime.h>
 #include <linux/pinctrl/devinfo.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
 
 #include "base.h"
 #include "power/power.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/dd.h>
+
 /*
  * Deferred Probe infrastructure.
  *
@@ -45,6 +51,10 @@
  * from the pending to the active list so that the workqueue will eventually
  * retry them.
  *
+ * Devices known to wait for a clock, regulator, pin controller or GPIO chip
+ * are the exception: those stay pending until a supplier of that kind is
+ * registered, rather than being retried after every bind.
+ *
  * The deferred_probe_mutex must be held any time the deferred_probe_*_list
  * of the (struct device*)->p->deferred_probe pointers are manipulated
  */
@@ -129,13 +139,86 @@ void driver_deferred_probe_del(struct device *dev)
 	mutex_unlock(&deferred_probe_mutex);
 }
 
+/*
+ * Statistics of every device probed so far, see the "probe_stats" debugfs
+ * file.
+ */
+static DEFINE_MUTEX(probe_stats_mutex);
+static LIST_HEAD(probe_stats_list);
+
+void driver_probe_stats_del(struct device *dev)
+{
+	mutex_lock(&probe_stats_mutex);
+	list_del_init(&dev->p->probe_stats);
+	mutex_unlock(&probe_stats_mutex);
+}
+
 static bool driver_deferred_probe_enable = false;
+
+/*
+ * Move the pending devices waiting for @supplier, or all of them, to the
+ * active list and kick the workqueue.
+ */
+static void __driver_deferred_probe_trigger(enum probe_defer_supplier supplier)
+{
+	struct device_private *private, *next;
+	unsigned int retried = 0;
+
+	if (!driver_deferred_probe_enable)
+		return;
+
+	mutex_lock(&deferred_probe_mutex);
+	atomic_inc(&deferred_trigger_count);
+	list_for_each_entry_safe(private, next, &deferred_probe_pending_list,
+				 deferred_probe) {
+		if (supplier != PROBE_DEFER_ALL &&
+		    private->defer_supplier != supplier)
+			continue;
+		list_move_tail(&private->deferred_probe,
+			       &deferred_probe_active_list);
+		retried++;
+	}
+	mutex_unlock(&deferred_probe_mutex);
+
+	trace_dd_deferred_trigger(supplier, retried);
+
+	if (retried)
+		queue_work(deferred_wq, &deferred_probe_work);
+}
+
+/**
+ * driver_deferred_probe_wait() - note what a deferring device waits for
+ * @dev: device whose resource lookup returned -EPROBE_DEFER
+ * @supplier: kind of the missing supplier
+ *
+ * Called by the supplier frameworks.  If the probe in progress defers,
+ * @dev is retried only when a @supplier is registered.
+ */
+void driver_deferred_probe_wait(struct device *dev,
+				enum probe_defer_supplier supplier)
+{
+	if (dev && dev->p)
+		dev->p->defer_supplier = supplier;
+}
+EXPORT_SYMBOL_GPL(driver_deferred_probe_wait);
+
+/**
+ * driver_deferred_probe_supplier() - retry the devices waiting for @supplier
+ * @supplier: kind of supplier just registered
+ */
+void driver_deferred_probe_supplier(enum probe_defer_supplier supplier)
+{
+	__driver_deferred_probe_trigger(supplier);
+}
+EXPORT_SYMBOL_GPL(driver_deferred_probe_supplier);
+
 /**
  * driver_deferred_probe_trigger() - Kick off re-probing deferred devices
  *
  * This functions moves all devices from the pending list to the active
- * list and schedules the deferred probe workqueue to process them.  It
- * should be called anytime a driver is successfully bound to a device.
+ * list and schedules the deferred probe workqueue to process them.  A
+ * driver binding only retries the devices waiting for an unknown
+ * supplier, see driver_bound().
  *
  * Note, there is a race condition in multi-threaded probe. In the case where
  * more than one device is probing at the same time, it is possible for one
@@ -150,27 +233,93 @@ static bool driver_deferred_probe_enable = false;
  */
 static void driver_deferred_probe_trigger(void)
 {
-	if (!driver_deferred_probe_enable)
-		return;
+	__driver_deferred_probe_trigger(PROBE_DEFER_ALL);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static const char * const probe_defer_supplier_names[] = {
+	[PROBE_DEFER_UNKNOWN]	= "unknown",
+	[PROBE_DEFER_CLK]	= "clk",
+	[PROBE_DEFER_REGULATOR]	= "regulator",
+	[PROBE_DEFER_PINCTRL]	= "pinctrl",
+	[PROBE_DEFER_GPIO]	= "gpio",
+};
+
+static int deferred_devs_show(struct seq_file *s, void *data)
+{
+	struct device_private *private;
 
-	/*
-	 * A successful probe means that all the devices in the pending list
-	 * should be triggered to be reprobed.  Move all the deferred devices
-	 * into the active list so they can be retried by the workqueue
-	 */
 	mutex_lock(&deferred_probe_mutex);
-	atomic_inc(&deferred_trigger_count);
-	list_splice_tail_init(&deferred_probe_pending_list,
-			      &deferred_probe_active_list);
+	list_for_each_entry(private, &deferred_probe_pending_list,
+			    deferred_probe)
+		seq_printf(s, "%s\t%s\t%u\n", dev_name(private->device),
+			   probe_defer_supplier_names[private->defer_supplier],
+			   private->probe_defers);
+	list_for_each_entry(private, &deferred_probe_active_list,
+			    deferred_probe)
+		seq_printf(s, "%s\t%s\t%u\tretrying\n",
+			   dev_name(private->device),
+			   probe_defer_supplier_names[private->defer_supplier],
+			   private->probe_defers);
 	mutex_unlock(&deferred_probe_mutex);
 
-	/*
-	 * Kick the re-probe thread.  It may already be scheduled, but it is
-	 * safe to kick it again.
-	 */
-	queue_work(deferred_wq, &deferred_probe_work);
+	return 0;
+}
+
+static int deferred_devs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, deferred_devs_show, NULL);
+}
+
+static const struct file_operations deferred_devs_fops = {
+	.open		= deferred_devs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int probe_stats_show(struct seq_file *s, void *data)
+{
+	struct device_private *private;
+
+	seq_puts(s, "# device attempts defers total_us last_ret\n");
+
+	mutex_lock(&probe_stats_mutex);
+	list_for_each_entry(private, &probe_stats_list, probe_stats)
+		seq_printf(s, "%s %u %u %llu %d\n", dev_name(private->device),
+			   private->probe_attempts, private->probe_defers,
+			   div_u64(private->probe_ns, NSEC_PER_USEC),
+			   private->probe_ret);
+	mutex_unlock(&probe_stats_mutex);
+
+	return 0;
 }
 
+static int probe_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, probe_stats_show, NULL);
+}
+
+static const struct file_operations probe_stats_fops = {
+	.open		= probe_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void deferred_probe_debugfs_init(void)
+{
+	debugfs_create_file("devices_deferred", S_IRUGO, NULL, NULL,
+			    &deferred_devs_fops);
+	debugfs_create_file("probe_stats", S_IRUGO, NULL, NULL,
+			    &probe_stats_fops);
+}
+#else
+static inline void deferred_probe_debugfs_init(void)
+{
+}
+#endif
+
 /**
  * deferred_probe_initcall() - Enable probing of deferred devices
  *
@@ -184,6 +333,11 @@ static int deferred_probe_initcall(void)
 	if (WARN_ON(!deferred_wq))
 		return -ENOMEM;
 
+	/* Asynchronous probes may still be adding to the pending list */
+	async_synchronize_full();
+
+	deferred_probe_debugfs_init();
+
 	driver_deferred_probe_enable = true;
 	driver_deferred_probe_trigger();
 	/* Sort as many dependencies as possible before exiting initcalls */
@@ -207,10 +361,10 @@ static void driver_bound(struct device *dev)
 
 	/*
 	 * Make sure the device is no longer in one of the deferred lists and
-	 * kick off retrying all pending devices
+	 * kick off retrying the pending devices which may depend on it
 	 */
 	driver_deferred_probe_del(dev);
-	driver_deferred_probe_trigger();
+	__driver_deferred_probe_trigger(PROBE_DEFER_UNKNOWN);
 
 	if (dev->bus)
 		blocking_notifier_call_chain(&dev->bus->p->bus_notifier,
@@ -275,16 +429,38 @@ EXPORT_SYMBOL_GPL(device_bind_driver);
 static atomic_t probe_count = ATOMIC_INIT(0);
 static DECLARE_WAIT_QUEUE_HEAD(probe_waitqueue);
 
+static void driver_probe_stats_update(struct device *dev, int ret,
+				      ktime_t start)
+{
+	struct device_private *private = dev->p;
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	mutex_lock(&probe_stats_mutex);
+	if (list_empty(&private->probe_stats))
+		list_add_tail(&private->probe_stats, &probe_stats_list);
+	private->probe_attempts++;
+	private->probe_ns += ns;
+	private->probe_ret = ret;
+	if (ret == -EPROBE_DEFER)
+		private->probe_defers++;
+	mutex_unlock(&probe_stats_mutex);
+}
+
 static int really_probe(struct device *dev, struct device_driver *drv)
 {
 	int ret = 0;
 	int local_trigger_count = atomic_read(&deferred_trigger_count);
+	ktime_t start;
 
 	atomic_inc(&probe_count);
 	pr_debug("bus: '%s': %s: probing driver %s with device %s\n",
 		 drv->bus->name, __func__, drv->name, dev_name(dev));
 	WARN_ON(!list_empty(&dev->devres_head));
 
+	dev->p->defer_supplier = PROBE_DEFER_UNKNOWN;
+	trace_dd_probe_start(dev, drv);
+	start = ktime_get();
+
 	dev->driver = drv;
 
 	/* If using pinctrl, bind pins now before probing */
@@ -317,6 +493,10 @@ static int really_probe(struct device *dev, struct device_driver *drv)
 	if (dev->pm_domain && dev->pm_domain->sync)
 		dev->pm_domain->sync(dev);
 
+	driver_probe_stats_update(dev, 0, start);
+	trace_dd_probe_end(dev, drv, 0, ktime_to_ns(ktime_sub(ktime_get(),
+							      start)));
+
 	driver_bound(dev);
 	ret = 1;
 	pr_debug("bus: '%s': %s: bound device %s to driver %s\n",
@@ -331,10 +511,16 @@ probe_failed:
 	if (dev->pm_domain && dev->pm_domain->dismiss)
 		dev->pm_domain->dismiss(dev);
 
+	driver_probe_stats_update(dev, ret, start);
+	trace_dd_probe_end(dev, drv, ret, ktime_to_ns(ktime_sub(ktime_get(),
+								start)));
+
 	switch (ret) {
 	case -EPROBE_DEFER:
 		/* Driver requested deferred probing */
 		dev_dbg(dev, "Driver %s requests probe deferral\n", drv->name);
+		trace_dd_probe_defer(dev, drv, dev->p->defer_supplier,
+				     dev->p->probe_defers);
 		driver_deferred_probe_add(dev);
 		/* Did a trigger occur while probing? Need to re-trigger if yes */
 		if (local_trigger_count != atomic_read(&deferred_trigger_count))
@@ -468,6 +654,83 @@ out_unlock:
 }
 EXPORT_SYMBOL_GPL(device_attach);
 
+/*
+ * "driver_async_probe=" lists, comma separated, the drivers to probe
+ * asynchronously, "*" standing for all the drivers which don't require
+ * synchronous probing.  A name prefixed with '!' is probed synchronously
+ * whatever its driver prefers.  A name given explicitly takes precedence
+ * over the annotation in the driver.
+ */
+#define ASYNC_DRV_NAMES_MAX_LEN	256
+static char async_probe_drv_names[ASYNC_DRV_NAMES_MAX_LEN];
+
+static int __init save_async_options(char *buf)
+{
+	if (strlen(buf) >= ASYNC_DRV_NAMES_MAX_LEN)
+		pr_warn("Too long list of driver names for 'driver_async_probe'!\n");
+
+	strlcpy(async_probe_drv_names, buf, ASYNC_DRV_NAMES_MAX_LEN);
+	return 1;
+}
+__setup("driver_async_probe=", save_async_options);
+
+static enum probe_type cmdline_probe_type(const char *name, bool *all)
+{
+	const char *p = async_probe_drv_names;
+	size_t namelen = strlen(name);
+
+	*all = false;
+
+	while (*p) {
+		size_t len = strcspn(p, ",");
+		bool force_sync = *p == '!';
+		const char *tok = p + force_sync;
+		size_t toklen = len - force_sync;
+
+		if (toklen == namelen && !strncmp(tok, name, namelen))
+			return force_sync ? PROBE_FORCE_SYNCHRONOUS :
+					    PROBE_PREFER_ASYNCHRONOUS;
+		if (!force_sync && toklen == 1 && *tok == '*')
+			*all = true;
+
+		p += len;
+		if (*p)
+			p++;
+	}
+
+	return PROBE_DEFAULT_STRATEGY;
+}
+
+/**
+ * driver_allows_async_probing - check whether @drv is probed asynchronously
+ * @drv: driver.
+ *
+ * Combines the probe_type of @drv with the "driver_async_probe=" kernel
+ * command line parameter.
+ */
+bool driver_allows_async_probing(struct device_driver *drv)
+{
+	bool all;
+
+	switch (cmdline_probe_type(drv->name, &all)) {
+	case PROBE_PREFER_ASYNCHRONOUS:
+		return true;
+	case PROBE_FORCE_SYNCHRONOUS:
+		return false;
+	default:
+		break;
+	}
+
+	switch (drv->probe_type) {
+	case PROBE_PREFER_ASYNCHRONOUS:
+		return true;
+	case PROBE_FORCE_SYNCHRONOUS:
+		return false;
+	default:
+		return all;
+	}
+}
+
 static int __driver_attach(struct device *dev, void *data)
 {
 	struct device_driver *drv = data;
@@ -581,6 +844,10 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	/* Let a pending asynchronous driver_attach() finish first */
+	if (driver_allows_async_probing(drv))
+		async_synchronize_full();
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
@@ -19,6 +19,9 @@
 #ifdef CONFIG_ZRAM_LZ4_COMPRESS
 #include "zcomp_lz4.h"
 #endif
+#ifdef CONFIG_ZRAM_CRYPTO_COMPRESS
+#include "zcomp_crypto.h"
+#endif
 
 /*
  * single zcomp_strm backend
@@ -59,6 +62,11 @@ static struct zcomp_backend *find_backend(const char *compress)
 			break;
 		i++;
 	}
+#ifdef CONFIG_ZRAM_CRYPTO_COMPRESS
+	/* any other compressor registered with the crypto API */
+	if (!backends[i] && zcomp_crypto_has(compress))
+		return &zcomp_crypto;
+#endif
 	return backends[i];
 }
 
@@ -80,7 +88,7 @@ static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
 	if (!zstrm)
 		return NULL;
 
-	zstrm->private = comp->backend->create();
+	zstrm->private = comp->backend->create(comp->data);
 	/*
 	 * allocate 2 pages. 1 for compressed data, plus 1 extra for the
 	 * case when compressed size is larger than the original one
@@ -282,6 +290,10 @@ ssize_t zcomp_available_show(const char *comp, char *buf)
 					"%s ", backends[i]->name);
 		i++;
 	}
+	/* crypto API compressors are not listed, only when selected */
+	if (find_backend(comp) && !sysfs_streq(comp, find_backend(comp)->name))
+		sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2, "[%.*s] ",
+				(int)strcspn(comp, "\n"), comp);
 	sz += scnprintf(buf + sz, PAGE_SIZE - sz, "\n");
 	return sz;
 }
@@ -311,12 +323,19 @@ int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
 int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
 		size_t src_len, unsigned char *dst)
 {
-	return comp->backend->decompress(src, src_len, dst);
+	return comp->backend->decompress(src, src_len, dst, comp->data);
+}
+
+bool zcomp_may_sleep(struct zcomp *comp)
+{
+	return comp->backend->may_sleep;
 }
 
 void zcomp_destroy(struct zcomp *comp)
 {
 	comp->destroy(comp);
+	if (comp->backend->exit)
+		comp->backend->exit(comp->data);
 	kfree(comp);
 }
 
@@ -341,11 +360,23 @@ struct zcomp *zcomp_create(const char *compress, int max_strm)
 		return ERR_PTR(-ENOMEM);
 
 	comp->backend = backend;
+	if (backend->init) {
+		comp->data = backend->init(compress);
+		if (IS_ERR(comp->data)) {
+			int err = PTR_ERR(comp->data);
+
+			kfree(comp);
+			return ERR_PTR(err);
+		}
+	}
+
 	if (max_strm > 1)
 		zcomp_strm_multi_create(comp, max_strm);
 	else
 		zcomp_strm_single_create(comp);
 	if (!comp->stream) {
+		if (backend->exit)
+			backend->exit(comp->data);
 		kfree(comp);
 		return ERR_PTR(-ENOMEM);
 	}
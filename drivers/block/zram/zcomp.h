@@ -30,12 +30,23 @@ struct zcomp_backend {
 	int (*compress)(const unsigned char *src, unsigned char *dst,
 			size_t *dst_len, void *private);
 
+	/* called in atomic context, with the backend data */
 	int (*decompress)(const unsigned char *src, size_t src_len,
-			unsigned char *dst);
+			unsigned char *dst, void *data);
 
-	void *(*create)(void);
+	void *(*create)(void *data);
 	void (*destroy)(void *private);
 
+	/*
+	 * optional per-device backend data, for backends serving several
+	 * algorithms: init gets the requested algorithm name.
+	 */
+	void *(*init)(const char *name);
+	void (*exit)(void *data);
+
+	/* compress may sleep, the source page must not be atomically mapped */
+	bool may_sleep;
+
 	const char *name;
 };
 
@@ -43,6 +54,7 @@ struct zcomp_backend {
 struct zcomp {
 	void *stream;
 	struct zcomp_backend *backend;
+	void *data;
 
 	struct zcomp_strm *(*strm_find)(struct zcomp *comp);
 	void (*strm_release)(struct zcomp *comp, struct zcomp_strm *zstrm);
@@ -65,4 +77,5 @@ int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
 		size_t src_len, unsigned char *dst);
 
 bool zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+bool zcomp_may_sleep(struct zcomp *comp);
 #endif /* _ZCOMP_H_ */
@@ -0,0 +1,139 @@
+/*
+ * Compression backend for any compressor registered with the crypto API,
+ * software or hardware.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zcomp_crypto.h"
+
+/*
+ * Each compression stream has its own transform, used with the stream
+ * held and the source page mapped with kmap(): the compressor may sleep
+ * waiting for its engine, while the other streams carry on.  Decompression
+ * runs under the zram slot lock, from the transform of the current CPU.
+ */
+struct zcomp_crypto_data {
+	char name[CRYPTO_MAX_ALG_NAME];
+	struct crypto_comp * __percpu *tfm;
+};
+
+static void zcomp_crypto_name(char *dst, const char *name)
+{
+	strlcpy(dst, name, CRYPTO_MAX_ALG_NAME);
+	strim(dst);
+}
+
+bool zcomp_crypto_has(const char *name)
+{
+	char alg[CRYPTO_MAX_ALG_NAME];
+
+	zcomp_crypto_name(alg, name);
+	return alg[0] && crypto_has_comp(alg, 0, 0);
+}
+
+static void zcomp_crypto_exit(void *data)
+{
+	struct zcomp_crypto_data *zc = data;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = *per_cpu_ptr(zc->tfm, cpu);
+
+		if (!IS_ERR_OR_NULL(tfm))
+			crypto_free_comp(tfm);
+	}
+	free_percpu(zc->tfm);
+	kfree(zc);
+}
+
+static void *zcomp_crypto_init(const char *name)
+{
+	struct zcomp_crypto_data *zc;
+	int cpu;
+
+	zc = kzalloc(sizeof(*zc), GFP_KERNEL);
+	if (!zc)
+		return ERR_PTR(-ENOMEM);
+	zcomp_crypto_name(zc->name, name);
+
+	zc->tfm = alloc_percpu(struct crypto_comp *);
+	if (!zc->tfm) {
+		kfree(zc);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = crypto_alloc_comp(zc->name, 0, 0);
+
+		*per_cpu_ptr(zc->tfm, cpu) = tfm;
+		if (IS_ERR(tfm)) {
+			zcomp_crypto_exit(zc);
+			return tfm;
+		}
+	}
+
+	return zc;
+}
+
+static void *zcomp_crypto_create(void *data)
+{
+	struct zcomp_crypto_data *zc = data;
+	struct crypto_comp *tfm = crypto_alloc_comp(zc->name, 0, 0);
+
+	return IS_ERR(tfm) ? NULL : tfm;
+}
+
+static void zcomp_crypto_destroy(void *private)
+{
+	crypto_free_comp(private);
+}
+
+static int zcomp_crypto_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *private)
+{
+	/* the stream buffer is two pages */
+	unsigned int len = 2 * PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &len);
+	*dst_len = len;
+	return ret;
+}
+
+static int zcomp_crypto_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, void *data)
+{
+	struct zcomp_crypto_data *zc = data;
+	unsigned int len = PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_decompress(*get_cpu_ptr(zc->tfm), src, src_len,
+				     dst, &len);
+	put_cpu_ptr(zc->tfm);
+
+	if (!ret && len != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+struct zcomp_backend zcomp_crypto = {
+	.compress = zcomp_crypto_compress,
+	.decompress = zcomp_crypto_decompress,
+	.create = zcomp_crypto_create,
+	.destroy = zcomp_crypto_destroy,
+	.init = zcomp_crypto_init,
+	.exit = zcomp_crypto_exit,
+	.may_sleep = true,
+	.name = "crypto",
+};
@@ -0,0 +1,17 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _ZCOMP_CRYPTO_H_
+#define _ZCOMP_CRYPTO_H_
+
+#include "zcomp.h"
+
+extern struct zcomp_backend zcomp_crypto;
+
+bool zcomp_crypto_has(const char *name);
+
+#endif /* _ZCOMP_CRYPTO_H_ */
@@ -13,7 +13,7 @@
 
 #include "zcomp_lz4.h"
 
-static void *zcomp_lz4_create(void)
+static void *zcomp_lz4_create(void *data)
 {
 	return kzalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
 }
@@ -31,7 +31,7 @@ static int zcomp_lz4_compress(const unsigned char *src, unsigned char *dst,
 }
 
 static int zcomp_lz4_decompress(const unsigned char *src, size_t src_len,
-		unsigned char *dst)
+		unsigned char *dst, void *data)
 {
 	size_t dst_len = PAGE_SIZE;
 	/* return  : Success if return 0 */
@@ -576,6 +576,14 @@ static inline void update_used_max(struct zram *zram,
 	} while (old_max != cur_max);
 }
 
+static void zram_kunmap(struct page *page, void *mem, bool sleeping)
+{
+	if (sleeping)
+		kunmap(page);
+	else
+		kunmap_atomic(mem);
+}
+
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
@@ -587,6 +595,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	struct zram_meta *meta = zram->meta;
 	struct zcomp_strm *zstrm;
 	bool locked = false;
+	bool sleeping;
 	unsigned long alloced_pages;
 
 	page = bvec->bv_page;
@@ -607,12 +616,14 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	zstrm = zcomp_strm_find(zram->comp);
 	locked = true;
-	user_mem = kmap_atomic(page);
+	/* a compressor which may sleep can't work from an atomic mapping */
+	sleeping = zcomp_may_sleep(zram->comp);
+	user_mem = sleeping ? kmap(page) : kmap_atomic(page);
 
 	if (is_partial_io(bvec)) {
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
-		kunmap_atomic(user_mem);
+		zram_kunmap(page, user_mem, sleeping);
 		user_mem = NULL;
 	} else {
 		uncmem = user_mem;
@@ -620,7 +631,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		if (user_mem)
-			kunmap_atomic(user_mem);
+			zram_kunmap(page, user_mem, sleeping);
 		/* Free memory associated with this sector now. */
 		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
 		zram_free_page(zram, index);
@@ -634,7 +645,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 	if (!is_partial_io(bvec)) {
-		kunmap_atomic(user_mem);
+		zram_kunmap(page, user_mem, sleeping);
 		user_mem = NULL;
 		uncmem = NULL;
 	}
@@ -12,40 +12,128 @@
 #include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/io.h>
+#include <linux/interrupt.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 #include <linux/hw_random.h>
 #include <linux/platform_device.h>
 
 #define TRNG_CR		0x00
+#define TRNG_IER	0x10
+#define TRNG_IDR	0x14
 #define TRNG_ISR	0x1c
 #define TRNG_ODATA	0x50
 
 #define TRNG_KEY	0x524e4700 /* RNG */
+#define TRNG_DATRDY	BIT(0)
+
+/* words collected by the interrupt handler between two reads */
+#define TRNG_POOL_WORDS	16
+#define TRNG_TIMEOUT	msecs_to_jiffies(10)
 
 struct atmel_trng {
 	struct clk *clk;
 	void __iomem *base;
 	struct hwrng rng;
+	int irq;
+
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	u32 pool[TRNG_POOL_WORDS];
+	unsigned int pool_cnt;
 };
 
+/* Must be called with trng->lock held */
+static bool atmel_trng_get(struct atmel_trng *trng, u32 *data)
+{
+	/* data ready? */
+	if (!(readl(trng->base + TRNG_ISR) & TRNG_DATRDY))
+		return false;
+
+	*data = readl(trng->base + TRNG_ODATA);
+	/*
+	  ensure data ready is only set again AFTER the next data
+	  word is ready in case it got set between checking ISR
+	  and reading ODATA, so we don't risk re-reading the
+	  same word
+	*/
+	readl(trng->base + TRNG_ISR);
+
+	return true;
+}
+
+static irqreturn_t atmel_trng_irq(int irq, void *dev_id)
+{
+	struct atmel_trng *trng = dev_id;
+	irqreturn_t ret = IRQ_NONE;
+
+	spin_lock(&trng->lock);
+
+	if (trng->pool_cnt < TRNG_POOL_WORDS &&
+	    atmel_trng_get(trng, &trng->pool[trng->pool_cnt])) {
+		trng->pool_cnt++;
+		ret = IRQ_HANDLED;
+	}
+
+	/* stop once the pool is full, the next read re-enables it */
+	if (trng->pool_cnt == TRNG_POOL_WORDS) {
+		writel(TRNG_DATRDY, trng->base + TRNG_IDR);
+		ret = IRQ_HANDLED;
+	}
+
+	spin_unlock(&trng->lock);
+
+	if (ret == IRQ_HANDLED)
+		wake_up(&trng->wait);
+
+	return ret;
+}
+
+/*
+ * Fill as much of the buffer as possible: first from the pool the interrupt
+ * handler collected since the last call, then straight from the TRNG while it
+ * keeps up. Only when nothing at all is available and the caller may block,
+ * wait for the next word to be signalled.
+ */
 static int atmel_trng_read(struct hwrng *rng, void *buf, size_t max,
 			   bool wait)
 {
 	struct atmel_trng *trng = container_of(rng, struct atmel_trng, rng);
+	size_t words = max / sizeof(u32), len = 0;
 	u32 *data = buf;
+	unsigned long flags;
+	unsigned int n;
 
-	/* data ready? */
-	if (readl(trng->base + TRNG_ISR) & 1) {
-		*data = readl(trng->base + TRNG_ODATA);
-		/*
-		  ensure data ready is only set again AFTER the next data
-		  word is ready in case it got set between checking ISR
-		  and reading ODATA, so we don't risk re-reading the
-		  same word
-		*/
-		readl(trng->base + TRNG_ISR);
-		return 4;
-	} else
+	if (!words)
 		return 0;
+
+	for (;;) {
+		spin_lock_irqsave(&trng->lock, flags);
+
+		n = min_t(size_t, trng->pool_cnt, words);
+		trng->pool_cnt -= n;
+		memcpy(data, &trng->pool[trng->pool_cnt], n * sizeof(u32));
+		len = n;
+
+		while (len < words && atmel_trng_get(trng, &data[len]))
+			len++;
+
+		if (trng->irq > 0)
+			writel(TRNG_DATRDY, trng->base + TRNG_IER);
+
+		spin_unlock_irqrestore(&trng->lock, flags);
+
+		if (len || !wait || trng->irq <= 0)
+			break;
+
+		if (wait_event_interruptible_timeout(trng->wait,
+				ACCESS_ONCE(trng->pool_cnt),
+				TRNG_TIMEOUT) <= 0)
+			break;
+	}
+
+	return len * sizeof(u32);
 }
 
 static int atmel_trng_probe(struct platform_device *pdev)
@@ -67,6 +155,18 @@ static int atmel_trng_probe(struct platform_device *pdev)
 	if (IS_ERR(trng->clk))
 		return PTR_ERR(trng->clk);
 
+	spin_lock_init(&trng->lock);
+	init_waitqueue_head(&trng->wait);
+
+	/* without an interrupt, the TRNG is simply polled */
+	trng->irq = platform_get_irq(pdev, 0);
+	if (trng->irq > 0) {
+		ret = devm_request_irq(&pdev->dev, trng->irq, atmel_trng_irq,
+				       0, dev_name(&pdev->dev), trng);
+		if (ret)
+			return ret;
+	}
+
 	ret = clk_prepare_enable(trng->clk);
 	if (ret)
 		return ret;
@@ -94,6 +194,7 @@ static int atmel_trng_remove(struct platform_device *pdev)
 
 	hwrng_unregister(&trng->rng);
 
+	writel(TRNG_DATRDY, trng->base + TRNG_IDR);
 	writel(TRNG_KEY, trng->base + TRNG_CR);
 	clk_disable_unprepare(trng->clk);
 
@@ -105,6 +206,7 @@ static int atmel_trng_suspend(struct device *dev)
 {
 	struct atmel_trng *trng = dev_get_drvdata(dev);
 
+	writel(TRNG_DATRDY, trng->base + TRNG_IDR);
 	clk_disable_unprepare(trng->clk);
 
 	return 0;
@@ -33,6 +33,7 @@ struct clk_generated {
 	u32 id;
 	u32 gckdiv;
 	u8 parent_id;
+	struct clk_rate_cache cache;
 };
 
 #define to_clk_generated(hw) \
@@ -110,6 +111,10 @@ static long clk_generated_determine_rate(struct clk_hw *hw,
 	int tmp_diff;
 	int i;
 
+	if (clk_rate_cache_lookup(&gck->cache, hw, rate, &best_rate,
+				  best_parent_rate, best_parent_hw))
+		return best_rate;
+
 	for (i = 0; i < __clk_get_num_parents(hw->clk); i++) {
 		u32 div;
 		unsigned long parent_rate;
@@ -148,6 +153,9 @@ static long clk_generated_determine_rate(struct clk_hw *hw,
 		 __FUNCTION__ , best_rate,
 		 __clk_get_name((*best_parent_hw)->clk), *best_parent_rate);
 
+	clk_rate_cache_store(&gck->cache, hw, rate, best_rate,
+			     *best_parent_rate, *best_parent_hw);
+
 	return best_rate;
 }
 
@@ -94,11 +94,7 @@ static int clk_main_osc_prepare(struct clk_hw *hw)
 		pmc_write(pmc, AT91_CKGR_MOR, tmp);
 	}
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCS)) {
-		enable_irq(osc->irq);
-		wait_event(osc->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCS);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_MOSCS, osc->irq, &osc->wait);
 
 	return 0;
 }
@@ -238,11 +234,7 @@ static int clk_main_rc_osc_prepare(struct clk_hw *hw)
 		pmc_write(pmc, AT91_CKGR_MOR, tmp);
 	}
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCRCS)) {
-		enable_irq(osc->irq);
-		wait_event(osc->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCRCS);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_MOSCRCS, osc->irq, &osc->wait);
 
 	return 0;
 }
@@ -493,11 +485,7 @@ static int clk_sam9x5_main_prepare(struct clk_hw *hw)
 	struct clk_sam9x5_main *clkmain = to_clk_sam9x5_main(hw);
 	struct at91_pmc *pmc = clkmain->pmc;
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCSELS)) {
-		enable_irq(clkmain->irq);
-		wait_event(clkmain->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCSELS);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_MOSCSELS, clkmain->irq, &clkmain->wait);
 
 	return clk_main_probe_frequency(pmc);
 }
@@ -533,11 +521,7 @@ static int clk_sam9x5_main_set_parent(struct clk_hw *hw, u8 index)
 	else if (!index && (tmp & AT91_PMC_MOSCSEL))
 		pmc_write(pmc, AT91_CKGR_MOR, tmp & ~AT91_PMC_MOSCSEL);
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCSELS)) {
-		enable_irq(clkmain->irq);
-		wait_event(clkmain->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MOSCSELS);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_MOSCSELS, clkmain->irq, &clkmain->wait);
 
 	return 0;
 }
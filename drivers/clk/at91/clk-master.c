@@ -65,11 +65,7 @@ static int clk_master_prepare(struct clk_hw *hw)
 	struct clk_master *master = to_clk_master(hw);
 	struct at91_pmc *pmc = master->pmc;
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MCKRDY)) {
-		enable_irq(master->irq);
-		wait_event(master->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MCKRDY);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_MCKRDY, master->irq, &master->wait);
 
 	return 0;
 }
@@ -131,6 +127,157 @@ static const struct clk_ops master_ops = {
 	.get_parent = clk_master_get_parent,
 };
 
+/*
+ * The processor clock is the master clock source divided by the
+ * prescaler, MCK is that clock further divided by MDIV.  Changing PRES and
+ * MDIV together, keeping their product, scales the processor clock while
+ * MCK, and so every bus, peripheral and DDR clock, stays where it is.
+ */
+#define to_clk_master_cpu(hw) container_of(hw, struct clk_master_cpu, hw)
+
+struct clk_master_cpu {
+	struct clk_hw hw;
+	struct clk_master *master;
+};
+
+static unsigned long clk_master_pres_rate(struct clk_master *master,
+					  unsigned long rate, u8 pres)
+{
+	if (master->characteristics->have_div3_pres && pres == MASTER_PRES_MAX)
+		return rate / 3;
+
+	return rate >> pres;
+}
+
+static unsigned long clk_master_source_rate(struct clk_master *master)
+{
+	return __clk_get_rate(__clk_get_parent(master->hw.clk));
+}
+
+static unsigned long clk_master_cpu_recalc_rate(struct clk_hw *hw,
+						unsigned long parent_rate)
+{
+	struct clk_master *master = to_clk_master_cpu(hw)->master;
+	u32 tmp;
+	u8 pres;
+
+	tmp = pmc_read(master->pmc, AT91_PMC_MCKR) & master->layout->mask;
+	pres = (tmp >> master->layout->pres_shift) & MASTER_PRES_MASK;
+
+	return clk_master_pres_rate(master, clk_master_source_rate(master),
+				    pres);
+}
+
+/*
+ * Find the PRES/MDIV pair giving the processor clock closest to @rate
+ * whose MCK is @mck.
+ */
+static long clk_master_cpu_get_best_pres_div(struct clk_master *master,
+					     unsigned long rate,
+					     unsigned long mck,
+					     u8 *pres, u8 *div)
+{
+	const struct clk_master_characteristics *characteristics =
+						master->characteristics;
+	unsigned long source = clk_master_source_rate(master);
+	unsigned long bestdiff = ULONG_MAX;
+	long bestrate = -ERANGE;
+	int p, d;
+
+	for (p = 0; p <= MASTER_PRES_MAX; p++) {
+		unsigned long pck = clk_master_pres_rate(master, source, p);
+
+		for (d = 0; d <= MASTER_DIV_MASK; d++) {
+			unsigned long diff;
+
+			if (!characteristics->divisors[d] ||
+			    pck / characteristics->divisors[d] != mck)
+				continue;
+
+			diff = abs(rate - pck);
+			if (diff < bestdiff) {
+				bestdiff = diff;
+				bestrate = pck;
+				if (pres)
+					*pres = p;
+				if (div)
+					*div = d;
+			}
+		}
+	}
+
+	return bestrate;
+}
+
+static long clk_master_cpu_round_rate(struct clk_hw *hw, unsigned long rate,
+				      unsigned long *parent_rate)
+{
+	struct clk_master *master = to_clk_master_cpu(hw)->master;
+
+	return clk_master_cpu_get_best_pres_div(master, rate, *parent_rate,
+						NULL, NULL);
+}
+
+static void clk_master_wait_ready(struct at91_pmc *pmc)
+{
+	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_MCKRDY))
+		cpu_relax();
+}
+
+static int clk_master_cpu_set_rate(struct clk_hw *hw, unsigned long rate,
+				   unsigned long parent_rate)
+{
+	struct clk_master *master = to_clk_master_cpu(hw)->master;
+	const struct clk_master_layout *layout = master->layout;
+	struct at91_pmc *pmc = master->pmc;
+	u32 pres_mask = MASTER_PRES_MASK << layout->pres_shift;
+	u32 div_mask = MASTER_DIV_MASK << MASTER_DIV_SHIFT;
+	unsigned long flags, cur;
+	u32 mckr, tmp, first;
+	long ret;
+	u8 pres, div;
+
+	ret = clk_master_cpu_get_best_pres_div(master, rate, parent_rate,
+					       &pres, &div);
+	if (ret < 0)
+		return ret;
+	if (ret != rate)
+		return -EINVAL;
+
+	local_irq_save(flags);
+	pmc_lock(pmc);
+
+	mckr = pmc_read(pmc, AT91_PMC_MCKR);
+	cur = clk_master_pres_rate(master, clk_master_source_rate(master),
+				   (mckr >> layout->pres_shift) &
+				   MASTER_PRES_MASK);
+
+	tmp = mckr & ~(pres_mask | div_mask);
+	tmp |= (pres << layout->pres_shift) | (div << MASTER_DIV_SHIFT);
+
+	/*
+	 * PRES and MDIV are changed in two writes.  Update first the field
+	 * raising the total division, so that MCK undershoots in between
+	 * instead of overclocking the bus.
+	 */
+	first = rate < cur ? pres_mask : div_mask;
+	pmc_write(pmc, AT91_PMC_MCKR, (mckr & ~first) | (tmp & first));
+	clk_master_wait_ready(pmc);
+	pmc_write(pmc, AT91_PMC_MCKR, tmp);
+	clk_master_wait_ready(pmc);
+
+	pmc_unlock(pmc);
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+static const struct clk_ops master_cpu_ops = {
+	.recalc_rate = clk_master_cpu_recalc_rate,
+	.round_rate = clk_master_cpu_round_rate,
+	.set_rate = clk_master_cpu_set_rate,
+};
+
 static struct clk * __init
 at91_clk_register_master(struct at91_pmc *pmc, unsigned int irq,
 		const char *name, int num_parents,
@@ -179,6 +326,37 @@ at91_clk_register_master(struct at91_pmc *pmc, unsigned int irq,
 	return clk;
 }
 
+static void __init at91_clk_register_master_cpu(struct clk *mck)
+{
+	struct clk_master_cpu *cpu;
+	struct clk *clk;
+	struct clk_init_data init;
+	const char *parent_name = __clk_get_name(mck);
+	struct clk_hw *hw = __clk_get_hw(mck);
+
+	cpu = kzalloc(sizeof(*cpu), GFP_KERNEL);
+	if (!cpu)
+		return;
+
+	init.name = "cpuck";
+	init.ops = &master_cpu_ops;
+	init.parent_names = &parent_name;
+	init.num_parents = 1;
+	init.flags = CLK_GET_RATE_NOCACHE;
+
+	cpu->hw.init = &init;
+	cpu->master = to_clk_master(hw);
+
+	clk = clk_register(NULL, &cpu->hw);
+	if (IS_ERR(clk)) {
+		kfree(cpu);
+		return;
+	}
+
+	/* found by cpufreq-dt when the cpu node has no clocks property */
+	clk_register_clkdev(clk, NULL, "cpu0");
+}
+
 
 static const struct clk_master_layout at91rm9200_master_layout = {
 	.mask = 0x31F,
@@ -255,6 +433,7 @@ of_at91_clk_master_setup(struct device_node *np, struct at91_pmc *pmc,
 		goto out_free_characteristics;
 
 	of_clk_add_provider(np, of_clk_src_simple_get, clk);
+	at91_clk_register_master_cpu(clk);
 	return;
 
 out_free_characteristics:
@@ -118,11 +118,7 @@ static int clk_pll_prepare(struct clk_hw *hw)
 		((pll->mul & layout->mul_mask) << layout->mul_shift));
 	pmc_write(pmc, offset, pllr);
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & mask)) {
-		enable_irq(pll->irq);
-		wait_event(pll->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & mask);
-	}
+	at91_pmc_wait_ready(pmc, hw, mask, pll->irq, &pll->wait);
 
 	return 0;
 }
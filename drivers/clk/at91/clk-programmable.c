@@ -37,6 +37,7 @@ struct clk_programmable {
 	struct at91_pmc *pmc;
 	u8 id;
 	const struct clk_programmable_layout *layout;
+	struct clk_rate_cache cache;
 };
 
 #define to_clk_programmable(hw) container_of(hw, struct clk_programmable, hw)
@@ -61,6 +62,7 @@ static long clk_programmable_determine_rate(struct clk_hw *hw,
 					    unsigned long *best_parent_rate,
 					    struct clk_hw **best_parent_hw)
 {
+	struct clk_programmable *prog = to_clk_programmable(hw);
 	struct clk *parent = NULL;
 	long best_rate = -EINVAL;
 	unsigned long parent_rate;
@@ -68,6 +70,10 @@ static long clk_programmable_determine_rate(struct clk_hw *hw,
 	int shift;
 	int i;
 
+	if (clk_rate_cache_lookup(&prog->cache, hw, rate, &best_rate,
+				  best_parent_rate, best_parent_hw))
+		return best_rate;
+
 	for (i = 0; i < __clk_get_num_parents(hw->clk); i++) {
 		parent = clk_get_parent_by_index(hw->clk, i);
 		if (!parent)
@@ -93,6 +99,9 @@ static long clk_programmable_determine_rate(struct clk_hw *hw,
 			break;
 	}
 
+	clk_rate_cache_store(&prog->cache, hw, rate, best_rate,
+			     *best_parent_rate, *best_parent_hw);
+
 	return best_rate;
 }
 
@@ -60,14 +60,8 @@ static int clk_system_prepare(struct clk_hw *hw)
 	if (!is_pck(sys->id))
 		return 0;
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & mask)) {
-		if (sys->irq) {
-			enable_irq(sys->irq);
-			wait_event(sys->wait,
-				   pmc_read(pmc, AT91_PMC_SR) & mask);
-		} else
-			cpu_relax();
-	}
+	at91_pmc_wait_ready(pmc, hw, mask, sys->irq, &sys->wait);
+
 	return 0;
 }
 
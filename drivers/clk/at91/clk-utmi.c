@@ -52,11 +52,7 @@ static int clk_utmi_prepare(struct clk_hw *hw)
 
 	pmc_write(pmc, AT91_CKGR_UCKR, tmp);
 
-	while (!(pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_LOCKU)) {
-		enable_irq(utmi->irq);
-		wait_event(utmi->wait,
-			   pmc_read(pmc, AT91_PMC_SR) & AT91_PMC_LOCKU);
-	}
+	at91_pmc_wait_ready(pmc, hw, AT91_PMC_LOCKU, utmi->irq, &utmi->wait);
 
 	return 0;
 }
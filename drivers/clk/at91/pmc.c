@@ -20,11 +20,24 @@
 #include <linux/irqdomain.h>
 #include <linux/of_irq.h>
 #include <linux/mfd/syscon.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 
 #include <asm/proc-fns.h>
 
 #include "pmc.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/at91_pmc.h>
+
+/*
+ * Most PMC status bits (MCKRDY, MOSCSELS, the PLL locks once the startup
+ * count is short) rise within a few microseconds, well before the interrupt
+ * round trip and the wake up of the waiter are done.
+ */
+#define AT91_PMC_POLL_US	50
+
 void __iomem *at91_pmc_base;
 EXPORT_SYMBOL_GPL(at91_pmc_base);
 
@@ -66,6 +79,101 @@ int of_at91_get_clk_range(struct device_node *np, const char *propname,
 }
 EXPORT_SYMBOL_GPL(of_at91_get_clk_range);
 
+static bool clk_rate_cache_parents_match(struct clk_rate_cache *cache,
+					 struct clk_hw *hw, bool update)
+{
+	int num_parents = __clk_get_num_parents(hw->clk);
+	bool match = true;
+	int i;
+
+	if (num_parents > CLK_RATE_CACHE_MAX_PARENTS)
+		return false;
+
+	for (i = 0; i < num_parents; i++) {
+		struct clk *parent = clk_get_parent_by_index(hw->clk, i);
+		unsigned long parent_rate = parent ? __clk_get_rate(parent) : 0;
+
+		if (cache->parent_rates[i] != parent_rate)
+			match = false;
+		if (update)
+			cache->parent_rates[i] = parent_rate;
+		else if (!match)
+			break;
+	}
+
+	return match;
+}
+
+/*
+ * Called with the clk prepare lock held, from determine_rate.  Returns true
+ * and the cached choice when @rate was the last rate asked for and all the
+ * parents still run at the rates they had then.
+ */
+bool clk_rate_cache_lookup(struct clk_rate_cache *cache, struct clk_hw *hw,
+			   unsigned long rate, long *best_rate,
+			   unsigned long *best_parent_rate,
+			   struct clk_hw **best_parent_hw)
+{
+	if (!cache->valid || cache->rate != rate ||
+	    !clk_rate_cache_parents_match(cache, hw, false))
+		return false;
+
+	*best_rate = cache->best_rate;
+	*best_parent_rate = cache->best_parent_rate;
+	*best_parent_hw = cache->best_parent_hw;
+
+	return true;
+}
+
+void clk_rate_cache_store(struct clk_rate_cache *cache, struct clk_hw *hw,
+			  unsigned long rate, long best_rate,
+			  unsigned long best_parent_rate,
+			  struct clk_hw *best_parent_hw)
+{
+	if (best_rate < 0 || !best_parent_hw) {
+		cache->valid = false;
+		return;
+	}
+
+	clk_rate_cache_parents_match(cache, hw, true);
+	cache->rate = rate;
+	cache->best_rate = best_rate;
+	cache->best_parent_rate = best_parent_rate;
+	cache->best_parent_hw = best_parent_hw;
+	cache->valid = __clk_get_num_parents(hw->clk) <=
+		       CLK_RATE_CACHE_MAX_PARENTS;
+}
+
+/*
+ * Wait for @mask to be set in the PMC status register after a clock was
+ * started or switched: spin for AT91_PMC_POLL_US first, then sleep until the
+ * PMC interrupt @irq reports it.  Without an interrupt, just keep spinning.
+ * Called from prepare and set_parent, with the clk prepare lock held.
+ */
+void at91_pmc_wait_ready(struct at91_pmc *pmc, struct clk_hw *hw, u32 mask,
+			 unsigned int irq, wait_queue_head_t *wait)
+{
+	ktime_t start = ktime_get();
+	bool slept = false;
+	s64 delta;
+
+	while (!(pmc_read(pmc, AT91_PMC_SR) & mask)) {
+		delta = ktime_us_delta(ktime_get(), start);
+		if (!irq || delta < AT91_PMC_POLL_US) {
+			cpu_relax();
+			continue;
+		}
+
+		enable_irq(irq);
+		wait_event(*wait, pmc_read(pmc, AT91_PMC_SR) & mask);
+		slept = true;
+	}
+
+	trace_at91_pmc_wait_ready(__clk_get_name(hw->clk), mask,
+				  ktime_to_ns(ktime_sub(ktime_get(), start)),
+				  slept);
+}
+
 static void pmc_irq_mask(struct irq_data *d)
 {
 	struct at91_pmc *pmc = irq_data_get_irq_chip_data(d);
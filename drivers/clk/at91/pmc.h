@@ -16,6 +16,7 @@
 #include <linux/irqdomain.h>
 #include <linux/regmap.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
 
 struct clk_range {
 	unsigned long min;
@@ -24,6 +25,21 @@ struct clk_range {
 
 #define CLK_RANGE(MIN, MAX) {.min = MIN, .max = MAX,}
 
+#define CLK_RATE_CACHE_MAX_PARENTS	6
+
+/*
+ * Last determine_rate result of a mux/divider clock, valid as long as the
+ * same rate is asked for and no parent rate has changed.
+ */
+struct clk_rate_cache {
+	unsigned long rate;
+	long best_rate;
+	unsigned long best_parent_rate;
+	struct clk_hw *best_parent_hw;
+	unsigned long parent_rates[CLK_RATE_CACHE_MAX_PARENTS];
+	bool valid;
+};
+
 struct at91_pmc_caps {
 	u32 available_irqs;
 };
@@ -64,6 +80,18 @@ static inline void pmc_write(struct at91_pmc *pmc, int offset, u32 value)
 int of_at91_get_clk_range(struct device_node *np, const char *propname,
 			  struct clk_range *range);
 
+bool clk_rate_cache_lookup(struct clk_rate_cache *cache, struct clk_hw *hw,
+			   unsigned long rate, long *best_rate,
+			   unsigned long *best_parent_rate,
+			   struct clk_hw **best_parent_hw);
+void clk_rate_cache_store(struct clk_rate_cache *cache, struct clk_hw *hw,
+			  unsigned long rate, long best_rate,
+			  unsigned long best_parent_rate,
+			  struct clk_hw *best_parent_hw);
+
+void at91_pmc_wait_ready(struct at91_pmc *pmc, struct clk_hw *hw, u32 mask,
+			 unsigned int irq, wait_queue_head_t *wait);
+
 extern void __init of_at91sam9260_clk_slow_setup(struct device_node *np,
 						 struct at91_pmc *pmc);
 
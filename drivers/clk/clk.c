@@ -2950,6 +2950,8 @@ int of_clk_add_provider(struct device_node *np,
 	ret = of_clk_set_defaults(np, true);
 	if (ret < 0)
 		of_clk_del_provider(np);
+	else
+		driver_deferred_probe_supplier(PROBE_DEFER_CLK);
 
 	return ret;
 }
@@ -201,6 +201,8 @@ struct clk *clk_get(struct device *dev, const char *con_id)
 
 	if (dev) {
 		clk = __of_clk_get_by_name(dev->of_node, dev_id, con_id);
+		if (PTR_ERR(clk) == -EPROBE_DEFER)
+			driver_deferred_probe_wait(dev, PROBE_DEFER_CLK);
 		if (!IS_ERR(clk) || PTR_ERR(clk) == -EPROBE_DEFER)
 			return clk;
 	}
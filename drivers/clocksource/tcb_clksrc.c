@@ -3,6 +3,7 @@
 #include <linux/clockchips.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/sched_clock.h>
 
 #include <linux/clk.h>
 #include <linux/err.h>
@@ -21,10 +22,13 @@
  *     resolution better than 200 nsec).
  *   - Some chips support 32 bit counter. A single channel is used for
  *     this 32 bit free-running counter. the second channel is not used.
+ *     Either counter also backs sched_clock().
  *
  *   - The third channel may be used to provide a 16-bit clockevent
  *     source, used in either periodic or oneshot mode.  This runs
  *     at 32 KiHZ, and can handle delays of up to two seconds.
+ *     With CONFIG_ATMEL_TCB_CLKEVT_MCK and 32 bit counters it runs
+ *     from the clocksource's divided master clock instead.
  *
  * A boot clocksource and clockevent source are also currently needed,
  * unless the relevant platforms (ARM/AT91, AVR32/AT32) are changed so
@@ -41,7 +45,7 @@
 
 static void __iomem *tcaddr;
 
-static cycle_t tc_get_cycles(struct clocksource *cs)
+static cycle_t notrace tc_get_cycles(struct clocksource *cs)
 {
 	unsigned long	flags;
 	u32		lower, upper;
@@ -56,11 +60,23 @@ static cycle_t tc_get_cycles(struct clocksource *cs)
 	return (upper << 16) | lower;
 }
 
-static cycle_t tc_get_cycles32(struct clocksource *cs)
+static cycle_t notrace tc_get_cycles32(struct clocksource *cs)
 {
 	return __raw_readl(tcaddr + ATMEL_TC_REG(0, CV));
 }
 
+#ifdef CONFIG_GENERIC_SCHED_CLOCK
+static u64 notrace tc_sched_clock_read(void)
+{
+	return tc_get_cycles(NULL);
+}
+
+static u64 notrace tc_sched_clock_read32(void)
+{
+	return tc_get_cycles32(NULL);
+}
+#endif
+
 static struct clocksource clksrc = {
 	.name           = "tcb_clksrc",
 	.rating         = 200,
@@ -82,14 +98,16 @@ static struct tc_clkevt_device *to_tc_clkevt(struct clock_event_device *clkevt)
 	return container_of(clkevt, struct tc_clkevt_device, clkevt);
 }
 
-/* For now, we always use the 32K clock ... this optimizes for NO_HZ,
- * because using one of the divided clocks would usually mean the
- * tick rate can never be less than several dozen Hz (vs 0.5 Hz).
+/* By default we use the 32K clock ... this optimizes for NO_HZ,
+ * because using one of the divided clocks with a 16 bit counter would
+ * mean the tick rate can never be less than several dozen Hz (vs 0.5 Hz).
  *
- * A divided clock could be good for high resolution timers, since
- * 30.5 usec resolution can seem "low".
+ * A divided clock is better for high resolution timers, since 30.5 usec
+ * resolution can seem "low".  With 32 bit counters it still allows
+ * delays of over a minute, so CONFIG_ATMEL_TCB_CLKEVT_MCK picks it there.
  */
 static u32 timer_clock;
+static u32 timer_rate = 32768;
 
 static void tc_mode(enum clock_event_mode m, struct clock_event_device *d)
 {
@@ -111,11 +129,12 @@ static void tc_mode(enum clock_event_mode m, struct clock_event_device *d)
 	case CLOCK_EVT_MODE_PERIODIC:
 		clk_enable(tcd->clk);
 
-		/* slow clock, count up to RC, then irq and restart */
+		/* count up to RC, then irq and restart */
 		__raw_writel(timer_clock
 				| ATMEL_TC_WAVE | ATMEL_TC_WAVESEL_UP_AUTO,
 				regs + ATMEL_TC_REG(2, CMR));
-		__raw_writel((32768 + HZ/2) / HZ, tcaddr + ATMEL_TC_REG(2, RC));
+		__raw_writel((timer_rate + HZ/2) / HZ,
+				tcaddr + ATMEL_TC_REG(2, RC));
 
 		/* Enable clock and interrupts on RC compare */
 		__raw_writel(ATMEL_TC_CPCS, regs + ATMEL_TC_REG(2, IER));
@@ -128,7 +147,7 @@ static void tc_mode(enum clock_event_mode m, struct clock_event_device *d)
 	case CLOCK_EVT_MODE_ONESHOT:
 		clk_enable(tcd->clk);
 
-		/* slow clock, count up to RC, then irq and stop */
+		/* count up to RC, then irq and stop */
 		__raw_writel(timer_clock | ATMEL_TC_CPCSTOP
 				| ATMEL_TC_WAVE | ATMEL_TC_WAVESEL_UP_AUTO,
 				regs + ATMEL_TC_REG(2, CMR));
@@ -178,11 +197,13 @@ static irqreturn_t ch2_irq(int irq, void *handle)
 	return IRQ_NONE;
 }
 
-static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
+static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx,
+		int mck_divisor_idx, u32 mck_rate)
 {
 	int ret;
 	struct clk *t2_clk = tc->clk[2];
 	int irq = tc->irq[2];
+	u32 max_delta = 0xffff;
 
 	/* try to enable t2 clk to avoid future errors in mode change */
 	ret = clk_prepare_enable(t2_clk);
@@ -194,6 +215,12 @@ static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
 	clkevt.clk = t2_clk;
 
 	timer_clock = clk32k_divisor_idx;
+	if (IS_ENABLED(CONFIG_ATMEL_TCB_CLKEVT_MCK)
+			&& tc->tcb_config && tc->tcb_config->counter_width == 32) {
+		timer_clock = mck_divisor_idx;
+		timer_rate = mck_rate;
+		max_delta = 0xffffffff;
+	}
 
 	clkevt.clkevt.cpumask = cpumask_of(0);
 
@@ -203,14 +230,15 @@ static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
 		return ret;
 	}
 
-	clockevents_config_and_register(&clkevt.clkevt, 32768, 1, 0xffff);
+	clockevents_config_and_register(&clkevt.clkevt, timer_rate, 1, max_delta);
 
 	return ret;
 }
 
 #else /* !CONFIG_GENERIC_CLOCKEVENTS */
 
-static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
+static int __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx,
+		int mck_divisor_idx, u32 mck_rate)
 {
 	/* NOTHING */
 	return 0;
@@ -340,10 +368,18 @@ static int __init tcb_clksrc_init(void)
 		goto err_disable_t1;
 
 	/* channel 2:  periodic and oneshot timer support */
-	ret = setup_clkevents(tc, clk32k_divisor_idx);
+	ret = setup_clkevents(tc, clk32k_divisor_idx, best_divisor_idx,
+			divided_rate);
 	if (ret)
 		goto err_unregister_clksrc;
 
+#ifdef CONFIG_GENERIC_SCHED_CLOCK
+	/* there's no way back from here, so only once all else is set up */
+	sched_clock_register(clksrc.read == tc_get_cycles32 ?
+			     tc_sched_clock_read32 : tc_sched_clock_read,
+			     32, divided_rate);
+#endif
+
 	return 0;
 
 err_unregister_clksrc:
@@ -43,7 +43,8 @@ struct pit_data {
 	struct clocksource		clksrc;
 
 	void __iomem	*base;
-	u32		cycle;
+	u32		cycle;		/* current interval, PIV + 1 */
+	u32		period;		/* interval for HZ */
 	u32		cnt;
 	unsigned int	irq;
 	struct clk	*mck;
@@ -91,7 +92,35 @@ static cycle_t read_pit_clk(struct clocksource *cs)
 }
 
 /*
- * Clockevent device:  interrupts every 1/HZ (== pit_cycles * MCK/16)
+ * The PIT has no compare register, so a oneshot event is emulated by
+ * stretching the current interval so that it ends @delta cycles from now.
+ * Writing PIV doesn't restart CPIV, which keeps the clocksource going as
+ * long as the periods elapsed with the old interval are folded into cnt
+ * first, and the new interval never ends before the current CPIV.
+ */
+static void pit_set_interval(struct pit_data *data, unsigned long delta,
+			     u32 flags)
+{
+	u32 t, cycle;
+
+	do {
+		t = pit_read(data->base, AT91_PIT_PIVR);
+		data->cnt += PIT_PICNT(t) * data->cycle;
+
+		/* delta is capped to PIV too, an early event is harmless */
+		cycle = min_t(unsigned long, PIT_CPIV(t) + delta,
+			      AT91_PIT_PIV + 1);
+		pit_write(data->base, AT91_PIT_MR, (cycle - 1) | flags);
+
+		/* the old interval may have ended just before the write */
+	} while (PIT_PICNT(pit_read(data->base, AT91_PIT_PIIR)));
+
+	data->cycle = cycle;
+}
+
+/*
+ * Clockevent device:  interrupts every 1/HZ (== pit_cycles * MCK/16),
+ * or once per event in oneshot mode.
  */
 static void
 pit_clkevt_mode(enum clock_event_mode mode, struct clock_event_device *dev)
@@ -100,14 +129,17 @@ pit_clkevt_mode(enum clock_event_mode mode, struct clock_event_device *dev)
 
 	switch (mode) {
 	case CLOCK_EVT_MODE_PERIODIC:
-		/* update clocksource counter */
-		data->cnt += data->cycle * PIT_PICNT(pit_read(data->base, AT91_PIT_PIVR));
-		pit_write(data->base, AT91_PIT_MR,
-			  (data->cycle - 1) | AT91_PIT_PITEN | AT91_PIT_PITIEN);
+		/*
+		 * Coming from oneshot, CPIV may be beyond the HZ period:
+		 * the first tick stretches, the irq handler shrinks PIV.
+		 */
+		pit_set_interval(data, data->period,
+				 AT91_PIT_PITEN | AT91_PIT_PITIEN);
 		break;
 	case CLOCK_EVT_MODE_ONESHOT:
-		BUG();
-		/* FALLTHROUGH */
+		/* irq off, and the longest interval until the first event */
+		pit_set_interval(data, AT91_PIT_PIV + 1, AT91_PIT_PITEN);
+		break;
 	case CLOCK_EVT_MODE_SHUTDOWN:
 	case CLOCK_EVT_MODE_UNUSED:
 		/* disable irq, leaving the clocksource active */
@@ -119,6 +151,16 @@ pit_clkevt_mode(enum clock_event_mode mode, struct clock_event_device *dev)
 	}
 }
 
+static int pit_clkevt_next_event(unsigned long delta,
+				 struct clock_event_device *dev)
+{
+	struct pit_data *data = clkevt_to_pit_data(dev);
+
+	pit_set_interval(data, delta, AT91_PIT_PITEN | AT91_PIT_PITIEN);
+
+	return 0;
+}
+
 static void at91sam926x_pit_suspend(struct clock_event_device *cedev)
 {
 	struct pit_data *data = clkevt_to_pit_data(cedev);
@@ -168,6 +210,17 @@ static irqreturn_t at91sam926x_pit_interrupt(int irq, void *dev_id)
 
 		/* Get number of ticks performed before irq, and ack it */
 		nr_ticks = PIT_PICNT(pit_read(data->base, AT91_PIT_PIVR));
+
+		/* back to the HZ period after a stretched first tick */
+		if (data->cycle != data->period) {
+			data->cnt += nr_ticks * data->cycle;
+			data->cycle = data->period;
+			pit_write(data->base, AT91_PIT_MR, (data->cycle - 1) |
+				  AT91_PIT_PITEN | AT91_PIT_PITIEN);
+			data->clkevt.event_handler(&data->clkevt);
+			return IRQ_HANDLED;
+		}
+
 		do {
 			data->cnt += data->cycle;
 			data->clkevt.event_handler(&data->clkevt);
@@ -177,6 +230,18 @@ static irqreturn_t at91sam926x_pit_interrupt(int irq, void *dev_id)
 		return IRQ_HANDLED;
 	}
 
+	if ((data->clkevt.mode == CLOCK_EVT_MODE_ONESHOT) &&
+	    (pit_read(data->base, AT91_PIT_SR) & AT91_PIT_PITS)) {
+		/*
+		 * Ack, and stay quiet until the next event is set.  A short
+		 * interval left running would overflow PICNT while idle.
+		 */
+		pit_set_interval(data, AT91_PIT_PIV + 1, AT91_PIT_PITEN);
+		data->clkevt.event_handler(&data->clkevt);
+
+		return IRQ_HANDLED;
+	}
+
 	return IRQ_NONE;
 }
 
@@ -194,7 +259,8 @@ static void __init at91sam926x_pit_common_init(struct pit_data *data)
 	 * 1/HZ period (instead of a compile-time constant LATCH).
 	 */
 	pit_rate = clk_get_rate(data->mck) / 16;
-	data->cycle = DIV_ROUND_CLOSEST(pit_rate, HZ);
+	data->period = DIV_ROUND_CLOSEST(pit_rate, HZ);
+	data->cycle = data->period;
 	WARN_ON(((data->cycle - 1) & ~AT91_PIT_PIV) != 0);
 
 	/* Initialize and enable the timer */
@@ -221,16 +287,19 @@ static void __init at91sam926x_pit_common_init(struct pit_data *data)
 
 	/* Set up and register clockevents */
 	data->clkevt.name = "pit";
-	data->clkevt.features = CLOCK_EVT_FEAT_PERIODIC;
-	data->clkevt.shift = 32;
-	data->clkevt.mult = div_sc(pit_rate, NSEC_PER_SEC, data->clkevt.shift);
+	data->clkevt.features = CLOCK_EVT_FEAT_PERIODIC
+				| CLOCK_EVT_FEAT_ONESHOT;
 	data->clkevt.rating = 100;
 	data->clkevt.cpumask = cpumask_of(0);
 
 	data->clkevt.set_mode = pit_clkevt_mode;
+	data->clkevt.set_next_event = pit_clkevt_next_event;
 	data->clkevt.resume = at91sam926x_pit_resume;
 	data->clkevt.suspend = at91sam926x_pit_suspend;
-	clockevents_register_device(&data->clkevt);
+
+	/* a few cycles of margin over the MR write, up to a full PIV */
+	clockevents_config_and_register(&data->clkevt, pit_rate, 16,
+					AT91_PIT_PIV + 1);
 }
 
 static void __init at91sam926x_pit_dt_init(struct device_node *node)
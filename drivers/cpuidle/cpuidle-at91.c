@@ -8,9 +8,13 @@
  * warranty of any kind, whether express or implied.
  *
  * The cpu idle uses wait-for-interrupt and RAM self refresh in order
- * to implement two idle states -
+ * to implement up to three idle states -
  * #1 wait-for-interrupt
  * #2 wait-for-interrupt and RAM self refresh
+ * #3 as #2, with the master clock running from the main clock
+ *
+ * The latencies of #2 and #3 depend on the memory controller, they come
+ * with the platform data.
  */
 
 #include <linux/kernel.h>
@@ -19,18 +23,19 @@
 #include <linux/cpuidle.h>
 #include <linux/io.h>
 #include <linux/export.h>
+#include <linux/platform_data/cpuidle-at91.h>
 #include <asm/cpuidle.h>
 
-#define AT91_MAX_STATES	2
+#define AT91_MAX_STATES	3
 
-static void (*at91_standby)(void);
+static const struct at91_cpuidle_state *at91_states[AT91_MAX_STATES];
 
 /* Actual code that puts the SoC in different idle states */
 static int at91_enter_idle(struct cpuidle_device *dev,
 			struct cpuidle_driver *drv,
 			       int index)
 {
-	at91_standby();
+	at91_states[index]->standby();
 	return index;
 }
 
@@ -40,19 +45,41 @@ static struct cpuidle_driver at91_idle_driver = {
 	.states[0]		= ARM_CPUIDLE_WFI_STATE,
 	.states[1]		= {
 		.enter			= at91_enter_idle,
-		.exit_latency		= 10,
-		.target_residency	= 10000,
 		.name			= "RAM_SR",
 		.desc			= "WFI and DDR Self Refresh",
 	},
+	.states[2]		= {
+		.enter			= at91_enter_idle,
+		.name			= "MCK_MAIN",
+		.desc			= "WFI, DDR SR, MCK on main clock",
+	},
 	.state_count = AT91_MAX_STATES,
 };
 
+static void at91_cpuidle_set_state(int index,
+				   const struct at91_cpuidle_state *state)
+{
+	at91_states[index] = state;
+	at91_idle_driver.states[index].exit_latency = state->exit_latency;
+	at91_idle_driver.states[index].target_residency =
+		state->target_residency;
+}
+
 /* Initialize CPU idle by registering the idle states */
 static int at91_cpuidle_probe(struct platform_device *dev)
 {
-	at91_standby = (void *)(dev->dev.platform_data);
-	
+	const struct at91_cpuidle_data *data = dev_get_platdata(&dev->dev);
+
+	if (!data || !data->sr.standby)
+		return -EINVAL;
+
+	at91_cpuidle_set_state(1, &data->sr);
+
+	if (data->mck.standby)
+		at91_cpuidle_set_state(2, &data->mck);
+	else
+		at91_idle_driver.state_count = 2;
+
 	return cpuidle_register(&at91_idle_driver, NULL);
 }
 
@@ -26,6 +26,8 @@
 #define AES_MR_OPMOD_OFB		(0x2 << 12)
 #define AES_MR_OPMOD_CFB		(0x3 << 12)
 #define AES_MR_OPMOD_CTR		(0x4 << 12)
+#define AES_MR_OPMOD_GCM		(0x5 << 12)
+#define AES_MR_OPMOD_XTS		(0x6 << 12)
 #define AES_MR_LOD				(0x1 << 15)
 #define AES_MR_CFBS_MASK		(0x7 << 16)
 #define AES_MR_CFBS_128b		(0x0 << 16)
@@ -33,6 +35,7 @@
 #define AES_MR_CFBS_32b			(0x2 << 16)
 #define AES_MR_CFBS_16b			(0x3 << 16)
 #define AES_MR_CFBS_8b			(0x4 << 16)
+#define AES_MR_GTAGEN			(0x1 << 17)
 #define AES_MR_CKEY_MASK		(0xF << 20)
 #define AES_MR_CKEY_OFFSET		20
 #define AES_MR_CMTYP_MASK		(0x1F << 24)
@@ -44,6 +47,7 @@
 #define	AES_ISR		0x1C
 #define AES_INT_DATARDY		(1 << 0)
 #define AES_INT_URAD		(1 << 8)
+#define AES_INT_TAGRDY		(1 << 16)
 #define AES_ISR_URAT_MASK	(0xF << 12)
 #define AES_ISR_URAT_IDR_WR_PROC	(0x0 << 12)
 #define AES_ISR_URAT_ODR_RD_PROC	(0x1 << 12)
@@ -57,6 +61,16 @@
 #define AES_ODATAR(x)	(0x50 + ((x) * 0x04))
 #define AES_IVR(x)		(0x60 + ((x) * 0x04))
 
+#define AES_AADLENR		0x70
+#define AES_CLENR		0x74
+#define AES_GHASHR(x)	(0x78 + ((x) * 0x04))
+#define AES_TAGR(x)		(0x88 + ((x) * 0x04))
+#define AES_CTRR		0x98
+#define AES_GCMHR(x)	(0x9c + ((x) * 0x04))
+
+#define AES_TWR(x)		(0xc0 + ((x) * 0x04))
+#define AES_ALPHAR(x)	(0xd0 + ((x) * 0x04))
+
 #define AES_EMR			0xB0
 #define AES_EMR_APEN		(1 << 0)
 #define AES_EMR_APM		(1 << 1)
@@ -32,6 +32,8 @@
 #include <linux/dma-mapping.h>
 #include <linux/of_device.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <linux/crypto.h>
 #include <linux/cryptohash.h>
 #include <crypto/scatterwalk.h>
@@ -42,9 +44,12 @@
 #include <crypto/aead.h>
 #include <crypto/authenc.h>
 #include <crypto/internal/hash.h>
+#include <asm/unaligned.h>
+#include <linux/atmel-sram.h>
 #include <linux/platform_data/crypto-atmel.h>
 #include <dt-bindings/dma/at91.h>
 #include "atmel-aes-regs.h"
+#include "atmel-crypto-engine.h"
 #include "atmel-sha-regs.h"
 #include "atmel-sha.h"
 
@@ -54,7 +59,7 @@
 #define CFB64_BLOCK_SIZE	8
 
 /* AES flags */
-#define AES_FLAGS_MODE_MASK	0x03ff
+#define AES_FLAGS_MODE_MASK	0x1fff
 #define AES_FLAGS_ENCRYPT	BIT(0)
 #define AES_FLAGS_CBC		BIT(1)
 #define AES_FLAGS_CFB		BIT(2)
@@ -65,13 +70,16 @@
 #define AES_FLAGS_CFB128	BIT(7)
 #define AES_FLAGS_OFB		BIT(8)
 #define AES_FLAGS_CTR		BIT(9)
+#define AES_FLAGS_GCM		BIT(10)
+#define AES_FLAGS_XTS		BIT(11)
+#define AES_FLAGS_CCM		BIT(12)
 
 #define AES_FLAGS_INIT		BIT(16)
 #define AES_FLAGS_DMA		BIT(17)
-#define AES_FLAGS_BUSY		BIT(18)
 #define AES_FLAGS_FAST		BIT(19)
 #define AES_FLAGS_PLIP		BIT(20)
 #define AES_FLAGS_GIV		BIT(21)
+#define AES_FLAGS_GTAGEN	BIT(22)
 
 #define ATMEL_AES_QUEUE_LENGTH	50
 
@@ -80,10 +88,44 @@
 #define ATMEL_MAX_KEY_SIZE		96
 #define ATMEL_MAX_IV_LENGTH		16
 
+#define ATMEL_AES_GCM_IV_SIZE		12
+#define ATMEL_AES_RFC4106_IV_SIZE	8
+#define ATMEL_AES_GCM_NONCE_SIZE	4
+/* The CTR counter of the IP is 16 bits: CCM texts can't wrap it */
+#define ATMEL_AES_CCM_MAX_TEXT		(0xffff * AES_BLOCK_SIZE)
+#define ATMEL_AES_POLL_TIMEOUT		10000
+
+/* Request sizes tried when calibrating the software fallback threshold */
+#define ATMEL_AES_CALIB_MAX		4096
+#define ATMEL_AES_CALIB_LOOPS		32
+
+/* Modes with a synchronous software implementation to fall back on */
+enum atmel_aes_fallback_mode {
+	ATMEL_AES_FB_ECB,
+	ATMEL_AES_FB_CBC,
+	ATMEL_AES_FB_CTR,
+	ATMEL_AES_FB_XTS,
+	ATMEL_AES_FB_NR
+};
+
+static const struct {
+	const char	*name;
+	const char	*driver_name;
+	unsigned int	keylen;
+} atmel_aes_fallback_info[ATMEL_AES_FB_NR] = {
+	[ATMEL_AES_FB_ECB] = { "ecb(aes)", "atmel-ecb-aes", AES_KEYSIZE_128 },
+	[ATMEL_AES_FB_CBC] = { "cbc(aes)", "atmel-cbc-aes", AES_KEYSIZE_128 },
+	[ATMEL_AES_FB_CTR] = { "ctr(aes)", "atmel-ctr-aes", AES_KEYSIZE_128 },
+	[ATMEL_AES_FB_XTS] = { "xts(aes)", "atmel-xts-aes",
+			       2 * AES_KEYSIZE_128 },
+};
+
 struct atmel_aes_caps {
 	bool	has_dualbuff;
 	bool	has_cfb64;
 	bool	has_aead;
+	bool	has_gcm;
+	bool	has_xts;
 	u32		max_burst_size;
 };
 
@@ -94,6 +136,8 @@ struct atmel_aes_ctx {
 
 	int		keylen;
 	u32		key[AES_KEYSIZE_256 / sizeof(u32)];
+	/* XTS tweak key, key holds the data key */
+	u32		key2[AES_KEYSIZE_256 / sizeof(u32)];
 
 	u16		block_size;
 
@@ -107,6 +151,15 @@ struct atmel_aes_ctx {
 	size_t		cryptlen;
 	size_t		ivsize;
 	u64		seq;
+
+	u8		nonce[ATMEL_AES_GCM_NONCE_SIZE];
+	u32		j0[AES_BLOCK_SIZE / sizeof(u32)];
+	u32		tag[AES_BLOCK_SIZE / sizeof(u32)];
+	u32		tweak[AES_BLOCK_SIZE / sizeof(u32)];
+
+	/* software implementation used for short requests */
+	struct crypto_blkcipher	*fallback;
+	int		fallback_mode;
 };
 
 struct atmel_aes_reqctx {
@@ -132,14 +185,9 @@ struct atmel_aes_dev {
 	unsigned long		flags;
 	int	err;
 
-	spinlock_t		lock;
-	struct crypto_queue	queue;
-	struct crypto_queue	aead_queue;
-	atomic_t		aead_configuring;
+	struct atmel_crypto_engine engine;
 
 	struct tasklet_struct	done_task;
-	struct tasklet_struct	queue_task;
-	struct tasklet_struct	aead_task;
 
 	struct ablkcipher_request	*req;
 	size_t	total;
@@ -156,6 +204,7 @@ struct atmel_aes_dev {
 	size_t	bufcnt;
 	size_t	buflen;
 	size_t	dma_size;
+	bool	buf_sram;
 
 	void	*buf_in;
 	int		dma_in;
@@ -170,6 +219,10 @@ struct atmel_aes_dev {
 	struct atmel_aes_caps	caps;
 
 	u32	hw_version;
+
+	/* requests shorter than this go to the software fallback */
+	unsigned int		fallback_len[ATMEL_AES_FB_NR];
+	struct work_struct	calib_work;
 };
 
 struct atmel_aes_drv {
@@ -182,6 +235,12 @@ static struct atmel_aes_drv atmel_aes = {
 	.lock = __SPIN_LOCK_UNLOCKED(atmel_aes.lock),
 };
 
+static void atmel_aes_gcm_start(struct atmel_aes_dev *dd);
+static void atmel_aes_gcm_dma_done(struct atmel_aes_dev *dd);
+static void atmel_aes_ccm_start(struct atmel_aes_dev *dd);
+static void atmel_aes_ccm_dma_done(struct atmel_aes_dev *dd);
+static void atmel_aead_finish_req(struct atmel_aes_dev *dd);
+
 static int atmel_aes_sg_length(struct ablkcipher_request *req,
 			struct scatterlist *sg)
 {
@@ -299,6 +358,25 @@ static int atmel_aes_hw_init(struct atmel_aes_dev *dd)
 	return 0;
 }
 
+/*
+ * Short single-block operations (GCM setup, XTS tweak) are polled rather
+ * than going through the interrupt and the done tasklet.
+ */
+static int atmel_aes_wait(struct atmel_aes_dev *dd, u32 mask)
+{
+	unsigned int timeout = ATMEL_AES_POLL_TIMEOUT;
+
+	while (!(atmel_aes_read(dd, AES_ISR) & mask)) {
+		if (!--timeout) {
+			dev_err(dd->dev, "timeout waiting for ISR 0x%x\n", mask);
+			return -ETIMEDOUT;
+		}
+		cpu_relax();
+	}
+
+	return 0;
+}
+
 static inline unsigned int atmel_aes_get_version(struct atmel_aes_dev *dd)
 {
 	return atmel_aes_read(dd, AES_HW_VERSION) & 0x00000fff;
@@ -316,58 +394,17 @@ static void atmel_aes_hw_version_init(struct atmel_aes_dev *dd)
 	clk_disable_unprepare(dd->iclk);
 }
 
+/*
+ * The engine starts the next queued request before completing the current
+ * one: the key and IV can't be loaded while the engine is still processing,
+ * but the completion callback of the caller can run while the next transfer
+ * is in flight. Gating the clock afterwards also keeps it enabled between
+ * back-to-back requests instead of turning it off after each one.
+ */
 static void atmel_aes_finish_req(struct atmel_aes_dev *dd, int err)
 {
-	struct ablkcipher_request *req = dd->req;
-
-	clk_disable_unprepare(dd->iclk);
-	dd->flags &= ~AES_FLAGS_BUSY;
-
-	req->base.complete(&req->base, err);
-}
-
-static void atmel_aead_finish_req(struct atmel_aes_dev *dd)
-{
-	struct atmel_aes_ctx *ctx = dd->ctx;
-	struct aead_request *areq = dd->aead_req;
-	char hash[SHA512_DIGEST_SIZE];
-	int err = 0;
-
-	dma_unmap_sg(dd->dev, areq->dst, 1, DMA_FROM_DEVICE);
-	dma_unmap_sg(dd->dev, areq->src, 1, DMA_TO_DEVICE);
-
-	if (dd->flags & AES_FLAGS_ENCRYPT) {
-		dma_sync_single_for_cpu(dd->dev,
-					sg_dma_address(areq->dst),
-					ctx->cryptlen,
-					DMA_FROM_DEVICE);
-
-		err = atmel_hmac_read_icv((u32 *)hash, ctx->authsize);
-		if (sg_pcopy_from_buffer(areq->dst, 1,
-					hash, ctx->authsize, ctx->cryptlen)) {
-
-			err = 0;
-		} else {
-			err = -EINVAL;
-		}
-	} else {
-		dma_sync_single_for_cpu(dd->dev,
-					sg_dma_address(areq->src),
-					ctx->cryptlen - ctx->authsize,
-					DMA_TO_DEVICE);
-		sg_pcopy_to_buffer(areq->src, 1,
-				dd->buf_in, ctx->authsize,
-				ctx->cryptlen - ctx->authsize);
-		err = atmel_hmac_check_icv(dd->buf_in, ctx->authsize);
-		if (err != 0)
-			err = -EBADMSG;
-	}
-
-	aead_request_complete(dd->aead_req, err);
+	atmel_crypto_engine_finalize(&dd->engine, &dd->req->base, err);
 	clk_disable_unprepare(dd->iclk);
-	dd->flags &= ~(AES_FLAGS_BUSY | AES_FLAGS_PLIP | AES_FLAGS_DMA);
-
-	tasklet_schedule(&dd->aead_task);
 }
 
 static void atmel_aes_dma_callback(void *data)
@@ -382,19 +419,14 @@ static void atmel_aes_dma_callback(void *data)
 	}
 }
 
-static int atmel_aes_crypt_dma(struct atmel_aes_dev *dd,
-		dma_addr_t dma_addr_in, dma_addr_t dma_addr_out, int length)
+static int atmel_aes_crypt_dma_sg(struct atmel_aes_dev *dd,
+		struct scatterlist *in_sg, unsigned int in_nents,
+		struct scatterlist *out_sg, unsigned int out_nents, int length)
 {
-	struct scatterlist sg[2];
 	struct dma_async_tx_descriptor	*in_desc, *out_desc;
 
 	dd->dma_size = length;
 
-	dma_sync_single_for_device(dd->dev, dma_addr_in, length,
-				   DMA_TO_DEVICE);
-	dma_sync_single_for_device(dd->dev, dma_addr_out, length,
-				   DMA_FROM_DEVICE);
-
 	if (dd->flags & AES_FLAGS_CFB8) {
 		dd->dma_lch_in.dma_conf.dst_addr_width =
 			DMA_SLAVE_BUSWIDTH_1_BYTE;
@@ -430,22 +462,14 @@ static int atmel_aes_crypt_dma(struct atmel_aes_dev *dd,
 
 	dd->flags |= AES_FLAGS_DMA;
 
-	sg_init_table(&sg[0], 1);
-	sg_dma_address(&sg[0]) = dma_addr_in;
-	sg_dma_len(&sg[0]) = length;
-
-	sg_init_table(&sg[1], 1);
-	sg_dma_address(&sg[1]) = dma_addr_out;
-	sg_dma_len(&sg[1]) = length;
-
-	in_desc = dmaengine_prep_slave_sg(dd->dma_lch_in.chan, &sg[0],
-				1, DMA_MEM_TO_DEV,
+	in_desc = dmaengine_prep_slave_sg(dd->dma_lch_in.chan, in_sg,
+				in_nents, DMA_MEM_TO_DEV,
 				DMA_PREP_INTERRUPT  |  DMA_CTRL_ACK);
 	if (!in_desc)
 		return -EINVAL;
 
-	out_desc = dmaengine_prep_slave_sg(dd->dma_lch_out.chan, &sg[1],
-				1, DMA_DEV_TO_MEM,
+	out_desc = dmaengine_prep_slave_sg(dd->dma_lch_out.chan, out_sg,
+				out_nents, DMA_DEV_TO_MEM,
 				DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
 	if (!out_desc)
 		return -EINVAL;
@@ -462,13 +486,56 @@ static int atmel_aes_crypt_dma(struct atmel_aes_dev *dd,
 	return 0;
 }
 
+/* The bounce buffers in SRAM are not cached and need no maintenance */
+static void atmel_aes_sync_for_cpu(struct atmel_aes_dev *dd, dma_addr_t addr,
+				   size_t size, enum dma_data_direction dir)
+{
+	if (dd->buf_sram &&
+	    (addr == dd->dma_addr_in || addr == dd->dma_addr_out))
+		return;
+
+	dma_sync_single_for_cpu(dd->dev, addr, size, dir);
+}
+
+static void atmel_aes_sync_for_device(struct atmel_aes_dev *dd,
+				      dma_addr_t addr, size_t size,
+				      enum dma_data_direction dir)
+{
+	if (dd->buf_sram &&
+	    (addr == dd->dma_addr_in || addr == dd->dma_addr_out))
+		return;
+
+	dma_sync_single_for_device(dd->dev, addr, size, dir);
+}
+
+static int atmel_aes_crypt_dma(struct atmel_aes_dev *dd,
+		dma_addr_t dma_addr_in, dma_addr_t dma_addr_out, int length)
+{
+	struct scatterlist sg[2];
+
+	atmel_aes_sync_for_device(dd, dma_addr_in, length,
+				   DMA_TO_DEVICE);
+	atmel_aes_sync_for_device(dd, dma_addr_out, length,
+				   DMA_FROM_DEVICE);
+
+	sg_init_table(&sg[0], 1);
+	sg_dma_address(&sg[0]) = dma_addr_in;
+	sg_dma_len(&sg[0]) = length;
+
+	sg_init_table(&sg[1], 1);
+	sg_dma_address(&sg[1]) = dma_addr_out;
+	sg_dma_len(&sg[1]) = length;
+
+	return atmel_aes_crypt_dma_sg(dd, &sg[0], 1, &sg[1], 1, length);
+}
+
 static int atmel_aes_crypt_cpu_start(struct atmel_aes_dev *dd)
 {
 	dd->flags &= ~AES_FLAGS_DMA;
 
-	dma_sync_single_for_cpu(dd->dev, dd->dma_addr_in,
+	atmel_aes_sync_for_cpu(dd, dd->dma_addr_in,
 				dd->dma_size, DMA_TO_DEVICE);
-	dma_sync_single_for_cpu(dd->dev, dd->dma_addr_out,
+	atmel_aes_sync_for_cpu(dd, dd->dma_addr_out,
 				dd->dma_size, DMA_FROM_DEVICE);
 
 	/* use cache buffers */
@@ -495,73 +562,192 @@ static int atmel_aes_crypt_cpu_start(struct atmel_aes_dev *dd)
 	return 0;
 }
 
-static int atmel_aes_crypt_dma_start(struct atmel_aes_dev *dd)
+static bool atmel_aes_sg_aligned(struct scatterlist *sg, size_t len,
+				 size_t block_size)
 {
-	int err, fast = 0, in, out;
-	size_t count;
-	dma_addr_t addr_in, addr_out;
+	return IS_ALIGNED(sg->offset, sizeof(u32)) &&
+		IS_ALIGNED(len, block_size);
+}
+
+/*
+ * Walk the input and output lists from their current position and return
+ * the length of the first stretch that ends on an entry boundary of both
+ * lists. With @fast, only entries usable by the DMA as they are may be
+ * crossed and the longest such stretch is returned, along with the number
+ * of entries it spans; without it, the shortest block-aligned one is, so
+ * that only the unaligned part of a request goes through the bounce
+ * buffers. The result is capped at @max.
+ */
+static size_t atmel_aes_sg_span(struct atmel_aes_dev *dd, size_t max,
+				bool fast, unsigned int *in_nents,
+				unsigned int *out_nents)
+{
+	struct scatterlist *in = dd->in_sg, *out = dd->out_sg;
+	size_t bs = dd->ctx->block_size;
+	size_t in_end, out_end, span = 0;
+	unsigned int ni = 1, no = 1;
+
+	in_end = min_t(size_t, in->length - dd->in_offset, max);
+	out_end = min_t(size_t, out->length - dd->out_offset, max);
+
+	if (fast && (!atmel_aes_sg_aligned(in, in_end, bs) ||
+		     !atmel_aes_sg_aligned(out, out_end, bs)))
+		return 0;
+
+	for (;;) {
+		if (in_end == out_end) {
+			if (fast) {
+				span = in_end;
+				*in_nents = ni;
+				*out_nents = no;
+			} else if (IS_ALIGNED(in_end, bs)) {
+				return in_end;
+			}
+			if (in_end == max)
+				break;
+		}
+
+		if (in_end <= out_end) {
+			in = sg_next(in);
+			if (!in)
+				break;
+			if (fast && !atmel_aes_sg_aligned(in,
+					min(in->length, max - in_end), bs))
+				break;
+			in_end = min(in_end + in->length, max);
+			ni++;
+		} else {
+			out = sg_next(out);
+			if (!out)
+				break;
+			if (fast && !atmel_aes_sg_aligned(out,
+					min(out->length, max - out_end), bs))
+				break;
+			out_end = min(out_end + out->length, max);
+			no++;
+		}
+	}
+
+	return fast ? span : max;
+}
+
+static struct scatterlist *atmel_aes_sg_skip(struct scatterlist *sg,
+					     unsigned int nents)
+{
+	while (sg && nents--)
+		sg = sg_next(sg);
 
-	if ((!dd->in_offset) && (!dd->out_offset)) {
-		/* check for alignment */
-		in = IS_ALIGNED((u32)dd->in_sg->offset, sizeof(u32)) &&
-			IS_ALIGNED(dd->in_sg->length, dd->ctx->block_size);
-		out = IS_ALIGNED((u32)dd->out_sg->offset, sizeof(u32)) &&
-			IS_ALIGNED(dd->out_sg->length, dd->ctx->block_size);
-		fast = in && out;
+	return sg;
+}
+
+/* The last mapped entry may extend past the part being processed */
+static void atmel_aes_sg_trim(struct scatterlist *sg, unsigned int nents,
+			      size_t len)
+{
+	struct scatterlist *s;
+	unsigned int i;
 
-		if (sg_dma_len(dd->in_sg) != sg_dma_len(dd->out_sg))
-			fast = 0;
+	for_each_sg(sg, s, nents, i) {
+		sg_dma_len(s) = min_t(size_t, sg_dma_len(s), len);
+		len -= sg_dma_len(s);
 	}
+}
 
+static int atmel_aes_crypt_dma_start(struct atmel_aes_dev *dd)
+{
+	int err, in_mapped, out_mapped;
+	size_t count = 0;
+	dma_addr_t addr_in, addr_out;
 
-	if (fast)  {
-		count = min(dd->total, sg_dma_len(dd->in_sg));
-		count = min(count, sg_dma_len(dd->out_sg));
+	if ((!dd->in_offset) && (!dd->out_offset))
+		count = atmel_aes_sg_span(dd, dd->total, true,
+					  &dd->nb_in_sg, &dd->nb_out_sg);
 
-		err = dma_map_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
-		if (!err) {
+	if (count) {
+		in_mapped = dma_map_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
+				DMA_TO_DEVICE);
+		if (!in_mapped) {
 			dev_err(dd->dev, "dma_map_sg() error\n");
 			return -EINVAL;
 		}
 
-		err = dma_map_sg(dd->dev, dd->out_sg, 1,
+		out_mapped = dma_map_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
 				DMA_FROM_DEVICE);
-		if (!err) {
+		if (!out_mapped) {
 			dev_err(dd->dev, "dma_map_sg() error\n");
-			dma_unmap_sg(dd->dev, dd->in_sg, 1,
+			dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
 				DMA_TO_DEVICE);
 			return -EINVAL;
 		}
 
-		addr_in = sg_dma_address(dd->in_sg);
-		addr_out = sg_dma_address(dd->out_sg);
+		atmel_aes_sg_trim(dd->in_sg, in_mapped, count);
+		atmel_aes_sg_trim(dd->out_sg, out_mapped, count);
 
 		dd->flags |= AES_FLAGS_FAST;
+		dd->total -= count;
 
-	} else {
-		dma_sync_single_for_cpu(dd->dev, dd->dma_addr_in,
-					dd->dma_size, DMA_TO_DEVICE);
+		err = atmel_aes_crypt_dma_sg(dd, dd->in_sg, in_mapped,
+				dd->out_sg, out_mapped, count);
+		if (err) {
+			dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
+				DMA_TO_DEVICE);
+			dma_unmap_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
+				DMA_FROM_DEVICE);
+		}
 
-		/* use cache buffers */
-		count = atmel_aes_sg_copy(&dd->in_sg, &dd->in_offset,
-				dd->buf_in, dd->buflen, dd->total, 0);
+		return err;
+	}
 
-		addr_in = dd->dma_addr_in;
-		addr_out = dd->dma_addr_out;
+	atmel_aes_sync_for_cpu(dd, dd->dma_addr_in,
+				dd->dma_size, DMA_TO_DEVICE);
 
-		dd->flags &= ~AES_FLAGS_FAST;
-	}
+	/* use cache buffers, up to where the lists are usable again */
+	count = atmel_aes_sg_span(dd, min(dd->total, dd->buflen), false,
+				  NULL, NULL);
+	count = atmel_aes_sg_copy(&dd->in_sg, &dd->in_offset,
+			dd->buf_in, dd->buflen, count, 0);
+
+	addr_in = dd->dma_addr_in;
+	addr_out = dd->dma_addr_out;
+
+	dd->flags &= ~AES_FLAGS_FAST;
 
 	dd->total -= count;
 
-	err = atmel_aes_crypt_dma(dd, addr_in, addr_out, count);
+	return atmel_aes_crypt_dma(dd, addr_in, addr_out, count);
+}
 
-	if (err && (dd->flags & AES_FLAGS_FAST)) {
-		dma_unmap_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
-		dma_unmap_sg(dd->dev, dd->out_sg, 1, DMA_TO_DEVICE);
-	}
+/*
+ * The XTS mode of the IP takes the encrypted tweak T = E(K2, IV) rather
+ * than the IV: compute it in-engine with a polled ECB pass using the tweak
+ * key, before the data key is loaded. The TWR registers expect the tweak
+ * in little-endian byte order.
+ */
+static int atmel_aes_xts_tweak(struct atmel_aes_dev *dd, u32 valmr)
+{
+	u8 *tweak = (u8 *)dd->ctx->tweak;
+	u32 ecbmr;
+	int err, i;
 
-	return err;
+	ecbmr = valmr & AES_MR_KEYSIZE_MASK;
+	ecbmr |= AES_MR_OPMOD_ECB | AES_MR_CYPHER_ENC | AES_MR_SMOD_AUTO;
+
+	atmel_aes_write(dd, AES_CR, 0);
+	atmel_aes_write(dd, AES_MR, ecbmr);
+	atmel_aes_write_n(dd, AES_KEYWR(0), dd->ctx->key2,
+						dd->ctx->keylen >> 2);
+	atmel_aes_write_n(dd, AES_IDATAR(0), dd->req->info, 4);
+
+	err = atmel_aes_wait(dd, AES_INT_DATARDY);
+	if (err)
+		return err;
+
+	atmel_aes_read_n(dd, AES_ODATAR(0), dd->ctx->tweak, 4);
+
+	for (i = 0; i < AES_BLOCK_SIZE / 2; i++)
+		swap(tweak[i], tweak[AES_BLOCK_SIZE - 1 - i]);
+
+	return 0;
 }
 
 static int atmel_aes_write_ctrl(struct atmel_aes_dev *dd)
@@ -601,6 +787,8 @@ static int atmel_aes_write_ctrl(struct atmel_aes_dev *dd)
 		valmr |= AES_MR_OPMOD_OFB;
 	} else if (dd->flags & AES_FLAGS_CTR) {
 		valmr |= AES_MR_OPMOD_CTR;
+	} else if (dd->flags & AES_FLAGS_XTS) {
+		valmr |= AES_MR_OPMOD_XTS;
 	} else {
 		valmr |= AES_MR_OPMOD_ECB;
 	}
@@ -619,6 +807,12 @@ static int atmel_aes_write_ctrl(struct atmel_aes_dev *dd)
 		valmr |= AES_MR_SMOD_AUTO;
 	}
 
+	if (dd->flags & AES_FLAGS_XTS) {
+		err = atmel_aes_xts_tweak(dd, valmr);
+		if (err)
+			return err;
+	}
+
 	atmel_aes_write(dd, AES_CR, valcr);
 	atmel_aes_write(dd, AES_MR, valmr);
 
@@ -648,38 +842,25 @@ static int atmel_aes_write_ctrl(struct atmel_aes_dev *dd)
 		atmel_aes_write_n(dd, AES_IVR(0), dd->req->info, 4);
 	}
 
+	if (dd->flags & AES_FLAGS_XTS) {
+		int i;
+
+		atmel_aes_write_n(dd, AES_TWR(0), dd->ctx->tweak, 4);
+		/* alpha = 1: start from the first block of the data unit */
+		atmel_aes_write(dd, AES_ALPHAR(0), 1);
+		for (i = 1; i < 4; i++)
+			atmel_aes_write(dd, AES_ALPHAR(i), 0);
+	}
+
 	return 0;
 }
 
-static int atmel_aes_handle_queue(struct atmel_aes_dev *dd,
-			       struct ablkcipher_request *req)
+static void atmel_aes_start(struct atmel_aes_dev *dd,
+			    struct ablkcipher_request *req)
 {
-	struct crypto_async_request *async_req, *backlog;
 	struct atmel_aes_ctx *ctx;
 	struct atmel_aes_reqctx *rctx;
-	unsigned long flags;
-	int err, ret = 0;
-
-	spin_lock_irqsave(&dd->lock, flags);
-	if (req)
-		ret = ablkcipher_enqueue_request(&dd->queue, req);
-	if (dd->flags & AES_FLAGS_BUSY) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
-	}
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->queue);
-	if (async_req)
-		dd->flags |= AES_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
-
-	if (!async_req)
-		return ret;
-
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
-
-	req = ablkcipher_request_cast(async_req);
+	int err;
 
 	/* assign new request to device */
 	dd->req = req;
@@ -703,13 +884,9 @@ static int atmel_aes_handle_queue(struct atmel_aes_dev *dd,
 		else
 			err = atmel_aes_crypt_cpu_start(dd);
 	}
-	if (err) {
+	if (err)
 		/* aes_task will not finish it, so do it here */
 		atmel_aes_finish_req(dd, err);
-		tasklet_schedule(&dd->queue_task);
-	}
-
-	return ret;
 }
 
 static int atmel_aes_crypt_dma_stop(struct atmel_aes_dev *dd)
@@ -720,10 +897,12 @@ static int atmel_aes_crypt_dma_stop(struct atmel_aes_dev *dd)
 	if (dd->flags & AES_FLAGS_DMA) {
 		err = 0;
 		if  (dd->flags & AES_FLAGS_FAST) {
-			dma_unmap_sg(dd->dev, dd->out_sg, 1, DMA_FROM_DEVICE);
-			dma_unmap_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
+			dma_unmap_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
+				DMA_FROM_DEVICE);
+			dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
+				DMA_TO_DEVICE);
 		} else {
-			dma_sync_single_for_cpu(dd->dev, dd->dma_addr_out,
+			atmel_aes_sync_for_cpu(dd, dd->dma_addr_out,
 				dd->dma_size, DMA_FROM_DEVICE);
 
 			/* copy data */
@@ -740,10 +919,44 @@ static int atmel_aes_crypt_dma_stop(struct atmel_aes_dev *dd)
 }
 
 
+/*
+ * Bounce buffers in the on-chip SRAM, if the device tree gives us some:
+ * the DMA then only goes to DDR for the data of the fast path.
+ */
+static bool atmel_aes_buff_init_sram(struct atmel_aes_dev *dd)
+{
+	struct gen_pool *pool;
+	size_t len;
+
+	pool = devm_atmel_sram_pool(dd->dev, 2 * PAGE_SIZE);
+	if (!pool)
+		return false;
+
+	len = min_t(size_t, gen_pool_avail(pool) / 2, PAGE_SIZE);
+	len &= ~(AES_BLOCK_SIZE - 1);
+	if (!len)
+		return false;
+
+	dd->buf_in = devm_atmel_sram_alloc(dd->dev, pool, len,
+					   &dd->dma_addr_in);
+	dd->buf_out = devm_atmel_sram_alloc(dd->dev, pool, len,
+					    &dd->dma_addr_out);
+	if (!dd->buf_in || !dd->buf_out)
+		return false;
+
+	dd->buflen = len;
+	dd->buf_sram = true;
+
+	return true;
+}
+
 static int atmel_aes_buff_init(struct atmel_aes_dev *dd)
 {
 	int err = -ENOMEM;
 
+	if (atmel_aes_buff_init_sram(dd))
+		return 0;
+
 	dd->buf_in = (void *)__get_free_pages(GFP_KERNEL, 0);
 	dd->buf_out = (void *)__get_free_pages(GFP_KERNEL, 0);
 	dd->buflen = PAGE_SIZE;
@@ -787,6 +1000,9 @@ err_alloc:
 
 static void atmel_aes_buff_cleanup(struct atmel_aes_dev *dd)
 {
+	if (dd->buf_sram)
+		return;
+
 	dma_unmap_single(dd->dev, dd->dma_addr_out, dd->buflen,
 			 DMA_FROM_DEVICE);
 	dma_unmap_single(dd->dev, dd->dma_addr_in, dd->buflen,
@@ -795,6 +1011,28 @@ static void atmel_aes_buff_cleanup(struct atmel_aes_dev *dd)
 	free_page((unsigned long)dd->buf_in);
 }
 
+/*
+ * For short requests, the DMA and interrupt round trip costs more than
+ * doing the work on the CPU: run them synchronously in software.
+ */
+static int atmel_aes_crypt_fallback(struct ablkcipher_request *req, int enc)
+{
+	struct atmel_aes_ctx *ctx = crypto_ablkcipher_ctx(
+			crypto_ablkcipher_reqtfm(req));
+	struct blkcipher_desc desc = {
+		.tfm	= ctx->fallback,
+		.info	= req->info,
+		.flags	= req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP,
+	};
+
+	if (enc)
+		return crypto_blkcipher_encrypt_iv(&desc, req->dst, req->src,
+						   req->nbytes);
+
+	return crypto_blkcipher_decrypt_iv(&desc, req->dst, req->src,
+					   req->nbytes);
+}
+
 static int atmel_aes_crypt(struct ablkcipher_request *req, unsigned long mode)
 {
 	struct atmel_aes_ctx *ctx = crypto_ablkcipher_ctx(
@@ -838,9 +1076,13 @@ static int atmel_aes_crypt(struct ablkcipher_request *req, unsigned long mode)
 	if (!dd)
 		return -ENODEV;
 
+	if (ctx->fallback &&
+	    req->nbytes < ACCESS_ONCE(dd->fallback_len[ctx->fallback_mode]))
+		return atmel_aes_crypt_fallback(req, mode & AES_FLAGS_ENCRYPT);
+
 	rctx->mode = mode;
 
-	return atmel_aes_handle_queue(dd, req);
+	return atmel_crypto_engine_enqueue(&dd->engine, &req->base);
 }
 
 static bool atmel_aes_filter(struct dma_chan *chan, void *slave)
@@ -912,6 +1154,29 @@ static void atmel_aes_dma_cleanup(struct atmel_aes_dev *dd)
 	dma_release_channel(dd->dma_lch_out.chan);
 }
 
+static int atmel_aes_fallback_setkey(struct crypto_ablkcipher *tfm,
+				     const u8 *key, unsigned int keylen)
+{
+	struct atmel_aes_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	int err;
+
+	if (!ctx->fallback)
+		return 0;
+
+	crypto_blkcipher_clear_flags(ctx->fallback, CRYPTO_TFM_REQ_MASK);
+	crypto_blkcipher_set_flags(ctx->fallback,
+		crypto_ablkcipher_get_flags(tfm) & CRYPTO_TFM_REQ_MASK);
+
+	err = crypto_blkcipher_setkey(ctx->fallback, key, keylen);
+	if (err) {
+		crypto_ablkcipher_set_flags(tfm,
+			crypto_blkcipher_get_flags(ctx->fallback) &
+			CRYPTO_TFM_RES_MASK);
+	}
+
+	return err;
+}
+
 static int atmel_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
 			   unsigned int keylen)
 {
@@ -926,7 +1191,7 @@ static int atmel_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
 	memcpy(ctx->key, key, keylen);
 	ctx->keylen = keylen;
 
-	return 0;
+	return atmel_aes_fallback_setkey(tfm, key, keylen);
 }
 
 static int atmel_aes_ecb_encrypt(struct ablkcipher_request *req)
@@ -1037,6 +1302,38 @@ static int atmel_aes_ctr_decrypt(struct ablkcipher_request *req)
 		AES_FLAGS_CTR);
 }
 
+static int atmel_aes_xts_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
+				unsigned int keylen)
+{
+	struct atmel_aes_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+
+	/* The data key and the tweak key are concatenated */
+	keylen /= 2;
+	if (keylen != AES_KEYSIZE_128 && keylen != AES_KEYSIZE_192 &&
+		   keylen != AES_KEYSIZE_256) {
+		crypto_ablkcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+
+	memcpy(ctx->key, key, keylen);
+	memcpy(ctx->key2, key + keylen, keylen);
+	ctx->keylen = keylen;
+
+	return atmel_aes_fallback_setkey(tfm, key, 2 * keylen);
+}
+
+static int atmel_aes_xts_encrypt(struct ablkcipher_request *req)
+{
+	return atmel_aes_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_XTS);
+}
+
+static int atmel_aes_xts_decrypt(struct ablkcipher_request *req)
+{
+	return atmel_aes_crypt(req,
+		AES_FLAGS_XTS);
+}
+
 static int atmel_aes_cra_init(struct crypto_tfm *tfm)
 {
 	tfm->crt_ablkcipher.reqsize = sizeof(struct atmel_aes_reqctx);
@@ -1048,6 +1345,37 @@ static void atmel_aes_cra_exit(struct crypto_tfm *tfm)
 {
 }
 
+static int atmel_aes_fallback_cra_init(struct crypto_tfm *tfm)
+{
+	struct atmel_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+	const char *name = crypto_tfm_alg_name(tfm);
+	int i;
+
+	for (i = 0; i < ATMEL_AES_FB_NR; i++)
+		if (!strcmp(name, atmel_aes_fallback_info[i].name))
+			break;
+
+	/* No software implementation: everything goes to the hardware */
+	ctx->fallback = NULL;
+	if (i < ATMEL_AES_FB_NR) {
+		ctx->fallback = crypto_alloc_blkcipher(name, 0,
+				CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
+		if (IS_ERR(ctx->fallback))
+			ctx->fallback = NULL;
+		ctx->fallback_mode = i;
+	}
+
+	return atmel_aes_cra_init(tfm);
+}
+
+static void atmel_aes_fallback_cra_exit(struct crypto_tfm *tfm)
+{
+	struct atmel_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (ctx->fallback)
+		crypto_free_blkcipher(ctx->fallback);
+}
+
 static int atmel_aead_cra_init(struct crypto_tfm *tfm)
 {
 	struct atmel_aes_ctx *ctx = crypto_tfm_ctx(tfm);
@@ -1113,45 +1441,157 @@ static inline struct aead_request *aead_request_cast(
 	return container_of(req, struct aead_request, base);
 }
 
-static int sg_count(struct scatterlist *sg_list, int nbytes, bool *chained)
+/*
+ * Count the entries covering the first @len bytes of @sg, as long as the
+ * DMA can use each of them as it is.
+ */
+static bool atmel_aead_sg_fast(struct scatterlist *sg, size_t len,
+			       unsigned int *nents)
 {
-	struct scatterlist *sg = sg_list;
-	int sg_nents = 0;
+	unsigned int n = 0;
+	size_t count;
 
-	*chained = false;
-	while (nbytes > 0) {
-		sg_nents++;
-		nbytes -= sg->length;
-		if (!sg_is_last(sg) && (sg + 1)->length == 0)
-			*chained = true;
-		sg = sg_next(sg);
+	for (; sg && len; sg = sg_next(sg), n++) {
+		count = min_t(size_t, sg->length, len);
+		if (!atmel_aes_sg_aligned(sg, count, AES_BLOCK_SIZE))
+			return false;
+		len -= count;
 	}
 
-	return sg_nents;
+	*nents = n;
+
+	return !len;
 }
 
-static int atmel_aead_perform(struct atmel_aes_dev *dd)
+static void atmel_aead_dma_stop(struct atmel_aes_dev *dd)
 {
 	struct aead_request *areq = dd->aead_req;
-	struct crypto_aead *aead = crypto_aead_reqtfm(areq);
-	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
-	struct atmel_aes_reqctx *rctx = aead_request_ctx(areq);
 
-	int err;
-	size_t cryptlen = areq->cryptlen;
-	size_t authsize = ctx->authsize;
-	size_t ivsize = crypto_aead_ivsize(aead);
+	if (!(dd->flags & AES_FLAGS_FAST)) {
+		atmel_aes_sync_for_cpu(dd, dd->dma_addr_out, dd->total,
+					DMA_FROM_DEVICE);
+		scatterwalk_map_and_copy(dd->buf_out, areq->dst, 0, dd->total,
+					 1);
+	} else if (areq->src == areq->dst) {
+		dma_unmap_sg(dd->dev, areq->src, dd->nb_in_sg,
+			     DMA_BIDIRECTIONAL);
+	} else {
+		dma_unmap_sg(dd->dev, areq->dst, dd->nb_out_sg,
+			     DMA_FROM_DEVICE);
+		dma_unmap_sg(dd->dev, areq->src, dd->nb_in_sg, DMA_TO_DEVICE);
+	}
+}
 
-	int assoc_nents, src_nents, dst_nents = 0;
-	bool assoc_chained = false, src_chained = false, dst_chained = false;
+/*
+ * Run the payload of an authenc request through the AES, which forwards its
+ * output to the SHA. The source and destination lists are mapped as they
+ * are, over all their entries, and only lists the DMA can't walk go through
+ * the bounce buffers.
+ */
+static int atmel_aead_dma_start(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct scatterlist *src = areq->src, *dst = areq->dst;
+	int in_mapped, out_mapped, err;
 
-	void *hmac_data = sg_virt(areq->assoc);
+	if (!atmel_aead_sg_fast(src, dd->total, &dd->nb_in_sg) ||
+	    !atmel_aead_sg_fast(dst, dd->total, &dd->nb_out_sg)) {
+		if (dd->total > dd->buflen)
+			return -E2BIG;
 
-	dma_addr_t addr_in, addr_out;
+		atmel_aes_sync_for_cpu(dd, dd->dma_addr_in, dd->total,
+					DMA_TO_DEVICE);
+		scatterwalk_map_and_copy(dd->buf_in, src, 0, dd->total, 0);
+
+		dd->flags &= ~AES_FLAGS_FAST;
+
+		return atmel_aes_crypt_dma(dd, dd->dma_addr_in,
+					   dd->dma_addr_out, dd->total);
+	}
+
+	if (src == dst) {
+		in_mapped = dma_map_sg(dd->dev, src, dd->nb_in_sg,
+				       DMA_BIDIRECTIONAL);
+		if (!in_mapped)
+			return -EINVAL;
+		out_mapped = in_mapped;
+	} else {
+		in_mapped = dma_map_sg(dd->dev, src, dd->nb_in_sg,
+				       DMA_TO_DEVICE);
+		if (!in_mapped)
+			return -EINVAL;
+		out_mapped = dma_map_sg(dd->dev, dst, dd->nb_out_sg,
+					DMA_FROM_DEVICE);
+		if (!out_mapped) {
+			dma_unmap_sg(dd->dev, src, dd->nb_in_sg, DMA_TO_DEVICE);
+			return -EINVAL;
+		}
+		atmel_aes_sg_trim(dst, out_mapped, dd->total);
+	}
+	atmel_aes_sg_trim(src, in_mapped, dd->total);
+
+	dd->flags |= AES_FLAGS_FAST;
+
+	err = atmel_aes_crypt_dma_sg(dd, src, in_mapped, dst, out_mapped,
+				     dd->total);
+	if (err)
+		atmel_aead_dma_stop(dd);
+
+	return err;
+}
+
+static void atmel_aead_finish_req(struct atmel_aes_dev *dd)
+{
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	struct aead_request *areq = dd->aead_req;
+	u32 icv[SHA512_DIGEST_SIZE / sizeof(u32)];
+	int err;
+
+	atmel_aead_dma_stop(dd);
+
+	if (dd->flags & AES_FLAGS_ENCRYPT) {
+		err = atmel_hmac_read_icv(icv, ctx->authsize);
+		if (!err)
+			scatterwalk_map_and_copy(icv, areq->dst, dd->total,
+						 ctx->authsize, 1);
+	} else {
+		scatterwalk_map_and_copy(icv, areq->src, dd->total,
+					 ctx->authsize, 0);
+		err = atmel_hmac_check_icv(icv, ctx->authsize);
+		if (err != 0)
+			err = -EBADMSG;
+	}
+
+	clk_disable_unprepare(dd->iclk);
+	dd->flags &= ~(AES_FLAGS_PLIP | AES_FLAGS_DMA | AES_FLAGS_FAST);
+
+	atmel_crypto_engine_finalize(&dd->engine, &areq->base, err);
+}
+
+static int atmel_aead_perform(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct crypto_aead *aead = crypto_aead_reqtfm(areq);
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
+	struct atmel_aes_reqctx *rctx = aead_request_ctx(areq);
+
+	int err;
+	size_t cryptlen = areq->cryptlen;
+	size_t authsize = ctx->authsize;
+	size_t ivsize = crypto_aead_ivsize(aead);
+
+	void *hmac_data;
 
 	ctx->cryptlen = cryptlen;
 	ctx->ivsize = ivsize;
 
+	dd->total = cryptlen;
+	if (!(rctx->mode & AES_FLAGS_ENCRYPT)) {
+		if (cryptlen < authsize)
+			return -EINVAL;
+		dd->total -= authsize;
+	}
+
 	if (!(rctx->mode & AES_FLAGS_GIV))
 		memcpy(ctx->iv, areq->iv, ivsize);
 
@@ -1161,12 +1601,16 @@ static int atmel_aead_perform(struct atmel_aes_dev *dd)
 	if (err)
 		return err;
 
-	assoc_nents = sg_count(areq->assoc, areq->assoclen, &assoc_chained);
-	src_nents = sg_count(areq->src, areq->cryptlen, &src_chained);
-
-	if (unlikely(areq->dst != areq->src)) {
-		dst_nents = sg_count(areq->dst, areq->cryptlen, &dst_chained);
-		dev_err(dd->dev, "aead src != dst, dst_nents %d\n", dst_nents);
+	/* The SHA reads the ESP header by words from a linear buffer */
+	if (areq->assoc->length >= areq->assoclen &&
+	    IS_ALIGNED(areq->assoc->offset, sizeof(u32))) {
+		hmac_data = sg_virt(areq->assoc);
+	} else {
+		if (areq->assoclen > dd->buflen)
+			return -EINVAL;
+		hmac_data = dd->buf_out;
+		scatterwalk_map_and_copy(hmac_data, areq->assoc, 0,
+					 areq->assoclen, 0);
 	}
 
 	err = atmel_hmac_write_key(ctx->authkey, ctx->authkeylen,
@@ -1178,251 +1622,838 @@ static int atmel_aead_perform(struct atmel_aes_dev *dd)
 
 	if (rctx->mode & AES_FLAGS_ENCRYPT)
 		err = atmel_hmac_write_esp(hmac_data, areq->assoclen,
-					areq->iv, ivsize, cryptlen, 0,
+					areq->iv, ivsize, dd->total, 0,
 					rctx->hmac_type);
 	else
 		err = atmel_hmac_write_esp(hmac_data, areq->assoclen,
 					areq->iv, ivsize,
-					cryptlen - authsize, ctx->authsize,
+					dd->total, ctx->authsize,
 					rctx->hmac_type);
 	if (err) {
 		dev_err(dd->dev, "write esp header error\n");
 		return -EINVAL;
 	}
 
-	err = dma_map_sg(dd->dev, areq->src, 1, DMA_TO_DEVICE);
-	if (!err) {
-		dev_err(dd->dev, "dma_map_sg() error\n");
-		return -EINVAL;
+	err = atmel_aead_dma_start(dd);
+	if (err) {
+		dev_err(dd->dev, "aead dma error %d\n", err);
+		return err;
 	}
 
-	err = dma_map_sg(dd->dev, areq->dst, 1,
-			DMA_FROM_DEVICE);
-	if (!err) {
-		dev_err(dd->dev, "dma_map_sg() error\n");
-		dma_unmap_sg(dd->dev, areq->src, 1,
-			DMA_TO_DEVICE);
-		return -EINVAL;
+	return -EINPROGRESS;
+}
+
+static void atmel_aead_start(struct atmel_aes_dev *dd,
+			     struct aead_request *req)
+{
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
+	int rc;
+
+	dd->ctx = ctx;
+	ctx->dd = dd;
+	dd->aead_req = req;
+
+	if (((struct atmel_aes_reqctx *)aead_request_ctx(req))->mode &
+	    AES_FLAGS_GCM) {
+		atmel_aes_gcm_start(dd);
+		return;
 	}
 
-	addr_in = sg_dma_address(areq->src);
-	addr_out = sg_dma_address(areq->dst);
+	if (((struct atmel_aes_reqctx *)aead_request_ctx(req))->mode &
+	    AES_FLAGS_CCM) {
+		atmel_aes_ccm_start(dd);
+		return;
+	}
 
-	if (rctx->mode & AES_FLAGS_ENCRYPT)
-		atmel_aes_crypt_dma(dd, addr_in, addr_out, cryptlen);
+	dd->flags |= AES_FLAGS_PLIP;
+	rc = atmel_aead_perform(dd);
+	if (rc != -EINPROGRESS) {
+		dev_err(dd->dev, "perform aead error %d", rc);
+		clk_disable_unprepare(dd->iclk);
+		dd->flags &= ~AES_FLAGS_PLIP;
+
+		atmel_crypto_engine_finalize(&dd->engine, &req->base, rc);
+	}
+}
+
+static int atmel_aead_crypt(struct aead_request *req,
+			unsigned long aes_mode,
+			unsigned long hmac_type)
+{
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
+	struct atmel_aes_dev *dd;
+	struct atmel_aes_reqctx *rctx = aead_request_ctx(req);
+
+	ctx->block_size = AES_BLOCK_SIZE;
+	dd = atmel_aes_find_dev(ctx);
+	if (!dd)
+		return -ENODEV;
+
+	rctx->mode = aes_mode;
+	rctx->hmac_type = hmac_type;
+
+	return atmel_crypto_engine_enqueue(&dd->engine, &req->base);
+}
+
+static int atmel_aead_givcrypt(struct aead_givcrypt_request *req,
+				unsigned long aes_mode,
+				unsigned long hmac_type)
+{
+	struct aead_request *areq = &req->areq;
+	struct crypto_aead *aead = crypto_aead_reqtfm(areq);
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
+
+	memcpy(req->giv, ctx->iv, crypto_aead_ivsize(aead));
+	memcpy(req->areq.iv, ctx->iv, crypto_aead_ivsize(aead));
+	ctx->seq = req->seq;
+
+	return atmel_aead_crypt(areq, aes_mode, hmac_type);
+}
+
+static int atmel_aead_sha1_cbc_encrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA1);
+}
+
+static int atmel_aead_sha1_cbc_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA1);
+}
+
+static int atmel_aead_sha1_cbc_givencrypt(struct aead_givcrypt_request *req)
+{
+	return atmel_aead_givcrypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
+		SHA_MR_ALGO_HMAC_SHA1);
+}
+
+static int atmel_aead_sha224_cbc_encrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA224);
+}
+
+static int atmel_aead_sha224_cbc_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA224);
+}
+
+static int atmel_aead_sha224_cbc_givencrypt(struct aead_givcrypt_request *req)
+{
+	return atmel_aead_givcrypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
+		SHA_MR_ALGO_HMAC_SHA224);
+}
+
+static int atmel_aead_sha256_cbc_encrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA256);
+}
+
+static int atmel_aead_sha256_cbc_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA256);
+}
+
+static int atmel_aead_sha256_cbc_givencrypt(struct aead_givcrypt_request *req)
+{
+	return atmel_aead_givcrypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
+		SHA_MR_ALGO_HMAC_SHA256);
+}
+
+static int atmel_aead_sha384_cbc_encrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA384);
+}
+
+static int atmel_aead_sha384_cbc_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA384);
+}
+
+static int atmel_aead_sha384_cbc_givencrypt(struct aead_givcrypt_request *req)
+{
+	return atmel_aead_givcrypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
+		SHA_MR_ALGO_HMAC_SHA384);
+}
+
+static int atmel_aead_sha512_cbc_encrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA512);
+}
+
+static int atmel_aead_sha512_cbc_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA512);
+}
+
+static int atmel_aead_sha512_cbc_givencrypt(struct aead_givcrypt_request *req)
+{
+	return atmel_aead_givcrypt(req,
+		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
+		SHA_MR_ALGO_HMAC_SHA512);
+}
+
+/*
+ * GCM: the key, the lengths and J0 are programmed, then the AAD blocks are
+ * fed by the CPU and the text goes through DMA (or the CPU for short
+ * requests). The hardware computes H and the tag on its own.
+ */
+static void atmel_aes_gcm_write_ctrl(struct atmel_aes_dev *dd, u32 opmod)
+{
+	u32 valmr = opmod | AES_MR_SMOD_AUTO;
+
+	if (dd->ctx->keylen == AES_KEYSIZE_128)
+		valmr |= AES_MR_KEYSIZE_128;
+	else if (dd->ctx->keylen == AES_KEYSIZE_192)
+		valmr |= AES_MR_KEYSIZE_192;
 	else
-		atmel_aes_crypt_dma(dd, addr_in, addr_out, cryptlen - authsize);
+		valmr |= AES_MR_KEYSIZE_256;
+
+	/* The tag pass (ECB) always encrypts */
+	if ((dd->flags & AES_FLAGS_ENCRYPT) || opmod != AES_MR_OPMOD_GCM)
+		valmr |= AES_MR_CYPHER_ENC;
+
+	if (opmod == AES_MR_OPMOD_GCM && (dd->flags & AES_FLAGS_GTAGEN))
+		valmr |= AES_MR_GTAGEN;
+
+	atmel_aes_write(dd, AES_CR, 0);
+	atmel_aes_write(dd, AES_MR, valmr);
+	/* Don't leave the AES/SHA pipeline of authenc requests enabled */
+	atmel_aes_write(dd, AES_EMR, 0);
+	atmel_aes_write_n(dd, AES_KEYWR(0), dd->ctx->key,
+						dd->ctx->keylen >> 2);
+}
+
+static int atmel_aes_gcm_aad(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	u32 block[AES_BLOCK_SIZE / sizeof(u32)];
+	unsigned int off, n;
+	int err;
+
+	for (off = 0; off < areq->assoclen; off += n) {
+		n = min_t(unsigned int, areq->assoclen - off, AES_BLOCK_SIZE);
+		memset(block, 0, sizeof(block));
+		scatterwalk_map_and_copy(block, areq->assoc, off, n, 0);
+
+		atmel_aes_write_n(dd, AES_IDATAR(0), block, 4);
+		err = atmel_aes_wait(dd, AES_INT_DATARDY);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int atmel_aes_gcm_cpu(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	u32 block[AES_BLOCK_SIZE / sizeof(u32)];
+	size_t off, n;
+	int err;
+
+	for (off = 0; off < dd->total; off += n) {
+		n = min_t(size_t, dd->total - off, AES_BLOCK_SIZE);
+		memset(block, 0, sizeof(block));
+		scatterwalk_map_and_copy(block, areq->src, off, n, 0);
+
+		atmel_aes_write_n(dd, AES_IDATAR(0), block, 4);
+		err = atmel_aes_wait(dd, AES_INT_DATARDY);
+		if (err)
+			return err;
+
+		atmel_aes_read_n(dd, AES_ODATAR(0), block, 4);
+		scatterwalk_map_and_copy(block, areq->dst, off, n, 1);
+	}
+
+	return 0;
+}
+
+static void atmel_aes_gcm_unmap(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+
+	if (areq->src == areq->dst) {
+		dma_unmap_sg(dd->dev, areq->src, 1, DMA_BIDIRECTIONAL);
+	} else {
+		dma_unmap_sg(dd->dev, areq->dst, 1, DMA_FROM_DEVICE);
+		dma_unmap_sg(dd->dev, areq->src, 1, DMA_TO_DEVICE);
+	}
+}
+
+/*
+ * Returns -EINPROGRESS once the DMA is running, or -E2BIG when the text can
+ * neither be mapped directly nor fit in the bounce buffers.
+ */
+static int atmel_aes_gcm_dma_start(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct scatterlist *src = areq->src, *dst = areq->dst;
+	size_t len = dd->total;
+	dma_addr_t addr_in, addr_out;
+	bool fast;
+	u32 valmr;
+	int err;
+
+	fast = IS_ALIGNED(len, AES_BLOCK_SIZE) &&
+		IS_ALIGNED(src->offset, sizeof(u32)) && src->length >= len &&
+		IS_ALIGNED(dst->offset, sizeof(u32)) && dst->length >= len;
+
+	if (fast) {
+		if (src == dst) {
+			if (!dma_map_sg(dd->dev, src, 1, DMA_BIDIRECTIONAL))
+				return -EINVAL;
+		} else {
+			if (!dma_map_sg(dd->dev, src, 1, DMA_TO_DEVICE))
+				return -EINVAL;
+			if (!dma_map_sg(dd->dev, dst, 1, DMA_FROM_DEVICE)) {
+				dma_unmap_sg(dd->dev, src, 1, DMA_TO_DEVICE);
+				return -EINVAL;
+			}
+		}
+
+		addr_in = sg_dma_address(src);
+		addr_out = sg_dma_address(dst);
+		dd->flags |= AES_FLAGS_FAST;
+	} else {
+		len = ALIGN(len, AES_BLOCK_SIZE);
+		if (len > dd->buflen)
+			return -E2BIG;
+
+		atmel_aes_sync_for_cpu(dd, dd->dma_addr_in, len,
+					DMA_TO_DEVICE);
+		memset(dd->buf_in, 0, len);
+		scatterwalk_map_and_copy(dd->buf_in, src, 0, dd->total, 0);
+
+		addr_in = dd->dma_addr_in;
+		addr_out = dd->dma_addr_out;
+		dd->flags &= ~AES_FLAGS_FAST;
+	}
+
+	valmr = atmel_aes_read(dd, AES_MR);
+	valmr &= ~(AES_MR_SMOD_MASK | AES_MR_DUALBUFF);
+	valmr |= AES_MR_SMOD_IDATAR0;
+	if (dd->caps.has_dualbuff)
+		valmr |= AES_MR_DUALBUFF;
+	atmel_aes_write(dd, AES_MR, valmr);
+
+	err = atmel_aes_crypt_dma(dd, addr_in, addr_out, len);
+	if (err) {
+		if (dd->flags & AES_FLAGS_FAST)
+			atmel_aes_gcm_unmap(dd);
+		return err;
+	}
 
 	return -EINPROGRESS;
 }
 
-static void atmel_aead_queue_task(unsigned long data)
+static int atmel_aes_gcm_tag(struct atmel_aes_dev *dd)
 {
-	struct atmel_aes_dev *dd = (struct atmel_aes_dev *) data;
+	struct aead_request *areq = dd->aead_req;
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	u32 itag[AES_BLOCK_SIZE / sizeof(u32)];
+	int err;
 
-	struct crypto_async_request *async_req, *backlog;
-	struct crypto_aead *aead;
-	struct aead_request *req;
-	struct atmel_aes_ctx *ctx;
+	if (dd->flags & AES_FLAGS_GTAGEN) {
+		err = atmel_aes_wait(dd, AES_INT_TAGRDY);
+		if (err)
+			return err;
+		atmel_aes_read_n(dd, AES_TAGR(0), ctx->tag, 4);
+	} else {
+		/*
+		 * The automatic tag generation doesn't work without AAD nor
+		 * text. GHASH of nothing is zero, so the tag is E(K, J0).
+		 */
+		atmel_aes_gcm_write_ctrl(dd, AES_MR_OPMOD_ECB);
+		atmel_aes_write_n(dd, AES_IDATAR(0), ctx->j0, 4);
+		err = atmel_aes_wait(dd, AES_INT_DATARDY);
+		if (err)
+			return err;
+		atmel_aes_read_n(dd, AES_ODATAR(0), ctx->tag, 4);
+	}
 
-	int rc;
-	unsigned long flags;
+	if (dd->flags & AES_FLAGS_ENCRYPT) {
+		scatterwalk_map_and_copy(ctx->tag, areq->dst, dd->total,
+					 ctx->authsize, 1);
+		return 0;
+	}
 
-	spin_lock_irqsave(&dd->lock, flags);
+	scatterwalk_map_and_copy(itag, areq->src, dd->total, ctx->authsize, 0);
 
-	if (dd->flags & AES_FLAGS_BUSY) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return;
+	return crypto_memneq(itag, ctx->tag, ctx->authsize) ? -EBADMSG : 0;
+}
+
+static void atmel_aes_gcm_complete(struct atmel_aes_dev *dd, int err)
+{
+	clk_disable_unprepare(dd->iclk);
+	dd->flags &= ~(AES_FLAGS_DMA | AES_FLAGS_FAST |
+		       AES_FLAGS_GCM | AES_FLAGS_CCM | AES_FLAGS_GTAGEN);
+
+	atmel_crypto_engine_finalize(&dd->engine, &dd->aead_req->base, err);
+}
+
+static void atmel_aes_gcm_start(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct crypto_aead *aead = crypto_aead_reqtfm(areq);
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	struct atmel_aes_reqctx *rctx = aead_request_ctx(areq);
+	u32 iv[AES_BLOCK_SIZE / sizeof(u32)];
+	u8 *j0 = (u8 *)ctx->j0;
+	int err;
+
+	dd->flags &= ~(AES_FLAGS_MODE_MASK | AES_FLAGS_PLIP);
+	dd->flags |= rctx->mode;
+
+	atmel_aes_hw_init(dd);
+
+	if (!(dd->flags & AES_FLAGS_ENCRYPT) && areq->cryptlen < ctx->authsize) {
+		err = -EINVAL;
+		goto complete;
 	}
+	dd->total = areq->cryptlen;
+	if (!(dd->flags & AES_FLAGS_ENCRYPT))
+		dd->total -= ctx->authsize;
 
-	if (atomic_read(&dd->aead_configuring)) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return;
+	if (areq->assoclen || dd->total)
+		dd->flags |= AES_FLAGS_GTAGEN;
+
+	/* J0 = IV || 0^31 || 1, with the salt in front of the IV for RFC4106 */
+	if (crypto_aead_ivsize(aead) == ATMEL_AES_RFC4106_IV_SIZE) {
+		memcpy(j0, ctx->nonce, ATMEL_AES_GCM_NONCE_SIZE);
+		memcpy(j0 + ATMEL_AES_GCM_NONCE_SIZE, areq->iv,
+		       ATMEL_AES_RFC4106_IV_SIZE);
+	} else {
+		memcpy(j0, areq->iv, ATMEL_AES_GCM_IV_SIZE);
 	}
+	ctx->j0[3] = cpu_to_be32(1);
 
-	atomic_inc(&dd->aead_configuring);
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->aead_queue);
-	if (async_req)
-		dd->flags |= AES_FLAGS_BUSY;
+	/* H is computed by the hardware as soon as the key is written */
+	atmel_aes_gcm_write_ctrl(dd, AES_MR_OPMOD_GCM);
+	err = atmel_aes_wait(dd, AES_INT_DATARDY);
+	if (err)
+		goto complete;
 
-	atomic_dec(&dd->aead_configuring);
-	spin_unlock_irqrestore(&dd->lock, flags);
+	/* The text is encrypted from inc32(J0) */
+	memcpy(iv, ctx->j0, sizeof(iv));
+	iv[3] = cpu_to_be32(2);
+	atmel_aes_write_n(dd, AES_IVR(0), iv, 4);
 
-	if (!async_req)
-		return;
+	atmel_aes_write(dd, AES_AADLENR, areq->assoclen);
+	atmel_aes_write(dd, AES_CLENR, dd->total);
 
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
+	err = atmel_aes_gcm_aad(dd);
+	if (err)
+		goto complete;
 
-	req = aead_request_cast(async_req);
-	aead = crypto_aead_reqtfm(req);
-	ctx = crypto_aead_ctx(aead);
+	if (dd->total > ATMEL_AES_DMA_THRESHOLD) {
+		err = atmel_aes_gcm_dma_start(dd);
+		if (err == -EINPROGRESS)
+			return;
+		if (err != -E2BIG)
+			goto complete;
+	}
 
-	dd->flags |= AES_FLAGS_PLIP;
-	dd->ctx = ctx;
-	ctx->dd = dd;
-	dd->aead_req = req;
+	if (dd->total) {
+		err = atmel_aes_gcm_cpu(dd);
+		if (err)
+			goto complete;
+	}
 
-	rc = atmel_aead_perform(dd);
-	if (rc != -EINPROGRESS) {
-		dev_err(dd->dev, "perform aead error %d", rc);
-		aead_request_complete(dd->aead_req, rc);
-		clk_disable_unprepare(dd->iclk);
-		dd->flags &= ~(AES_FLAGS_BUSY | AES_FLAGS_PLIP);
+	err = atmel_aes_gcm_tag(dd);
 
-		tasklet_schedule(&dd->aead_task);
+complete:
+	atmel_aes_gcm_complete(dd, err);
+}
+
+static void atmel_aes_gcm_dma_done(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	int err;
+
+	if (dd->flags & AES_FLAGS_FAST) {
+		atmel_aes_gcm_unmap(dd);
+	} else {
+		atmel_aes_sync_for_cpu(dd, dd->dma_addr_out,
+					dd->dma_size, DMA_FROM_DEVICE);
+		scatterwalk_map_and_copy(dd->buf_out, areq->dst, 0, dd->total, 1);
 	}
+	dd->flags &= ~AES_FLAGS_DMA;
+
+	err = atmel_aes_gcm_tag(dd);
+	atmel_aes_gcm_complete(dd, err);
 }
 
-static int atmel_aead_enqueue(struct atmel_aes_dev *dd,
-			struct aead_request *req)
+static int atmel_aes_gcm_setkey(struct crypto_aead *tfm, const u8 *key,
+				unsigned int keylen)
 {
-	unsigned long flags;
-	int ret = 0;
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(tfm);
 
-	spin_lock_irqsave(&dd->lock, flags);
-	if (atomic_read(&dd->aead_configuring)) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return -EAGAIN;
+	if (keylen != AES_KEYSIZE_128 && keylen != AES_KEYSIZE_192 &&
+	    keylen != AES_KEYSIZE_256) {
+		crypto_aead_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
 	}
 
-	atomic_inc(&dd->aead_configuring);
-	ret = crypto_enqueue_request(&dd->aead_queue, &req->base);
-	if (ret == -EBUSY)
-		dev_err(dd->dev, "atmel aead queue is full");
+	memcpy(ctx->key, key, keylen);
+	ctx->keylen = keylen;
 
-	atomic_dec(&dd->aead_configuring);
-	spin_unlock_irqrestore(&dd->lock, flags);
+	return 0;
+}
 
-	tasklet_schedule(&dd->aead_task);
+static int atmel_aes_gcm_setauthsize(struct crypto_aead *tfm,
+				     unsigned int authsize)
+{
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(tfm);
+
+	switch (authsize) {
+	case 4:
+	case 8:
+	case 12:
+	case 13:
+	case 14:
+	case 15:
+	case 16:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ctx->authsize = authsize;
 
-	return ret;
+	return 0;
 }
 
-static int atmel_aead_crypt(struct aead_request *req,
-			unsigned long aes_mode,
-			unsigned long hmac_type)
+static int atmel_aes_gcm_encrypt(struct aead_request *req)
 {
-	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	return atmel_aead_crypt(req, AES_FLAGS_ENCRYPT | AES_FLAGS_GCM, 0);
+}
+
+static int atmel_aes_gcm_decrypt(struct aead_request *req)
+{
+	return atmel_aead_crypt(req, AES_FLAGS_GCM, 0);
+}
+
+static int atmel_aes_rfc4106_setkey(struct crypto_aead *tfm, const u8 *key,
+				    unsigned int keylen)
+{
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(tfm);
+
+	/* The last four bytes of the key are the salt of the nonce */
+	if (keylen < ATMEL_AES_GCM_NONCE_SIZE) {
+		crypto_aead_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+
+	keylen -= ATMEL_AES_GCM_NONCE_SIZE;
+	memcpy(ctx->nonce, key + keylen, ATMEL_AES_GCM_NONCE_SIZE);
+
+	return atmel_aes_gcm_setkey(tfm, key, keylen);
+}
+
+static int atmel_aes_rfc4106_setauthsize(struct crypto_aead *tfm,
+					 unsigned int authsize)
+{
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(tfm);
+
+	switch (authsize) {
+	case 8:
+	case 12:
+	case 16:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ctx->authsize = authsize;
+
+	return 0;
+}
+
+static int atmel_aes_rfc4106_givencrypt(struct aead_givcrypt_request *req)
+{
+	struct crypto_aead *aead = crypto_aead_reqtfm(&req->areq);
 	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
-	struct atmel_aes_dev *dd;
-	struct atmel_aes_reqctx *rctx = aead_request_ctx(req);
+	__be64 seq = cpu_to_be64(req->seq);
+
+	/*
+	 * GCM must never reuse an IV with the same key: derive it from the
+	 * sequence number and the random value drawn at tfm init, as seqiv
+	 * does.
+	 */
+	memcpy(req->giv, ctx->iv, ATMEL_AES_RFC4106_IV_SIZE);
+	crypto_xor(req->giv, (u8 *)&seq, ATMEL_AES_RFC4106_IV_SIZE);
+	memcpy(req->areq.iv, req->giv, ATMEL_AES_RFC4106_IV_SIZE);
+
+	return atmel_aead_crypt(&req->areq, AES_FLAGS_ENCRYPT | AES_FLAGS_GCM,
+				0);
+}
+
+/*
+ * CCM: the IP has no CCM mode, so the CBC-MAC and the CTR passes are run
+ * one after the other through the CBC and CTR modes, with the key loaded
+ * for each. The CBC-MAC is polled: CCM traffic is mostly short frames
+ * (802.15.4, BLE) where a DMA setup costs more than it saves. The CTR pass
+ * over the text goes through a single DMA transfer as for GCM, or the CPU
+ * for short texts. j0 holds the A0 counter block and tag the CBC-MAC.
+ */
+static int atmel_aes_ccm_block(struct atmel_aes_dev *dd, u32 *block)
+{
+	atmel_aes_write_n(dd, AES_IDATAR(0), block, 4);
+
+	return atmel_aes_wait(dd, AES_INT_DATARDY);
+}
+
+static int atmel_aes_ccm_mac_sg(struct atmel_aes_dev *dd,
+				struct scatterlist *sg, size_t off, size_t len)
+{
+	u32 block[AES_BLOCK_SIZE / sizeof(u32)];
+	size_t n;
+	int err;
+
+	for (; len; off += n, len -= n) {
+		n = min_t(size_t, len, AES_BLOCK_SIZE);
+		memset(block, 0, sizeof(block));
+		scatterwalk_map_and_copy(block, sg, off, n, 0);
+
+		err = atmel_aes_ccm_block(dd, block);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int atmel_aes_ccm_mac(struct atmel_aes_dev *dd, struct scatterlist *text)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	u32 block[AES_BLOCK_SIZE / sizeof(u32)];
+	u8 *b = (u8 *)block;
+	unsigned int l;
+	size_t len, n;
+	int i, err;
+
+	/* B0: flags, nonce and text length */
+	memcpy(block, ctx->j0, AES_BLOCK_SIZE);
+	l = b[0] + 1;
+	b[0] |= ((ctx->authsize - 2) / 2) << 3;
+	if (areq->assoclen)
+		b[0] |= 0x40;
+	for (i = 0, len = dd->total; i < l; i++, len >>= 8)
+		b[AES_BLOCK_SIZE - 1 - i] = len & 0xff;
+
+	atmel_aes_gcm_write_ctrl(dd, AES_MR_OPMOD_CBC);
+	memset(ctx->tag, 0, sizeof(ctx->tag));
+	atmel_aes_write_n(dd, AES_IVR(0), ctx->tag, 4);
+
+	err = atmel_aes_ccm_block(dd, block);
+	if (err)
+		return err;
+
+	if (areq->assoclen) {
+		/* The AAD length is prepended to the AAD */
+		memset(block, 0, sizeof(block));
+		if (areq->assoclen < 0xff00) {
+			put_unaligned_be16(areq->assoclen, b);
+			n = 2;
+		} else {
+			b[0] = 0xff;
+			b[1] = 0xfe;
+			put_unaligned_be32(areq->assoclen, b + 2);
+			n = 6;
+		}
+		len = min_t(size_t, areq->assoclen, AES_BLOCK_SIZE - n);
+		scatterwalk_map_and_copy(b + n, areq->assoc, 0, len, 0);
+
+		err = atmel_aes_ccm_block(dd, block);
+		if (!err)
+			err = atmel_aes_ccm_mac_sg(dd, areq->assoc, len,
+						   areq->assoclen - len);
+		if (err)
+			return err;
+	}
+
+	err = atmel_aes_ccm_mac_sg(dd, text, 0, dd->total);
+	if (err)
+		return err;
+
+	atmel_aes_read_n(dd, AES_ODATAR(0), ctx->tag, 4);
+
+	return 0;
+}
+
+static int atmel_aes_ccm_ctr(struct atmel_aes_dev *dd)
+{
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	u32 ctr[AES_BLOCK_SIZE / sizeof(u32)];
+	int err;
+
+	if (!dd->total)
+		return 0;
+
+	/* The text is encrypted from A1 */
+	memcpy(ctr, ctx->j0, sizeof(ctr));
+	((u8 *)ctr)[AES_BLOCK_SIZE - 1] = 1;
+
+	atmel_aes_gcm_write_ctrl(dd, AES_MR_OPMOD_CTR);
+	atmel_aes_write_n(dd, AES_IVR(0), ctr, 4);
+
+	if (dd->total > ATMEL_AES_DMA_THRESHOLD) {
+		err = atmel_aes_gcm_dma_start(dd);
+		if (err != -E2BIG)
+			return err;
+	}
+
+	return atmel_aes_gcm_cpu(dd);
+}
+
+/* MAC of the decrypted text, then tag = MAC ^ E(K, A0) */
+static int atmel_aes_ccm_tag(struct atmel_aes_dev *dd)
+{
+	struct aead_request *areq = dd->aead_req;
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	u32 s0[AES_BLOCK_SIZE / sizeof(u32)];
+	u32 itag[AES_BLOCK_SIZE / sizeof(u32)];
+	int err;
+
+	if (!(dd->flags & AES_FLAGS_ENCRYPT)) {
+		err = atmel_aes_ccm_mac(dd, areq->dst);
+		if (err)
+			return err;
+	}
 
-	ctx->block_size = AES_BLOCK_SIZE;
-	dd = atmel_aes_find_dev(ctx);
-	if (!dd)
-		return -ENODEV;
+	atmel_aes_gcm_write_ctrl(dd, AES_MR_OPMOD_ECB);
+	memcpy(s0, ctx->j0, sizeof(s0));
+	err = atmel_aes_ccm_block(dd, s0);
+	if (err)
+		return err;
+	atmel_aes_read_n(dd, AES_ODATAR(0), s0, 4);
+	crypto_xor((u8 *)ctx->tag, (u8 *)s0, AES_BLOCK_SIZE);
 
-	rctx->mode = aes_mode;
-	rctx->hmac_type = hmac_type;
+	if (dd->flags & AES_FLAGS_ENCRYPT) {
+		scatterwalk_map_and_copy(ctx->tag, areq->dst, dd->total,
+					 ctx->authsize, 1);
+		return 0;
+	}
 
-	return atmel_aead_enqueue(dd, req);
+	scatterwalk_map_and_copy(itag, areq->src, dd->total, ctx->authsize, 0);
+
+	return crypto_memneq(itag, ctx->tag, ctx->authsize) ? -EBADMSG : 0;
 }
 
-static int atmel_aead_givcrypt(struct aead_givcrypt_request *req,
-				unsigned long aes_mode,
-				unsigned long hmac_type)
+static void atmel_aes_ccm_start(struct atmel_aes_dev *dd)
 {
-	struct aead_request *areq = &req->areq;
-	struct crypto_aead *aead = crypto_aead_reqtfm(areq);
-	struct atmel_aes_ctx *ctx = crypto_aead_ctx(aead);
+	struct aead_request *areq = dd->aead_req;
+	struct atmel_aes_ctx *ctx = dd->ctx;
+	struct atmel_aes_reqctx *rctx = aead_request_ctx(areq);
+	u8 *a0 = (u8 *)ctx->j0;
+	unsigned int l = areq->iv[0] + 1;
+	int err;
 
-	memcpy(req->giv, ctx->iv, crypto_aead_ivsize(aead));
-	memcpy(req->areq.iv, ctx->iv, crypto_aead_ivsize(aead));
-	ctx->seq = req->seq;
+	dd->flags &= ~(AES_FLAGS_MODE_MASK | AES_FLAGS_PLIP);
+	dd->flags |= rctx->mode;
 
-	return atmel_aead_crypt(areq, aes_mode, hmac_type);
-}
+	atmel_aes_hw_init(dd);
 
-static int atmel_aead_sha1_cbc_encrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA1);
-}
+	/* iv[0] is L' = L - 1, the size of the length field minus one */
+	if (l < 2 || l > 8) {
+		err = -EINVAL;
+		goto complete;
+	}
 
-static int atmel_aead_sha1_cbc_decrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA1);
-}
+	if (!(dd->flags & AES_FLAGS_ENCRYPT) && areq->cryptlen < ctx->authsize) {
+		err = -EINVAL;
+		goto complete;
+	}
+	dd->total = areq->cryptlen;
+	if (!(dd->flags & AES_FLAGS_ENCRYPT))
+		dd->total -= ctx->authsize;
 
-static int atmel_aead_sha1_cbc_givencrypt(struct aead_givcrypt_request *req)
-{
-	return atmel_aead_givcrypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
-		SHA_MR_ALGO_HMAC_SHA1);
-}
+	if (dd->total > ATMEL_AES_CCM_MAX_TEXT ||
+	    (l < sizeof(dd->total) && dd->total >> (8 * l))) {
+		err = -EOVERFLOW;
+		goto complete;
+	}
 
-static int atmel_aead_sha224_cbc_encrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA224);
-}
+	/* A0 = flags (L') || nonce || 0 */
+	memcpy(a0, areq->iv, AES_BLOCK_SIZE);
+	memset(a0 + AES_BLOCK_SIZE - l, 0, l);
 
-static int atmel_aead_sha224_cbc_decrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA224);
-}
+	if (dd->flags & AES_FLAGS_ENCRYPT) {
+		err = atmel_aes_ccm_mac(dd, areq->src);
+		if (err)
+			goto complete;
+	}
 
-static int atmel_aead_sha224_cbc_givencrypt(struct aead_givcrypt_request *req)
-{
-	return atmel_aead_givcrypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
-		SHA_MR_ALGO_HMAC_SHA224);
-}
+	err = atmel_aes_ccm_ctr(dd);
+	if (err == -EINPROGRESS)
+		return;
+	if (!err)
+		err = atmel_aes_ccm_tag(dd);
 
-static int atmel_aead_sha256_cbc_encrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA256);
+complete:
+	atmel_aes_gcm_complete(dd, err);
 }
 
-static int atmel_aead_sha256_cbc_decrypt(struct aead_request *req)
+static void atmel_aes_ccm_dma_done(struct atmel_aes_dev *dd)
 {
-	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA256);
-}
+	struct aead_request *areq = dd->aead_req;
+	int err;
 
-static int atmel_aead_sha256_cbc_givencrypt(struct aead_givcrypt_request *req)
-{
-	return atmel_aead_givcrypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
-		SHA_MR_ALGO_HMAC_SHA256);
-}
+	if (dd->flags & AES_FLAGS_FAST) {
+		atmel_aes_gcm_unmap(dd);
+	} else {
+		atmel_aes_sync_for_cpu(dd, dd->dma_addr_out,
+					dd->dma_size, DMA_FROM_DEVICE);
+		scatterwalk_map_and_copy(dd->buf_out, areq->dst, 0, dd->total, 1);
+	}
+	dd->flags &= ~AES_FLAGS_DMA;
 
-static int atmel_aead_sha384_cbc_encrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA384);
+	err = atmel_aes_ccm_tag(dd);
+	atmel_aes_gcm_complete(dd, err);
 }
 
-static int atmel_aead_sha384_cbc_decrypt(struct aead_request *req)
+static int atmel_aes_ccm_setauthsize(struct crypto_aead *tfm,
+				     unsigned int authsize)
 {
-	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA384);
-}
+	struct atmel_aes_ctx *ctx = crypto_aead_ctx(tfm);
 
-static int atmel_aead_sha384_cbc_givencrypt(struct aead_givcrypt_request *req)
-{
-	return atmel_aead_givcrypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
-		SHA_MR_ALGO_HMAC_SHA384);
-}
+	switch (authsize) {
+	case 4:
+	case 6:
+	case 8:
+	case 10:
+	case 12:
+	case 14:
+	case 16:
+		break;
+	default:
+		return -EINVAL;
+	}
 
-static int atmel_aead_sha512_cbc_encrypt(struct aead_request *req)
-{
-	return atmel_aead_crypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA512);
+	ctx->authsize = authsize;
+
+	return 0;
 }
 
-static int atmel_aead_sha512_cbc_decrypt(struct aead_request *req)
+static int atmel_aes_ccm_encrypt(struct aead_request *req)
 {
-	return atmel_aead_crypt(req, AES_FLAGS_CBC, SHA_MR_ALGO_HMAC_SHA512);
+	return atmel_aead_crypt(req, AES_FLAGS_ENCRYPT | AES_FLAGS_CCM, 0);
 }
 
-static int atmel_aead_sha512_cbc_givencrypt(struct aead_givcrypt_request *req)
+static int atmel_aes_ccm_decrypt(struct aead_request *req)
 {
-	return atmel_aead_givcrypt(req,
-		AES_FLAGS_ENCRYPT | AES_FLAGS_CBC | AES_FLAGS_GIV,
-		SHA_MR_ALGO_HMAC_SHA512);
+	return atmel_aead_crypt(req, AES_FLAGS_CCM, 0);
 }
 
 static struct crypto_alg aes_algs[] = {
@@ -1430,14 +2461,15 @@ static struct crypto_alg aes_algs[] = {
 	.cra_name		= "ecb(aes)",
 	.cra_driver_name	= "atmel-ecb-aes",
 	.cra_priority		= 100,
-	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC |
+				  CRYPTO_ALG_NEED_FALLBACK,
 	.cra_blocksize		= AES_BLOCK_SIZE,
 	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
 	.cra_alignmask		= 0xf,
 	.cra_type		= &crypto_ablkcipher_type,
 	.cra_module		= THIS_MODULE,
-	.cra_init		= atmel_aes_cra_init,
-	.cra_exit		= atmel_aes_cra_exit,
+	.cra_init		= atmel_aes_fallback_cra_init,
+	.cra_exit		= atmel_aes_fallback_cra_exit,
 	.cra_u.ablkcipher = {
 		.min_keysize	= AES_MIN_KEY_SIZE,
 		.max_keysize	= AES_MAX_KEY_SIZE,
@@ -1450,14 +2482,15 @@ static struct crypto_alg aes_algs[] = {
 	.cra_name		= "cbc(aes)",
 	.cra_driver_name	= "atmel-cbc-aes",
 	.cra_priority		= 100,
-	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC |
+				  CRYPTO_ALG_NEED_FALLBACK,
 	.cra_blocksize		= AES_BLOCK_SIZE,
 	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
 	.cra_alignmask		= 0xf,
 	.cra_type		= &crypto_ablkcipher_type,
 	.cra_module		= THIS_MODULE,
-	.cra_init		= atmel_aes_cra_init,
-	.cra_exit		= atmel_aes_cra_exit,
+	.cra_init		= atmel_aes_fallback_cra_init,
+	.cra_exit		= atmel_aes_fallback_cra_exit,
 	.cra_u.ablkcipher = {
 		.min_keysize	= AES_MIN_KEY_SIZE,
 		.max_keysize	= AES_MAX_KEY_SIZE,
@@ -1576,14 +2609,15 @@ static struct crypto_alg aes_algs[] = {
 	.cra_name		= "ctr(aes)",
 	.cra_driver_name	= "atmel-ctr-aes",
 	.cra_priority		= 100,
-	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC |
+				  CRYPTO_ALG_NEED_FALLBACK,
 	.cra_blocksize		= AES_BLOCK_SIZE,
 	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
 	.cra_alignmask		= 0xf,
 	.cra_type		= &crypto_ablkcipher_type,
 	.cra_module		= THIS_MODULE,
-	.cra_init		= atmel_aes_cra_init,
-	.cra_exit		= atmel_aes_cra_exit,
+	.cra_init		= atmel_aes_fallback_cra_init,
+	.cra_exit		= atmel_aes_fallback_cra_exit,
 	.cra_u.ablkcipher = {
 		.min_keysize	= AES_MIN_KEY_SIZE,
 		.max_keysize	= AES_MAX_KEY_SIZE,
@@ -1617,6 +2651,29 @@ static struct crypto_alg aes_cfb64_alg = {
 	}
 };
 
+static struct crypto_alg aes_xts_alg = {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "atmel-xts-aes",
+	.cra_priority		= 100,
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC |
+				  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
+	.cra_alignmask		= 0xf,
+	.cra_type		= &crypto_ablkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_init		= atmel_aes_fallback_cra_init,
+	.cra_exit		= atmel_aes_fallback_cra_exit,
+	.cra_u.ablkcipher = {
+		.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+		.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+		.ivsize		= AES_BLOCK_SIZE,
+		.setkey		= atmel_aes_xts_setkey,
+		.encrypt	= atmel_aes_xts_encrypt,
+		.decrypt	= atmel_aes_xts_decrypt,
+	}
+};
+
 static struct crypto_alg aead_algs[] = {
 {
 	.cra_name		= "authenc(hmac(sha1),cbc(aes))",
@@ -1735,11 +2792,87 @@ static struct crypto_alg aead_algs[] = {
 },
 };
 
-static void atmel_aes_queue_task(unsigned long data)
+static struct crypto_alg aes_gcm_algs[] = {
+{
+	.cra_name		= "gcm(aes)",
+	.cra_driver_name	= "atmel-gcm-aes",
+	.cra_priority		= 3000,
+	.cra_flags		= CRYPTO_ALG_TYPE_AEAD | CRYPTO_ALG_ASYNC,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
+	.cra_alignmask		= 0xf,
+	.cra_type		= &crypto_aead_type,
+	.cra_module		= THIS_MODULE,
+	.cra_init		= atmel_aead_cra_init,
+	.cra_exit		= atmel_aead_cra_exit,
+	.cra_u.aead = {
+		.setkey = atmel_aes_gcm_setkey,
+		.setauthsize = atmel_aes_gcm_setauthsize,
+		.encrypt = atmel_aes_gcm_encrypt,
+		.decrypt = atmel_aes_gcm_decrypt,
+		.geniv = "<built-in>",
+		.ivsize = ATMEL_AES_GCM_IV_SIZE,
+		.maxauthsize = AES_BLOCK_SIZE,
+	}
+},
+{
+	.cra_name		= "rfc4106(gcm(aes))",
+	.cra_driver_name	= "atmel-rfc4106-gcm-aes",
+	.cra_priority		= 3000,
+	.cra_flags		= CRYPTO_ALG_TYPE_AEAD | CRYPTO_ALG_ASYNC,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
+	.cra_alignmask		= 0xf,
+	.cra_type		= &crypto_aead_type,
+	.cra_module		= THIS_MODULE,
+	.cra_init		= atmel_aead_cra_init,
+	.cra_exit		= atmel_aead_cra_exit,
+	.cra_u.aead = {
+		.setkey = atmel_aes_rfc4106_setkey,
+		.setauthsize = atmel_aes_rfc4106_setauthsize,
+		.encrypt = atmel_aes_gcm_encrypt,
+		.decrypt = atmel_aes_gcm_decrypt,
+		.givencrypt = atmel_aes_rfc4106_givencrypt,
+		.geniv = "<built-in>",
+		.ivsize = ATMEL_AES_RFC4106_IV_SIZE,
+		.maxauthsize = AES_BLOCK_SIZE,
+	}
+},
+};
+
+static struct crypto_alg aes_ccm_alg = {
+	.cra_name		= "ccm(aes)",
+	.cra_driver_name	= "atmel-ccm-aes",
+	.cra_priority		= 3000,
+	.cra_flags		= CRYPTO_ALG_TYPE_AEAD | CRYPTO_ALG_ASYNC,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct atmel_aes_ctx),
+	.cra_alignmask		= 0xf,
+	.cra_type		= &crypto_aead_type,
+	.cra_module		= THIS_MODULE,
+	.cra_init		= atmel_aead_cra_init,
+	.cra_exit		= atmel_aead_cra_exit,
+	.cra_u.aead = {
+		.setkey = atmel_aes_gcm_setkey,
+		.setauthsize = atmel_aes_ccm_setauthsize,
+		.encrypt = atmel_aes_ccm_encrypt,
+		.decrypt = atmel_aes_ccm_decrypt,
+		.geniv = "<built-in>",
+		.ivsize = AES_BLOCK_SIZE,
+		.maxauthsize = AES_BLOCK_SIZE,
+	}
+};
+
+static void atmel_aes_do_one(struct atmel_crypto_engine *engine,
+			     struct crypto_async_request *areq)
 {
-	struct atmel_aes_dev *dd = (struct atmel_aes_dev *)data;
+	struct atmel_aes_dev *dd =
+		container_of(engine, struct atmel_aes_dev, engine);
 
-	atmel_aes_handle_queue(dd, NULL);
+	if (crypto_tfm_alg_type(areq->tfm) == CRYPTO_ALG_TYPE_AEAD)
+		atmel_aead_start(dd, aead_request_cast(areq));
+	else
+		atmel_aes_start(dd, ablkcipher_request_cast(areq));
 }
 
 static void atmel_aes_done_task(unsigned long data)
@@ -1747,6 +2880,16 @@ static void atmel_aes_done_task(unsigned long data)
 	struct atmel_aes_dev *dd = (struct atmel_aes_dev *) data;
 	int err;
 
+	if (dd->flags & AES_FLAGS_GCM) {
+		atmel_aes_gcm_dma_done(dd);
+		return;
+	}
+
+	if (dd->flags & AES_FLAGS_CCM) {
+		atmel_aes_ccm_dma_done(dd);
+		return;
+	}
+
 	if (!(dd->flags & AES_FLAGS_DMA)) {
 		atmel_aes_read_n(dd, AES_ODATAR(0), (u32 *) dd->buf_out,
 				dd->bufcnt >> 2);
@@ -1766,8 +2909,10 @@ static void atmel_aes_done_task(unsigned long data)
 
 	if (dd->total && !err) {
 		if (dd->flags & AES_FLAGS_FAST) {
-			dd->in_sg = sg_next(dd->in_sg);
-			dd->out_sg = sg_next(dd->out_sg);
+			dd->in_sg = atmel_aes_sg_skip(dd->in_sg,
+						      dd->nb_in_sg);
+			dd->out_sg = atmel_aes_sg_skip(dd->out_sg,
+						       dd->nb_out_sg);
 			if (!dd->in_sg || !dd->out_sg)
 				err = -EINVAL;
 		}
@@ -1779,7 +2924,6 @@ static void atmel_aes_done_task(unsigned long data)
 
 cpu_end:
 	atmel_aes_finish_req(dd, err);
-	atmel_aes_handle_queue(dd, NULL);
 }
 
 static irqreturn_t atmel_aes_irq(int irq, void *dev_id)
@@ -1790,7 +2934,7 @@ static irqreturn_t atmel_aes_irq(int irq, void *dev_id)
 	reg = atmel_aes_read(aes_dd, AES_ISR);
 	if (reg & atmel_aes_read(aes_dd, AES_IMR)) {
 		atmel_aes_write(aes_dd, AES_IDR, reg);
-		if (AES_FLAGS_BUSY & aes_dd->flags)
+		if (atmel_crypto_engine_busy(&aes_dd->engine))
 			tasklet_schedule(&aes_dd->done_task);
 		else
 			dev_warn(aes_dd->dev, "AES interrupt when no active requests.\n");
@@ -1808,10 +2952,17 @@ static void atmel_aes_unregister_algs(struct atmel_aes_dev *dd)
 		crypto_unregister_alg(&aes_algs[i]);
 	if (dd->caps.has_cfb64)
 		crypto_unregister_alg(&aes_cfb64_alg);
+	if (dd->caps.has_xts)
+		crypto_unregister_alg(&aes_xts_alg);
 	if (dd->caps.has_aead) {
 		for (i = 0; i < ARRAY_SIZE(aead_algs); i++)
 			crypto_unregister_alg(&aead_algs[i]);
 	}
+	if (dd->caps.has_gcm) {
+		for (i = 0; i < ARRAY_SIZE(aes_gcm_algs); i++)
+			crypto_unregister_alg(&aes_gcm_algs[i]);
+	}
+	crypto_unregister_alg(&aes_ccm_alg);
 }
 
 static int atmel_aes_register_algs(struct atmel_aes_dev *dd)
@@ -1830,6 +2981,12 @@ static int atmel_aes_register_algs(struct atmel_aes_dev *dd)
 			goto err_aes_cfb64_alg;
 	}
 
+	if (dd->caps.has_xts) {
+		err = crypto_register_alg(&aes_xts_alg);
+		if (err)
+			goto err_aes_xts_alg;
+	}
+
 	if (dd->caps.has_aead) {
 		for (i = 0; i < ARRAY_SIZE(aead_algs); i++) {
 			err = crypto_register_alg(&aead_algs[i]);
@@ -1838,11 +2995,33 @@ static int atmel_aes_register_algs(struct atmel_aes_dev *dd)
 		}
 	}
 
+	if (dd->caps.has_gcm) {
+		for (i = 0; i < ARRAY_SIZE(aes_gcm_algs); i++) {
+			err = crypto_register_alg(&aes_gcm_algs[i]);
+			if (err)
+				goto err_gcm_alg;
+		}
+	}
+
+	/* CCM only needs the CBC, CTR and ECB modes */
+	err = crypto_register_alg(&aes_ccm_alg);
+	if (err)
+		goto err_ccm_alg;
+
 	return 0;
 
+err_ccm_alg:
+	i = dd->caps.has_gcm ? ARRAY_SIZE(aes_gcm_algs) : 0;
+err_gcm_alg:
+	for (j = 0; j < i; j++)
+		crypto_unregister_alg(&aes_gcm_algs[j]);
+	i = dd->caps.has_aead ? ARRAY_SIZE(aead_algs) : 0;
 err_aead_alg:
 	for (j = 0; j < i; j++)
 		crypto_unregister_alg(&aead_algs[j]);
+	if (dd->caps.has_xts)
+		crypto_unregister_alg(&aes_xts_alg);
+err_aes_xts_alg:
 	crypto_unregister_alg(&aes_cfb64_alg);
 err_aes_cfb64_alg:
 	i = ARRAY_SIZE(aes_algs);
@@ -1853,11 +3032,206 @@ err_aes_algs:
 	return err;
 }
 
+struct atmel_aes_calib_result {
+	struct completion	completion;
+	int			err;
+};
+
+static void atmel_aes_calib_done(struct crypto_async_request *areq, int err)
+{
+	struct atmel_aes_calib_result *res = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	res->err = err;
+	complete(&res->completion);
+}
+
+static int atmel_aes_calib_wait(int err, struct atmel_aes_calib_result *res)
+{
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&res->completion);
+		reinit_completion(&res->completion);
+		err = res->err;
+	}
+
+	return err;
+}
+
+/*
+ * Time the hardware against the software implementation of a mode for
+ * increasing request sizes, and return the size from which the hardware
+ * is faster. Requests shorter than that are then handled in software.
+ */
+static unsigned int atmel_aes_calibrate_mode(struct atmel_aes_dev *dd,
+					     int mode)
+{
+	const char *name = atmel_aes_fallback_info[mode].name;
+	unsigned int keylen = atmel_aes_fallback_info[mode].keylen;
+	struct crypto_ablkcipher *hw;
+	struct crypto_blkcipher *sw;
+	struct ablkcipher_request *req;
+	struct blkcipher_desc desc;
+	struct atmel_aes_calib_result res;
+	struct scatterlist sg;
+	u8 key[2 * AES_KEYSIZE_128];
+	u8 iv[AES_BLOCK_SIZE];
+	unsigned int len, i;
+	s64 t_hw, t_sw;
+	ktime_t start;
+	void *buf;
+	int err;
+
+	hw = crypto_alloc_ablkcipher(atmel_aes_fallback_info[mode].driver_name,
+				     0, 0);
+	if (IS_ERR(hw))
+		return 0;
+
+	sw = crypto_alloc_blkcipher(name, 0,
+				    CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(sw)) {
+		len = 0;
+		goto free_hw;
+	}
+
+	len = 0;
+	buf = kzalloc(ATMEL_AES_CALIB_MAX, GFP_KERNEL);
+	req = ablkcipher_request_alloc(hw, GFP_KERNEL);
+	if (!buf || !req)
+		goto out;
+
+	/* XTS refuses identical data and tweak keys in some implementations */
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i;
+	memset(iv, 0, sizeof(iv));
+
+	if (crypto_ablkcipher_setkey(hw, key, keylen) ||
+	    crypto_blkcipher_setkey(sw, key, keylen))
+		goto out;
+
+	init_completion(&res.completion);
+	ablkcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+					atmel_aes_calib_done, &res);
+	desc.tfm = sw;
+	desc.info = iv;
+	desc.flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	/* The hardware must not forward these to the fallback */
+	dd->fallback_len[mode] = 0;
+
+	for (len = AES_BLOCK_SIZE; len <= ATMEL_AES_CALIB_MAX; len <<= 1) {
+		sg_init_one(&sg, buf, len);
+		ablkcipher_request_set_crypt(req, &sg, &sg, len, iv);
+
+		start = ktime_get();
+		for (i = 0; i < ATMEL_AES_CALIB_LOOPS; i++) {
+			err = atmel_aes_calib_wait(
+				crypto_ablkcipher_encrypt(req), &res);
+			if (err) {
+				len = 0;
+				goto out;
+			}
+		}
+		t_hw = ktime_us_delta(ktime_get(), start);
+
+		start = ktime_get();
+		for (i = 0; i < ATMEL_AES_CALIB_LOOPS; i++)
+			crypto_blkcipher_encrypt_iv(&desc, &sg, &sg, len);
+		t_sw = ktime_us_delta(ktime_get(), start);
+
+		if (t_hw <= t_sw)
+			break;
+	}
+
+	len = min_t(unsigned int, len, ATMEL_AES_CALIB_MAX);
+	dev_dbg(dd->dev, "%s: software below %u bytes\n", name, len);
+
+out:
+	ablkcipher_request_free(req);
+	kfree(buf);
+	crypto_free_blkcipher(sw);
+free_hw:
+	crypto_free_ablkcipher(hw);
+
+	return len;
+}
+
+static void atmel_aes_calibrate(struct work_struct *work)
+{
+	struct atmel_aes_dev *dd = container_of(work, struct atmel_aes_dev,
+						calib_work);
+	int i;
+
+	for (i = 0; i < ATMEL_AES_FB_NR; i++) {
+		if (i == ATMEL_AES_FB_XTS && !dd->caps.has_xts)
+			continue;
+		dd->fallback_len[i] = atmel_aes_calibrate_mode(dd, i);
+	}
+}
+
+static ssize_t atmel_aes_fallback_show(struct device *dev, char *buf,
+				       int mode)
+{
+	struct atmel_aes_dev *dd = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", dd->fallback_len[mode]);
+}
+
+static ssize_t atmel_aes_fallback_store(struct device *dev, const char *buf,
+					size_t len, int mode)
+{
+	struct atmel_aes_dev *dd = dev_get_drvdata(dev);
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	dd->fallback_len[mode] = val;
+
+	return len;
+}
+
+#define ATMEL_AES_FALLBACK_ATTR(_name, _mode)				\
+static ssize_t fallback_##_name##_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	return atmel_aes_fallback_show(dev, buf, _mode);		\
+}									\
+static ssize_t fallback_##_name##_store(struct device *dev,		\
+		struct device_attribute *attr, const char *buf,		\
+		size_t len)						\
+{									\
+	return atmel_aes_fallback_store(dev, buf, len, _mode);		\
+}									\
+static DEVICE_ATTR_RW(fallback_##_name)
+
+ATMEL_AES_FALLBACK_ATTR(ecb, ATMEL_AES_FB_ECB);
+ATMEL_AES_FALLBACK_ATTR(cbc, ATMEL_AES_FB_CBC);
+ATMEL_AES_FALLBACK_ATTR(ctr, ATMEL_AES_FB_CTR);
+ATMEL_AES_FALLBACK_ATTR(xts, ATMEL_AES_FB_XTS);
+
+static struct attribute *atmel_aes_attrs[] = {
+	&dev_attr_fallback_ecb.attr,
+	&dev_attr_fallback_cbc.attr,
+	&dev_attr_fallback_ctr.attr,
+	&dev_attr_fallback_xts.attr,
+	NULL
+};
+
+static const struct attribute_group atmel_aes_attr_group = {
+	.attrs = atmel_aes_attrs,
+};
+
 static void atmel_aes_get_cap(struct atmel_aes_dev *dd)
 {
 	dd->caps.has_dualbuff = 0;
 	dd->caps.has_cfb64 = 0;
 	dd->caps.has_aead = 0;
+	dd->caps.has_gcm = 0;
+	dd->caps.has_xts = 0;
 	dd->caps.max_burst_size = 1;
 
 	/* keep only major version number */
@@ -1866,6 +3240,9 @@ static void atmel_aes_get_cap(struct atmel_aes_dev *dd)
 		dd->caps.has_dualbuff = 1;
 		dd->caps.has_cfb64 = 1;
 		dd->caps.has_aead = 1;
+		/* GCM requests go through the AEAD queue */
+		dd->caps.has_gcm = 1;
+		dd->caps.has_xts = 1;
 		dd->caps.max_burst_size = 4;
 		break;
 	case 0x200:
@@ -1963,14 +3340,9 @@ static int atmel_aes_probe(struct platform_device *pdev)
 	platform_set_drvdata(pdev, aes_dd);
 
 	INIT_LIST_HEAD(&aes_dd->list);
-	spin_lock_init(&aes_dd->lock);
 
 	tasklet_init(&aes_dd->done_task, atmel_aes_done_task,
 					(unsigned long)aes_dd);
-	tasklet_init(&aes_dd->queue_task, atmel_aes_queue_task,
-					(unsigned long)aes_dd);
-
-	crypto_init_queue(&aes_dd->queue, ATMEL_AES_QUEUE_LENGTH);
 
 	aes_dd->irq = -1;
 
@@ -2030,25 +3402,35 @@ static int atmel_aes_probe(struct platform_device *pdev)
 	list_add_tail(&aes_dd->list, &atmel_aes.dev_list);
 	spin_unlock(&atmel_aes.lock);
 
-	if (aes_dd->caps.has_aead) {
-		atomic_set(&aes_dd->aead_configuring, 0);
-		tasklet_init(&aes_dd->aead_task, atmel_aead_queue_task,
-					(unsigned long)aes_dd);
-		crypto_init_queue(&aes_dd->aead_queue,
-					ATMEL_AES_QUEUE_LENGTH * 6);
-	}
+	/* IPsec needs a deeper queue */
+	atmel_crypto_engine_init(&aes_dd->engine, dev,
+				 aes_dd->caps.has_aead ?
+				 ATMEL_AES_QUEUE_LENGTH * 6 :
+				 ATMEL_AES_QUEUE_LENGTH,
+				 atmel_aes_do_one);
 
 	err = atmel_aes_register_algs(aes_dd);
 	if (err)
 		goto err_algs;
 
+	err = sysfs_create_group(&dev->kobj, &atmel_aes_attr_group);
+	if (err)
+		goto err_sysfs;
+
+	/* The algorithms must be usable to compare them with software */
+	INIT_WORK(&aes_dd->calib_work, atmel_aes_calibrate);
+	schedule_work(&aes_dd->calib_work);
+
 	dev_info(dev, "Atmel AES - Using %s, %s for DMA transfers\n",
 			dma_chan_name(aes_dd->dma_lch_in.chan),
 			dma_chan_name(aes_dd->dma_lch_out.chan));
 
 	return 0;
 
+err_sysfs:
+	atmel_aes_unregister_algs(aes_dd);
 err_algs:
+	atmel_crypto_engine_exit(&aes_dd->engine);
 	spin_lock(&atmel_aes.lock);
 	list_del(&aes_dd->list);
 	spin_unlock(&atmel_aes.lock);
@@ -2064,9 +3446,6 @@ clk_err:
 aes_irq_err:
 res_err:
 	tasklet_kill(&aes_dd->done_task);
-	tasklet_kill(&aes_dd->queue_task);
-	if (aes_dd->caps.has_aead)
-		tasklet_kill(&aes_dd->aead_task);
 	kfree(aes_dd);
 	aes_dd = NULL;
 aes_dd_err:
@@ -2082,6 +3461,9 @@ static int atmel_aes_remove(struct platform_device *pdev)
 	aes_dd = platform_get_drvdata(pdev);
 	if (!aes_dd)
 		return -ENODEV;
+	cancel_work_sync(&aes_dd->calib_work);
+	sysfs_remove_group(&pdev->dev.kobj, &atmel_aes_attr_group);
+
 	spin_lock(&atmel_aes.lock);
 	list_del(&aes_dd->list);
 	spin_unlock(&atmel_aes.lock);
@@ -2089,9 +3471,7 @@ static int atmel_aes_remove(struct platform_device *pdev)
 	atmel_aes_unregister_algs(aes_dd);
 
 	tasklet_kill(&aes_dd->done_task);
-	tasklet_kill(&aes_dd->queue_task);
-	if (aes_dd->caps.has_aead)
-		tasklet_kill(&aes_dd->aead_task);
+	atmel_crypto_engine_exit(&aes_dd->engine);
 
 	atmel_aes_dma_cleanup(aes_dd);
 
@@ -0,0 +1,287 @@
+/*
+ * Request queue shared by the Atmel AES, SHA and TDES drivers.
+ *
+ * Each of these IPs processes one request at a time. The engine queues the
+ * requests, hands them to the driver one after the other and starts the
+ * next one straight from the completion of the previous one, before its
+ * completion callback runs, so that the hardware doesn't sit idle waiting
+ * for a tasklet.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include "atmel-crypto-engine.h"
+
+static struct dentry *atmel_crypto_engine_debugfs_root;
+
+/*
+ * Start the queued requests until one of them keeps the hardware busy.
+ * Requests completed synchronously by do_one() are not started again
+ * recursively from atmel_crypto_engine_finalize(): the loop below picks
+ * the next one instead.
+ */
+static void atmel_crypto_engine_pump(struct atmel_crypto_engine *engine,
+				     bool chained)
+{
+	struct crypto_async_request *areq, *backlog;
+	unsigned long flags;
+
+	spin_lock_irqsave(&engine->lock, flags);
+
+	if (engine->running) {
+		spin_unlock_irqrestore(&engine->lock, flags);
+		return;
+	}
+	engine->running = true;
+
+	while (!engine->busy) {
+		backlog = crypto_get_backlog(&engine->queue);
+		areq = crypto_dequeue_request(&engine->queue);
+		if (!areq)
+			break;
+
+		engine->cur = areq;
+		engine->busy = true;
+		engine->stats.started++;
+		if (chained)
+			engine->stats.chained++;
+
+		spin_unlock_irqrestore(&engine->lock, flags);
+
+		if (backlog)
+			backlog->complete(backlog, -EINPROGRESS);
+
+		engine->do_one(engine, areq);
+
+		spin_lock_irqsave(&engine->lock, flags);
+		chained = true;
+	}
+
+	engine->running = false;
+
+	spin_unlock_irqrestore(&engine->lock, flags);
+}
+
+/**
+ * atmel_crypto_engine_enqueue - queue a request
+ * @engine: engine to queue the request on
+ * @areq: request
+ *
+ * The request is started right away if the hardware is idle.
+ *
+ * Return: -EINPROGRESS if the request is queued, -EBUSY if it has been
+ * backlogged or if the queue is full and the request can't be backlogged.
+ */
+int atmel_crypto_engine_enqueue(struct atmel_crypto_engine *engine,
+				struct crypto_async_request *areq)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&engine->lock, flags);
+
+	ret = crypto_enqueue_request(&engine->queue, areq);
+	if (ret == -EINPROGRESS) {
+		engine->stats.enqueued++;
+	} else if (areq->flags & CRYPTO_TFM_REQ_MAY_BACKLOG) {
+		engine->stats.enqueued++;
+		engine->stats.backlogged++;
+	} else {
+		engine->stats.rejected++;
+	}
+
+	if (engine->queue.qlen > engine->stats.max_qlen)
+		engine->stats.max_qlen = engine->queue.qlen;
+
+	spin_unlock_irqrestore(&engine->lock, flags);
+
+	atmel_crypto_engine_pump(engine, false);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_enqueue);
+
+/**
+ * atmel_crypto_engine_finalize - complete the current request
+ * @engine: engine processing the request
+ * @areq: request
+ * @err: completion status
+ *
+ * The next queued request is started before @areq is completed. The driver
+ * must not use the state of @areq once this has been called.
+ */
+void atmel_crypto_engine_finalize(struct atmel_crypto_engine *engine,
+				  struct crypto_async_request *areq, int err)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&engine->lock, flags);
+
+	WARN_ON(engine->cur != areq);
+
+	engine->cur = NULL;
+	engine->busy = false;
+	engine->stats.completed++;
+	if (err)
+		engine->stats.errors++;
+
+	spin_unlock_irqrestore(&engine->lock, flags);
+
+	atmel_crypto_engine_pump(engine, true);
+
+	areq->complete(areq, err);
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_finalize);
+
+/**
+ * atmel_crypto_engine_claim - use the hardware outside of the queue
+ * @engine: engine to claim
+ *
+ * Queued requests are held back until atmel_crypto_engine_release().
+ *
+ * Return: 0 on success, -EBUSY if a request is being processed.
+ */
+int atmel_crypto_engine_claim(struct atmel_crypto_engine *engine)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&engine->lock, flags);
+
+	if (engine->busy) {
+		ret = -EBUSY;
+	} else {
+		engine->busy = true;
+		engine->stats.claimed++;
+	}
+
+	spin_unlock_irqrestore(&engine->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_claim);
+
+/**
+ * atmel_crypto_engine_release - give back a claimed engine
+ * @engine: engine to release
+ *
+ * The queued requests are started again.
+ */
+void atmel_crypto_engine_release(struct atmel_crypto_engine *engine)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&engine->lock, flags);
+	engine->busy = false;
+	spin_unlock_irqrestore(&engine->lock, flags);
+
+	atmel_crypto_engine_pump(engine, true);
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_release);
+
+static int atmel_crypto_engine_stats_show(struct seq_file *m, void *v)
+{
+	struct atmel_crypto_engine *engine = m->private;
+	struct atmel_crypto_engine_stats stats;
+	unsigned int qlen;
+	unsigned long flags;
+
+	spin_lock_irqsave(&engine->lock, flags);
+	stats = engine->stats;
+	qlen = engine->queue.qlen;
+	spin_unlock_irqrestore(&engine->lock, flags);
+
+	seq_printf(m, "queued:     %u\n", qlen);
+	seq_printf(m, "max_queued: %u\n", stats.max_qlen);
+	seq_printf(m, "enqueued:   %lu\n", stats.enqueued);
+	seq_printf(m, "backlogged: %lu\n", stats.backlogged);
+	seq_printf(m, "rejected:   %lu\n", stats.rejected);
+	seq_printf(m, "started:    %lu\n", stats.started);
+	seq_printf(m, "chained:    %lu\n", stats.chained);
+	seq_printf(m, "completed:  %lu\n", stats.completed);
+	seq_printf(m, "errors:     %lu\n", stats.errors);
+	seq_printf(m, "claimed:    %lu\n", stats.claimed);
+
+	return 0;
+}
+
+static int atmel_crypto_engine_stats_open(struct inode *inode,
+					  struct file *file)
+{
+	return single_open(file, atmel_crypto_engine_stats_show,
+			   inode->i_private);
+}
+
+static const struct file_operations atmel_crypto_engine_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= atmel_crypto_engine_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/**
+ * atmel_crypto_engine_init - initialize an engine
+ * @engine: engine to initialize
+ * @dev: device the engine feeds
+ * @max_qlen: queue length, past which requests are backlogged or refused
+ * @do_one: driver handler starting a request
+ */
+void atmel_crypto_engine_init(struct atmel_crypto_engine *engine,
+			      struct device *dev, unsigned int max_qlen,
+			      void (*do_one)(struct atmel_crypto_engine *engine,
+					     struct crypto_async_request *areq))
+{
+	memset(engine, 0, sizeof(*engine));
+
+	engine->dev = dev;
+	engine->do_one = do_one;
+	spin_lock_init(&engine->lock);
+	crypto_init_queue(&engine->queue, max_qlen);
+
+	if (atmel_crypto_engine_debugfs_root)
+		engine->debugfs = debugfs_create_file(dev_name(dev), S_IRUGO,
+					atmel_crypto_engine_debugfs_root,
+					engine,
+					&atmel_crypto_engine_stats_fops);
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_init);
+
+/**
+ * atmel_crypto_engine_exit - release the resources of an engine
+ * @engine: engine to clean up
+ *
+ * The algorithms fed by the engine must have been unregistered.
+ */
+void atmel_crypto_engine_exit(struct atmel_crypto_engine *engine)
+{
+	debugfs_remove(engine->debugfs);
+	WARN_ON(engine->busy || engine->queue.qlen);
+}
+EXPORT_SYMBOL_GPL(atmel_crypto_engine_exit);
+
+static int __init atmel_crypto_engine_module_init(void)
+{
+	atmel_crypto_engine_debugfs_root = debugfs_create_dir("atmel-crypto",
+							      NULL);
+	if (IS_ERR(atmel_crypto_engine_debugfs_root))
+		atmel_crypto_engine_debugfs_root = NULL;
+
+	return 0;
+}
+subsys_initcall(atmel_crypto_engine_module_init);
+
+static void __exit atmel_crypto_engine_module_exit(void)
+{
+	debugfs_remove_recursive(atmel_crypto_engine_debugfs_root);
+}
+module_exit(atmel_crypto_engine_module_exit);
+
+MODULE_DESCRIPTION("Atmel crypto request engine");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,92 @@
+/*
+ * Request queue shared by the Atmel AES, SHA and TDES drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#ifndef __ATMEL_CRYPTO_ENGINE_H__
+#define __ATMEL_CRYPTO_ENGINE_H__
+
+#include <linux/compiler.h>
+#include <linux/crypto.h>
+#include <linux/device.h>
+#include <linux/spinlock.h>
+#include <crypto/algapi.h>
+
+struct dentry;
+struct atmel_crypto_engine;
+
+/**
+ * struct atmel_crypto_engine_stats - request statistics of an engine
+ * @enqueued: requests accepted in the queue, backlogged ones included
+ * @backlogged: requests queued past the queue length
+ * @rejected: requests refused because the queue was full
+ * @started: requests handed to the driver
+ * @chained: requests started back to back, without the engine going idle
+ * @completed: completed requests
+ * @errors: requests completed with an error
+ * @claimed: times the hardware was used outside of the queue
+ * @max_qlen: deepest the queue has been
+ */
+struct atmel_crypto_engine_stats {
+	unsigned long	enqueued;
+	unsigned long	backlogged;
+	unsigned long	rejected;
+	unsigned long	started;
+	unsigned long	chained;
+	unsigned long	completed;
+	unsigned long	errors;
+	unsigned long	claimed;
+	unsigned int	max_qlen;
+};
+
+/**
+ * struct atmel_crypto_engine - hardware request queue
+ * @dev: device the engine feeds
+ * @do_one: start processing a request. atmel_crypto_engine_finalize() must
+ *	    be called exactly once for it, possibly before @do_one returns.
+ * @lock: protects all the fields below
+ * @queue: pending requests
+ * @cur: request being processed
+ * @busy: the hardware is in use, by @cur or by a claim
+ * @running: the dispatch loop is active
+ * @stats: request statistics
+ * @debugfs: statistics file
+ */
+struct atmel_crypto_engine {
+	struct device			*dev;
+	void	(*do_one)(struct atmel_crypto_engine *engine,
+			  struct crypto_async_request *areq);
+
+	spinlock_t			lock;
+	struct crypto_queue		queue;
+	struct crypto_async_request	*cur;
+	bool				busy;
+	bool				running;
+	struct atmel_crypto_engine_stats stats;
+
+	struct dentry			*debugfs;
+};
+
+void atmel_crypto_engine_init(struct atmel_crypto_engine *engine,
+			      struct device *dev, unsigned int max_qlen,
+			      void (*do_one)(struct atmel_crypto_engine *engine,
+					     struct crypto_async_request *areq));
+void atmel_crypto_engine_exit(struct atmel_crypto_engine *engine);
+
+int atmel_crypto_engine_enqueue(struct atmel_crypto_engine *engine,
+				struct crypto_async_request *areq);
+void atmel_crypto_engine_finalize(struct atmel_crypto_engine *engine,
+				  struct crypto_async_request *areq, int err);
+
+int atmel_crypto_engine_claim(struct atmel_crypto_engine *engine);
+void atmel_crypto_engine_release(struct atmel_crypto_engine *engine);
+
+static inline bool atmel_crypto_engine_busy(struct atmel_crypto_engine *engine)
+{
+	return ACCESS_ONCE(engine->busy);
+}
+
+#endif /* __ATMEL_CRYPTO_ENGINE_H__ */
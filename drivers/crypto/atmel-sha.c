@@ -32,6 +32,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/of_device.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
 #include <linux/crypto.h>
 #include <linux/cryptohash.h>
 #include <crypto/scatterwalk.h>
@@ -40,11 +43,11 @@
 #include <crypto/hash.h>
 #include <crypto/internal/hash.h>
 #include <linux/platform_data/crypto-atmel.h>
+#include "atmel-crypto-engine.h"
 #include "atmel-sha-regs.h"
 #include "atmel-sha.h"
 
 /* SHA flags */
-#define SHA_FLAGS_BUSY			BIT(0)
 #define	SHA_FLAGS_FINAL			BIT(1)
 #define SHA_FLAGS_DMA_ACTIVE	BIT(2)
 #define SHA_FLAGS_OUTPUT_READY	BIT(3)
@@ -63,6 +66,8 @@
 #define SHA_FLAGS_ERROR		BIT(23)
 #define SHA_FLAGS_PAD		BIT(24)
 #define SHA_FLAGS_RESTORE	BIT(25)
+#define SHA_FLAGS_HMAC		BIT(26)
+#define SHA_FLAGS_HMAC_OUTER	BIT(27)
 
 #define SHA_OP_UPDATE	1
 #define SHA_OP_FINAL	2
@@ -73,6 +78,31 @@
 
 #define SIZE_IN_WORDS(x)	((x) >> 2)
 
+/* Request sizes tried when calibrating the software fallback threshold */
+#define ATMEL_SHA_CALIB_MAX		4096
+#define ATMEL_SHA_CALIB_LOOPS		32
+
+/* In the order of the SHA_FLAGS_ALGO_MASK bits */
+enum atmel_sha_fallback_algo {
+	ATMEL_SHA_FB_SHA1,
+	ATMEL_SHA_FB_SHA224,
+	ATMEL_SHA_FB_SHA256,
+	ATMEL_SHA_FB_SHA384,
+	ATMEL_SHA_FB_SHA512,
+	ATMEL_SHA_FB_NR
+};
+
+static const struct {
+	const char	*name;
+	const char	*driver_name;
+} atmel_sha_fallback_info[ATMEL_SHA_FB_NR] = {
+	[ATMEL_SHA_FB_SHA1]	= { "sha1", "atmel-sha1" },
+	[ATMEL_SHA_FB_SHA224]	= { "sha224", "atmel-sha224" },
+	[ATMEL_SHA_FB_SHA256]	= { "sha256", "atmel-sha256" },
+	[ATMEL_SHA_FB_SHA384]	= { "sha384", "atmel-sha384" },
+	[ATMEL_SHA_FB_SHA512]	= { "sha512", "atmel-sha512" },
+};
+
 struct atmel_sha_caps {
 	bool	has_dma;
 	bool	has_dualbuff;
@@ -93,8 +123,12 @@ struct atmel_sha_state {
 	u8	buffer[SHA_BUFFER_LEN];
 	u64	digcnt[2];
 	size_t	bufcnt;
+	unsigned long	flags;
 };
 
+/* Request flags that describe the saved hash state */
+#define SHA_FLAGS_STATE_MASK	(SHA_FLAGS_PAD | SHA_FLAGS_HMAC_OUTER)
+
 struct atmel_sha_reqctx {
 	struct atmel_sha_dev	*dd;
 	unsigned long	flags;
@@ -120,6 +154,14 @@ struct atmel_sha_ctx {
 	struct atmel_sha_dev	*dd;
 
 	unsigned long		flags;
+
+	/* software implementation used for short digest() requests */
+	struct crypto_shash	*fallback;
+
+	/* HMAC: states after hashing K ^ ipad and K ^ opad */
+	struct crypto_shash	*base;
+	u8	ipad[SHA512_DIGEST_SIZE] __aligned(sizeof(u32));
+	u8	opad[SHA512_DIGEST_SIZE] __aligned(sizeof(u32));
 };
 
 #define ATMEL_SHA_QUEUE_LENGTH	50
@@ -137,13 +179,11 @@ struct atmel_sha_dev {
 	int					irq;
 	void __iomem		*io_base;
 
-	spinlock_t		lock;
 	int			err;
 	struct tasklet_struct	done_task;
-	struct tasklet_struct	queue_task;
 
 	unsigned long		flags;
-	struct crypto_queue	queue;
+	struct atmel_crypto_engine engine;
 	struct ahash_request	*req;
 
 	struct atmel_sha_dma	dma_lch_in;
@@ -151,6 +191,10 @@ struct atmel_sha_dev {
 	struct atmel_sha_caps	caps;
 
 	u32	hw_version;
+
+	/* digest() requests shorter than this go to the software fallback */
+	unsigned int		fallback_len[ATMEL_SHA_FB_NR];
+	struct work_struct	calib_work;
 };
 
 struct atmel_sha_drv {
@@ -330,6 +374,13 @@ static int atmel_sha_init(struct ahash_request *req)
 	ctx->digcnt[1] = 0;
 	ctx->buflen = SHA_BUFFER_LEN;
 
+	if (tctx->flags & SHA_FLAGS_HMAC) {
+		/* Resume from H(K ^ ipad), one block already hashed */
+		memcpy(ctx->digest, tctx->ipad, SHA512_DIGEST_SIZE);
+		ctx->digcnt[0] = ctx->block_size;
+		ctx->flags |= SHA_FLAGS_HMAC | SHA_FLAGS_RESTORE;
+	}
+
 	return 0;
 }
 
@@ -474,10 +525,24 @@ static int atmel_sha_xmit_pdc(struct atmel_sha_dev *dd, dma_addr_t dma_addr1,
 	return -EINPROGRESS;
 }
 
+static void atmel_sha_done_task(unsigned long data);
+
 static void atmel_sha_dma_callback(void *data)
 {
 	struct atmel_sha_dev *dd = data;
 
+	/*
+	 * The last blocks are usually hashed by the time the DMA controller
+	 * calls back: go on from here, which reads the digest and starts the
+	 * next queued request, rather than through one more interrupt and
+	 * tasklet round trip per request.
+	 */
+	if (atmel_sha_read(dd, SHA_ISR) & SHA_INT_DATARDY) {
+		dd->flags |= SHA_FLAGS_OUTPUT_READY | SHA_FLAGS_DMA_READY;
+		atmel_sha_done_task((unsigned long)dd);
+		return;
+	}
+
 	/* dma_lch_in - completed - wait DATRDY */
 	atmel_sha_write(dd, SHA_IER, SHA_INT_DATARDY);
 }
@@ -834,6 +899,34 @@ static int atmel_sha_finish(struct ahash_request *req)
 	return err;
 }
 
+/*
+ * The inner hash is done: compute H(K ^ opad || inner digest) starting from
+ * the precomputed opad state. The single block left is short enough to be
+ * handled by the CPU path.
+ */
+static int atmel_sha_hmac_outer(struct ahash_request *req)
+{
+	struct crypto_ahash *tfm = crypto_ahash_reqtfm(req);
+	struct atmel_sha_ctx *tctx = crypto_ahash_ctx(tfm);
+	struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
+	struct atmel_sha_dev *dd = ctx->dd;
+	unsigned int ds = crypto_ahash_digestsize(tfm);
+
+	memcpy(ctx->buffer, ctx->digest, ds);
+	ctx->bufcnt = ds;
+
+	memcpy(ctx->digest, tctx->opad, SHA512_DIGEST_SIZE);
+	ctx->digcnt[0] = ctx->block_size;
+	ctx->digcnt[1] = 0;
+	ctx->flags &= ~SHA_FLAGS_PAD;
+	ctx->flags |= SHA_FLAGS_HMAC_OUTER | SHA_FLAGS_RESTORE;
+
+	dd->flags &= ~(SHA_FLAGS_FINAL | SHA_FLAGS_CPU |
+			SHA_FLAGS_DMA_READY | SHA_FLAGS_OUTPUT_READY);
+
+	return atmel_sha_final_req(dd);
+}
+
 static void atmel_sha_finish_req(struct ahash_request *req, int err)
 {
 	struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
@@ -841,23 +934,32 @@ static void atmel_sha_finish_req(struct ahash_request *req, int err)
 
 	if (!err) {
 		atmel_sha_copy_hash(req);
-		if (SHA_FLAGS_FINAL & dd->flags)
+		if ((SHA_FLAGS_FINAL & dd->flags) &&
+		    (ctx->flags & (SHA_FLAGS_HMAC | SHA_FLAGS_HMAC_OUTER)) ==
+		    SHA_FLAGS_HMAC) {
+			err = atmel_sha_hmac_outer(req);
+			if (err == -EINPROGRESS)
+				return;
+		} else if (SHA_FLAGS_FINAL & dd->flags) {
 			err = atmel_sha_finish(req);
-	} else {
-		ctx->flags |= SHA_FLAGS_ERROR;
+		}
 	}
 
+	if (err)
+		ctx->flags |= SHA_FLAGS_ERROR;
+
 	/* atomic operation is not needed here */
-	dd->flags &= ~(SHA_FLAGS_BUSY | SHA_FLAGS_FINAL | SHA_FLAGS_CPU |
+	dd->flags &= ~(SHA_FLAGS_FINAL | SHA_FLAGS_CPU |
 			SHA_FLAGS_DMA_READY | SHA_FLAGS_OUTPUT_READY);
 
-	clk_disable_unprepare(dd->iclk);
-
-	if (req->base.complete)
-		req->base.complete(&req->base, err);
+	/*
+	 * The next queued request is started, and enables the clock again,
+	 * from the finalization: only gate the clock afterwards so that it
+	 * stays on while requests are processed back to back.
+	 */
+	atmel_crypto_engine_finalize(&dd->engine, &req->base, err);
 
-	/* handle new request */
-	tasklet_schedule(&dd->queue_task);
+	clk_disable_unprepare(dd->iclk);
 }
 
 static int atmel_sha_hw_init(struct atmel_sha_dev *dd)
@@ -890,37 +992,15 @@ static void atmel_sha_hw_version_init(struct atmel_sha_dev *dd)
 	clk_disable_unprepare(dd->iclk);
 }
 
-static int atmel_sha_handle_queue(struct atmel_sha_dev *dd,
-				  struct ahash_request *req)
+static void atmel_sha_do_one(struct atmel_crypto_engine *engine,
+			     struct crypto_async_request *async_req)
 {
-	struct crypto_async_request *async_req, *backlog;
+	struct atmel_sha_dev *dd =
+		container_of(engine, struct atmel_sha_dev, engine);
+	struct ahash_request *req = ahash_request_cast(async_req);
 	struct atmel_sha_reqctx *ctx;
-	unsigned long flags;
-	int err = 0, ret = 0;
-
-	spin_lock_irqsave(&dd->lock, flags);
-	if (req)
-		ret = ahash_enqueue_request(&dd->queue, req);
-
-	if (SHA_FLAGS_BUSY & dd->flags) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
-	}
-
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->queue);
-	if (async_req)
-		dd->flags |= SHA_FLAGS_BUSY;
-
-	spin_unlock_irqrestore(&dd->lock, flags);
-
-	if (!async_req)
-		return ret;
-
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
+	int err;
 
-	req = ahash_request_cast(async_req);
 	dd->req = req;
 	ctx = ahash_request_ctx(req);
 
@@ -947,8 +1027,6 @@ err1:
 		atmel_sha_finish_req(req, err);
 
 	dev_dbg(dd->dev, "exit, err: %d\n", err);
-
-	return ret;
 }
 
 static int atmel_sha_enqueue(struct ahash_request *req, unsigned int op)
@@ -959,7 +1037,7 @@ static int atmel_sha_enqueue(struct ahash_request *req, unsigned int op)
 
 	ctx->op = op;
 
-	return atmel_sha_handle_queue(dd, req);
+	return atmel_crypto_engine_enqueue(&dd->engine, &req->base);
 }
 
 static int atmel_sha_update(struct ahash_request *req)
@@ -987,37 +1065,18 @@ static int atmel_sha_update(struct ahash_request *req)
 static int atmel_sha_final(struct ahash_request *req)
 {
 	struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
-	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
-	struct atmel_sha_dev *dd = tctx->dd;
-
-	int err = 0;
 
 	ctx->flags |= SHA_FLAGS_FINUP;
 
 	if (ctx->flags & SHA_FLAGS_ERROR)
 		return 0; /* uncompleted hash is not needed */
 
-	if (ctx->bufcnt) {
+	/* flush the buffer or add padding */
+	if (ctx->bufcnt || !(ctx->flags & SHA_FLAGS_PAD))
 		return atmel_sha_enqueue(req, SHA_OP_FINAL);
-	} else if (!(ctx->flags & SHA_FLAGS_PAD)) { /* add padding */
-		err = atmel_sha_hw_init(dd);
-		if (err)
-			goto err1;
 
-		dd->req = req;
-		dd->flags |= SHA_FLAGS_BUSY;
-		err = atmel_sha_final_req(dd);
-	} else {
-		/* copy ready hash (+ finalize hmac) */
-		return atmel_sha_finish(req);
-	}
-
-err1:
-	if (err != -EINPROGRESS)
-		/* done_task will not finish it, so do it here */
-		atmel_sha_finish_req(req, err);
-
-	return err;
+	/* copy ready hash (+ finalize hmac) */
+	return atmel_sha_finish(req);
 }
 
 static int atmel_sha_finup(struct ahash_request *req)
@@ -1040,12 +1099,48 @@ static int atmel_sha_finup(struct ahash_request *req)
 	return err1 ?: err2;
 }
 
+/*
+ * For short one-shot requests, the DMA and interrupt round trip costs more
+ * than hashing on the CPU: run them synchronously in software.
+ */
+static int atmel_sha_digest_fallback(struct ahash_request *req)
+{
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
+	SHASH_DESC_ON_STACK(desc, tctx->fallback);
+
+	desc->tfm = tctx->fallback;
+	desc->flags = req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	return shash_ahash_digest(req, desc);
+}
+
 static int atmel_sha_digest(struct ahash_request *req)
 {
-	return atmel_sha_init(req) ?: atmel_sha_finup(req);
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
+	struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
+	unsigned int algo;
+	int err;
+
+	err = atmel_sha_init(req);
+	if (err)
+		return err;
+
+	algo = ilog2((ctx->flags & SHA_FLAGS_ALGO_MASK) / SHA_FLAGS_SHA1);
+	if (tctx->fallback &&
+	    req->nbytes < ACCESS_ONCE(ctx->dd->fallback_len[algo]))
+		return atmel_sha_digest_fallback(req);
+
+	return atmel_sha_finup(req);
 }
 
 
+/*
+ * ctx->digest always holds the intermediate digest registers as read back
+ * when the last hardware pass of this request completed, so exporting is a
+ * plain copy. Importing resumes that state on the engine through UIHV the
+ * next time data is submitted, which is why it needs has_uihv once some
+ * data has been hashed.
+ */
 static int atmel_sha_export(struct ahash_request *req, void *out)
 {
 	const struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
@@ -1056,6 +1151,7 @@ static int atmel_sha_export(struct ahash_request *req, void *out)
 	state->bufcnt = ctx->bufcnt;
 	state->digcnt[0] = ctx->digcnt[0];
 	state->digcnt[1] = ctx->digcnt[1];
+	state->flags = ctx->flags & SHA_FLAGS_STATE_MASK;
 	return 0;
 }
 
@@ -1063,24 +1159,173 @@ static int atmel_sha_import(struct ahash_request *req, const void *in)
 {
 	struct atmel_sha_reqctx *ctx = ahash_request_ctx(req);
 	const struct atmel_sha_state *state = in;
+	int err;
+
+	if (state->bufcnt > SHA_BUFFER_LEN)
+		return -EINVAL;
+
+	/* Set up the device, algorithm and block size as init() would */
+	err = atmel_sha_init(req);
+	if (err)
+		return err;
+
+	if ((state->digcnt[0] || state->digcnt[1]) &&
+	    !ctx->dd->caps.has_uihv)
+		return -EOPNOTSUPP;
 
 	memcpy(ctx->digest, state->digest, SHA512_DIGEST_SIZE);
 	memcpy(ctx->buffer, state->buffer, state->bufcnt);
 	ctx->bufcnt = state->bufcnt;
 	ctx->digcnt[0] = state->digcnt[0];
 	ctx->digcnt[1] = state->digcnt[1];
+	ctx->flags &= ~SHA_FLAGS_STATE_MASK;
+	ctx->flags |= state->flags & SHA_FLAGS_STATE_MASK;
+	if (ctx->digcnt[0] || ctx->digcnt[1])
+		ctx->flags |= SHA_FLAGS_RESTORE;
 	return 0;
 }
 
 static int atmel_sha_cra_init(struct crypto_tfm *tfm)
 {
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
 	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
 				 sizeof(struct atmel_sha_reqctx) +
 				 SHA_BUFFER_LEN + SHA512_BLOCK_SIZE);
 
+	/* Without a software implementation, everything goes to hardware */
+	tctx->fallback = crypto_alloc_shash(crypto_tfm_alg_name(tfm), 0,
+					    CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(tctx->fallback))
+		tctx->fallback = NULL;
+
+	return 0;
+}
+
+static void atmel_sha_cra_exit(struct crypto_tfm *tfm)
+{
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
+	if (tctx->fallback)
+		crypto_free_shash(tctx->fallback);
+}
+
+static int atmel_sha_hmac_cra_init(struct crypto_tfm *tfm)
+{
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+	const char *name = crypto_tfm_alg_name(tfm);
+	char base[CRYPTO_MAX_ALG_NAME];
+
+	/* "hmac(shaN)" -> "shaN", only used to precompute the pads */
+	strlcpy(base, name + 5, min_t(size_t, strlen(name) - 5, sizeof(base)));
+
+	tctx->base = crypto_alloc_shash(base, 0, 0);
+	if (IS_ERR(tctx->base)) {
+		pr_err("atmel-sha: could not allocate %s\n", base);
+		return PTR_ERR(tctx->base);
+	}
+
+	tctx->flags |= SHA_FLAGS_HMAC;
+
+	return atmel_sha_cra_init(tfm);
+}
+
+static void atmel_sha_hmac_cra_exit(struct crypto_tfm *tfm)
+{
+	struct atmel_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_shash(tctx->base);
+	atmel_sha_cra_exit(tfm);
+}
+
+/*
+ * Hash one pad block in software and store the resulting intermediate
+ * state the way the digest registers hold it, so it can be loaded into
+ * the hardware through UIHV.
+ */
+static int atmel_sha_hmac_pad_state(struct shash_desc *desc, const u8 *pad,
+				    u8 *digest)
+{
+	unsigned int bs = crypto_shash_blocksize(desc->tfm);
+	union {
+		struct sha1_state	sha1;
+		struct sha256_state	sha256;
+		struct sha512_state	sha512;
+	} state;
+	__be32 *d32 = (__be32 *)digest;
+	__be64 *d64 = (__be64 *)digest;
+	int err, i;
+
+	err = crypto_shash_init(desc) ?:
+	      crypto_shash_update(desc, pad, bs) ?:
+	      crypto_shash_export(desc, &state);
+	if (err)
+		return err;
+
+	switch (crypto_shash_digestsize(desc->tfm)) {
+	case SHA1_DIGEST_SIZE:
+		for (i = 0; i < ARRAY_SIZE(state.sha1.state); i++)
+			d32[i] = cpu_to_be32(state.sha1.state[i]);
+		break;
+	case SHA224_DIGEST_SIZE:
+	case SHA256_DIGEST_SIZE:
+		for (i = 0; i < ARRAY_SIZE(state.sha256.state); i++)
+			d32[i] = cpu_to_be32(state.sha256.state[i]);
+		break;
+	default:
+		for (i = 0; i < ARRAY_SIZE(state.sha512.state); i++)
+			d64[i] = cpu_to_be64(state.sha512.state[i]);
+		break;
+	}
+
 	return 0;
 }
 
+static int atmel_sha_hmac_setkey(struct crypto_ahash *tfm, const u8 *key,
+				 unsigned int keylen)
+{
+	struct atmel_sha_ctx *tctx = crypto_ahash_ctx(tfm);
+	unsigned int bs = crypto_shash_blocksize(tctx->base);
+	u8 pad[SHA512_BLOCK_SIZE];
+	unsigned int i;
+	int err;
+	SHASH_DESC_ON_STACK(desc, tctx->base);
+
+	if (tctx->fallback) {
+		err = crypto_shash_setkey(tctx->fallback, key, keylen);
+		if (err)
+			return err;
+	}
+
+	desc->tfm = tctx->base;
+	desc->flags = crypto_ahash_get_flags(tfm) & CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	if (keylen > bs) {
+		err = crypto_shash_digest(desc, key, keylen, pad);
+		if (err)
+			return err;
+		keylen = crypto_shash_digestsize(tctx->base);
+	} else {
+		memcpy(pad, key, keylen);
+	}
+	memset(pad + keylen, 0, bs - keylen);
+
+	for (i = 0; i < bs; i++)
+		pad[i] ^= 0x36;
+	err = atmel_sha_hmac_pad_state(desc, pad, tctx->ipad);
+	if (err)
+		goto out;
+
+	for (i = 0; i < bs; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	err = atmel_sha_hmac_pad_state(desc, pad, tctx->opad);
+
+out:
+	memzero_explicit(pad, sizeof(pad));
+
+	return err;
+}
+
 static struct atmel_sha_dev *atmel_hmac_find_dev(void)
 {
 	struct atmel_sha_dev *tmp, *dd = NULL;
@@ -1182,7 +1427,6 @@ static void atmel_hmac_set_uiv(struct atmel_sha_dev *dd, u32 *uiv,
 int atmel_hmac_write_key(const u8 *key, size_t keylen, unsigned long hmac_type)
 {
 	struct atmel_sha_dev *dd;
-	unsigned long flags;
 	u32 valcr = 0, valmr = 0;
 	int err;
 
@@ -1235,11 +1479,16 @@ int atmel_hmac_write_key(const u8 *key, size_t keylen, unsigned long hmac_type)
 		opad[i] = 0x5c;
 	}
 
-	spin_lock_irqsave(&dd->lock, flags);
-	dd->flags |= SHA_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
+	/* released by atmel_hmac_check_icv() or atmel_hmac_read_icv() */
+	err = atmel_crypto_engine_claim(&dd->engine);
+	if (err)
+		return err;
 
-	atmel_sha_hw_init(dd);
+	err = atmel_sha_hw_init(dd);
+	if (err) {
+		atmel_crypto_engine_release(&dd->engine);
+		return err;
+	}
 
 	/* set ipad and get user initial hash value 1 */
 	valmr |= SHA_MR_MODE_AUTO;
@@ -1314,7 +1563,6 @@ EXPORT_SYMBOL(atmel_hmac_write_esp);
 int atmel_hmac_check_icv(u32 *hash, u32 cnt)
 {
 	struct atmel_sha_dev *dd;
-	unsigned long flags;
 	u32 reg = 0;
 	int rc = 0;
 
@@ -1330,10 +1578,8 @@ int atmel_hmac_check_icv(u32 *hash, u32 cnt)
 	if (!(reg & SHA_ISR_CHKST))
 		rc = -EINVAL;
 
-	spin_lock_irqsave(&dd->lock, flags);
-	dd->flags &= ~SHA_FLAGS_BUSY;
 	clk_disable_unprepare(dd->iclk);
-	spin_unlock_irqrestore(&dd->lock, flags);
+	atmel_crypto_engine_release(&dd->engine);
 
 	return rc;
 }
@@ -1342,7 +1588,6 @@ EXPORT_SYMBOL(atmel_hmac_check_icv);
 int atmel_hmac_read_icv(u32 *hash, u32 cnt)
 {
 	struct atmel_sha_dev *dd;
-	unsigned long flags;
 	int rc;
 	u32 reg = 0;
 
@@ -1353,10 +1598,8 @@ int atmel_hmac_read_icv(u32 *hash, u32 cnt)
 	rc = atmel_hmac_check_isr(dd, SHA_INT_DATARDY, &reg);
 	atmel_hmac_read_output(dd, hash, cnt);
 
-	spin_lock_irqsave(&dd->lock, flags);
-	dd->flags &= ~SHA_FLAGS_BUSY;
 	clk_disable_unprepare(dd->iclk);
-	spin_unlock_irqrestore(&dd->lock, flags);
+	atmel_crypto_engine_release(&dd->engine);
 
 	return rc;
 }
@@ -1384,6 +1627,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 			.cra_alignmask		= 0,
 			.cra_module		= THIS_MODULE,
 			.cra_init		= atmel_sha_cra_init,
+			.cra_exit		= atmel_sha_cra_exit,
 		}
 	}
 },
@@ -1408,6 +1652,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 			.cra_alignmask		= 0,
 			.cra_module		= THIS_MODULE,
 			.cra_init		= atmel_sha_cra_init,
+			.cra_exit		= atmel_sha_cra_exit,
 		}
 	}
 },
@@ -1434,6 +1679,7 @@ static struct ahash_alg sha_224_alg = {
 			.cra_alignmask		= 0,
 			.cra_module		= THIS_MODULE,
 			.cra_init		= atmel_sha_cra_init,
+			.cra_exit		= atmel_sha_cra_exit,
 		}
 	}
 };
@@ -1460,6 +1706,7 @@ static struct ahash_alg sha_384_512_algs[] = {
 			.cra_alignmask		= 0x3,
 			.cra_module		= THIS_MODULE,
 			.cra_init		= atmel_sha_cra_init,
+			.cra_exit		= atmel_sha_cra_exit,
 		}
 	}
 },
@@ -1484,17 +1731,148 @@ static struct ahash_alg sha_384_512_algs[] = {
 			.cra_alignmask		= 0x3,
 			.cra_module		= THIS_MODULE,
 			.cra_init		= atmel_sha_cra_init,
+			.cra_exit		= atmel_sha_cra_exit,
 		}
 	}
 },
 };
 
-static void atmel_sha_queue_task(unsigned long data)
+static struct ahash_alg hmac_1_256_algs[] = {
 {
-	struct atmel_sha_dev *dd = (struct atmel_sha_dev *)data;
+	.init		= atmel_sha_init,
+	.update		= atmel_sha_update,
+	.final		= atmel_sha_final,
+	.finup		= atmel_sha_finup,
+	.digest		= atmel_sha_digest,
+	.export		= atmel_sha_export,
+	.import		= atmel_sha_import,
+	.setkey		= atmel_sha_hmac_setkey,
+	.halg = {
+		.digestsize	= SHA1_DIGEST_SIZE,
+		.statesize	= sizeof(struct atmel_sha_state),
+		.base	= {
+			.cra_name		= "hmac(sha1)",
+			.cra_driver_name	= "atmel-hmac-sha1",
+			.cra_priority		= 100,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= SHA1_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct atmel_sha_ctx),
+			.cra_alignmask		= 0,
+			.cra_module		= THIS_MODULE,
+			.cra_init		= atmel_sha_hmac_cra_init,
+			.cra_exit		= atmel_sha_hmac_cra_exit,
+		}
+	}
+},
+{
+	.init		= atmel_sha_init,
+	.update		= atmel_sha_update,
+	.final		= atmel_sha_final,
+	.finup		= atmel_sha_finup,
+	.digest		= atmel_sha_digest,
+	.export		= atmel_sha_export,
+	.import		= atmel_sha_import,
+	.setkey		= atmel_sha_hmac_setkey,
+	.halg = {
+		.digestsize	= SHA256_DIGEST_SIZE,
+		.statesize	= sizeof(struct atmel_sha_state),
+		.base	= {
+			.cra_name		= "hmac(sha256)",
+			.cra_driver_name	= "atmel-hmac-sha256",
+			.cra_priority		= 100,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= SHA256_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct atmel_sha_ctx),
+			.cra_alignmask		= 0,
+			.cra_module		= THIS_MODULE,
+			.cra_init		= atmel_sha_hmac_cra_init,
+			.cra_exit		= atmel_sha_hmac_cra_exit,
+		}
+	}
+},
+};
 
-	atmel_sha_handle_queue(dd, NULL);
-}
+static struct ahash_alg hmac_224_alg = {
+	.init		= atmel_sha_init,
+	.update		= atmel_sha_update,
+	.final		= atmel_sha_final,
+	.finup		= atmel_sha_finup,
+	.digest		= atmel_sha_digest,
+	.export		= atmel_sha_export,
+	.import		= atmel_sha_import,
+	.setkey		= atmel_sha_hmac_setkey,
+	.halg = {
+		.digestsize	= SHA224_DIGEST_SIZE,
+		.statesize	= sizeof(struct atmel_sha_state),
+		.base	= {
+			.cra_name		= "hmac(sha224)",
+			.cra_driver_name	= "atmel-hmac-sha224",
+			.cra_priority		= 100,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= SHA224_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct atmel_sha_ctx),
+			.cra_alignmask		= 0,
+			.cra_module		= THIS_MODULE,
+			.cra_init		= atmel_sha_hmac_cra_init,
+			.cra_exit		= atmel_sha_hmac_cra_exit,
+		}
+	}
+};
+
+static struct ahash_alg hmac_384_512_algs[] = {
+{
+	.init		= atmel_sha_init,
+	.update		= atmel_sha_update,
+	.final		= atmel_sha_final,
+	.finup		= atmel_sha_finup,
+	.digest		= atmel_sha_digest,
+	.export		= atmel_sha_export,
+	.import		= atmel_sha_import,
+	.setkey		= atmel_sha_hmac_setkey,
+	.halg = {
+		.digestsize	= SHA384_DIGEST_SIZE,
+		.statesize	= sizeof(struct atmel_sha_state),
+		.base	= {
+			.cra_name		= "hmac(sha384)",
+			.cra_driver_name	= "atmel-hmac-sha384",
+			.cra_priority		= 100,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= SHA384_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct atmel_sha_ctx),
+			.cra_alignmask		= 0x3,
+			.cra_module		= THIS_MODULE,
+			.cra_init		= atmel_sha_hmac_cra_init,
+			.cra_exit		= atmel_sha_hmac_cra_exit,
+		}
+	}
+},
+{
+	.init		= atmel_sha_init,
+	.update		= atmel_sha_update,
+	.final		= atmel_sha_final,
+	.finup		= atmel_sha_finup,
+	.digest		= atmel_sha_digest,
+	.export		= atmel_sha_export,
+	.import		= atmel_sha_import,
+	.setkey		= atmel_sha_hmac_setkey,
+	.halg = {
+		.digestsize	= SHA512_DIGEST_SIZE,
+		.statesize	= sizeof(struct atmel_sha_state),
+		.base	= {
+			.cra_name		= "hmac(sha512)",
+			.cra_driver_name	= "atmel-hmac-sha512",
+			.cra_priority		= 100,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= SHA512_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct atmel_sha_ctx),
+			.cra_alignmask		= 0x3,
+			.cra_module		= THIS_MODULE,
+			.cra_init		= atmel_sha_hmac_cra_init,
+			.cra_exit		= atmel_sha_hmac_cra_exit,
+		}
+	}
+},
+};
 
 static void atmel_sha_done_task(unsigned long data)
 {
@@ -1539,7 +1917,7 @@ static irqreturn_t atmel_sha_irq(int irq, void *dev_id)
 	reg = atmel_sha_read(sha_dd, SHA_ISR);
 	if (reg & atmel_sha_read(sha_dd, SHA_IMR)) {
 		atmel_sha_write(sha_dd, SHA_IDR, reg);
-		if (SHA_FLAGS_BUSY & sha_dd->flags) {
+		if (atmel_crypto_engine_busy(&sha_dd->engine)) {
 			sha_dd->flags |= SHA_FLAGS_OUTPUT_READY;
 			if (!(SHA_FLAGS_CPU & sha_dd->flags))
 				sha_dd->flags |= SHA_FLAGS_DMA_READY;
@@ -1567,6 +1945,57 @@ static void atmel_sha_unregister_algs(struct atmel_sha_dev *dd)
 		for (i = 0; i < ARRAY_SIZE(sha_384_512_algs); i++)
 			crypto_unregister_ahash(&sha_384_512_algs[i]);
 	}
+
+	if (dd->caps.has_uihv) {
+		for (i = 0; i < ARRAY_SIZE(hmac_1_256_algs); i++)
+			crypto_unregister_ahash(&hmac_1_256_algs[i]);
+		if (dd->caps.has_sha224)
+			crypto_unregister_ahash(&hmac_224_alg);
+		if (dd->caps.has_sha_384_512) {
+			for (i = 0; i < ARRAY_SIZE(hmac_384_512_algs); i++)
+				crypto_unregister_ahash(&hmac_384_512_algs[i]);
+		}
+	}
+}
+
+static int atmel_sha_register_hmac_algs(struct atmel_sha_dev *dd)
+{
+	int err, i, j;
+
+	for (i = 0; i < ARRAY_SIZE(hmac_1_256_algs); i++) {
+		err = crypto_register_ahash(&hmac_1_256_algs[i]);
+		if (err)
+			goto err_hmac_1_256_algs;
+	}
+
+	if (dd->caps.has_sha224) {
+		err = crypto_register_ahash(&hmac_224_alg);
+		if (err)
+			goto err_hmac_224_alg;
+	}
+
+	if (dd->caps.has_sha_384_512) {
+		for (i = 0; i < ARRAY_SIZE(hmac_384_512_algs); i++) {
+			err = crypto_register_ahash(&hmac_384_512_algs[i]);
+			if (err)
+				goto err_hmac_384_512_algs;
+		}
+	}
+
+	return 0;
+
+err_hmac_384_512_algs:
+	for (j = 0; j < i; j++)
+		crypto_unregister_ahash(&hmac_384_512_algs[j]);
+	if (dd->caps.has_sha224)
+		crypto_unregister_ahash(&hmac_224_alg);
+err_hmac_224_alg:
+	i = ARRAY_SIZE(hmac_1_256_algs);
+err_hmac_1_256_algs:
+	for (j = 0; j < i; j++)
+		crypto_unregister_ahash(&hmac_1_256_algs[j]);
+
+	return err;
 }
 
 static int atmel_sha_register_algs(struct atmel_sha_dev *dd)
@@ -1593,6 +2022,16 @@ static int atmel_sha_register_algs(struct atmel_sha_dev *dd)
 		}
 	}
 
+	/* HMAC needs to load the precomputed pad states through UIHV */
+	if (dd->caps.has_uihv) {
+		err = atmel_sha_register_hmac_algs(dd);
+		if (err) {
+			i = dd->caps.has_sha_384_512 ?
+				ARRAY_SIZE(sha_384_512_algs) : 0;
+			goto err_sha_384_512_algs;
+		}
+	}
+
 	return 0;
 
 err_sha_384_512_algs:
@@ -1656,6 +2095,197 @@ static void atmel_sha_dma_cleanup(struct atmel_sha_dev *dd)
 	dma_release_channel(dd->dma_lch_in.chan);
 }
 
+struct atmel_sha_calib_result {
+	struct completion	completion;
+	int			err;
+};
+
+static void atmel_sha_calib_done(struct crypto_async_request *areq, int err)
+{
+	struct atmel_sha_calib_result *res = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	res->err = err;
+	complete(&res->completion);
+}
+
+static int atmel_sha_calib_wait(int err, struct atmel_sha_calib_result *res)
+{
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&res->completion);
+		reinit_completion(&res->completion);
+		err = res->err;
+	}
+
+	return err;
+}
+
+static s64 atmel_sha_calib_time_sw(struct crypto_shash *sw, const u8 *buf,
+				   unsigned int len, u8 *out)
+{
+	SHASH_DESC_ON_STACK(desc, sw);
+	ktime_t start;
+	int i;
+
+	desc->tfm = sw;
+	desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	start = ktime_get();
+	for (i = 0; i < ATMEL_SHA_CALIB_LOOPS; i++)
+		crypto_shash_digest(desc, buf, len, out);
+
+	return ktime_us_delta(ktime_get(), start);
+}
+
+/*
+ * Time the hardware against the software implementation of an algorithm
+ * for increasing request sizes, and return the size from which the
+ * hardware is faster. Shorter digest() requests are then done in software.
+ */
+static unsigned int atmel_sha_calibrate_algo(struct atmel_sha_dev *dd,
+					     int algo)
+{
+	const char *name = atmel_sha_fallback_info[algo].name;
+	struct crypto_ahash *hw;
+	struct crypto_shash *sw;
+	struct ahash_request *req;
+	struct atmel_sha_calib_result res;
+	struct scatterlist sg;
+	u8 out[SHA512_DIGEST_SIZE];
+	unsigned int len = 0, i;
+	s64 t_hw, t_sw;
+	ktime_t start;
+	void *buf;
+	int err;
+
+	hw = crypto_alloc_ahash(atmel_sha_fallback_info[algo].driver_name, 0, 0);
+	if (IS_ERR(hw))
+		return 0;
+
+	sw = crypto_alloc_shash(name, 0, CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(sw))
+		goto free_hw;
+
+	buf = kzalloc(ATMEL_SHA_CALIB_MAX, GFP_KERNEL);
+	req = ahash_request_alloc(hw, GFP_KERNEL);
+	if (!buf || !req)
+		goto out;
+
+	init_completion(&res.completion);
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				   atmel_sha_calib_done, &res);
+
+	/* The hardware must not forward these to the fallback */
+	dd->fallback_len[algo] = 0;
+
+	for (len = 16; len <= ATMEL_SHA_CALIB_MAX; len <<= 1) {
+		sg_init_one(&sg, buf, len);
+		ahash_request_set_crypt(req, &sg, out, len);
+
+		start = ktime_get();
+		for (i = 0; i < ATMEL_SHA_CALIB_LOOPS; i++) {
+			err = atmel_sha_calib_wait(crypto_ahash_digest(req),
+						   &res);
+			if (err) {
+				len = 0;
+				goto out;
+			}
+		}
+		t_hw = ktime_us_delta(ktime_get(), start);
+
+		t_sw = atmel_sha_calib_time_sw(sw, buf, len, out);
+
+		if (t_hw <= t_sw)
+			break;
+	}
+
+	len = min_t(unsigned int, len, ATMEL_SHA_CALIB_MAX);
+	dev_dbg(dd->dev, "%s: software below %u bytes\n", name, len);
+
+out:
+	ahash_request_free(req);
+	kfree(buf);
+	crypto_free_shash(sw);
+free_hw:
+	crypto_free_ahash(hw);
+
+	return len;
+}
+
+static void atmel_sha_calibrate(struct work_struct *work)
+{
+	struct atmel_sha_dev *dd = container_of(work, struct atmel_sha_dev,
+						calib_work);
+	int i;
+
+	for (i = 0; i < ATMEL_SHA_FB_NR; i++) {
+		if (i == ATMEL_SHA_FB_SHA224 && !dd->caps.has_sha224)
+			continue;
+		if (i >= ATMEL_SHA_FB_SHA384 && !dd->caps.has_sha_384_512)
+			continue;
+		dd->fallback_len[i] = atmel_sha_calibrate_algo(dd, i);
+	}
+}
+
+static ssize_t atmel_sha_fallback_show(struct device *dev, char *buf,
+				       int algo)
+{
+	struct atmel_sha_dev *dd = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", dd->fallback_len[algo]);
+}
+
+static ssize_t atmel_sha_fallback_store(struct device *dev, const char *buf,
+					size_t len, int algo)
+{
+	struct atmel_sha_dev *dd = dev_get_drvdata(dev);
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	dd->fallback_len[algo] = val;
+
+	return len;
+}
+
+#define ATMEL_SHA_FALLBACK_ATTR(_name, _algo)				\
+static ssize_t fallback_##_name##_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	return atmel_sha_fallback_show(dev, buf, _algo);		\
+}									\
+static ssize_t fallback_##_name##_store(struct device *dev,		\
+		struct device_attribute *attr, const char *buf,		\
+		size_t len)						\
+{									\
+	return atmel_sha_fallback_store(dev, buf, len, _algo);		\
+}									\
+static DEVICE_ATTR_RW(fallback_##_name)
+
+ATMEL_SHA_FALLBACK_ATTR(sha1, ATMEL_SHA_FB_SHA1);
+ATMEL_SHA_FALLBACK_ATTR(sha224, ATMEL_SHA_FB_SHA224);
+ATMEL_SHA_FALLBACK_ATTR(sha256, ATMEL_SHA_FB_SHA256);
+ATMEL_SHA_FALLBACK_ATTR(sha384, ATMEL_SHA_FB_SHA384);
+ATMEL_SHA_FALLBACK_ATTR(sha512, ATMEL_SHA_FB_SHA512);
+
+static struct attribute *atmel_sha_attrs[] = {
+	&dev_attr_fallback_sha1.attr,
+	&dev_attr_fallback_sha224.attr,
+	&dev_attr_fallback_sha256.attr,
+	&dev_attr_fallback_sha384.attr,
+	&dev_attr_fallback_sha512.attr,
+	NULL
+};
+
+static const struct attribute_group atmel_sha_attr_group = {
+	.attrs = atmel_sha_attrs,
+};
+
 static void atmel_sha_get_cap(struct atmel_sha_dev *dd)
 {
 
@@ -1766,14 +2396,12 @@ static int atmel_sha_probe(struct platform_device *pdev)
 	platform_set_drvdata(pdev, sha_dd);
 
 	INIT_LIST_HEAD(&sha_dd->list);
-	spin_lock_init(&sha_dd->lock);
 
 	tasklet_init(&sha_dd->done_task, atmel_sha_done_task,
 					(unsigned long)sha_dd);
-	tasklet_init(&sha_dd->queue_task, atmel_sha_queue_task,
-					(unsigned long)sha_dd);
 
-	crypto_init_queue(&sha_dd->queue, ATMEL_SHA_QUEUE_LENGTH);
+	atmel_crypto_engine_init(&sha_dd->engine, dev,
+				 ATMEL_SHA_QUEUE_LENGTH, atmel_sha_do_one);
 
 	sha_dd->irq = -1;
 
@@ -1851,12 +2479,23 @@ static int atmel_sha_probe(struct platform_device *pdev)
 	if (err)
 		goto err_algs;
 
-	dev_info(dev, "Atmel SHA1/SHA256%s%s\n",
+	err = sysfs_create_group(&dev->kobj, &atmel_sha_attr_group);
+	if (err)
+		goto err_sysfs;
+
+	/* The algorithms must be usable to compare them with software */
+	INIT_WORK(&sha_dd->calib_work, atmel_sha_calibrate);
+	schedule_work(&sha_dd->calib_work);
+
+	dev_info(dev, "Atmel SHA1/SHA256%s%s%s\n",
 			sha_dd->caps.has_sha224 ? "/SHA224" : "",
-			sha_dd->caps.has_sha_384_512 ? "/SHA384/SHA512" : "");
+			sha_dd->caps.has_sha_384_512 ? "/SHA384/SHA512" : "",
+			sha_dd->caps.has_uihv ? " (+HMAC)" : "");
 
 	return 0;
 
+err_sysfs:
+	atmel_sha_unregister_algs(sha_dd);
 err_algs:
 	spin_lock(&atmel_sha.lock);
 	list_del(&sha_dd->list);
@@ -1871,8 +2510,8 @@ sha_io_err:
 clk_err:
 	free_irq(sha_dd->irq, sha_dd);
 res_err:
-	tasklet_kill(&sha_dd->queue_task);
 	tasklet_kill(&sha_dd->done_task);
+	atmel_crypto_engine_exit(&sha_dd->engine);
 sha_dd_err:
 	dev_err(dev, "initialization failed.\n");
 
@@ -1886,14 +2525,18 @@ static int atmel_sha_remove(struct platform_device *pdev)
 	sha_dd = platform_get_drvdata(pdev);
 	if (!sha_dd)
 		return -ENODEV;
+
+	cancel_work_sync(&sha_dd->calib_work);
+	sysfs_remove_group(&pdev->dev.kobj, &atmel_sha_attr_group);
+
 	spin_lock(&atmel_sha.lock);
 	list_del(&sha_dd->list);
 	spin_unlock(&atmel_sha.lock);
 
 	atmel_sha_unregister_algs(sha_dd);
 
-	tasklet_kill(&sha_dd->queue_task);
 	tasklet_kill(&sha_dd->done_task);
+	atmel_crypto_engine_exit(&sha_dd->engine);
 
 	if (sha_dd->caps.has_dma)
 		atmel_sha_dma_cleanup(sha_dd);
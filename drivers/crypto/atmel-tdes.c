@@ -40,6 +40,7 @@
 #include <crypto/hash.h>
 #include <crypto/internal/hash.h>
 #include <linux/platform_data/crypto-atmel.h>
+#include "atmel-crypto-engine.h"
 #include "atmel-tdes-regs.h"
 
 /* TDES flags  */
@@ -55,7 +56,6 @@
 
 #define TDES_FLAGS_INIT		BIT(16)
 #define TDES_FLAGS_FAST		BIT(17)
-#define TDES_FLAGS_BUSY		BIT(18)
 #define TDES_FLAGS_DMA		BIT(19)
 
 #define ATMEL_TDES_QUEUE_LENGTH	50
@@ -103,11 +103,9 @@ struct atmel_tdes_dev {
 	unsigned long		flags;
 	int			err;
 
-	spinlock_t		lock;
-	struct crypto_queue	queue;
+	struct atmel_crypto_engine engine;
 
 	struct tasklet_struct	done_task;
-	struct tasklet_struct	queue_task;
 
 	struct ablkcipher_request	*req;
 	size_t				total;
@@ -324,8 +322,8 @@ static int atmel_tdes_crypt_pdc_stop(struct atmel_tdes_dev *dd)
 		dma_unmap_sg(dd->dev, dd->out_sg, 1, DMA_FROM_DEVICE);
 		dma_unmap_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
 	} else {
-		dma_sync_single_for_device(dd->dev, dd->dma_addr_out,
-					   dd->dma_size, DMA_FROM_DEVICE);
+		dma_sync_single_for_cpu(dd->dev, dd->dma_addr_out,
+					dd->dma_size, DMA_FROM_DEVICE);
 
 		/* copy data */
 		count = atmel_tdes_sg_copy(&dd->out_sg, &dd->out_offset,
@@ -430,21 +428,14 @@ static int atmel_tdes_crypt_pdc(struct crypto_tfm *tfm, dma_addr_t dma_addr_in,
 	return 0;
 }
 
-static int atmel_tdes_crypt_dma(struct crypto_tfm *tfm, dma_addr_t dma_addr_in,
-			       dma_addr_t dma_addr_out, int length)
+static int atmel_tdes_crypt_dma_sg(struct atmel_tdes_dev *dd,
+		struct scatterlist *in_sg, unsigned int in_nents,
+		struct scatterlist *out_sg, unsigned int out_nents, int length)
 {
-	struct atmel_tdes_ctx *ctx = crypto_tfm_ctx(tfm);
-	struct atmel_tdes_dev *dd = ctx->dd;
-	struct scatterlist sg[2];
 	struct dma_async_tx_descriptor	*in_desc, *out_desc;
 
 	dd->dma_size = length;
 
-	if (!(dd->flags & TDES_FLAGS_FAST)) {
-		dma_sync_single_for_device(dd->dev, dma_addr_in, length,
-					   DMA_TO_DEVICE);
-	}
-
 	if (dd->flags & TDES_FLAGS_CFB8) {
 		dd->dma_lch_in.dma_conf.dst_addr_width =
 			DMA_SLAVE_BUSWIDTH_1_BYTE;
@@ -467,22 +458,14 @@ static int atmel_tdes_crypt_dma(struct crypto_tfm *tfm, dma_addr_t dma_addr_in,
 
 	dd->flags |= TDES_FLAGS_DMA;
 
-	sg_init_table(&sg[0], 1);
-	sg_dma_address(&sg[0]) = dma_addr_in;
-	sg_dma_len(&sg[0]) = length;
-
-	sg_init_table(&sg[1], 1);
-	sg_dma_address(&sg[1]) = dma_addr_out;
-	sg_dma_len(&sg[1]) = length;
-
-	in_desc = dmaengine_prep_slave_sg(dd->dma_lch_in.chan, &sg[0],
-				1, DMA_MEM_TO_DEV,
+	in_desc = dmaengine_prep_slave_sg(dd->dma_lch_in.chan, in_sg,
+				in_nents, DMA_MEM_TO_DEV,
 				DMA_PREP_INTERRUPT  |  DMA_CTRL_ACK);
 	if (!in_desc)
 		return -EINVAL;
 
-	out_desc = dmaengine_prep_slave_sg(dd->dma_lch_out.chan, &sg[1],
-				1, DMA_DEV_TO_MEM,
+	out_desc = dmaengine_prep_slave_sg(dd->dma_lch_out.chan, out_sg,
+				out_nents, DMA_DEV_TO_MEM,
 				DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
 	if (!out_desc)
 		return -EINVAL;
@@ -499,55 +482,188 @@ static int atmel_tdes_crypt_dma(struct crypto_tfm *tfm, dma_addr_t dma_addr_in,
 	return 0;
 }
 
+static int atmel_tdes_crypt_dma(struct crypto_tfm *tfm, dma_addr_t dma_addr_in,
+			       dma_addr_t dma_addr_out, int length)
+{
+	struct atmel_tdes_ctx *ctx = crypto_tfm_ctx(tfm);
+	struct atmel_tdes_dev *dd = ctx->dd;
+	struct scatterlist sg[2];
+
+	dma_sync_single_for_device(dd->dev, dma_addr_in, length,
+				   DMA_TO_DEVICE);
+
+	sg_init_table(&sg[0], 1);
+	sg_dma_address(&sg[0]) = dma_addr_in;
+	sg_dma_len(&sg[0]) = length;
+
+	sg_init_table(&sg[1], 1);
+	sg_dma_address(&sg[1]) = dma_addr_out;
+	sg_dma_len(&sg[1]) = length;
+
+	return atmel_tdes_crypt_dma_sg(dd, &sg[0], 1, &sg[1], 1, length);
+}
+
+static bool atmel_tdes_sg_aligned(struct scatterlist *sg, size_t len,
+				  size_t block_size)
+{
+	return IS_ALIGNED(sg->offset, sizeof(u32)) &&
+		IS_ALIGNED(len, block_size);
+}
+
+/*
+ * Walk the input and output lists from their current position and return
+ * the length of the first stretch that ends on an entry boundary of both
+ * lists. With @fast, only entries usable by the DMA as they are may be
+ * crossed and the longest such stretch is returned, along with the number
+ * of entries it spans; without it, the shortest block-aligned one is, so
+ * that only the unaligned part of a request goes through the bounce
+ * buffers. The result is capped at @max.
+ */
+static size_t atmel_tdes_sg_span(struct atmel_tdes_dev *dd, size_t max,
+				 bool fast, unsigned int *in_nents,
+				 unsigned int *out_nents)
+{
+	struct scatterlist *in = dd->in_sg, *out = dd->out_sg;
+	size_t bs = dd->ctx->block_size;
+	size_t in_end, out_end, span = 0;
+	unsigned int ni = 1, no = 1;
+
+	in_end = min_t(size_t, in->length - dd->in_offset, max);
+	out_end = min_t(size_t, out->length - dd->out_offset, max);
+
+	if (fast && (!atmel_tdes_sg_aligned(in, in_end, bs) ||
+		     !atmel_tdes_sg_aligned(out, out_end, bs)))
+		return 0;
+
+	for (;;) {
+		if (in_end == out_end) {
+			if (fast) {
+				span = in_end;
+				*in_nents = ni;
+				*out_nents = no;
+			} else if (IS_ALIGNED(in_end, bs)) {
+				return in_end;
+			}
+			if (in_end == max)
+				break;
+		}
+
+		if (in_end <= out_end) {
+			in = sg_next(in);
+			if (!in)
+				break;
+			if (fast && !atmel_tdes_sg_aligned(in,
+					min(in->length, max - in_end), bs))
+				break;
+			in_end = min(in_end + in->length, max);
+			ni++;
+		} else {
+			out = sg_next(out);
+			if (!out)
+				break;
+			if (fast && !atmel_tdes_sg_aligned(out,
+					min(out->length, max - out_end), bs))
+				break;
+			out_end = min(out_end + out->length, max);
+			no++;
+		}
+	}
+
+	return fast ? span : max;
+}
+
+static struct scatterlist *atmel_tdes_sg_skip(struct scatterlist *sg,
+					      unsigned int nents)
+{
+	while (sg && nents--)
+		sg = sg_next(sg);
+
+	return sg;
+}
+
+/* The last mapped entry may extend past the part being processed */
+static void atmel_tdes_sg_trim(struct scatterlist *sg, unsigned int nents,
+			       size_t len)
+{
+	struct scatterlist *s;
+	unsigned int i;
+
+	for_each_sg(sg, s, nents, i) {
+		sg_dma_len(s) = min_t(size_t, sg_dma_len(s), len);
+		len -= sg_dma_len(s);
+	}
+}
+
 static int atmel_tdes_crypt_start(struct atmel_tdes_dev *dd)
 {
 	struct crypto_tfm *tfm = crypto_ablkcipher_tfm(
 					crypto_ablkcipher_reqtfm(dd->req));
-	int err, fast = 0, in, out;
-	size_t count;
+	int err, in, out, in_mapped = 1, out_mapped = 1;
+	size_t count = 0;
 	dma_addr_t addr_in, addr_out;
 
 	if ((!dd->in_offset) && (!dd->out_offset)) {
-		/* check for alignment */
-		in = IS_ALIGNED((u32)dd->in_sg->offset, sizeof(u32)) &&
-			IS_ALIGNED(dd->in_sg->length, dd->ctx->block_size);
-		out = IS_ALIGNED((u32)dd->out_sg->offset, sizeof(u32)) &&
-			IS_ALIGNED(dd->out_sg->length, dd->ctx->block_size);
-		fast = in && out;
-
-		if (sg_dma_len(dd->in_sg) != sg_dma_len(dd->out_sg))
-			fast = 0;
+		if (dd->caps.has_dma) {
+			/* the dmaengine can chain all the usable entries */
+			count = atmel_tdes_sg_span(dd, dd->total, true,
+						   &dd->nb_in_sg,
+						   &dd->nb_out_sg);
+		} else {
+			/* check for alignment */
+			in = IS_ALIGNED((u32)dd->in_sg->offset, sizeof(u32)) &&
+				IS_ALIGNED(dd->in_sg->length,
+					   dd->ctx->block_size);
+			out = IS_ALIGNED((u32)dd->out_sg->offset,
+					 sizeof(u32)) &&
+				IS_ALIGNED(dd->out_sg->length,
+					   dd->ctx->block_size);
+
+			if (in && out &&
+			    sg_dma_len(dd->in_sg) == sg_dma_len(dd->out_sg)) {
+				count = min(dd->total, sg_dma_len(dd->in_sg));
+				dd->nb_in_sg = 1;
+				dd->nb_out_sg = 1;
+			}
+		}
 	}
 
-
-	if (fast)  {
-		count = min(dd->total, sg_dma_len(dd->in_sg));
-		count = min(count, sg_dma_len(dd->out_sg));
-
-		err = dma_map_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
-		if (!err) {
+	if (count)  {
+		in_mapped = dma_map_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
+				DMA_TO_DEVICE);
+		if (!in_mapped) {
 			dev_err(dd->dev, "dma_map_sg() error\n");
 			return -EINVAL;
 		}
 
-		err = dma_map_sg(dd->dev, dd->out_sg, 1,
+		out_mapped = dma_map_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
 				DMA_FROM_DEVICE);
-		if (!err) {
+		if (!out_mapped) {
 			dev_err(dd->dev, "dma_map_sg() error\n");
-			dma_unmap_sg(dd->dev, dd->in_sg, 1,
+			dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
 				DMA_TO_DEVICE);
 			return -EINVAL;
 		}
 
+		atmel_tdes_sg_trim(dd->in_sg, in_mapped, count);
+		atmel_tdes_sg_trim(dd->out_sg, out_mapped, count);
+
 		addr_in = sg_dma_address(dd->in_sg);
 		addr_out = sg_dma_address(dd->out_sg);
 
 		dd->flags |= TDES_FLAGS_FAST;
 
 	} else {
-		/* use cache buffers */
+		/*
+		 * use cache buffers; with the dmaengine, only up to where the
+		 * lists are usable again
+		 */
+		count = dd->total;
+		if (dd->caps.has_dma)
+			count = atmel_tdes_sg_span(dd,
+					min(dd->total, dd->buflen), false,
+					NULL, NULL);
 		count = atmel_tdes_sg_copy(&dd->in_sg, &dd->in_offset,
-				dd->buf_in, dd->buflen, dd->total, 0);
+				dd->buf_in, dd->buflen, count, 0);
 
 		addr_in = dd->dma_addr_in;
 		addr_out = dd->dma_addr_out;
@@ -557,14 +673,18 @@ static int atmel_tdes_crypt_start(struct atmel_tdes_dev *dd)
 
 	dd->total -= count;
 
-	if (dd->caps.has_dma)
-		err = atmel_tdes_crypt_dma(tfm, addr_in, addr_out, count);
-	else
+	if (!dd->caps.has_dma)
 		err = atmel_tdes_crypt_pdc(tfm, addr_in, addr_out, count);
+	else if (dd->flags & TDES_FLAGS_FAST)
+		err = atmel_tdes_crypt_dma_sg(dd, dd->in_sg, in_mapped,
+				dd->out_sg, out_mapped, count);
+	else
+		err = atmel_tdes_crypt_dma(tfm, addr_in, addr_out, count);
 
 	if (err && (dd->flags & TDES_FLAGS_FAST)) {
-		dma_unmap_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
-		dma_unmap_sg(dd->dev, dd->out_sg, 1, DMA_TO_DEVICE);
+		dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg, DMA_TO_DEVICE);
+		dma_unmap_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
+			     DMA_FROM_DEVICE);
 	}
 
 	return err;
@@ -576,40 +696,18 @@ static void atmel_tdes_finish_req(struct atmel_tdes_dev *dd, int err)
 
 	clk_disable_unprepare(dd->iclk);
 
-	dd->flags &= ~TDES_FLAGS_BUSY;
-
-	req->base.complete(&req->base, err);
+	atmel_crypto_engine_finalize(&dd->engine, &req->base, err);
 }
 
-static int atmel_tdes_handle_queue(struct atmel_tdes_dev *dd,
-			       struct ablkcipher_request *req)
+static void atmel_tdes_do_one(struct atmel_crypto_engine *engine,
+			      struct crypto_async_request *async_req)
 {
-	struct crypto_async_request *async_req, *backlog;
+	struct atmel_tdes_dev *dd =
+		container_of(engine, struct atmel_tdes_dev, engine);
+	struct ablkcipher_request *req = ablkcipher_request_cast(async_req);
 	struct atmel_tdes_ctx *ctx;
 	struct atmel_tdes_reqctx *rctx;
-	unsigned long flags;
-	int err, ret = 0;
-
-	spin_lock_irqsave(&dd->lock, flags);
-	if (req)
-		ret = ablkcipher_enqueue_request(&dd->queue, req);
-	if (dd->flags & TDES_FLAGS_BUSY) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
-	}
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->queue);
-	if (async_req)
-		dd->flags |= TDES_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
-
-	if (!async_req)
-		return ret;
-
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
-
-	req = ablkcipher_request_cast(async_req);
+	int err;
 
 	/* assign new request to device */
 	dd->req = req;
@@ -629,13 +727,9 @@ static int atmel_tdes_handle_queue(struct atmel_tdes_dev *dd,
 	err = atmel_tdes_write_ctrl(dd);
 	if (!err)
 		err = atmel_tdes_crypt_start(dd);
-	if (err) {
+	if (err)
 		/* des_task will not finish it, so do it here */
 		atmel_tdes_finish_req(dd, err);
-		tasklet_schedule(&dd->queue_task);
-	}
-
-	return ret;
 }
 
 static int atmel_tdes_crypt_dma_stop(struct atmel_tdes_dev *dd)
@@ -646,10 +740,12 @@ static int atmel_tdes_crypt_dma_stop(struct atmel_tdes_dev *dd)
 	if (dd->flags & TDES_FLAGS_DMA) {
 		err = 0;
 		if  (dd->flags & TDES_FLAGS_FAST) {
-			dma_unmap_sg(dd->dev, dd->out_sg, 1, DMA_FROM_DEVICE);
-			dma_unmap_sg(dd->dev, dd->in_sg, 1, DMA_TO_DEVICE);
+			dma_unmap_sg(dd->dev, dd->out_sg, dd->nb_out_sg,
+				DMA_FROM_DEVICE);
+			dma_unmap_sg(dd->dev, dd->in_sg, dd->nb_in_sg,
+				DMA_TO_DEVICE);
 		} else {
-			dma_sync_single_for_device(dd->dev, dd->dma_addr_out,
+			dma_sync_single_for_cpu(dd->dev, dd->dma_addr_out,
 				dd->dma_size, DMA_FROM_DEVICE);
 
 			/* copy data */
@@ -698,7 +794,7 @@ static int atmel_tdes_crypt(struct ablkcipher_request *req, unsigned long mode)
 
 	rctx->mode = mode;
 
-	return atmel_tdes_handle_queue(ctx->dd, req);
+	return atmel_crypto_engine_enqueue(&ctx->dd->engine, &req->base);
 }
 
 static bool atmel_tdes_filter(struct dma_chan *chan, void *slave)
@@ -1207,13 +1303,6 @@ static struct crypto_alg tdes_algs[] = {
 },
 };
 
-static void atmel_tdes_queue_task(unsigned long data)
-{
-	struct atmel_tdes_dev *dd = (struct atmel_tdes_dev *)data;
-
-	atmel_tdes_handle_queue(dd, NULL);
-}
-
 static void atmel_tdes_done_task(unsigned long data)
 {
 	struct atmel_tdes_dev *dd = (struct atmel_tdes_dev *) data;
@@ -1228,8 +1317,10 @@ static void atmel_tdes_done_task(unsigned long data)
 
 	if (dd->total && !err) {
 		if (dd->flags & TDES_FLAGS_FAST) {
-			dd->in_sg = sg_next(dd->in_sg);
-			dd->out_sg = sg_next(dd->out_sg);
+			dd->in_sg = atmel_tdes_sg_skip(dd->in_sg,
+						       dd->nb_in_sg);
+			dd->out_sg = atmel_tdes_sg_skip(dd->out_sg,
+							dd->nb_out_sg);
 			if (!dd->in_sg || !dd->out_sg)
 				err = -EINVAL;
 		}
@@ -1240,7 +1331,6 @@ static void atmel_tdes_done_task(unsigned long data)
 	}
 
 	atmel_tdes_finish_req(dd, err);
-	atmel_tdes_handle_queue(dd, NULL);
 }
 
 static irqreturn_t atmel_tdes_irq(int irq, void *dev_id)
@@ -1251,7 +1341,7 @@ static irqreturn_t atmel_tdes_irq(int irq, void *dev_id)
 	reg = atmel_tdes_read(tdes_dd, TDES_ISR);
 	if (reg & atmel_tdes_read(tdes_dd, TDES_IMR)) {
 		atmel_tdes_write(tdes_dd, TDES_IDR, reg);
-		if (TDES_FLAGS_BUSY & tdes_dd->flags)
+		if (atmel_crypto_engine_busy(&tdes_dd->engine))
 			tasklet_schedule(&tdes_dd->done_task);
 		else
 			dev_warn(tdes_dd->dev, "TDES interrupt when no active requests.\n");
@@ -1370,14 +1460,12 @@ static int atmel_tdes_probe(struct platform_device *pdev)
 	platform_set_drvdata(pdev, tdes_dd);
 
 	INIT_LIST_HEAD(&tdes_dd->list);
-	spin_lock_init(&tdes_dd->lock);
 
 	tasklet_init(&tdes_dd->done_task, atmel_tdes_done_task,
 					(unsigned long)tdes_dd);
-	tasklet_init(&tdes_dd->queue_task, atmel_tdes_queue_task,
-					(unsigned long)tdes_dd);
 
-	crypto_init_queue(&tdes_dd->queue, ATMEL_TDES_QUEUE_LENGTH);
+	atmel_crypto_engine_init(&tdes_dd->engine, dev,
+				 ATMEL_TDES_QUEUE_LENGTH, atmel_tdes_do_one);
 
 	tdes_dd->irq = -1;
 
@@ -1482,7 +1570,7 @@ clk_err:
 tdes_irq_err:
 res_err:
 	tasklet_kill(&tdes_dd->done_task);
-	tasklet_kill(&tdes_dd->queue_task);
+	atmel_crypto_engine_exit(&tdes_dd->engine);
 tdes_dd_err:
 	dev_err(dev, "initialization failed.\n");
 
@@ -1503,7 +1591,7 @@ static int atmel_tdes_remove(struct platform_device *pdev)
 	atmel_tdes_unregister_algs(tdes_dd);
 
 	tasklet_kill(&tdes_dd->done_task);
-	tasklet_kill(&tdes_dd->queue_task);
+	atmel_crypto_engine_exit(&tdes_dd->engine);
 
 	if (tdes_dd->caps.has_dma)
 		atmel_tdes_dma_cleanup(tdes_dd);
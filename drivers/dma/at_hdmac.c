@@ -26,6 +26,7 @@
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/of_dma.h>
+#include <trace/events/dmaengine.h>
 
 #include "at_hdmac_regs.h"
 #include "dmaengine.h"
@@ -147,7 +148,10 @@ static struct at_desc *atc_desc_get(struct at_dma_chan *atchan)
 		}
 		dev_dbg(chan2dev(&atchan->chan_common),
 				"desc %p not ACKed\n", desc);
+		/* don't scan it again before the ACKed ones */
+		list_move_tail(&desc->desc_node, &tmp_list);
 	}
+	list_splice_tail(&tmp_list, &atchan->free_list);
 	spin_unlock_irqrestore(&atchan->lock, flags);
 	dev_vdbg(chan2dev(&atchan->chan_common),
 		"scanned %u descriptors on freelist\n", i);
@@ -196,7 +200,7 @@ static void atc_desc_put(struct at_dma_chan *atchan, struct at_desc *desc)
  * atc_desc_chain - build chain adding a descriptor
  * @first: address of first descriptor of the chain
  * @prev: address of previous descriptor of the chain
- * @desc: descriptor to queue
+ * @desc: descriptor to queue, its len already set
  *
  * Called from prep_* functions
  */
@@ -205,16 +209,56 @@ static void atc_desc_chain(struct at_desc **first, struct at_desc **prev,
 {
 	if (!(*first)) {
 		*first = desc;
+		desc->offset = 0;
+		desc->residue_hint = desc;
 	} else {
 		/* inform the HW lli about chaining */
 		(*prev)->lli.dscr = desc->txd.phys;
 		/* insert the link descriptor to the LD ring */
 		list_add_tail(&desc->desc_node,
 				&(*first)->tx_list);
+		desc->offset = (*prev)->offset + (*prev)->len;
 	}
 	*prev = desc;
 }
 
+/* Next descriptor of the chain of @first, wrapping as in cyclic mode */
+static struct at_desc *atc_next_child(struct at_desc *first,
+				      struct at_desc *desc)
+{
+	if (list_is_last(&desc->desc_node, &first->tx_list) ||
+	    list_empty(&first->tx_list))
+		return first;
+	if (desc == first)
+		return list_first_entry(&first->tx_list, struct at_desc,
+					desc_node);
+	return list_next_entry(desc, desc_node);
+}
+
+/**
+ * atc_find_child - get the descriptor of a chain the controller is on
+ * @first: first descriptor of the chain
+ * @dscr: value of the DSCR register, the address of the next descriptor
+ *
+ * The search starts from the descriptor found the last time, so that
+ * polling the residue of a long or cyclic chain is not linear in its
+ * number of descriptors.
+ */
+static struct at_desc *atc_find_child(struct at_desc *first, u32 dscr)
+{
+	struct at_desc *desc = first->residue_hint;
+
+	do {
+		if (desc->lli.dscr == dscr) {
+			first->residue_hint = desc;
+			return desc;
+		}
+		desc = atc_next_child(first, desc);
+	} while (desc != first->residue_hint);
+
+	return NULL;
+}
+
 /**
  * atc_dostart - starts the DMA engine for real
  * @atchan: the channel we want to start
@@ -412,23 +456,16 @@ static int atc_get_bytes_left(struct dma_chan *chan, dma_cookie_t cookie)
 		if (unlikely(trials >= ATC_MAX_DSCR_TRIALS))
 			return -ETIMEDOUT;
 
-		/* for the first descriptor we can be more accurate */
-		if (desc_first->lli.dscr == dscr)
-			return atc_calc_bytes_left(ret, ctrla);
-
-		ret -= desc_first->len;
-		list_for_each_entry(desc, &desc_first->tx_list, desc_node) {
-			if (desc->lli.dscr == dscr)
-				break;
-
-			ret -= desc->len;
-		}
+		desc = atc_find_child(desc_first, dscr);
+		if (unlikely(!desc))
+			return -EINVAL;
 
 		/*
-		 * For the current descriptor in the chain we can calculate
-		 * the remaining bytes using the channel's register.
+		 * Remove the descriptors already transferred, then for the
+		 * current one we can calculate the remaining bytes using the
+		 * channel's register.
 		 */
-		ret = atc_calc_bytes_left(ret, ctrla);
+		ret = atc_calc_bytes_left(ret - desc->offset, ctrla);
 	} else {
 		/* single transfer */
 		ctrla = channel_readl(atchan, CTRLA);
@@ -480,8 +517,11 @@ atc_chain_complete(struct at_dma_chan *atchan, struct at_desc *desc)
 		 * The API requires that no submissions are done from a
 		 * callback, so we don't need to drop the lock here
 		 */
-		if (callback)
+		if (callback) {
+			trace_dma_callback(txd->chan, txd->cookie,
+					   desc->total_len);
 			callback(param);
+		}
 	}
 
 	dma_run_dependencies(txd);
@@ -605,8 +645,10 @@ static void atc_handle_cyclic(struct at_dma_chan *atchan)
 			"new cyclic period llp 0x%08x\n",
 			channel_readl(atchan, DSCR));
 
-	if (callback)
+	if (callback) {
+		trace_dma_callback(txd->chan, txd->cookie, first->total_len);
 		callback(param);
+	}
 }
 
 /*--  IRQ & Tasklet  ---------------------------------------------------*/
@@ -650,6 +692,8 @@ static irqreturn_t at_dma_interrupt(int irq, void *dev_id)
 		for (i = 0; i < atdma->dma_common.chancnt; i++) {
 			atchan = &atdma->chan[i];
 			if (pending & (AT_DMA_BTC(i) | AT_DMA_ERR(i))) {
+				trace_dma_irq(&atchan->chan_common, pending &
+					      (AT_DMA_BTC(i) | AT_DMA_ERR(i)));
 				if (pending & AT_DMA_ERR(i)) {
 					/* Disable channel on AHB error */
 					dma_writel(atdma, CHDR,
@@ -687,6 +731,7 @@ static dma_cookie_t atc_tx_submit(struct dma_async_tx_descriptor *tx)
 
 	spin_lock_irqsave(&atchan->lock, flags);
 	cookie = dma_cookie_assign(tx);
+	trace_dma_tx_submit(tx->chan, cookie, desc->total_len);
 
 	if (list_empty(&atchan->active_list)) {
 		dev_vdbg(chan2dev(tx->chan), "tx_submit: started %u\n",
@@ -728,8 +773,8 @@ atc_prep_dma_interleaved(struct dma_chan *chan,
 	if (unlikely(!xt || xt->numf != 1 || !xt->frame_size))
 		return NULL;
 
-	dev_info(chan2dev(chan),
-		 "%s: src=0x%08x, dest=0x%08x, numf=%d, frame_size=%d, flags=0x%lx\n",
+	dev_dbg(chan2dev(chan),
+		"%s: src=0x%08x, dest=0x%08x, numf=%d, frame_size=%d, flags=0x%lx\n",
 		__func__, xt->src_start, xt->dst_start, xt->numf,
 		xt->frame_size, flags);
 
@@ -766,12 +811,18 @@ atc_prep_dma_interleaved(struct dma_chan *chan,
 	ctrla = ATC_SRC_WIDTH(dwidth) |
 		ATC_DST_WIDTH(dwidth);
 
-	ctrlb =   ATC_DEFAULT_CTRLB | ATC_IEN
-		| ATC_SRC_ADDR_MODE_INCR
-		| ATC_DST_ADDR_MODE_INCR
-		| ATC_SRC_PIP
-		| ATC_DST_PIP
-		| ATC_FC_MEM2MEM;
+	ctrlb = ATC_DEFAULT_CTRLB | ATC_IEN | ATC_FC_MEM2MEM;
+
+	/* a side which does not increment is a data register, without holes */
+	if (xt->src_inc)
+		ctrlb |= ATC_SRC_ADDR_MODE_INCR | ATC_SRC_PIP;
+	else
+		ctrlb |= ATC_SRC_ADDR_MODE_FIXED;
+
+	if (xt->dst_inc)
+		ctrlb |= ATC_DST_ADDR_MODE_INCR | ATC_DST_PIP;
+	else
+		ctrlb |= ATC_DST_ADDR_MODE_FIXED;
 
 	/* create the transfer */
 	desc = atc_desc_get(atchan);
@@ -1573,6 +1624,7 @@ static void atc_issue_pending(struct dma_chan *chan)
 	unsigned long		flags;
 
 	dev_vdbg(chan2dev(chan), "issue_pending\n");
+	trace_dma_issue_pending(chan);
 
 	/* Not needed for cyclic transfers */
 	if (atc_chan_is_cyclic(atchan))
@@ -195,6 +195,8 @@ struct at_desc {
 	struct list_head		desc_node;
 	size_t				len;
 	size_t				total_len;
+	size_t				offset;
+	struct at_desc			*residue_hint;
 
 	/* Interleaved data */
 	size_t				boundary;
@@ -20,6 +20,7 @@
 
 #include <asm/barrier.h>
 #include <dt-bindings/dma/at91.h>
+#include <linux/atmel-sram.h>
 #include <linux/clk.h>
 #include <linux/dmaengine.h>
 #include <linux/dmapool.h>
@@ -27,11 +28,14 @@
 #include <linux/irq.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/module.h>
 #include <linux/of_dma.h>
 #include <linux/of_platform.h>
 #include <linux/platform_device.h>
 #include <linux/pm.h>
+#include <linux/workqueue.h>
+#include <trace/events/dmaengine.h>
 
 #include "dmaengine.h"
 
@@ -42,6 +46,10 @@
 #define		AT_XDMAC_NB_REQ(i)	((((i) >> 16) & 0x3F) + 1)	/* Number of Peripheral Requests Minus One */
 #define AT_XDMAC_GCFG		0x04	/* Global Configuration Register */
 #define AT_XDMAC_GWAC		0x08	/* Global Weighted Arbiter Configuration Register */
+#define		AT_XDMAC_PW0(i)		(((i) & 0xF) << 0)		/* Pool Weight 0: peripheral read */
+#define		AT_XDMAC_PW1(i)		(((i) & 0xF) << 4)		/* Pool Weight 1: memory read */
+#define		AT_XDMAC_PW2(i)		(((i) & 0xF) << 8)		/* Pool Weight 2: peripheral write */
+#define		AT_XDMAC_PW3(i)		(((i) & 0xF) << 12)		/* Pool Weight 3: memory write */
 #define AT_XDMAC_GIE		0x0C	/* Global Interrupt Enable Register */
 #define AT_XDMAC_GID		0x10	/* Global Interrupt Disable Register */
 #define AT_XDMAC_GIM		0x14	/* Global Interrupt Mask Register */
@@ -177,6 +185,7 @@
 #define AT_XDMAC_MAX_CSIZE	16	/* 16 data */
 #define AT_XDMAC_MAX_DWIDTH	8	/* 64 bits */
 #define AT_XDMAC_RESIDUE_MAX_RETRIES	5
+#define AT_XDMAC_SRAM_DESCS	64	/* default SRAM quota, in descriptors */
 
 #define AT_XDMAC_DMA_BUSWIDTHS\
 	(BIT(DMA_SLAVE_BUSWIDTH_UNDEFINED) |\
@@ -199,6 +208,7 @@ struct at_xdmac_chan {
 	u8				perid;		/* Peripheral ID */
 	u8				perif;		/* Peripheral Interface */
 	u8				memif;		/* Memory Interface */
+	u8				prio;		/* Requested Arbitration Weight */
 	u32				save_cc;
 	u32				save_cim;
 	u32				save_cnda;
@@ -210,7 +220,11 @@ struct at_xdmac_chan {
 	spinlock_t			lock;
 
 	struct list_head		xfers_list;
-	struct list_head		free_descs_list;
+
+	/* descriptor cache, topped up to init_nr_desc_per_channel */
+	struct llist_head		free_descs;
+	atomic_t			nr_free_descs;
+	struct work_struct		refill_work;
 };
 
 
@@ -222,7 +236,10 @@ struct at_xdmac {
 	struct clk		*clk;
 	u32			save_gim;
 	u32			save_gs;
+	u32			gwac;
+	struct mutex		gwac_lock;
 	struct dma_pool		*at_xdmac_desc_pool;
+	struct gen_pool		*sram_pool;
 	struct at_xdmac_chan	chan[0];
 };
 
@@ -248,6 +265,7 @@ struct at_xdmac_desc {
 	enum dma_transfer_direction	direction;
 	struct dma_async_tx_descriptor	tx_dma_desc;
 	struct list_head		desc_node;
+	struct llist_node		free_node;
 	/* Following members are only used by the first descriptor */
 	bool				active_xfer;
 	unsigned int			xfer_size;
@@ -316,7 +334,7 @@ static inline u8 at_xdmac_get_dwidth(u32 cfg)
 static unsigned int init_nr_desc_per_channel = 64;
 module_param(init_nr_desc_per_channel, uint, 0644);
 MODULE_PARM_DESC(init_nr_desc_per_channel,
-		 "initial descriptors per channel (default: 64)");
+		 "descriptors kept ready per channel (default: 64)");
 
 
 static bool at_xdmac_chan_is_enabled(struct at_xdmac_chan *atchan)
@@ -426,6 +444,7 @@ static dma_cookie_t at_xdmac_tx_submit(struct dma_async_tx_descriptor *tx)
 
 	spin_lock_irqsave(&atchan->lock, irqflags);
 	cookie = dma_cookie_assign(tx);
+	trace_dma_tx_submit(tx->chan, cookie, desc->xfer_size);
 
 	dev_vdbg(chan2dev(tx->chan), "%s: atchan 0x%p, add desc 0x%p to xfers_list\n",
 		 __func__, atchan, desc);
@@ -444,7 +463,13 @@ static struct at_xdmac_desc *at_xdmac_alloc_desc(struct dma_chan *chan,
 	struct at_xdmac		*atxdmac = to_at_xdmac(chan->device);
 	dma_addr_t		phys;
 
-	desc = dma_pool_alloc(atxdmac->at_xdmac_desc_pool, gfp_flags, &phys);
+	desc = NULL;
+	if (atxdmac->sram_pool)
+		desc = gen_pool_dma_alloc(atxdmac->sram_pool, sizeof(*desc),
+					  &phys);
+	if (!desc)
+		desc = dma_pool_alloc(atxdmac->at_xdmac_desc_pool, gfp_flags,
+				      &phys);
 	if (desc) {
 		memset(desc, 0, sizeof(*desc));
 		INIT_LIST_HEAD(&desc->descs_list);
@@ -456,6 +481,19 @@ static struct at_xdmac_desc *at_xdmac_alloc_desc(struct dma_chan *chan,
 	return desc;
 }
 
+static void at_xdmac_free_desc(struct at_xdmac *atxdmac,
+			       struct at_xdmac_desc *desc)
+{
+	if (atxdmac->sram_pool &&
+	    addr_in_gen_pool(atxdmac->sram_pool, (unsigned long)desc,
+			     sizeof(*desc)))
+		gen_pool_free(atxdmac->sram_pool, (unsigned long)desc,
+			      sizeof(*desc));
+	else
+		dma_pool_free(atxdmac->at_xdmac_desc_pool, desc,
+			      desc->tx_dma_desc.phys);
+}
+
 void at_xdmac_init_used_desc(struct at_xdmac_desc *desc)
 {
 	memset(&desc->lld, 0, sizeof(desc->lld));
@@ -465,20 +503,70 @@ void at_xdmac_init_used_desc(struct at_xdmac_desc *desc)
 	desc->active_xfer = false;
 }
 
-/* Call must be protected by lock. */
+/*
+ * Descriptor cache: free descriptors are kept in a lockless list. They
+ * are given back from the completion and error paths without taking the
+ * channel lock, and a work item tops the cache up with sleeping
+ * allocations when it runs low, so that long scatterlists do not have
+ * to allocate in atomic context.
+ */
+static void at_xdmac_put_desc(struct at_xdmac_chan *atchan,
+			      struct at_xdmac_desc *desc)
+{
+	llist_add(&desc->free_node, &atchan->free_descs);
+	atomic_inc(&atchan->nr_free_descs);
+}
+
+/* Give back all descriptors of a list, e.g. a transfer's descs_list. */
+static void at_xdmac_put_descs(struct at_xdmac_chan *atchan,
+			       struct list_head *descs)
+{
+	struct at_xdmac_desc *desc, *_desc;
+
+	list_for_each_entry_safe(desc, _desc, descs, desc_node) {
+		list_del_init(&desc->desc_node);
+		at_xdmac_put_desc(atchan, desc);
+	}
+}
+
+static void at_xdmac_refill_work(struct work_struct *work)
+{
+	struct at_xdmac_chan	*atchan = container_of(work,
+						       struct at_xdmac_chan,
+						       refill_work);
+	struct at_xdmac_desc	*desc;
+
+	while (atomic_read(&atchan->nr_free_descs) <
+	       init_nr_desc_per_channel) {
+		desc = at_xdmac_alloc_desc(&atchan->chan, GFP_KERNEL);
+		if (!desc)
+			break;
+		at_xdmac_put_desc(atchan, desc);
+	}
+}
+
+/*
+ * Call must be protected by lock: the lockless list allows a single
+ * consumer only, the channel lock serializes the prep callbacks.
+ */
 static struct at_xdmac_desc *at_xdmac_get_desc(struct at_xdmac_chan *atchan)
 {
-	struct at_xdmac_desc *desc;
+	struct at_xdmac_desc	*desc;
+	struct llist_node	*node;
 
-	if (list_empty(&atchan->free_descs_list)) {
-		desc = at_xdmac_alloc_desc(&atchan->chan, GFP_NOWAIT);
-	} else {
-		desc = list_first_entry(&atchan->free_descs_list,
-					struct at_xdmac_desc, desc_node);
-		list_del(&desc->desc_node);
+	node = llist_del_first(&atchan->free_descs);
+	if (node) {
+		atomic_dec(&atchan->nr_free_descs);
+		desc = llist_entry(node, struct at_xdmac_desc, free_node);
 		at_xdmac_init_used_desc(desc);
+	} else {
+		desc = at_xdmac_alloc_desc(&atchan->chan, GFP_NOWAIT);
 	}
 
+	if (atomic_read(&atchan->nr_free_descs) <
+	    init_nr_desc_per_channel / 2)
+		schedule_work(&atchan->refill_work);
+
 	return desc;
 }
 
@@ -509,6 +597,28 @@ static inline void at_xdmac_increment_block_count(struct dma_chan *chan,
 		__func__, desc);
 }
 
+/*
+ * The arbiter weighs pools of transfers, not channels: give the peripheral
+ * pools the highest weight requested by the allocated channels so that
+ * latency sensitive peripherals are served ahead of memory to memory
+ * transfers.
+ */
+static void at_xdmac_update_gwac(struct at_xdmac *atxdmac)
+{
+	u8	prio = 0;
+	int	i;
+
+	mutex_lock(&atxdmac->gwac_lock);
+	for (i = 0; i < atxdmac->dma.chancnt; i++)
+		prio = max(prio, atxdmac->chan[i].prio);
+
+	atxdmac->gwac = AT_XDMAC_PW0(prio) | AT_XDMAC_PW2(prio);
+	at_xdmac_write(atxdmac, AT_XDMAC_GWAC, atxdmac->gwac);
+	mutex_unlock(&atxdmac->gwac_lock);
+
+	dev_dbg(atxdmac->dma.dev, "%s: gwac=0x%08x\n", __func__, atxdmac->gwac);
+}
+
 static struct dma_chan *at_xdmac_xlate(struct of_phandle_args *dma_spec,
 				       struct of_dma *of_dma)
 {
@@ -532,8 +642,12 @@ static struct dma_chan *at_xdmac_xlate(struct of_phandle_args *dma_spec,
 	atchan->memif = AT91_XDMAC_DT_GET_MEM_IF(dma_spec->args[0]);
 	atchan->perif = AT91_XDMAC_DT_GET_PER_IF(dma_spec->args[0]);
 	atchan->perid = AT91_XDMAC_DT_GET_PERID(dma_spec->args[0]);
-	dev_dbg(dev, "chan dt cfg: memif=%u perif=%u perid=%u\n",
-		 atchan->memif, atchan->perif, atchan->perid);
+	atchan->prio = AT91_XDMAC_DT_GET_PRIO(dma_spec->args[0]);
+	dev_dbg(dev, "chan dt cfg: memif=%u perif=%u perid=%u prio=%u\n",
+		 atchan->memif, atchan->perif, atchan->perid, atchan->prio);
+
+	if (atchan->prio)
+		at_xdmac_update_gwac(atxdmac);
 
 	return chan;
 }
@@ -630,6 +744,37 @@ static int at_xdmac_set_slave_config(struct dma_chan *chan,
 	return 0;
 }
 
+/*
+ * Slave sg microblocks use the configured data width unless their length is
+ * not a multiple of it, in which case they fall back to byte accesses.
+ */
+static u32 at_xdmac_sg_dwidth(struct at_xdmac_chan *atchan, u32 len)
+{
+	u32 dwidth = at_xdmac_get_dwidth(atchan->cfg);
+
+	return IS_ALIGNED(len, 1 << dwidth) ? dwidth : AT_XDMAC_CC_DWIDTH_BYTE;
+}
+
+static bool at_xdmac_sg_fits_ublen(struct at_xdmac_chan *atchan, u32 len)
+{
+	return (len >> at_xdmac_sg_dwidth(atchan, len)) <=
+	       AT_XDMAC_MBR_UBC_UBLEN_MAX;
+}
+
+/* Set the microblock length and data width of a slave sg descriptor. */
+static void at_xdmac_sg_set_len(struct at_xdmac_chan *atchan,
+				struct at_xdmac_desc *desc, u32 len)
+{
+	u32 dwidth = at_xdmac_sg_dwidth(atchan, len);
+
+	desc->lld.mbr_ubc = AT_XDMAC_MBR_UBC_NDV2			/* next descriptor view */
+		| AT_XDMAC_MBR_UBC_NDEN					/* next descriptor dst parameter update */
+		| AT_XDMAC_MBR_UBC_NSEN					/* next descriptor src parameter update */
+		| (len >> dwidth);					/* microblock length */
+	desc->lld.mbr_cfg = (atchan->cfg & ~AT_XDMAC_CC_DWIDTH_MASK) |
+			    AT_XDMAC_CC_DWIDTH(dwidth);
+}
+
 static struct dma_async_tx_descriptor *
 at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 		       unsigned int sg_len, enum dma_transfer_direction direction,
@@ -640,6 +785,7 @@ at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 	struct scatterlist		*sg;
 	int				i;
 	unsigned int			xfer_size = 0;
+	u32				desc_len = 0, next_mem = 0;
 	unsigned long			irqflags;
 	struct dma_async_tx_descriptor	*ret = NULL;
 
@@ -665,7 +811,7 @@ at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 	/* Prepare descriptors. */
 	for_each_sg(sgl, sg, sg_len, i) {
 		struct at_xdmac_desc	*desc = NULL;
-		u32			len, mem, dwidth, fixed_dwidth;
+		u32			len, mem;
 
 		len = sg_dma_len(sg);
 		mem = sg_dma_address(sg);
@@ -676,11 +822,28 @@ at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 		dev_dbg(chan2dev(chan), "%s: * sg%d len=%u, mem=0x%08x\n",
 			 __func__, i, len, mem);
 
+		/*
+		 * Physically contiguous entries are folded into the previous
+		 * microblock as long as it stays within the maximum microblock
+		 * length, saving a descriptor fetch per merged entry.
+		 */
+		if (prev && mem == next_mem &&
+		    at_xdmac_sg_fits_ublen(atchan, desc_len + len)) {
+			desc_len += len;
+			next_mem += len;
+			at_xdmac_sg_set_len(atchan, prev, desc_len);
+			dev_dbg(chan2dev(chan),
+				 "%s: merge sg%d into desc 0x%p, mbr_ubc=0x%08x\n",
+				 __func__, i, prev, prev->lld.mbr_ubc);
+			xfer_size += len;
+			continue;
+		}
+
 		desc = at_xdmac_get_desc(atchan);
 		if (!desc) {
 			dev_err(chan2dev(chan), "can't get descriptor\n");
 			if (first)
-				list_splice_init(&first->descs_list, &atchan->free_descs_list);
+				at_xdmac_put_descs(atchan, &first->descs_list);
 			goto spin_unlock;
 		}
 
@@ -692,16 +855,7 @@ at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 			desc->lld.mbr_sa = mem;
 			desc->lld.mbr_da = atchan->sconfig.dst_addr;
 		}
-		dwidth = at_xdmac_get_dwidth(atchan->cfg);
-		fixed_dwidth = IS_ALIGNED(len, 1 << dwidth)
-			       ? dwidth
-			       : AT_XDMAC_CC_DWIDTH_BYTE;
-		desc->lld.mbr_ubc = AT_XDMAC_MBR_UBC_NDV2			/* next descriptor view */
-			| AT_XDMAC_MBR_UBC_NDEN					/* next descriptor dst parameter update */
-			| AT_XDMAC_MBR_UBC_NSEN					/* next descriptor src parameter update */
-			| (len >> fixed_dwidth);				/* microblock length */
-		desc->lld.mbr_cfg = (atchan->cfg & ~AT_XDMAC_CC_DWIDTH_MASK) |
-				    AT_XDMAC_CC_DWIDTH(fixed_dwidth);
+		at_xdmac_sg_set_len(atchan, desc, len);
 		dev_dbg(chan2dev(chan),
 			 "%s: lld: mbr_sa=%pad, mbr_da=%pad, mbr_ubc=0x%08x\n",
 			 __func__, &desc->lld.mbr_sa, &desc->lld.mbr_da, desc->lld.mbr_ubc);
@@ -713,6 +867,8 @@ at_xdmac_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 		prev = desc;
 		if (!first)
 			first = desc;
+		desc_len = len;
+		next_mem = mem + len;
 
 		dev_dbg(chan2dev(chan), "%s: add desc 0x%p to descs_list 0x%p\n",
 			 __func__, desc, first);
@@ -740,6 +896,8 @@ at_xdmac_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
 	struct at_xdmac_chan	*atchan = to_at_xdmac_chan(chan);
 	struct at_xdmac_desc	*first = NULL, *prev = NULL;
 	unsigned int		periods = buf_len / period_len;
+	unsigned int		coalesce;
+	size_t			len, max_len;
 	int			i;
 	unsigned long		irqflags;
 
@@ -760,7 +918,18 @@ at_xdmac_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
 	if (at_xdmac_compute_chan_conf(chan, direction))
 		return NULL;
 
-	for (i = 0; i < periods; i++) {
+	/*
+	 * The end of block interrupt comes at the end of each microblock:
+	 * periods are grouped in microblocks to get a callback every
+	 * periods_per_callback periods. The residue is still read from CUBC.
+	 */
+	coalesce = clamp_t(unsigned int, atchan->sconfig.periods_per_callback,
+			   1, periods);
+	max_len = AT_XDMAC_MBR_UBC_UBLEN_MAX << at_xdmac_get_dwidth(atchan->cfg);
+	if (coalesce * period_len > max_len)
+		coalesce = max_t(size_t, max_len / period_len, 1);
+
+	for (i = 0; i < periods; i += coalesce) {
 		struct at_xdmac_desc	*desc = NULL;
 
 		spin_lock_irqsave(&atchan->lock, irqflags);
@@ -768,7 +937,7 @@ at_xdmac_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
 		if (!desc) {
 			dev_err(chan2dev(chan), "can't get descriptor\n");
 			if (first)
-				list_splice_init(&first->descs_list, &atchan->free_descs_list);
+				at_xdmac_put_descs(atchan, &first->descs_list);
 			spin_unlock_irqrestore(&atchan->lock, irqflags);
 			return NULL;
 		}
@@ -777,6 +946,7 @@ at_xdmac_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
 			"%s: desc=0x%p, tx_dma_desc.phys=%pad\n",
 			__func__, desc, &desc->tx_dma_desc.phys);
 
+		len = min(coalesce, periods - i) * period_len;
 		if (direction == DMA_DEV_TO_MEM) {
 			desc->lld.mbr_sa = atchan->sconfig.src_addr;
 			desc->lld.mbr_da = buf_addr + i * period_len;
@@ -788,7 +958,7 @@ at_xdmac_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
 		desc->lld.mbr_ubc = AT_XDMAC_MBR_UBC_NDV1
 			| AT_XDMAC_MBR_UBC_NDEN
 			| AT_XDMAC_MBR_UBC_NSEN
-			| period_len >> at_xdmac_get_dwidth(desc->lld.mbr_cfg);
+			| len >> at_xdmac_get_dwidth(desc->lld.mbr_cfg);
 
 		dev_dbg(chan2dev(chan),
 			 "%s: lld: mbr_sa=%pad, mbr_da=%pad, mbr_ubc=0x%08x\n",
@@ -1000,8 +1170,7 @@ at_xdmac_prep_interleaved(struct dma_chan *chan,
 							       src_addr, dst_addr,
 							       xt, chunk);
 			if (!desc) {
-				list_splice_init(&first->descs_list,
-						 &atchan->free_descs_list);
+				at_xdmac_put_descs(atchan, &first->descs_list);
 				return NULL;
 			}
 
@@ -1079,7 +1248,7 @@ at_xdmac_prep_dma_memcpy(struct dma_chan *chan, dma_addr_t dest, dma_addr_t src,
 		if (!desc) {
 			dev_err(chan2dev(chan), "can't get descriptor\n");
 			if (first)
-				list_splice_init(&first->descs_list, &atchan->free_descs_list);
+				at_xdmac_put_descs(atchan, &first->descs_list);
 			return NULL;
 		}
 
@@ -1134,6 +1303,122 @@ at_xdmac_prep_dma_memcpy(struct dma_chan *chan, dma_addr_t dest, dma_addr_t src,
 	return &first->tx_dma_desc;
 }
 
+static struct dma_async_tx_descriptor *
+at_xdmac_prep_dma_sg(struct dma_chan *chan,
+		     struct scatterlist *dst_sg, unsigned int dst_nents,
+		     struct scatterlist *src_sg, unsigned int src_nents,
+		     unsigned long flags)
+{
+	struct at_xdmac_chan	*atchan = to_at_xdmac_chan(chan);
+	struct at_xdmac_desc	*first = NULL, *prev = NULL;
+	size_t			dst_len, src_len, xfer_size, len = 0;
+	dma_addr_t		dst_addr, src_addr;
+	u32			dwidth;
+	/* Same channel configuration as memcpy, see the comment there. */
+	u32			chan_cc = AT_XDMAC_CC_PERID(0x3f)
+					| AT_XDMAC_CC_DAM_INCREMENTED_AM
+					| AT_XDMAC_CC_SAM_INCREMENTED_AM
+					| AT_XDMAC_CC_DIF(0)
+					| AT_XDMAC_CC_SIF(0)
+					| AT_XDMAC_CC_MBSIZE_SIXTEEN
+					| AT_XDMAC_CC_TYPE_MEM_TRAN;
+	unsigned long		irqflags;
+
+	if (!dst_sg || !dst_nents || !src_sg || !src_nents)
+		return NULL;
+
+	dev_dbg(chan2dev(chan), "%s: dst_nents=%u, src_nents=%u, flags=0x%lx\n",
+		__func__, dst_nents, src_nents, flags);
+
+	dst_addr = sg_dma_address(dst_sg);
+	dst_len = sg_dma_len(dst_sg);
+	src_addr = sg_dma_address(src_sg);
+	src_len = sg_dma_len(src_sg);
+
+	/*
+	 * Walk both lists at the same time, each microblock covering the
+	 * largest chunk that is contiguous in both the source and destination
+	 * entries and that fits in the microblock length.
+	 */
+	while (true) {
+		struct at_xdmac_desc	*desc;
+
+		while (!dst_len) {
+			if (!--dst_nents)
+				goto done;
+			dst_sg = sg_next(dst_sg);
+			dst_addr = sg_dma_address(dst_sg);
+			dst_len = sg_dma_len(dst_sg);
+		}
+
+		while (!src_len) {
+			if (!--src_nents)
+				goto done;
+			src_sg = sg_next(src_sg);
+			src_addr = sg_dma_address(src_sg);
+			src_len = sg_dma_len(src_sg);
+		}
+
+		xfer_size = min(dst_len, src_len);
+		dwidth = at_xdmac_align_width(chan,
+					      src_addr | dst_addr | xfer_size);
+		if (xfer_size > AT_XDMAC_MBR_UBC_UBLEN_MAX << dwidth)
+			xfer_size = AT_XDMAC_MBR_UBC_UBLEN_MAX << dwidth;
+
+		spin_lock_irqsave(&atchan->lock, irqflags);
+		desc = at_xdmac_get_desc(atchan);
+		spin_unlock_irqrestore(&atchan->lock, irqflags);
+		if (!desc) {
+			dev_err(chan2dev(chan), "can't get descriptor\n");
+			if (first)
+				at_xdmac_put_descs(atchan, &first->descs_list);
+			return NULL;
+		}
+
+		chan_cc &= ~AT_XDMAC_CC_DWIDTH_MASK;
+		chan_cc |= AT_XDMAC_CC_DWIDTH(dwidth);
+
+		desc->lld.mbr_sa = src_addr;
+		desc->lld.mbr_da = dst_addr;
+		desc->lld.mbr_ubc = AT_XDMAC_MBR_UBC_NDV2
+			| AT_XDMAC_MBR_UBC_NDEN
+			| AT_XDMAC_MBR_UBC_NSEN
+			| (xfer_size >> dwidth);
+		desc->lld.mbr_cfg = chan_cc;
+
+		dev_dbg(chan2dev(chan),
+			 "%s: lld: mbr_sa=%pad, mbr_da=%pad, mbr_ubc=0x%08x, mbr_cfg=0x%08x\n",
+			 __func__, &desc->lld.mbr_sa, &desc->lld.mbr_da, desc->lld.mbr_ubc, desc->lld.mbr_cfg);
+
+		/* Chain lld. */
+		if (prev)
+			at_xdmac_queue_desc(chan, prev, desc);
+
+		prev = desc;
+		if (!first)
+			first = desc;
+
+		dev_dbg(chan2dev(chan), "%s: add desc 0x%p to descs_list 0x%p\n",
+			 __func__, desc, first);
+		list_add_tail(&desc->desc_node, &first->descs_list);
+
+		dst_addr += xfer_size;
+		dst_len -= xfer_size;
+		src_addr += xfer_size;
+		src_len -= xfer_size;
+		len += xfer_size;
+	}
+
+done:
+	if (!first)
+		return NULL;
+
+	first->tx_dma_desc.flags = flags;
+	first->xfer_size = len;
+
+	return &first->tx_dma_desc;
+}
+
 static struct at_xdmac_desc *at_xdmac_memset_create_desc(struct dma_chan *chan,
 							 struct at_xdmac_chan *atchan,
 							 dma_addr_t dst_addr,
@@ -1253,8 +1538,7 @@ at_xdmac_prep_dma_memset_sg(struct dma_chan *chan, struct scatterlist *sgl,
 						   sg_dma_len(sg),
 						   value);
 		if (!desc && first)
-			list_splice_init(&first->descs_list,
-					 &atchan->free_descs_list);
+			at_xdmac_put_descs(atchan, &first->descs_list);
 
 		if (!first)
 			first = desc;
@@ -1302,8 +1586,7 @@ at_xdmac_prep_dma_memset_sg(struct dma_chan *chan, struct scatterlist *sgl,
 				 * Put back the N-1 descriptor in the
 				 * free descriptor list
 				 */
-				list_add_tail(&pdesc->desc_node,
-					      &atchan->free_descs_list);
+				at_xdmac_put_desc(atchan, pdesc);
 
 				/*
 				 * Make our N-1 descriptor pointer
@@ -1365,8 +1648,7 @@ at_xdmac_prep_dma_memset_sg(struct dma_chan *chan, struct scatterlist *sgl,
 			 * Put back the N descriptor in the free
 			 * descriptor list
 			 */
-			list_add_tail(&desc->desc_node,
-				      &atchan->free_descs_list);
+			at_xdmac_put_desc(atchan, desc);
 		}
 
 		/* Update our descriptors */
@@ -1505,7 +1787,8 @@ at_xdmac_tx_status(struct dma_chan *chan, dma_cookie_t cookie,
 	/*
 	 * Remove size of all microblocks already transferred and the current
 	 * one. Then add the remaining size to transfer of the current
-	 * microblock.
+	 * microblock. A microblock may cover several merged sg entries, so
+	 * its size is always taken from the descriptor, never from the sg.
 	 */
 	descs_list = &desc->descs_list;
 	list_for_each_entry_safe(desc, _desc, descs_list, desc_node) {
@@ -1538,7 +1821,7 @@ static void at_xdmac_remove_xfer(struct at_xdmac_chan *atchan,
 	 * descriptors into the free descriptors list.
 	 */
 	list_del(&desc->xfer_node);
-	list_splice_init(&desc->descs_list, &atchan->free_descs_list);
+	at_xdmac_put_descs(atchan, &desc->descs_list);
 }
 
 static void at_xdmac_advance_work(struct at_xdmac_chan *atchan)
@@ -1564,16 +1847,22 @@ static void at_xdmac_advance_work(struct at_xdmac_chan *atchan)
 	spin_unlock_irqrestore(&atchan->lock, flags);
 }
 
+static void at_xdmac_callback(struct at_xdmac_desc *desc)
+{
+	struct dma_async_tx_descriptor	*txd = &desc->tx_dma_desc;
+
+	if (txd->callback && (txd->flags & DMA_PREP_INTERRUPT)) {
+		trace_dma_callback(txd->chan, txd->cookie, desc->xfer_size);
+		txd->callback(txd->callback_param);
+	}
+}
+
 static void at_xdmac_handle_cyclic(struct at_xdmac_chan *atchan)
 {
 	struct at_xdmac_desc		*desc;
-	struct dma_async_tx_descriptor	*txd;
 
 	desc = list_first_entry(&atchan->xfers_list, struct at_xdmac_desc, xfer_node);
-	txd = &desc->tx_dma_desc;
-
-	if (txd->callback && (txd->flags & DMA_PREP_INTERRUPT))
-		txd->callback(txd->callback_param);
+	at_xdmac_callback(desc);
 }
 
 static void at_xdmac_tasklet(unsigned long data)
@@ -1602,7 +1891,8 @@ static void at_xdmac_tasklet(unsigned long data)
 		if (atchan->status & AT_XDMAC_CIS_ROIS)
 			dev_err(chan2dev(&atchan->chan), "request overflow error!!!");
 
-		spin_lock_bh(&atchan->lock);
+		/* The interrupt handler takes the lock too, see below. */
+		spin_lock_irq(&atchan->lock);
 		desc = list_first_entry(&atchan->xfers_list,
 					struct at_xdmac_desc,
 					xfer_node);
@@ -1612,12 +1902,11 @@ static void at_xdmac_tasklet(unsigned long data)
 		txd = &desc->tx_dma_desc;
 
 		at_xdmac_remove_xfer(atchan, desc);
-		spin_unlock_bh(&atchan->lock);
+		spin_unlock_irq(&atchan->lock);
 
 		if (!at_xdmac_chan_is_cyclic(atchan)) {
 			dma_cookie_complete(txd);
-			if (txd->callback && (txd->flags & DMA_PREP_INTERRUPT))
-				txd->callback(txd->callback_param);
+			at_xdmac_callback(desc);
 		}
 
 		dma_run_dependencies(txd);
@@ -1626,6 +1915,58 @@ static void at_xdmac_tasklet(unsigned long data)
 	}
 }
 
+/*
+ * Transfers prepared with DMA_PREP_IRQ_CALLBACK are completed straight from
+ * the interrupt handler, saving the tasklet round trip for clients such as
+ * audio or SPI that only wake up a waiter. Errors still go through the
+ * tasklet. Returns true if the interrupt has been fully handled.
+ */
+static bool at_xdmac_irq_complete(struct at_xdmac_chan *atchan)
+{
+	struct at_xdmac_desc		*desc;
+	struct dma_async_tx_descriptor	*txd;
+
+	if (atchan->status & (AT_XDMAC_CIS_RBEIS | AT_XDMAC_CIS_WBEIS
+			      | AT_XDMAC_CIS_ROIS))
+		return false;
+
+	spin_lock(&atchan->lock);
+
+	if (list_empty(&atchan->xfers_list))
+		goto no_irq_callback;
+
+	desc = list_first_entry(&atchan->xfers_list, struct at_xdmac_desc,
+				xfer_node);
+	txd = &desc->tx_dma_desc;
+	if (!(txd->flags & DMA_PREP_IRQ_CALLBACK))
+		goto no_irq_callback;
+
+	if (at_xdmac_chan_is_cyclic(atchan)) {
+		spin_unlock(&atchan->lock);
+		at_xdmac_callback(desc);
+		return true;
+	}
+
+	if (!(atchan->status & AT_XDMAC_CIS_LIS) || !desc->active_xfer)
+		goto no_irq_callback;
+
+	at_xdmac_remove_xfer(atchan, desc);
+	spin_unlock(&atchan->lock);
+
+	dma_cookie_complete(txd);
+	at_xdmac_callback(desc);
+
+	dma_run_dependencies(txd);
+
+	at_xdmac_advance_work(atchan);
+
+	return true;
+
+no_irq_callback:
+	spin_unlock(&atchan->lock);
+	return false;
+}
+
 static irqreturn_t at_xdmac_interrupt(int irq, void *dev_id)
 {
 	struct at_xdmac		*atxdmac = (struct at_xdmac *)dev_id;
@@ -1655,6 +1996,7 @@ static irqreturn_t at_xdmac_interrupt(int irq, void *dev_id)
 			chan_imr = at_xdmac_chan_read(atchan, AT_XDMAC_CIM);
 			chan_status = at_xdmac_chan_read(atchan, AT_XDMAC_CIS);
 			atchan->status = chan_status & chan_imr;
+			trace_dma_irq(&atchan->chan, atchan->status);
 			dev_vdbg(atxdmac->dma.dev,
 				 "%s: chan%d: imr=0x%x, status=0x%x\n",
 				 __func__, i, chan_imr, chan_status);
@@ -1671,7 +2013,8 @@ static irqreturn_t at_xdmac_interrupt(int irq, void *dev_id)
 			if (atchan->status & (AT_XDMAC_CIS_RBEIS | AT_XDMAC_CIS_WBEIS))
 				at_xdmac_write(atxdmac, AT_XDMAC_GD, atchan->mask);
 
-			tasklet_schedule(&atchan->tasklet);
+			if (!at_xdmac_irq_complete(atchan))
+				tasklet_schedule(&atchan->tasklet);
 			ret = IRQ_HANDLED;
 		}
 
@@ -1685,6 +2028,7 @@ static void at_xdmac_issue_pending(struct dma_chan *chan)
 	struct at_xdmac_chan *atchan = to_at_xdmac_chan(chan);
 
 	dev_dbg(chan2dev(&atchan->chan), "%s\n", __func__);
+	trace_dma_issue_pending(chan);
 
 	if (!at_xdmac_chan_is_cyclic(atchan))
 		at_xdmac_advance_work(atchan);
@@ -1791,27 +2135,32 @@ static int at_xdmac_alloc_chan_resources(struct dma_chan *chan)
 		goto spin_unlock;
 	}
 
-	if (!list_empty(&atchan->free_descs_list)) {
+	if (!llist_empty(&atchan->free_descs)) {
 		dev_err(chan2dev(chan),
 			"can't allocate channel resources (channel not free from a previous use)\n");
 		i = -EIO;
 		goto spin_unlock;
 	}
 
+	dma_cookie_init(chan);
+
+	spin_unlock_irqrestore(&atchan->lock, flags);
+
+	/* The cache is not shared yet, fill it with sleeping allocations. */
 	for (i = 0; i < init_nr_desc_per_channel; i++) {
-		desc = at_xdmac_alloc_desc(chan, GFP_ATOMIC);
+		desc = at_xdmac_alloc_desc(chan, GFP_KERNEL);
 		if (!desc) {
 			dev_warn(chan2dev(chan),
 				"only %d descriptors have been allocated\n", i);
 			break;
 		}
-		list_add_tail(&desc->desc_node, &atchan->free_descs_list);
+		at_xdmac_put_desc(atchan, desc);
 	}
 
-	dma_cookie_init(chan);
-
 	dev_dbg(chan2dev(chan), "%s: allocated %d descriptors\n", __func__, i);
 
+	return i;
+
 spin_unlock:
 	spin_unlock_irqrestore(&atchan->lock, flags);
 	return i;
@@ -1822,11 +2171,20 @@ static void at_xdmac_free_chan_resources(struct dma_chan *chan)
 	struct at_xdmac_chan	*atchan = to_at_xdmac_chan(chan);
 	struct at_xdmac		*atxdmac = to_at_xdmac(chan->device);
 	struct at_xdmac_desc	*desc, *_desc;
+	struct llist_node	*node;
+
+	cancel_work_sync(&atchan->refill_work);
 
-	list_for_each_entry_safe(desc, _desc, &atchan->free_descs_list, desc_node) {
+	node = llist_del_all(&atchan->free_descs);
+	llist_for_each_entry_safe(desc, _desc, node, free_node) {
 		dev_dbg(chan2dev(chan), "%s: freeing descriptor %p\n", __func__, desc);
-		list_del(&desc->desc_node);
-		dma_pool_free(atxdmac->at_xdmac_desc_pool, desc, desc->tx_dma_desc.phys);
+		at_xdmac_free_desc(atxdmac, desc);
+	}
+	atomic_set(&atchan->nr_free_descs, 0);
+
+	if (atchan->prio) {
+		atchan->prio = 0;
+		at_xdmac_update_gwac(atxdmac);
 	}
 
 	return;
@@ -1895,6 +2253,7 @@ static int atmel_xdmac_resume(struct device *dev)
 			cpu_relax();
 	}
 
+	at_xdmac_write(atxdmac, AT_XDMAC_GWAC, atxdmac->gwac);
 	at_xdmac_write(atxdmac, AT_XDMAC_GIE, atxdmac->save_gim);
 	at_xdmac_write(atxdmac, AT_XDMAC_GE, atxdmac->save_gs);
 	list_for_each_entry_safe(chan, _chan, &atxdmac->dma.channels, device_node) {
@@ -1957,6 +2316,7 @@ static int at_xdmac_probe(struct platform_device *pdev)
 
 	atxdmac->regs = base;
 	atxdmac->irq = irq;
+	mutex_init(&atxdmac->gwac_lock);
 
 	atxdmac->clk = devm_clk_get(&pdev->dev, "dma_clk");
 	if (IS_ERR(atxdmac->clk)) {
@@ -1986,11 +2346,20 @@ static int at_xdmac_probe(struct platform_device *pdev)
 		goto err_clk_disable;
 	}
 
+	/*
+	 * The controller fetches a descriptor per microblock: from the SRAM,
+	 * these fetches don't compete with the transfers for the DDR. The
+	 * DDR pool takes over once the SRAM quota is used up.
+	 */
+	atxdmac->sram_pool = devm_atmel_sram_pool(&pdev->dev,
+				AT_XDMAC_SRAM_DESCS * sizeof(struct at_xdmac_desc));
+
 	dma_cap_set(DMA_CYCLIC, atxdmac->dma.cap_mask);
 	dma_cap_set(DMA_INTERLEAVE, atxdmac->dma.cap_mask);
 	dma_cap_set(DMA_MEMCPY, atxdmac->dma.cap_mask);
 	dma_cap_set(DMA_MEMSET, atxdmac->dma.cap_mask);
 	dma_cap_set(DMA_MEMSET_SG, atxdmac->dma.cap_mask);
+	dma_cap_set(DMA_SG, atxdmac->dma.cap_mask);
 	dma_cap_set(DMA_SLAVE, atxdmac->dma.cap_mask);
 	/*
 	 * Without DMA_PRIVATE the driver is not able to allocate more than
@@ -2007,6 +2376,7 @@ static int at_xdmac_probe(struct platform_device *pdev)
 	atxdmac->dma.device_prep_dma_memcpy		= at_xdmac_prep_dma_memcpy;
 	atxdmac->dma.device_prep_dma_memset		= at_xdmac_prep_dma_memset;
 	atxdmac->dma.device_prep_dma_memset_sg		= at_xdmac_prep_dma_memset_sg;
+	atxdmac->dma.device_prep_dma_sg			= at_xdmac_prep_dma_sg;
 	atxdmac->dma.device_prep_slave_sg		= at_xdmac_prep_slave_sg;
 	atxdmac->dma.device_config			= at_xdmac_device_config;
 	atxdmac->dma.device_pause			= at_xdmac_device_pause;
@@ -2020,6 +2390,9 @@ static int at_xdmac_probe(struct platform_device *pdev)
 	/* Disable all chans and interrupts. */
 	at_xdmac_off(atxdmac);
 
+	/* All pools are weighted equally until a channel asks otherwise. */
+	at_xdmac_write(atxdmac, AT_XDMAC_GWAC, atxdmac->gwac);
+
 	/* Init channels. */
 	INIT_LIST_HEAD(&atxdmac->dma.channels);
 	for (i = 0; i < nr_channels; i++) {
@@ -2034,7 +2407,9 @@ static int at_xdmac_probe(struct platform_device *pdev)
 
 		spin_lock_init(&atchan->lock);
 		INIT_LIST_HEAD(&atchan->xfers_list);
-		INIT_LIST_HEAD(&atchan->free_descs_list);
+		init_llist_head(&atchan->free_descs);
+		atomic_set(&atchan->nr_free_descs, 0);
+		INIT_WORK(&atchan->refill_work, at_xdmac_refill_work);
 		tasklet_init(&atchan->tasklet, at_xdmac_tasklet,
 			     (unsigned long)atchan);
 
@@ -63,6 +63,14 @@
 #include <linux/of_dma.h>
 #include <linux/mempool.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/dmaengine.h>
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(dma_tx_submit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dma_issue_pending);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dma_irq);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dma_callback);
+
 static DEFINE_MUTEX(dma_list_mutex);
 static DEFINE_IDR(dma_idr);
 static LIST_HEAD(dma_device_list);
@@ -10,16 +10,21 @@
  */
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
 #include <linux/dmaengine.h>
 #include <linux/freezer.h>
 #include <linux/init.h>
 #include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/random.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/wait.h>
 
 static unsigned int test_buf_size = 16384;
@@ -74,6 +79,16 @@ static bool verbose;
 module_param(verbose, bool, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(verbose, "Enable \"success\" result messages (default: off)");
 
+static bool benchmark;
+module_param(benchmark, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(benchmark,
+		"Sweep transfer sizes and offsets, report latencies in debugfs (default: off)");
+
+static unsigned int bench_runs = 100;
+module_param(bench_runs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bench_runs,
+		"Transfers per size and offset in benchmark mode (default: 100)");
+
 /**
  * struct dmatest_params - test parameters.
  * @buf_size:		size of the memcpy test buffer
@@ -85,6 +100,9 @@ MODULE_PARM_DESC(verbose, "Enable \"success\" result messages (default: off)");
  * @xor_sources:	number of xor source buffers
  * @pq_sources:		number of p+q source buffers
  * @timeout:		transfer timeout in msec, -1 for infinite timeout
+ * @noverify:		disable random data setup and verification
+ * @benchmark:		sweep sizes and offsets and record latencies
+ * @bench_runs:		transfers per benchmark point
  */
 struct dmatest_params {
 	unsigned int	buf_size;
@@ -97,6 +115,8 @@ struct dmatest_params {
 	unsigned int	pq_sources;
 	int		timeout;
 	bool		noverify;
+	bool		benchmark;
+	unsigned int	bench_runs;
 };
 
 /**
@@ -148,6 +168,34 @@ MODULE_PARM_DESC(run, "Run the test (default: false)");
 #define PATTERN_OVERWRITE	0x20
 #define PATTERN_COUNT_MASK	0x1f
 
+/* Source and destination offsets swept in benchmark mode */
+static const unsigned int dmatest_bench_offsets[] = { 0, 1, 2, 4, 8 };
+
+/* Log2 buckets of the submit to callback latency in ns */
+#define DMATEST_HIST_BUCKETS	32
+
+/**
+ * struct dmatest_bench_point - benchmark results for one size and offset
+ * @len:	transfer length
+ * @off:	source and destination offset in the test buffers
+ * @runs:	transfers attempted
+ * @samples:	transfers completed, whose latency was recorded
+ * @p50_ns:	median submit to callback latency
+ * @p99_ns:	99th percentile latency
+ * @max_ns:	worst latency
+ * @mbps:	throughput in MB/s over the time spent in the transfers
+ */
+struct dmatest_bench_point {
+	unsigned int	len;
+	unsigned int	off;
+	unsigned int	runs;
+	unsigned int	samples;
+	u64		p50_ns;
+	u64		p99_ns;
+	u64		max_ns;
+	u64		mbps;
+};
+
 struct dmatest_thread {
 	struct list_head	node;
 	struct dmatest_info	*info;
@@ -157,6 +205,13 @@ struct dmatest_thread {
 	u8			**dsts;
 	enum dma_transaction_type type;
 	bool			done;
+
+	/* benchmark mode only */
+	struct dmatest_bench_point *bench;
+	unsigned int		bench_count;
+	unsigned int		bench_done;
+	u64			*samples;
+	unsigned int		hist[DMATEST_HIST_BUCKETS];
 };
 
 struct dmatest_chan {
@@ -319,6 +374,7 @@ static unsigned int dmatest_verify(u8 **bufs, unsigned int start,
 /* poor man's completion - we want to use wait_event_freezable() on it */
 struct dmatest_done {
 	bool			done;
+	ktime_t			ts;
 	wait_queue_head_t	*wait;
 };
 
@@ -326,6 +382,7 @@ static void dmatest_callback(void *arg)
 {
 	struct dmatest_done *done = arg;
 
+	done->ts = ktime_get();
 	done->done = true;
 	wake_up_all(done->wait);
 }
@@ -382,6 +439,80 @@ static unsigned long long dmatest_KBs(s64 runtime, unsigned long long len)
 	return dmatest_persec(runtime, len >> 10);
 }
 
+static u8 dmatest_align(struct dma_device *dev, enum dma_transaction_type type)
+{
+	if (type == DMA_MEMCPY)
+		return dev->copy_align;
+	else if (type == DMA_XOR)
+		return dev->xor_align;
+	else if (type == DMA_PQ)
+		return dev->pq_align;
+	return 0;
+}
+
+/*
+ * Fill in the sizes and offsets a benchmark thread sweeps, if @bench is not
+ * NULL, and return their number. Sizes are the powers of two from the
+ * alignment of the operation up to the buffer size.
+ */
+static unsigned int dmatest_bench_points(struct dmatest_bench_point *bench,
+					 unsigned int buf_size, u8 align)
+{
+	unsigned int len, off, i, n = 0;
+
+	for (len = 1 << align; len && len <= buf_size; len <<= 1) {
+		for (i = 0; i < ARRAY_SIZE(dmatest_bench_offsets); i++) {
+			off = dmatest_bench_offsets[i];
+			if (off & ((1 << align) - 1) || off + len > buf_size)
+				continue;
+			if (bench) {
+				bench[n].len = len;
+				bench[n].off = off;
+			}
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static void dmatest_bench_record(struct dmatest_thread *thread,
+				 struct dmatest_bench_point *point, u64 ns)
+{
+	unsigned int bucket = ilog2(ns | 1);
+
+	thread->samples[point->samples++] = ns;
+	thread->hist[min(bucket, DMATEST_HIST_BUCKETS - 1)]++;
+}
+
+static int dmatest_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void dmatest_bench_finish(struct dmatest_bench_point *point,
+				 u64 *samples)
+{
+	unsigned int i, n = point->samples;
+	u64 total_ns = 0;
+
+	if (!n)
+		return;
+
+	sort(samples, n, sizeof(*samples), dmatest_cmp_u64, NULL);
+	for (i = 0; i < n; i++)
+		total_ns += samples[i];
+
+	point->p50_ns = samples[(n - 1) * 50 / 100];
+	point->p99_ns = samples[(n - 1) * 99 / 100];
+	point->max_ns = samples[n - 1];
+	/* bytes per ns * 1000 is MB/s */
+	if (total_ns)
+		point->mbps = div64_u64((u64)point->len * n * 1000, total_ns);
+}
+
 /*
  * This function repeatedly tests DMA transfers of various lengths and
  * offsets for a given operation type until it is told to exit by
@@ -416,9 +547,10 @@ static int dmatest_func(void *data)
 	int			src_cnt;
 	int			dst_cnt;
 	int			i;
-	ktime_t			ktime;
+	ktime_t			ktime, submit;
 	s64			runtime = 0;
 	unsigned long long	total_len = 0;
+	struct dmatest_bench_point *point = NULL;
 
 	set_freezable();
 
@@ -489,12 +621,7 @@ static int dmatest_func(void *data)
 		total_tests++;
 
 		/* honor alignment restrictions */
-		if (thread->type == DMA_MEMCPY)
-			align = dev->copy_align;
-		else if (thread->type == DMA_XOR)
-			align = dev->xor_align;
-		else if (thread->type == DMA_PQ)
-			align = dev->pq_align;
+		align = dmatest_align(dev, thread->type);
 
 		if (1 << align > params->buf_size) {
 			pr_err("%u-byte buffer too small for %d-byte alignment\n",
@@ -502,7 +629,20 @@ static int dmatest_func(void *data)
 			break;
 		}
 
-		if (params->noverify)
+		if (params->benchmark) {
+			point = &thread->bench[thread->bench_done];
+			if (point->runs == params->bench_runs) {
+				dmatest_bench_finish(point, thread->samples);
+				/* publish the point before counting it done */
+				smp_wmb();
+				thread->bench_done++;
+				if (thread->bench_done == thread->bench_count)
+					break;
+				point++;
+			}
+			point->runs++;
+			len = point->len;
+		} else if (params->noverify)
 			len = params->buf_size;
 		else
 			len = dmatest_random() % params->buf_size + 1;
@@ -513,7 +653,10 @@ static int dmatest_func(void *data)
 
 		total_len += len;
 
-		if (params->noverify) {
+		if (params->benchmark) {
+			src_off = point->off;
+			dst_off = point->off;
+		} else if (params->noverify) {
 			src_off = 0;
 			dst_off = 0;
 		} else {
@@ -522,7 +665,9 @@ static int dmatest_func(void *data)
 
 			src_off = (src_off >> align) << align;
 			dst_off = (dst_off >> align) << align;
+		}
 
+		if (!params->noverify) {
 			dmatest_init_srcs(thread->srcs, src_off, len,
 					  params->buf_size);
 			dmatest_init_dsts(thread->dsts, dst_off, len,
@@ -608,6 +753,7 @@ static int dmatest_func(void *data)
 		done.done = false;
 		tx->callback = dmatest_callback;
 		tx->callback_param = &done;
+		submit = ktime_get();
 		cookie = tx->tx_submit(tx);
 
 		if (dma_submit_error(cookie)) {
@@ -651,6 +797,10 @@ static int dmatest_func(void *data)
 
 		dmaengine_unmap_put(um);
 
+		if (params->benchmark)
+			dmatest_bench_record(thread, point,
+					     ktime_to_ns(ktime_sub(done.ts, submit)));
+
 		if (params->noverify) {
 			verbose_result("test passed", total_tests, src_off,
 				       dst_off, len, 0);
@@ -728,6 +878,8 @@ static void dmatest_cleanup_channel(struct dmatest_chan *dtc)
 			 thread->task->comm, ret);
 		list_del(&thread->node);
 		put_task_struct(thread->task);
+		kfree(thread->samples);
+		kfree(thread->bench);
 		kfree(thread);
 	}
 
@@ -737,6 +889,31 @@ static void dmatest_cleanup_channel(struct dmatest_chan *dtc)
 	kfree(dtc);
 }
 
+static int dmatest_bench_alloc(struct dmatest_thread *thread,
+			       struct dmatest_params *params)
+{
+	u8 align = dmatest_align(thread->chan->device, thread->type);
+
+	thread->bench_count = dmatest_bench_points(NULL, params->buf_size,
+						   align);
+	if (!thread->bench_count)
+		return 0;
+
+	thread->bench = kcalloc(thread->bench_count, sizeof(*thread->bench),
+				GFP_KERNEL);
+	thread->samples = kcalloc(params->bench_runs, sizeof(*thread->samples),
+				  GFP_KERNEL);
+	if (!thread->bench || !thread->samples) {
+		kfree(thread->samples);
+		kfree(thread->bench);
+		return -ENOMEM;
+	}
+
+	dmatest_bench_points(thread->bench, params->buf_size, align);
+
+	return 0;
+}
+
 static int dmatest_add_threads(struct dmatest_info *info,
 		struct dmatest_chan *dtc, enum dma_transaction_type type)
 {
@@ -765,12 +942,20 @@ static int dmatest_add_threads(struct dmatest_info *info,
 		thread->info = info;
 		thread->chan = dtc->chan;
 		thread->type = type;
+		if (params->benchmark && dmatest_bench_alloc(thread, params)) {
+			pr_warn("No memory for %s-%s%u benchmark\n",
+				dma_chan_name(chan), op, i);
+			kfree(thread);
+			break;
+		}
 		smp_wmb();
 		thread->task = kthread_create(dmatest_func, thread, "%s-%s%u",
 				dma_chan_name(chan), op, i);
 		if (IS_ERR(thread->task)) {
 			pr_warn("Failed to create thread %s-%s%u\n",
 				dma_chan_name(chan), op, i);
+			kfree(thread->samples);
+			kfree(thread->bench);
 			kfree(thread);
 			break;
 		}
@@ -874,6 +1059,8 @@ static void run_threaded_test(struct dmatest_info *info)
 	params->pq_sources = pq_sources;
 	params->timeout = timeout;
 	params->noverify = noverify;
+	params->benchmark = benchmark;
+	params->bench_runs = max(bench_runs, 1U);
 
 	request_channels(info, DMA_MEMCPY);
 	request_channels(info, DMA_XOR);
@@ -949,11 +1136,102 @@ static int dmatest_run_set(const char *val, const struct kernel_param *kp)
 	return ret;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *dmatest_debugfs;
+
+static void dmatest_bench_show_thread(struct seq_file *s,
+				      struct dmatest_thread *thread)
+{
+	struct dmatest_bench_point *point;
+	unsigned int i, done = READ_ONCE(thread->bench_done);
+
+	/* pairs with the barrier before bench_done is bumped */
+	smp_rmb();
+
+	seq_printf(s, "%s: %u/%u points\n", thread->task->comm, done,
+		   thread->bench_count);
+	seq_puts(s, "       len  off  samples    p50(ns)    p99(ns)    max(ns)    MB/s\n");
+	for (i = 0; i < done; i++) {
+		point = &thread->bench[i];
+		seq_printf(s, "%10u %4u %8u %10llu %10llu %10llu %7llu\n",
+			   point->len, point->off, point->samples,
+			   point->p50_ns, point->p99_ns, point->max_ns,
+			   point->mbps);
+	}
+
+	seq_puts(s, "latency histogram (ns):\n");
+	for (i = 0; i < DMATEST_HIST_BUCKETS; i++) {
+		if (!thread->hist[i])
+			continue;
+		seq_printf(s, "  [%10llu, %10llu) %u\n", 1ULL << i,
+			   2ULL << i, thread->hist[i]);
+	}
+}
+
+static int dmatest_results_show(struct seq_file *s, void *data)
+{
+	struct dmatest_info *info = s->private;
+	struct dmatest_thread *thread;
+	struct dmatest_chan *dtc;
+
+	mutex_lock(&info->lock);
+	list_for_each_entry(dtc, &info->channels, node) {
+		list_for_each_entry(thread, &dtc->threads, node) {
+			if (thread->bench)
+				dmatest_bench_show_thread(s, thread);
+		}
+	}
+	mutex_unlock(&info->lock);
+
+	return 0;
+}
+
+static int dmatest_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dmatest_results_show, inode->i_private);
+}
+
+static const struct file_operations dmatest_results_fops = {
+	.owner		= THIS_MODULE,
+	.open		= dmatest_results_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void dmatest_debugfs_init(struct dmatest_info *info)
+{
+	dmatest_debugfs = debugfs_create_dir("dmatest", NULL);
+	if (IS_ERR_OR_NULL(dmatest_debugfs)) {
+		dmatest_debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("results", S_IRUGO, dmatest_debugfs, info,
+			    &dmatest_results_fops);
+}
+
+static void dmatest_debugfs_exit(void)
+{
+	debugfs_remove_recursive(dmatest_debugfs);
+}
+#else
+static void dmatest_debugfs_init(struct dmatest_info *info)
+{
+}
+
+static void dmatest_debugfs_exit(void)
+{
+}
+#endif
+
 static int __init dmatest_init(void)
 {
 	struct dmatest_info *info = &test_info;
 	struct dmatest_params *params = &info->params;
 
+	dmatest_debugfs_init(info);
+
 	if (dmatest_run) {
 		mutex_lock(&info->lock);
 		run_threaded_test(info);
@@ -977,6 +1255,8 @@ static void __exit dmatest_exit(void)
 {
 	struct dmatest_info *info = &test_info;
 
+	dmatest_debugfs_exit();
+
 	mutex_lock(&info->lock);
 	stop_threaded_test(info);
 	mutex_unlock(&info->lock);
@@ -298,6 +298,8 @@ int gpiochip_add(struct gpio_chip *chip)
 		chip->base, chip->base + chip->ngpio - 1,
 		chip->label ? : "generic");
 
+	driver_deferred_probe_supplier(PROBE_DEFER_GPIO);
+
 	return 0;
 
 err_remove_chip:
@@ -2003,6 +2005,8 @@ struct gpio_desc *__must_check __gpiod_get_index(struct device *dev,
 
 	if (IS_ERR(desc)) {
 		dev_dbg(dev, "lookup for GPIO %s failed\n", con_id);
+		if (desc == ERR_PTR(-EPROBE_DEFER))
+			driver_deferred_probe_wait(dev, PROBE_DEFER_GPIO);
 		return desc;
 	}
 
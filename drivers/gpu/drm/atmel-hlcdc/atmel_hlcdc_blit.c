@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2014 Atmel
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+
+#include <drm/atmel_drm.h>
+
+#include "atmel_hlcdc_dc.h"
+
+/*
+ * 2D blitter: the SoCs with an HLCDC have no GPU, but their XDMAC copies
+ * rectangles with interleaved transfers, one microblock per line. Fills
+ * read the color from a fixed source address.
+ *
+ * Operations are synchronous and work on CMA GEM objects, which are
+ * write-combined: no cache maintenance is needed.
+ */
+
+/* The XDMAC block length is 12 bits wide: longer rectangles are split */
+#define ATMEL_HLCDC_BLIT_MAX_LINES	4096
+#define ATMEL_HLCDC_BLIT_TIMEOUT	msecs_to_jiffies(1000)
+
+struct atmel_hlcdc_blit_rect {
+	struct drm_gem_cma_object *obj;
+	dma_addr_t start;
+	size_t size;
+	u32 pitch;
+};
+
+void atmel_hlcdc_blit_init(struct atmel_hlcdc_dc *dc)
+{
+	mutex_init(&dc->blit.lock);
+}
+
+void atmel_hlcdc_blit_cleanup(struct drm_device *dev)
+{
+	struct atmel_hlcdc_dc *dc = dev->dev_private;
+
+	if (!dc->blit.chan)
+		return;
+
+	dma_release_channel(dc->blit.chan);
+	dma_free_coherent(dev->dev, sizeof(*dc->blit.pattern),
+			  dc->blit.pattern, dc->blit.pattern_dma);
+}
+
+/* The channel is requested on first use, so that probing doesn't need it */
+static int atmel_hlcdc_blit_get_chan(struct drm_device *dev)
+{
+	struct atmel_hlcdc_dc *dc = dev->dev_private;
+	dma_cap_mask_t mask;
+
+	if (dc->blit.chan)
+		return 0;
+
+	dc->blit.pattern = dma_alloc_coherent(dev->dev,
+					      sizeof(*dc->blit.pattern),
+					      &dc->blit.pattern_dma,
+					      GFP_KERNEL);
+	if (!dc->blit.pattern)
+		return -ENOMEM;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_INTERLEAVE, mask);
+	dc->blit.chan = dma_request_channel(mask, NULL, NULL);
+	if (!dc->blit.chan) {
+		dma_free_coherent(dev->dev, sizeof(*dc->blit.pattern),
+				  dc->blit.pattern, dc->blit.pattern_dma);
+		dc->blit.pattern = NULL;
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static int atmel_hlcdc_blit_get_rect(struct drm_device *dev,
+				     struct drm_file *file,
+				     struct drm_atmel_blit *args,
+				     u32 handle, u32 pitch, u32 x, u32 y,
+				     struct atmel_hlcdc_blit_rect *rect)
+{
+	struct drm_gem_object *gem;
+	u64 line = (u64)args->width * args->cpp;
+	u64 offset, end;
+
+	if (line > pitch)
+		return -EINVAL;
+
+	gem = drm_gem_object_lookup(dev, file, handle);
+	if (!gem)
+		return -ENOENT;
+
+	offset = (u64)y * pitch + (u64)x * args->cpp;
+	end = offset + (u64)(args->height - 1) * pitch + line;
+	if (end > gem->size) {
+		drm_gem_object_unreference_unlocked(gem);
+		return -EINVAL;
+	}
+
+	rect->obj = to_drm_gem_cma_obj(gem);
+	rect->start = rect->obj->paddr + offset;
+	rect->size = end - offset;
+	rect->pitch = pitch;
+
+	return 0;
+}
+
+static void atmel_hlcdc_blit_put_rect(struct atmel_hlcdc_blit_rect *rect)
+{
+	if (rect->obj)
+		drm_gem_object_unreference_unlocked(&rect->obj->base);
+}
+
+static void atmel_hlcdc_blit_done(void *arg)
+{
+	complete(arg);
+}
+
+static int atmel_hlcdc_blit_run(struct atmel_hlcdc_dc *dc,
+				struct drm_atmel_blit *args,
+				struct atmel_hlcdc_blit_rect *dst,
+				struct atmel_hlcdc_blit_rect *src)
+{
+	struct dma_chan *chan = dc->blit.chan;
+	struct dma_async_tx_descriptor *tx;
+	struct dma_interleaved_template *xt;
+	DECLARE_COMPLETION_ONSTACK(done);
+	dma_cookie_t cookie;
+	u32 line, lines;
+	int ret = 0;
+
+	xt = kzalloc(sizeof(*xt) + sizeof(xt->sgl[0]), GFP_KERNEL);
+	if (!xt)
+		return -ENOMEM;
+
+	xt->dir = DMA_MEM_TO_MEM;
+	xt->frame_size = 1;
+	xt->dst_inc = true;
+	xt->dst_sgl = true;
+	xt->sgl[0].size = args->width * args->cpp;
+	xt->sgl[0].dst_icg = dst->pitch - xt->sgl[0].size;
+	if (src) {
+		xt->src_inc = true;
+		xt->src_sgl = true;
+		xt->sgl[0].src_icg = src->pitch - xt->sgl[0].size;
+	} else {
+		xt->src_start = dc->blit.pattern_dma;
+	}
+
+	for (line = 0; line < args->height; line += lines) {
+		lines = min_t(u32, args->height - line,
+			      ATMEL_HLCDC_BLIT_MAX_LINES);
+
+		xt->numf = lines;
+		xt->dst_start = dst->start + line * dst->pitch;
+		if (src)
+			xt->src_start = src->start + line * src->pitch;
+
+		tx = dmaengine_prep_interleaved_dma(chan, xt,
+				line + lines == args->height ?
+				DMA_PREP_INTERRUPT : 0);
+		if (!tx) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (line + lines == args->height) {
+			tx->callback = atmel_hlcdc_blit_done;
+			tx->callback_param = &done;
+		}
+
+		cookie = dmaengine_submit(tx);
+		ret = dma_submit_error(cookie);
+		if (ret)
+			break;
+	}
+
+	kfree(xt);
+
+	if (ret) {
+		dmaengine_terminate_all(chan);
+		return ret;
+	}
+
+	dma_async_issue_pending(chan);
+
+	if (!wait_for_completion_timeout(&done, ATMEL_HLCDC_BLIT_TIMEOUT)) {
+		dmaengine_terminate_all(chan);
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+int atmel_hlcdc_blit_ioctl(struct drm_device *dev, void *data,
+			   struct drm_file *file)
+{
+	struct atmel_hlcdc_dc *dc = dev->dev_private;
+	struct drm_atmel_blit *args = data;
+	struct atmel_hlcdc_blit_rect dst = { }, src = { };
+	u64 color;
+	int ret;
+
+	if (args->pad || !args->width || !args->height)
+		return -EINVAL;
+
+	switch (args->op) {
+	case DRM_ATMEL_BLIT_COPY:
+		if (args->cpp < 1 || args->cpp > 4)
+			return -EINVAL;
+		break;
+	case DRM_ATMEL_BLIT_FILL:
+		/* The fill pattern is read by power of two data widths */
+		if (args->cpp != 1 && args->cpp != 2 && args->cpp != 4)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = atmel_hlcdc_blit_get_rect(dev, file, args, args->dst_handle,
+					args->dst_pitch, args->dst_x,
+					args->dst_y, &dst);
+	if (ret)
+		return ret;
+
+	if (args->op == DRM_ATMEL_BLIT_COPY) {
+		ret = atmel_hlcdc_blit_get_rect(dev, file, args,
+						args->src_handle,
+						args->src_pitch, args->src_x,
+						args->src_y, &src);
+		if (ret)
+			goto out;
+
+		/* The lines are copied forward: no overlap */
+		if (src.obj == dst.obj && src.start < dst.start + dst.size &&
+		    dst.start < src.start + src.size) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	mutex_lock(&dc->blit.lock);
+
+	ret = atmel_hlcdc_blit_get_chan(dev);
+	if (ret)
+		goto out_unlock;
+
+	if (args->op == DRM_ATMEL_BLIT_FILL) {
+		color = args->color;
+		if (args->cpp == 1)
+			color = (color & 0xff) * 0x0101010101010101ULL;
+		else if (args->cpp == 2)
+			color = (color & 0xffff) * 0x0001000100010001ULL;
+		else
+			color |= color << 32;
+		*dc->blit.pattern = color;
+
+		ret = atmel_hlcdc_blit_run(dc, args, &dst, NULL);
+	} else {
+		ret = atmel_hlcdc_blit_run(dc, args, &dst, &src);
+	}
+
+out_unlock:
+	mutex_unlock(&dc->blit.lock);
+out:
+	atmel_hlcdc_blit_put_rect(&src);
+	atmel_hlcdc_blit_put_rect(&dst);
+
+	return ret;
+}
@@ -24,6 +24,7 @@
 #include <linux/irqchip.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
 
 #include "atmel_hlcdc_dc.h"
 #include <drm/atmel_drm.h>
@@ -410,6 +411,9 @@ static irqreturn_t atmel_hlcdc_dc_irq_handler(int irq, void *data)
 	if (status & ATMEL_HLCDC_SOF)
 		atmel_hlcdc_crtc_irq(dc->crtc);
 
+	if (status & ATMEL_HLCDC_FIFOERR)
+		dc->underruns++;
+
 	for (i = 0; i < ATMEL_HLCDC_MAX_LAYERS; i++) {
 		struct atmel_hlcdc_layer *layer = dc->layers[i];
 
@@ -617,6 +621,7 @@ static int atmel_hlcdc_dc_load(struct drm_device *dev)
 		return -ENOMEM;
 
 	init_waitqueue_head(&dc->commit.wait);
+	atmel_hlcdc_blit_init(dc);
 	dc->desc = match->data;
 	dc->hlcdc = dev_get_drvdata(dev->dev->parent);
 	dev->dev_private = dc;
@@ -677,6 +682,7 @@ static void atmel_hlcdc_dc_unload(struct drm_device *dev)
 	if (dc->fbdev)
 		drm_fbdev_cma_fini(dc->fbdev);
 	flush_workqueue(dc->wq);
+	atmel_hlcdc_blit_cleanup(dev);
 	drm_kms_helper_poll_fini(dev);
 	drm_mode_config_cleanup(dev);
 	drm_vblank_cleanup(dev);
@@ -746,10 +752,10 @@ static void atmel_hlcdc_dc_lastclose(struct drm_device *dev)
 static int atmel_hlcdc_dc_irq_postinstall(struct drm_device *dev)
 {
 	struct atmel_hlcdc_dc *dc = dev->dev_private;
-	unsigned int cfg = 0;
+	unsigned int cfg = ATMEL_HLCDC_FIFOERR;
 	int i;
 
-	/* Enable interrupts on activated layers */
+	/* Enable FIFO error and interrupts on activated layers */
 	for (i = 0; i < ATMEL_HLCDC_MAX_LAYERS; i++) {
 		if (dc->layers[i])
 			cfg |= ATMEL_HLCDC_LAYER_STATUS(i);
@@ -829,9 +835,52 @@ int atmel_drm_gem_get_ioctl(struct drm_device *drm, void *data,
 
 	return 0;
 }
+#ifdef CONFIG_DEBUG_FS
+static int atmel_hlcdc_dc_stats_show(struct seq_file *m, void *arg)
+{
+	struct drm_info_node *node = m->private;
+	struct atmel_hlcdc_dc *dc = node->minor->dev->dev_private;
+	int i;
+
+	seq_printf(m, "underruns: %lu\n", dc->underruns);
+
+	for (i = 0; i < ATMEL_HLCDC_MAX_LAYERS; i++) {
+		struct atmel_hlcdc_layer *layer = dc->layers[i];
+
+		if (!layer)
+			continue;
+
+		seq_printf(m, "%s overruns: %lu\n", layer->desc->name,
+			   layer->overruns);
+	}
+
+	return 0;
+}
+
+static struct drm_info_list atmel_hlcdc_dc_debugfs_list[] = {
+	{ "stats", atmel_hlcdc_dc_stats_show, 0 },
+};
+
+static int atmel_hlcdc_dc_debugfs_init(struct drm_minor *minor)
+{
+	return drm_debugfs_create_files(atmel_hlcdc_dc_debugfs_list,
+					ARRAY_SIZE(atmel_hlcdc_dc_debugfs_list),
+					minor->debugfs_root, minor);
+}
+
+static void atmel_hlcdc_dc_debugfs_cleanup(struct drm_minor *minor)
+{
+	drm_debugfs_remove_files(atmel_hlcdc_dc_debugfs_list,
+				 ARRAY_SIZE(atmel_hlcdc_dc_debugfs_list),
+				 minor);
+}
+#endif
+
 static const struct drm_ioctl_desc atmel_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(ATMEL_GEM_GET, atmel_drm_gem_get_ioctl,
 			DRM_CONTROL_ALLOW|DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(ATMEL_BLIT, atmel_hlcdc_blit_ioctl,
+			DRM_AUTH|DRM_UNLOCKED),
 };
 
 
@@ -845,6 +894,10 @@ static struct drm_driver atmel_hlcdc_dc_driver = {
 	.irq_preinstall = atmel_hlcdc_dc_irq_uninstall,
 	.irq_postinstall = atmel_hlcdc_dc_irq_postinstall,
 	.irq_uninstall = atmel_hlcdc_dc_irq_uninstall,
+#ifdef CONFIG_DEBUG_FS
+	.debugfs_init = atmel_hlcdc_dc_debugfs_init,
+	.debugfs_cleanup = atmel_hlcdc_dc_debugfs_cleanup,
+#endif
 	.get_vblank_counter = drm_vblank_count,
 	.enable_vblank = atmel_hlcdc_dc_enable_vblank,
 	.disable_vblank = atmel_hlcdc_dc_disable_vblank,
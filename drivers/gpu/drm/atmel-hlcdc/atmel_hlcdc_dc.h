@@ -78,9 +78,13 @@ struct atmel_hlcdc_dc_desc {
  *
  * @alpha: alpha blending (or transparency) property
  * @rotation: rotation property
+ * @scaling_filter: scaler filter coefficients selection property
+ * @yuv_to_rgb: YUV to RGB color space conversion property
  */
 struct atmel_hlcdc_plane_properties {
 	struct drm_property *alpha;
+	struct drm_property *scaling_filter;
+	struct drm_property *yuv_to_rgb;
 };
 
 /**
@@ -140,6 +144,8 @@ struct atmel_hlcdc_planes {
  * @layers: active HLCDC layer
  * @wq: display controller workqueue
  * @commit: used for async commit handling
+ * @underruns: number of output FIFO underruns
+ * @blit: XDMAC channel and fill pattern of the 2D blitter
  */
 struct atmel_hlcdc_dc {
 	const struct atmel_hlcdc_dc_desc *desc;
@@ -153,6 +159,13 @@ struct atmel_hlcdc_dc {
 		wait_queue_head_t wait;
 		bool pending;
 	} commit;
+	unsigned long underruns;
+	struct {
+		struct mutex lock;
+		struct dma_chan *chan;
+		u64 *pattern;
+		dma_addr_t pattern_dma;
+	} blit;
 };
 
 extern struct atmel_hlcdc_formats atmel_hlcdc_plane_rgb_formats;
@@ -179,4 +192,9 @@ int atmel_hlcdc_crtc_create(struct drm_device *dev);
 
 int atmel_hlcdc_create_outputs(struct drm_device *dev);
 
+void atmel_hlcdc_blit_init(struct atmel_hlcdc_dc *dc);
+void atmel_hlcdc_blit_cleanup(struct drm_device *dev);
+int atmel_hlcdc_blit_ioctl(struct drm_device *dev, void *data,
+			   struct drm_file *file);
+
 #endif /* DRM_ATMEL_HLCDC_H */
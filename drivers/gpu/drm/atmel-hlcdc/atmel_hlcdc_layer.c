@@ -82,10 +82,18 @@ static void atmel_hlcdc_layer_update_reset(struct atmel_hlcdc_layer *layer,
 	}
 }
 
+static void atmel_hlcdc_layer_write(struct atmel_hlcdc_layer *layer,
+				    int *nwrites, unsigned int reg, u32 val)
+{
+	struct reg_default *write = &layer->writes[(*nwrites)++];
+
+	write->reg = layer->desc->regs_offset + reg;
+	write->def = val;
+}
+
 static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 {
 	struct atmel_hlcdc_layer_dma_channel *dma = &layer->dma;
-	const struct atmel_hlcdc_layer_desc *desc = layer->desc;
 	struct atmel_hlcdc_layer_update *upd = &layer->update;
 	struct regmap *regmap = layer->hlcdc->regmap;
 	struct atmel_hlcdc_layer_update_slot *slot;
@@ -93,6 +101,7 @@ static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 	struct atmel_hlcdc_dma_channel_dscr *dscr;
 	unsigned int cfg;
 	u32 action = 0;
+	int nwrites = 0;
 	int i = 0;
 
 	if (upd->pending < 0 || upd->pending > 1)
@@ -101,10 +110,13 @@ static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 	slot = &upd->slots[upd->pending];
 
 	for_each_set_bit(cfg, slot->updated_configs, layer->desc->nconfigs) {
-		regmap_write(regmap,
-			     desc->regs_offset +
-			     ATMEL_HLCDC_LAYER_CFG(layer, cfg),
-			     slot->configs[cfg]);
+		if (slot->configs[cfg] == layer->configs[cfg])
+			continue;
+
+		atmel_hlcdc_layer_write(layer, &nwrites,
+					ATMEL_HLCDC_LAYER_CFG(layer, cfg),
+					slot->configs[cfg]);
+		layer->configs[cfg] = slot->configs[cfg];
 		action |= ATMEL_HLCDC_LAYER_UPDATE;
 	}
 
@@ -121,18 +133,15 @@ static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 				     ATMEL_HLCDC_LAYER_ADD_IRQ |
 				     ATMEL_HLCDC_LAYER_DONE_IRQ;
 
-			regmap_write(regmap,
-				     desc->regs_offset +
-				     ATMEL_HLCDC_LAYER_PLANE_ADDR(i),
-				     dscr->addr);
-			regmap_write(regmap,
-				     desc->regs_offset +
-				     ATMEL_HLCDC_LAYER_PLANE_CTRL(i),
-				     dscr->ctrl);
-			regmap_write(regmap,
-				     desc->regs_offset +
-				     ATMEL_HLCDC_LAYER_PLANE_NEXT(i),
-				     dscr->next);
+			atmel_hlcdc_layer_write(layer, &nwrites,
+						ATMEL_HLCDC_LAYER_PLANE_ADDR(i),
+						dscr->addr);
+			atmel_hlcdc_layer_write(layer, &nwrites,
+						ATMEL_HLCDC_LAYER_PLANE_CTRL(i),
+						dscr->ctrl);
+			atmel_hlcdc_layer_write(layer, &nwrites,
+						ATMEL_HLCDC_LAYER_PLANE_NEXT(i),
+						dscr->next);
 		}
 
 		action |= ATMEL_HLCDC_LAYER_DMA_CHAN;
@@ -145,10 +154,9 @@ static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 				     ATMEL_HLCDC_LAYER_DSCR_IRQ |
 				     ATMEL_HLCDC_LAYER_DONE_IRQ;
 
-			regmap_write(regmap,
-				     desc->regs_offset +
-				     ATMEL_HLCDC_LAYER_PLANE_HEAD(i),
-				     dscr->next);
+			atmel_hlcdc_layer_write(layer, &nwrites,
+						ATMEL_HLCDC_LAYER_PLANE_HEAD(i),
+						dscr->next);
 		}
 
 		action |= ATMEL_HLCDC_LAYER_A2Q;
@@ -164,10 +172,13 @@ static void atmel_hlcdc_layer_update_apply(struct atmel_hlcdc_layer *layer)
 	slot->fb_flip = NULL;
 
 apply:
+	/* The channel enable goes last, once the channel is set up */
 	if (action)
-		regmap_write(regmap,
-			     desc->regs_offset + ATMEL_HLCDC_LAYER_CHER,
-			     action);
+		atmel_hlcdc_layer_write(layer, &nwrites,
+					ATMEL_HLCDC_LAYER_CHER, action);
+
+	if (nwrites)
+		regmap_multi_reg_write(regmap, layer->writes, nwrites);
 
 	atmel_hlcdc_layer_update_reset(layer, upd->pending);
 
@@ -196,6 +207,13 @@ void atmel_hlcdc_layer_irq(struct atmel_hlcdc_layer *layer)
 
 	spin_lock_irqsave(&layer->lock, flags);
 
+	for (i = 0; i < layer->max_planes; i++) {
+		if (status & (ATMEL_HLCDC_LAYER_OVR_IRQ << (8 * i))) {
+			layer->overruns++;
+			break;
+		}
+	}
+
 	flip = dma->queue ? dma->queue : dma->cur;
 
 	if (!flip) {
@@ -410,11 +428,22 @@ int atmel_hlcdc_layer_update_start(struct atmel_hlcdc_layer *layer)
 			drm_framebuffer_reference(slot->fb_flip->fb);
 		}
 	} else {
-		regmap_bulk_read(regmap,
-				 layer->desc->regs_offset +
-				 ATMEL_HLCDC_LAYER_CFG(layer, 0),
-				 upd->slots[upd->next].configs,
-				 layer->desc->nconfigs);
+		/*
+		 * The shadow copy is only loaded on the first update: some
+		 * config registers are initialized behind our back when the
+		 * plane is created.
+		 */
+		if (!layer->configs_valid) {
+			regmap_bulk_read(regmap,
+					 layer->desc->regs_offset +
+					 ATMEL_HLCDC_LAYER_CFG(layer, 0),
+					 layer->configs,
+					 layer->desc->nconfigs);
+			layer->configs_valid = true;
+		}
+
+		memcpy(slot->configs, layer->configs,
+		       layer->desc->nconfigs * sizeof(u32));
 	}
 
 	spin_unlock_irqrestore(&layer->lock, flags);
@@ -487,8 +516,11 @@ void atmel_hlcdc_layer_update_cfg(struct atmel_hlcdc_layer *layer, int cfg,
 		return;
 
 	slot = &upd->slots[upd->next];
-	slot->configs[cfg] &= ~mask;
-	slot->configs[cfg] |= (val & mask);
+	val = (slot->configs[cfg] & ~mask) | (val & mask);
+	if (val == slot->configs[cfg])
+		return;
+
+	slot->configs[cfg] = val;
 	set_bit(cfg, slot->updated_configs);
 }
 
@@ -579,11 +611,15 @@ static int atmel_hlcdc_layer_update_init(struct drm_device *dev,
 
 	buffer = devm_kzalloc(dev->dev,
 			      ((desc->nconfigs * sizeof(u32)) +
-				(updated_size * sizeof(unsigned long))) * 2,
+				(updated_size * sizeof(unsigned long))) * 2 +
+			      desc->nconfigs * sizeof(u32),
 			      GFP_KERNEL);
 	if (!buffer)
 		return -ENOMEM;
 
+	layer->configs = buffer;
+	buffer += desc->nconfigs * sizeof(u32);
+
 	for (i = 0; i < 2; i++) {
 		upd->slots[i].updated_configs = buffer;
 		buffer += updated_size * sizeof(unsigned long);
@@ -591,6 +627,13 @@ static int atmel_hlcdc_layer_update_init(struct drm_device *dev,
 		buffer += desc->nconfigs * sizeof(u32);
 	}
 
+	/* Config registers, plane descriptors and the channel enable */
+	layer->writes = devm_kcalloc(dev->dev,
+				     desc->nconfigs + layer->max_planes * 3 + 1,
+				     sizeof(*layer->writes), GFP_KERNEL);
+	if (!layer->writes)
+		return -ENOMEM;
+
 	upd->pending = -1;
 	upd->next = -1;
 
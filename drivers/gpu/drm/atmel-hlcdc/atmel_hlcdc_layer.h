@@ -229,6 +229,20 @@ enum atmel_hlcdc_layer_type {
 	ATMEL_HLCDC_PP_LAYER,
 };
 
+/**
+ * Atmel HLCDC Layer system bus interface selection
+ *
+ * @ATMEL_HLCDC_SIF_AUTO: balance the layer with the others on both AHB
+ *			  masters, depending on the bandwidth it needs
+ * @ATMEL_HLCDC_SIF0: always fetch through AHB master 0
+ * @ATMEL_HLCDC_SIF1: always fetch through AHB master 1
+ */
+enum atmel_hlcdc_layer_sif {
+	ATMEL_HLCDC_SIF_AUTO,
+	ATMEL_HLCDC_SIF0,
+	ATMEL_HLCDC_SIF1,
+};
+
 /**
  * Atmel HLCDC Supported formats structure
  *
@@ -256,6 +270,8 @@ struct atmel_hlcdc_formats {
  * @layout: config registers layout
  * @max_width: maximum width supported by this layer (0 means unlimited)
  * @max_height: maximum height supported by this layer (0 means unlimited)
+ * @dma_burst: DMA burst length in beats: 4, 8 or 16 (0 means 16)
+ * @sif: system bus interface the layer fetches its buffers through
  */
 struct atmel_hlcdc_layer_desc {
 	const char *name;
@@ -267,6 +283,8 @@ struct atmel_hlcdc_layer_desc {
 	struct atmel_hlcdc_layer_cfg_layout layout;
 	int max_width;
 	int max_height;
+	int dma_burst;
+	enum atmel_hlcdc_layer_sif sif;
 };
 
 /**
@@ -355,6 +373,12 @@ struct atmel_hlcdc_layer_dma_channel {
  * @dma: dma channel
  * @gc: fb flip garbage collector
  * @update: update handler
+ * @configs: shadow copy of the config registers, so that updates don't have
+ *	     to read them back nor write the unchanged ones
+ * @configs_valid: whether @configs has been loaded from the hardware
+ * @writes: register writes of an update, issued at once so that the regmap
+ *	    lock is only taken once per update
+ * @overruns: number of DMA overflows reported by the layer
  * @lock: layer lock
  */
 struct atmel_hlcdc_layer {
@@ -365,6 +389,10 @@ struct atmel_hlcdc_layer {
 	struct drm_flip_work gc;
 	struct atmel_hlcdc_layer_dma_channel dma;
 	struct atmel_hlcdc_layer_update update;
+	u32 *configs;
+	bool configs_valid;
+	struct reg_default *writes;
+	unsigned long overruns;
 	spinlock_t lock;
 };
 
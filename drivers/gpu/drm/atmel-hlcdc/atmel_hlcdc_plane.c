@@ -32,6 +32,10 @@
  * @src_w: buffer width
  * @src_h: buffer height
  * @alpha: alpha blending of the plane
+ * @scaling_filter: scaler filter coefficients (see enum
+ *		    atmel_hlcdc_scaling_filter)
+ * @yuv_to_rgb: color space conversion matrix applied to YUV formats (see
+ *		enum atmel_hlcdc_yuv_to_rgb)
  * @bpp: bytes per pixel deduced from pixel_format
  * @offsets: offsets to apply to the GEM buffers
  * @xstride: value to add to the pixel pointer between each line
@@ -50,6 +54,8 @@ struct atmel_hlcdc_plane_state {
 	uint32_t src_h;
 
 	u8 alpha;
+	u8 scaling_filter;
+	u8 yuv_to_rgb;
 
 	bool disc_updated;
 
@@ -76,6 +82,41 @@ drm_plane_state_to_atmel_hlcdc_plane_state(struct drm_plane_state *s)
 
 #define SUBPIXEL_MASK			0xffff
 
+enum atmel_hlcdc_scaling_filter {
+	ATMEL_HLCDC_SCALING_AUTO,
+	ATMEL_HLCDC_SCALING_SMOOTH,
+	ATMEL_HLCDC_SCALING_NEAREST,
+};
+
+static const struct drm_prop_enum_list atmel_hlcdc_scaling_filters[] = {
+	{ ATMEL_HLCDC_SCALING_AUTO, "auto" },
+	{ ATMEL_HLCDC_SCALING_SMOOTH, "smooth" },
+	{ ATMEL_HLCDC_SCALING_NEAREST, "nearest" },
+};
+
+enum atmel_hlcdc_yuv_to_rgb {
+	ATMEL_HLCDC_CSC_BT601,
+	ATMEL_HLCDC_CSC_BT601_FULL,
+	ATMEL_HLCDC_CSC_BT709,
+};
+
+static const struct drm_prop_enum_list atmel_hlcdc_yuv_to_rgb_list[] = {
+	{ ATMEL_HLCDC_CSC_BT601, "BT.601" },
+	{ ATMEL_HLCDC_CSC_BT601_FULL, "BT.601 full range" },
+	{ ATMEL_HLCDC_CSC_BT709, "BT.709" },
+};
+
+/*
+ * One config word per output component (R, G then B), each holding the Y, U
+ * and V factors as 10 bits signed 1/128 fixed point values, and the offset
+ * (16 for Y, 128 for U and V) to remove from the Y, U or V input at bit 30.
+ */
+static const u32 atmel_hlcdc_csc_coeffs[][3] = {
+	[ATMEL_HLCDC_CSC_BT601] = { 0x4c900091, 0x7a5f5090, 0x40040890 },
+	[ATMEL_HLCDC_CSC_BT601_FULL] = { 0x0b300080, 0x7a5f5080, 0x40038c80 },
+	[ATMEL_HLCDC_CSC_BT709] = { 0x4e600095, 0x7bcf9495, 0x40043895 },
+};
+
 static uint32_t rgb_formats[] = {
 	DRM_FORMAT_XRGB4444,
 	DRM_FORMAT_ARGB4444,
@@ -257,6 +298,51 @@ static u32 heo_upscaling_ycoef[] = {
 	0x00205907,
 };
 
+/* All the phases use the center tap only */
+static u32 heo_nearest_xcoef[] = {
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+	0x00800000,
+	0x00000000,
+};
+
+static u32 heo_nearest_ycoef[] = {
+	0x00008000,
+	0x00008000,
+	0x00008000,
+	0x00008000,
+	0x00008000,
+	0x00008000,
+	0x00008000,
+	0x00008000,
+};
+
+static u32 atmel_hlcdc_plane_scaler_factor(unsigned int src,
+					   unsigned int crtc)
+{
+	u32 factor, max_memsize;
+
+	factor = ((8 * 256 * src) - (256 * 4)) / crtc;
+	factor++;
+	max_memsize = ((factor * crtc) + (256 * 4)) / 2048;
+	if (max_memsize > src)
+		factor--;
+
+	return factor;
+}
+
 static void
 atmel_hlcdc_plane_update_pos_and_size(struct atmel_hlcdc_plane *plane,
 				      struct atmel_hlcdc_plane_state *state)
@@ -285,58 +371,58 @@ atmel_hlcdc_plane_update_pos_and_size(struct atmel_hlcdc_plane *plane,
 					     state->crtc_x |
 					     (state->crtc_y  << 16));
 
-	/* TODO: rework the rescaling part */
+	/* Only the HEO layer has a scaler */
+	if (!layout->memsize)
+		return;
+
 	if (state->crtc_w != state->src_w || state->crtc_h != state->src_h) {
 		u32 factor_reg = 0;
 
 		if (state->crtc_w != state->src_w) {
 			int i;
-			u32 factor;
 			u32 *coeff_tab = heo_upscaling_xcoef;
-			u32 max_memsize;
 
-			if (state->crtc_w < state->src_w)
+			if (state->scaling_filter == ATMEL_HLCDC_SCALING_NEAREST)
+				coeff_tab = heo_nearest_xcoef;
+			else if (state->crtc_w < state->src_w ||
+				 state->scaling_filter ==
+				 ATMEL_HLCDC_SCALING_SMOOTH)
 				coeff_tab = heo_downscaling_xcoef;
 			for (i = 0; i < ARRAY_SIZE(heo_upscaling_xcoef); i++)
 				atmel_hlcdc_layer_update_cfg(&plane->layer,
 							     17 + i,
 							     0xffffffff,
 							     coeff_tab[i]);
-			factor = ((8 * 256 * state->src_w) - (256 * 4)) /
-				 state->crtc_w;
-			factor++;
-			max_memsize = ((factor * state->crtc_w) + (256 * 4)) /
-				      2048;
-			if (max_memsize > state->src_w)
-				factor--;
-			factor_reg |= factor | 0x80000000;
+			factor_reg |= atmel_hlcdc_plane_scaler_factor(
+						state->src_w, state->crtc_w) |
+				      0x80000000;
 		}
 
 		if (state->crtc_h != state->src_h) {
 			int i;
-			u32 factor;
 			u32 *coeff_tab = heo_upscaling_ycoef;
-			u32 max_memsize;
 
-			if (state->crtc_w < state->src_w)
+			if (state->scaling_filter == ATMEL_HLCDC_SCALING_NEAREST)
+				coeff_tab = heo_nearest_ycoef;
+			else if (state->crtc_h < state->src_h ||
+				 state->scaling_filter ==
+				 ATMEL_HLCDC_SCALING_SMOOTH)
 				coeff_tab = heo_downscaling_ycoef;
 			for (i = 0; i < ARRAY_SIZE(heo_upscaling_ycoef); i++)
 				atmel_hlcdc_layer_update_cfg(&plane->layer,
 							     33 + i,
 							     0xffffffff,
 							     coeff_tab[i]);
-			factor = ((8 * 256 * state->src_w) - (256 * 4)) /
-				 state->crtc_w;
-			factor++;
-			max_memsize = ((factor * state->crtc_w) + (256 * 4)) /
-				      2048;
-			if (max_memsize > state->src_w)
-				factor--;
-			factor_reg |= (factor << 16) | 0x80000000;
+			factor_reg |= (atmel_hlcdc_plane_scaler_factor(
+						state->src_h, state->crtc_h) <<
+				       16) | 0x80000000;
 		}
 
 		atmel_hlcdc_layer_update_cfg(&plane->layer, 13, 0xffffffff,
 					     factor_reg);
+	} else {
+		/* Don't keep scaling once back to a 1:1 ratio */
+		atmel_hlcdc_layer_update_cfg(&plane->layer, 13, 0xffffffff, 0);
 	}
 }
 
@@ -347,6 +433,7 @@ atmel_hlcdc_plane_update_general_settings(struct atmel_hlcdc_plane *plane,
 	const struct atmel_hlcdc_layer_cfg_layout *layout =
 						&plane->layer.desc->layout;
 	unsigned int cfg = ATMEL_HLCDC_LAYER_DMA;
+	unsigned int dma_cfg;
 
 	if (plane->base.type != DRM_PLANE_TYPE_PRIMARY) {
 		cfg |= ATMEL_HLCDC_LAYER_OVR | ATMEL_HLCDC_LAYER_ITER2BL |
@@ -359,12 +446,23 @@ atmel_hlcdc_plane_update_general_settings(struct atmel_hlcdc_plane *plane,
 			       ATMEL_HLCDC_LAYER_GA(state->alpha);
 	}
 
+	switch (plane->layer.desc->dma_burst) {
+	case 4:
+		dma_cfg = ATMEL_HLCDC_LAYER_DMA_BLEN_INCR4;
+		break;
+	case 8:
+		dma_cfg = ATMEL_HLCDC_LAYER_DMA_BLEN_INCR8;
+		break;
+	default:
+		dma_cfg = ATMEL_HLCDC_LAYER_DMA_BLEN_INCR16;
+		break;
+	}
+
 	atmel_hlcdc_layer_update_cfg(&plane->layer,
 				     ATMEL_HLCDC_LAYER_DMA_CFG_ID,
 				     ATMEL_HLCDC_LAYER_DMA_BLEN_MASK |
 				     ATMEL_HLCDC_LAYER_DMA_SIF,
-				     ATMEL_HLCDC_LAYER_DMA_BLEN_INCR16 |
-				     state->ahb_id);
+				     dma_cfg | state->ahb_id);
 
 	atmel_hlcdc_layer_update_cfg(&plane->layer, layout->general_config,
 				     ATMEL_HLCDC_LAYER_ITER2BL |
@@ -397,6 +495,16 @@ static void atmel_hlcdc_plane_update_format(struct atmel_hlcdc_plane *plane,
 				     0xffffffff,
 				     cfg);
 
+	if (plane->layer.desc->layout.csc) {
+		const u32 *coeffs = atmel_hlcdc_csc_coeffs[state->yuv_to_rgb];
+		int i;
+
+		for (i = 0; i < ARRAY_SIZE(atmel_hlcdc_csc_coeffs[0]); i++)
+			atmel_hlcdc_layer_update_cfg(&plane->layer,
+					plane->layer.desc->layout.csc + i,
+					0xffffffff, coeffs[i]);
+	}
+
 	/*
 	 * Rotation optimization is not working on RGB888 (rotation is still
 	 * working but without any optimization).
@@ -412,15 +520,26 @@ static void atmel_hlcdc_plane_update_format(struct atmel_hlcdc_plane *plane,
 }
 
 static void atmel_hlcdc_plane_update_buffers(struct atmel_hlcdc_plane *plane,
-					struct atmel_hlcdc_plane_state *state)
+					struct atmel_hlcdc_plane_state *state,
+					struct atmel_hlcdc_plane_state *old)
 {
 	struct atmel_hlcdc_layer *layer = &plane->layer;
 	const struct atmel_hlcdc_layer_cfg_layout *layout =
 							&layer->desc->layout;
 	int i;
 
-	atmel_hlcdc_layer_update_set_fb(&plane->layer, state->base.fb,
-					state->offsets);
+	/*
+	 * Moving a plane (typically the cursor) without changing what it
+	 * scans out must not queue a new DMA descriptor: the layer would
+	 * refetch the same buffer and the update would wait for the frame
+	 * end instead of only touching the position registers.
+	 */
+	if (!old || old->base.fb != state->base.fb ||
+	    old->nplanes != state->nplanes ||
+	    memcmp(old->offsets, state->offsets,
+		   state->nplanes * sizeof(state->offsets[0])))
+		atmel_hlcdc_layer_update_set_fb(&plane->layer, state->base.fb,
+						state->offsets);
 
 	for (i = 0; i < state->nplanes; i++) {
 		if (layout->xstride[i]) {
@@ -439,17 +558,22 @@ static void atmel_hlcdc_plane_update_buffers(struct atmel_hlcdc_plane *plane,
 	}
 }
 
-int atmel_hlcdc_plane_prepare_ahb_routing(struct drm_crtc_state *c_state)
+static int atmel_hlcdc_plane_route_ahb(struct drm_crtc_state *c_state,
+				       unsigned int *ahb_load, bool fixed)
 {
-	unsigned int ahb_load[2] = { };
 	struct drm_plane *plane;
 
 	drm_atomic_crtc_state_for_each_plane(plane, c_state) {
 		struct atmel_hlcdc_plane_state *plane_state;
+		const struct atmel_hlcdc_layer_desc *desc;
 		struct drm_plane_state *plane_s;
 		unsigned int pixels, load = 0;
 		int i;
 
+		desc = drm_plane_to_atmel_hlcdc_plane(plane)->layer.desc;
+		if (fixed != (desc->sif != ATMEL_HLCDC_SIF_AUTO))
+			continue;
+
 		plane_s = drm_atomic_get_plane_state(c_state->state, plane);
 		if (IS_ERR(plane_s))
 			return PTR_ERR(plane_s);
@@ -463,7 +587,11 @@ int atmel_hlcdc_plane_prepare_ahb_routing(struct drm_crtc_state *c_state)
 		for (i = 0; i < plane_state->nplanes; i++)
 			load += pixels * plane_state->bpp[i];
 
-		if (ahb_load[0] <= ahb_load[1])
+		if (desc->sif == ATMEL_HLCDC_SIF0)
+			plane_state->ahb_id = 0;
+		else if (desc->sif == ATMEL_HLCDC_SIF1)
+			plane_state->ahb_id = 1;
+		else if (ahb_load[0] <= ahb_load[1])
 			plane_state->ahb_id = 0;
 		else
 			plane_state->ahb_id = 1;
@@ -474,6 +602,22 @@ int atmel_hlcdc_plane_prepare_ahb_routing(struct drm_crtc_state *c_state)
 	return 0;
 }
 
+int atmel_hlcdc_plane_prepare_ahb_routing(struct drm_crtc_state *c_state)
+{
+	unsigned int ahb_load[2] = { };
+	int ret;
+
+	/*
+	 * Layers pinned on one AHB master are accounted first, so that the
+	 * other ones are balanced against what is left.
+	 */
+	ret = atmel_hlcdc_plane_route_ahb(c_state, ahb_load, true);
+	if (ret)
+		return ret;
+
+	return atmel_hlcdc_plane_route_ahb(c_state, ahb_load, false);
+}
+
 int
 atmel_hlcdc_plane_prepare_disc_area(struct drm_crtc_state *c_state)
 {
@@ -783,14 +927,20 @@ static void atmel_hlcdc_plane_atomic_update(struct drm_plane *p,
 	struct atmel_hlcdc_plane *plane = drm_plane_to_atmel_hlcdc_plane(p);
 	struct atmel_hlcdc_plane_state *state =
 			drm_plane_state_to_atmel_hlcdc_plane_state(p->state);
+	struct atmel_hlcdc_plane_state *old = NULL;
 
 	if (!p->state->crtc || !p->state->fb)
 		return;
 
+	/* Only a running DMA channel still scans out the old framebuffer */
+	if (old_s && old_s->crtc && old_s->fb &&
+	    plane->layer.dma.status == ATMEL_HLCDC_LAYER_ENABLED)
+		old = drm_plane_state_to_atmel_hlcdc_plane_state(old_s);
+
 	atmel_hlcdc_plane_update_pos_and_size(plane, state);
 	atmel_hlcdc_plane_update_general_settings(plane, state);
 	atmel_hlcdc_plane_update_format(plane, state);
-	atmel_hlcdc_plane_update_buffers(plane, state);
+	atmel_hlcdc_plane_update_buffers(plane, state, old);
 	atmel_hlcdc_plane_update_disc_area(plane, state);
 
 	atmel_hlcdc_layer_update_commit(&plane->layer);
@@ -830,6 +980,10 @@ static int atmel_hlcdc_plane_atomic_set_property(struct drm_plane *p,
 
 	if (property == props->alpha)
 		state->alpha = val;
+	else if (property == props->scaling_filter)
+		state->scaling_filter = val;
+	else if (property == props->yuv_to_rgb)
+		state->yuv_to_rgb = val;
 	else
 		return -EINVAL;
 
@@ -848,6 +1002,10 @@ static int atmel_hlcdc_plane_atomic_get_property(struct drm_plane *p,
 
 	if (property == props->alpha)
 		*val = state->alpha;
+	else if (property == props->scaling_filter)
+		*val = state->scaling_filter;
+	else if (property == props->yuv_to_rgb)
+		*val = state->yuv_to_rgb;
 	else
 		return -EINVAL;
 
@@ -878,24 +1036,17 @@ static void atmel_hlcdc_plane_init_properties(struct atmel_hlcdc_plane *plane,
 				plane->base.dev->mode_config.rotation_property,
 				BIT(DRM_ROTATE_0));
 
-	if (desc->layout.csc) {
-		/*
-		 * TODO: decare a "yuv-to-rgb-conv-factors" property to let
-		 * userspace modify these factors (using a BLOB property ?).
-		 */
-		regmap_write(regmap,
-			     desc->regs_offset +
-			     ATMEL_HLCDC_LAYER_CSC_CFG(&plane->layer, 0),
-			     0x4c900091);
-		regmap_write(regmap,
-			     desc->regs_offset +
-			     ATMEL_HLCDC_LAYER_CSC_CFG(&plane->layer, 1),
-			     0x7a5f5090);
-		regmap_write(regmap,
-			     desc->regs_offset +
-			     ATMEL_HLCDC_LAYER_CSC_CFG(&plane->layer, 2),
-			     0x40040890);
-	}
+	/* Only the HEO layer has a scaler */
+	if (desc->layout.memsize)
+		drm_object_attach_property(&plane->base.base,
+					   props->scaling_filter,
+					   ATMEL_HLCDC_SCALING_AUTO);
+
+	/* The matrix is loaded with the formats, see update_format() */
+	if (desc->layout.csc)
+		drm_object_attach_property(&plane->base.base,
+					   props->yuv_to_rgb,
+					   ATMEL_HLCDC_CSC_BT601);
 }
 
 static struct drm_plane_helper_funcs atmel_hlcdc_layer_plane_helper_funcs = {
@@ -1024,6 +1175,20 @@ atmel_hlcdc_plane_create_properties(struct drm_device *dev)
 	if (!props->alpha)
 		return ERR_PTR(-ENOMEM);
 
+	props->scaling_filter =
+		drm_property_create_enum(dev, 0, "scaling-filter",
+					 atmel_hlcdc_scaling_filters,
+					 ARRAY_SIZE(atmel_hlcdc_scaling_filters));
+	if (!props->scaling_filter)
+		return ERR_PTR(-ENOMEM);
+
+	props->yuv_to_rgb =
+		drm_property_create_enum(dev, 0, "yuv-to-rgb",
+					 atmel_hlcdc_yuv_to_rgb_list,
+					 ARRAY_SIZE(atmel_hlcdc_yuv_to_rgb_list));
+	if (!props->yuv_to_rgb)
+		return ERR_PTR(-ENOMEM);
+
 	dev->mode_config.rotation_property =
 			drm_mode_create_rotation_property(dev,
 							  BIT(DRM_ROTATE_0) |
@@ -87,6 +87,8 @@
 #define	AT91_TWI_ACR		0x0040	/* Alternative Command Register */
 #define	AT91_TWI_ACR_DATAL(len)	((len) & 0xff)
 #define	AT91_TWI_ACR_DIR	BIT(8)
+#define	AT91_TWI_ACR_NDATAL(len)	(((len) & 0xff) << 16)
+#define	AT91_TWI_ACR_NDIR	BIT(24)
 
 #define	AT91_TWI_FMR		0x0050	/* FIFO Mode Register */
 #define	AT91_TWI_FMR_TXRDYM(mode)	(((mode) & 0x3) << 0)
@@ -98,6 +100,8 @@
 #define	AT91_TWI_FOUR_DATA	0x2
 
 #define	AT91_TWI_FLR		0x0054	/* FIFO Level Register */
+#define	AT91_TWI_FLR_TXFL(flr)	((flr) & 0x3f)
+#define	AT91_TWI_FLR_RXFL(flr)	(((flr) >> 16) & 0x3f)
 
 #define	AT91_TWI_FSR		0x0060	/* FIFO Status Register */
 #define	AT91_TWI_FIER		0x0064	/* FIFO Interrupt Enable Register */
@@ -132,6 +136,7 @@ struct at91_twi_dev {
 	u8 *buf;
 	size_t buf_len;
 	struct i2c_msg *msg;
+	struct i2c_msg *next_msg;
 	int irq;
 	unsigned imr;
 	unsigned transfer_status;
@@ -252,6 +257,55 @@ static void at91_twi_write_next_byte(struct at91_twi_dev *dev)
 	++dev->buf;
 }
 
+static void at91_twi_set_rx_threshold(struct at91_twi_dev *dev);
+static void at91_twi_write_data(struct at91_twi_dev *dev);
+
+/*
+ * Switch to the message queued as the next command in ACR: the controller
+ * chains it with a repeated start on its own, we only have to feed or
+ * drain its bytes.
+ */
+static void at91_twi_next_msg(struct at91_twi_dev *dev)
+{
+	struct i2c_msg *msg = dev->next_msg;
+
+	dev->next_msg = NULL;
+	dev->msg = msg;
+	dev->buf = msg->buf;
+	dev->buf_len = msg->len;
+
+	if (msg->flags & I2C_M_RD) {
+		at91_twi_write(dev, AT91_TWI_IDR, AT91_TWI_TXRDY);
+		if (dev->fifo_size)
+			at91_twi_set_rx_threshold(dev);
+		at91_twi_write(dev, AT91_TWI_IER, AT91_TWI_RXRDY);
+	} else {
+		at91_twi_write(dev, AT91_TWI_IDR, AT91_TWI_RXRDY);
+		at91_twi_write_data(dev);
+		if (dev->buf_len)
+			at91_twi_write(dev, AT91_TWI_IER, AT91_TWI_TXRDY);
+	}
+}
+
+/*
+ * With the FIFO, fill all its free room at once. TXRDY is then only raised
+ * again when four more bytes fit, instead of once per byte.
+ */
+static void at91_twi_write_data(struct at91_twi_dev *dev)
+{
+	unsigned room = 1;
+
+	if (dev->fifo_size)
+		room = dev->fifo_size -
+		       AT91_TWI_FLR_TXFL(at91_twi_read(dev, AT91_TWI_FLR));
+
+	while (room-- && dev->buf_len)
+		at91_twi_write_next_byte(dev);
+
+	if (!dev->buf_len && dev->next_msg)
+		at91_twi_next_msg(dev);
+}
+
 static void at91_twi_write_data_dma_callback(void *data)
 {
 	struct at91_twi_dev *dev = (struct at91_twi_dev *)data;
@@ -393,6 +447,43 @@ static void at91_twi_read_next_byte(struct at91_twi_dev *dev)
 	++dev->buf;
 }
 
+static void at91_twi_set_rx_threshold(struct at91_twi_dev *dev)
+{
+	unsigned fifo_mr = at91_twi_read(dev, AT91_TWI_FMR);
+
+	/* Wait for four bytes, unless fewer are still to come */
+	fifo_mr &= ~AT91_TWI_FMR_RXRDYM_MASK;
+	fifo_mr |= AT91_TWI_FMR_RXRDYM(dev->buf_len >= 4 ? AT91_TWI_FOUR_DATA :
+						       AT91_TWI_ONE_DATA);
+	at91_twi_write(dev, AT91_TWI_FMR, fifo_mr);
+}
+
+/* Drain all the bytes already received in the RX FIFO */
+static void at91_twi_read_data(struct at91_twi_dev *dev)
+{
+	unsigned count = 1;
+
+	if (dev->fifo_size)
+		count = max_t(unsigned, 1,
+			      AT91_TWI_FLR_RXFL(at91_twi_read(dev,
+							      AT91_TWI_FLR)));
+
+	while (count--) {
+		/* Bytes of a chained read follow in the same FIFO */
+		if (!dev->buf_len && dev->next_msg) {
+			if (!(dev->next_msg->flags & I2C_M_RD))
+				break;
+			at91_twi_next_msg(dev);
+		}
+		at91_twi_read_next_byte(dev);
+	}
+
+	if (!dev->buf_len && dev->next_msg)
+		at91_twi_next_msg(dev);
+	else if (dev->fifo_size)
+		at91_twi_set_rx_threshold(dev);
+}
+
 static void at91_twi_read_data_dma_callback(void *data)
 {
 	struct at91_twi_dev *dev = (struct at91_twi_dev *)data;
@@ -492,7 +583,7 @@ static irqreturn_t atmel_twi_interrupt(int irq, void *dev_id)
 	 * Receive Holding Register for the next transfer.
 	 */
 	if (irqstatus & AT91_TWI_RXRDY)
-		at91_twi_read_next_byte(dev);
+		at91_twi_read_data(dev);
 
 	/*
 	 * When a NACK condition is detected, the I2C controller sets the NACK,
@@ -536,7 +627,10 @@ static irqreturn_t atmel_twi_interrupt(int irq, void *dev_id)
 		at91_disable_twi_interrupts(dev);
 		complete(&dev->cmd_complete);
 	} else if (irqstatus & AT91_TWI_TXRDY) {
-		at91_twi_write_next_byte(dev);
+		at91_twi_write_data(dev);
+		/* Everything is queued, only wait for TXCOMP now */
+		if (!dev->buf_len)
+			at91_twi_write(dev, AT91_TWI_IDR, AT91_TWI_TXRDY);
 	}
 
 	/* catch error flags */
@@ -640,21 +734,33 @@ static int at91_do_twi_transfer(struct at91_twi_dev *dev)
 		 * Reading n-2 bytes with dma and the two last ones manually
 		 * seems to be the best solution.
 		 */
-		if (dev->use_dma && (dev->buf_len > AT91_I2C_DMA_THRESHOLD)) {
+		if (dev->use_dma && !dev->next_msg &&
+		    (dev->buf_len > AT91_I2C_DMA_THRESHOLD)) {
 			at91_twi_write(dev, AT91_TWI_IER, AT91_TWI_NACK);
 			at91_twi_read_data_dma(dev);
 		} else {
+			if (dev->fifo_size)
+				at91_twi_set_rx_threshold(dev);
 			at91_twi_write(dev, AT91_TWI_IER,
 				       AT91_TWI_TXCOMP |
 				       AT91_TWI_NACK |
 				       AT91_TWI_RXRDY);
 		}
 	} else {
-		if (dev->use_dma && (dev->buf_len > AT91_I2C_DMA_THRESHOLD)) {
+		if (dev->use_dma && !dev->next_msg &&
+		    (dev->buf_len > AT91_I2C_DMA_THRESHOLD)) {
 			at91_twi_write(dev, AT91_TWI_IER, AT91_TWI_NACK);
 			at91_twi_write_data_dma(dev);
 		} else {
-			at91_twi_write_next_byte(dev);
+			if (dev->fifo_size) {
+				unsigned fifo_mr;
+
+				fifo_mr = at91_twi_read(dev, AT91_TWI_FMR);
+				fifo_mr &= ~AT91_TWI_FMR_TXRDYM_MASK;
+				fifo_mr |= AT91_TWI_FMR_TXRDYM(AT91_TWI_FOUR_DATA);
+				at91_twi_write(dev, AT91_TWI_FMR, fifo_mr);
+			}
+			at91_twi_write_data(dev);
 			at91_twi_write(dev, AT91_TWI_IER,
 				       AT91_TWI_TXCOMP |
 				       AT91_TWI_NACK |
@@ -729,10 +835,26 @@ static int at91_twi_xfer(struct i2c_adapter *adap, struct i2c_msg *msg, int num)
 	if (ret < 0)
 		goto out;
 
-	if (num == 2) {
+	/*
+	 * With the alternative command mode, the second message is queued as
+	 * the next command and follows the first one after a repeated start,
+	 * whatever their directions and lengths. SMBus block reads still need
+	 * the internal address since their length is not known upfront.
+	 */
+	dev->next_msg = NULL;
+	if (num == 2 && dev->pdata->has_alt_cmd && msg[0].len && msg[1].len &&
+	    !((msg[0].flags | msg[1].flags) & I2C_M_RECV_LEN))
+		dev->next_msg = &msg[1];
+
+	if (num == 2 && !dev->next_msg) {
 		int internal_address = 0;
 		int i;
 
+		if ((msg->flags & I2C_M_RD) || msg->len > 3) {
+			ret = -EOPNOTSUPP;
+			goto out;
+		}
+
 		/* 1st msg is put into the internal address, start with 2nd */
 		m_start = &msg[1];
 		for (i = 0; i < msg->len; ++i) {
@@ -747,10 +869,17 @@ static int at91_twi_xfer(struct i2c_adapter *adap, struct i2c_msg *msg, int num)
 	is_read = (m_start->flags & I2C_M_RD);
 	if (dev->pdata->has_alt_cmd) {
 		if (m_start->len > 0) {
+			unsigned acr = AT91_TWI_ACR_DATAL(m_start->len) |
+				       ((is_read) ? AT91_TWI_ACR_DIR : 0);
+
+			if (dev->next_msg) {
+				acr |= AT91_TWI_ACR_NDATAL(dev->next_msg->len);
+				if (dev->next_msg->flags & I2C_M_RD)
+					acr |= AT91_TWI_ACR_NDIR;
+			}
+
 			at91_twi_write(dev, AT91_TWI_CR, AT91_TWI_ACMEN);
-			at91_twi_write(dev, AT91_TWI_ACR,
-				       AT91_TWI_ACR_DATAL(m_start->len) |
-				       ((is_read) ? AT91_TWI_ACR_DIR : 0));
+			at91_twi_write(dev, AT91_TWI_ACR, acr);
 			use_alt_cmd = true;
 		} else {
 			at91_twi_write(dev, AT91_TWI_CR, AT91_TWI_ACMDIS);
@@ -786,6 +915,16 @@ static struct i2c_adapter_quirks at91_twi_quirks = {
 	.max_comb_1st_msg_len = 3,
 };
 
+/*
+ * With the alternative command mode, the two messages can go either way and
+ * are only limited by the 8-bit DATAL and NDATAL fields.
+ */
+static struct i2c_adapter_quirks at91_twi_alt_cmd_quirks = {
+	.flags = I2C_AQ_COMB | I2C_AQ_COMB_SAME_ADDR,
+	.max_comb_1st_msg_len = 255,
+	.max_comb_2nd_msg_len = 255,
+};
+
 static u32 at91_twi_func(struct i2c_adapter *adapter)
 {
 	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL
@@ -1069,7 +1208,10 @@ static int at91_twi_probe(struct platform_device *pdev)
 	dev->adapter.owner = THIS_MODULE;
 	dev->adapter.class = I2C_CLASS_DEPRECATED;
 	dev->adapter.algo = &at91_twi_algorithm;
-	dev->adapter.quirks = &at91_twi_quirks;
+	if (dev->pdata->has_alt_cmd)
+		dev->adapter.quirks = &at91_twi_alt_cmd_quirks;
+	else
+		dev->adapter.quirks = &at91_twi_quirks;
 	dev->adapter.dev.parent = dev->dev;
 	dev->adapter.nr = pdev->id;
 	dev->adapter.timeout = AT91_I2C_TIMEOUT;
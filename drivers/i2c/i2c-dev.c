@@ -235,37 +235,31 @@ static int i2cdev_check_addr(struct i2c_adapter *adapter, unsigned int addr)
 	return result;
 }
 
-static noinline int i2cdev_ioctl_rdrw(struct i2c_client *client,
-		unsigned long arg)
+/* Copy in a user message array and the write data of each message */
+static struct i2c_msg *i2cdev_msgs_get(struct i2c_msg __user *umsgs,
+		u32 nmsgs, u8 __user ***data_ptrs_p)
 {
-	struct i2c_rdwr_ioctl_data rdwr_arg;
 	struct i2c_msg *rdwr_pa;
 	u8 __user **data_ptrs;
 	int i, res;
 
-	if (copy_from_user(&rdwr_arg,
-			   (struct i2c_rdwr_ioctl_data __user *)arg,
-			   sizeof(rdwr_arg)))
-		return -EFAULT;
-
 	/* Put an arbitrary limit on the number of messages that can
 	 * be sent at once */
-	if (rdwr_arg.nmsgs > I2C_RDRW_IOCTL_MAX_MSGS)
-		return -EINVAL;
+	if (nmsgs > I2C_RDRW_IOCTL_MAX_MSGS)
+		return ERR_PTR(-EINVAL);
 
-	rdwr_pa = memdup_user(rdwr_arg.msgs,
-			      rdwr_arg.nmsgs * sizeof(struct i2c_msg));
+	rdwr_pa = memdup_user(umsgs, nmsgs * sizeof(struct i2c_msg));
 	if (IS_ERR(rdwr_pa))
-		return PTR_ERR(rdwr_pa);
+		return rdwr_pa;
 
-	data_ptrs = kmalloc(rdwr_arg.nmsgs * sizeof(u8 __user *), GFP_KERNEL);
+	data_ptrs = kmalloc(nmsgs * sizeof(u8 __user *), GFP_KERNEL);
 	if (data_ptrs == NULL) {
 		kfree(rdwr_pa);
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
 
 	res = 0;
-	for (i = 0; i < rdwr_arg.nmsgs; i++) {
+	for (i = 0; i < nmsgs; i++) {
 		/* Limit the size of the message to a sane amount */
 		if (rdwr_pa[i].len > 8192) {
 			res = -EINVAL;
@@ -295,6 +289,7 @@ static noinline int i2cdev_ioctl_rdrw(struct i2c_client *client,
 			    rdwr_pa[i].buf[0] < 1 ||
 			    rdwr_pa[i].len < rdwr_pa[i].buf[0] +
 					     I2C_SMBUS_BLOCK_MAX) {
+				i++;
 				res = -EINVAL;
 				break;
 			}
@@ -308,10 +303,19 @@ static noinline int i2cdev_ioctl_rdrw(struct i2c_client *client,
 			kfree(rdwr_pa[j].buf);
 		kfree(data_ptrs);
 		kfree(rdwr_pa);
-		return res;
+		return ERR_PTR(res);
 	}
 
-	res = i2c_transfer(client->adapter, rdwr_pa, rdwr_arg.nmsgs);
+	*data_ptrs_p = data_ptrs;
+	return rdwr_pa;
+}
+
+/* Copy out the read data after a transfer returning res, and free */
+static int i2cdev_msgs_put(struct i2c_msg *rdwr_pa, u8 __user **data_ptrs,
+		u32 nmsgs, int res)
+{
+	int i = nmsgs;
+
 	while (i-- > 0) {
 		if (res >= 0 && (rdwr_pa[i].flags & I2C_M_RD)) {
 			if (copy_to_user(data_ptrs[i], rdwr_pa[i].buf,
@@ -325,6 +329,97 @@ static noinline int i2cdev_ioctl_rdrw(struct i2c_client *client,
 	return res;
 }
 
+static noinline int i2cdev_ioctl_rdrw(struct i2c_client *client,
+		unsigned long arg)
+{
+	struct i2c_rdwr_ioctl_data rdwr_arg;
+	struct i2c_msg *rdwr_pa;
+	u8 __user **data_ptrs;
+	int res;
+
+	if (copy_from_user(&rdwr_arg,
+			   (struct i2c_rdwr_ioctl_data __user *)arg,
+			   sizeof(rdwr_arg)))
+		return -EFAULT;
+
+	rdwr_pa = i2cdev_msgs_get(rdwr_arg.msgs, rdwr_arg.nmsgs, &data_ptrs);
+	if (IS_ERR(rdwr_pa))
+		return PTR_ERR(rdwr_pa);
+
+	res = i2c_transfer(client->adapter, rdwr_pa, rdwr_arg.nmsgs);
+	return i2cdev_msgs_put(rdwr_pa, data_ptrs, rdwr_arg.nmsgs, res);
+}
+
+/*
+ * Run independent combined transfers, each ending with a STOP, back to
+ * back while holding the adapter: no other client gets on the bus in
+ * between, and the lock is only taken once.  One failing transfer does
+ * not stop the others, each reports its own result.
+ */
+static noinline int i2cdev_ioctl_batch(struct i2c_client *client,
+		unsigned long arg)
+{
+	struct i2c_adapter *adap = client->adapter;
+	struct i2c_batch_ioctl_data batch_arg;
+	struct i2c_batch_xfer *xfers;
+	struct i2c_msg **msgs;
+	u8 __user ***data_ptrs;
+	int i, res = 0;
+
+	if (copy_from_user(&batch_arg,
+			   (struct i2c_batch_ioctl_data __user *)arg,
+			   sizeof(batch_arg)))
+		return -EFAULT;
+
+	if (!batch_arg.nxfers || batch_arg.nxfers > I2C_BATCH_IOCTL_MAX_XFERS)
+		return -EINVAL;
+
+	if (!adap->algo->master_xfer)
+		return -EOPNOTSUPP;
+
+	xfers = memdup_user(batch_arg.xfers,
+			    batch_arg.nxfers * sizeof(*xfers));
+	if (IS_ERR(xfers))
+		return PTR_ERR(xfers);
+
+	msgs = kcalloc(batch_arg.nxfers, sizeof(*msgs), GFP_KERNEL);
+	data_ptrs = kcalloc(batch_arg.nxfers, sizeof(*data_ptrs), GFP_KERNEL);
+	if (!msgs || !data_ptrs) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < batch_arg.nxfers; i++) {
+		msgs[i] = i2cdev_msgs_get(xfers[i].msgs, xfers[i].nmsgs,
+					  &data_ptrs[i]);
+		if (IS_ERR(msgs[i])) {
+			res = PTR_ERR(msgs[i]);
+			goto put;
+		}
+	}
+
+	i2c_lock_adapter(adap);
+	for (i = 0; i < batch_arg.nxfers; i++)
+		xfers[i].result = __i2c_transfer(adap, msgs[i],
+						 xfers[i].nmsgs);
+	i2c_unlock_adapter(adap);
+
+put:
+	while (i-- > 0) {
+		xfers[i].result = i2cdev_msgs_put(msgs[i], data_ptrs[i],
+						  xfers[i].nmsgs,
+						  res ? res : xfers[i].result);
+		if (!res && put_user(xfers[i].result,
+				     &batch_arg.xfers[i].result))
+			res = -EFAULT;
+	}
+out:
+	kfree(data_ptrs);
+	kfree(msgs);
+	kfree(xfers);
+	return res;
+}
+
 static noinline int i2cdev_ioctl_smbus(struct i2c_client *client,
 		unsigned long arg)
 {
@@ -458,6 +553,9 @@ static long i2cdev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case I2C_RDWR:
 		return i2cdev_ioctl_rdrw(client, arg);
 
+	case I2C_BATCH:
+		return i2cdev_ioctl_batch(client, arg);
+
 	case I2C_SMBUS:
 		return i2cdev_ioctl_smbus(client, arg);
 
@@ -16,15 +16,24 @@
 
 #include <linux/bitops.h>
 #include <linux/clk.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/iio/iio.h>
+#include <linux/iio/events.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/buffer-dma.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/regulator/consumer.h>
 
 /* Control Register */
@@ -42,6 +51,8 @@
 #define AT91_SAMA5D2_MR		0x04
 /* Trigger Selection */
 #define	AT91_SAMA5D2_MR_TRGSEL(v)	((v) << 1)
+#define	AT91_SAMA5D2_MR_TRGSEL_MASK	GENMASK(3, 1)
+#define	AT91_SAMA5D2_MR_TRGSEL_MAX	7
 /* ADTRG */
 #define	AT91_SAMA5D2_MR_TRGSEL_TRIG0	0
 /* TIOA0 */
@@ -101,6 +112,12 @@
 #define AT91_SAMA5D2_IMR	0x2c
 /* Interrupt Status Register */
 #define AT91_SAMA5D2_ISR	0x30
+/* Data Ready */
+#define	AT91_SAMA5D2_ISR_DRDY		BIT(24)
+/* Comparison Event */
+#define	AT91_SAMA5D2_ISR_COMPE		BIT(26)
+/* End of Conversion of the channels */
+#define	AT91_SAMA5D2_ISR_EOC_MASK	GENMASK(11, 0)
 /* Last Channel Trigger Mode Register */
 #define AT91_SAMA5D2_LCTMR	0x34
 /* Last Channel Compare Window Register */
@@ -109,8 +126,28 @@
 #define AT91_SAMA5D2_OVER	0x3c
 /* Extended Mode Register */
 #define AT91_SAMA5D2_EMR	0x40
+/* Comparison Mode */
+#define	AT91_SAMA5D2_EMR_CMPMODE(v)	((v) << 0)
+#define	AT91_SAMA5D2_EMR_CMPMODE_MASK	GENMASK(1, 0)
+#define	AT91_SAMA5D2_EMR_CMPMODE_LOW	0
+#define	AT91_SAMA5D2_EMR_CMPMODE_HIGH	1
+#define	AT91_SAMA5D2_EMR_CMPMODE_IN	2
+#define	AT91_SAMA5D2_EMR_CMPMODE_OUT	3
+/* Comparison Selected Channel */
+#define	AT91_SAMA5D2_EMR_CMPSEL(v)	((v) << 3)
+#define	AT91_SAMA5D2_EMR_CMPSEL_MASK	GENMASK(7, 3)
+/* Over Sampling Rate */
+#define	AT91_SAMA5D2_EMR_OSR(v)		((v) << 16)
+#define	AT91_SAMA5D2_EMR_OSR_MASK	GENMASK(17, 16)
+#define	AT91_SAMA5D2_EMR_OSR_1SAMPLES	0
+#define	AT91_SAMA5D2_EMR_OSR_4SAMPLES	1
+#define	AT91_SAMA5D2_EMR_OSR_16SAMPLES	2
+/* Averaging on Single Trigger Event */
+#define	AT91_SAMA5D2_EMR_ASTE		BIT(20)
 /* Compare Window Register */
 #define AT91_SAMA5D2_CWR	0x44
+#define	AT91_SAMA5D2_CWR_LOWTHRES(v)	((v) << 0)
+#define	AT91_SAMA5D2_CWR_HIGHTHRES(v)	((v) << 16)
 /* Channel Gain Register */
 #define AT91_SAMA5D2_CGR	0x48
 
@@ -132,6 +169,13 @@
 #define AT91_SAMA5D2_PRESSR	0xbc
 /* Trigger Register */
 #define AT91_SAMA5D2_TRGR	0xc0
+/* Trigger Mode */
+#define	AT91_SAMA5D2_TRGR_TRGMOD_MASK		GENMASK(2, 0)
+#define	AT91_SAMA5D2_TRGR_TRGMOD_NO_TRIGGER	0
+#define	AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_RISE	1
+#define	AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_FALL	2
+#define	AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_ANY	3
+#define	AT91_SAMA5D2_TRGR_TRGMOD_CONTINUOUS	6
 /* Correction Select Register */
 #define AT91_SAMA5D2_COSR	0xd0
 /* Correction Value Register */
@@ -145,20 +189,62 @@
 /* Version Register */
 #define AT91_SAMA5D2_VERSION	0xfc
 
+#define AT91_SAMA5D2_SINGLE_CHAN_CNT	12
+#define AT91_SAMA5D2_DIFF_CHAN_CNT	6
+
+/*
+ * Results are always reported on 14 bits: the plain 12-bit conversion and
+ * the 13-bit result of 4x oversampling are shifted up to match the 16x one.
+ */
+#define AT91_SAMA5D2_REALBITS		14
+#define AT91_SAMA5D2_CONV_BITS		12
+
+/* Timestamp goes after the conversions, 64-bit aligned */
+#define AT91_BUFFER_MAX_CONVERSION_BYTES	((AT91_SAMA5D2_SINGLE_CHAN_CNT + \
+					 AT91_SAMA5D2_DIFF_CHAN_CNT) * 2)
+#define AT91_BUFFER_MAX_BYTES		(round_up(AT91_BUFFER_MAX_CONVERSION_BYTES, \
+						  sizeof(s64)) + sizeof(s64))
+#define AT91_BUFFER_MAX_HWORDS		(AT91_BUFFER_MAX_BYTES / 2)
+
+/* Most scans a DMA period can hold, see hwfifo_set_watermark */
+#define AT91_HWFIFO_MAX_SIZE		128
+#define AT91_DMA_BUFFER_SIZE		(AT91_HWFIFO_MAX_SIZE * 2 * \
+					 AT91_BUFFER_MAX_CONVERSION_BYTES)
+
+/* Window comparison, on a single-ended channel at a time */
+static const struct iio_event_spec at91_adc_events[] = {
+	{
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_RISING,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				 BIT(IIO_EV_INFO_ENABLE),
+	}, {
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_FALLING,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				 BIT(IIO_EV_INFO_ENABLE),
+	},
+};
+
 #define AT91_SAMA5D2_CHAN_SINGLE(num, addr)				\
 	{								\
 		.type = IIO_VOLTAGE,					\
 		.channel = num,						\
 		.address = addr,					\
+		.scan_index = num,					\
 		.scan_type = {						\
 			.sign = 'u',					\
-			.realbits = 12,					\
+			.realbits = AT91_SAMA5D2_REALBITS,		\
+			.storagebits = 16,				\
 		},							\
 		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),		\
 		.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),	\
-		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),\
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ) |\
+				BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),	\
 		.datasheet_name = "CH"#num,				\
 		.indexed = 1,						\
+		.event_spec = at91_adc_events,				\
+		.num_event_specs = ARRAY_SIZE(at91_adc_events),		\
 	}
 
 #define AT91_SAMA5D2_CHAN_DIFF(num, num2, addr)				\
@@ -168,13 +254,16 @@
 		.channel = num,						\
 		.channel2 = num2,					\
 		.address = addr,					\
+		.scan_index = AT91_SAMA5D2_SINGLE_CHAN_CNT + (num) / 2,	\
 		.scan_type = {						\
 			.sign = 's',					\
-			.realbits = 12,					\
+			.realbits = AT91_SAMA5D2_REALBITS,		\
+			.storagebits = 16,				\
 		},							\
 		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),		\
 		.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),	\
-		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),\
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ) |\
+				BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),	\
 		.datasheet_name = "CH"#num"-CH"#num2,			\
 		.indexed = 1,						\
 	}
@@ -182,13 +271,57 @@
 #define at91_adc_readl(st, reg)		readl_relaxed(st->base + reg)
 #define at91_adc_writel(st, reg, val)	writel_relaxed(val, st->base + reg)
 
+static bool dma_blocks;
+module_param(dma_blocks, bool, S_IRUGO);
+MODULE_PARM_DESC(dma_blocks,
+		 "Capture into DMA blocks userspace maps, instead of a kfifo");
+
 struct at91_adc_soc_info {
 	unsigned			startup_time;
 	unsigned			min_sample_rate;
 	unsigned			max_sample_rate;
 };
 
+/**
+ * struct at91_adc_dma - continuous sampling through DMA
+ * @dma_chan:		channel reading LCDR on each DRDY
+ * @rx_buf:		cyclic buffer of two periods of @watermark scans
+ * @rx_dma_buf:		bus address of @rx_buf
+ * @rx_buf_sz:		size of the cyclic buffer in use
+ * @buf_idx:		offset of the next scan to push
+ * @watermark:		scans per DMA period, DMA is only used above one
+ * @dma_ts:		timestamp of the previous DMA period
+ * @fixup:		with the block buffer, the scans of a block are to be
+ *			reordered or shifted in place
+ */
+struct at91_adc_dma {
+	struct dma_chan			*dma_chan;
+	u8				*rx_buf;
+	dma_addr_t			rx_dma_buf;
+	int				rx_buf_sz;
+	int				buf_idx;
+	unsigned			watermark;
+	s64				dma_ts;
+	bool				fixup;
+};
+
+/**
+ * struct at91_adc_cmp - comparison window monitoring
+ * @chan:		monitored channel, -1 when monitoring is off
+ * @dir_mask:		BIT() of the enabled IIO_EV_DIR_RISING/FALLING events
+ * @thresh:		rising and falling thresholds of each channel, raw
+ * @rearm:		an event fired, waiting for the value to come back
+ *			across the threshold before reporting again
+ */
+struct at91_adc_cmp {
+	int				chan;
+	unsigned			dir_mask;
+	u16				thresh[AT91_SAMA5D2_SINGLE_CHAN_CNT][2];
+	bool				rearm;
+};
+
 struct at91_adc_state {
+	phys_addr_t			phys_base;
 	void __iomem			*base;
 	int				irq;
 	struct clk			*per_clk;
@@ -200,6 +333,21 @@ struct at91_adc_state {
 	u32				conversion_value;
 	struct at91_adc_soc_info	soc_info;
 	wait_queue_head_t		wq_data_available;
+	struct iio_trigger		*trig;
+	u32				trigger_mode;
+	u32				trigger_sel;
+	u32				eoc_mask;
+	bool				dma_active;
+	struct at91_adc_dma		dma_st;
+	/* DMA scan slot k goes to position scan_pos[k] of the IIO scan */
+	u8				scan_pos[AT91_SAMA5D2_SINGLE_CHAN_CNT];
+	unsigned			scan_cnt;
+	unsigned			oversampling_ratio;
+	struct at91_adc_cmp		cmp;
+	/* protects EMR, CWR and @cmp against the interrupt handler */
+	spinlock_t			cmp_lock;
+	u16				buffer[AT91_BUFFER_MAX_HWORDS]
+					__aligned(sizeof(s64));
 	/*
 	 * lock to prevent concurrent 'single conversion' requests through
 	 * sysfs.
@@ -226,6 +374,8 @@ static const struct iio_chan_spec at91_adc_channels[] = {
 	AT91_SAMA5D2_CHAN_DIFF(6, 7, 0x68),
 	AT91_SAMA5D2_CHAN_DIFF(8, 9, 0x70),
 	AT91_SAMA5D2_CHAN_DIFF(10, 11, 0x78),
+	IIO_CHAN_SOFT_TIMESTAMP(AT91_SAMA5D2_SINGLE_CHAN_CNT
+				+ AT91_SAMA5D2_DIFF_CHAN_CNT),
 };
 
 static unsigned at91_adc_startup_time(unsigned startup_time_min,
@@ -286,21 +436,627 @@ static unsigned at91_adc_get_sample_freq(struct at91_adc_state *st)
 	return f_adc;
 }
 
+/* Left shift bringing a conversion result to AT91_SAMA5D2_REALBITS */
+static unsigned at91_adc_osr_shift(struct at91_adc_state *st)
+{
+	switch (st->oversampling_ratio) {
+	case 16:
+		return 0;
+	case 4:
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+/*
+ * Oversampling averages 4 or 16 conversions into a 13 or 14-bit result. With
+ * ASTE all of them are done on a single trigger, so each software start or
+ * trigger event still yields one sample.
+ */
+static int at91_adc_config_osr(struct at91_adc_state *st, unsigned ratio)
+{
+	unsigned long flags;
+	u32 emr, osr;
+
+	switch (ratio) {
+	case 1:
+		osr = AT91_SAMA5D2_EMR_OSR_1SAMPLES;
+		break;
+	case 4:
+		osr = AT91_SAMA5D2_EMR_OSR_4SAMPLES;
+		break;
+	case 16:
+		osr = AT91_SAMA5D2_EMR_OSR_16SAMPLES;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&st->cmp_lock, flags);
+	emr = at91_adc_readl(st, AT91_SAMA5D2_EMR);
+	emr &= ~(AT91_SAMA5D2_EMR_OSR_MASK | AT91_SAMA5D2_EMR_ASTE);
+	emr |= AT91_SAMA5D2_EMR_OSR(osr);
+	if (ratio > 1)
+		emr |= AT91_SAMA5D2_EMR_ASTE;
+	at91_adc_writel(st, AT91_SAMA5D2_EMR, emr);
+	st->oversampling_ratio = ratio;
+	spin_unlock_irqrestore(&st->cmp_lock, flags);
+
+	return 0;
+}
+
+static int at91_adc_thresh_idx(enum iio_event_direction dir)
+{
+	return dir == IIO_EV_DIR_RISING ? 0 : 1;
+}
+
+/*
+ * The comparator flags COMPE on every conversion matching the window, so in
+ * continuous mode an out of bounds value would interrupt on each sample.
+ * Once an event fired, the complementary window is programmed and the
+ * original one is restored when it matches: only the crossings are
+ * reported. The thresholds are compared on 12 bits. Called with cmp_lock
+ * held.
+ */
+static void at91_adc_cmp_program(struct at91_adc_state *st)
+{
+	struct at91_adc_cmp *cmp = &st->cmp;
+	int shift = AT91_SAMA5D2_REALBITS - AT91_SAMA5D2_CONV_BITS;
+	u32 high, low, mode, emr;
+
+	high = cmp->thresh[cmp->chan][0] >> shift;
+	low = cmp->thresh[cmp->chan][1] >> shift;
+
+	if (cmp->dir_mask == (BIT(IIO_EV_DIR_RISING) |
+			      BIT(IIO_EV_DIR_FALLING))) {
+		mode = cmp->rearm ? AT91_SAMA5D2_EMR_CMPMODE_IN :
+				    AT91_SAMA5D2_EMR_CMPMODE_OUT;
+	} else if (cmp->dir_mask & BIT(IIO_EV_DIR_RISING)) {
+		mode = cmp->rearm ? AT91_SAMA5D2_EMR_CMPMODE_LOW :
+				    AT91_SAMA5D2_EMR_CMPMODE_HIGH;
+		low = high;
+	} else {
+		mode = cmp->rearm ? AT91_SAMA5D2_EMR_CMPMODE_HIGH :
+				    AT91_SAMA5D2_EMR_CMPMODE_LOW;
+		high = low;
+	}
+
+	emr = at91_adc_readl(st, AT91_SAMA5D2_EMR);
+	emr &= ~(AT91_SAMA5D2_EMR_CMPMODE_MASK | AT91_SAMA5D2_EMR_CMPSEL_MASK);
+	emr |= AT91_SAMA5D2_EMR_CMPMODE(mode) |
+	       AT91_SAMA5D2_EMR_CMPSEL(cmp->chan);
+
+	at91_adc_writel(st, AT91_SAMA5D2_CWR, AT91_SAMA5D2_CWR_LOWTHRES(low) |
+			AT91_SAMA5D2_CWR_HIGHTHRES(high));
+	at91_adc_writel(st, AT91_SAMA5D2_EMR, emr);
+	at91_adc_writel(st, AT91_SAMA5D2_CR, AT91_SAMA5D2_CR_CMPRST);
+}
+
+/*
+ * Convert the monitored channel continuously. While the buffer is enabled,
+ * the trigger paces the conversions instead and the comparison only goes on
+ * if the channel is part of the scan.
+ */
+static void at91_adc_cmp_start(struct at91_adc_state *st)
+{
+	u32 trgr = at91_adc_readl(st, AT91_SAMA5D2_TRGR);
+
+	at91_adc_writel(st, AT91_SAMA5D2_CHER, BIT(st->cmp.chan));
+	at91_adc_writel(st, AT91_SAMA5D2_IER, AT91_SAMA5D2_ISR_COMPE);
+
+	trgr &= ~AT91_SAMA5D2_TRGR_TRGMOD_MASK;
+	trgr |= AT91_SAMA5D2_TRGR_TRGMOD_CONTINUOUS;
+	at91_adc_writel(st, AT91_SAMA5D2_TRGR, trgr);
+}
+
+static void at91_adc_cmp_stop(struct at91_adc_state *st)
+{
+	u32 trgr = at91_adc_readl(st, AT91_SAMA5D2_TRGR);
+
+	at91_adc_writel(st, AT91_SAMA5D2_IDR, AT91_SAMA5D2_ISR_COMPE);
+
+	trgr &= ~AT91_SAMA5D2_TRGR_TRGMOD_MASK;
+	at91_adc_writel(st, AT91_SAMA5D2_TRGR, trgr);
+
+	at91_adc_writel(st, AT91_SAMA5D2_CHDR, BIT(st->cmp.chan));
+}
+
+static void at91_adc_cmp_event(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	struct at91_adc_cmp *cmp = &st->cmp;
+	enum iio_event_direction dir;
+	bool push = false;
+	int chan;
+	u32 val;
+
+	spin_lock(&st->cmp_lock);
+
+	chan = cmp->chan;
+	if (chan < 0) {
+		spin_unlock(&st->cmp_lock);
+		return;
+	}
+
+	if (!cmp->rearm) {
+		if (cmp->dir_mask & BIT(IIO_EV_DIR_FALLING))
+			dir = IIO_EV_DIR_FALLING;
+		else
+			dir = IIO_EV_DIR_RISING;
+
+		/* Out of the window: tell below from above */
+		if (cmp->dir_mask == (BIT(IIO_EV_DIR_RISING) |
+				      BIT(IIO_EV_DIR_FALLING))) {
+			val = at91_adc_readl(st, AT91_SAMA5D2_CDR0 + 4 * chan);
+			val <<= at91_adc_osr_shift(st);
+			if (val >= cmp->thresh[chan][1])
+				dir = IIO_EV_DIR_RISING;
+		}
+		push = true;
+	}
+
+	cmp->rearm = !cmp->rearm;
+	at91_adc_cmp_program(st);
+
+	spin_unlock(&st->cmp_lock);
+
+	if (push)
+		iio_push_event(indio, IIO_UNMOD_EVENT_CODE(IIO_VOLTAGE, chan,
+							   IIO_EV_TYPE_THRESH,
+							   dir),
+			       iio_get_time_ns());
+}
+
+/*
+ * Buffered capture: the hardware trigger (ADTRG, TIOAx, PWM or RTC event,
+ * selected by atmel,trigger-sel) converts all the enabled channels. The
+ * results are either read from the CDRs on the end of conversion of the
+ * last channel, or, with a watermark above one, moved from LCDR by a cyclic
+ * DMA and pushed one period at a time.
+ */
+static int at91_adc_configure_trigger(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio = iio_trigger_get_drvdata(trig);
+	struct at91_adc_state *st = iio_priv(indio);
+	u32 status = at91_adc_readl(st, AT91_SAMA5D2_TRGR);
+	u8 bit;
+
+	status &= ~AT91_SAMA5D2_TRGR_TRGMOD_MASK;
+	if (state)
+		status |= st->trigger_mode;
+	at91_adc_writel(st, AT91_SAMA5D2_TRGR, status);
+
+	if (state) {
+		u32 cor = 0, cher = 0;
+
+		for_each_set_bit(bit, indio->active_scan_mask,
+				 indio->num_channels) {
+			struct iio_chan_spec const *chan = indio->channels + bit;
+
+			if (chan->type != IIO_VOLTAGE)
+				continue;
+			if (chan->differential)
+				cor |= (BIT(chan->channel) |
+					BIT(chan->channel2)) <<
+				       AT91_SAMA5D2_COR_DIFF_OFFSET;
+			cher |= BIT(chan->channel);
+		}
+
+		/* Interrupt on the last channel converted, unless DMA runs */
+		st->eoc_mask = (st->dma_active || !cher) ? 0 :
+			       BIT(fls(cher) - 1);
+		/* Only convert the scan, not a channel under monitoring */
+		at91_adc_writel(st, AT91_SAMA5D2_CHDR, 0xffffffff);
+		at91_adc_writel(st, AT91_SAMA5D2_COR, cor);
+		at91_adc_writel(st, AT91_SAMA5D2_CHER, cher);
+		at91_adc_writel(st, AT91_SAMA5D2_IER, st->eoc_mask);
+	} else {
+		at91_adc_writel(st, AT91_SAMA5D2_IDR, 0xffffffff);
+		at91_adc_writel(st, AT91_SAMA5D2_CHDR, 0xffffffff);
+		st->eoc_mask = 0;
+
+		/* Clear any pending DRDY */
+		at91_adc_readl(st, AT91_SAMA5D2_LCDR);
+
+		if (st->cmp.chan >= 0)
+			at91_adc_cmp_start(st);
+	}
+
+	return 0;
+}
+
+static int at91_adc_validate_device(struct iio_trigger *trig,
+				    struct iio_dev *indio)
+{
+	return indio != iio_trigger_get_drvdata(trig) ? -EINVAL : 0;
+}
+
+static const struct iio_trigger_ops at91_adc_trigger_ops = {
+	.owner = THIS_MODULE,
+	.set_trigger_state = &at91_adc_configure_trigger,
+	.validate_device = &at91_adc_validate_device,
+};
+
+static irqreturn_t at91_adc_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio = pf->indio_dev;
+	struct at91_adc_state *st = iio_priv(indio);
+	unsigned shift = at91_adc_osr_shift(st);
+	int i = 0;
+	u8 bit;
+
+	for_each_set_bit(bit, indio->active_scan_mask, indio->num_channels) {
+		struct iio_chan_spec const *chan = indio->channels + bit;
+
+		if (chan->type != IIO_VOLTAGE)
+			continue;
+		st->buffer[i++] = at91_adc_readl(st, chan->address) << shift;
+	}
+
+	iio_push_to_buffers_with_timestamp(indio, st->buffer, pf->timestamp);
+
+	iio_trigger_notify_done(indio->trig);
+
+	/* Reading the CDRs cleared the EOC, unmask it again */
+	at91_adc_writel(st, AT91_SAMA5D2_IER, st->eoc_mask);
+
+	return IRQ_HANDLED;
+}
+
+static void at91_adc_dma_push(struct iio_dev *indio, int from, int to,
+			      int scan_sz, s64 ts, s64 interval)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	unsigned shift = at91_adc_osr_shift(st);
+	u16 *scan;
+	int k;
+
+	for (; from + scan_sz <= to; from += scan_sz) {
+		scan = (u16 *)(st->dma_st.rx_buf + from);
+
+		/* The ADC converts in channel order, IIO wants scan order */
+		for (k = 0; k < st->scan_cnt; k++)
+			st->buffer[st->scan_pos[k]] = scan[k] << shift;
+
+		iio_push_to_buffers_with_timestamp(indio, st->buffer, ts);
+		ts += interval;
+	}
+}
+
+static void at91_adc_dma_done(void *data)
+{
+	struct iio_dev *indio = data;
+	struct at91_adc_state *st = iio_priv(indio);
+	struct at91_adc_dma *dma_st = &st->dma_st;
+	int scan_sz = st->scan_cnt * 2;
+	struct dma_tx_state state;
+	int pos, cnt, wrap = 0;
+	s64 now, interval;
+
+	dmaengine_tx_status(dma_st->dma_chan, dma_st->dma_chan->cookie,
+			    &state);
+	pos = dma_st->rx_buf_sz - state.residue;
+	pos -= pos % scan_sz;
+
+	if (pos < dma_st->buf_idx)
+		wrap = dma_st->rx_buf_sz - dma_st->buf_idx;
+	cnt = (wrap ? wrap + pos : pos - dma_st->buf_idx) / scan_sz;
+	if (!cnt)
+		return;
+
+	/* Spread the scans evenly over the time since the last period */
+	now = iio_get_time_ns();
+	interval = div_s64(now - dma_st->dma_ts, cnt);
+	dma_st->dma_ts = now;
+	now -= interval * (cnt - 1);
+
+	if (wrap) {
+		at91_adc_dma_push(indio, dma_st->buf_idx, dma_st->rx_buf_sz,
+				  scan_sz, now, interval);
+		now += interval * (wrap / scan_sz);
+		dma_st->buf_idx = 0;
+	}
+	at91_adc_dma_push(indio, dma_st->buf_idx, pos, scan_sz, now, interval);
+	dma_st->buf_idx = pos;
+}
+
+/*
+ * Record, for each CHx in conversion order, where its result goes in the
+ * scan. Returns true when the ADC converts the channels in scan order.
+ */
+static bool at91_adc_scan_order(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	unsigned chans[AT91_SAMA5D2_SINGLE_CHAN_CNT];
+	bool in_order = true;
+	int i, j, n = 0;
+	u8 bit;
+
+	for_each_set_bit(bit, indio->active_scan_mask, indio->num_channels) {
+		if (indio->channels[bit].type == IIO_VOLTAGE)
+			chans[n++] = indio->channels[bit].channel;
+	}
+	st->scan_cnt = n;
+	for (i = 0; i < n; i++) {
+		int slot = 0;
+
+		for (j = 0; j < n; j++)
+			if (chans[j] < chans[i])
+				slot++;
+		st->scan_pos[slot] = i;
+		if (slot != i)
+			in_order = false;
+	}
+
+	return in_order;
+}
+
+static int at91_adc_dma_start(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	struct at91_adc_dma *dma_st = &st->dma_st;
+	struct dma_async_tx_descriptor *desc;
+	int period;
+
+	at91_adc_scan_order(indio);
+
+	period = dma_st->watermark * st->scan_cnt * 2;
+	dma_st->rx_buf_sz = 2 * period;
+	dma_st->buf_idx = 0;
+
+	desc = dmaengine_prep_dma_cyclic(dma_st->dma_chan, dma_st->rx_dma_buf,
+					 dma_st->rx_buf_sz, period,
+					 DMA_DEV_TO_MEM, DMA_PREP_INTERRUPT);
+	if (!desc) {
+		dev_err(&indio->dev, "cannot prepare DMA cyclic\n");
+		return -EBUSY;
+	}
+
+	desc->callback = at91_adc_dma_done;
+	desc->callback_param = indio;
+
+	if (dma_submit_error(dmaengine_submit(desc))) {
+		dev_err(&indio->dev, "cannot submit DMA cyclic\n");
+		dmaengine_terminate_all(dma_st->dma_chan);
+		return -EBUSY;
+	}
+
+	dma_st->dma_ts = iio_get_time_ns();
+	dma_async_issue_pending(dma_st->dma_chan);
+
+	return 0;
+}
+
+static int at91_adc_buffer_postenable(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	int ret;
+
+	st->dma_active = st->dma_st.dma_chan && st->dma_st.watermark > 1;
+	if (st->dma_active) {
+		ret = at91_adc_dma_start(indio);
+		if (ret) {
+			st->dma_active = false;
+			return ret;
+		}
+	}
+
+	/* Attaching the poll function enables the trigger */
+	ret = iio_triggered_buffer_postenable(indio);
+	if (ret && st->dma_active) {
+		dmaengine_terminate_all(st->dma_st.dma_chan);
+		st->dma_active = false;
+	}
+
+	return ret;
+}
+
+static int at91_adc_buffer_predisable(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	int ret;
+
+	ret = iio_triggered_buffer_predisable(indio);
+
+	if (st->dma_active) {
+		dmaengine_terminate_all(st->dma_st.dma_chan);
+		st->dma_active = false;
+	}
+
+	return ret;
+}
+
+static bool at91_adc_validate_scan_mask(struct iio_dev *indio,
+					const unsigned long *mask)
+{
+	unsigned long chans = 0;
+	u8 bit;
+
+	/* A CHx is either converted single-ended or differential */
+	for_each_set_bit(bit, mask, indio->num_channels) {
+		struct iio_chan_spec const *chan = indio->channels + bit;
+		unsigned long used;
+
+		if (chan->type != IIO_VOLTAGE)
+			continue;
+		used = BIT(chan->channel);
+		if (chan->differential)
+			used |= BIT(chan->channel2);
+		if (chans & used)
+			return false;
+		chans |= used;
+	}
+
+	return true;
+}
+
+static const struct iio_buffer_setup_ops at91_adc_buffer_ops = {
+	.postenable = &at91_adc_buffer_postenable,
+	.predisable = &at91_adc_buffer_predisable,
+	.validate_scan_mask = &at91_adc_validate_scan_mask,
+};
+
+/*
+ * With the dma_blocks parameter, the buffer is made of blocks userspace can
+ * map: the DMA moves the conversions straight from LCDR to the block, one
+ * block per transfer, and no poll function runs. The ADC converts in channel
+ * order at the resolution of the oversampling ratio, so the scans are only
+ * fixed up in place, without being copied, when that doesn't match the IIO
+ * scan: with 16x oversampling and channels enabled in conversion order, the
+ * CPU doesn't touch the samples at all.
+ */
+static void at91_adc_block_done(void *data)
+{
+	struct iio_dma_buffer_block *block = data;
+	struct iio_dev *indio = block->queue->driver_data;
+	struct at91_adc_state *st = iio_priv(indio);
+	unsigned shift = at91_adc_osr_shift(st);
+	int scan_sz = st->scan_cnt * 2;
+	u16 *scan, *end;
+	int k;
+
+	block->block.bytes_used = rounddown(block->block.size, scan_sz);
+
+	if (st->dma_st.fixup) {
+		end = block->vaddr + block->block.bytes_used;
+		for (scan = block->vaddr; scan < end; scan += st->scan_cnt) {
+			for (k = 0; k < st->scan_cnt; k++)
+				st->buffer[st->scan_pos[k]] = scan[k] << shift;
+			memcpy(scan, st->buffer, scan_sz);
+		}
+	}
+
+	iio_dma_buffer_block_done(block);
+}
+
+static int at91_adc_block_submit(struct iio_dma_buffer_queue *queue,
+				 struct iio_dma_buffer_block *block)
+{
+	struct iio_dev *indio = queue->driver_data;
+	struct at91_adc_state *st = iio_priv(indio);
+	struct dma_chan *chan = st->dma_st.dma_chan;
+	struct dma_async_tx_descriptor *desc;
+	size_t len;
+
+	len = rounddown(block->block.size, st->scan_cnt * 2);
+	if (!len)
+		return -EINVAL;
+
+	desc = dmaengine_prep_slave_single(chan, block->phys_addr, len,
+					   DMA_DEV_TO_MEM, DMA_PREP_INTERRUPT);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = at91_adc_block_done;
+	desc->callback_param = block;
+
+	if (dma_submit_error(dmaengine_submit(desc)))
+		return -EBUSY;
+
+	dma_async_issue_pending(chan);
+
+	return 0;
+}
+
+static void at91_adc_block_abort(struct iio_dma_buffer_queue *queue)
+{
+	struct at91_adc_state *st = iio_priv(queue->driver_data);
+
+	dmaengine_terminate_all(st->dma_st.dma_chan);
+}
+
+static const struct iio_dma_buffer_ops at91_adc_block_ops = {
+	.submit = &at91_adc_block_submit,
+	.abort = &at91_adc_block_abort,
+};
+
+static int at91_adc_block_preenable(struct iio_dev *indio)
+{
+	/* The blocks only hold conversions, there is no room for timestamps */
+	if (indio->scan_timestamp)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int at91_adc_block_postenable(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	bool in_order;
+	int ret;
+
+	in_order = at91_adc_scan_order(indio);
+	st->dma_st.fixup = !in_order || at91_adc_osr_shift(st);
+	st->dma_active = true;
+
+	ret = iio_dma_buffer_enable(indio->buffer);
+	if (ret) {
+		iio_dma_buffer_disable(indio->buffer);
+		st->dma_active = false;
+		return ret;
+	}
+
+	/* Without a poll function, the core leaves the trigger to us */
+	return at91_adc_configure_trigger(st->trig, true);
+}
+
+static int at91_adc_block_predisable(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+
+	at91_adc_configure_trigger(st->trig, false);
+	iio_dma_buffer_disable(indio->buffer);
+	st->dma_active = false;
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops at91_adc_block_buffer_ops = {
+	.preenable = &at91_adc_block_preenable,
+	.postenable = &at91_adc_block_postenable,
+	.predisable = &at91_adc_block_predisable,
+	.validate_scan_mask = &at91_adc_validate_scan_mask,
+};
+
+static int at91_adc_set_watermark(struct iio_dev *indio, unsigned val)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+
+	st->dma_st.watermark = clamp_t(unsigned, val, 1, AT91_HWFIFO_MAX_SIZE);
+
+	return 0;
+}
+
 static irqreturn_t at91_adc_interrupt(int irq, void *private)
 {
 	struct iio_dev *indio = private;
 	struct at91_adc_state *st = iio_priv(indio);
 	u32 status = at91_adc_readl(st, AT91_SAMA5D2_ISR);
 	u32 imr = at91_adc_readl(st, AT91_SAMA5D2_IMR);
+	irqreturn_t ret = IRQ_NONE;
 
-	if (status & imr) {
+	if (status & imr & AT91_SAMA5D2_ISR_COMPE) {
+		at91_adc_cmp_event(indio);
+		ret = IRQ_HANDLED;
+	}
+
+	if (iio_buffer_enabled(indio) && (status & imr & st->eoc_mask)) {
+		/* Masked until the trigger handler has read the CDRs */
+		at91_adc_writel(st, AT91_SAMA5D2_IDR, st->eoc_mask);
+		iio_trigger_poll(indio->trig);
+		return IRQ_HANDLED;
+	}
+
+	if (status & imr & AT91_SAMA5D2_ISR_EOC_MASK) {
 		st->conversion_value = at91_adc_readl(st, st->chan->address);
 		st->conversion_done = true;
 		wake_up_interruptible(&st->wq_data_available);
 		return IRQ_HANDLED;
 	}
 
-	return IRQ_NONE;
+	return ret;
 }
 
 static int at91_adc_read_raw(struct iio_dev *indio_dev,
@@ -315,6 +1071,11 @@ static int at91_adc_read_raw(struct iio_dev *indio_dev,
 	case IIO_CHAN_INFO_RAW:
 		mutex_lock(&st->lock);
 
+		if (iio_buffer_enabled(indio_dev)) {
+			mutex_unlock(&st->lock);
+			return -EBUSY;
+		}
+
 		st->chan = chan;
 
 		if (chan->differential)
@@ -333,15 +1094,21 @@ static int at91_adc_read_raw(struct iio_dev *indio_dev,
 			ret = -ETIMEDOUT;
 
 		if (ret > 0) {
-			*val = st->conversion_value;
+			*val = st->conversion_value << at91_adc_osr_shift(st);
 			if (chan->scan_type.sign == 's')
-				*val = sign_extend32(*val, 11);
+				*val = sign_extend32(*val,
+						     AT91_SAMA5D2_REALBITS - 1);
 			ret = IIO_VAL_INT;
 			st->conversion_done = false;
 		}
 
 		at91_adc_writel(st, AT91_SAMA5D2_IDR, BIT(chan->channel));
-		at91_adc_writel(st, AT91_SAMA5D2_CHDR, BIT(chan->channel));
+		/* Leave the monitored channel converting, single-ended */
+		if (st->cmp.chan >= 0)
+			at91_adc_writel(st, AT91_SAMA5D2_COR, 0);
+		if (chan->channel != st->cmp.chan)
+			at91_adc_writel(st, AT91_SAMA5D2_CHDR,
+					BIT(chan->channel));
 
 		mutex_unlock(&st->lock);
 		return ret;
@@ -357,6 +1124,10 @@ static int at91_adc_read_raw(struct iio_dev *indio_dev,
 		*val = at91_adc_get_sample_freq(st);
 		return IIO_VAL_INT;
 
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		*val = st->oversampling_ratio;
+		return IIO_VAL_INT;
+
 	default:
 		return -EINVAL;
 	}
@@ -367,25 +1138,310 @@ static int at91_adc_write_raw(struct iio_dev *indio_dev,
 			      int val, int val2, long mask)
 {
 	struct at91_adc_state *st = iio_priv(indio_dev);
+	int ret;
 
-	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+	switch (mask) {
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		if (val < st->soc_info.min_sample_rate ||
+		    val > st->soc_info.max_sample_rate)
+			return -EINVAL;
+
+		at91_adc_setup_samp_freq(st, val);
+		return 0;
+
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		mutex_lock(&indio_dev->mlock);
+		if (iio_buffer_enabled(indio_dev))
+			ret = -EBUSY;
+		else
+			ret = at91_adc_config_osr(st, val);
+		mutex_unlock(&indio_dev->mlock);
+		return ret;
+
+	default:
 		return -EINVAL;
+	}
+}
+
+static int at91_adc_read_event_config(struct iio_dev *indio_dev,
+				      const struct iio_chan_spec *chan,
+				      enum iio_event_type type,
+				      enum iio_event_direction dir)
+{
+	struct at91_adc_state *st = iio_priv(indio_dev);
+
+	return st->cmp.chan == chan->channel &&
+	       (st->cmp.dir_mask & BIT(dir));
+}
+
+static int at91_adc_write_event_config(struct iio_dev *indio_dev,
+				       const struct iio_chan_spec *chan,
+				       enum iio_event_type type,
+				       enum iio_event_direction dir,
+				       int state)
+{
+	struct at91_adc_state *st = iio_priv(indio_dev);
+	struct at91_adc_cmp *cmp = &st->cmp;
+	unsigned long flags;
+	unsigned dir_mask;
+	int ret = 0;
+
+	mutex_lock(&indio_dev->mlock);
+	mutex_lock(&st->lock);
+
+	if (iio_buffer_enabled(indio_dev)) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	/* The comparator only watches one channel */
+	if (cmp->chan >= 0 && cmp->chan != chan->channel) {
+		if (state)
+			ret = -EBUSY;
+		goto unlock;
+	}
+
+	dir_mask = cmp->dir_mask;
+	if (state)
+		dir_mask |= BIT(dir);
+	else
+		dir_mask &= ~BIT(dir);
+
+	if (dir_mask == cmp->dir_mask)
+		goto unlock;
+
+	if (!dir_mask) {
+		at91_adc_cmp_stop(st);
+		spin_lock_irqsave(&st->cmp_lock, flags);
+		cmp->chan = -1;
+		cmp->dir_mask = 0;
+		spin_unlock_irqrestore(&st->cmp_lock, flags);
+		goto unlock;
+	}
+
+	spin_lock_irqsave(&st->cmp_lock, flags);
+	cmp->chan = chan->channel;
+	cmp->dir_mask = dir_mask;
+	cmp->rearm = false;
+	at91_adc_cmp_program(st);
+	spin_unlock_irqrestore(&st->cmp_lock, flags);
+
+	at91_adc_cmp_start(st);
+
+unlock:
+	mutex_unlock(&st->lock);
+	mutex_unlock(&indio_dev->mlock);
+	return ret;
+}
 
-	if (val < st->soc_info.min_sample_rate ||
-	    val > st->soc_info.max_sample_rate)
+static int at91_adc_read_event_value(struct iio_dev *indio_dev,
+				     const struct iio_chan_spec *chan,
+				     enum iio_event_type type,
+				     enum iio_event_direction dir,
+				     enum iio_event_info info,
+				     int *val, int *val2)
+{
+	struct at91_adc_state *st = iio_priv(indio_dev);
+
+	*val = st->cmp.thresh[chan->channel][at91_adc_thresh_idx(dir)];
+
+	return IIO_VAL_INT;
+}
+
+static int at91_adc_write_event_value(struct iio_dev *indio_dev,
+				      const struct iio_chan_spec *chan,
+				      enum iio_event_type type,
+				      enum iio_event_direction dir,
+				      enum iio_event_info info,
+				      int val, int val2)
+{
+	struct at91_adc_state *st = iio_priv(indio_dev);
+	struct at91_adc_cmp *cmp = &st->cmp;
+	unsigned long flags;
+
+	if (val < 0 || val >= BIT(AT91_SAMA5D2_REALBITS))
 		return -EINVAL;
 
-	at91_adc_setup_samp_freq(st, val);
+	spin_lock_irqsave(&st->cmp_lock, flags);
+	cmp->thresh[chan->channel][at91_adc_thresh_idx(dir)] = val;
+	if (cmp->chan == chan->channel) {
+		cmp->rearm = false;
+		at91_adc_cmp_program(st);
+	}
+	spin_unlock_irqrestore(&st->cmp_lock, flags);
 
 	return 0;
 }
 
+static IIO_CONST_ATTR(oversampling_ratio_available, "1 4 16");
+
+static struct attribute *at91_adc_attributes[] = {
+	&iio_const_attr_oversampling_ratio_available.dev_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group at91_adc_attribute_group = {
+	.attrs = at91_adc_attributes,
+};
+
 static const struct iio_info at91_adc_info = {
+	.attrs = &at91_adc_attribute_group,
 	.read_raw = &at91_adc_read_raw,
 	.write_raw = &at91_adc_write_raw,
+	.read_event_config = &at91_adc_read_event_config,
+	.write_event_config = &at91_adc_write_event_config,
+	.read_event_value = &at91_adc_read_event_value,
+	.write_event_value = &at91_adc_write_event_value,
+	.hwfifo_set_watermark = &at91_adc_set_watermark,
 	.driver_module = THIS_MODULE,
 };
 
+static int at91_adc_dma_init(struct platform_device *pdev,
+			     struct at91_adc_state *st)
+{
+	struct at91_adc_dma *dma_st = &st->dma_st;
+	struct dma_slave_config config = {0};
+	struct dma_chan *chan;
+
+	st->dma_st.watermark = 1;
+
+	chan = dma_request_slave_channel_reason(&pdev->dev, "rx");
+	if (IS_ERR(chan)) {
+		if (PTR_ERR(chan) == -EPROBE_DEFER)
+			return -EPROBE_DEFER;
+		dev_info(&pdev->dev, "no DMA, continuous sampling disabled\n");
+		return 0;
+	}
+
+	dma_st->rx_buf = dma_alloc_coherent(chan->device->dev,
+					    AT91_DMA_BUFFER_SIZE,
+					    &dma_st->rx_dma_buf, GFP_KERNEL);
+	if (!dma_st->rx_buf) {
+		dma_release_channel(chan);
+		return -ENOMEM;
+	}
+
+	/* LCDR holds the last conversion, DRDY is the DMA request */
+	config.direction = DMA_DEV_TO_MEM;
+	config.src_addr = st->phys_base + AT91_SAMA5D2_LCDR;
+	config.src_addr_width = DMA_SLAVE_BUSWIDTH_2_BYTES;
+	config.src_maxburst = 1;
+	config.dst_maxburst = 1;
+
+	if (dmaengine_slave_config(chan, &config)) {
+		dma_free_coherent(chan->device->dev, AT91_DMA_BUFFER_SIZE,
+				  dma_st->rx_buf, dma_st->rx_dma_buf);
+		dma_release_channel(chan);
+		return -EINVAL;
+	}
+
+	dma_st->dma_chan = chan;
+
+	return 0;
+}
+
+static void at91_adc_dma_release(struct at91_adc_state *st)
+{
+	struct at91_adc_dma *dma_st = &st->dma_st;
+
+	if (!dma_st->dma_chan)
+		return;
+
+	dma_free_coherent(dma_st->dma_chan->device->dev, AT91_DMA_BUFFER_SIZE,
+			  dma_st->rx_buf, dma_st->rx_dma_buf);
+	dma_release_channel(dma_st->dma_chan);
+	dma_st->dma_chan = NULL;
+}
+
+static int at91_adc_buffer_setup(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	struct iio_buffer *buffer;
+
+	if (!dma_blocks || !st->dma_st.dma_chan)
+		return iio_triggered_buffer_setup(indio,
+						  &iio_pollfunc_store_time,
+						  &at91_adc_trigger_handler,
+						  &at91_adc_buffer_ops);
+
+	buffer = iio_dma_buffer_alloc(st->dma_st.dma_chan->device->dev,
+				      &at91_adc_block_ops, indio);
+	if (!buffer)
+		return -ENOMEM;
+
+	iio_device_attach_buffer(indio, buffer);
+	indio->modes |= INDIO_BUFFER_HARDWARE;
+	indio->setup_ops = &at91_adc_block_buffer_ops;
+
+	return 0;
+}
+
+static void at91_adc_buffer_cleanup(struct iio_dev *indio)
+{
+	if (indio->modes & INDIO_BUFFER_HARDWARE)
+		iio_dma_buffer_free(indio->buffer);
+	else
+		iio_triggered_buffer_cleanup(indio);
+}
+
+static int at91_adc_trigger_init(struct iio_dev *indio)
+{
+	struct at91_adc_state *st = iio_priv(indio);
+	int ret;
+
+	st->trig = devm_iio_trigger_alloc(indio->dev.parent, "%s-dev%d-ext",
+					  indio->name, indio->id);
+	if (!st->trig)
+		return -ENOMEM;
+
+	st->trig->dev.parent = indio->dev.parent;
+	st->trig->ops = &at91_adc_trigger_ops;
+	iio_trigger_set_drvdata(st->trig, indio);
+
+	ret = iio_trigger_register(st->trig);
+	if (ret)
+		return ret;
+
+	/* The block buffer enables the trigger itself */
+	if (indio->modes & INDIO_BUFFER_TRIGGERED)
+		indio->trig = iio_trigger_get(st->trig);
+
+	return 0;
+}
+
+static int at91_adc_parse_trigger(struct platform_device *pdev,
+				  struct at91_adc_state *st)
+{
+	struct device_node *np = pdev->dev.of_node;
+	u32 edge = IRQ_TYPE_EDGE_RISING;
+
+	st->trigger_sel = AT91_SAMA5D2_MR_TRGSEL_TRIG0;
+	of_property_read_u32(np, "atmel,trigger-sel", &st->trigger_sel);
+	if (st->trigger_sel > AT91_SAMA5D2_MR_TRGSEL_MAX) {
+		dev_err(&pdev->dev, "invalid value for atmel,trigger-sel\n");
+		return -EINVAL;
+	}
+
+	of_property_read_u32(np, "atmel,trigger-edge-type", &edge);
+	switch (edge) {
+	case IRQ_TYPE_EDGE_RISING:
+		st->trigger_mode = AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_RISE;
+		break;
+	case IRQ_TYPE_EDGE_FALLING:
+		st->trigger_mode = AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_FALL;
+		break;
+	case IRQ_TYPE_EDGE_BOTH:
+		st->trigger_mode = AT91_SAMA5D2_TRGR_TRGMOD_EXT_TRIG_ANY;
+		break;
+	default:
+		dev_err(&pdev->dev,
+			"invalid value for atmel,trigger-edge-type\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int at91_adc_probe(struct platform_device *pdev)
 {
 	struct iio_dev *indio_dev;
@@ -405,6 +1461,7 @@ static int at91_adc_probe(struct platform_device *pdev)
 	indio_dev->num_channels = ARRAY_SIZE(at91_adc_channels);
 
 	st = iio_priv(indio_dev);
+	platform_set_drvdata(pdev, indio_dev);
 
 	ret = of_property_read_u32(pdev->dev.of_node,
 				   "atmel,min-sample-rate-hz",
@@ -432,13 +1489,21 @@ static int at91_adc_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	ret = at91_adc_parse_trigger(pdev, st);
+	if (ret)
+		return ret;
+
 	init_waitqueue_head(&st->wq_data_available);
 	mutex_init(&st->lock);
+	spin_lock_init(&st->cmp_lock);
+	st->cmp.chan = -1;
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res)
 		return -EINVAL;
 
+	st->phys_base = res->start;
+
 	st->base = devm_ioremap_resource(&pdev->dev, res);
 	if (IS_ERR(st->base))
 		return PTR_ERR(st->base);
@@ -489,23 +1554,43 @@ static int at91_adc_probe(struct platform_device *pdev)
 	 * allows different analog settings for each channel.
 	 */
 	at91_adc_writel(st, AT91_SAMA5D2_MR,
-			AT91_SAMA5D2_MR_TRANSFER(2) | AT91_SAMA5D2_MR_ANACH);
+			AT91_SAMA5D2_MR_TRANSFER(2) | AT91_SAMA5D2_MR_ANACH |
+			AT91_SAMA5D2_MR_TRGSEL(st->trigger_sel));
 
 	at91_adc_setup_samp_freq(st, st->soc_info.min_sample_rate);
+	at91_adc_config_osr(st, 1);
 
 	ret = clk_prepare_enable(st->per_clk);
 	if (ret)
 		goto vref_disable;
 
+	ret = at91_adc_dma_init(pdev, st);
+	if (ret)
+		goto per_clk_disable_unprepare;
+
+	ret = at91_adc_buffer_setup(indio_dev);
+	if (ret)
+		goto dma_release;
+
+	ret = at91_adc_trigger_init(indio_dev);
+	if (ret)
+		goto buffer_cleanup;
+
 	ret = iio_device_register(indio_dev);
 	if (ret < 0)
-		goto per_clk_disable_unprepare;
+		goto trigger_unregister;
 
 	dev_info(&pdev->dev, "version: %x\n",
 		 readl_relaxed(st->base + AT91_SAMA5D2_VERSION));
 
 	return 0;
 
+trigger_unregister:
+	iio_trigger_unregister(st->trig);
+buffer_cleanup:
+	at91_adc_buffer_cleanup(indio_dev);
+dma_release:
+	at91_adc_dma_release(st);
 per_clk_disable_unprepare:
 	clk_disable_unprepare(st->per_clk);
 vref_disable:
@@ -522,6 +1607,10 @@ static int at91_adc_remove(struct platform_device *pdev)
 
 	iio_device_unregister(indio_dev);
 
+	iio_trigger_unregister(st->trig);
+	at91_adc_buffer_cleanup(indio_dev);
+	at91_adc_dma_release(st);
+
 	clk_disable_unprepare(st->per_clk);
 
 	regulator_disable(st->vref);
@@ -9,6 +9,7 @@
 #include <linux/bitmap.h>
 #include <linux/bitops.h>
 #include <linux/clk.h>
+#include <linux/dma-mapping.h>
 #include <linux/err.h>
 #include <linux/io.h>
 #include <linux/input.h>
@@ -24,6 +25,7 @@
 #include <linux/wait.h>
 
 #include <linux/platform_data/at91_adc.h>
+#include <linux/atmel_pdc.h>
 
 #include <linux/iio/iio.h>
 #include <linux/iio/buffer.h>
@@ -112,6 +114,8 @@
 #define			AT91_ADC_TSMR_TSMODE_5WIRE		(3 << 0)
 #define		AT91_ADC_TSMR_TSAV	(3 << 4)	/* Averages samples */
 #define			AT91_ADC_TSMR_TSAV_(x)		((x) << 4)
+#define		AT91_ADC_TSMR_TSFREQ	(0x0f << 8)	/* Touch Screen Frequency */
+#define			AT91_ADC_TSMR_TSFREQ_(x)	((x) << 8)
 #define		AT91_ADC_TSMR_SCTIM	(0x0f << 16)	/* Switch closure time */
 #define		AT91_ADC_TSMR_PENDBC	(0x0f << 28)	/* Pen Debounce time */
 #define			AT91_ADC_TSMR_PENDBC_(x)	((x) << 28)
@@ -144,10 +148,19 @@
 #define DRIVER_NAME		"at91_adc"
 #define MAX_POS_BITS		12
 
-#define TOUCH_SAMPLE_PERIOD_US		2000	/* 2ms */
+#define TOUCH_REPORT_PERIOD_US		16000	/* 62.5 Hz */
+/*
+ * One position every 2^TOUCH_TSFREQ triggers, averaged over up to as many
+ * conversions: TSFREQ must not be less than TSAV.
+ */
+#define TOUCH_TSFREQ			3
+#define TOUCH_MAX_AVERAGE		3
 #define TOUCH_PEN_DETECT_DEBOUNCE_US	200
 
 #define MAX_RLPOS_BITS         10
+
+/* Most scans a PDC block can hold, see at91_adc_set_watermark() */
+#define AT91_ADC_PDC_MAX_SCANS	128
 #define TOUCH_SAMPLE_PERIOD_US_RL      10000   /* 10ms, the SoC can't keep up with 2ms */
 #define TOUCH_SHTIM                    0xa
 
@@ -186,6 +199,24 @@ struct at91_adc_caps {
 
 	u8	num_channels;
 	struct at91_adc_reg_desc registers;
+
+	bool	has_pdc;	/* PDC reading LCDR on each DRDY */
+};
+
+/**
+ * struct at91_adc_pdc - PDC block capture
+ * @buf:	two blocks of @watermark scans, filled in turn by the PDC
+ * @dma:	bus address of @buf
+ * @watermark:	scans per block, the PDC is only used above one
+ * @cur:	block the PDC is currently filling
+ * @ts:		timestamp of the end of the previous block
+ */
+struct at91_adc_pdc {
+	u16		*buf;
+	dma_addr_t	dma;
+	unsigned	watermark;
+	int		cur;
+	s64		ts;
 };
 
 struct at91_adc_state {
@@ -234,10 +265,19 @@ struct at91_adc_state {
 	u16			ts_sample_period_val;
 	u32			ts_pressure_threshold;
 	u16			ts_pendbc;
+	u8			ts_average;
+	u32			ts_report_period_us;
+	/* data ready flags of a position, and the one that comes last */
+	u32			ts_data_mask;
+	u32			ts_data_irq;
 
 	bool			ts_bufferedmeasure;
 	u32			ts_prev_absx;
 	u32			ts_prev_absy;
+
+	struct at91_adc_pdc	pdc;
+	bool			pdc_active;
+	unsigned		scan_cnt;
 };
 
 static irqreturn_t at91_adc_trigger_handler(int irq, void *p)
@@ -281,6 +321,90 @@ static void handle_adc_eoc_trigger(int irq, struct iio_dev *idev)
 	}
 }
 
+/*
+ * PDC mode: the PDC moves each conversion from LCDR into one of two blocks
+ * of st->pdc.watermark scans. ENDRX is raised when a block is full; its
+ * scans are pushed at once and the block is queued again as the next one.
+ */
+static void at91_adc_pdc_push(struct iio_dev *idev, int idx, s64 ts,
+			      s64 interval)
+{
+	struct at91_adc_state *st = iio_priv(idev);
+	struct at91_adc_pdc *pdc = &st->pdc;
+	u16 *scan = pdc->buf + idx * pdc->watermark * st->scan_cnt;
+	int i;
+
+	for (i = 0; i < pdc->watermark; i++) {
+		memcpy(st->buffer, scan, st->scan_cnt * sizeof(*scan));
+		iio_push_to_buffers_with_timestamp(idev, st->buffer, ts);
+		scan += st->scan_cnt;
+		ts += interval;
+	}
+}
+
+static void at91_adc_pdc_irq(struct iio_dev *idev)
+{
+	struct at91_adc_state *st = iio_priv(idev);
+	struct at91_adc_pdc *pdc = &st->pdc;
+	unsigned block = pdc->watermark * st->scan_cnt;
+	s64 now, interval;
+
+	now = iio_get_time_ns();
+	interval = div_s64(now - pdc->ts, pdc->watermark);
+	pdc->ts = now;
+
+	if (!at91_adc_readl(st, ATMEL_PDC_RCR)) {
+		/* Both blocks are full and the PDC stopped: drain, restart */
+		at91_adc_pdc_push(idev, pdc->cur,
+				  now - interval * (2 * pdc->watermark - 1),
+				  interval);
+		at91_adc_pdc_push(idev, pdc->cur ^ 1,
+				  now - interval * (pdc->watermark - 1),
+				  interval);
+
+		pdc->cur = 0;
+		at91_adc_writel(st, ATMEL_PDC_RPR, pdc->dma);
+		at91_adc_writel(st, ATMEL_PDC_RCR, block);
+		at91_adc_writel(st, ATMEL_PDC_RNPR,
+				pdc->dma + block * sizeof(u16));
+		at91_adc_writel(st, ATMEL_PDC_RNCR, block);
+		return;
+	}
+
+	at91_adc_pdc_push(idev, pdc->cur, now - interval * (pdc->watermark - 1),
+			  interval);
+
+	/* The PDC moved on to the other block, queue this one after it */
+	at91_adc_writel(st, ATMEL_PDC_RNPR,
+			pdc->dma + pdc->cur * block * sizeof(u16));
+	at91_adc_writel(st, ATMEL_PDC_RNCR, block);
+	pdc->cur ^= 1;
+}
+
+static void at91_adc_pdc_start(struct at91_adc_state *st)
+{
+	struct at91_adc_pdc *pdc = &st->pdc;
+	unsigned block = pdc->watermark * st->scan_cnt;
+
+	pdc->cur = 0;
+	pdc->ts = iio_get_time_ns();
+
+	at91_adc_writel(st, ATMEL_PDC_RPR, pdc->dma);
+	at91_adc_writel(st, ATMEL_PDC_RCR, block);
+	at91_adc_writel(st, ATMEL_PDC_RNPR, pdc->dma + block * sizeof(u16));
+	at91_adc_writel(st, ATMEL_PDC_RNCR, block);
+	at91_adc_writel(st, ATMEL_PDC_PTCR, ATMEL_PDC_RXTEN);
+	at91_adc_writel(st, AT91_ADC_IER, AT91_ADC_ENDRX);
+}
+
+static void at91_adc_pdc_stop(struct at91_adc_state *st)
+{
+	at91_adc_writel(st, AT91_ADC_IDR, AT91_ADC_ENDRX);
+	at91_adc_writel(st, ATMEL_PDC_PTCR, ATMEL_PDC_RXTDIS);
+	at91_adc_writel(st, ATMEL_PDC_RCR, 0);
+	at91_adc_writel(st, ATMEL_PDC_RNCR, 0);
+}
+
 static int at91_ts_sample(struct at91_adc_state *st)
 {
 	unsigned int xscale, yscale, reg, z1, z2;
@@ -315,6 +439,15 @@ static int at91_ts_sample(struct at91_adc_state *st)
 	}
 	y /= yscale;
 
+	/* no pressure measurement in 5-wire mode */
+	if (st->touchscreen_type == ATMEL_ADC_TOUCHSCREEN_5WIRE) {
+		input_report_abs(st->ts_input, ABS_X, x);
+		input_report_abs(st->ts_input, ABS_Y, y);
+		input_report_key(st->ts_input, BTN_TOUCH, 1);
+		input_sync(st->ts_input);
+		return 0;
+	}
+
 	/* calculate the pressure */
 	reg = at91_adc_readl(st, AT91_ADC_TSPRESSR);
 	z1 = reg & xyz_mask;
@@ -355,6 +488,9 @@ static irqreturn_t at91_adc_rl_interrupt(int irq, void *private)
 	if (status & GENMASK(st->num_channels - 1, 0))
 		handle_adc_eoc_trigger(irq, idev);
 
+	if (st->pdc_active && (status & AT91_ADC_ENDRX))
+		at91_adc_pdc_irq(idev);
+
 	if (status & AT91RL_ADC_IER_PEN) {
 		/* Disabling pen debounce is required to get a NOPEN irq */
 		reg = at91_adc_readl(st, AT91_ADC_MR);
@@ -414,18 +550,18 @@ static irqreturn_t at91_adc_9x5_interrupt(int irq, void *private)
 	struct iio_dev *idev = private;
 	struct at91_adc_state *st = iio_priv(idev);
 	u32 status = at91_adc_readl(st, st->registers->status_register);
-	const uint32_t ts_data_irq_mask =
-		AT91_ADC_IER_XRDY |
-		AT91_ADC_IER_YRDY |
-		AT91_ADC_IER_PRDY;
 
 	if (status & GENMASK(st->num_channels - 1, 0))
 		handle_adc_eoc_trigger(irq, idev);
 
+	/*
+	 * The trigger only runs while the pen is down, and a position costs a
+	 * single interrupt, on the last of its data ready flags.
+	 */
 	if (status & AT91_ADC_IER_PEN) {
 		at91_adc_writel(st, AT91_ADC_IDR, AT91_ADC_IER_PEN);
 		at91_adc_writel(st, AT91_ADC_IER, AT91_ADC_IER_NOPEN |
-			ts_data_irq_mask);
+			st->ts_data_irq);
 		/* Set up period trigger for sampling */
 		at91_adc_writel(st, st->registers->trigger_register,
 			AT91_ADC_TRGR_MOD_PERIOD_TRIG |
@@ -433,12 +569,12 @@ static irqreturn_t at91_adc_9x5_interrupt(int irq, void *private)
 	} else if (status & AT91_ADC_IER_NOPEN) {
 		at91_adc_writel(st, st->registers->trigger_register, 0);
 		at91_adc_writel(st, AT91_ADC_IDR, AT91_ADC_IER_NOPEN |
-			ts_data_irq_mask);
+			st->ts_data_irq);
 		at91_adc_writel(st, AT91_ADC_IER, AT91_ADC_IER_PEN);
 
 		input_report_key(st->ts_input, BTN_TOUCH, 0);
 		input_sync(st->ts_input);
-	} else if ((status & ts_data_irq_mask) == ts_data_irq_mask) {
+	} else if ((status & st->ts_data_mask) == st->ts_data_mask) {
 		/* Now all touchscreen data is ready */
 
 		if (status & AT91_ADC_ISR_PENS) {
@@ -560,19 +696,33 @@ static int at91_adc_configure_trigger(struct iio_trigger *trig, bool state)
 		if (st->buffer == NULL)
 			return -ENOMEM;
 
-		at91_adc_writel(st, reg->trigger_register,
-				status | value);
-
+		st->scan_cnt = 0;
 		for_each_set_bit(bit, idev->active_scan_mask,
 				 st->num_channels) {
 			struct iio_chan_spec const *chan = idev->channels + bit;
 			at91_adc_writel(st, AT91_ADC_CHER,
 					AT91_ADC_CH(chan->channel));
+			st->scan_cnt++;
 		}
 
-		at91_adc_writel(st, AT91_ADC_IER, reg->drdy_mask);
+		/*
+		 * Channels are converted in increasing order, which is also
+		 * the scan order, so the PDC blocks hold ready-made scans.
+		 */
+		st->pdc_active = st->pdc.buf && st->pdc.watermark > 1 &&
+				 st->scan_cnt;
+		if (st->pdc_active)
+			at91_adc_pdc_start(st);
+		else
+			at91_adc_writel(st, AT91_ADC_IER, reg->drdy_mask);
 
+		at91_adc_writel(st, reg->trigger_register,
+				status | value);
 	} else {
+		if (st->pdc_active) {
+			at91_adc_pdc_stop(st);
+			st->pdc_active = false;
+		}
 		at91_adc_writel(st, AT91_ADC_IDR, reg->drdy_mask);
 
 		at91_adc_writel(st, reg->trigger_register,
@@ -669,6 +819,19 @@ static void at91_adc_trigger_remove(struct iio_dev *idev)
 
 static int at91_adc_buffer_init(struct iio_dev *idev)
 {
+	struct at91_adc_state *st = iio_priv(idev);
+
+	st->pdc.watermark = 1;
+	if (st->caps->has_pdc) {
+		st->pdc.buf = dmam_alloc_coherent(idev->dev.parent,
+				2 * AT91_ADC_PDC_MAX_SCANS *
+				st->num_channels * sizeof(u16),
+				&st->pdc.dma, GFP_KERNEL);
+		if (!st->pdc.buf)
+			dev_warn(idev->dev.parent,
+				 "no memory for PDC, using per-trigger reads\n");
+	}
+
 	return iio_triggered_buffer_setup(idev, &iio_pollfunc_store_time,
 		&at91_adc_trigger_handler, NULL);
 }
@@ -844,6 +1007,16 @@ static int at91_adc_probe_dt_ts(struct device_node *node,
 
 	if (!st->caps->has_tsmr)
 		return 0;
+
+	st->ts_average = st->caps->ts_filter_average;
+	if (!of_property_read_u32(node, "atmel,adc-ts-average", &prop))
+		st->ts_average = min_t(u32, prop, TOUCH_MAX_AVERAGE);
+
+	prop = 0;
+	of_property_read_u32(node, "atmel,adc-ts-report-rate", &prop);
+	if (prop)
+		st->ts_report_period_us = DIV_ROUND_UP(USEC_PER_SEC, prop);
+
 	prop = 0;
 	of_property_read_u32(node, "atmel,adc-ts-pressure-threshold", &prop);
 	st->ts_pressure_threshold = prop;
@@ -968,6 +1141,16 @@ static int at91_adc_probe_pdata(struct at91_adc_state *st,
 	st->trigger_list = pdata->trigger_list;
 	st->registers = &st->caps->registers;
 	st->touchscreen_type = pdata->touchscreen_type;
+	st->ts_average = st->caps->ts_filter_average;
+
+	return 0;
+}
+
+static int at91_adc_set_watermark(struct iio_dev *idev, unsigned val)
+{
+	struct at91_adc_state *st = iio_priv(idev);
+
+	st->pdc.watermark = clamp_t(unsigned, val, 1, AT91_ADC_PDC_MAX_SCANS);
 
 	return 0;
 }
@@ -975,6 +1158,7 @@ static int at91_adc_probe_pdata(struct at91_adc_state *st,
 static const struct iio_info at91_adc_info = {
 	.driver_module = THIS_MODULE,
 	.read_raw = &at91_adc_read_raw,
+	.hwfifo_set_watermark = &at91_adc_set_watermark,
 };
 
 /* Touchscreen related functions */
@@ -1001,7 +1185,7 @@ static void atmel_ts_close(struct input_dev *dev)
 
 static int at91_ts_hw_init(struct at91_adc_state *st, u32 adc_clk_khz)
 {
-	u32 reg = 0;
+	u32 reg = 0, period;
 	int i = 0;
 
 	/* a Pen Detect Debounce Time is necessary for the ADC Touch to avoid
@@ -1034,17 +1218,22 @@ static int at91_ts_hw_init(struct at91_adc_state *st, u32 adc_clk_khz)
 		return 0;
 	}
 
-	if (st->touchscreen_type == ATMEL_ADC_TOUCHSCREEN_4WIRE)
+	if (st->touchscreen_type == ATMEL_ADC_TOUCHSCREEN_4WIRE) {
 		reg = AT91_ADC_TSMR_TSMODE_4WIRE_PRESS;
-	else
+		st->ts_data_mask = AT91_ADC_IER_XRDY | AT91_ADC_IER_YRDY |
+				   AT91_ADC_IER_PRDY;
+		st->ts_data_irq = AT91_ADC_IER_PRDY;
+	} else {
 		reg = AT91_ADC_TSMR_TSMODE_5WIRE;
+		st->ts_data_mask = AT91_ADC_IER_XRDY | AT91_ADC_IER_YRDY;
+		st->ts_data_irq = AT91_ADC_IER_YRDY;
+	}
 
-	reg |= AT91_ADC_TSMR_TSAV_(st->caps->ts_filter_average)
-	       & AT91_ADC_TSMR_TSAV;
+	reg |= AT91_ADC_TSMR_TSAV_(st->ts_average) & AT91_ADC_TSMR_TSAV;
 	reg |= AT91_ADC_TSMR_PENDBC_(st->ts_pendbc) & AT91_ADC_TSMR_PENDBC;
 	reg |= AT91_ADC_TSMR_NOTSDMA;
 	reg |= AT91_ADC_TSMR_PENDET_ENA;
-	reg |= 0x03 << 8;	/* TSFREQ, needs to be bigger than TSAV */
+	reg |= AT91_ADC_TSMR_TSFREQ_(TOUCH_TSFREQ) & AT91_ADC_TSMR_TSFREQ;
 
 	at91_adc_writel(st, AT91_ADC_TSMR, reg);
 
@@ -1056,9 +1245,16 @@ static int at91_ts_hw_init(struct at91_adc_state *st, u32 adc_clk_khz)
 	at91_adc_writel(st, AT91_ADC_ACR, st->caps->ts_pen_detect_sensitivity
 			& AT91_ADC_ACR_PENDETSENS);
 
-	/* Sample Period Time = (TRGPER + 1) / ADCClock */
-	st->ts_sample_period_val = round_up((TOUCH_SAMPLE_PERIOD_US *
-			adc_clk_khz / 1000) - 1, 1);
+	/*
+	 * Sample Period Time = (TRGPER + 1) / ADCClock, the touchscreen
+	 * is measured every 2^TSFREQ samples.
+	 */
+	if (!st->ts_report_period_us)
+		st->ts_report_period_us = TOUCH_REPORT_PERIOD_US;
+	period = DIV_ROUND_UP((st->ts_report_period_us >> TOUCH_TSFREQ) *
+			      adc_clk_khz, 1000);
+	st->ts_sample_period_val = clamp_t(u32, period, 1,
+					   AT91_ADC_TRGR_TRGPER >> 16) - 1;
 
 	return 0;
 }
@@ -1345,6 +1541,7 @@ static struct at91_adc_caps at91sam9260_caps = {
 		.mr_prescal_mask = AT91_ADC_PRESCAL_9260,
 		.mr_startup_mask = AT91_ADC_STARTUP_9260,
 	},
+	.has_pdc = true,
 };
 
 static struct at91_adc_caps at91sam9rl_caps = {
@@ -1359,6 +1556,7 @@ static struct at91_adc_caps at91sam9rl_caps = {
 		.mr_prescal_mask = AT91_ADC_PRESCAL_9260,
 		.mr_startup_mask = AT91_ADC_STARTUP_9G45,
 	},
+	.has_pdc = true,
 };
 
 static struct at91_adc_caps at91sam9g45_caps = {
@@ -1373,6 +1571,7 @@ static struct at91_adc_caps at91sam9g45_caps = {
 		.mr_prescal_mask = AT91_ADC_PRESCAL_9G45,
 		.mr_startup_mask = AT91_ADC_STARTUP_9G45,
 	},
+	.has_pdc = true,
 };
 
 static struct at91_adc_caps at91sam9x5_caps = {
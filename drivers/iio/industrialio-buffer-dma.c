@@ -0,0 +1,641 @@
+/*
+ * Industrial I/O - DMA block buffer
+ *
+ * The buffer is a set of DMA-able blocks the driver fills one at a time,
+ * without the samples going through a kfifo. Userspace can allocate the
+ * blocks, map them and hand them over to the device and back with the
+ * IIO_BUFFER_BLOCK_* ioctls, so that the CPU never copies the samples.
+ * When it doesn't, the buffer allocates a few blocks of its own on enable
+ * and read() copies out of them.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer-dma.h>
+
+#define IIO_DMA_BUFFER_DEFAULT_LENGTH	1024
+/* Blocks allocated for read(), the length of the buffer is split among them */
+#define IIO_DMA_BUFFER_FILEIO_BLOCKS	4
+#define IIO_DMA_BUFFER_MAX_BLOCKS	64
+#define IIO_DMA_BUFFER_MAX_BLOCK_SIZE	SZ_16M
+
+#define iio_to_dma_queue(r) container_of(r, struct iio_dma_buffer_queue, buffer)
+
+static struct iio_dma_buffer_block *
+iio_dma_buffer_alloc_block(struct iio_dma_buffer_queue *queue, size_t size,
+			   u32 id, u32 offset)
+{
+	struct iio_dma_buffer_block *block;
+
+	block = kzalloc(sizeof(*block), GFP_KERNEL);
+	if (!block)
+		return NULL;
+
+	block->vaddr = dma_alloc_coherent(queue->dev, PAGE_ALIGN(size),
+					  &block->phys_addr, GFP_KERNEL);
+	if (!block->vaddr) {
+		kfree(block);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&block->head);
+	block->queue = queue;
+	block->block.id = id;
+	block->block.size = size;
+	block->block.data.offset = offset;
+	block->state = IIO_BLOCK_STATE_DEQUEUED;
+
+	return block;
+}
+
+/* Called with the queue lock held, the buffer disabled and nothing mapped */
+static void iio_dma_buffer_free_blocks_locked(struct iio_dma_buffer_queue *queue)
+{
+	struct iio_dma_buffer_block *block;
+	unsigned int i;
+
+	for (i = 0; i < queue->num_blocks; i++) {
+		block = queue->blocks[i];
+		dma_free_coherent(queue->dev, PAGE_ALIGN(block->block.size),
+				  block->vaddr, block->phys_addr);
+		kfree(block);
+	}
+
+	kfree(queue->blocks);
+	queue->blocks = NULL;
+	queue->num_blocks = 0;
+	queue->fileio = false;
+	queue->fileio_pos = 0;
+
+	spin_lock_irq(&queue->list_lock);
+	INIT_LIST_HEAD(&queue->incoming);
+	INIT_LIST_HEAD(&queue->outgoing);
+	spin_unlock_irq(&queue->list_lock);
+}
+
+/* Called with the queue lock held and no blocks allocated */
+static int iio_dma_buffer_alloc_blocks_locked(struct iio_dma_buffer_queue *queue,
+					      size_t size, unsigned int count)
+{
+	struct iio_dma_buffer_block **blocks;
+	u32 offset = 0;
+	unsigned int i;
+
+	blocks = kcalloc(count, sizeof(*blocks), GFP_KERNEL);
+	if (!blocks)
+		return -ENOMEM;
+
+	queue->blocks = blocks;
+	for (i = 0; i < count; i++) {
+		blocks[i] = iio_dma_buffer_alloc_block(queue, size, i, offset);
+		if (!blocks[i]) {
+			iio_dma_buffer_free_blocks_locked(queue);
+			return -ENOMEM;
+		}
+
+		queue->num_blocks++;
+		offset += PAGE_ALIGN(size);
+	}
+
+	return 0;
+}
+
+/*
+ * Hand a dequeued block over to the device: to the driver right away when
+ * the buffer is enabled, to the incoming list otherwise. Called with the
+ * queue lock held.
+ */
+static int iio_dma_buffer_queue_block(struct iio_dma_buffer_queue *queue,
+				      struct iio_dma_buffer_block *block)
+{
+	int ret;
+
+	block->block.bytes_used = 0;
+
+	spin_lock_irq(&queue->list_lock);
+	if (!queue->active) {
+		block->state = IIO_BLOCK_STATE_QUEUED;
+		list_add_tail(&block->head, &queue->incoming);
+		spin_unlock_irq(&queue->list_lock);
+		return 0;
+	}
+	block->state = IIO_BLOCK_STATE_ACTIVE;
+	spin_unlock_irq(&queue->list_lock);
+
+	ret = queue->ops->submit(queue, block);
+	if (ret) {
+		spin_lock_irq(&queue->list_lock);
+		block->state = IIO_BLOCK_STATE_DEQUEUED;
+		spin_unlock_irq(&queue->list_lock);
+	}
+
+	return ret;
+}
+
+/**
+ * iio_dma_buffer_block_done() - complete a block
+ * @block: block the driver has filled with @block->block.bytes_used bytes
+ *
+ * Can be called from any context, but not from the submit callback.
+ */
+void iio_dma_buffer_block_done(struct iio_dma_buffer_block *block)
+{
+	struct iio_dma_buffer_queue *queue = block->queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->list_lock, flags);
+
+	/* The buffer got the block back when it was disabled */
+	if (block->state != IIO_BLOCK_STATE_ACTIVE) {
+		spin_unlock_irqrestore(&queue->list_lock, flags);
+		return;
+	}
+
+	block->block.timestamp = iio_get_time_ns();
+	block->state = IIO_BLOCK_STATE_DONE;
+	list_add_tail(&block->head, &queue->outgoing);
+
+	spin_unlock_irqrestore(&queue->list_lock, flags);
+
+	wake_up_interruptible_poll(&queue->buffer.pollq, POLLIN | POLLRDNORM);
+}
+EXPORT_SYMBOL_GPL(iio_dma_buffer_block_done);
+
+/* Called with the queue lock held */
+static int iio_dma_buffer_fileio_setup(struct iio_dma_buffer_queue *queue)
+{
+	struct iio_buffer *buffer = &queue->buffer;
+	unsigned int i;
+	size_t size;
+	int ret;
+
+	iio_dma_buffer_free_blocks_locked(queue);
+
+	if (!buffer->bytes_per_datum || buffer->length <= 0)
+		return -EINVAL;
+
+	size = buffer->bytes_per_datum *
+	       DIV_ROUND_UP(buffer->length, IIO_DMA_BUFFER_FILEIO_BLOCKS);
+	ret = iio_dma_buffer_alloc_blocks_locked(queue, size,
+						 IIO_DMA_BUFFER_FILEIO_BLOCKS);
+	if (ret)
+		return ret;
+
+	queue->fileio = true;
+	for (i = 0; i < queue->num_blocks; i++)
+		iio_dma_buffer_queue_block(queue, queue->blocks[i]);
+
+	return 0;
+}
+
+/**
+ * iio_dma_buffer_enable() - start filling the blocks
+ * @buffer: DMA block buffer
+ *
+ * To be called by the driver once the device is ready for the first block
+ * to be submitted, usually from the postenable setup op.
+ */
+int iio_dma_buffer_enable(struct iio_buffer *buffer)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *block, *tmp;
+	LIST_HEAD(incoming);
+	int ret = 0;
+
+	mutex_lock(&queue->lock);
+
+	if (!queue->num_blocks || queue->fileio) {
+		ret = iio_dma_buffer_fileio_setup(queue);
+		if (ret)
+			goto out_unlock;
+	}
+
+	spin_lock_irq(&queue->list_lock);
+	queue->active = true;
+	list_splice_init(&queue->incoming, &incoming);
+	spin_unlock_irq(&queue->list_lock);
+
+	list_for_each_entry_safe(block, tmp, &incoming, head) {
+		list_del_init(&block->head);
+		ret = iio_dma_buffer_queue_block(queue, block);
+		if (ret) {
+			/* Keep this block and the next ones for later */
+			spin_lock_irq(&queue->list_lock);
+			block->state = IIO_BLOCK_STATE_QUEUED;
+			list_add(&block->head, &incoming);
+			list_splice(&incoming, &queue->incoming);
+			spin_unlock_irq(&queue->list_lock);
+			break;
+		}
+	}
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(iio_dma_buffer_enable);
+
+/**
+ * iio_dma_buffer_disable() - stop filling the blocks
+ * @buffer: DMA block buffer
+ *
+ * The blocks the driver has not completed are queued again, the filled ones
+ * can still be dequeued or read.
+ */
+void iio_dma_buffer_disable(struct iio_buffer *buffer)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *block;
+	unsigned int i;
+
+	mutex_lock(&queue->lock);
+
+	queue->ops->abort(queue);
+
+	spin_lock_irq(&queue->list_lock);
+	queue->active = false;
+	for (i = 0; i < queue->num_blocks; i++) {
+		block = queue->blocks[i];
+		if (block->state != IIO_BLOCK_STATE_ACTIVE)
+			continue;
+		block->state = IIO_BLOCK_STATE_QUEUED;
+		list_add_tail(&block->head, &queue->incoming);
+	}
+	spin_unlock_irq(&queue->list_lock);
+
+	mutex_unlock(&queue->lock);
+}
+EXPORT_SYMBOL_GPL(iio_dma_buffer_disable);
+
+static int iio_dma_buffer_read(struct iio_buffer *buffer, size_t n,
+			       char __user *user_buffer)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *block;
+	int ret;
+
+	if (n < buffer->bytes_per_datum || !buffer->bytes_per_datum)
+		return -EINVAL;
+
+	mutex_lock(&queue->lock);
+
+	/* The blocks belong to userspace */
+	if (queue->num_blocks && !queue->fileio) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	spin_lock_irq(&queue->list_lock);
+	block = list_first_entry_or_null(&queue->outgoing,
+					 struct iio_dma_buffer_block, head);
+	spin_unlock_irq(&queue->list_lock);
+	if (!block) {
+		ret = 0;
+		goto out_unlock;
+	}
+
+	n = rounddown(n, buffer->bytes_per_datum);
+	n = min_t(size_t, n, block->block.bytes_used - queue->fileio_pos);
+
+	if (copy_to_user(user_buffer, block->vaddr + queue->fileio_pos, n)) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+
+	spin_lock_irq(&queue->list_lock);
+	queue->fileio_pos += n;
+	if (queue->fileio_pos < block->block.bytes_used) {
+		block = NULL;
+	} else {
+		list_del_init(&block->head);
+		block->state = IIO_BLOCK_STATE_DEQUEUED;
+		queue->fileio_pos = 0;
+	}
+	spin_unlock_irq(&queue->list_lock);
+
+	/* Hand the block back once it has been read entirely */
+	if (block)
+		iio_dma_buffer_queue_block(queue, block);
+
+	ret = n;
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static size_t iio_dma_buffer_data_available(struct iio_buffer *buffer)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *block;
+	size_t bytes = 0;
+
+	if (!buffer->bytes_per_datum)
+		return 0;
+
+	spin_lock_irq(&queue->list_lock);
+	list_for_each_entry(block, &queue->outgoing, head)
+		bytes += block->block.bytes_used;
+	if (queue->fileio)
+		bytes -= queue->fileio_pos;
+	spin_unlock_irq(&queue->list_lock);
+
+	return bytes / buffer->bytes_per_datum;
+}
+
+static int iio_dma_buffer_set_bytes_per_datum(struct iio_buffer *buffer,
+					      size_t bpd)
+{
+	buffer->bytes_per_datum = bpd;
+
+	return 0;
+}
+
+static int iio_dma_buffer_set_length(struct iio_buffer *buffer, int length)
+{
+	/* Avoid an invalid state */
+	if (length < 2)
+		length = 2;
+	buffer->length = length;
+
+	return 0;
+}
+
+static int iio_dma_buffer_alloc_blocks(struct iio_buffer *buffer,
+				       struct iio_buffer_block_alloc_req *req)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	int ret = 0;
+
+	mutex_lock(&queue->lock);
+
+	if (queue->active || atomic_read(&queue->mapped)) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	iio_dma_buffer_free_blocks_locked(queue);
+	if (!req->count)
+		goto out_unlock;
+
+	if (!req->size || req->size > IIO_DMA_BUFFER_MAX_BLOCK_SIZE) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	req->count = min_t(u32, req->count, IIO_DMA_BUFFER_MAX_BLOCKS);
+	ret = iio_dma_buffer_alloc_blocks_locked(queue, req->size, req->count);
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static int iio_dma_buffer_free_blocks(struct iio_buffer *buffer)
+{
+	struct iio_buffer_block_alloc_req req = { .count = 0 };
+
+	return iio_dma_buffer_alloc_blocks(buffer, &req);
+}
+
+/* Called with the queue lock held */
+static struct iio_dma_buffer_block *
+iio_dma_buffer_get_block(struct iio_dma_buffer_queue *queue, u32 id)
+{
+	if (queue->fileio || id >= queue->num_blocks)
+		return NULL;
+
+	return queue->blocks[id];
+}
+
+static int iio_dma_buffer_query_block(struct iio_buffer *buffer,
+				      struct iio_buffer_block *block)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *dma_block;
+	int ret = 0;
+
+	mutex_lock(&queue->lock);
+
+	dma_block = iio_dma_buffer_get_block(queue, block->id);
+	if (dma_block)
+		*block = dma_block->block;
+	else
+		ret = -EINVAL;
+
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static int iio_dma_buffer_enqueue_block(struct iio_buffer *buffer,
+					struct iio_buffer_block *block)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *dma_block;
+	int ret;
+
+	mutex_lock(&queue->lock);
+
+	dma_block = iio_dma_buffer_get_block(queue, block->id);
+	if (!dma_block || dma_block->state != IIO_BLOCK_STATE_DEQUEUED) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	ret = iio_dma_buffer_queue_block(queue, dma_block);
+	if (!ret)
+		*block = dma_block->block;
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static int iio_dma_buffer_dequeue_block(struct iio_buffer *buffer,
+					struct iio_buffer_block *block)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	struct iio_dma_buffer_block *dma_block;
+	int ret = 0;
+
+	mutex_lock(&queue->lock);
+
+	if (!queue->num_blocks || queue->fileio) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	spin_lock_irq(&queue->list_lock);
+	dma_block = list_first_entry_or_null(&queue->outgoing,
+					     struct iio_dma_buffer_block, head);
+	if (dma_block) {
+		list_del_init(&dma_block->head);
+		dma_block->state = IIO_BLOCK_STATE_DEQUEUED;
+	}
+	spin_unlock_irq(&queue->list_lock);
+
+	if (dma_block)
+		*block = dma_block->block;
+	else
+		ret = -EAGAIN;
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static void iio_dma_buffer_vm_open(struct vm_area_struct *vma)
+{
+	struct iio_dma_buffer_queue *queue = vma->vm_private_data;
+
+	atomic_inc(&queue->mapped);
+}
+
+static void iio_dma_buffer_vm_close(struct vm_area_struct *vma)
+{
+	struct iio_dma_buffer_queue *queue = vma->vm_private_data;
+
+	atomic_dec(&queue->mapped);
+}
+
+static const struct vm_operations_struct iio_dma_buffer_vm_ops = {
+	.open = iio_dma_buffer_vm_open,
+	.close = iio_dma_buffer_vm_close,
+};
+
+static int iio_dma_buffer_mmap(struct iio_buffer *buffer,
+			       struct vm_area_struct *vma)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	size_t size = vma->vm_end - vma->vm_start;
+	struct iio_dma_buffer_block *block = NULL;
+	unsigned int i;
+	int ret;
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	mutex_lock(&queue->lock);
+
+	for (i = 0; !queue->fileio && i < queue->num_blocks; i++) {
+		if (queue->blocks[i]->block.data.offset == offset) {
+			block = queue->blocks[i];
+			break;
+		}
+	}
+
+	if (!block || size != PAGE_ALIGN(block->block.size)) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	vma->vm_pgoff = 0;
+	ret = dma_mmap_coherent(queue->dev, vma, block->vaddr,
+				block->phys_addr, size);
+	if (ret)
+		goto out_unlock;
+
+	vma->vm_ops = &iio_dma_buffer_vm_ops;
+	vma->vm_private_data = queue;
+	iio_dma_buffer_vm_open(vma);
+
+out_unlock:
+	mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+static void iio_dma_buffer_release(struct iio_buffer *buffer)
+{
+	struct iio_dma_buffer_queue *queue = iio_to_dma_queue(buffer);
+
+	mutex_lock(&queue->lock);
+	iio_dma_buffer_free_blocks_locked(queue);
+	mutex_unlock(&queue->lock);
+
+	mutex_destroy(&queue->lock);
+	kfree(queue);
+}
+
+static const struct iio_buffer_access_funcs iio_dma_buffer_access_funcs = {
+	.read_first_n = &iio_dma_buffer_read,
+	.data_available = &iio_dma_buffer_data_available,
+	.set_bytes_per_datum = &iio_dma_buffer_set_bytes_per_datum,
+	.set_length = &iio_dma_buffer_set_length,
+	.release = &iio_dma_buffer_release,
+	.alloc_blocks = &iio_dma_buffer_alloc_blocks,
+	.free_blocks = &iio_dma_buffer_free_blocks,
+	.query_block = &iio_dma_buffer_query_block,
+	.enqueue_block = &iio_dma_buffer_enqueue_block,
+	.dequeue_block = &iio_dma_buffer_dequeue_block,
+	.mmap = &iio_dma_buffer_mmap,
+};
+
+/**
+ * iio_dma_buffer_alloc() - allocate a DMA block buffer
+ * @dev: device the blocks are allocated for, usually the DMA controller
+ * @ops: driver callbacks
+ * @driver_data: private data of the driver, see struct iio_dma_buffer_queue
+ *
+ * Return: the buffer, or NULL on failure.
+ */
+struct iio_buffer *iio_dma_buffer_alloc(struct device *dev,
+					const struct iio_dma_buffer_ops *ops,
+					void *driver_data)
+{
+	struct iio_dma_buffer_queue *queue;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue)
+		return NULL;
+
+	iio_buffer_init(&queue->buffer);
+	queue->buffer.length = IIO_DMA_BUFFER_DEFAULT_LENGTH;
+	queue->buffer.access = &iio_dma_buffer_access_funcs;
+
+	queue->dev = dev;
+	queue->ops = ops;
+	queue->driver_data = driver_data;
+
+	mutex_init(&queue->lock);
+	spin_lock_init(&queue->list_lock);
+	INIT_LIST_HEAD(&queue->incoming);
+	INIT_LIST_HEAD(&queue->outgoing);
+	atomic_set(&queue->mapped, 0);
+
+	return &queue->buffer;
+}
+EXPORT_SYMBOL_GPL(iio_dma_buffer_alloc);
+
+/**
+ * iio_dma_buffer_free() - drop the driver reference to a DMA block buffer
+ * @buffer: buffer returned by iio_dma_buffer_alloc()
+ */
+void iio_dma_buffer_free(struct iio_buffer *buffer)
+{
+	iio_buffer_put(buffer);
+}
+EXPORT_SYMBOL_GPL(iio_dma_buffer_free);
+
+MODULE_DESCRIPTION("Industrial I/O DMA block buffer");
+MODULE_LICENSE("GPL v2");
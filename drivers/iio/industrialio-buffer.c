@@ -159,6 +159,112 @@ unsigned int iio_buffer_poll(struct file *filp,
 	return 0;
 }
 
+static int iio_buffer_dequeue_block(struct iio_dev *indio_dev,
+				    struct file *filp,
+				    struct iio_buffer_block *block)
+{
+	struct iio_buffer *rb = indio_dev->buffer;
+	size_t to_wait = 0;
+	int ret;
+
+	if (!(filp->f_flags & O_NONBLOCK))
+		to_wait = 1;
+
+	do {
+		/* Nothing will be filled while the buffer is disabled */
+		ret = wait_event_interruptible(rb->pollq,
+			iio_buffer_ready(indio_dev, rb, to_wait, 0) ||
+			!iio_buffer_is_active(rb));
+		if (ret)
+			return ret;
+
+		if (!indio_dev->info)
+			return -ENODEV;
+
+		ret = rb->access->dequeue_block(rb, block);
+	} while (ret == -EAGAIN && to_wait && iio_buffer_is_active(rb));
+
+	return ret;
+}
+
+/**
+ * iio_buffer_ioctl() - chrdev ioctls for block access to the buffer
+ *
+ * Lets userspace map the blocks of buffers that support it and exchange them
+ * with the device, so that the samples are never copied.
+ */
+long iio_buffer_ioctl(struct iio_dev *indio_dev, struct file *filp,
+		      unsigned int cmd, unsigned long arg)
+{
+	const struct iio_buffer_access_funcs *access;
+	struct iio_buffer *rb = indio_dev->buffer;
+	void __user *argp = (void __user *)arg;
+	struct iio_buffer_block_alloc_req req;
+	struct iio_buffer_block block;
+	int ret;
+
+	if (!rb || !rb->access->alloc_blocks)
+		return -EINVAL;
+	access = rb->access;
+
+	switch (cmd) {
+	case IIO_BUFFER_BLOCK_ALLOC_IOCTL:
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		if (req.type || req.id)
+			return -EINVAL;
+
+		ret = access->alloc_blocks(rb, &req);
+		if (ret)
+			return ret;
+
+		if (copy_to_user(argp, &req, sizeof(req)))
+			return -EFAULT;
+		return 0;
+	case IIO_BUFFER_BLOCK_FREE_IOCTL:
+		return access->free_blocks(rb);
+	case IIO_BUFFER_BLOCK_QUERY_IOCTL:
+	case IIO_BUFFER_BLOCK_ENQUEUE_IOCTL:
+	case IIO_BUFFER_BLOCK_DEQUEUE_IOCTL:
+		if (copy_from_user(&block, argp, sizeof(block)))
+			return -EFAULT;
+
+		if (cmd == IIO_BUFFER_BLOCK_QUERY_IOCTL)
+			ret = access->query_block(rb, &block);
+		else if (cmd == IIO_BUFFER_BLOCK_ENQUEUE_IOCTL)
+			ret = access->enqueue_block(rb, &block);
+		else
+			ret = iio_buffer_dequeue_block(indio_dev, filp, &block);
+		if (ret)
+			return ret;
+
+		if (copy_to_user(argp, &block, sizeof(block)))
+			return -EFAULT;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * iio_buffer_mmap() - chrdev mmap of a buffer block
+ *
+ * The offset selects the block, see struct iio_buffer_block.
+ */
+int iio_buffer_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct iio_dev *indio_dev = filp->private_data;
+	struct iio_buffer *rb = indio_dev->buffer;
+
+	if (!indio_dev->info)
+		return -ENODEV;
+
+	if (!rb || !rb->access->mmap)
+		return -ENODEV;
+
+	return rb->access->mmap(rb, vma);
+}
+
 /**
  * iio_buffer_wakeup_poll - Wakes up the buffer waitqueue
  * @indio_dev: The IIO device
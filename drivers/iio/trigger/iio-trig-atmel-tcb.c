@@ -0,0 +1,321 @@
+/*
+ * Industrial I/O - Atmel Timer Counter Block based trigger
+ *
+ * A TC channel runs in waveform mode and produces a rising edge on its TIOA
+ * output at each period. That output is routed inside the SoC to the ADC
+ * hardware trigger inputs (TIOAx), so an ADC using it as its external
+ * trigger samples at the exact timer rate, without any CPU involvement.
+ * The RC compare interrupt additionally polls the consumers of the IIO
+ * trigger, for devices which are not wired to TIOA.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/atmel_tc.h>
+#include <linux/clk.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger.h>
+
+#define ATMEL_TCB_TRIG_SLOW_CLK	32768
+
+/**
+ * struct atmel_tcb_trig - TC channel used as a sample clock
+ * @tc:		Timer Counter Block, from atmel_tc_alloc()
+ * @channel:	channel of @tc generating the waveform
+ * @trig:	IIO trigger polled on each period
+ * @frequency:	requested sampling frequency in Hz, 0 when stopped
+ * @running:	the counter clock is enabled
+ * @lock:	protects @frequency and @running
+ */
+struct atmel_tcb_trig {
+	struct atmel_tc		*tc;
+	unsigned		channel;
+	struct iio_trigger	*trig;
+	unsigned		frequency;
+	bool			running;
+	struct mutex		lock;
+};
+
+static void atmel_tcb_trig_writel(struct atmel_tcb_trig *tt, unsigned reg,
+				  u32 val)
+{
+	__raw_writel(val, tt->tc->regs + ATMEL_TC_CHAN(tt->channel) + reg);
+}
+
+static u32 atmel_tcb_trig_readl(struct atmel_tcb_trig *tt, unsigned reg)
+{
+	return __raw_readl(tt->tc->regs + ATMEL_TC_CHAN(tt->channel) + reg);
+}
+
+static void atmel_tcb_trig_stop(struct atmel_tcb_trig *tt)
+{
+	if (!tt->running)
+		return;
+
+	atmel_tcb_trig_writel(tt, ATMEL_TC_CCR, ATMEL_TC_CLKDIS);
+	clk_disable(tt->tc->clk[tt->channel]);
+	tt->running = false;
+}
+
+/*
+ * Program the period for @freq. As in the TCB PWM driver, the smallest
+ * divisor whose counter range holds the period is used, for the best
+ * resolution, and the 32 KiHz clock for the slowest rates.
+ */
+static int atmel_tcb_trig_start(struct atmel_tcb_trig *tt, unsigned freq)
+{
+	struct atmel_tc *tc = tt->tc;
+	u64 max = BIT_ULL(tc->tcb_config->counter_width) - 1;
+	unsigned long rate = clk_get_rate(tc->clk[tt->channel]);
+	int i, slowclk = 0;
+	u64 rc = 0;
+	int ret;
+
+	for (i = 0; i < ARRAY_SIZE(atmel_tc_divisors); i++) {
+		if (!atmel_tc_divisors[i]) {
+			slowclk = i;
+			continue;
+		}
+		rc = div_u64(rate / atmel_tc_divisors[i] + freq / 2, freq);
+		if (rc <= max)
+			break;
+	}
+
+	if (i == ARRAY_SIZE(atmel_tc_divisors)) {
+		i = slowclk;
+		rc = DIV_ROUND_CLOSEST(ATMEL_TCB_TRIG_SLOW_CLK, freq);
+		if (rc > max)
+			return -ERANGE;
+	}
+
+	/* TIOA needs a high and a low phase */
+	if (rc < 2)
+		return -ERANGE;
+
+	atmel_tcb_trig_stop(tt);
+
+	ret = clk_enable(tc->clk[tt->channel]);
+	if (ret)
+		return ret;
+
+	/* Up to RC then reset, TIOA raised at RA = RC / 2, cleared at RC */
+	atmel_tcb_trig_writel(tt, ATMEL_TC_CMR, ATMEL_TC_WAVE |
+			      ATMEL_TC_WAVESEL_UP_AUTO | ATMEL_TC_ACPA_SET |
+			      ATMEL_TC_ACPC_CLEAR | ATMEL_TC_ASWTRG_CLEAR | i);
+	atmel_tcb_trig_writel(tt, ATMEL_TC_RA, rc / 2);
+	atmel_tcb_trig_writel(tt, ATMEL_TC_RC, rc);
+	atmel_tcb_trig_writel(tt, ATMEL_TC_CCR,
+			      ATMEL_TC_CLKEN | ATMEL_TC_SWTRG);
+	tt->running = true;
+
+	return 0;
+}
+
+static irqreturn_t atmel_tcb_trig_irq(int irq, void *private)
+{
+	struct atmel_tcb_trig *tt = private;
+	u32 status = atmel_tcb_trig_readl(tt, ATMEL_TC_SR);
+
+	if (!(status & atmel_tcb_trig_readl(tt, ATMEL_TC_IMR) & ATMEL_TC_CPCS))
+		return IRQ_NONE;
+
+	iio_trigger_poll(tt->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int atmel_tcb_trig_set_state(struct iio_trigger *trig, bool state)
+{
+	struct atmel_tcb_trig *tt = iio_trigger_get_drvdata(trig);
+	int ret = 0;
+
+	mutex_lock(&tt->lock);
+
+	if (state && !tt->running) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	atmel_tcb_trig_writel(tt, state ? ATMEL_TC_IER : ATMEL_TC_IDR,
+			      ATMEL_TC_CPCS);
+
+unlock:
+	mutex_unlock(&tt->lock);
+	return ret;
+}
+
+static const struct iio_trigger_ops atmel_tcb_trig_ops = {
+	.owner = THIS_MODULE,
+	.set_trigger_state = &atmel_tcb_trig_set_state,
+};
+
+static ssize_t atmel_tcb_trig_freq_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct atmel_tcb_trig *tt = iio_trigger_get_drvdata(to_iio_trigger(dev));
+
+	return sprintf(buf, "%u\n", tt->frequency);
+}
+
+/* A nonzero frequency keeps TIOA running, whether the trigger is used or not */
+static ssize_t atmel_tcb_trig_freq_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t len)
+{
+	struct atmel_tcb_trig *tt = iio_trigger_get_drvdata(to_iio_trigger(dev));
+	unsigned freq;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &freq);
+	if (ret)
+		return ret;
+
+	mutex_lock(&tt->lock);
+
+	if (freq)
+		ret = atmel_tcb_trig_start(tt, freq);
+	else
+		atmel_tcb_trig_stop(tt);
+
+	if (!ret)
+		tt->frequency = freq;
+
+	mutex_unlock(&tt->lock);
+
+	return ret ? ret : len;
+}
+
+static DEVICE_ATTR(sampling_frequency, S_IRUGO | S_IWUSR,
+		   atmel_tcb_trig_freq_show, atmel_tcb_trig_freq_store);
+
+static struct attribute *atmel_tcb_trig_attrs[] = {
+	&dev_attr_sampling_frequency.attr,
+	NULL,
+};
+
+static const struct attribute_group atmel_tcb_trig_attr_group = {
+	.attrs = atmel_tcb_trig_attrs,
+};
+
+static const struct attribute_group *atmel_tcb_trig_attr_groups[] = {
+	&atmel_tcb_trig_attr_group,
+	NULL
+};
+
+static int atmel_tcb_trig_probe(struct platform_device *pdev)
+{
+	struct device_node *np = pdev->dev.of_node;
+	struct atmel_tcb_trig *tt;
+	u32 tcblock, channel;
+	int ret;
+
+	ret = of_property_read_u32(np, "tc-block", &tcblock);
+	if (ret) {
+		dev_err(&pdev->dev, "missing Timer Counter Block number\n");
+		return ret;
+	}
+
+	ret = of_property_read_u32(np, "tc-channel", &channel);
+	if (ret || channel > 2) {
+		dev_err(&pdev->dev, "invalid or missing tc-channel\n");
+		return -EINVAL;
+	}
+
+	tt = devm_kzalloc(&pdev->dev, sizeof(*tt), GFP_KERNEL);
+	if (!tt)
+		return -ENOMEM;
+
+	tt->tc = atmel_tc_alloc(tcblock);
+	if (!tt->tc) {
+		dev_err(&pdev->dev, "failed to allocate Timer Counter Block\n");
+		return -EBUSY;
+	}
+	tt->channel = channel;
+	mutex_init(&tt->lock);
+
+	ret = clk_prepare(tt->tc->clk[channel]);
+	if (ret)
+		goto tc_free;
+
+	tt->trig = iio_trigger_alloc("tcb%u-%u", tcblock, channel);
+	if (!tt->trig) {
+		ret = -ENOMEM;
+		goto clk_unprepare;
+	}
+
+	tt->trig->dev.parent = &pdev->dev;
+	tt->trig->dev.groups = atmel_tcb_trig_attr_groups;
+	tt->trig->ops = &atmel_tcb_trig_ops;
+	iio_trigger_set_drvdata(tt->trig, tt);
+
+	/* Several channels of a block may share the interrupt */
+	ret = request_irq(tt->tc->irq[channel], atmel_tcb_trig_irq,
+			  IRQF_SHARED, tt->trig->name, tt);
+	if (ret)
+		goto trigger_put;
+
+	ret = iio_trigger_register(tt->trig);
+	if (ret)
+		goto irq_free;
+
+	platform_set_drvdata(pdev, tt);
+
+	return 0;
+
+irq_free:
+	free_irq(tt->tc->irq[channel], tt);
+trigger_put:
+	iio_trigger_put(tt->trig);
+clk_unprepare:
+	clk_unprepare(tt->tc->clk[channel]);
+tc_free:
+	atmel_tc_free(tt->tc);
+	return ret;
+}
+
+static int atmel_tcb_trig_remove(struct platform_device *pdev)
+{
+	struct atmel_tcb_trig *tt = platform_get_drvdata(pdev);
+
+	iio_trigger_unregister(tt->trig);
+
+	atmel_tcb_trig_writel(tt, ATMEL_TC_IDR, ATMEL_TC_ALL_IRQ);
+	atmel_tcb_trig_stop(tt);
+
+	free_irq(tt->tc->irq[tt->channel], tt);
+	iio_trigger_put(tt->trig);
+	clk_unprepare(tt->tc->clk[tt->channel]);
+	atmel_tc_free(tt->tc);
+
+	return 0;
+}
+
+static const struct of_device_id atmel_tcb_trig_dt_ids[] = {
+	{ .compatible = "atmel,tcb-iio-trigger", },
+	{ /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, atmel_tcb_trig_dt_ids);
+
+static struct platform_driver atmel_tcb_trig_driver = {
+	.probe = atmel_tcb_trig_probe,
+	.remove = atmel_tcb_trig_remove,
+	.driver = {
+		.name = "atmel-tcb-iio-trigger",
+		.of_match_table = atmel_tcb_trig_dt_ids,
+	},
+};
+module_platform_driver(atmel_tcb_trig_driver);
+
+MODULE_DESCRIPTION("Atmel Timer Counter Block IIO trigger");
+MODULE_LICENSE("GPL v2");
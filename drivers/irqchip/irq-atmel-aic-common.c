@@ -14,13 +14,18 @@
  * warranty of any kind, whether express or implied.
  */
 
+#include <linux/debugfs.h>
 #include <linux/errno.h>
+#include <linux/init.h>
 #include <linux/io.h>
 #include <linux/irq.h>
 #include <linux/irqdomain.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/uaccess.h>
 
 #include "irq-atmel-aic-common.h"
 
@@ -212,6 +217,187 @@ void __init aic_common_irq_fixup(const struct of_device_id *matches)
 	of_node_put(root);
 }
 
+#ifdef CONFIG_ATMEL_AIC_IRQ_STATS
+/*
+ * Interrupt timing statistics, read from debugfs. The timestamps come from
+ * sched_clock(), which the TCB clocksource backs on the AT91 SoCs.
+ *
+ * The run time of a source is measured around its flow handler. The AIC does
+ * not record when a source was asserted, so its wait time is a lower bound:
+ * the time since it was first seen pending, and enabled, at the end of the
+ * handler of another source. It shows how long sources are held back behind
+ * the others, not the latency of interrupts masked by the CPU.
+ *
+ * Both are histograms of power of two buckets of microseconds: bucket 0
+ * counts times below 1 us, bucket n times in [2^(n-1), 2^n) us, and the last
+ * one everything longer.
+ */
+#define AIC_STATS_BUCKETS	16
+
+struct aic_irq_stats {
+	u64 pending_since;
+	u32 count;
+	u32 max_run;
+	u32 max_wait;
+	u32 run[AIC_STATS_BUCKETS];
+	u32 wait[AIC_STATS_BUCKETS];
+};
+
+static struct irq_domain *aic_stats_domain;
+static struct aic_irq_stats *aic_stats;
+
+static void aic_stats_account(u32 *hist, u32 *max, u64 delta)
+{
+	u32 us = min_t(u64, delta, U32_MAX) / NSEC_PER_USEC;
+
+	if (us > *max)
+		*max = us;
+
+	hist[us ? min(fls(us), AIC_STATS_BUCKETS - 1) : 0]++;
+}
+
+u64 aic_common_stats_entry(u32 hwirq)
+{
+	struct aic_irq_stats *stats;
+	u64 now = sched_clock();
+
+	if (!aic_stats || hwirq >= aic_stats_domain->revmap_size)
+		return now;
+
+	stats = &aic_stats[hwirq];
+	if (stats->pending_since) {
+		aic_stats_account(stats->wait, &stats->max_wait,
+				  now - stats->pending_since);
+		stats->pending_since = 0;
+	}
+
+	return now;
+}
+
+void aic_common_stats_exit(struct irq_domain *domain, u32 hwirq, u64 start,
+			   u32 ipr)
+{
+	struct irq_chip_generic *gc;
+	struct aic_irq_stats *stats;
+	u64 now = sched_clock();
+	unsigned long pending;
+	int i, bit;
+
+	if (!aic_stats || hwirq >= domain->revmap_size)
+		return;
+
+	stats = &aic_stats[hwirq];
+	stats->count++;
+	aic_stats_account(stats->run, &stats->max_run, now - start);
+
+	for (i = 0; i < domain->revmap_size / 32; i++) {
+		gc = irq_get_domain_generic_chip(domain, i * 32);
+		pending = irq_reg_readl(gc, ipr + i * 4) & gc->mask_cache;
+
+		for_each_set_bit(bit, &pending, 32) {
+			stats = &aic_stats[i * 32 + bit];
+			if (!stats->pending_since)
+				stats->pending_since = now;
+		}
+	}
+}
+
+static void aic_stats_show_row(struct seq_file *m, const char *name,
+			       const u32 *hist)
+{
+	int i;
+
+	seq_printf(m, "  %-4s", name);
+	for (i = 0; i < AIC_STATS_BUCKETS; i++)
+		seq_printf(m, " %7u", hist[i]);
+	seq_putc(m, '\n');
+}
+
+static int aic_stats_show(struct seq_file *m, void *v)
+{
+	struct aic_irq_stats stats;
+	unsigned long flags;
+	char label[8];
+	int hwirq, i;
+
+	seq_puts(m, "  us  ");
+	for (i = 0; i < AIC_STATS_BUCKETS; i++) {
+		if (i < AIC_STATS_BUCKETS - 1)
+			snprintf(label, sizeof(label), "<%u", 1U << i);
+		else
+			snprintf(label, sizeof(label), ">=%u", 1U << (i - 1));
+		seq_printf(m, " %7s", label);
+	}
+	seq_putc(m, '\n');
+
+	for (hwirq = 0; hwirq < aic_stats_domain->revmap_size; hwirq++) {
+		local_irq_save(flags);
+		stats = aic_stats[hwirq];
+		local_irq_restore(flags);
+
+		if (!stats.count)
+			continue;
+
+		seq_printf(m, "hwirq %d: %u handled, run max %u us, wait max %u us\n",
+			   hwirq, stats.count, stats.max_run, stats.max_wait);
+		aic_stats_show_row(m, "run", stats.run);
+		aic_stats_show_row(m, "wait", stats.wait);
+	}
+
+	return 0;
+}
+
+static int aic_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, aic_stats_show, NULL);
+}
+
+/* Writing anything to the file clears the statistics */
+static ssize_t aic_stats_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	memset(aic_stats, 0,
+	       aic_stats_domain->revmap_size * sizeof(*aic_stats));
+	local_irq_restore(flags);
+
+	return count;
+}
+
+static const struct file_operations aic_stats_fops = {
+	.open		= aic_stats_open,
+	.read		= seq_read,
+	.write		= aic_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init aic_common_stats_init(struct irq_domain *domain)
+{
+	aic_stats = kcalloc(domain->revmap_size, sizeof(*aic_stats),
+			    GFP_KERNEL);
+	if (aic_stats)
+		aic_stats_domain = domain;
+}
+
+/* The AIC is probed long before debugfs is available */
+static int __init aic_common_stats_debugfs_init(void)
+{
+	if (aic_stats)
+		debugfs_create_file("atmel-aic-stats", S_IRUGO | S_IWUSR,
+				    NULL, NULL, &aic_stats_fops);
+
+	return 0;
+}
+late_initcall(aic_common_stats_debugfs_init);
+#else
+static inline void aic_common_stats_init(struct irq_domain *domain)
+{
+}
+#endif /* CONFIG_ATMEL_AIC_IRQ_STATS */
+
 struct irq_domain *__init aic_common_of_init(struct device_node *node,
 					     const struct irq_domain_ops *ops,
 					     const char *name, int nirqs)
@@ -264,6 +450,7 @@ struct irq_domain *__init aic_common_of_init(struct device_node *node,
 	}
 
 	aic_common_ext_irq_of_init(domain);
+	aic_common_stats_init(domain);
 
 	return domain;
 
@@ -38,4 +38,21 @@ void __init aic_common_rtt_irq_fixup(struct device_node *root);
 
 void __init aic_common_irq_fixup(const struct of_device_id *matches);
 
+#ifdef CONFIG_ATMEL_AIC_IRQ_STATS
+u64 aic_common_stats_entry(u32 hwirq);
+
+void aic_common_stats_exit(struct irq_domain *domain, u32 hwirq, u64 start,
+			   u32 ipr);
+#else
+static inline u64 aic_common_stats_entry(u32 hwirq)
+{
+	return 0;
+}
+
+static inline void aic_common_stats_exit(struct irq_domain *domain,
+					 u32 hwirq, u64 start, u32 ipr)
+{
+}
+#endif
+
 #endif /* __IRQ_ATMEL_AIC_COMMON_H */
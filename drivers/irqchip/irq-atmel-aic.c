@@ -64,14 +64,18 @@ aic_handle(struct pt_regs *regs)
 	struct irq_chip_generic *gc = dgc->gc[0];
 	u32 irqnr;
 	u32 irqstat;
+	u64 start;
 
 	irqnr = irq_reg_readl(gc, AT91_AIC_IVR);
 	irqstat = irq_reg_readl(gc, AT91_AIC_ISR);
 
-	if (!irqstat)
+	if (!irqstat) {
 		irq_reg_writel(gc, 0, AT91_AIC_EOICR);
-	else
+	} else {
+		start = aic_common_stats_entry(irqnr);
 		handle_domain_irq(aic_domain, irqnr, regs);
+		aic_common_stats_exit(aic_domain, irqnr, start, AT91_AIC_IPR);
+	}
 }
 
 static int aic_retrigger(struct irq_data *d)
@@ -23,11 +23,13 @@
 #include <linux/of_address.h>
 #include <linux/of_irq.h>
 #include <linux/irqdomain.h>
+#include <linux/irqchip/atmel-aic5.h>
 #include <linux/err.h>
 #include <linux/slab.h>
 #include <linux/io.h>
 
 #include <asm/exception.h>
+#include <asm/fiq.h>
 #include <asm/mach/irq.h>
 
 #include "irq-atmel-aic-common.h"
@@ -73,14 +75,19 @@ aic5_handle(struct pt_regs *regs)
 	struct irq_chip_generic *bgc = irq_get_domain_generic_chip(aic5_domain, 0);
 	u32 irqnr;
 	u32 irqstat;
+	u64 start;
 
 	irqnr = irq_reg_readl(bgc, AT91_AIC5_IVR);
 	irqstat = irq_reg_readl(bgc, AT91_AIC5_ISR);
 
-	if (!irqstat)
+	if (!irqstat) {
 		irq_reg_writel(bgc, 0, AT91_AIC5_EOICR);
-	else
+	} else {
+		start = aic_common_stats_entry(irqnr);
 		handle_domain_irq(aic5_domain, irqnr, regs);
+		aic_common_stats_exit(aic5_domain, irqnr, start,
+				      AT91_AIC5_IPR0);
+	}
 }
 
 static void aic5_mask(struct irq_data *d)
@@ -149,7 +156,52 @@ static int aic5_set_type(struct irq_data *d, unsigned type)
 	return ret;
 }
 
+/**
+ * aic5_set_fast_forcing - route an AIC5 source to the FIQ
+ * @irq: Linux interrupt number of the source
+ * @on: true to redirect the source to nFIQ, false to give it back
+ *
+ * A fast forced source bypasses the priority controller and interrupts
+ * even the highest priority IRQ handler, for sources whose latency can't
+ * depend on the rest of the system.  The caller installs its handler
+ * with claim_fiq() and set_fiq_handler(), enables the FIQ with
+ * enable_fiq(0), and must not request @irq as a normal interrupt.  The
+ * FIQ handler clears edge triggered sources itself, through SSR and ICCR.
+ */
+int aic5_set_fast_forcing(unsigned int irq, bool on)
+{
+	struct irq_data *d = irq_get_irq_data(irq);
+	struct irq_chip_generic *bgc;
+
+	/* source 0 is the FIQ itself */
+	if (!d || !aic5_domain || d->domain != aic5_domain || !d->hwirq)
+		return -EINVAL;
+
+	bgc = irq_get_domain_generic_chip(aic5_domain, 0);
+
+	irq_gc_lock(bgc);
+	irq_reg_writel(bgc, d->hwirq, AT91_AIC5_SSR);
+	if (on) {
+		irq_reg_writel(bgc, 1, AT91_AIC5_FFER);
+		irq_reg_writel(bgc, 1, AT91_AIC5_IECR);
+	} else {
+		irq_reg_writel(bgc, 1, AT91_AIC5_IDCR);
+		irq_reg_writel(bgc, 1, AT91_AIC5_FFDR);
+	}
+	irq_gc_unlock(bgc);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(aic5_set_fast_forcing);
+
 #ifdef CONFIG_PM
+/*
+ * The AIC loses its configuration when the SAMA5D2 goes to backup mode:
+ * the source modes are saved on suspend and the whole controller is
+ * reprogrammed on resume.
+ */
+static u32 *smr_cache;
+
 static void aic5_suspend(struct irq_data *d)
 {
 	struct irq_domain *domain = d->domain;
@@ -162,6 +214,12 @@ static void aic5_suspend(struct irq_data *d)
 	irq_gc_lock(bgc);
 	for (i = 0; i < dgc->irqs_per_chip; i++) {
 		mask = 1 << i;
+		if (smr_cache) {
+			irq_reg_writel(bgc, i + gc->irq_base, AT91_AIC5_SSR);
+			smr_cache[i + gc->irq_base] =
+				irq_reg_readl(bgc, AT91_AIC5_SMR);
+		}
+
 		if ((mask & gc->mask_cache) == (mask & gc->wake_active))
 			continue;
 
@@ -184,10 +242,22 @@ static void aic5_resume(struct irq_data *d)
 	u32 mask;
 
 	irq_gc_lock(bgc);
+	if (smr_cache) {
+		irq_reg_writel(bgc, 0xffffffff, AT91_AIC5_SPU);
+		irq_reg_writel(bgc, 0, AT91_AIC5_DCR);
+	}
+
 	for (i = 0; i < dgc->irqs_per_chip; i++) {
 		mask = 1 << i;
-		if ((mask & gc->mask_cache) == (mask & gc->wake_active))
+		if (smr_cache) {
+			irq_reg_writel(bgc, i + gc->irq_base, AT91_AIC5_SSR);
+			irq_reg_writel(bgc, i + gc->irq_base, AT91_AIC5_SVR);
+			irq_reg_writel(bgc, smr_cache[i + gc->irq_base],
+				       AT91_AIC5_SMR);
+		} else if ((mask & gc->mask_cache) ==
+			   (mask & gc->wake_active)) {
 			continue;
+		}
 
 		irq_reg_writel(bgc, i + gc->irq_base, AT91_AIC5_SSR);
 		if (mask & gc->mask_cache)
@@ -336,6 +406,17 @@ static int __init aic5_of_init(struct device_node *node,
 	aic5_hw_init(domain);
 	set_handle_irq(aic5_handle);
 
+#ifdef CONFIG_PM
+	if (of_device_is_compatible(node, "atmel,sama5d2-aic"))
+		smr_cache = kcalloc(domain->revmap_size, sizeof(*smr_cache),
+				    GFP_KERNEL);
+#endif
+
+#ifdef CONFIG_FIQ
+	/* enable_fiq(0) unmasks source 0, the nFIQ input */
+	init_FIQ(irq_create_mapping(domain, 0));
+#endif
+
 	return 0;
 }
 
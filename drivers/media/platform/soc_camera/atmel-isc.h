@@ -38,6 +38,8 @@
 #define ISC_GAM_RENTRY0				(ISC_GAM_GENTRY0 + 4 * 64)
 
 #define ISC_RLP_CFG				0x03d0
+#define ISC_HIS_CTRL				0x03d4
+#define ISC_HIS_CFG				0x03d8
 
 #define ISC_DCFG				0x03e0
 #define ISC_DCTRL				0x03e4
@@ -49,6 +51,9 @@
 #define ISC_DAD2				0x03fc
 #define ISC_DST2				0x0400
 
+#define ISC_HIS_ENTRY				0x0510
+#define ISC_HIS_ENTRIES				512
+
 /* Bitfields in ISC_CTRLEN */
 #define ISC_CTRLEN_CAPTURE			(1 << 0)
 #define ISC_CTRLEN_UPPRO			(1 << 1)	/* update profile */
@@ -131,6 +136,23 @@
 #define ISC_RLP_CFG_ALPHA_OFFSET		(8)
 #define ISC_RLP_CFG_ALPHA_MASK			(0xFF << ISC_RLP_CFG_ALPHA_OFFSET)
 
+/* Bitfields in ISC_HIS_CTRL */
+#define ISC_HIS_CTRL_EN				BIT(0)
+
+/* Bitfields in ISC_HIS_CFG */
+#define ISC_HIS_CFG_MODE_GR			(0 << 0)
+#define ISC_HIS_CFG_MODE_R			(1 << 0)
+#define ISC_HIS_CFG_MODE_GB			(2 << 0)
+#define ISC_HIS_CFG_MODE_B			(3 << 0)
+#define ISC_HIS_CFG_MODE_Y			(4 << 0)
+#define ISC_HIS_CFG_MODE_RAW			(5 << 0)
+#define ISC_HIS_CFG_MODES			6
+#define ISC_HIS_CFG_BAYSEL_GRGR			(0 << 4)
+#define ISC_HIS_CFG_BAYSEL_RGRG			(1 << 4)
+#define ISC_HIS_CFG_BAYSEL_GBGB			(2 << 4)
+#define ISC_HIS_CFG_BAYSEL_BGBG			(3 << 4)
+#define ISC_HIS_CFG_RAR				BIT(8)	/* reset after read */
+
 /* Bitfields in ISC_INTEN/INTDIS/INTMASK/INTSR */
 #define ISC_INT_VSYNC				(1 << 0)
 #define ISC_INT_HSYNC				(1 << 1)
@@ -169,6 +191,19 @@
 #define ISC_DCTRL_WRITE_BACK_DISABLE		(0 << 5)
 #define ISC_DCTRL_WRITE_BACK_ENABLE		(1 << 5)
 
+/*
+ * Histogram controls:
+ * - V4L2_CID_ISC_HIST_CHANNELS: bitmask of the ISC_HIS_CFG_MODE_* channels to
+ *   compute. The channels are measured in turn, one frame each.
+ * - V4L2_CID_ISC_HIST: ISC_HIS_CFG_MODES x ISC_HIS_ENTRIES array, the last
+ *   histogram of each channel.
+ * - V4L2_CID_ISC_HIST_SEQUENCE: ISC_HIS_CFG_MODES array, sequence number of
+ *   the frame each histogram was computed on.
+ */
+#define V4L2_CID_ISC_HIST_CHANNELS		(V4L2_CID_USER_ATMEL_ISC_BASE + 0)
+#define V4L2_CID_ISC_HIST			(V4L2_CID_USER_ATMEL_ISC_BASE + 1)
+#define V4L2_CID_ISC_HIST_SEQUENCE		(V4L2_CID_USER_ATMEL_ISC_BASE + 2)
+
 /* Definition for isc_platform_data */
 #define ISC_DATAWIDTH_8				0x01
 #define ISC_DATAWIDTH_10			0x02
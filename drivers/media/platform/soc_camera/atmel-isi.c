@@ -28,6 +28,10 @@
 
 #include <media/soc_camera.h>
 #include <media/soc_mediabus.h>
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-dev.h>
+#include <media/v4l2-fh.h>
+#include <media/v4l2-ioctl.h>
 #include <media/v4l2-of.h>
 #include <media/videobuf2-dma-contig.h>
 
@@ -41,6 +45,13 @@
 #define MIN_FRAME_RATE			15
 #define FRAME_INTERVAL_MILLI_SEC	(1000 / MIN_FRAME_RATE)
 
+#define PREVIEW_MAX_WIDTH		640
+#define PREVIEW_MAX_HEIGHT		480
+
+/* Capture paths in use, see atmel_isi.paths */
+#define ISI_PATH_MAIN			(1 << 0)
+#define ISI_PATH_PREVIEW		(1 << 1)
+
 /* Frame buffer descriptor */
 struct fbd_isi_v2 {
 	/* Physical address of the frame buffer */
@@ -80,6 +91,21 @@ struct frame_buffer {
 	struct list_head list;
 };
 
+/*
+ * The preview path, captured through its own video node while the soc-camera
+ * node takes the codec path of the same sensor frames. The preview image is
+ * the sensor image decimated by a factor of ISI_PDECF / 16, converted to
+ * RGB565.
+ */
+struct isi_preview {
+	struct video_device		vdev;
+	struct vb2_queue		vb2_vidq;
+	struct list_head		video_buffer_list;
+	struct frame_buffer		*active;
+	int				sequence;
+	struct v4l2_pix_format		pix;
+};
+
 struct atmel_isi {
 	/* Protects the access of variables shared with the ISR */
 	spinlock_t			lock;
@@ -111,9 +137,24 @@ struct atmel_isi {
 	struct list_head		video_buffer_list;
 	struct frame_buffer		*active;
 
+	/* ISI_PATH_* streaming, the hardware is set up by the first one */
+	unsigned int			paths;
+	struct isi_preview		preview;
+
 	struct soc_camera_host		soc_host;
 	struct at91_camera_hw_ops	*hw_ops;
 	struct at91_camera_caps		*caps;
+
+	/* ISC histogram, see V4L2_CID_ISC_HIST */
+	u32				(*hist)[ISC_HIS_ENTRIES];
+	u32				hist_seq[ISC_HIS_CFG_MODES];
+	u32				hist_req_seq;
+	u32				hist_channels;
+	u32				hist_baysel;
+	int				hist_cur;
+	bool				hist_running;
+	bool				hist_pending;
+	bool				hist_skip;
 };
 
 static void isi_writel(struct atmel_isi *isi, u32 reg, u32 val)
@@ -138,10 +179,13 @@ struct at91_camera_hw_ops {
 	void (*hw_enable_interrupt)(struct atmel_isi *isi, int type);
 	void (*hw_set_clock)(struct atmel_isi *isi, bool enable_clk);
 	bool (*host_fmt_supported)(const u32 pixformat);
+	int (*add_ctrls)(struct atmel_isi *isi, struct soc_camera_device *icd);
 };
 
 struct at91_camera_caps {
 	struct at91_camera_hw_ops hw_ops;
+	/* preview path with its own video node, next to the codec path */
+	bool has_preview;
 	struct soc_mbus_pixelfmt yuv_support_formats[];
 };
 
@@ -158,11 +202,14 @@ static u32 setup_cfg2_yuv_swap(struct atmel_isi *isi,
 		case MEDIA_BUS_FMT_YVYU8_2X8:
 			return ISI_CFG2_YCC_SWAP_MODE_1;
 		}
-	} else if (xlate->host_fmt->fourcc == V4L2_PIX_FMT_RGB565) {
+	} else if (xlate->host_fmt->fourcc == V4L2_PIX_FMT_RGB565 ||
+		   xlate->host_fmt->fourcc == V4L2_PIX_FMT_UYVY) {
 		/*
 		 * Preview path is enabled, it will convert UYVY to RGB format.
 		 * But if sensor output format is not UYVY, we need to set
-		 * YCC_SWAP_MODE to convert it as UYVY.
+		 * YCC_SWAP_MODE to convert it as UYVY. The codec path then
+		 * outputs UYVY as well, which is what lets both paths run
+		 * together.
 		 */
 		switch (xlate->code) {
 		case MEDIA_BUS_FMT_VYUY8_2X8:
@@ -271,6 +318,40 @@ static irqreturn_t atmel_isi_handle_streaming(struct atmel_isi *isi)
 	return IRQ_HANDLED;
 }
 
+static void isi_preview_start_dma(struct atmel_isi *isi,
+				  struct frame_buffer *buffer)
+{
+	isi_writel(isi, ISI_DMA_P_DSCR, (u32)buffer->p_dma_desc->fbd_phys);
+	isi_writel(isi, ISI_DMA_P_CTRL, ISI_DMA_CTRL_FETCH | ISI_DMA_CTRL_DONE);
+	isi_writel(isi, ISI_DMA_CHER, ISI_DMA_CHSR_P_CH);
+
+	/* Not a codec request, that one stays with the main node */
+	isi_writel(isi, ISI_CTRL, ISI_CTRL_EN);
+}
+
+static irqreturn_t isi_preview_handle_streaming(struct atmel_isi *isi)
+{
+	struct isi_preview *prev = &isi->preview;
+
+	if (prev->active) {
+		struct vb2_buffer *vb = &prev->active->vb;
+
+		list_del_init(&prev->active->list);
+		v4l2_get_timestamp(&vb->v4l2_buf.timestamp);
+		vb->v4l2_buf.sequence = prev->sequence++;
+		vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
+	}
+
+	if (list_empty(&prev->video_buffer_list)) {
+		prev->active = NULL;
+	} else {
+		prev->active = list_entry(prev->video_buffer_list.next,
+					  struct frame_buffer, list);
+		isi_preview_start_dma(isi, prev->active);
+	}
+	return IRQ_HANDLED;
+}
+
 /* ISI interrupt service routine */
 static irqreturn_t isi_interrupt(int irq, void *dev_id)
 {
@@ -293,6 +374,13 @@ static irqreturn_t isi_interrupt(int irq, void *dev_id)
 		isi_writel(isi, ISI_INTDIS, ISI_CTRL_DIS);
 		ret = IRQ_HANDLED;
 	} else {
+		/* With the preview node streaming, pxfr is its own */
+		if ((pending & ISI_SR_PXFR_DONE) &&
+		    (isi->paths & ISI_PATH_PREVIEW)) {
+			ret = isi_preview_handle_streaming(isi);
+			pending &= ~ISI_SR_PXFR_DONE;
+		}
+
 		if (likely(pending & ISI_SR_CXFR_DONE) ||
 				likely(pending & ISI_SR_PXFR_DONE))
 			ret = atmel_isi_handle_streaming(isi);
@@ -385,29 +473,17 @@ static void isi_hw_init_dma_desc(union fbd *p_fdb, u32 fb_addr, u32 next_fbd_add
 	p->dma_ctrl = ISI_DMA_CTRL_WB;
 }
 
-static int buffer_prepare(struct vb2_buffer *vb)
+/* Attach a dma descriptor to @buf and point it at the buffer memory */
+static int isi_buffer_prepare_desc(struct atmel_isi *isi,
+				   struct frame_buffer *buf)
 {
-	struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
-	struct frame_buffer *buf = container_of(vb, struct frame_buffer, vb);
-	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
-	struct atmel_isi *isi = ici->priv;
-	unsigned long size;
 	struct isi_dma_desc *desc;
 	u32 vb_addr;
 
-	size = icd->sizeimage;
-
-	if (vb2_plane_size(vb, 0) < size) {
-		dev_err(icd->parent, "%s data will not fit into plane (%lu < %lu)\n",
-				__func__, vb2_plane_size(vb, 0), size);
-		return -EINVAL;
-	}
-
-	vb2_set_plane_payload(&buf->vb, 0, size);
-
 	if (!buf->p_dma_desc) {
 		if (list_empty(&isi->dma_desc_head)) {
-			dev_err(icd->parent, "Not enough dma descriptors.\n");
+			dev_err(isi->soc_host.v4l2_dev.dev,
+				"Not enough dma descriptors.\n");
 			return -EINVAL;
 		} else {
 			/* Get an available descriptor */
@@ -416,16 +492,41 @@ static int buffer_prepare(struct vb2_buffer *vb)
 			/* Delete the descriptor since now it is used */
 			list_del_init(&desc->list);
 
-			/* Initialize the dma descriptor */
-			vb_addr = vb2_dma_contig_plane_dma_addr(vb, 0);
-			(*isi->hw_ops->init_dma_desc)(desc->p_fbd, vb_addr, 0);
-
 			buf->p_dma_desc = desc;
 		}
 	}
+
+	/*
+	 * An imported dma-buf may be a different buffer at each QBUF, so
+	 * (re)initialize the dma descriptor with the current address.
+	 */
+	vb_addr = vb2_dma_contig_plane_dma_addr(&buf->vb, 0);
+	(*isi->hw_ops->init_dma_desc)(buf->p_dma_desc->p_fbd, vb_addr, 0);
+
 	return 0;
 }
 
+static int buffer_prepare(struct vb2_buffer *vb)
+{
+	struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
+	struct frame_buffer *buf = container_of(vb, struct frame_buffer, vb);
+	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
+	struct atmel_isi *isi = ici->priv;
+	unsigned long size;
+
+	size = icd->sizeimage;
+
+	if (vb2_plane_size(vb, 0) < size) {
+		dev_err(icd->parent, "%s data will not fit into plane (%lu < %lu)\n",
+				__func__, vb2_plane_size(vb, 0), size);
+		return -EINVAL;
+	}
+
+	vb2_set_plane_payload(&buf->vb, 0, size);
+
+	return isi_buffer_prepare_desc(isi, buf);
+}
+
 static void buffer_cleanup(struct vb2_buffer *vb)
 {
 	struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
@@ -540,25 +641,25 @@ static void isi_hw_uninitialize(struct atmel_isi *isi)
 				"Timeout waiting for finishing codec request\n");
 	}
 
-	/* Disable interrupts */
-	isi_writel(isi, ISI_INTDIS,
-			ISI_SR_CXFR_DONE | ISI_SR_PXFR_DONE);
+	/* Disable interrupts, but not those of a preview node still running */
+	if (isi->paths & ISI_PATH_PREVIEW) {
+		isi_writel(isi, ISI_DMA_CHDR, ISI_DMA_CHSR_C_CH);
+		isi_writel(isi, ISI_INTDIS, ISI_SR_CXFR_DONE);
+	} else {
+		isi_writel(isi, ISI_INTDIS,
+				ISI_SR_CXFR_DONE | ISI_SR_PXFR_DONE);
+	}
 }
 
-static int start_streaming(struct vb2_queue *vq, unsigned int count)
+/* Reset and configure the hardware for the sensor format of @icd */
+static int isi_hw_setup(struct atmel_isi *isi, struct soc_camera_device *icd)
 {
-	struct soc_camera_device *icd = soc_camera_from_vb2q(vq);
-	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
-	struct atmel_isi *isi = ici->priv;
 	int ret;
 
-	pm_runtime_get_sync(ici->v4l2_dev.dev);
-
 	/* Reset ISI */
 	ret = atmel_isi_wait_status(isi, WAIT_HW_RESET);
 	if (ret < 0) {
 		dev_err(icd->parent, "Reset ISI timed out\n");
-		pm_runtime_put(ici->v4l2_dev.dev);
 		return ret;
 	}
 
@@ -567,8 +668,30 @@ static int start_streaming(struct vb2_queue *vq, unsigned int count)
 	(*isi->hw_ops->hw_configure)(isi, icd->user_width, icd->user_height,
 				icd->current_fmt);
 
+	return 0;
+}
+
+static int start_streaming(struct vb2_queue *vq, unsigned int count)
+{
+	struct soc_camera_device *icd = soc_camera_from_vb2q(vq);
+	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
+	struct atmel_isi *isi = ici->priv;
+	int ret;
+
+	pm_runtime_get_sync(ici->v4l2_dev.dev);
+
+	/* Already running for the preview node, with this same format */
+	if (!isi->paths) {
+		ret = isi_hw_setup(isi, icd);
+		if (ret < 0) {
+			pm_runtime_put(ici->v4l2_dev.dev);
+			return ret;
+		}
+	}
+
 	spin_lock_irq(&isi->lock);
 
+	isi->paths |= ISI_PATH_MAIN;
 	if (count)
 		(*isi->hw_ops->start_dma)(isi, isi->active, true);
 
@@ -587,6 +710,7 @@ static void stop_streaming(struct vb2_queue *vq)
 	int ret = 0;
 
 	spin_lock_irq(&isi->lock);
+	isi->paths &= ~ISI_PATH_MAIN;
 	isi->active = NULL;
 	/* Release all active buffers */
 	list_for_each_entry_safe(buf, node, &isi->video_buffer_list, list) {
@@ -599,9 +723,11 @@ static void stop_streaming(struct vb2_queue *vq)
 	(*isi->hw_ops->hw_uninitialize)(isi);
 
 	/* Disable ISI and wait for it is done */
-	ret = atmel_isi_wait_status(isi, WAIT_HW_DISABLE);
-	if (ret < 0)
-		dev_err(icd->parent, "Disable ISI timed out\n");
+	if (!isi->paths) {
+		ret = atmel_isi_wait_status(isi, WAIT_HW_DISABLE);
+		if (ret < 0)
+			dev_err(icd->parent, "Disable ISI timed out\n");
+	}
 
 	pm_runtime_put(ici->v4l2_dev.dev);
 }
@@ -618,6 +744,355 @@ static struct vb2_ops isi_video_qops = {
 	.wait_finish		= vb2_ops_wait_finish,
 };
 
+/* ------------------------------------------------------------------
+	Preview node
+   ------------------------------------------------------------------*/
+
+/*
+ * The preview image is the whole sensor image decimated by the same factor
+ * in both directions, so its size follows from the codec node format. Pick
+ * the smallest factor for which it fits into the requested size.
+ */
+static void isi_preview_fit(struct atmel_isi *isi, struct v4l2_pix_format *pix,
+			    u32 *dec_factor)
+{
+	struct soc_camera_device *icd = isi->soc_host.icd;
+	u32 in_width = icd ? icd->user_width : PREVIEW_MAX_WIDTH;
+	u32 in_height = icd ? icd->user_height : PREVIEW_MAX_HEIGHT;
+	u32 dec;
+
+	pix->width = clamp_t(u32, pix->width, 1, PREVIEW_MAX_WIDTH);
+	pix->height = clamp_t(u32, pix->height, 1, PREVIEW_MAX_HEIGHT);
+
+	dec = max(DIV_ROUND_UP(in_width * 16, pix->width),
+		  DIV_ROUND_UP(in_height * 16, pix->height));
+	dec = clamp_t(u32, dec, ISI_PDECF_NO_SAMPLING,
+		      ISI_PDECF_DEC_FACTOR_MASK);
+
+	pix->width = in_width * 16 / dec;
+	pix->height = in_height * 16 / dec;
+	pix->pixelformat = V4L2_PIX_FMT_RGB565;
+	pix->field = V4L2_FIELD_NONE;
+	pix->bytesperline = pix->width * 2;
+	pix->sizeimage = pix->bytesperline * pix->height;
+	pix->colorspace = V4L2_COLORSPACE_SRGB;
+	pix->priv = 0;
+
+	if (dec_factor)
+		*dec_factor = dec;
+}
+
+static int preview_queue_setup(struct vb2_queue *vq,
+			       const struct v4l2_format *fmt,
+			       unsigned int *nbuffers, unsigned int *nplanes,
+			       unsigned int sizes[], void *alloc_ctxs[])
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vq);
+	unsigned long size = isi->preview.pix.sizeimage;
+
+	if (!*nbuffers || *nbuffers > MAX_BUFFER_NUM)
+		*nbuffers = MAX_BUFFER_NUM;
+
+	if (size * *nbuffers > VID_LIMIT_BYTES)
+		*nbuffers = VID_LIMIT_BYTES / size;
+
+	*nplanes = 1;
+	sizes[0] = size;
+	alloc_ctxs[0] = isi->alloc_ctx;
+
+	isi->preview.sequence = 0;
+	isi->preview.active = NULL;
+
+	return 0;
+}
+
+static int preview_buffer_prepare(struct vb2_buffer *vb)
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vb->vb2_queue);
+	struct frame_buffer *buf = container_of(vb, struct frame_buffer, vb);
+	unsigned long size = isi->preview.pix.sizeimage;
+
+	if (vb2_plane_size(vb, 0) < size)
+		return -EINVAL;
+
+	vb2_set_plane_payload(vb, 0, size);
+
+	return isi_buffer_prepare_desc(isi, buf);
+}
+
+static void preview_buffer_cleanup(struct vb2_buffer *vb)
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vb->vb2_queue);
+	struct frame_buffer *buf = container_of(vb, struct frame_buffer, vb);
+
+	if (buf->p_dma_desc)
+		list_add(&buf->p_dma_desc->list, &isi->dma_desc_head);
+}
+
+static void preview_buffer_queue(struct vb2_buffer *vb)
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vb->vb2_queue);
+	struct frame_buffer *buf = container_of(vb, struct frame_buffer, vb);
+	struct isi_preview *prev = &isi->preview;
+	unsigned long flags;
+
+	spin_lock_irqsave(&isi->lock, flags);
+	list_add_tail(&buf->list, &prev->video_buffer_list);
+
+	if (!prev->active) {
+		prev->active = buf;
+		if (isi->paths & ISI_PATH_PREVIEW)
+			isi_preview_start_dma(isi, buf);
+	}
+	spin_unlock_irqrestore(&isi->lock, flags);
+}
+
+static void preview_release_buffers(struct atmel_isi *isi,
+				    enum vb2_buffer_state state)
+{
+	struct isi_preview *prev = &isi->preview;
+	struct frame_buffer *buf, *node;
+
+	prev->active = NULL;
+	list_for_each_entry_safe(buf, node, &prev->video_buffer_list, list) {
+		list_del_init(&buf->list);
+		vb2_buffer_done(&buf->vb, state);
+	}
+}
+
+/*
+ * Both paths take the same frames, so the preview node only runs next to a
+ * codec node set to UYVY: the colour space conversion of the preview path
+ * wants that order, and the swap applies to the codec path too. The codec
+ * node format is then locked while the preview streams.
+ *
+ * The codec node owns the sensor, which the preview node only starts on its
+ * own while the codec node isn't streaming. A codec STREAMOFF stops the
+ * sensor for both, so it should be the last one to stop.
+ */
+static int preview_start_streaming(struct vb2_queue *vq, unsigned int count)
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vq);
+	struct soc_camera_device *icd = isi->soc_host.icd;
+	struct isi_preview *prev = &isi->preview;
+	struct device *dev = isi->soc_host.v4l2_dev.dev;
+	struct v4l2_pix_format pix;
+	u32 dec;
+	int ret;
+
+	if (!icd || icd->current_fmt->host_fmt->fourcc != V4L2_PIX_FMT_UYVY) {
+		dev_dbg(dev, "preview needs the codec node open, set to UYVY\n");
+		ret = -EBUSY;
+		goto err_release;
+	}
+
+	/* The codec node format may have changed since S_FMT */
+	pix = prev->pix;
+	isi_preview_fit(isi, &pix, &dec);
+	if (pix.width != prev->pix.width || pix.height != prev->pix.height) {
+		ret = -EPIPE;
+		goto err_release;
+	}
+
+	pm_runtime_get_sync(dev);
+
+	if (!isi->paths) {
+		ret = isi_hw_setup(isi, icd);
+		if (ret < 0)
+			goto err_pm_put;
+	}
+
+	isi_writel(isi, ISI_PSIZE,
+		   (((pix.width - 1) << ISI_PSIZE_PREV_HSIZE_OFFSET) &
+		    ISI_PSIZE_PREV_HSIZE_MASK) |
+		   (((pix.height - 1) << ISI_PSIZE_PREV_VSIZE_OFFSET) &
+		    ISI_PSIZE_PREV_VSIZE_MASK));
+	isi_writel(isi, ISI_PDECF, dec);
+
+	if (!(isi->paths & ISI_PATH_MAIN))
+		v4l2_subdev_call(soc_camera_to_subdev(icd), video, s_stream, 1);
+
+	spin_lock_irq(&isi->lock);
+	isi->paths |= ISI_PATH_PREVIEW;
+	isi_writel(isi, ISI_INTEN, ISI_SR_PXFR_DONE);
+	if (prev->active)
+		isi_preview_start_dma(isi, prev->active);
+	spin_unlock_irq(&isi->lock);
+
+	return 0;
+
+err_pm_put:
+	pm_runtime_put(dev);
+err_release:
+	spin_lock_irq(&isi->lock);
+	preview_release_buffers(isi, VB2_BUF_STATE_QUEUED);
+	spin_unlock_irq(&isi->lock);
+	return ret;
+}
+
+static void preview_stop_streaming(struct vb2_queue *vq)
+{
+	struct atmel_isi *isi = vb2_get_drv_priv(vq);
+	struct soc_camera_device *icd = isi->soc_host.icd;
+	struct device *dev = isi->soc_host.v4l2_dev.dev;
+
+	spin_lock_irq(&isi->lock);
+	isi->paths &= ~ISI_PATH_PREVIEW;
+	isi_writel(isi, ISI_DMA_CHDR, ISI_DMA_CHSR_P_CH);
+	isi_writel(isi, ISI_INTDIS, ISI_SR_PXFR_DONE);
+	preview_release_buffers(isi, VB2_BUF_STATE_ERROR);
+	spin_unlock_irq(&isi->lock);
+
+	if (!isi->paths) {
+		if (icd)
+			v4l2_subdev_call(soc_camera_to_subdev(icd), video,
+					 s_stream, 0);
+
+		if (atmel_isi_wait_status(isi, WAIT_HW_DISABLE) < 0)
+			dev_err(dev, "Disable ISI timed out\n");
+	}
+
+	pm_runtime_put(dev);
+}
+
+static struct vb2_ops isi_preview_qops = {
+	.queue_setup		= preview_queue_setup,
+	.buf_init		= buffer_init,
+	.buf_prepare		= preview_buffer_prepare,
+	.buf_cleanup		= preview_buffer_cleanup,
+	.buf_queue		= preview_buffer_queue,
+	.start_streaming	= preview_start_streaming,
+	.stop_streaming		= preview_stop_streaming,
+	.wait_prepare		= vb2_ops_wait_prepare,
+	.wait_finish		= vb2_ops_wait_finish,
+};
+
+static int isi_preview_querycap(struct file *file, void *priv,
+				struct v4l2_capability *cap)
+{
+	struct atmel_isi *isi = video_drvdata(file);
+
+	strlcpy(cap->driver, "atmel-isi", sizeof(cap->driver));
+	strlcpy(cap->card, "Atmel ISI preview", sizeof(cap->card));
+	snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s",
+		 dev_name(isi->soc_host.v4l2_dev.dev));
+	cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+	cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+
+	return 0;
+}
+
+static int isi_preview_enum_fmt(struct file *file, void *priv,
+				struct v4l2_fmtdesc *f)
+{
+	if (f->index)
+		return -EINVAL;
+
+	strlcpy(f->description, "RGB565", sizeof(f->description));
+	f->pixelformat = V4L2_PIX_FMT_RGB565;
+
+	return 0;
+}
+
+static int isi_preview_g_fmt(struct file *file, void *priv,
+			     struct v4l2_format *f)
+{
+	struct atmel_isi *isi = video_drvdata(file);
+
+	f->fmt.pix = isi->preview.pix;
+
+	return 0;
+}
+
+static int isi_preview_try_fmt(struct file *file, void *priv,
+			       struct v4l2_format *f)
+{
+	struct atmel_isi *isi = video_drvdata(file);
+
+	isi_preview_fit(isi, &f->fmt.pix, NULL);
+
+	return 0;
+}
+
+static int isi_preview_s_fmt(struct file *file, void *priv,
+			     struct v4l2_format *f)
+{
+	struct atmel_isi *isi = video_drvdata(file);
+
+	if (vb2_is_busy(&isi->preview.vb2_vidq))
+		return -EBUSY;
+
+	isi_preview_fit(isi, &f->fmt.pix, NULL);
+	isi->preview.pix = f->fmt.pix;
+
+	return 0;
+}
+
+static const struct v4l2_ioctl_ops isi_preview_ioctl_ops = {
+	.vidioc_querycap		= isi_preview_querycap,
+	.vidioc_enum_fmt_vid_cap	= isi_preview_enum_fmt,
+	.vidioc_g_fmt_vid_cap		= isi_preview_g_fmt,
+	.vidioc_try_fmt_vid_cap		= isi_preview_try_fmt,
+	.vidioc_s_fmt_vid_cap		= isi_preview_s_fmt,
+	.vidioc_reqbufs			= vb2_ioctl_reqbufs,
+	.vidioc_create_bufs		= vb2_ioctl_create_bufs,
+	.vidioc_prepare_buf		= vb2_ioctl_prepare_buf,
+	.vidioc_querybuf		= vb2_ioctl_querybuf,
+	.vidioc_qbuf			= vb2_ioctl_qbuf,
+	.vidioc_dqbuf			= vb2_ioctl_dqbuf,
+	.vidioc_expbuf			= vb2_ioctl_expbuf,
+	.vidioc_streamon		= vb2_ioctl_streamon,
+	.vidioc_streamoff		= vb2_ioctl_streamoff,
+};
+
+static const struct v4l2_file_operations isi_preview_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v4l2_fh_open,
+	.release	= vb2_fop_release,
+	.poll		= vb2_fop_poll,
+	.mmap		= vb2_fop_mmap,
+	.unlocked_ioctl	= video_ioctl2,
+};
+
+static int isi_preview_register(struct atmel_isi *isi)
+{
+	struct isi_preview *prev = &isi->preview;
+	struct video_device *vdev = &prev->vdev;
+	struct vb2_queue *q = &prev->vb2_vidq;
+	int ret;
+
+	INIT_LIST_HEAD(&prev->video_buffer_list);
+
+	/* Serialized with the codec node, they share the descriptors */
+	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	q->io_modes = VB2_MMAP | VB2_DMABUF;
+	q->drv_priv = isi;
+	q->buf_struct_size = sizeof(struct frame_buffer);
+	q->ops = &isi_preview_qops;
+	q->mem_ops = &vb2_dma_contig_memops;
+	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	q->lock = &isi->soc_host.host_lock;
+
+	ret = vb2_queue_init(q);
+	if (ret)
+		return ret;
+
+	prev->pix.width = PREVIEW_MAX_WIDTH;
+	prev->pix.height = PREVIEW_MAX_HEIGHT;
+	isi_preview_fit(isi, &prev->pix, NULL);
+
+	strlcpy(vdev->name, "isi-preview", sizeof(vdev->name));
+	vdev->v4l2_dev = &isi->soc_host.v4l2_dev;
+	vdev->fops = &isi_preview_fops;
+	vdev->ioctl_ops = &isi_preview_ioctl_ops;
+	vdev->release = video_device_release_empty;
+	vdev->lock = &isi->soc_host.host_lock;
+	vdev->queue = q;
+	video_set_drvdata(vdev, isi);
+
+	return video_register_device(vdev, VFL_TYPE_GRABBER, -1);
+}
+
 /* ------------------------------------------------------------------
 	ISC hardware operations
    ------------------------------------------------------------------*/
@@ -688,7 +1163,11 @@ static void isc_hw_uninitialize(struct atmel_isi *isc)
 			"Timeout waiting for finishing codec request\n");
 
 	/* Disable interrupts */
-	isi_writel(isc, ISC_INTDIS, ISC_INT_DMA_DONE);
+	spin_lock_irq(&isc->lock);
+	isc->hist_running = false;
+	isi_writel(isc, ISC_HIS_CTRL, 0);
+	isi_writel(isc, ISC_INTDIS, ISC_INT_DMA_DONE | ISC_INT_HISTOGRAM_DONE);
+	spin_unlock_irq(&isc->lock);
 }
 
 static void isc_hw_set_clock(struct atmel_isi *isc, bool enable_clk)
@@ -701,9 +1180,82 @@ static void isc_hw_set_clock(struct atmel_isi *isc, bool enable_clk)
 		pm_runtime_put(isc->soc_host.v4l2_dev.dev);
 }
 
+/*
+ * Histogram: the enabled channels are measured in turn. The table of a frame
+ * is requested when its DMA completes, and read back on HISTOGRAM_DONE.
+ * All called with isc->lock held.
+ */
+static void isc_hist_next(struct atmel_isi *isc)
+{
+	int i, ch = isc->hist_cur;
+
+	for (i = 1; i <= ISC_HIS_CFG_MODES; i++) {
+		ch = (isc->hist_cur + i) % ISC_HIS_CFG_MODES;
+		if (isc->hist_channels & BIT(ch))
+			break;
+	}
+
+	if (ch == isc->hist_cur)
+		return;
+
+	isc->hist_cur = ch;
+	isi_writel(isc, ISC_HIS_CFG, ch | isc->hist_baysel | ISC_HIS_CFG_RAR);
+	isi_writel(isc, ISC_CTRLEN, ISC_CTRLEN_UPPRO);
+
+	/* The new channel applies from the next frame on */
+	isc->hist_skip = true;
+}
+
+static void isc_hist_setup(struct atmel_isi *isc)
+{
+	isc->hist_pending = false;
+
+	if (!isc->hist_channels) {
+		isi_writel(isc, ISC_HIS_CTRL, 0);
+		isi_writel(isc, ISC_INTDIS, ISC_INT_HISTOGRAM_DONE);
+		return;
+	}
+
+	isc->hist_cur = -1;
+	isc_hist_next(isc);
+	isi_writel(isc, ISC_HIS_CTRL, ISC_HIS_CTRL_EN);
+	isi_writel(isc, ISC_INTEN, ISC_INT_HISTOGRAM_DONE);
+}
+
+static void isc_hist_request(struct atmel_isi *isc)
+{
+	if (!isc->hist_running || !isc->hist_channels || isc->hist_pending)
+		return;
+
+	if (isc->hist_skip) {
+		isc->hist_skip = false;
+		return;
+	}
+
+	isc->hist_req_seq = isc->sequence - 1;
+	isc->hist_pending = true;
+	isi_writel(isc, ISC_CTRLEN, ISC_CTRLEN_HISREQ);
+}
+
+static void isc_hist_done(struct atmel_isi *isc)
+{
+	u32 *hist = isc->hist[isc->hist_cur];
+	int i;
+
+	for (i = 0; i < ISC_HIS_ENTRIES; i++)
+		hist[i] = isi_readl(isc, ISC_HIS_ENTRY + 4 * i);
+	isc->hist_seq[isc->hist_cur] = isc->hist_req_seq;
+	isc->hist_pending = false;
+
+	isc_hist_next(isc);
+}
+
 static void isc_configure_geometry(struct atmel_isi *isc, u32 width,
 		u32 height, const struct soc_camera_format_xlate *xlate)
 {
+	/* Only used for the Bayer channels of the histogram */
+	isc->hist_baysel = ISC_HIS_CFG_BAYSEL_BGBG;
+
 	/* According to sensor's output format to set cfg2 */
 	switch (xlate->code) {
 	/* YUV, including grey */
@@ -735,6 +1287,104 @@ static void isc_configure_geometry(struct atmel_isi *isc, u32 width,
 		}
 		break;
 	}
+
+	if (isc->hist) {
+		spin_lock_irq(&isc->lock);
+		isc->hist_running = true;
+		isc_hist_setup(isc);
+		spin_unlock_irq(&isc->lock);
+	}
+}
+
+static int isc_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct atmel_isi *isc = ctrl->priv;
+
+	switch (ctrl->id) {
+	case V4L2_CID_ISC_HIST_CHANNELS:
+		spin_lock_irq(&isc->lock);
+		isc->hist_channels = ctrl->val;
+		if (isc->hist_running)
+			isc_hist_setup(isc);
+		spin_unlock_irq(&isc->lock);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int isc_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct atmel_isi *isc = ctrl->priv;
+
+	spin_lock_irq(&isc->lock);
+	switch (ctrl->id) {
+	case V4L2_CID_ISC_HIST:
+		memcpy(ctrl->p_new.p_u32, isc->hist,
+		       sizeof(u32) * ISC_HIS_CFG_MODES * ISC_HIS_ENTRIES);
+		break;
+	case V4L2_CID_ISC_HIST_SEQUENCE:
+		memcpy(ctrl->p_new.p_u32, isc->hist_seq, sizeof(isc->hist_seq));
+		break;
+	}
+	spin_unlock_irq(&isc->lock);
+
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops isc_ctrl_ops = {
+	.s_ctrl = isc_s_ctrl,
+	.g_volatile_ctrl = isc_g_volatile_ctrl,
+};
+
+static const struct v4l2_ctrl_config isc_hist_ctrls[] = {
+	{
+		.ops = &isc_ctrl_ops,
+		.id = V4L2_CID_ISC_HIST_CHANNELS,
+		.name = "Histogram Channels",
+		.type = V4L2_CTRL_TYPE_BITMASK,
+		.max = BIT(ISC_HIS_CFG_MODES) - 1,
+	}, {
+		.ops = &isc_ctrl_ops,
+		.id = V4L2_CID_ISC_HIST,
+		.name = "Histogram",
+		.type = V4L2_CTRL_TYPE_U32,
+		.max = 0xffffffff,
+		.step = 1,
+		.dims = { ISC_HIS_CFG_MODES, ISC_HIS_ENTRIES },
+		.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	}, {
+		.ops = &isc_ctrl_ops,
+		.id = V4L2_CID_ISC_HIST_SEQUENCE,
+		.name = "Histogram Sequence",
+		.type = V4L2_CTRL_TYPE_U32,
+		.max = 0xffffffff,
+		.step = 1,
+		.dims = { ISC_HIS_CFG_MODES },
+		.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	},
+};
+
+static int isc_add_ctrls(struct atmel_isi *isc, struct soc_camera_device *icd)
+{
+	int i;
+
+	/* The handler outlives a camera remove/add cycle */
+	if (v4l2_ctrl_find(&icd->ctrl_handler, V4L2_CID_ISC_HIST_CHANNELS))
+		return 0;
+
+	if (!isc->hist) {
+		isc->hist = devm_kzalloc(isc->soc_host.v4l2_dev.dev,
+				sizeof(u32) * ISC_HIS_CFG_MODES * ISC_HIS_ENTRIES,
+				GFP_KERNEL);
+		if (!isc->hist)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(isc_hist_ctrls); i++)
+		v4l2_ctrl_new_custom(&icd->ctrl_handler, &isc_hist_ctrls[i], isc);
+
+	return icd->ctrl_handler.error;
 }
 
 static irqreturn_t isc_interrupt(int irq, void *dev_id)
@@ -759,6 +1409,12 @@ static irqreturn_t isc_interrupt(int irq, void *dev_id)
 		ret = IRQ_HANDLED;
 	} else if (likely(pending & ISC_INT_DMA_DONE)) {
 		ret = atmel_isi_handle_streaming(isc);
+		isc_hist_request(isc);
+	}
+
+	if (pending & ISC_INT_HISTOGRAM_DONE) {
+		isc_hist_done(isc);
+		ret = IRQ_HANDLED;
 	}
 
 	spin_unlock(&isc->lock);
@@ -817,7 +1473,7 @@ static int isi_camera_init_videobuf(struct vb2_queue *q,
 	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
 
 	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	q->io_modes = VB2_MMAP;
+	q->io_modes = VB2_MMAP | VB2_DMABUF;
 	q->drv_priv = icd;
 	q->buf_struct_size = sizeof(struct frame_buffer);
 	q->ops = &isi_video_qops;
@@ -901,10 +1557,16 @@ static int try_or_set_fmt(struct soc_camera_device *icd,
 static int isi_camera_set_fmt(struct soc_camera_device *icd,
 			      struct v4l2_format *f)
 {
+	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
+	struct atmel_isi *isi = ici->priv;
 	struct v4l2_subdev_format format = {
 		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
 	};
 
+	/* The preview path runs from the current sensor format */
+	if (isi->paths & ISI_PATH_PREVIEW)
+		return -EBUSY;
+
 	return try_or_set_fmt(icd, f, &format);
 }
 
@@ -974,7 +1636,7 @@ static int isi_camera_get_formats(struct soc_camera_device *icd,
 	struct v4l2_subdev *sd = soc_camera_to_subdev(icd);
 	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
 	struct atmel_isi *isi = ici->priv;
-	int formats = 0, ret, i, n;
+	int formats = 0, ret, n;
 	/* sensor format */
 	struct v4l2_subdev_mbus_code_enum code = {
 		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
@@ -983,6 +1645,13 @@ static int isi_camera_get_formats(struct soc_camera_device *icd,
 	/* soc camera host format */
 	const struct soc_mbus_pixelfmt *fmt;
 
+	/* Host controls, added once along with the first format */
+	if (!idx && isi->hw_ops->add_ctrls) {
+		ret = (*isi->hw_ops->add_ctrls)(isi, icd);
+		if (ret < 0)
+			return ret;
+	}
+
 	ret = v4l2_subdev_call(sd, pad, enum_mbus_code, NULL, &code);
 	if (ret < 0)
 		/* No more formats */
@@ -1008,15 +1677,22 @@ static int isi_camera_get_formats(struct soc_camera_device *icd,
 	case MEDIA_BUS_FMT_VYUY8_2X8:
 	case MEDIA_BUS_FMT_YUYV8_2X8:
 	case MEDIA_BUS_FMT_YVYU8_2X8:
-		for (n = 0; isi->caps->yuv_support_formats[n].name != NULL; n++)
-			/* Empty! */;
-
-		formats += n;
-		for (i = 0; xlate && i < n; i++, xlate++) {
-			xlate->host_fmt	= isi->caps->yuv_support_formats + i;
-			xlate->code	= code.code;
-			dev_dbg(icd->parent, "Providing format %s using code %d\n",
-				xlate->host_fmt->name, xlate->code);
+		for (n = 0; isi->caps->yuv_support_formats[n].name != NULL; n++) {
+			const struct soc_mbus_pixelfmt *host_fmt =
+				isi->caps->yuv_support_formats + n;
+
+			/* Provided by the pass-through format below */
+			if (host_fmt->fourcc == fmt->fourcc)
+				continue;
+
+			formats++;
+			if (xlate) {
+				xlate->host_fmt	= host_fmt;
+				xlate->code	= code.code;
+				dev_dbg(icd->parent, "Providing format %s using code %d\n",
+					xlate->host_fmt->name, xlate->code);
+				xlate++;
+			}
 		}
 		break;
 	default:
@@ -1049,6 +1725,14 @@ static int isi_camera_add_device(struct soc_camera_device *icd)
 
 static void isi_camera_remove_device(struct soc_camera_device *icd)
 {
+	struct soc_camera_host *ici = to_soc_camera_host(icd->parent);
+	struct atmel_isi *isi = ici->priv;
+
+	/* The preview node loses its sensor, called with .host_lock held */
+	if (isi->caps->has_preview && vb2_is_streaming(&isi->preview.vb2_vidq))
+		vb2_streamoff(&isi->preview.vb2_vidq,
+			      V4L2_BUF_TYPE_VIDEO_CAPTURE);
+
 	dev_dbg(icd->parent, "Atmel ISI Camera driver detached from camera %d\n",
 		 icd->devnum);
 }
@@ -1188,6 +1872,8 @@ static int atmel_isi_remove(struct platform_device *pdev)
 	struct atmel_isi *isi = container_of(soc_host,
 					struct atmel_isi, soc_host);
 
+	if (isi->caps->has_preview)
+		video_unregister_device(&isi->preview.vdev);
 	soc_camera_host_unregister(soc_host);
 	vb2_dma_contig_cleanup_ctx(isi->alloc_ctx);
 	dma_free_coherent(&pdev->dev,
@@ -1350,11 +2036,21 @@ static int atmel_isi_probe(struct platform_device *pdev)
 		goto err_register_soc_camera_host;
 	}
 
+	if (isi->caps->has_preview) {
+		ret = isi_preview_register(isi);
+		if (ret) {
+			dev_err(&pdev->dev, "Unable to register preview node\n");
+			goto err_register_preview;
+		}
+	}
+
 	if (of_device_is_compatible(pdev->dev.of_node, "atmel,sama5d2-isc"))
 		isc_enable_clock(isi);
 
 	return 0;
 
+err_register_preview:
+	soc_camera_host_unregister(soc_host);
 err_register_soc_camera_host:
 	pm_runtime_disable(&pdev->dev);
 err_req_irq:
@@ -1405,6 +2101,7 @@ static struct at91_camera_caps at91sam9g45_caps = {
 		.hw_enable_interrupt = isi_hw_enable_interrupt,
 		.host_fmt_supported = isi_fmt_supported,
 	},
+	.has_preview = true,
 
 	.yuv_support_formats = {
 		{
@@ -1415,6 +2112,15 @@ static struct at91_camera_caps at91sam9g45_caps = {
 			.order			= SOC_MBUS_ORDER_LE,
 			.layout			= SOC_MBUS_LAYOUT_PACKED,
 		},
+		{
+			/* codec format usable along with the preview node */
+			.fourcc			= V4L2_PIX_FMT_UYVY,
+			.name			= "UYVY 16 bit",
+			.bits_per_sample	= 8,
+			.packing		= SOC_MBUS_PACKING_2X8_PADHI,
+			.order			= SOC_MBUS_ORDER_LE,
+			.layout			= SOC_MBUS_LAYOUT_PACKED,
+		},
 		{
 			.fourcc			= V4L2_PIX_FMT_RGB565,
 			.name			= "RGB565",
@@ -1438,6 +2144,7 @@ static struct at91_camera_caps sama5d2_caps = {
 		.hw_enable_interrupt = isc_hw_enable_interrupt,
 		.host_fmt_supported = isc_fmt_supported,
 		.hw_set_clock = isc_hw_set_clock,
+		.add_ctrls = isc_add_ctrls,
 	},
 
 	.yuv_support_formats = {
@@ -19,14 +19,59 @@
 
 #include <linux/clk.h>
 #include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/mfd/syscon.h>
+#include <linux/mfd/syscon/atmel-matrix.h>
 #include <linux/module.h>
 #include <linux/of_platform.h>
+#include <linux/perf_event.h>
 #include <linux/platform_device.h>
+#include <linux/regmap.h>
+#include <linux/spinlock.h>
+
+#define AT91_MPDDRC_CONF_ARBITER	0x54
+#define		AT91_MPDDRC_ARB			GENMASK(1, 0)
+#define		AT91_MPDDRC_ARB_ROUND		(0 << 0)
+#define		AT91_MPDDRC_ARB_NB_REQUEST	(1 << 0)
+#define		AT91_MPDDRC_ARB_BANDWIDTH	(2 << 0)
+#define		AT91_MPDDRC_BDW_MAX_CUR		BIT(4)
+#define AT91_MPDDRC_REQ_PORT(x)		(0x5c + ((x) / 4) * 4)
+#define AT91_MPDDRC_BDW_PORT(x)		(0x64 + ((x) / 4) * 4)
+#define		AT91_MPDDRC_PORT_SHIFT(x)	(((x) % 4) * 8)
+#define		AT91_MPDDRC_BDW_MASK		0x7f
+
+#define AT91_MPDDRC_PORTS		8
 
 struct at91_ramc_caps {
 	bool has_ddrck;
 	bool has_mpddr_clk;
+	bool has_arbiter;
+};
+
+/**
+ * struct at91_ramc - Multi-port DDR controller arbiter and monitor
+ * @base:	controller registers
+ * @dev:	platform device
+ * @pmu:	"mpddrc" perf PMU, one event per port
+ * @timer:	samples the bandwidth monitors while events are counting
+ * @events:	counting event of each port
+ * @lock:	protects @events and the arbiter configuration
+ */
+struct at91_ramc {
+	void __iomem		*base;
+	struct device		*dev;
+	struct pmu		pmu;
+	struct hrtimer		timer;
+	struct perf_event	*events[AT91_MPDDRC_PORTS];
+	spinlock_t		lock;
+};
+
+static const char * const at91_ramc_arb_names[] = {
+	[AT91_MPDDRC_ARB_ROUND] = "round-robin",
+	[AT91_MPDDRC_ARB_NB_REQUEST] = "requests",
+	[AT91_MPDDRC_ARB_BANDWIDTH] = "bandwidth",
 };
 
 static const struct at91_ramc_caps at91rm9200_caps = { };
@@ -39,6 +84,7 @@ static const struct at91_ramc_caps at91sam9g45_caps = {
 static const struct at91_ramc_caps sama5d3_caps = {
 	.has_ddrck = 1,
 	.has_mpddr_clk = 1,
+	.has_arbiter = 1,
 };
 
 static const struct of_device_id atmel_ramc_of_match[] = {
@@ -50,11 +96,453 @@ static const struct of_device_id atmel_ramc_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, atmel_ramc_of_match);
 
+static u32 at91_ramc_port_field(struct at91_ramc *ramc, unsigned reg,
+				unsigned port)
+{
+	return readl_relaxed(ramc->base + reg) >> AT91_MPDDRC_PORT_SHIFT(port);
+}
+
+#ifdef CONFIG_PERF_EVENTS
+/*
+ * The MPDDRC reports, for each port, its share of the DDR bandwidth in
+ * percent.  There is no counter to read, so the monitors are sampled
+ * every pmu_poll_period_us and each event accumulates its port share:
+ * count * pmu_poll_period_us / elapsed time is the average share.
+ */
+static unsigned int at91_ramc_pmu_poll_period_us = 1000;
+module_param_named(pmu_poll_period_us, at91_ramc_pmu_poll_period_us, uint,
+		   S_IRUGO | S_IWUSR);
+
+static ktime_t at91_ramc_pmu_period(void)
+{
+	return ns_to_ktime((u64)at91_ramc_pmu_poll_period_us * 1000);
+}
+
+static enum hrtimer_restart at91_ramc_pmu_timer(struct hrtimer *timer)
+{
+	struct at91_ramc *ramc = container_of(timer, struct at91_ramc, timer);
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ramc->lock, flags);
+	for (i = 0; i < AT91_MPDDRC_PORTS; i++) {
+		if (!ramc->events[i])
+			continue;
+		local64_add(at91_ramc_port_field(ramc,
+						 AT91_MPDDRC_BDW_PORT(i), i) &
+			    AT91_MPDDRC_BDW_MASK, &ramc->events[i]->count);
+	}
+	spin_unlock_irqrestore(&ramc->lock, flags);
+
+	hrtimer_forward_now(timer, at91_ramc_pmu_period());
+	return HRTIMER_RESTART;
+}
+
+static int at91_ramc_pmu_event_init(struct perf_event *event)
+{
+	struct at91_ramc *ramc = container_of(event->pmu, struct at91_ramc,
+					      pmu);
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EOPNOTSUPP;
+
+	if (event->cpu < 0) {
+		dev_warn(ramc->dev, "Can't provide per-task data!\n");
+		return -EOPNOTSUPP;
+	}
+
+	if (event->attr.config >= AT91_MPDDRC_PORTS)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void at91_ramc_pmu_event_start(struct perf_event *event, int flags)
+{
+	event->hw.state = 0;
+}
+
+static void at91_ramc_pmu_event_stop(struct perf_event *event, int flags)
+{
+	event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+static int at91_ramc_pmu_event_add(struct perf_event *event, int flags)
+{
+	struct at91_ramc *ramc = container_of(event->pmu, struct at91_ramc,
+					      pmu);
+	unsigned port = event->attr.config;
+	unsigned long irqflags;
+	bool first = true;
+	int i;
+
+	spin_lock_irqsave(&ramc->lock, irqflags);
+	if (ramc->events[port]) {
+		spin_unlock_irqrestore(&ramc->lock, irqflags);
+		return -EAGAIN;
+	}
+	for (i = 0; i < AT91_MPDDRC_PORTS; i++)
+		if (ramc->events[i])
+			first = false;
+	ramc->events[port] = event;
+	spin_unlock_irqrestore(&ramc->lock, irqflags);
+
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	if (flags & PERF_EF_START)
+		at91_ramc_pmu_event_start(event, flags);
+
+	if (first)
+		hrtimer_start(&ramc->timer, at91_ramc_pmu_period(),
+			      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static void at91_ramc_pmu_event_del(struct perf_event *event, int flags)
+{
+	struct at91_ramc *ramc = container_of(event->pmu, struct at91_ramc,
+					      pmu);
+	unsigned long irqflags;
+	bool last = true;
+	int i;
+
+	at91_ramc_pmu_event_stop(event, PERF_EF_UPDATE);
+
+	spin_lock_irqsave(&ramc->lock, irqflags);
+	ramc->events[event->attr.config] = NULL;
+	for (i = 0; i < AT91_MPDDRC_PORTS; i++)
+		if (ramc->events[i])
+			last = false;
+	spin_unlock_irqrestore(&ramc->lock, irqflags);
+
+	if (last)
+		hrtimer_cancel(&ramc->timer);
+}
+
+/* The count is kept up to date by the sampling timer */
+static void at91_ramc_pmu_event_read(struct perf_event *event)
+{
+}
+
+PMU_FORMAT_ATTR(port, "config:0-2");
+
+static struct attribute *at91_ramc_pmu_format_attrs[] = {
+	&format_attr_port.attr,
+	NULL,
+};
+
+static struct attribute_group at91_ramc_pmu_format_group = {
+	.name = "format",
+	.attrs = at91_ramc_pmu_format_attrs,
+};
+
+#define AT91_RAMC_PMU_EVENT(n)						\
+	PMU_EVENT_ATTR_STRING(bandwidth_port##n,			\
+			      at91_ramc_pmu_event_attr_##n, "port=" #n)
+
+AT91_RAMC_PMU_EVENT(0);
+AT91_RAMC_PMU_EVENT(1);
+AT91_RAMC_PMU_EVENT(2);
+AT91_RAMC_PMU_EVENT(3);
+AT91_RAMC_PMU_EVENT(4);
+AT91_RAMC_PMU_EVENT(5);
+AT91_RAMC_PMU_EVENT(6);
+AT91_RAMC_PMU_EVENT(7);
+
+static struct attribute *at91_ramc_pmu_event_attrs[] = {
+	&at91_ramc_pmu_event_attr_0.attr.attr,
+	&at91_ramc_pmu_event_attr_1.attr.attr,
+	&at91_ramc_pmu_event_attr_2.attr.attr,
+	&at91_ramc_pmu_event_attr_3.attr.attr,
+	&at91_ramc_pmu_event_attr_4.attr.attr,
+	&at91_ramc_pmu_event_attr_5.attr.attr,
+	&at91_ramc_pmu_event_attr_6.attr.attr,
+	&at91_ramc_pmu_event_attr_7.attr.attr,
+	NULL,
+};
+
+static struct attribute_group at91_ramc_pmu_events_group = {
+	.name = "events",
+	.attrs = at91_ramc_pmu_event_attrs,
+};
+
+static const struct attribute_group *at91_ramc_pmu_attr_groups[] = {
+	&at91_ramc_pmu_format_group,
+	&at91_ramc_pmu_events_group,
+	NULL,
+};
+
+static int at91_ramc_pmu_init(struct at91_ramc *ramc)
+{
+	hrtimer_init(&ramc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ramc->timer.function = at91_ramc_pmu_timer;
+
+	ramc->pmu = (struct pmu) {
+		.attr_groups = at91_ramc_pmu_attr_groups,
+		.task_ctx_nr = perf_invalid_context,
+		.event_init = at91_ramc_pmu_event_init,
+		.add = at91_ramc_pmu_event_add,
+		.del = at91_ramc_pmu_event_del,
+		.start = at91_ramc_pmu_event_start,
+		.stop = at91_ramc_pmu_event_stop,
+		.read = at91_ramc_pmu_event_read,
+	};
+
+	return perf_pmu_register(&ramc->pmu, "mpddrc", -1);
+}
+#else
+static int at91_ramc_pmu_init(struct at91_ramc *ramc)
+{
+	return 0;
+}
+#endif
+
+static int at91_ramc_set_arbiter(struct at91_ramc *ramc, u32 arb)
+{
+	unsigned long flags;
+	u32 conf;
+
+	if (arb >= ARRAY_SIZE(at91_ramc_arb_names))
+		return -EINVAL;
+
+	spin_lock_irqsave(&ramc->lock, flags);
+	conf = readl_relaxed(ramc->base + AT91_MPDDRC_CONF_ARBITER);
+	conf &= ~(AT91_MPDDRC_ARB | AT91_MPDDRC_BDW_MAX_CUR);
+	writel_relaxed(conf | arb, ramc->base + AT91_MPDDRC_CONF_ARBITER);
+	spin_unlock_irqrestore(&ramc->lock, flags);
+
+	return 0;
+}
+
+/*
+ * The weight of a port is its number of consecutive requests in the
+ * "requests" policy, and its bandwidth share in percent in the
+ * "bandwidth" one.
+ */
+static void at91_ramc_set_weight(struct at91_ramc *ramc, unsigned port,
+				 u32 weight)
+{
+	unsigned reg = AT91_MPDDRC_REQ_PORT(port);
+	unsigned long flags;
+	u32 val;
+
+	spin_lock_irqsave(&ramc->lock, flags);
+	val = readl_relaxed(ramc->base + reg);
+	val &= ~(0xff << AT91_MPDDRC_PORT_SHIFT(port));
+	val |= (weight & 0xff) << AT91_MPDDRC_PORT_SHIFT(port);
+	writel_relaxed(val, ramc->base + reg);
+	spin_unlock_irqrestore(&ramc->lock, flags);
+}
+
+static ssize_t arbitration_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct at91_ramc *ramc = dev_get_drvdata(dev);
+	u32 arb = readl_relaxed(ramc->base + AT91_MPDDRC_CONF_ARBITER) &
+		  AT91_MPDDRC_ARB;
+
+	if (arb >= ARRAY_SIZE(at91_ramc_arb_names))
+		return -EIO;
+
+	return sprintf(buf, "%s\n", at91_ramc_arb_names[arb]);
+}
+
+static ssize_t arbitration_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t len)
+{
+	struct at91_ramc *ramc = dev_get_drvdata(dev);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(at91_ramc_arb_names); i++)
+		if (sysfs_streq(buf, at91_ramc_arb_names[i]))
+			break;
+
+	return at91_ramc_set_arbiter(ramc, i) ? : len;
+}
+static DEVICE_ATTR_RW(arbitration);
+
+static ssize_t port_weights_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct at91_ramc *ramc = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < AT91_MPDDRC_PORTS; i++)
+		len += sprintf(buf + len, "%u%c",
+			       at91_ramc_port_field(ramc,
+						    AT91_MPDDRC_REQ_PORT(i), i) &
+			       0xff, i == AT91_MPDDRC_PORTS - 1 ? '\n' : ' ');
+
+	return len;
+}
+
+/* "<port> <weight>" */
+static ssize_t port_weights_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len)
+{
+	struct at91_ramc *ramc = dev_get_drvdata(dev);
+	unsigned port, weight;
+
+	if (sscanf(buf, "%u %u", &port, &weight) != 2 ||
+	    port >= AT91_MPDDRC_PORTS || weight > 0xff)
+		return -EINVAL;
+
+	at91_ramc_set_weight(ramc, port, weight);
+
+	return len;
+}
+static DEVICE_ATTR_RW(port_weights);
+
+static struct attribute *at91_ramc_attrs[] = {
+	&dev_attr_arbitration.attr,
+	&dev_attr_port_weights.attr,
+	NULL,
+};
+
+static const struct attribute_group at91_ramc_attr_group = {
+	.attrs = at91_ramc_attrs,
+};
+
+static int at91_ramc_of_arbiter(struct at91_ramc *ramc, struct device_node *np)
+{
+	u32 weights[AT91_MPDDRC_PORTS];
+	const char *policy;
+	int i, n, ret;
+
+	if (!of_property_read_string(np, "atmel,arbitration", &policy)) {
+		for (i = 0; i < ARRAY_SIZE(at91_ramc_arb_names); i++)
+			if (!strcmp(policy, at91_ramc_arb_names[i]))
+				break;
+
+		ret = at91_ramc_set_arbiter(ramc, i);
+		if (ret) {
+			dev_err(ramc->dev, "invalid arbitration %s\n", policy);
+			return ret;
+		}
+	}
+
+	n = of_property_count_u32_elems(np, "atmel,port-weights");
+	if (n <= 0)
+		return 0;
+
+	n = min(n, AT91_MPDDRC_PORTS);
+	ret = of_property_read_u32_array(np, "atmel,port-weights", weights, n);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < n; i++)
+		at91_ramc_set_weight(ramc, i, weights[i]);
+
+	return 0;
+}
+
+/*
+ * Priorities of the bus matrix masters on the DDR port slaves, as
+ * "atmel,matrix-priorities" = <slave master priority> triplets.  The
+ * slaves listed are switched to fixed priority arbitration, as the
+ * priorities are ignored by the round-robin one.
+ */
+static int at91_ramc_of_matrix(struct device *dev, struct device_node *np)
+{
+	struct regmap *matrix;
+	int i, n, ret;
+
+	n = of_property_count_u32_elems(np, "atmel,matrix-priorities");
+	if (n <= 0)
+		return 0;
+
+	if (n % 3) {
+		dev_err(dev, "invalid atmel,matrix-priorities\n");
+		return -EINVAL;
+	}
+
+	matrix = syscon_regmap_lookup_by_phandle(np, "atmel,matrix");
+	if (IS_ERR(matrix)) {
+		dev_err(dev, "missing atmel,matrix\n");
+		return PTR_ERR(matrix);
+	}
+
+	for (i = 0; i < n; i += 3) {
+		u32 slave, master, prio;
+		unsigned reg;
+
+		of_property_read_u32_index(np, "atmel,matrix-priorities", i,
+					   &slave);
+		of_property_read_u32_index(np, "atmel,matrix-priorities", i + 1,
+					   &master);
+		of_property_read_u32_index(np, "atmel,matrix-priorities", i + 2,
+					   &prio);
+		if (slave > 15 || master > 15 || prio > 3)
+			return -EINVAL;
+
+		/* same layout in all the matrices with priority registers */
+		reg = master < 8 ?
+		      AT91_MATRIX_PRAS(SAMA5D3_MATRIX_PRS, slave) :
+		      AT91_MATRIX_PRBS(SAMA5D3_MATRIX_PRS, slave);
+		ret = regmap_update_bits(matrix, reg,
+					 AT91_MATRIX_MPR(master % 8),
+					 prio << ((master % 8) * 4));
+		if (ret)
+			return ret;
+
+		ret = regmap_update_bits(matrix,
+					 AT91_MATRIX_SCFG(SAMA5D3_MATRIX_SCFG,
+							  slave),
+					 AT91_MATRIX_ARBT,
+					 AT91_MATRIX_ARBT_FIXED_PRIORITY);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int at91_ramc_arbiter_probe(struct platform_device *pdev)
+{
+	struct at91_ramc *ramc;
+	struct resource *res;
+	int ret;
+
+	ramc = devm_kzalloc(&pdev->dev, sizeof(*ramc), GFP_KERNEL);
+	if (!ramc)
+		return -ENOMEM;
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	ramc->base = devm_ioremap_resource(&pdev->dev, res);
+	if (IS_ERR(ramc->base))
+		return PTR_ERR(ramc->base);
+
+	ramc->dev = &pdev->dev;
+	spin_lock_init(&ramc->lock);
+	platform_set_drvdata(pdev, ramc);
+
+	ret = at91_ramc_of_arbiter(ramc, pdev->dev.of_node);
+	if (ret)
+		return ret;
+
+	ret = sysfs_create_group(&pdev->dev.kobj, &at91_ramc_attr_group);
+	if (ret)
+		return ret;
+
+	ret = at91_ramc_pmu_init(ramc);
+	if (ret)
+		dev_warn(&pdev->dev, "failed to register the PMU: %d\n", ret);
+
+	return 0;
+}
+
 static int atmel_ramc_probe(struct platform_device *pdev)
 {
 	const struct of_device_id *match;
 	const struct at91_ramc_caps *caps;
 	struct clk *clk;
+	int ret;
 
 	match = of_match_device(atmel_ramc_of_match, &pdev->dev);
 	caps = match->data;
@@ -75,6 +563,13 @@ static int atmel_ramc_probe(struct platform_device *pdev)
 		clk_prepare_enable(clk);
 	}
 
+	ret = at91_ramc_of_matrix(&pdev->dev, pdev->dev.of_node);
+	if (ret)
+		return ret;
+
+	if (caps->has_arbiter)
+		return at91_ramc_arbiter_probe(pdev);
+
 	return 0;
 }
 
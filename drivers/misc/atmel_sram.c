@@ -0,0 +1,200 @@
+/*
+ * On-chip SRAM carve-outs for the AT91 drivers
+ *
+ * The internal SRAM is registered as a genalloc pool by the mmio-sram
+ * driver. Besides the suspend code, small structures the DMA controllers
+ * or the CPU go through on every operation (DMA descriptors, crypto bounce
+ * buffers, ECC tables) are faster there than in DDR, where each access can
+ * wait behind a refresh or a page miss.
+ *
+ * A driver opts in from the device tree with an "atmel,sram" phandle to the
+ * SRAM node and gets a quota of the SRAM as a pool of its own, so that no
+ * user can starve the others. The quota is the "atmel,sram-size" property
+ * of the device node, or the size the driver asks for by default.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/atmel-sram.h>
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/slab.h>
+
+#define ATMEL_SRAM_GRANULARITY	32
+/* Allocations from a quota are 64-bit aligned, as XDMAC descriptors */
+#define ATMEL_SRAM_MIN_ORDER	3
+
+struct atmel_sram_quota {
+	struct gen_pool		*parent;
+	struct gen_pool		*pool;
+	unsigned long		vaddr;
+	size_t			size;
+};
+
+struct atmel_sram_buf {
+	struct gen_pool		*pool;
+	unsigned long		vaddr;
+	size_t			size;
+};
+
+/**
+ * atmel_sram_get_pool - get the pool of the SoC SRAM
+ *
+ * Return: the pool of the first SRAM registered by the mmio-sram driver, the
+ * secure RAM aside, or NULL if there is none.
+ */
+struct gen_pool *atmel_sram_get_pool(void)
+{
+	struct platform_device *pdev = NULL;
+	struct device_node *node;
+	struct gen_pool *pool;
+
+	for_each_compatible_node(node, NULL, "mmio-sram") {
+		/* The secure RAM is kept for the backup mode hand-off */
+		if (of_device_is_compatible(node, "atmel,sama5d2-securam"))
+			continue;
+
+		pdev = of_find_device_by_node(node);
+		if (pdev) {
+			of_node_put(node);
+			break;
+		}
+	}
+
+	if (!pdev)
+		return NULL;
+
+	pool = dev_get_gen_pool(&pdev->dev);
+	put_device(&pdev->dev);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(atmel_sram_get_pool);
+
+static void atmel_sram_release(struct device *dev, void *res)
+{
+	struct atmel_sram_quota *quota = res;
+
+	gen_pool_destroy(quota->pool);
+	gen_pool_free(quota->parent, quota->vaddr, quota->size);
+}
+
+/**
+ * devm_atmel_sram_pool - get an SRAM quota for a device
+ * @dev: device using the SRAM
+ * @size: default size of the quota
+ *
+ * The memory handed out by the pool is mapped write-combined and doesn't
+ * need any cache maintenance: gen_pool_dma_alloc() gives its bus address.
+ * The quota goes back to the SRAM when @dev is unbound.
+ *
+ * Return: the pool, or NULL if @dev doesn't use the SRAM or if there is not
+ * enough SRAM left. Drivers are expected to fall back to DDR then.
+ */
+struct gen_pool *devm_atmel_sram_pool(struct device *dev, size_t size)
+{
+	struct atmel_sram_quota *quota;
+	struct gen_pool *parent;
+	phys_addr_t phys;
+	u32 val;
+	int ret;
+
+	if (!dev->of_node)
+		return NULL;
+
+	parent = of_get_named_gen_pool(dev->of_node, "atmel,sram", 0);
+	if (!parent)
+		return NULL;
+
+	if (!of_property_read_u32(dev->of_node, "atmel,sram-size", &val))
+		size = val;
+	size = ALIGN(size, ATMEL_SRAM_GRANULARITY);
+	if (!size)
+		return NULL;
+
+	quota = devres_alloc(atmel_sram_release, sizeof(*quota), GFP_KERNEL);
+	if (!quota)
+		return NULL;
+
+	quota->parent = parent;
+	quota->size = size;
+	quota->vaddr = gen_pool_alloc(parent, size);
+	if (!quota->vaddr) {
+		dev_warn(dev, "no room for %zu bytes of SRAM\n", size);
+		goto err_free_res;
+	}
+
+	quota->pool = gen_pool_create(ATMEL_SRAM_MIN_ORDER, -1);
+	if (!quota->pool)
+		goto err_free_sram;
+
+	phys = gen_pool_virt_to_phys(parent, quota->vaddr);
+	ret = gen_pool_add_virt(quota->pool, quota->vaddr, phys, size, -1);
+	if (ret)
+		goto err_destroy_pool;
+
+	devres_add(dev, quota);
+	dev_dbg(dev, "%zu bytes of SRAM at %pa\n", size, &phys);
+
+	return quota->pool;
+
+err_destroy_pool:
+	gen_pool_destroy(quota->pool);
+err_free_sram:
+	gen_pool_free(parent, quota->vaddr, size);
+err_free_res:
+	devres_free(quota);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(devm_atmel_sram_pool);
+
+static void atmel_sram_buf_release(struct device *dev, void *res)
+{
+	struct atmel_sram_buf *buf = res;
+
+	gen_pool_free(buf->pool, buf->vaddr, buf->size);
+}
+
+/**
+ * devm_atmel_sram_alloc - allocate a buffer from an SRAM quota
+ * @dev: device owning the quota
+ * @pool: quota returned by devm_atmel_sram_pool()
+ * @size: size of the buffer
+ * @dma: bus address of the buffer, may be NULL
+ *
+ * The buffer is freed when @dev is unbound, before the quota goes back to
+ * the SRAM. Buffers allocated and freed at run time can use gen_pool_alloc()
+ * and gen_pool_free() on @pool instead, as long as they are all freed
+ * before @dev is unbound.
+ *
+ * Return: the buffer, or NULL if the quota is exhausted.
+ */
+void *devm_atmel_sram_alloc(struct device *dev, struct gen_pool *pool,
+			    size_t size, dma_addr_t *dma)
+{
+	struct atmel_sram_buf *buf;
+
+	buf = devres_alloc(atmel_sram_buf_release, sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return NULL;
+
+	buf->pool = pool;
+	buf->size = size;
+	buf->vaddr = gen_pool_alloc(pool, size);
+	if (!buf->vaddr) {
+		devres_free(buf);
+		return NULL;
+	}
+
+	if (dma)
+		*dma = gen_pool_virt_to_phys(pool, buf->vaddr);
+
+	devres_add(dev, buf);
+
+	return (void *)buf->vaddr;
+}
+EXPORT_SYMBOL_GPL(devm_atmel_sram_alloc);
@@ -0,0 +1,703 @@
+/*
+ * Atmel SSC streaming, raw synchronous serial data from a character device
+ *
+ * The SSC receiver and transmitter are set up from the device tree for a
+ * fixed framing, and each direction runs a cyclic DMA transfer between its
+ * data register and a ring buffer.  The CPU only handles one interrupt per
+ * period of a ring, whatever the bit rate.
+ *
+ * read() and write() copy out of and into the rings.  Both rings can also
+ * be mapped, the SSC_STREAM_IOC_STATUS ioctl then gives the DMA positions.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/atmel-ssc.h>
+#include <linux/atomic.h>
+#include <linux/clk.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include <linux/atmel_ssc_stream.h>
+
+#define SSC_STREAM_PERIODS	8
+
+/* Clock selection, the divided clock or the RK/TK pin of the direction */
+#define SSC_CKS_DIV		0
+#define SSC_CKS_PIN		2
+#define SSC_CKO_CONTINUOUS	1
+
+static unsigned int ring_size = 256 * 1024;
+module_param(ring_size, uint, S_IRUGO);
+MODULE_PARM_DESC(ring_size, "bytes in each ring buffer, a power of 2 (default 256 KiB)");
+
+/**
+ * struct ssc_stream_ring - one direction of the stream
+ * @dma:	channel between the SSC data register and @buf
+ * @cookie:	cookie of the cyclic transfer
+ * @buf:	ring buffer
+ * @phys:	DMA address of @buf
+ * @periods:	periods completed by the DMA since open
+ * @pos:	position of read() or write() in the stream
+ * @xruns:	overruns or underruns seen by read() or write()
+ * @wait:	waiting for a period to complete
+ * @running:	the direction is streaming
+ */
+struct ssc_stream_ring {
+	struct dma_chan		*dma;
+	dma_cookie_t		cookie;
+	void			*buf;
+	dma_addr_t		phys;
+	atomic64_t		periods;
+	u64			pos;
+	u32			xruns;
+	wait_queue_head_t	wait;
+	bool			running;
+};
+
+/**
+ * struct ssc_stream - SSC in streaming mode
+ * @ssc:	SSC instance, from ssc_request()
+ * @rx:		receive direction
+ * @tx:		transmit direction
+ * @size:	bytes in each ring
+ * @period:	bytes in each period of a ring
+ * @width:	bytes per data word in the rings
+ * @cmr:	clock mode register, 0 for an external clock
+ * @rcmr:	receive clock mode register
+ * @rfmr:	receive frame mode register
+ * @tcmr:	transmit clock mode register
+ * @tfmr:	transmit frame mode register
+ * @busy:	the device is open, it has a single user
+ * @lock:	serializes read(), write() and ioctl()
+ * @misc:	character device
+ */
+struct ssc_stream {
+	struct ssc_device	*ssc;
+	struct ssc_stream_ring	rx;
+	struct ssc_stream_ring	tx;
+	u32			size;
+	u32			period;
+	u32			width;
+	u32			cmr;
+	u32			rcmr;
+	u32			rfmr;
+	u32			tcmr;
+	u32			tfmr;
+	unsigned long		busy;
+	struct mutex		lock;
+	struct miscdevice	misc;
+};
+
+/*
+ * Position in the stream of the next byte the DMA controller transfers.
+ * The period count may lag behind the residue, for callbacks not run yet,
+ * so only the periods of the last ring lap are taken from the residue.
+ */
+static u64 ssc_stream_dma_pos(struct ssc_stream *st, struct ssc_stream_ring *r)
+{
+	u64 base = atomic64_read(&r->periods) * st->period;
+	u32 base_off = ((u32)base) & (st->size - 1);
+	struct dma_tx_state state;
+	u32 off;
+
+	dmaengine_tx_status(r->dma, r->cookie, &state);
+	off = (st->size - state.residue) & (st->size - 1);
+
+	return base + ((off - base_off) & (st->size - 1));
+}
+
+static void ssc_stream_period(void *data)
+{
+	struct ssc_stream_ring *r = data;
+
+	atomic64_inc(&r->periods);
+	wake_up_interruptible(&r->wait);
+}
+
+static int ssc_stream_ring_start(struct ssc_stream *st,
+				 struct ssc_stream_ring *r,
+				 enum dma_transfer_direction dir)
+{
+	struct ssc_device *ssc = st->ssc;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config cfg = {
+		.direction = dir,
+		.src_addr = ssc->phybase + SSC_RHR,
+		.src_addr_width = st->width,
+		.src_maxburst = 1,
+		.dst_addr = ssc->phybase + SSC_THR,
+		.dst_addr_width = st->width,
+		.dst_maxburst = 1,
+	};
+	int ret;
+
+	ret = dmaengine_slave_config(r->dma, &cfg);
+	if (ret)
+		return ret;
+
+	desc = dmaengine_prep_dma_cyclic(r->dma, r->phys, st->size,
+					 st->period, dir, DMA_PREP_INTERRUPT);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = ssc_stream_period;
+	desc->callback_param = r;
+
+	atomic64_set(&r->periods, 0);
+	r->xruns = 0;
+
+	/* Sending starts from silence, write() lands a period ahead */
+	if (dir == DMA_MEM_TO_DEV) {
+		memset(r->buf, 0, st->size);
+		r->pos = st->period;
+	} else {
+		r->pos = 0;
+	}
+
+	r->cookie = dmaengine_submit(desc);
+	dma_async_issue_pending(r->dma);
+	r->running = true;
+
+	return 0;
+}
+
+static void ssc_stream_ring_stop(struct ssc_stream_ring *r)
+{
+	if (!r->running)
+		return;
+
+	dmaengine_terminate_all(r->dma);
+	r->running = false;
+}
+
+static int ssc_stream_start(struct ssc_stream *st, fmode_t mode)
+{
+	void __iomem *regs = st->ssc->regs;
+	u32 cr = 0;
+	int ret;
+
+	if (((mode & FMODE_READ) && !st->rx.dma) ||
+	    ((mode & FMODE_WRITE) && !st->tx.dma))
+		return -EINVAL;
+
+	ret = clk_enable(st->ssc->clk);
+	if (ret)
+		return ret;
+
+	ssc_writel(regs, CR, SSC_BIT(CR_SWRST));
+	ssc_writel(regs, IDR, -1);
+	ssc_writel(regs, CMR, st->cmr);
+	ssc_writel(regs, RCMR, st->rcmr);
+	ssc_writel(regs, RFMR, st->rfmr);
+	ssc_writel(regs, TCMR, st->tcmr);
+	ssc_writel(regs, TFMR, st->tfmr);
+
+	if (mode & FMODE_READ) {
+		ret = ssc_stream_ring_start(st, &st->rx, DMA_DEV_TO_MEM);
+		if (ret)
+			goto err;
+		cr |= SSC_BIT(CR_RXEN);
+	}
+
+	if (mode & FMODE_WRITE) {
+		ret = ssc_stream_ring_start(st, &st->tx, DMA_MEM_TO_DEV);
+		if (ret)
+			goto err;
+		cr |= SSC_BIT(CR_TXEN);
+	}
+
+	ssc_writel(regs, CR, cr);
+
+	return 0;
+
+err:
+	ssc_stream_ring_stop(&st->rx);
+	clk_disable(st->ssc->clk);
+	return ret;
+}
+
+static void ssc_stream_stop(struct ssc_stream *st)
+{
+	ssc_writel(st->ssc->regs, CR, SSC_BIT(CR_RXDIS) | SSC_BIT(CR_TXDIS));
+	ssc_stream_ring_stop(&st->rx);
+	ssc_stream_ring_stop(&st->tx);
+	clk_disable(st->ssc->clk);
+}
+
+static int ssc_stream_open(struct inode *inode, struct file *file)
+{
+	struct ssc_stream *st = container_of(file->private_data,
+					     struct ssc_stream, misc);
+	int ret;
+
+	if (test_and_set_bit(0, &st->busy))
+		return -EBUSY;
+
+	ret = ssc_stream_start(st, file->f_mode);
+	if (ret) {
+		clear_bit(0, &st->busy);
+		return ret;
+	}
+
+	file->private_data = st;
+
+	return nonseekable_open(inode, file);
+}
+
+static int ssc_stream_release(struct inode *inode, struct file *file)
+{
+	struct ssc_stream *st = file->private_data;
+
+	ssc_stream_stop(st);
+	clear_bit(0, &st->busy);
+
+	return 0;
+}
+
+/* Bytes received and not read yet */
+static u64 ssc_stream_rx_avail(struct ssc_stream *st)
+{
+	return ssc_stream_dma_pos(st, &st->rx) - st->rx.pos;
+}
+
+/*
+ * Copies the data received since the last read.  A reader slower than the
+ * ring skips to the oldest data not overwritten yet: the period the DMA is
+ * filling is left out of that.
+ */
+static ssize_t ssc_stream_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct ssc_stream *st = file->private_data;
+	struct ssc_stream_ring *r = &st->rx;
+	u32 off, n;
+	u64 avail;
+	ssize_t ret;
+
+	if (!r->running)
+		return -EBADF;
+
+	if (!count)
+		return 0;
+
+	mutex_lock(&st->lock);
+
+	while (!(avail = ssc_stream_rx_avail(st))) {
+		mutex_unlock(&st->lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(r->wait,
+					       ssc_stream_rx_avail(st));
+		if (ret)
+			return ret;
+
+		mutex_lock(&st->lock);
+	}
+
+	if (avail > st->size - st->period) {
+		r->pos += avail - (st->size - st->period);
+		avail = st->size - st->period;
+		r->xruns++;
+	}
+
+	/* up to the end of the ring, the next read gets the rest */
+	off = (u32)r->pos & (st->size - 1);
+	n = min_t(u64, avail, st->size - off);
+	n = min_t(size_t, n, count);
+
+	if (copy_to_user(buf, r->buf + off, n)) {
+		ret = -EFAULT;
+		goto unlock;
+	}
+
+	r->pos += n;
+	ret = n;
+
+unlock:
+	mutex_unlock(&st->lock);
+	return ret;
+}
+
+/*
+ * Room in the transmit ring, up to the position the DMA is reading.  A
+ * writer which fell behind the DMA restarts a period ahead of it, the ring
+ * having been sent again meanwhile.
+ */
+static u32 ssc_stream_tx_room(struct ssc_stream *st, bool resync)
+{
+	struct ssc_stream_ring *r = &st->tx;
+	u64 head = ssc_stream_dma_pos(st, r);
+
+	if ((s64)(r->pos - head) < 0) {
+		if (!resync)
+			return st->size;
+		r->pos = head + st->period;
+		r->xruns++;
+	}
+
+	return st->size - (u32)(r->pos - head);
+}
+
+static ssize_t ssc_stream_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct ssc_stream *st = file->private_data;
+	struct ssc_stream_ring *r = &st->tx;
+	u32 off, n;
+	ssize_t ret;
+
+	if (!r->running)
+		return -EBADF;
+
+	if (!count)
+		return 0;
+
+	mutex_lock(&st->lock);
+
+	while (!(n = ssc_stream_tx_room(st, true))) {
+		mutex_unlock(&st->lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(r->wait,
+					       ssc_stream_tx_room(st, false));
+		if (ret)
+			return ret;
+
+		mutex_lock(&st->lock);
+	}
+
+	off = (u32)r->pos & (st->size - 1);
+	n = min_t(u32, n, st->size - off);
+	n = min_t(size_t, n, count);
+
+	if (copy_from_user(r->buf + off, buf, n)) {
+		ret = -EFAULT;
+		goto unlock;
+	}
+
+	r->pos += n;
+	ret = n;
+
+unlock:
+	mutex_unlock(&st->lock);
+	return ret;
+}
+
+static unsigned int ssc_stream_poll(struct file *file,
+				    struct poll_table_struct *wait)
+{
+	struct ssc_stream *st = file->private_data;
+	unsigned int mask = 0;
+
+	if (st->rx.running) {
+		poll_wait(file, &st->rx.wait, wait);
+		if (ssc_stream_rx_avail(st))
+			mask |= POLLIN | POLLRDNORM;
+	}
+
+	if (st->tx.running) {
+		poll_wait(file, &st->tx.wait, wait);
+		if (ssc_stream_tx_room(st, false))
+			mask |= POLLOUT | POLLWRNORM;
+	}
+
+	return mask;
+}
+
+static long ssc_stream_ioctl(struct file *file, unsigned int cmd,
+			     unsigned long arg)
+{
+	struct ssc_stream *st = file->private_data;
+	struct ssc_stream_status status = { .ring_size = st->size };
+
+	if (cmd != SSC_STREAM_IOC_STATUS)
+		return -ENOTTY;
+
+	mutex_lock(&st->lock);
+	if (st->rx.running) {
+		status.rx_pos = ssc_stream_dma_pos(st, &st->rx);
+		status.rx_overruns = st->rx.xruns;
+	}
+	if (st->tx.running) {
+		status.tx_pos = ssc_stream_dma_pos(st, &st->tx);
+		status.tx_underruns = st->tx.xruns;
+	}
+	mutex_unlock(&st->lock);
+
+	if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* The receive ring is at offset 0, the transmit ring follows it */
+static int ssc_stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ssc_stream *st = file->private_data;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	struct ssc_stream_ring *r;
+
+	if (vma->vm_end - vma->vm_start != st->size)
+		return -EINVAL;
+
+	if (off == 0)
+		r = &st->rx;
+	else if (off == st->size)
+		r = &st->tx;
+	else
+		return -EINVAL;
+
+	if (!r->running)
+		return -EINVAL;
+
+	vma->vm_pgoff = 0;
+
+	return dma_mmap_coherent(r->dma->device->dev, vma, r->buf, r->phys,
+				 st->size);
+}
+
+static const struct file_operations ssc_stream_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ssc_stream_open,
+	.release	= ssc_stream_release,
+	.read		= ssc_stream_read,
+	.write		= ssc_stream_write,
+	.poll		= ssc_stream_poll,
+	.unlocked_ioctl	= ssc_stream_ioctl,
+	.compat_ioctl	= ssc_stream_ioctl,
+	.mmap		= ssc_stream_mmap,
+	.llseek		= no_llseek,
+};
+
+/*
+ * Framing, the same for both directions:
+ *   atmel,data-bits	bits per data word, 2 to 32 (default 32)
+ *   atmel,frame-words	data words per frame, 1 to 16 (default 1)
+ *   atmel,start	START field of RCMR and TCMR, the condition that
+ *			starts a frame (default 0, continuous)
+ *   atmel,lsb-first	shift data out and in LSB first
+ *   clock-frequency	bit clock generated from the divided peripheral
+ *			clock on RK and TK, else it is taken from those pins
+ */
+static int ssc_stream_parse_dt(struct ssc_stream *st, struct device_node *np)
+{
+	u32 bits = 32, words = 1, start = 0, freq = 0;
+	u32 cks = SSC_CKS_PIN, cko = 0;
+	u32 fmr;
+
+	of_property_read_u32(np, "atmel,data-bits", &bits);
+	of_property_read_u32(np, "atmel,frame-words", &words);
+	of_property_read_u32(np, "atmel,start", &start);
+	of_property_read_u32(np, "clock-frequency", &freq);
+
+	if (bits < 2 || bits > 32 || !words || words > 16 || start > 8)
+		return -EINVAL;
+
+	st->width = bits > 16 ? 4 : bits > 8 ? 2 : 1;
+
+	if (freq) {
+		unsigned long rate = clk_get_rate(st->ssc->clk);
+		u32 div = DIV_ROUND_UP(rate, 2 * freq);
+
+		if (!div || div >= 1 << SSC_CMR_DIV_SIZE)
+			return -EINVAL;
+
+		st->cmr = SSC_BF(CMR_DIV, div);
+		cks = SSC_CKS_DIV;
+		cko = SSC_CKO_CONTINUOUS;
+	}
+
+	/* sampled on the rising edge, shifted out on the falling one */
+	st->rcmr = SSC_BF(RCMR_CKS, cks) | SSC_BF(RCMR_CKO, cko) |
+		   SSC_BF(RCMR_CKI, 1) | SSC_BF(RCMR_START, start);
+	st->tcmr = SSC_BF(TCMR_CKS, cks) | SSC_BF(TCMR_CKO, cko) |
+		   SSC_BF(TCMR_START, start);
+
+	fmr = SSC_BF(RFMR_DATLEN, bits - 1) | SSC_BF(RFMR_DATNB, words - 1);
+	if (!of_property_read_bool(np, "atmel,lsb-first"))
+		fmr |= SSC_BIT(RFMR_MSBF);
+
+	/* DATLEN, DATNB and MSBF have the same layout in both */
+	st->rfmr = fmr;
+	st->tfmr = fmr;
+
+	return 0;
+}
+
+static int ssc_stream_ring_init(struct ssc_stream *st,
+				struct ssc_stream_ring *r, const char *name)
+{
+	struct device *dev = &st->ssc->pdev->dev;
+
+	init_waitqueue_head(&r->wait);
+
+	r->dma = dma_request_slave_channel_reason(dev, name);
+	if (IS_ERR(r->dma)) {
+		int ret = PTR_ERR(r->dma);
+
+		r->dma = NULL;
+		return ret;
+	}
+
+	r->buf = dma_alloc_coherent(r->dma->device->dev, st->size, &r->phys,
+				    GFP_KERNEL);
+	if (!r->buf) {
+		dma_release_channel(r->dma);
+		r->dma = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void ssc_stream_ring_free(struct ssc_stream *st,
+				 struct ssc_stream_ring *r)
+{
+	if (!r->dma)
+		return;
+
+	dma_free_coherent(r->dma->device->dev, st->size, r->buf, r->phys);
+	dma_release_channel(r->dma);
+}
+
+static int ssc_stream_probe(struct platform_device *pdev)
+{
+	struct device_node *np = pdev->dev.of_node;
+	struct device_node *ssc_np;
+	struct ssc_stream *st;
+	int id, ret, rx_ret;
+
+	ssc_np = of_parse_phandle(np, "atmel,ssc", 0);
+	if (!ssc_np) {
+		dev_err(&pdev->dev, "missing atmel,ssc\n");
+		return -EINVAL;
+	}
+	id = of_alias_get_id(ssc_np, "ssc");
+	of_node_put(ssc_np);
+	if (id < 0) {
+		dev_err(&pdev->dev, "no ssc alias for atmel,ssc\n");
+		return id;
+	}
+
+	if (!is_power_of_2(ring_size) || ring_size < PAGE_SIZE ||
+	    ring_size < SSC_STREAM_PERIODS * sizeof(u32))
+		return -EINVAL;
+
+	st = devm_kzalloc(&pdev->dev, sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+
+	st->size = ring_size;
+	st->period = ring_size / SSC_STREAM_PERIODS;
+	mutex_init(&st->lock);
+
+	/* The SSC itself may not be probed yet */
+	st->ssc = ssc_request(id);
+	if (IS_ERR(st->ssc))
+		return PTR_ERR(st->ssc) == -ENODEV ? -EPROBE_DEFER :
+		       PTR_ERR(st->ssc);
+
+	/* PDC-only SSCs would need their own ring handling */
+	if (!st->ssc->pdata->use_dma) {
+		dev_err(&pdev->dev, "ssc%d has no DMA controller channels\n",
+			id);
+		ret = -ENODEV;
+		goto ssc_free;
+	}
+
+	ret = ssc_stream_parse_dt(st, np);
+	if (ret) {
+		dev_err(&pdev->dev, "invalid framing\n");
+		goto ssc_free;
+	}
+
+	/* Either direction may be left without a channel, not both */
+	rx_ret = ssc_stream_ring_init(st, &st->rx, "rx");
+	if (rx_ret == -EPROBE_DEFER) {
+		ret = rx_ret;
+		goto ssc_free;
+	}
+
+	ret = ssc_stream_ring_init(st, &st->tx, "tx");
+	if (ret == -EPROBE_DEFER || (ret && rx_ret))
+		goto rx_free;
+
+	platform_set_drvdata(pdev, st);
+
+	st->misc.minor = MISC_DYNAMIC_MINOR;
+	st->misc.name = devm_kasprintf(&pdev->dev, GFP_KERNEL,
+				       "ssc%d-stream", id);
+	st->misc.fops = &ssc_stream_fops;
+	st->misc.parent = &pdev->dev;
+	if (!st->misc.name) {
+		ret = -ENOMEM;
+		goto tx_free;
+	}
+
+	ret = misc_register(&st->misc);
+	if (ret)
+		goto tx_free;
+
+	return 0;
+
+tx_free:
+	ssc_stream_ring_free(st, &st->tx);
+rx_free:
+	ssc_stream_ring_free(st, &st->rx);
+ssc_free:
+	ssc_free(st->ssc);
+	return ret;
+}
+
+static int ssc_stream_remove(struct platform_device *pdev)
+{
+	struct ssc_stream *st = platform_get_drvdata(pdev);
+
+	misc_deregister(&st->misc);
+	ssc_stream_ring_free(st, &st->tx);
+	ssc_stream_ring_free(st, &st->rx);
+	ssc_free(st->ssc);
+
+	return 0;
+}
+
+static const struct of_device_id ssc_stream_dt_ids[] = {
+	{ .compatible = "atmel,ssc-stream", },
+	{ /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, ssc_stream_dt_ids);
+
+static struct platform_driver ssc_stream_driver = {
+	.probe = ssc_stream_probe,
+	.remove = ssc_stream_remove,
+	.driver = {
+		.name = "atmel-ssc-stream",
+		.of_match_table = ssc_stream_dt_ids,
+	},
+};
+module_platform_driver(ssc_stream_driver);
+
+MODULE_DESCRIPTION("Atmel SSC synchronous serial streaming");
+MODULE_LICENSE("GPL v2");
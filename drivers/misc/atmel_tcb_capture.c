@@ -0,0 +1,404 @@
+/*
+ * Atmel Timer Counter Block capture, timestamping external edges
+ *
+ * A TC channel runs in capture mode from its fastest clock and loads RA
+ * and RB, alternately, on each selected edge of its TIOA input.  The TC
+ * raises a DMA request each time, which copies the counter value, read
+ * through RAB in load order, into a ring buffer.  The CPU only handles
+ * one interrupt per quarter of the ring, whatever the event rate.
+ *
+ * The timestamps are read as native u32 counter values from a character
+ * device; their rate in Hz is in the "rate" attribute.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/atmel_tc.h>
+#include <linux/clk.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#define ATMEL_TCB_CAPTURE_PERIODS	4
+
+static unsigned int ring_size = 4096;
+module_param(ring_size, uint, S_IRUGO);
+MODULE_PARM_DESC(ring_size, "timestamps in the ring buffer (default 4096)");
+
+/**
+ * struct atmel_tcb_capture - TC channel timestamping TIOA edges
+ * @tc:		Timer Counter Block, from atmel_tc_alloc()
+ * @channel:	channel of @tc in capture mode
+ * @edges:	ATMEL_TC_LDRA_* edge selection
+ * @dma:	channel reading RAB into @ring
+ * @cookie:	cookie of the cyclic transfer
+ * @ring:	ring buffer of @size timestamps
+ * @ring_phys:	DMA address of @ring
+ * @size:	number of timestamps in @ring
+ * @tail:	index of the next timestamp to read
+ * @wait:	readers waiting for new timestamps
+ * @busy:	the device is open, it has a single reader
+ * @lock:	serializes readers
+ * @misc:	character device
+ */
+struct atmel_tcb_capture {
+	struct atmel_tc		*tc;
+	unsigned		channel;
+	u32			edges;
+	struct dma_chan		*dma;
+	dma_cookie_t		cookie;
+	u32			*ring;
+	dma_addr_t		ring_phys;
+	unsigned		size;
+	unsigned		tail;
+	wait_queue_head_t	wait;
+	unsigned long		busy;
+	struct mutex		lock;
+	struct miscdevice	misc;
+};
+
+static void atmel_tcb_capture_writel(struct atmel_tcb_capture *cap,
+				     unsigned reg, u32 val)
+{
+	__raw_writel(val, cap->tc->regs + ATMEL_TC_CHAN(cap->channel) + reg);
+}
+
+/* Index in @ring of the next timestamp the DMA controller will write */
+static unsigned atmel_tcb_capture_head(struct atmel_tcb_capture *cap)
+{
+	struct dma_tx_state state;
+	unsigned head;
+
+	dmaengine_tx_status(cap->dma, cap->cookie, &state);
+	head = cap->size - state.residue / sizeof(u32);
+
+	return head == cap->size ? 0 : head;
+}
+
+static void atmel_tcb_capture_period(void *data)
+{
+	struct atmel_tcb_capture *cap = data;
+
+	wake_up_interruptible(&cap->wait);
+}
+
+static int atmel_tcb_capture_start(struct atmel_tcb_capture *cap)
+{
+	struct atmel_tc *tc = cap->tc;
+	struct resource *res = platform_get_resource(tc->pdev,
+						     IORESOURCE_MEM, 0);
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config cfg = {
+		.direction = DMA_DEV_TO_MEM,
+		.src_addr = res->start + ATMEL_TC_CHAN(cap->channel) +
+			    ATMEL_TC_RAB,
+		.src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.src_maxburst = 1,
+	};
+	size_t len = cap->size * sizeof(u32);
+	int ret;
+
+	ret = dmaengine_slave_config(cap->dma, &cfg);
+	if (ret)
+		return ret;
+
+	desc = dmaengine_prep_dma_cyclic(cap->dma, cap->ring_phys, len,
+					 len / ATMEL_TCB_CAPTURE_PERIODS,
+					 DMA_DEV_TO_MEM, DMA_PREP_INTERRUPT);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = atmel_tcb_capture_period;
+	desc->callback_param = cap;
+
+	ret = clk_enable(tc->clk[cap->channel]);
+	if (ret)
+		return ret;
+
+	cap->cookie = dmaengine_submit(desc);
+	dma_async_issue_pending(cap->dma);
+	cap->tail = 0;
+
+	/*
+	 * Free running counter, RA and RB loaded on the same edges: the TC
+	 * alternates between them, and RAB returns them in order.
+	 */
+	atmel_tcb_capture_writel(cap, ATMEL_TC_IDR, ATMEL_TC_ALL_IRQ);
+	atmel_tcb_capture_writel(cap, ATMEL_TC_CMR, ATMEL_TC_TIMER_CLOCK1 |
+				 cap->edges | (cap->edges << 2));
+	atmel_tcb_capture_writel(cap, ATMEL_TC_CCR,
+				 ATMEL_TC_CLKEN | ATMEL_TC_SWTRG);
+
+	return 0;
+}
+
+static void atmel_tcb_capture_stop(struct atmel_tcb_capture *cap)
+{
+	atmel_tcb_capture_writel(cap, ATMEL_TC_CCR, ATMEL_TC_CLKDIS);
+	dmaengine_terminate_all(cap->dma);
+	clk_disable(cap->tc->clk[cap->channel]);
+}
+
+static int atmel_tcb_capture_open(struct inode *inode, struct file *file)
+{
+	struct atmel_tcb_capture *cap = container_of(file->private_data,
+						     struct atmel_tcb_capture,
+						     misc);
+	int ret;
+
+	if (test_and_set_bit(0, &cap->busy))
+		return -EBUSY;
+
+	ret = atmel_tcb_capture_start(cap);
+	if (ret) {
+		clear_bit(0, &cap->busy);
+		return ret;
+	}
+
+	file->private_data = cap;
+
+	return nonseekable_open(inode, file);
+}
+
+static int atmel_tcb_capture_release(struct inode *inode, struct file *file)
+{
+	struct atmel_tcb_capture *cap = file->private_data;
+
+	atmel_tcb_capture_stop(cap);
+	clear_bit(0, &cap->busy);
+
+	return 0;
+}
+
+/*
+ * Copies the timestamps captured since the last read.  A reader slower
+ * than the ring loses a whole ring of them, unnoticed.
+ */
+static ssize_t atmel_tcb_capture_read(struct file *file, char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	struct atmel_tcb_capture *cap = file->private_data;
+	unsigned head, n;
+	ssize_t ret;
+
+	count /= sizeof(u32);
+	if (!count)
+		return -EINVAL;
+
+	mutex_lock(&cap->lock);
+
+	while ((head = atmel_tcb_capture_head(cap)) == cap->tail) {
+		mutex_unlock(&cap->lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(cap->wait,
+				atmel_tcb_capture_head(cap) != cap->tail);
+		if (ret)
+			return ret;
+
+		mutex_lock(&cap->lock);
+	}
+
+	/* up to the end of the ring, the next read gets the rest */
+	n = head > cap->tail ? head - cap->tail : cap->size - cap->tail;
+	n = min_t(unsigned, n, count);
+
+	if (copy_to_user(buf, cap->ring + cap->tail, n * sizeof(u32))) {
+		ret = -EFAULT;
+		goto unlock;
+	}
+
+	cap->tail = (cap->tail + n) % cap->size;
+	ret = n * sizeof(u32);
+
+unlock:
+	mutex_unlock(&cap->lock);
+	return ret;
+}
+
+static unsigned int atmel_tcb_capture_poll(struct file *file,
+					   struct poll_table_struct *wait)
+{
+	struct atmel_tcb_capture *cap = file->private_data;
+
+	poll_wait(file, &cap->wait, wait);
+
+	return atmel_tcb_capture_head(cap) != cap->tail ?
+		POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations atmel_tcb_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= atmel_tcb_capture_open,
+	.release	= atmel_tcb_capture_release,
+	.read		= atmel_tcb_capture_read,
+	.poll		= atmel_tcb_capture_poll,
+	.llseek		= no_llseek,
+};
+
+static ssize_t rate_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct atmel_tcb_capture *cap = dev_get_drvdata(dev);
+	unsigned long rate = clk_get_rate(cap->tc->clk[cap->channel]);
+
+	return sprintf(buf, "%lu\n", rate / atmel_tc_divisors[0]);
+}
+static DEVICE_ATTR_RO(rate);
+
+static struct attribute *atmel_tcb_capture_attrs[] = {
+	&dev_attr_rate.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(atmel_tcb_capture);
+
+static int atmel_tcb_capture_probe(struct platform_device *pdev)
+{
+	struct device_node *np = pdev->dev.of_node;
+	struct atmel_tcb_capture *cap;
+	u32 tcblock, channel, edges = 1;
+	int ret;
+
+	ret = of_property_read_u32(np, "tc-block", &tcblock);
+	if (ret) {
+		dev_err(&pdev->dev, "missing Timer Counter Block number\n");
+		return ret;
+	}
+
+	ret = of_property_read_u32(np, "tc-channel", &channel);
+	if (ret || channel > 2) {
+		dev_err(&pdev->dev, "invalid or missing tc-channel\n");
+		return -EINVAL;
+	}
+
+	/* 1: rising, 2: falling, 3: both edges */
+	of_property_read_u32(np, "atmel,capture-edges", &edges);
+	if (!edges || edges > 3) {
+		dev_err(&pdev->dev, "invalid atmel,capture-edges\n");
+		return -EINVAL;
+	}
+
+	if (ring_size < ATMEL_TCB_CAPTURE_PERIODS ||
+	    ring_size % ATMEL_TCB_CAPTURE_PERIODS)
+		return -EINVAL;
+
+	cap = devm_kzalloc(&pdev->dev, sizeof(*cap), GFP_KERNEL);
+	if (!cap)
+		return -ENOMEM;
+
+	cap->channel = channel;
+	cap->edges = edges << 16;
+	cap->size = ring_size;
+	init_waitqueue_head(&cap->wait);
+	mutex_init(&cap->lock);
+
+	cap->dma = dma_request_slave_channel_reason(&pdev->dev, "rx");
+	if (IS_ERR(cap->dma))
+		return PTR_ERR(cap->dma);
+
+	cap->ring = dma_alloc_coherent(cap->dma->device->dev,
+				       cap->size * sizeof(u32),
+				       &cap->ring_phys, GFP_KERNEL);
+	if (!cap->ring) {
+		ret = -ENOMEM;
+		goto dma_release;
+	}
+
+	cap->tc = atmel_tc_alloc(tcblock);
+	if (!cap->tc) {
+		dev_err(&pdev->dev, "failed to allocate Timer Counter Block\n");
+		ret = -EBUSY;
+		goto ring_free;
+	}
+
+	if (cap->tc->tcb_config->counter_width < 32) {
+		dev_err(&pdev->dev, "TC block has no RAB register\n");
+		ret = -ENODEV;
+		goto tc_free;
+	}
+
+	ret = clk_prepare(cap->tc->clk[channel]);
+	if (ret)
+		goto tc_free;
+
+	platform_set_drvdata(pdev, cap);
+
+	cap->misc.minor = MISC_DYNAMIC_MINOR;
+	cap->misc.name = devm_kasprintf(&pdev->dev, GFP_KERNEL,
+					"tcb%u-capture%u", tcblock, channel);
+	cap->misc.fops = &atmel_tcb_capture_fops;
+	cap->misc.parent = &pdev->dev;
+	cap->misc.groups = atmel_tcb_capture_groups;
+	if (!cap->misc.name) {
+		ret = -ENOMEM;
+		goto clk_unprepare;
+	}
+
+	ret = misc_register(&cap->misc);
+	if (ret)
+		goto clk_unprepare;
+
+	dev_set_drvdata(cap->misc.this_device, cap);
+
+	return 0;
+
+clk_unprepare:
+	clk_unprepare(cap->tc->clk[channel]);
+tc_free:
+	atmel_tc_free(cap->tc);
+ring_free:
+	dma_free_coherent(cap->dma->device->dev, cap->size * sizeof(u32),
+			  cap->ring, cap->ring_phys);
+dma_release:
+	dma_release_channel(cap->dma);
+	return ret;
+}
+
+static int atmel_tcb_capture_remove(struct platform_device *pdev)
+{
+	struct atmel_tcb_capture *cap = platform_get_drvdata(pdev);
+
+	misc_deregister(&cap->misc);
+	clk_unprepare(cap->tc->clk[cap->channel]);
+	atmel_tc_free(cap->tc);
+	dma_free_coherent(cap->dma->device->dev, cap->size * sizeof(u32),
+			  cap->ring, cap->ring_phys);
+	dma_release_channel(cap->dma);
+
+	return 0;
+}
+
+static const struct of_device_id atmel_tcb_capture_dt_ids[] = {
+	{ .compatible = "atmel,tcb-capture", },
+	{ /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, atmel_tcb_capture_dt_ids);
+
+static struct platform_driver atmel_tcb_capture_driver = {
+	.probe = atmel_tcb_capture_probe,
+	.remove = atmel_tcb_capture_remove,
+	.driver = {
+		.name = "atmel-tcb-capture",
+		.of_match_table = atmel_tcb_capture_dt_ids,
+	},
+};
+module_platform_driver(atmel_tcb_capture_driver);
+
+MODULE_DESCRIPTION("Atmel Timer Counter Block edge capture");
+MODULE_LICENSE("GPL v2");
@@ -12,6 +12,7 @@
 #include <linux/slab.h>
 #include <linux/module.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
 #include <linux/scatterlist.h>
@@ -22,34 +23,71 @@
 #include "queue.h"
 
 #define MMC_QUEUE_BOUNCESZ	65536
+#define MMC_QUEUE_DEPTH		64
 
-/*
- * Prepare a MMC request. This just filters out odd stuff.
+/* Next request handed over by mmc_queue_rq(), mq->lock held */
+static struct request *mmc_queue_fetch(struct mmc_queue *mq)
+{
+	struct request *req;
+
+	req = list_first_entry_or_null(&mq->pending, struct request, queuelist);
+	if (req)
+		list_del_init(&req->queuelist);
+
+	return req;
+}
+
+/**
+ * mmc_queue_fetch_request - take the next pending request
+ * @mq: MMC queue
+ *
+ * Used by the issue path to look ahead, when packing requests.
  */
-static int mmc_prep_request(struct request_queue *q, struct request *req)
+struct request *mmc_queue_fetch_request(struct mmc_queue *mq)
 {
-	struct mmc_queue *mq = q->queuedata;
+	struct request *req;
 
-	/*
-	 * We only like normal block requests and discards.
-	 */
-	if (req->cmd_type != REQ_TYPE_FS && !(req->cmd_flags & REQ_DISCARD)) {
-		blk_dump_rq_flags(req, "MMC bad request");
-		return BLKPREP_KILL;
-	}
+	spin_lock_irq(mq->lock);
+	req = mmc_queue_fetch(mq);
+	spin_unlock_irq(mq->lock);
 
-	if (mq && (mmc_card_removed(mq->card) || mmc_access_rpmb(mq)))
-		return BLKPREP_KILL;
+	return req;
+}
+
+/**
+ * mmc_queue_requeue - put a request back at the head of the queue
+ * @mq: MMC queue
+ * @req: request taken from @mq and not started on the card
+ */
+void mmc_queue_requeue(struct mmc_queue *mq, struct request *req)
+{
+	spin_lock_irq(mq->lock);
+	list_add(&req->queuelist, &mq->pending);
+	spin_unlock_irq(mq->lock);
+}
 
-	req->cmd_flags |= REQ_DONTPREP;
+/**
+ * mmc_queue_end_request - complete part of a request
+ * @req: request being completed
+ * @error: 0 for success, < 0 for error
+ * @nr_bytes: number of bytes to complete
+ *
+ * As blk_end_request(): returns %true while @req still has bytes to
+ * complete.
+ */
+bool mmc_queue_end_request(struct request *req, int error,
+			   unsigned int nr_bytes)
+{
+	if (blk_update_request(req, error, nr_bytes))
+		return true;
 
-	return BLKPREP_OK;
+	__blk_mq_end_request(req, error);
+	return false;
 }
 
 static int mmc_queue_thread(void *d)
 {
 	struct mmc_queue *mq = d;
-	struct request_queue *q = mq->queue;
 
 	current->flags |= PF_MEMALLOC;
 
@@ -59,11 +97,11 @@ static int mmc_queue_thread(void *d)
 		struct mmc_queue_req *tmp;
 		unsigned int cmd_flags = 0;
 
-		spin_lock_irq(q->queue_lock);
+		spin_lock_irq(mq->lock);
 		set_current_state(TASK_INTERRUPTIBLE);
-		req = blk_fetch_request(q);
+		req = mmc_queue_fetch(mq);
 		mq->mqrq_cur->req = req;
-		spin_unlock_irq(q->queue_lock);
+		spin_unlock_irq(mq->lock);
 
 		if (req || mq->mqrq_prev->req) {
 			set_current_state(TASK_RUNNING);
@@ -105,26 +143,38 @@ static int mmc_queue_thread(void *d)
 }
 
 /*
- * Generic MMC request handler.  This is called for any queue on a
- * particular host.  When the host is not busy, we look for a request
- * on any queue on this host, and attempt to issue it.  This may
- * not be the queue we were asked to process.
+ * blk-mq dispatch.  Issuing needs to sleep, for the host claim and the
+ * request completion, so requests are only filtered here and handed to
+ * the queue thread.  That thread still keeps one request prepared while
+ * the previous one is on the bus.
  */
-static void mmc_request_fn(struct request_queue *q)
+static int mmc_queue_rq(struct blk_mq_hw_ctx *hctx,
+			const struct blk_mq_queue_data *bd)
 {
-	struct mmc_queue *mq = q->queuedata;
-	struct request *req;
-	unsigned long flags;
+	struct mmc_queue *mq = hctx->queue->queuedata;
+	struct request *req = bd->rq;
 	struct mmc_context_info *cntx;
+	unsigned long flags;
 
-	if (!mq) {
-		while ((req = blk_fetch_request(q)) != NULL) {
-			req->cmd_flags |= REQ_QUIET;
-			__blk_end_request_all(req, -EIO);
-		}
-		return;
+	/*
+	 * We only like normal block requests and discards.
+	 */
+	if (req->cmd_type != REQ_TYPE_FS && !(req->cmd_flags & REQ_DISCARD)) {
+		blk_dump_rq_flags(req, "MMC bad request");
+		return BLK_MQ_RQ_QUEUE_ERROR;
 	}
 
+	spin_lock_irqsave(mq->lock, flags);
+
+	if (mq->dying || mmc_card_removed(mq->card) || mmc_access_rpmb(mq)) {
+		spin_unlock_irqrestore(mq->lock, flags);
+		req->cmd_flags |= REQ_QUIET;
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+
+	blk_mq_start_request(req);
+	list_add_tail(&req->queuelist, &mq->pending);
+
 	cntx = &mq->card->host->context_info;
 	if (!mq->mqrq_cur->req && mq->mqrq_prev->req) {
 		/*
@@ -132,16 +182,25 @@ static void mmc_request_fn(struct request_queue *q)
 		 * blocked on the previous request to be complete
 		 * with no current request fetched
 		 */
-		spin_lock_irqsave(&cntx->lock, flags);
+		spin_lock(&cntx->lock);
 		if (cntx->is_waiting_last_req) {
 			cntx->is_new_req = true;
 			wake_up_interruptible(&cntx->wait);
 		}
-		spin_unlock_irqrestore(&cntx->lock, flags);
+		spin_unlock(&cntx->lock);
 	} else if (!mq->mqrq_cur->req && !mq->mqrq_prev->req)
 		wake_up_process(mq->thread);
+
+	spin_unlock_irqrestore(mq->lock, flags);
+
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
+static struct blk_mq_ops mmc_mq_ops = {
+	.queue_rq	= mmc_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
 static struct scatterlist *mmc_alloc_sg(int sg_len, int *err)
 {
 	struct scatterlist *sg;
@@ -182,7 +241,7 @@ static void mmc_queue_setup_discard(struct request_queue *q,
  * mmc_init_queue - initialise a queue structure.
  * @mq: mmc queue
  * @card: mmc card to attach this queue
- * @lock: queue lock
+ * @lock: lock of the pending request list
  * @subname: partition subname
  *
  * Initialise a MMC card request queue.
@@ -200,15 +259,31 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 		limit = (u64)dma_max_pfn(mmc_dev(host)) << PAGE_SHIFT;
 
 	mq->card = card;
-	mq->queue = blk_init_queue(mmc_request_fn, lock);
-	if (!mq->queue)
-		return -ENOMEM;
+	mq->lock = lock;
+	mq->dying = false;
+	INIT_LIST_HEAD(&mq->pending);
+
+	memset(&mq->tag_set, 0, sizeof(mq->tag_set));
+	mq->tag_set.ops = &mmc_mq_ops;
+	mq->tag_set.nr_hw_queues = 1;
+	mq->tag_set.queue_depth = MMC_QUEUE_DEPTH;
+	mq->tag_set.numa_node = NUMA_NO_NODE;
+	mq->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_SG_MERGE;
+
+	ret = blk_mq_alloc_tag_set(&mq->tag_set);
+	if (ret)
+		return ret;
+
+	mq->queue = blk_mq_init_queue(&mq->tag_set);
+	if (IS_ERR(mq->queue)) {
+		ret = PTR_ERR(mq->queue);
+		goto free_tag_set;
+	}
 
 	mq->mqrq_cur = mqrq_cur;
 	mq->mqrq_prev = mqrq_prev;
 	mq->queue->queuedata = mq;
 
-	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
 	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, mq->queue);
 	if (mmc_can_erase(card))
@@ -317,12 +392,13 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mqrq_prev->bounce_buf = NULL;
 
 	blk_cleanup_queue(mq->queue);
+ free_tag_set:
+	blk_mq_free_tag_set(&mq->tag_set);
 	return ret;
 }
 
 void mmc_cleanup_queue(struct mmc_queue *mq)
 {
-	struct request_queue *q = mq->queue;
 	unsigned long flags;
 	struct mmc_queue_req *mqrq_cur = mq->mqrq_cur;
 	struct mmc_queue_req *mqrq_prev = mq->mqrq_prev;
@@ -330,14 +406,13 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	/* Make sure the queue isn't suspended, as that will deadlock */
 	mmc_queue_resume(mq);
 
-	/* Then terminate our worker thread */
-	kthread_stop(mq->thread);
+	/* Fail anything dispatched from now on, the thread may go away */
+	spin_lock_irqsave(mq->lock, flags);
+	mq->dying = true;
+	spin_unlock_irqrestore(mq->lock, flags);
 
-	/* Empty the queue */
-	spin_lock_irqsave(q->queue_lock, flags);
-	q->queuedata = NULL;
-	blk_start_queue(q);
-	spin_unlock_irqrestore(q->queue_lock, flags);
+	/* Then terminate our worker thread, once it emptied the queue */
+	kthread_stop(mq->thread);
 
 	kfree(mqrq_cur->bounce_sg);
 	mqrq_cur->bounce_sg = NULL;
@@ -415,14 +490,11 @@ void mmc_packed_clean(struct mmc_queue *mq)
 void mmc_queue_suspend(struct mmc_queue *mq)
 {
 	struct request_queue *q = mq->queue;
-	unsigned long flags;
 
 	if (!(mq->flags & MMC_QUEUE_SUSPENDED)) {
 		mq->flags |= MMC_QUEUE_SUSPENDED;
 
-		spin_lock_irqsave(q->queue_lock, flags);
-		blk_stop_queue(q);
-		spin_unlock_irqrestore(q->queue_lock, flags);
+		blk_mq_stop_hw_queues(q);
 
 		down(&mq->thread_sem);
 	}
@@ -435,16 +507,13 @@ void mmc_queue_suspend(struct mmc_queue *mq)
 void mmc_queue_resume(struct mmc_queue *mq)
 {
 	struct request_queue *q = mq->queue;
-	unsigned long flags;
 
 	if (mq->flags & MMC_QUEUE_SUSPENDED) {
 		mq->flags &= ~MMC_QUEUE_SUSPENDED;
 
 		up(&mq->thread_sem);
 
-		spin_lock_irqsave(q->queue_lock, flags);
-		blk_start_queue(q);
-		spin_unlock_irqrestore(q->queue_lock, flags);
+		blk_mq_start_stopped_hw_queues(q, true);
 	}
 }
 
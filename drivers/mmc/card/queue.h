@@ -3,6 +3,8 @@
 
 #define MMC_REQ_SPECIAL_MASK	(REQ_DISCARD | REQ_FLUSH)
 
+#include <linux/blk-mq.h>
+
 struct request;
 struct task_struct;
 
@@ -54,6 +56,10 @@ struct mmc_queue {
 	int			(*issue_fn)(struct mmc_queue *, struct request *);
 	void			*data;
 	struct request_queue	*queue;
+	struct blk_mq_tag_set	tag_set;
+	spinlock_t		*lock;		/* protects pending, dying */
+	struct list_head	pending;	/* dispatched, not fetched */
+	bool			dying;
 	struct mmc_queue_req	mqrq[2];
 	struct mmc_queue_req	*mqrq_cur;
 	struct mmc_queue_req	*mqrq_prev;
@@ -65,6 +71,10 @@ extern void mmc_cleanup_queue(struct mmc_queue *);
 extern void mmc_queue_suspend(struct mmc_queue *);
 extern void mmc_queue_resume(struct mmc_queue *);
 
+extern struct request *mmc_queue_fetch_request(struct mmc_queue *);
+extern void mmc_queue_requeue(struct mmc_queue *, struct request *);
+extern bool mmc_queue_end_request(struct request *, int, unsigned int);
+
 extern unsigned int mmc_queue_map_sg(struct mmc_queue *,
 				     struct mmc_queue_req *);
 extern void mmc_queue_bounce_pre(struct mmc_queue_req *);
@@ -132,6 +132,8 @@ static int sdio_read_cccr(struct mmc_card *card, u32 ocr)
 		card->cccr.low_speed = 1;
 	if (data & SDIO_CCCR_CAP_4BLS)
 		card->cccr.wide_bus = 1;
+	if (data & SDIO_CCCR_CAP_S4MI)
+		card->cccr.irq_4bit_data = 1;
 
 	if (cccr_vsn >= SDIO_CCCR_REV_1_10) {
 		ret = mmc_io_rw_direct(card, 0, 0, SDIO_CCCR_POWER, 0, &data);
@@ -200,6 +202,30 @@ out:
 	return ret;
 }
 
+/*
+ * In 4-bit mode, card interrupts are only signalled between CMD53 data
+ * blocks if the card supports it and it's enabled. Otherwise they are
+ * delayed until the end of the transfer, which hurts devices such as
+ * network adapters that keep the bus busy.
+ */
+static int sdio_enable_4bit_irq(struct mmc_card *card)
+{
+	int ret;
+	u8 caps;
+
+	if (!(card->host->caps2 & MMC_CAP2_SDIO_IRQ_4BIT_DATA) ||
+	    !card->cccr.irq_4bit_data)
+		return 0;
+
+	ret = mmc_io_rw_direct(card, 0, 0, SDIO_CCCR_CAPS, 0, &caps);
+	if (ret)
+		return ret;
+
+	caps |= SDIO_CCCR_CAP_E4MI;
+
+	return mmc_io_rw_direct(card, 1, 0, SDIO_CCCR_CAPS, caps, NULL);
+}
+
 static int sdio_enable_wide(struct mmc_card *card)
 {
 	int ret;
@@ -227,6 +253,10 @@ static int sdio_enable_wide(struct mmc_card *card)
 	if (ret)
 		return ret;
 
+	ret = sdio_enable_4bit_irq(card);
+	if (ret)
+		return ret;
+
 	return 1;
 }
 
@@ -19,6 +19,7 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/ioport.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
@@ -202,6 +203,19 @@ enum atmel_mci_state {
 	STATE_END_REQUEST,
 };
 
+/* Request phases for which the latency histograms are accounted */
+enum atmci_lat_phase {
+	ATMCI_LAT_CMD = 0,
+	ATMCI_LAT_DATA,
+	ATMCI_LAT_BUSY,
+	ATMCI_LAT_NR,
+};
+
+/* No data, up to 512 bytes, 4 KiB, 64 KiB, and larger transfers */
+#define ATMCI_LAT_SIZES		5
+/* Power of two buckets in microseconds, the last one is open-ended */
+#define ATMCI_LAT_BUCKETS	16
+
 enum atmci_xfer_dir {
 	XFER_RECEIVE = 0,
 	XFER_TRANSMIT,
@@ -258,16 +272,18 @@ struct atmel_mci_dma {
  *	EVENT_DATA_ERROR is pending.
  * @stop_cmdr: Value to be loaded into CMDR when the stop command is
  *	to be sent.
- * @tasklet: Tasklet running the request state machine.
+ * @irq: Interrupt line, whose thread runs the request state machine.
  * @pending_events: Bitmask of events flagged by the interrupt handler
- *	to be processed by the tasklet.
+ *	to be processed by the interrupt thread.
  * @completed_events: Bitmask of events which the state machine has
  *	processed.
- * @state: Tasklet state.
+ * @state: State machine state.
  * @queue: List of slots waiting for access to the controller.
  * @need_clock_update: Update the clock rate before the next request.
  * @need_reset: Reset controller before next request.
  * @timer: Timer to balance the data timeout error flag which cannot rise.
+ * @lat_stamp: Time at which the current request phase (command, data
+ *	transfer or busy wait) started, for the latency histograms.
  * @mode_reg: Value of the MR register.
  * @cfg_reg: Value of the CFG register.
  * @bus_hz: The rate of @mck in Hz. This forms the basis for MMC bus
@@ -337,7 +353,7 @@ struct atmel_mci {
 	u32			data_status;
 	u32			stop_cmdr;
 
-	struct tasklet_struct	tasklet;
+	int			irq;
 	unsigned long		pending_events;
 	unsigned long		completed_events;
 	enum atmel_mci_state	state;
@@ -346,6 +362,7 @@ struct atmel_mci {
 	bool			need_clock_update;
 	bool			need_reset;
 	struct timer_list	timer;
+	ktime_t			lat_stamp;
 	u32			mode_reg;
 	u32			cfg_reg;
 	unsigned long		bus_hz;
@@ -380,6 +397,8 @@ struct atmel_mci {
  *	if not available.
  * @detect_is_active_high: The state of the detect pin when it is active.
  * @detect_timer: Timer used for debouncing @detect_pin interrupts.
+ * @lat_hist: Latency histograms of the requests sent to this slot, by
+ *	phase, direction and transfer size. Protected by host->lock.
  */
 struct atmel_mci_slot {
 	struct mmc_host		*mmc;
@@ -402,6 +421,9 @@ struct atmel_mci_slot {
 	bool			detect_is_active_high;
 
 	struct timer_list	detect_timer;
+
+	u32			lat_hist[ATMCI_LAT_NR][2][ATMCI_LAT_SIZES]
+					[ATMCI_LAT_BUCKETS];
 };
 
 #define atmci_test_and_clear_pending(host, event)		\
@@ -411,6 +433,15 @@ struct atmel_mci_slot {
 #define atmci_set_pending(host, event)				\
 	set_bit(event, &host->pending_events)
 
+/*
+ * Kick the request state machine. It runs in the thread of the MCI
+ * interrupt, so that it doesn't compete with the other softirq users.
+ */
+static inline void atmci_schedule(struct atmel_mci *host)
+{
+	irq_wake_thread(host->irq, host);
+}
+
 /*
  * The debugfs stuff below is mostly optimized away when
  * CONFIG_DEBUG_FS is not set.
@@ -468,6 +499,90 @@ static const struct file_operations atmci_req_fops = {
 	.release	= single_release,
 };
 
+static const char * const atmci_lat_phase_name[ATMCI_LAT_NR] = {
+	[ATMCI_LAT_CMD]		= "cmd",
+	[ATMCI_LAT_DATA]	= "data",
+	[ATMCI_LAT_BUSY]	= "busy",
+};
+
+static const char * const atmci_lat_size_name[ATMCI_LAT_SIZES] = {
+	"none", "<=512", "<=4K", "<=64K", ">64K",
+};
+
+static int atmci_latency_show(struct seq_file *s, void *v)
+{
+	struct atmel_mci_slot	*slot = s->private;
+	u32			(*hist)[2][ATMCI_LAT_SIZES][ATMCI_LAT_BUCKETS];
+	unsigned int		phase, dir, size, i;
+	u64			total;
+
+	hist = kmalloc(sizeof(slot->lat_hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+
+	spin_lock_bh(&slot->host->lock);
+	memcpy(hist, slot->lat_hist, sizeof(slot->lat_hist));
+	spin_unlock_bh(&slot->host->lock);
+
+	seq_printf(s, "%-17s", "usecs");
+	for (i = 0; i < ATMCI_LAT_BUCKETS - 1; i++)
+		seq_printf(s, " %6u", 1U << i);
+	seq_printf(s, " %6s\n", "more");
+
+	for (phase = 0; phase < ATMCI_LAT_NR; phase++) {
+		for (dir = 0; dir < 2; dir++) {
+			for (size = 0; size < ATMCI_LAT_SIZES; size++) {
+				total = 0;
+				for (i = 0; i < ATMCI_LAT_BUCKETS; i++)
+					total += hist[phase][dir][size][i];
+				if (!total)
+					continue;
+
+				seq_printf(s, "%-4s %-5s %-6s",
+					   atmci_lat_phase_name[phase],
+					   size ? (dir ? "write" : "read") : "-",
+					   atmci_lat_size_name[size]);
+				for (i = 0; i < ATMCI_LAT_BUCKETS; i++)
+					seq_printf(s, " %6u",
+						   hist[phase][dir][size][i]);
+				seq_putc(s, '\n');
+			}
+		}
+	}
+
+	kfree(hist);
+
+	return 0;
+}
+
+static int atmci_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, atmci_latency_show, inode->i_private);
+}
+
+/* Any write resets the histograms */
+static ssize_t atmci_latency_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file		*s = file->private_data;
+	struct atmel_mci_slot	*slot = s->private;
+
+	spin_lock_bh(&slot->host->lock);
+	memset(slot->lat_hist, 0, sizeof(slot->lat_hist));
+	spin_unlock_bh(&slot->host->lock);
+
+	return count;
+}
+
+static const struct file_operations atmci_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= atmci_latency_open,
+	.read		= seq_read,
+	.write		= atmci_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static void atmci_show_status_reg(struct seq_file *s,
 		const char *regname, u32 value)
 {
@@ -627,6 +742,11 @@ static void atmci_init_debugfs(struct atmel_mci_slot *slot)
 	if (!node)
 		goto err;
 
+	node = debugfs_create_file("latency", S_IRUSR | S_IWUSR, root, slot,
+			&atmci_latency_fops);
+	if (!node)
+		goto err;
+
 	node = debugfs_create_u32("state", S_IRUSR, root, (u32 *)&host->state);
 	if (!node)
 		goto err;
@@ -767,7 +887,7 @@ static void atmci_timeout_timer(unsigned long data)
 	host->need_reset = 1;
 	host->state = STATE_END_REQUEST;
 	smp_wmb();
-	tasklet_schedule(&host->tasklet);
+	atmci_schedule(host);
 }
 
 static inline unsigned int atmci_ns_to_clocks(struct atmel_mci *host,
@@ -987,14 +1107,15 @@ static void atmci_pdc_complete(struct atmel_mci *host)
 
 	dev_dbg(&host->pdev->dev, "(%s) set pending xfer complete\n", __func__);
 	atmci_set_pending(host, EVENT_XFER_COMPLETE);
-	tasklet_schedule(&host->tasklet);
+	atmci_schedule(host);
 }
 
 static void atmci_dma_cleanup(struct atmel_mci *host)
 {
 	struct mmc_data                 *data = host->data;
 
-	if (data)
+	/* Mappings done by atmci_pre_req() are undone by atmci_post_req() */
+	if (data && !data->host_cookie)
 		dma_unmap_sg(host->dma.chan->device->dev,
 				data->sg, data->sg_len,
 				((data->flags & MMC_DATA_WRITE)
@@ -1025,7 +1146,7 @@ static void atmci_dma_complete(void *arg)
 		dev_dbg(&host->pdev->dev,
 		        "(%s) set pending xfer complete\n", __func__);
 		atmci_set_pending(host, EVENT_XFER_COMPLETE);
-		tasklet_schedule(&host->tasklet);
+		atmci_schedule(host);
 
 		/*
 		 * Regardless of what the documentation says, we have
@@ -1037,9 +1158,9 @@ static void atmci_dma_complete(void *arg)
 		 * the data transfer is still in progress and we
 		 * haven't seen all the potential error bits yet.
 		 *
-		 * The interrupt handler will schedule a different
-		 * tasklet to finish things up when the data transfer
-		 * is completely done.
+		 * The interrupt handler will wake the interrupt thread
+		 * again to finish things up when the data transfer is
+		 * completely done.
 		 *
 		 * We may not complete the mmc request here anyway
 		 * because the mmc layer may call back and cause us to
@@ -1145,18 +1266,65 @@ atmci_prepare_data_pdc(struct atmel_mci *host, struct mmc_data *data)
 	return iflags;
 }
 
+static inline enum dma_data_direction atmci_get_dma_dir(struct mmc_data *data)
+{
+	if (data->flags & MMC_DATA_WRITE)
+		return DMA_TO_DEVICE;
+	else
+		return DMA_FROM_DEVICE;
+}
+
+/*
+ * Map the sg list of a transfer for the DMA controller, unless it has already
+ * been mapped by atmci_pre_req(). Returns the number of mapped entries, or a
+ * negative error code if the transfer cannot be done by DMA.
+ */
+static int atmci_map_data_dma(struct atmel_mci *host, struct mmc_data *data,
+			      bool next)
+{
+	struct scatterlist	*sg;
+	unsigned int		i, sg_len;
+
+	if (!next && data->host_cookie)
+		return data->host_cookie;
+
+	/*
+	 * We don't do DMA on "complex" transfers, i.e. with
+	 * non-word-aligned buffers or lengths. Also, we don't bother
+	 * with all the DMA setup overhead for short transfers.
+	 */
+	if (data->blocks * data->blksz < ATMCI_DMA_THRESHOLD)
+		return -EINVAL;
+	if (data->blksz & 3)
+		return -EINVAL;
+
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		if (sg->offset & 3 || sg->length & 3)
+			return -EINVAL;
+	}
+
+	sg_len = dma_map_sg(host->dma.chan->device->dev, data->sg,
+			    data->sg_len, atmci_get_dma_dir(data));
+	if (!sg_len)
+		return -EINVAL;
+
+	if (next)
+		data->host_cookie = sg_len;
+
+	return sg_len;
+}
+
 static u32
 atmci_prepare_data_dma(struct atmel_mci *host, struct mmc_data *data)
 {
 	struct dma_chan			*chan;
 	struct dma_async_tx_descriptor	*desc;
-	struct scatterlist		*sg;
-	unsigned int			i;
 	enum dma_data_direction		direction;
 	enum dma_transfer_direction	slave_dirn;
 	unsigned int			sglen;
 	u32				maxburst;
 	u32 iflags;
+	int				ret;
 
 	data->error = -EINPROGRESS;
 
@@ -1166,29 +1334,17 @@ atmci_prepare_data_dma(struct atmel_mci *host, struct mmc_data *data)
 
 	iflags = ATMCI_DATA_ERROR_FLAGS;
 
-	/*
-	 * We don't do DMA on "complex" transfers, i.e. with
-	 * non-word-aligned buffers or lengths. Also, we don't bother
-	 * with all the DMA setup overhead for short transfers.
-	 */
-	if (data->blocks * data->blksz < ATMCI_DMA_THRESHOLD)
-		return atmci_prepare_data(host, data);
-	if (data->blksz & 3)
-		return atmci_prepare_data(host, data);
-
-	for_each_sg(data->sg, sg, data->sg_len, i) {
-		if (sg->offset & 3 || sg->length & 3)
-			return atmci_prepare_data(host, data);
-	}
-
 	/* If we don't have a channel, we can't do DMA */
 	chan = host->dma.chan;
-	if (chan)
-		host->data_chan = chan;
-
 	if (!chan)
 		return -ENODEV;
 
+	ret = atmci_map_data_dma(host, data, false);
+	if (ret < 0)
+		return atmci_prepare_data(host, data);
+	sglen = ret;
+	host->data_chan = chan;
+
 	if (data->flags & MMC_DATA_READ) {
 		direction = DMA_FROM_DEVICE;
 		host->dma_conf.direction = slave_dirn = DMA_DEV_TO_MEM;
@@ -1205,9 +1361,6 @@ atmci_prepare_data_dma(struct atmel_mci *host, struct mmc_data *data)
 		atmci_writel(host, ATMCI_DMA, ATMCI_DMA_CHKSIZE(maxburst) |
 			ATMCI_DMAEN);
 
-	sglen = dma_map_sg(chan->device->dev, data->sg,
-			data->sg_len, direction);
-
 	dmaengine_slave_config(chan, &host->dma_conf);
 	desc = dmaengine_prep_slave_sg(chan,
 			data->sg, sglen, slave_dirn,
@@ -1221,7 +1374,9 @@ atmci_prepare_data_dma(struct atmel_mci *host, struct mmc_data *data)
 
 	return iflags;
 unmap_exit:
-	dma_unmap_sg(chan->device->dev, data->sg, data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(chan->device->dev, data->sg, data->sg_len,
+			     direction);
 	return -ENOMEM;
 }
 
@@ -1352,6 +1507,7 @@ static void atmci_start_request(struct atmel_mci *host,
 	iflags |= ATMCI_CMDRDY;
 	cmd = mrq->cmd;
 	cmdflags = atmci_prepare_command(slot->mmc, cmd);
+	host->lat_stamp = ktime_get();
 
 	/*
 	 * DMA transfer should be started before sending the command to avoid
@@ -1627,8 +1783,49 @@ static void atmci_enable_sdio_irq(struct mmc_host *mmc, int enable)
 		atmci_writel(host, ATMCI_IDR, slot->sdio_irq);
 }
 
+/*
+ * Map the data of the next request while the current one is being
+ * transferred, so that the mapping cost is not serialized with the bus.
+ */
+static void atmci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct atmel_mci_slot	*slot = mmc_priv(mmc);
+	struct atmel_mci	*host = slot->host;
+	struct mmc_data		*data = mrq->data;
+
+	if (!host->dma.chan || !data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie = 0;
+		return;
+	}
+
+	if (atmci_map_data_dma(host, data, true) < 0)
+		data->host_cookie = 0;
+}
+
+static void atmci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct atmel_mci_slot	*slot = mmc_priv(mmc);
+	struct atmel_mci	*host = slot->host;
+	struct mmc_data		*data = mrq->data;
+
+	if (!host->dma.chan || !data)
+		return;
+
+	if (data->host_cookie)
+		dma_unmap_sg(host->dma.chan->device->dev, data->sg,
+			     data->sg_len, atmci_get_dma_dir(data));
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops atmci_ops = {
 	.request	= atmci_request,
+	.pre_req	= atmci_pre_req,
+	.post_req	= atmci_post_req,
 	.set_ios	= atmci_set_ios,
 	.get_ro		= atmci_get_ro,
 	.get_cd		= atmci_get_cd,
@@ -1804,21 +2001,73 @@ static void atmci_detect_change(unsigned long data)
 	}
 }
 
-static void atmci_tasklet_func(unsigned long priv)
+/*
+ * Account the time spent in the request phase the state machine is leaving
+ * and start timing the next one. Called with host->lock held.
+ */
+static void atmci_lat_account(struct atmel_mci *host,
+		enum atmel_mci_state from)
 {
-	struct atmel_mci	*host = (struct atmel_mci *)priv;
+	struct mmc_data		*data;
+	enum atmci_lat_phase	phase;
+	unsigned int		dir = 0, size = 0, bucket;
+	ktime_t			now;
+	s64			us;
+
+	switch (from) {
+	case STATE_SENDING_CMD:
+	case STATE_SENDING_STOP:
+		phase = ATMCI_LAT_CMD;
+		break;
+	case STATE_DATA_XFER:
+		phase = ATMCI_LAT_DATA;
+		break;
+	case STATE_WAITING_NOTBUSY:
+		phase = ATMCI_LAT_BUSY;
+		break;
+	default:
+		return;
+	}
+
+	data = host->mrq->data;
+	if (data) {
+		unsigned int len = data->blocks * data->blksz;
+
+		dir = !!(data->flags & MMC_DATA_WRITE);
+		if (len <= 512)
+			size = 1;
+		else if (len <= 4096)
+			size = 2;
+		else if (len <= 65536)
+			size = 3;
+		else
+			size = 4;
+	}
+
+	now = ktime_get();
+	us = ktime_us_delta(now, host->lat_stamp);
+	bucket = us > 0 ? min_t(unsigned int, fls64(us),
+				ATMCI_LAT_BUCKETS - 1) : 0;
+	host->cur_slot->lat_hist[phase][dir][size][bucket]++;
+	host->lat_stamp = now;
+}
+
+static irqreturn_t atmci_irq_thread(int irq, void *dev_id)
+{
+	struct atmel_mci	*host = dev_id;
 	struct mmc_request	*mrq = host->mrq;
 	struct mmc_data		*data = host->data;
 	enum atmel_mci_state	state = host->state;
 	enum atmel_mci_state	prev_state;
 	u32			status;
 
-	spin_lock(&host->lock);
+	/* The card detect timer takes the lock from softirq context */
+	spin_lock_bh(&host->lock);
 
 	state = host->state;
 
 	dev_vdbg(&host->pdev->dev,
-		"tasklet: state %u pending/completed/mask %lx/%lx/%x\n",
+		"thread: state %u pending/completed/mask %lx/%lx/%x\n",
 		state, host->pending_events, host->completed_events,
 		atmci_readl(host, ATMCI_IMR));
 
@@ -2003,11 +2252,27 @@ static void atmci_tasklet_func(unsigned long priv)
 			state = STATE_IDLE;
 			break;
 		}
+
+		if (state != prev_state)
+			atmci_lat_account(host, prev_state);
 	} while (state != prev_state);
 
 	host->state = state;
 
-	spin_unlock(&host->lock);
+	spin_unlock_bh(&host->lock);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * RXRDY and TXRDY only guarantee room for a single word and the controller
+ * doesn't report its FIFO level, so the PIO loops still have to poll SR
+ * once per word. Keep that loop tight: use plain word accesses whenever the
+ * buffer allows it, and only deal with alignment at scatterlist boundaries.
+ */
+static inline bool atmci_pio_aligned(void *buf, unsigned int offset)
+{
+	return IS_ALIGNED((unsigned long)buf + offset, sizeof(u32));
 }
 
 static void atmci_read_data_pio(struct atmel_mci *host)
@@ -2016,6 +2281,7 @@ static void atmci_read_data_pio(struct atmel_mci *host)
 	void			*buf = sg_virt(sg);
 	unsigned int		offset = host->pio_offset;
 	struct mmc_data		*data = host->data;
+	bool			aligned = atmci_pio_aligned(buf, offset);
 	u32			value;
 	u32			status;
 	unsigned int		nbytes = 0;
@@ -2023,7 +2289,10 @@ static void atmci_read_data_pio(struct atmel_mci *host)
 	do {
 		value = atmci_readl(host, ATMCI_RDR);
 		if (likely(offset + 4 <= sg->length)) {
-			put_unaligned(value, (u32 *)(buf + offset));
+			if (likely(aligned))
+				*(u32 *)(buf + offset) = value;
+			else
+				put_unaligned(value, (u32 *)(buf + offset));
 
 			offset += 4;
 			nbytes += 4;
@@ -2037,6 +2306,7 @@ static void atmci_read_data_pio(struct atmel_mci *host)
 
 				offset = 0;
 				buf = sg_virt(sg);
+				aligned = atmci_pio_aligned(buf, offset);
 			}
 		} else {
 			unsigned int remaining = sg->length - offset;
@@ -2053,6 +2323,7 @@ static void atmci_read_data_pio(struct atmel_mci *host)
 			buf = sg_virt(sg);
 			memcpy(buf, (u8 *)&value + remaining, offset);
 			nbytes += offset;
+			aligned = atmci_pio_aligned(buf, offset);
 		}
 
 		status = atmci_readl(host, ATMCI_SR);
@@ -2084,13 +2355,17 @@ static void atmci_write_data_pio(struct atmel_mci *host)
 	void			*buf = sg_virt(sg);
 	unsigned int		offset = host->pio_offset;
 	struct mmc_data		*data = host->data;
+	bool			aligned = atmci_pio_aligned(buf, offset);
 	u32			value;
 	u32			status;
 	unsigned int		nbytes = 0;
 
 	do {
 		if (likely(offset + 4 <= sg->length)) {
-			value = get_unaligned((u32 *)(buf + offset));
+			if (likely(aligned))
+				value = *(u32 *)(buf + offset);
+			else
+				value = get_unaligned((u32 *)(buf + offset));
 			atmci_writel(host, ATMCI_TDR, value);
 
 			offset += 4;
@@ -2103,6 +2378,7 @@ static void atmci_write_data_pio(struct atmel_mci *host)
 
 				offset = 0;
 				buf = sg_virt(sg);
+				aligned = atmci_pio_aligned(buf, offset);
 			}
 		} else {
 			unsigned int remaining = sg->length - offset;
@@ -2123,6 +2399,7 @@ static void atmci_write_data_pio(struct atmel_mci *host)
 			memcpy((u8 *)&value + remaining, buf, offset);
 			atmci_writel(host, ATMCI_TDR, value);
 			nbytes += offset;
+			aligned = atmci_pio_aligned(buf, offset);
 		}
 
 		status = atmci_readl(host, ATMCI_SR);
@@ -2166,6 +2443,7 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 	struct atmel_mci	*host = dev_id;
 	u32			status, mask, pending;
 	unsigned int		pass_count = 0;
+	bool			wake = false;
 
 	do {
 		status = atmci_readl(host, ATMCI_SR);
@@ -2185,7 +2463,7 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 			dev_dbg(&host->pdev->dev, "set pending data error\n");
 			smp_wmb();
 			atmci_set_pending(host, EVENT_DATA_ERROR);
-			tasklet_schedule(&host->tasklet);
+			wake = true;
 		}
 
 		if (pending & ATMCI_TXBUFE) {
@@ -2254,7 +2532,7 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 			smp_wmb();
 			dev_dbg(&host->pdev->dev, "set pending notbusy\n");
 			atmci_set_pending(host, EVENT_NOTBUSY);
-			tasklet_schedule(&host->tasklet);
+			wake = true;
 		}
 
 		if (pending & ATMCI_NOTBUSY) {
@@ -2263,7 +2541,7 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 			smp_wmb();
 			dev_dbg(&host->pdev->dev, "set pending notbusy\n");
 			atmci_set_pending(host, EVENT_NOTBUSY);
-			tasklet_schedule(&host->tasklet);
+			wake = true;
 		}
 
 		if (pending & ATMCI_RXRDY)
@@ -2278,7 +2556,7 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 			smp_wmb();
 			dev_dbg(&host->pdev->dev, "set pending cmd rdy\n");
 			atmci_set_pending(host, EVENT_CMD_RDY);
-			tasklet_schedule(&host->tasklet);
+			wake = true;
 		}
 
 		if (pending & (ATMCI_SDIOIRQA | ATMCI_SDIOIRQB))
@@ -2286,6 +2564,9 @@ static irqreturn_t atmci_interrupt(int irq, void *dev_id)
 
 	} while (pass_count++ < 5);
 
+	if (wake)
+		return IRQ_WAKE_THREAD;
+
 	return pass_count ? IRQ_HANDLED : IRQ_NONE;
 }
 
@@ -2335,8 +2616,14 @@ static int atmci_init_slot(struct atmel_mci *host,
 	mmc->f_min = DIV_ROUND_UP(host->bus_hz, 512);
 	mmc->f_max = host->bus_hz / 2;
 	mmc->ocr_avail	= MMC_VDD_32_33 | MMC_VDD_33_34;
-	if (sdio_irq)
+	/*
+	 * The controller samples DAT[1] during the interrupt period between
+	 * the blocks of a 4-bit transfer too.
+	 */
+	if (sdio_irq) {
 		mmc->caps |= MMC_CAP_SDIO_IRQ;
+		mmc->caps2 |= MMC_CAP2_SDIO_IRQ_4BIT_DATA;
+	}
 	if (host->caps.has_highspeed)
 		mmc->caps |= MMC_CAP_SD_HIGHSPEED;
 	/*
@@ -2561,9 +2848,9 @@ static int atmci_probe(struct platform_device *pdev)
 
 	host->mapbase = regs->start;
 
-	tasklet_init(&host->tasklet, atmci_tasklet_func, (unsigned long)host);
-
-	ret = request_irq(irq, atmci_interrupt, 0, dev_name(&pdev->dev), host);
+	host->irq = irq;
+	ret = request_threaded_irq(irq, atmci_interrupt, atmci_irq_thread, 0,
+				   dev_name(&pdev->dev), host);
 	if (ret) {
 		clk_disable_unprepare(host->mck);
 		return ret;
@@ -2735,6 +3022,7 @@ static struct platform_driver atmci_driver = {
 		.name		= "atmel_mci",
 		.of_match_table	= of_match_ptr(atmci_dt_ids),
 		.pm		= &atmci_dev_pm_ops,
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 module_platform_driver(atmci_driver);
@@ -29,9 +29,13 @@
 
 #include "sdhci-pltfm.h"
 
+#define SDMMC_MC1R	0x204
+#define		SDMMC_MC1R_DDR		BIT(3)
 #define SDMMC_CACR	0x230
 #define		SDMMC_CACR_CAPWREN	BIT(0)
 #define		SDMMC_CACR_KEY		(0x46 << 8)
+#define SDMMC_CALCR	0x240
+#define		SDMMC_CALCR_EN		BIT(0)
 
 struct sdhci_at91_priv {
 	struct clk *hclock;
@@ -109,11 +113,57 @@ static void sdhci_at91_set_clock(struct sdhci_host *host, unsigned int clock)
 	sdhci_writew(host, clk, SDHCI_CLOCK_CONTROL);
 }
 
+/*
+ * The UHS mode select field of the Host Control 2 register has no eMMC DDR
+ * encoding, the SDMMC controller needs its own DDR bit for DDR52.
+ */
+static void sdhci_at91_set_uhs_signaling(struct sdhci_host *host,
+					 unsigned int timing)
+{
+	u8 mc1r;
+
+	mc1r = sdhci_readb(host, SDMMC_MC1R);
+	if (timing == MMC_TIMING_MMC_DDR52)
+		mc1r |= SDMMC_MC1R_DDR;
+	else
+		mc1r &= ~SDMMC_MC1R_DDR;
+	sdhci_writeb(host, mc1r, SDMMC_MC1R);
+
+	sdhci_set_uhs_signaling(host, timing);
+}
+
+/*
+ * The output impedance of the pads has to be calibrated again once the I/O
+ * voltage has been switched to 1.8V, otherwise tuning for SDR104/HS200
+ * may not find a valid sampling point.
+ */
+static void sdhci_at91_voltage_switch(struct sdhci_host *host)
+{
+	u32 calcr;
+	unsigned long timeout;
+
+	calcr = sdhci_readl(host, SDMMC_CALCR);
+	sdhci_writel(host, calcr | SDMMC_CALCR_EN, SDMMC_CALCR);
+
+	/* Wait max 20 ms */
+	timeout = 20;
+	while (sdhci_readl(host, SDMMC_CALCR) & SDMMC_CALCR_EN) {
+		if (timeout == 0) {
+			pr_err("%s: pads calibration never completed.\n",
+			       mmc_hostname(host->mmc));
+			return;
+		}
+		timeout--;
+		usleep_range(1000, 1500);
+	}
+}
+
 static const struct sdhci_ops sdhci_at91_sama5d2_ops = {
 	.set_clock		= sdhci_at91_set_clock,
 	.set_bus_width		= sdhci_set_bus_width,
 	.reset			= sdhci_reset,
-	.set_uhs_signaling	= sdhci_set_uhs_signaling,
+	.set_uhs_signaling	= sdhci_at91_set_uhs_signaling,
+	.voltage_switch		= sdhci_at91_voltage_switch,
 };
 
 static const struct sdhci_pltfm_data soc_data_sama5d2 = {
@@ -281,6 +331,16 @@ static int sdhci_at91_probe(struct platform_device *pdev)
 
 	sdhci_get_of_property(pdev);
 
+	/*
+	 * The controller raises the transfer complete interrupt when the card
+	 * releases DAT0 at the end of the busy signalling of an R1b response,
+	 * and the data timeout counter bounds it with the busy timeout of the
+	 * command. The MMC core can then skip polling the card status with
+	 * CMD13 after writes, erases and switches. Longer busy timeouts than
+	 * the counter can count fall back to polling.
+	 */
+	host->mmc->caps |= MMC_CAP_WAIT_WHILE_BUSY;
+
 	pm_runtime_get_noresume(&pdev->dev);
 	pm_runtime_set_active(&pdev->dev);
 	pm_runtime_enable(&pdev->dev);
@@ -349,6 +409,7 @@ static struct platform_driver sdhci_at91_driver = {
 		.name	= "sdhci-at91",
 		.of_match_table = sdhci_at91_dt_match,
 		.pm	= &sdhci_at91_dev_pm_ops,
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe		= sdhci_at91_probe,
 	.remove		= sdhci_at91_remove,
@@ -20,6 +20,7 @@
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/highmem.h>
 #include <linux/err.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
@@ -144,8 +145,98 @@ static int mtdchar_close(struct inode *inode, struct file *file)
  * write case, this requires yet more complex head and tail transfer
  * handling when those head and tail offsets and sizes are such that
  * alignment requirements are not met in the NAND subdriver.
+ *
+ * As a first step, plain reads and writes whose user buffer, device offset
+ * and length are all aligned on the write unit are done directly on the
+ * pinned user pages, one page at a time, which avoids both the bounce buffer
+ * and the copy, and lets DMA-capable drivers transfer to or from the user
+ * pages. Everything else still goes through mtd_kmalloc_up_to.
  */
 
+/* Maximum number of user pages pinned at a time */
+#define MTDCHAR_MAX_PINNED_PAGES 16
+
+static bool mtdchar_can_pin(struct mtd_file_info *mfi, const void __user *buf,
+			    size_t count, loff_t pos)
+{
+	struct mtd_info *mtd = mfi->mtd;
+	u32 align = mtd->writesize;
+
+	if (mfi->mode != MTD_FILE_MODE_NORMAL || count < PAGE_SIZE ||
+	    align > PAGE_SIZE || PAGE_SIZE % align)
+		return false;
+
+	return !((unsigned long)buf % align) && !(count % align) &&
+	       !do_div(pos, align);
+}
+
+static ssize_t mtdchar_rw_pinned(struct mtd_info *mtd, char __user *buf,
+				 size_t count, loff_t *ppos, int write)
+{
+	struct page *pages[MTDCHAR_MAX_PINNED_PAGES];
+	unsigned long uaddr = (unsigned long)buf;
+	size_t total_retlen = 0;
+	int ret = 0;
+
+	while (count && !ret) {
+		unsigned int offs = uaddr & ~PAGE_MASK;
+		int i, nr_pages;
+
+		nr_pages = min_t(size_t, DIV_ROUND_UP(offs + count, PAGE_SIZE),
+				 MTDCHAR_MAX_PINNED_PAGES);
+		nr_pages = get_user_pages_fast(uaddr, nr_pages, !write, pages);
+		if (nr_pages <= 0)
+			return nr_pages ? nr_pages : -EFAULT;
+
+		for (i = 0; i < nr_pages; i++) {
+			size_t len = min_t(size_t, count, PAGE_SIZE - offs);
+			size_t retlen = 0;
+			void *kaddr;
+
+			if (ret || !count) {
+				put_page(pages[i]);
+				continue;
+			}
+
+			kaddr = kmap(pages[i]);
+			if (write) {
+				ret = mtd_write(mtd, *ppos, len, &retlen,
+						kaddr + offs);
+			} else {
+				ret = mtd_read(mtd, *ppos, len, &retlen,
+					       kaddr + offs);
+				/* See mtdchar_read() about ECC errors */
+				if (mtd_is_bitflip_or_eccerr(ret))
+					ret = 0;
+				flush_dcache_page(pages[i]);
+				set_page_dirty_lock(pages[i]);
+			}
+			kunmap(pages[i]);
+			put_page(pages[i]);
+
+			if (ret)
+				continue;
+
+			*ppos += retlen;
+			total_retlen += retlen;
+			count -= retlen;
+			uaddr += retlen;
+			offs = 0;
+			if (retlen != len)
+				/* Short read at the end of the device */
+				count = 0;
+		}
+	}
+
+	/*
+	 * Like the bounce-buffer path, return -ENOSPC only if no data could
+	 * be written at all.
+	 */
+	if (ret == -ENOSPC && total_retlen)
+		ret = 0;
+	return ret ? ret : total_retlen;
+}
+
 static ssize_t mtdchar_read(struct file *file, char __user *buf, size_t count,
 			loff_t *ppos)
 {
@@ -166,6 +257,9 @@ static ssize_t mtdchar_read(struct file *file, char __user *buf, size_t count,
 	if (!count)
 		return 0;
 
+	if (mtdchar_can_pin(mfi, buf, count, *ppos))
+		return mtdchar_rw_pinned(mtd, buf, count, ppos, 0);
+
 	kbuf = mtd_kmalloc_up_to(mtd, &size);
 	if (!kbuf)
 		return -ENOMEM;
@@ -255,6 +349,10 @@ static ssize_t mtdchar_write(struct file *file, const char __user *buf, size_t c
 	if (!count)
 		return 0;
 
+	if (mtdchar_can_pin(mfi, buf, count, *ppos))
+		return mtdchar_rw_pinned(mtd, (char __user *)buf, count, ppos,
+					 1);
+
 	kbuf = mtd_kmalloc_up_to(mtd, &size);
 	if (!kbuf)
 		return -ENOMEM;
@@ -39,12 +39,17 @@
 #include <linux/slab.h>
 #include <linux/reboot.h>
 #include <linux/kconfig.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 
 #include "mtdcore.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/mtd.h>
+
 static struct backing_dev_info mtd_bdi = {
 };
 
@@ -379,6 +384,137 @@ static int mtd_reboot_notifier(struct notifier_block *n, unsigned long state,
  *	if there is insufficient memory or a sysfs error.
  */
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *dfs_dir_mtd;
+
+static void mtd_io_account(struct mtd_info *mtd, enum mtd_io_op op, u64 len,
+			   int ret, s64 ns)
+{
+	struct mtd_io_stats *st = &mtd->dbg.io_stats;
+	unsigned int b;
+
+	b = min_t(unsigned int, fls64(div_u64(ns, NSEC_PER_USEC)),
+		  MTD_IO_LAT_BUCKETS - 1);
+	atomic_long_inc(&st->lat[op][b]);
+	atomic64_add(len, &st->bytes[op]);
+
+	if (ret < 0 && ret != -EUCLEAN)
+		atomic_long_inc(&st->errors[op]);
+	else if (op == MTD_IO_READ && ret >= 0)
+		atomic_long_inc(&st->bitflips[min(ret,
+						  MTD_IO_BITFLIP_BUCKETS - 1)]);
+}
+
+static int mtd_io_stats_show(struct seq_file *s, void *p)
+{
+	struct mtd_io_stats *st = &((struct mtd_info *)s->private)->dbg.io_stats;
+	int b, op;
+
+	seq_puts(s, "latency_us\tread\twrite\terase\n");
+	for (b = 0; b < MTD_IO_LAT_BUCKETS; b++) {
+		if (b == MTD_IO_LAT_BUCKETS - 1)
+			seq_printf(s, ">=%u", 1U << (b - 1));
+		else
+			seq_printf(s, "<%u", 1U << b);
+		for (op = 0; op < MTD_IO_NR_OPS; op++)
+			seq_printf(s, "\t%ld", atomic_long_read(&st->lat[op][b]));
+		seq_putc(s, '\n');
+	}
+
+	seq_puts(s, "bytes");
+	for (op = 0; op < MTD_IO_NR_OPS; op++)
+		seq_printf(s, "\t%lld", (long long)atomic64_read(&st->bytes[op]));
+	seq_puts(s, "\nerrors");
+	for (op = 0; op < MTD_IO_NR_OPS; op++)
+		seq_printf(s, "\t%ld", atomic_long_read(&st->errors[op]));
+
+	seq_puts(s, "\n\nbitflips\treads\n");
+	for (b = 0; b < MTD_IO_BITFLIP_BUCKETS; b++)
+		seq_printf(s, "%s%d\t\t%ld\n",
+			   b == MTD_IO_BITFLIP_BUCKETS - 1 ? ">=" : "", b,
+			   atomic_long_read(&st->bitflips[b]));
+
+	return 0;
+}
+
+static int mtd_io_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mtd_io_stats_show, inode->i_private);
+}
+
+/* Any write clears the statistics */
+static ssize_t mtd_io_stats_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct mtd_info *mtd = ((struct seq_file *)file->private_data)->private;
+
+	memset(&mtd->dbg.io_stats, 0, sizeof(mtd->dbg.io_stats));
+
+	return count;
+}
+
+static const struct file_operations mtd_io_stats_fops = {
+	.open		= mtd_io_stats_open,
+	.read		= seq_read,
+	.write		= mtd_io_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void mtd_debugfs_populate(struct mtd_info *mtd)
+{
+	struct dentry *root;
+
+	if (IS_ERR_OR_NULL(dfs_dir_mtd))
+		return;
+
+	root = debugfs_create_dir(dev_name(&mtd->dev), dfs_dir_mtd);
+	if (IS_ERR_OR_NULL(root))
+		return;
+
+	debugfs_create_file("io_stats", S_IRUSR | S_IWUSR, root, mtd,
+			    &mtd_io_stats_fops);
+	mtd->dbg.dfs_dir = root;
+}
+
+static void mtd_debugfs_remove(struct mtd_info *mtd)
+{
+	debugfs_remove_recursive(mtd->dbg.dfs_dir);
+	mtd->dbg.dfs_dir = NULL;
+}
+
+static void mtd_debugfs_init(void)
+{
+	dfs_dir_mtd = debugfs_create_dir("mtd", NULL);
+}
+
+static void mtd_debugfs_exit(void)
+{
+	debugfs_remove_recursive(dfs_dir_mtd);
+}
+#else
+static inline void mtd_io_account(struct mtd_info *mtd, enum mtd_io_op op,
+				  u64 len, int ret, s64 ns)
+{
+}
+
+static inline void mtd_debugfs_populate(struct mtd_info *mtd)
+{
+}
+
+static inline void mtd_debugfs_remove(struct mtd_info *mtd)
+{
+}
+
+static inline void mtd_debugfs_init(void)
+{
+}
+
+static inline void mtd_debugfs_exit(void)
+{
+}
+#endif
+
 int add_mtd_device(struct mtd_info *mtd)
 {
 	struct mtd_notifier *not;
@@ -436,6 +572,8 @@ int add_mtd_device(struct mtd_info *mtd)
 	device_create(&mtd_class, mtd->dev.parent, MTD_DEVT(i) + 1, NULL,
 		      "mtd%dro", i);
 
+	mtd_debugfs_populate(mtd);
+
 	pr_debug("mtd: Giving out device %d to %s\n", i, mtd->name);
 	/* No need to get a refcount on the module containing
 	   the notifier, since we hold the mtd_table_mutex */
@@ -489,6 +627,8 @@ int del_mtd_device(struct mtd_info *mtd)
 		       mtd->index, mtd->name, mtd->usecount);
 		ret = -EBUSY;
 	} else {
+		mtd_debugfs_remove(mtd);
+
 		device_unregister(&mtd->dev);
 
 		idr_remove(&mtd_idr, mtd->index);
@@ -802,6 +942,11 @@ EXPORT_SYMBOL_GPL(__put_mtd_device);
  */
 int mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
 {
+	u64 addr = instr->addr, len = instr->len;
+	ktime_t start;
+	s64 ns;
+	int ret;
+
 	if (instr->addr >= mtd->size || instr->len > mtd->size - instr->addr)
 		return -EINVAL;
 	if (!(mtd->flags & MTD_WRITEABLE))
@@ -812,7 +957,19 @@ int mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
 		mtd_erase_callback(instr);
 		return 0;
 	}
-	return mtd->_erase(mtd, instr);
+
+	/*
+	 * The time to return from ->_erase(), which is the whole operation
+	 * for the drivers completing the erase before returning, NAND and
+	 * SPI NOR included.
+	 */
+	start = ktime_get();
+	ret = mtd->_erase(mtd, instr);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	trace_mtd_io_erase(mtd, addr, len, ret, 0, ns);
+	mtd_io_account(mtd, MTD_IO_ERASE, ret ? 0 : len, ret, ns);
+
+	return ret;
 }
 EXPORT_SYMBOL_GPL(mtd_erase);
 
@@ -869,6 +1026,9 @@ int mtd_read(struct mtd_info *mtd, loff_t from, size_t len, size_t *retlen,
 	     u_char *buf)
 {
 	int ret_code;
+	ktime_t start;
+	s64 ns;
+
 	*retlen = 0;
 	if (from < 0 || from >= mtd->size || len > mtd->size - from)
 		return -EINVAL;
@@ -880,7 +1040,12 @@ int mtd_read(struct mtd_info *mtd, loff_t from, size_t len, size_t *retlen,
 	 * representing the maximum number of bitflips that were corrected on
 	 * any one ecc region (if applicable; zero otherwise).
 	 */
+	start = ktime_get();
 	ret_code = mtd->_read(mtd, from, len, retlen, buf);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	trace_mtd_io_read(mtd, from, len, ret_code, max(ret_code, 0), ns);
+	mtd_io_account(mtd, MTD_IO_READ, *retlen, ret_code, ns);
+
 	if (unlikely(ret_code < 0))
 		return ret_code;
 	if (mtd->ecc_strength == 0)
@@ -892,6 +1057,10 @@ EXPORT_SYMBOL_GPL(mtd_read);
 int mtd_write(struct mtd_info *mtd, loff_t to, size_t len, size_t *retlen,
 	      const u_char *buf)
 {
+	ktime_t start;
+	s64 ns;
+	int ret;
+
 	*retlen = 0;
 	if (to < 0 || to >= mtd->size || len > mtd->size - to)
 		return -EINVAL;
@@ -899,7 +1068,14 @@ int mtd_write(struct mtd_info *mtd, loff_t to, size_t len, size_t *retlen,
 		return -EROFS;
 	if (!len)
 		return 0;
-	return mtd->_write(mtd, to, len, retlen, buf);
+
+	start = ktime_get();
+	ret = mtd->_write(mtd, to, len, retlen, buf);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	trace_mtd_io_write(mtd, to, len, ret, 0, ns);
+	mtd_io_account(mtd, MTD_IO_WRITE, *retlen, ret, ns);
+
+	return ret;
 }
 EXPORT_SYMBOL_GPL(mtd_write);
 
@@ -1270,6 +1446,8 @@ static int __init init_mtd(void)
 
 	proc_mtd = proc_create("mtd", 0, NULL, &mtd_proc_ops);
 
+	mtd_debugfs_init();
+
 	ret = init_mtdchar();
 	if (ret)
 		goto out_procfs;
@@ -1277,6 +1455,7 @@ static int __init init_mtd(void)
 	return 0;
 
 out_procfs:
+	mtd_debugfs_exit();
 	if (proc_mtd)
 		remove_proc_entry("mtd", NULL);
 err_bdi:
@@ -1289,6 +1468,7 @@ err_reg:
 static void __exit cleanup_mtd(void)
 {
 	cleanup_mtdchar();
+	mtd_debugfs_exit();
 	if (proc_mtd)
 		remove_proc_entry("mtd", NULL);
 	class_unregister(&mtd_class);
@@ -30,6 +30,7 @@
 #include <linux/clk.h>
 #include <linux/dma-mapping.h>
 #include <linux/slab.h>
+#include <linux/atmel-sram.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/platform_device.h>
@@ -37,16 +38,21 @@
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
 #include <linux/of_mtd.h>
+#include <linux/mtd/concat.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/partitions.h>
+#include <linux/mutex.h>
 
 #include <linux/delay.h>
 #include <linux/dmaengine.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/mfd/syscon.h>
+#include <linux/mfd/syscon/atmel-smc.h>
 #include <linux/platform_data/atmel.h>
+#include <linux/regmap.h>
 
 static int use_dma = 1;
 module_param(use_dma, int, 0);
@@ -67,6 +73,9 @@ struct atmel_nand_caps {
 	bool pmecc_correct_erase_page;
 	uint8_t pmecc_max_correction;
 	bool has_hsmc_clk;
+	/* Layout of the per chip select SMC timing registers */
+	u32 smc_generic;
+	u32 smc_blk_sz;
 };
 
 /* oob layout for large page size
@@ -111,9 +120,37 @@ struct atmel_nfc {
 	/* Point to the sram bank which include readed data via NFC */
 	void			*data_in_sram;
 	bool			will_write_sram;
+
+	/* Sequential cache read, see nfc_cache_read() */
+	bool			has_cache_read;
+	int			cache_read_page;	/* page being preloaded */
+	int			cache_read_last;	/* last page of the read */
+
+	/* Read-ahead in the other SRAM bank, see nfc_read_ahead() */
+	bool			has_read_ahead;
+	bool			read_ahead_nowait;
+	int			read_ahead_page;	/* page being loaded */
+	void			*read_ahead_sram;	/* where it lands */
+	int			(*mtd_read)(struct mtd_info *mtd, loff_t from,
+					    size_t len, size_t *retlen,
+					    u_char *buf);
 };
 static struct atmel_nfc	nand_nfc;
 
+/*
+ * Additional die behind its own CE and R/B lines on the SMC bus. Each
+ * die is a separate nand_chip with its own hw_control, so operations
+ * on different dies only serialise on the bus lock, which is dropped
+ * while a die is busy programming or erasing.
+ */
+struct atmel_nand_die {
+	struct mtd_info		mtd;
+	struct nand_chip	nand_chip;
+	int			ce_pin;
+	int			rdy_pin;
+	bool			bus_held;
+};
+
 struct atmel_nand_host {
 	struct nand_chip	nand_chip;
 	struct mtd_info		mtd;
@@ -129,6 +166,18 @@ struct atmel_nand_host {
 	struct atmel_nfc	*nfc;
 	struct clk		*clk;
 
+	/* Extra dies, concatenated behind the first one */
+	struct atmel_nand_die	*dies;
+	int			num_dies;
+	struct mutex		bus_lock;
+	bool			bus_held;
+	struct mtd_info		*concat;
+
+	/* SMC syscon, when the timings may be tuned from ONFI */
+	struct regmap		*smc;
+	u32			smc_cs;
+	int			max_timing_mode;
+
 	struct atmel_nand_caps	*caps;
 	bool			has_pmecc;
 	u8			pmecc_corr_cap;
@@ -145,9 +194,9 @@ struct atmel_nand_host {
 	void __iomem		*pmerrloc_el_base;
 	void __iomem		*pmecc_rom_base;
 
-	/* lookup table for alpha_to and index_of */
-	void __iomem		*pmecc_alpha_to;
-	void __iomem		*pmecc_index_of;
+	/* lookup table for alpha_to and index_of, kept in RAM or SRAM */
+	int16_t			*pmecc_alpha_to;
+	int16_t			*pmecc_index_of;
 
 	/* data for pmecc computation */
 	int16_t			*pmecc_partial_syn;
@@ -179,6 +228,13 @@ static void atmel_nand_disable(struct atmel_nand_host *host)
 		gpio_set_value(host->board.enable_pin, 1);
 }
 
+static inline struct atmel_nand_die *atmel_nand_mtd_to_die(
+		struct atmel_nand_host *host, struct mtd_info *mtd)
+{
+	return mtd == &host->mtd ? NULL :
+		container_of(mtd, struct atmel_nand_die, mtd);
+}
+
 /*
  * Hardware specific access to control-lines
  */
@@ -186,9 +242,12 @@ static void atmel_nand_cmd_ctrl(struct mtd_info *mtd, int cmd, unsigned int ctrl
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
+	struct atmel_nand_die *die = atmel_nand_mtd_to_die(host, mtd);
 
 	if (ctrl & NAND_CTRL_CHANGE) {
-		if (ctrl & NAND_NCE)
+		if (die)
+			gpio_set_value(die->ce_pin, !(ctrl & NAND_NCE));
+		else if (ctrl & NAND_NCE)
 			atmel_nand_enable(host);
 		else
 			atmel_nand_disable(host);
@@ -209,11 +268,98 @@ static int atmel_nand_device_ready(struct mtd_info *mtd)
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
+	struct atmel_nand_die *die = atmel_nand_mtd_to_die(host, mtd);
+
+	if (die)
+		return gpio_get_value(die->rdy_pin) ^
+			!!host->board.rdy_pin_active_low;
 
 	return gpio_get_value(host->board.rdy_pin) ^
                 !!host->board.rdy_pin_active_low;
 }
 
+static bool *atmel_nand_bus_held(struct atmel_nand_host *host,
+				 struct mtd_info *mtd)
+{
+	struct atmel_nand_die *die = atmel_nand_mtd_to_die(host, mtd);
+
+	return die ? &die->bus_held : &host->bus_held;
+}
+
+static void atmel_nand_bus_claim(struct atmel_nand_host *host,
+				 struct mtd_info *mtd)
+{
+	bool *held = atmel_nand_bus_held(host, mtd);
+
+	if (!*held && !oops_in_progress) {
+		mutex_lock(&host->bus_lock);
+		*held = true;
+	}
+}
+
+static void atmel_nand_bus_release(struct atmel_nand_host *host,
+				   struct mtd_info *mtd)
+{
+	bool *held = atmel_nand_bus_held(host, mtd);
+
+	if (*held) {
+		*held = false;
+		mutex_unlock(&host->bus_lock);
+	}
+}
+
+/* Chip select for the multi-die setup: a die owns the bus while selected */
+static void atmel_nand_select_die(struct mtd_info *mtd, int chipnr)
+{
+	struct nand_chip *chip = mtd->priv;
+	struct atmel_nand_host *host = chip->priv;
+
+	if (chipnr < 0) {
+		chip->cmd_ctrl(mtd, NAND_CMD_NONE, 0 | NAND_CTRL_CHANGE);
+		atmel_nand_bus_release(host, mtd);
+	} else {
+		atmel_nand_bus_claim(host, mtd);
+	}
+}
+
+/*
+ * Wait for a program or erase to finish with the bus given up, so that
+ * the other dies can transfer data meanwhile. R/B is per die, which is
+ * what makes this possible; the status is read once the bus is back.
+ */
+static int atmel_nand_die_wait(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	struct atmel_nand_host *host = chip->priv;
+	unsigned int timeo_ms = chip->state == FL_ERASING ? 400 : 20;
+	unsigned long timeo;
+	int i;
+
+	/* tWB before R/B is guaranteed to be low */
+	ndelay(100);
+
+	if (oops_in_progress) {
+		/* No sleeping and no bus handover from a panic write */
+		for (i = 0; i < timeo_ms * 1000 && !chip->dev_ready(mtd); i++)
+			udelay(1);
+	} else {
+		chip->cmd_ctrl(mtd, NAND_CMD_NONE, 0 | NAND_CTRL_CHANGE);
+		atmel_nand_bus_release(host, mtd);
+
+		timeo = jiffies + msecs_to_jiffies(timeo_ms);
+		while (!chip->dev_ready(mtd)) {
+			if (time_after(jiffies, timeo))
+				break;
+			usleep_range(20, 50);
+		}
+
+		atmel_nand_bus_claim(host, mtd);
+	}
+
+	chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+
+	return chip->read_byte(mtd);
+}
+
 /* Set up for hardware ready pin and enable pin. */
 static int atmel_nand_set_enable_ready_pins(struct mtd_info *mtd)
 {
@@ -361,7 +507,7 @@ static int atmel_nand_dma_op(struct mtd_info *mtd, void *buf, int len,
 	enum dma_data_direction dir = is_read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
 	struct atmel_nfc *nfc = host->nfc;
 
-	if (buf >= high_memory)
+	if (!virt_addr_valid(buf))
 		goto err_buf;
 
 	dma_dev = host->dma_chan->device;
@@ -376,8 +522,9 @@ static int atmel_nand_dma_op(struct mtd_info *mtd, void *buf, int len,
 
 	if (is_read) {
 		if (nfc && nfc->data_in_sram)
-			dma_src_addr = nfc_sram_phys(host) + (nfc->data_in_sram
-				- (nfc->sram_bank0 + nfc_get_sram_off(host)));
+			/* The bank register may already point to a read-ahead */
+			dma_src_addr = nfc->sram_bank0_phys +
+				(nfc->data_in_sram - nfc->sram_bank0);
 		else
 			dma_src_addr = host->io_phys;
 
@@ -493,17 +640,6 @@ static void pmecc_config_ecc_layout(struct nand_ecclayout *layout,
 		oobsize - ecc_len - layout->oobfree[0].offset;
 }
 
-static void __iomem *pmecc_get_alpha_to(struct atmel_nand_host *host)
-{
-	int table_size;
-
-	table_size = host->pmecc_sector_size == 512 ?
-		PMECC_LOOKUP_TABLE_SIZE_512 : PMECC_LOOKUP_TABLE_SIZE_1024;
-
-	return host->pmecc_rom_base + host->pmecc_lookup_table_offset +
-			table_size * sizeof(int16_t);
-}
-
 static int pmecc_data_alloc(struct atmel_nand_host *host)
 {
 	const int cap = host->pmecc_corr_cap;
@@ -534,12 +670,17 @@ static int pmecc_data_alloc(struct atmel_nand_host *host)
 	return 0;
 }
 
-static void pmecc_gen_syndrome(struct mtd_info *mtd, int sector)
+/*
+ * Fetch the odd partial syndromes of a sector. Returns false when they
+ * are all zero, i.e. the sector holds no error and needs no decoding.
+ */
+static bool pmecc_gen_syndrome(struct mtd_info *mtd, int sector)
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
 	int i;
 	uint32_t value;
+	uint32_t any = 0;
 
 	/* Fill odd syndromes */
 	for (i = 0; i < host->pmecc_corr_cap; i++) {
@@ -548,18 +689,22 @@ static void pmecc_gen_syndrome(struct mtd_info *mtd, int sector)
 			value >>= 16;
 		value &= 0xffff;
 		host->pmecc_partial_syn[(2 * i) + 1] = (int16_t)value;
+		any |= value;
 	}
+
+	return any != 0;
 }
 
 static void pmecc_substitute(struct mtd_info *mtd)
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
-	int16_t __iomem *alpha_to = host->pmecc_alpha_to;
-	int16_t __iomem *index_of = host->pmecc_index_of;
+	int16_t *alpha_to = host->pmecc_alpha_to;
+	int16_t *index_of = host->pmecc_index_of;
 	int16_t *partial_syn = host->pmecc_partial_syn;
 	const int cap = host->pmecc_corr_cap;
 	int16_t *si;
+	unsigned int bits;
 	int i, j;
 
 	/* si[] is a table that holds the current syndrome value,
@@ -572,9 +717,10 @@ static void pmecc_substitute(struct mtd_info *mtd)
 	/* Computation 2t syndromes based on S(x) */
 	/* Odd syndromes */
 	for (i = 1; i < 2 * cap; i += 2) {
-		for (j = 0; j < host->pmecc_degree; j++) {
-			if (partial_syn[i] & ((unsigned short)0x1 << j))
-				si[i] = readw_relaxed(alpha_to + i * j) ^ si[i];
+		bits = (unsigned short)partial_syn[i];
+		for (j = 0; bits; j++, bits >>= 1) {
+			if (bits & 0x1)
+				si[i] ^= alpha_to[i * j];
 		}
 	}
 	/* Even syndrome = (Odd syndrome) ** 2 */
@@ -584,9 +730,10 @@ static void pmecc_substitute(struct mtd_info *mtd)
 		} else {
 			int16_t tmp;
 
-			tmp = readw_relaxed(index_of + si[j]);
-			tmp = (tmp * 2) % host->pmecc_cw_len;
-			si[i] = readw_relaxed(alpha_to + tmp);
+			tmp = index_of[si[j]] * 2;
+			if (tmp >= host->pmecc_cw_len)
+				tmp -= host->pmecc_cw_len;
+			si[i] = alpha_to[tmp];
 		}
 	}
 
@@ -606,16 +753,19 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 	int cw_len = host->pmecc_cw_len;
 	const int16_t cap = host->pmecc_corr_cap;
 	const int num = 2 * cap + 1;
-	int16_t __iomem	*index_of = host->pmecc_index_of;
-	int16_t __iomem	*alpha_to = host->pmecc_alpha_to;
+	int16_t *index_of = host->pmecc_index_of;
+	int16_t *alpha_to = host->pmecc_alpha_to;
 	int i, j, k;
 	uint32_t dmu_0_count, tmp;
 	int16_t *smu = host->pmecc_smu;
+	int16_t *row, *next;
 
 	/* index of largest delta */
 	int ro;
 	int largest;
 	int diff;
+	/* log of the discrepancy ratio dmu[i] / dmu[ro] */
+	uint32_t ratio;
 
 	dmu_0_count = 0;
 
@@ -700,26 +850,32 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 			else
 				lmu[i + 1] = ((lmu[ro] >> 1) + diff) * 2;
 
+			row = &smu[ro * num];
+			next = &smu[(i + 1) * num];
+
 			/* Init smu[i+1] with 0 */
-			for (k = 0; k < num; k++)
-				smu[(i + 1) * num + k] = 0;
+			memset(next, 0, sizeof(int16_t) * num);
 
-			/* Compute smu[i+1] */
-			for (k = 0; k <= lmu[ro] >> 1; k++) {
-				int16_t a, b, c;
+			/*
+			 * Compute smu[i+1]. The dmu[i] / dmu[ro] ratio does
+			 * not depend on k, so take its log once.
+			 */
+			ratio = index_of[dmu[i]] + cw_len - index_of[dmu[ro]];
+			if (ratio >= cw_len)
+				ratio -= cw_len;
 
-				if (!(smu[ro * num + k] && dmu[i]))
+			for (k = 0; k <= lmu[ro] >> 1; k++) {
+				if (!row[k])
 					continue;
-				a = readw_relaxed(index_of + dmu[i]);
-				b = readw_relaxed(index_of + dmu[ro]);
-				c = readw_relaxed(index_of + smu[ro * num + k]);
-				tmp = a + (cw_len - b) + c;
-				a = readw_relaxed(alpha_to + tmp % cw_len);
-				smu[(i + 1) * num + (k + diff)] = a;
+				tmp = ratio + index_of[row[k]];
+				if (tmp >= cw_len)
+					tmp -= cw_len;
+				next[k + diff] = alpha_to[tmp];
 			}
 
+			row = &smu[i * num];
 			for (k = 0; k <= lmu[i] >> 1; k++)
-				smu[(i + 1) * num + k] ^= smu[i * num + k];
+				next[k] ^= row[k];
 		}
 
 		/* End Computing Sigma (Mu+1) and L(mu) */
@@ -730,21 +886,17 @@ static void pmecc_get_sigma(struct mtd_info *mtd)
 		if (i >= cap)
 			continue;
 
-		for (k = 0; k <= (lmu[i + 1] >> 1); k++) {
-			tmp = 2 * (i - 1);
-			if (k == 0) {
-				dmu[i + 1] = si[tmp + 3];
-			} else if (smu[(i + 1) * num + k] && si[tmp + 3 - k]) {
-				int16_t a, b, c;
-				a = readw_relaxed(index_of +
-						smu[(i + 1) * num + k]);
-				b = si[2 * (i - 1) + 3 - k];
-				c = readw_relaxed(index_of + b);
-				tmp = a + c;
-				tmp %= cw_len;
-				dmu[i + 1] = readw_relaxed(alpha_to + tmp) ^
-					dmu[i + 1];
-			}
+		next = &smu[(i + 1) * num];
+		dmu[i + 1] = si[2 * i + 1];
+		for (k = 1; k <= (lmu[i + 1] >> 1); k++) {
+			int16_t b = si[2 * i + 1 - k];
+
+			if (!next[k] || !b)
+				continue;
+			tmp = index_of[next[k]] + index_of[b];
+			if (tmp >= cw_len)
+				tmp -= cw_len;
+			dmu[i + 1] ^= alpha_to[tmp];
 		}
 	}
 
@@ -849,7 +1001,7 @@ static void pmecc_correct_data(struct mtd_info *mtd, uint8_t *buf, uint8_t *ecc,
 }
 
 static int pmecc_correction(struct mtd_info *mtd, u32 pmecc_stat, uint8_t *buf,
-	u8 *ecc)
+	u8 *ecc, int sectors)
 {
 	struct nand_chip *nand_chip = mtd->priv;
 	struct atmel_nand_host *host = nand_chip->priv;
@@ -861,19 +1013,18 @@ static int pmecc_correction(struct mtd_info *mtd, u32 pmecc_stat, uint8_t *buf,
 	if (host->caps->pmecc_correct_erase_page)
 		goto normal_check;
 
-	for (i = 0; i < nand_chip->ecc.total; i++)
+	for (i = 0; i < sectors * nand_chip->ecc.bytes; i++)
 		if (ecc[i] != 0xff)
 			goto normal_check;
 	/* Erased page, return OK */
 	return 0;
 
 normal_check:
-	for (i = 0; i < nand_chip->ecc.steps; i++) {
+	for (i = 0; i < sectors; i++) {
 		err_nbr = 0;
-		if (pmecc_stat & 0x1) {
+		if ((pmecc_stat & 0x1) && pmecc_gen_syndrome(mtd, i)) {
 			buf_pos = buf + i * host->pmecc_sector_size;
 
-			pmecc_gen_syndrome(mtd, i);
 			pmecc_substitute(mtd);
 			pmecc_get_sigma(mtd);
 
@@ -919,6 +1070,24 @@ static void pmecc_enable(struct atmel_nand_host *host, int ecc_op)
 	pmecc_writel(host->ecc, CTRL, PMECC_CTRL_DATA);
 }
 
+static void nfc_read_ahead(struct atmel_nand_host *host, int page);
+
+static int pmecc_wait_ready(struct atmel_nand_host *host)
+{
+	unsigned long end_time;
+
+	end_time = jiffies + msecs_to_jiffies(PMECC_MAX_TIMEOUT_MS);
+	while ((pmecc_readl_relaxed(host->ecc, SR) & PMECC_SR_BUSY)) {
+		if (unlikely(time_after(jiffies, end_time))) {
+			dev_err(host->dev, "PMECC: Timeout to get error status.\n");
+			return -EIO;
+		}
+		cpu_relax();
+	}
+
+	return 0;
+}
+
 static int atmel_nand_pmecc_read_page(struct mtd_info *mtd,
 	struct nand_chip *chip, uint8_t *buf, int oob_required, int page)
 {
@@ -926,33 +1095,137 @@ static int atmel_nand_pmecc_read_page(struct mtd_info *mtd,
 	int eccsize = chip->ecc.size * chip->ecc.steps;
 	uint8_t *oob = chip->oob_poi;
 	uint32_t *eccpos = chip->ecc.layout->eccpos;
+	bool sram = host->nfc && host->nfc->use_nfc_sram;
 	uint32_t stat;
-	unsigned long end_time;
 	int bitflips = 0;
 
-	if (!host->nfc || !host->nfc->use_nfc_sram)
+	if (!sram) {
 		pmecc_enable(host, NAND_ECC_READ);
+	} else {
+		/*
+		 * The PMECC has seen the page on its way to SRAM. Unless it
+		 * is to be corrected, which needs the PMECC remainders, load
+		 * the next page while this one is copied.
+		 */
+		if (pmecc_wait_ready(host))
+			return -EIO;
+		stat = pmecc_readl_relaxed(host->ecc, ISR);
+		if (!stat)
+			nfc_read_ahead(host, page);
+	}
 
-	chip->read_buf(mtd, buf, eccsize);
-	chip->read_buf(mtd, oob, mtd->oobsize);
+	/*
+	 * When the page lands in the chip buffer the OOB area directly
+	 * follows the data, so fetch both with a single transfer.
+	 */
+	if (oob == buf + eccsize) {
+		chip->read_buf(mtd, buf, eccsize + mtd->oobsize);
+	} else {
+		chip->read_buf(mtd, buf, eccsize);
+		chip->read_buf(mtd, oob, mtd->oobsize);
+	}
+
+	if (!sram) {
+		if (pmecc_wait_ready(host))
+			return -EIO;
+		stat = pmecc_readl_relaxed(host->ecc, ISR);
+	}
+
+	if (stat != 0) {
+		bitflips = pmecc_correction(mtd, stat, buf, &oob[eccpos[0]],
+					    chip->ecc.steps);
+		if (sram)
+			nfc_read_ahead(host, page);
+		if (bitflips < 0)
+			/* uncorrectable errors */
+			return 0;
+	}
+
+	return bitflips;
+}
+
+/*
+ * Tell the PMECC how many sectors make up the data stream and where the
+ * ECC bytes sit in the spare stream that follows it.
+ */
+static void pmecc_set_layout(struct atmel_nand_host *host, int sectors,
+			     u32 sarea, u32 saddr, u32 eaddr)
+{
+	u32 val;
+
+	val = pmecc_readl_relaxed(host->ecc, CFG);
+	val &= ~PMECC_CFG_PAGE_SECTORS_MASK;
+	pmecc_writel(host->ecc, CFG, val | PMECC_CFG_PAGE_SECTORS(sectors));
+	pmecc_writel(host->ecc, SAREA, sarea);
+	pmecc_writel(host->ecc, SADDR, saddr);
+	pmecc_writel(host->ecc, EADDR, eaddr);
+}
+
+/*
+ * Read and correct only the sectors covering [data_offs, data_offs +
+ * readlen). The PMECC is set up for a shorter "page" made of those
+ * sectors, and a column change right after the data feeds it their ECC
+ * bytes in place of a full spare area. It only handles 1, 2, 4 or 8
+ * sectors, so the run is widened to a power of two.
+ */
+static int atmel_nand_pmecc_read_subpage(struct mtd_info *mtd,
+		struct nand_chip *chip, uint32_t data_offs, uint32_t readlen,
+		uint8_t *buf, int page)
+{
+	struct atmel_nand_host *host = chip->priv;
+	struct nand_ecclayout *layout = chip->ecc.layout;
+	int start, sectors, ecc_len, eccpos;
+	uint32_t stat;
+	unsigned long end_time;
+	int bitflips = 0;
+
+	start = data_offs / chip->ecc.size;
+	sectors = roundup_pow_of_two((data_offs + readlen - 1) /
+				     chip->ecc.size - start + 1);
+	if (start + sectors > chip->ecc.steps)
+		start = chip->ecc.steps - sectors;
+
+	ecc_len = sectors * chip->ecc.bytes;
+	eccpos = layout->eccpos[start * chip->ecc.bytes];
+
+	/* A 16-bit bus cannot start or end a transfer on an odd column */
+	if ((chip->options & NAND_BUSWIDTH_16) && ((eccpos | ecc_len) & 1))
+		return chip->ecc.read_page(mtd, chip, buf, 0, page);
+
+	pmecc_set_layout(host, sectors, ecc_len - 1, 0, ecc_len - 1);
+	pmecc_enable(host, NAND_ECC_READ);
+
+	if (start)
+		chip->cmdfunc(mtd, NAND_CMD_RNDOUT, start * chip->ecc.size, -1);
+	chip->read_buf(mtd, buf + start * chip->ecc.size,
+		       sectors * chip->ecc.size);
+
+	chip->cmdfunc(mtd, NAND_CMD_RNDOUT, mtd->writesize + eccpos, -1);
+	chip->read_buf(mtd, chip->oob_poi + eccpos, ecc_len);
 
 	end_time = jiffies + msecs_to_jiffies(PMECC_MAX_TIMEOUT_MS);
 	while ((pmecc_readl_relaxed(host->ecc, SR) & PMECC_SR_BUSY)) {
 		if (unlikely(time_after(jiffies, end_time))) {
 			dev_err(host->dev, "PMECC: Timeout to get error status.\n");
-			return -EIO;
+			bitflips = -EIO;
+			goto out;
 		}
 		cpu_relax();
 	}
 
 	stat = pmecc_readl_relaxed(host->ecc, ISR);
 	if (stat != 0) {
-		bitflips = pmecc_correction(mtd, stat, buf, &oob[eccpos[0]]);
+		bitflips = pmecc_correction(mtd, stat,
+					    buf + start * chip->ecc.size,
+					    chip->oob_poi + eccpos, sectors);
 		if (bitflips < 0)
 			/* uncorrectable errors */
-			return 0;
+			bitflips = 0;
 	}
 
+out:
+	pmecc_set_layout(host, chip->ecc.steps, mtd->oobsize - 1,
+			 layout->eccpos[0], layout->eccpos[layout->eccbytes - 1]);
 	return bitflips;
 }
 
@@ -1146,6 +1419,41 @@ static int build_gf_tables(int mm, unsigned int poly,
 	return 0;
 }
 
+/*
+ * The decoder walks these tables at random for every flagged sector.
+ * They go to the on-chip SRAM when the device tree gives the NAND
+ * controller a quota of it, which has no wait state and no cache to miss,
+ * or else to RAM so that the lookups hit the cache.
+ */
+static void *pmecc_table_alloc(struct device *dev, size_t size)
+{
+	struct gen_pool *pool;
+	void *addr = NULL;
+
+	pool = devm_atmel_sram_pool(dev, size);
+	if (pool)
+		addr = devm_atmel_sram_alloc(dev, pool, size, NULL);
+	if (!addr)
+		addr = devm_kmalloc(dev, size, GFP_KERNEL);
+
+	return addr;
+}
+
+static int16_t *copy_lookup_table(struct device *dev, void __iomem *rom,
+				  int sector_size)
+{
+	int table_size = (sector_size == 512) ?
+			PMECC_LOOKUP_TABLE_SIZE_512 :
+			PMECC_LOOKUP_TABLE_SIZE_1024;
+	int16_t *addr = pmecc_table_alloc(dev,
+					  2 * table_size * sizeof(uint16_t));
+
+	if (addr)
+		memcpy_fromio(addr, rom, 2 * table_size * sizeof(uint16_t));
+
+	return addr;
+}
+
 static uint16_t *create_lookup_table(struct device *dev, int sector_size)
 {
 	int degree = (sector_size == 512) ?
@@ -1158,9 +1466,14 @@ static uint16_t *create_lookup_table(struct device *dev, int sector_size)
 			PMECC_LOOKUP_TABLE_SIZE_512 :
 			PMECC_LOOKUP_TABLE_SIZE_1024;
 
-	int16_t *addr = devm_kzalloc(dev, 2 * table_size * sizeof(uint16_t),
-			GFP_KERNEL);
-	if (addr && build_gf_tables(degree, poly, addr, addr + table_size))
+	int16_t *addr = pmecc_table_alloc(dev,
+					  2 * table_size * sizeof(uint16_t));
+
+	if (!addr)
+		return NULL;
+
+	memset(addr, 0, 2 * table_size * sizeof(uint16_t));
+	if (build_gf_tables(degree, poly, addr, addr + table_size))
 		return NULL;
 
 	return addr;
@@ -1172,8 +1485,8 @@ static int atmel_pmecc_nand_init_params(struct platform_device *pdev,
 	struct mtd_info *mtd = &host->mtd;
 	struct nand_chip *nand_chip = &host->nand_chip;
 	struct resource *regs, *regs_pmerr, *regs_rom;
-	uint16_t *galois_table;
-	int cap, sector_size, err_no;
+	int16_t *galois_table;
+	int cap, sector_size, table_size, err_no;
 
 	err_no = pmecc_choose_ecc(host, &cap, &sector_size);
 	if (err_no) {
@@ -1229,15 +1542,21 @@ static int atmel_pmecc_nand_init_params(struct platform_device *pdev,
 
 	if (host->has_no_lookup_table) {
 		/* Build the look-up table in runtime */
-		galois_table = create_lookup_table(host->dev, sector_size);
+		galois_table = (int16_t *)create_lookup_table(host->dev,
+							      sector_size);
 		if (!galois_table) {
 			dev_err(host->dev, "Failed to build a lookup table in runtime!\n");
 			err_no = -EINVAL;
 			goto err;
 		}
-
-		host->pmecc_rom_base = (void __iomem *)galois_table;
-		host->pmecc_lookup_table_offset = 0;
+	} else {
+		galois_table = copy_lookup_table(host->dev,
+				host->pmecc_rom_base +
+				host->pmecc_lookup_table_offset, sector_size);
+		if (!galois_table) {
+			err_no = -ENOMEM;
+			goto err;
+		}
 	}
 
 	nand_chip->ecc.size = sector_size;
@@ -1258,9 +1577,11 @@ static int atmel_pmecc_nand_init_params(struct platform_device *pdev,
 		host->pmecc_degree = (sector_size == 512) ?
 			PMECC_GF_DIMENSION_13 : PMECC_GF_DIMENSION_14;
 		host->pmecc_cw_len = (1 << host->pmecc_degree) - 1;
-		host->pmecc_alpha_to = pmecc_get_alpha_to(host);
-		host->pmecc_index_of = host->pmecc_rom_base +
-			host->pmecc_lookup_table_offset;
+		table_size = (sector_size == 512) ?
+			PMECC_LOOKUP_TABLE_SIZE_512 :
+			PMECC_LOOKUP_TABLE_SIZE_1024;
+		host->pmecc_index_of = galois_table;
+		host->pmecc_alpha_to = galois_table + table_size;
 
 		nand_chip->ecc.strength = cap;
 		nand_chip->ecc.bytes = pmecc_get_ecc_bytes(cap, sector_size);
@@ -1298,6 +1619,7 @@ static int atmel_pmecc_nand_init_params(struct platform_device *pdev,
 
 	nand_chip->options |= NAND_NO_SUBPAGE_WRITE;
 	nand_chip->ecc.read_page = atmel_nand_pmecc_read_page;
+	nand_chip->ecc.read_subpage = atmel_nand_pmecc_read_subpage;
 	nand_chip->ecc.write_page = atmel_nand_pmecc_write_page;
 
 	atmel_pmecc_core_init(mtd);
@@ -1505,6 +1827,7 @@ static int atmel_of_init_port(struct atmel_nand_host *host,
 	u32 val;
 	u32 offset[2];
 	int ecc_mode;
+	int i, n;
 	struct atmel_nand_data *board = &host->board;
 	enum of_gpio_flags flags = 0;
 
@@ -1544,8 +1867,42 @@ static int atmel_of_init_port(struct atmel_nand_host *host,
 	board->enable_pin = of_get_gpio(np, 1);
 	board->det_pin = of_get_gpio(np, 2);
 
+	/* Further dies on the same bus, as <ce rdy> pairs */
+	n = of_gpio_named_count(np, "atmel,nand-die-gpios");
+	if (n > 0) {
+		if (n % 2) {
+			dev_err(host->dev, "atmel,nand-die-gpios needs <ce rdy> pairs\n");
+			return -EINVAL;
+		}
+
+		host->num_dies = n / 2;
+		host->dies = devm_kcalloc(host->dev, host->num_dies,
+					  sizeof(*host->dies), GFP_KERNEL);
+		if (!host->dies)
+			return -ENOMEM;
+
+		for (i = 0; i < host->num_dies; i++) {
+			host->dies[i].ce_pin = of_get_named_gpio(np,
+					"atmel,nand-die-gpios", 2 * i);
+			host->dies[i].rdy_pin = of_get_named_gpio(np,
+					"atmel,nand-die-gpios", 2 * i + 1);
+		}
+	}
+
 	host->has_pmecc = of_property_read_bool(np, "atmel,has-pmecc");
 
+	host->smc = syscon_regmap_lookup_by_phandle(np, "atmel,smc");
+	if (IS_ERR(host->smc)) {
+		host->smc = NULL;
+	} else {
+		if (of_property_read_u32(np, "atmel,smc-cs", &host->smc_cs))
+			host->smc_cs = 3;	/* EBI NAND chip select */
+		if (of_property_read_u32(np, "atmel,onfi-max-timing-mode",
+					 &val))
+			val = 5;
+		host->max_timing_mode = min_t(u32, val, 5);
+	}
+
 	/* load the nfc driver if there is */
 	of_platform_populate(np, NULL, NULL, host->dev);
 
@@ -1659,6 +2016,132 @@ static int atmel_hw_nand_init_params(struct platform_device *pdev,
 	return 0;
 }
 
+static u32 atmel_nand_ps_to_cycles(u32 ps, u32 period_ns)
+{
+	return DIV_ROUND_UP(DIV_ROUND_UP(ps, 1000), period_ns);
+}
+
+/*
+ * Program the SMC for the given ONFI SDR timings. NCS is held for the
+ * whole cycle and NWE/NRD are placed inside it:
+ *  - write: CLE, ALE, CS and data must be set up before NWE rises and
+ *    held past it, within tWC;
+ *  - read: the data is sampled on the NRD rising edge, so the pulse
+ *    has to cover tREA and tCEA, within tRC.
+ * The atmel-smc encoders divide nanoseconds by the same rounded-up
+ * period used here, so the cycle counts are handed over unchanged.
+ */
+static void atmel_nand_smc_set_timings(struct atmel_nand_host *host,
+				       const struct nand_sdr_timings *t,
+				       unsigned long rate)
+{
+	u32 period = DIV_ROUND_UP(NSEC_PER_SEC, rate);
+	u32 base = host->caps->smc_generic +
+		   host->smc_cs * host->caps->smc_blk_sz;
+	u32 nwe_setup, nwe_pulse, nwe_hold, nwe_cycle;
+	u32 nrd_pulse, nrd_cycle;
+
+	nwe_pulse = atmel_nand_ps_to_cycles(t->tWP_min, period);
+	nwe_setup = atmel_nand_ps_to_cycles(max(max(t->tCLS_min, t->tALS_min),
+						max(t->tCS_min, t->tDS_min)),
+					    period);
+	nwe_setup = nwe_setup > nwe_pulse ? nwe_setup - nwe_pulse : 0;
+	nwe_hold = atmel_nand_ps_to_cycles(max(max(t->tWH_min, t->tCLH_min),
+					       max(t->tALH_min,
+						   max(t->tCH_min, t->tDH_min))),
+					   period);
+	nwe_cycle = max(atmel_nand_ps_to_cycles(t->tWC_min, period),
+			nwe_setup + nwe_pulse + nwe_hold);
+
+	nrd_pulse = atmel_nand_ps_to_cycles(max(t->tRP_min,
+						max(t->tREA_max, t->tCEA_max)),
+					    period);
+	nrd_cycle = max(atmel_nand_ps_to_cycles(t->tRC_min, period),
+			nrd_pulse +
+			atmel_nand_ps_to_cycles(t->tREH_min, period));
+
+	regmap_write(host->smc, AT91SAM9_SMC_SETUP(base),
+		AT91SAM9_SMC_NWESETUP(at91sam9_smc_setup_ns_to_cycles(rate,
+							nwe_setup * period)));
+	regmap_write(host->smc, AT91SAM9_SMC_PULSE(base),
+		AT91SAM9_SMC_NWEPULSE(at91sam9_smc_pulse_ns_to_cycles(rate,
+							nwe_pulse * period)) |
+		AT91SAM9_SMC_NCS_WRPULSE(at91sam9_smc_pulse_ns_to_cycles(rate,
+							nwe_cycle * period)) |
+		AT91SAM9_SMC_NRDPULSE(at91sam9_smc_pulse_ns_to_cycles(rate,
+							nrd_pulse * period)) |
+		AT91SAM9_SMC_NCS_NRDPULSE(at91sam9_smc_pulse_ns_to_cycles(rate,
+							nrd_cycle * period)));
+	regmap_write(host->smc, AT91SAM9_SMC_CYCLE(base),
+		AT91SAM9_SMC_NWECYCLE(at91sam9_smc_cycle_ns_to_cycles(rate,
+							nwe_cycle * period)) |
+		AT91SAM9_SMC_NRDCYCLE(at91sam9_smc_cycle_ns_to_cycles(rate,
+							nrd_cycle * period)));
+
+	dev_dbg(host->dev, "SMC: nwe %u/%u/%u nrd %u/%u cycles of %u ns\n",
+		nwe_setup, nwe_pulse, nwe_cycle, nrd_pulse, nrd_cycle, period);
+}
+
+/*
+ * Switch the chip to the fastest ONFI asynchronous timing mode it
+ * supports, up to the DT limit, and retune the SMC to match. Without
+ * an SMC syscon, a known master clock or ONFI data, the timings set
+ * by the bootloader are left alone.
+ */
+static void atmel_nand_onfi_timings(struct atmel_nand_host *host)
+{
+	struct nand_chip *chip = &host->nand_chip;
+	struct mtd_info *mtd = &host->mtd;
+	const struct nand_sdr_timings *t;
+	struct clk *mck = host->clk;
+	unsigned long rate;
+	int modes, mode, ret;
+
+	if (!host->smc)
+		return;
+
+	modes = onfi_get_async_timing_mode(chip);
+	if (modes == ONFI_TIMING_MODE_UNKNOWN)
+		return;
+	modes &= GENMASK(host->max_timing_mode, 0);
+	if (!modes)
+		return;
+	mode = fls(modes) - 1;
+
+	if (!mck) {
+		mck = devm_clk_get(host->dev, "mck");
+		if (IS_ERR(mck)) {
+			dev_info(host->dev, "no master clock, keeping NAND timings\n");
+			return;
+		}
+	}
+	rate = clk_get_rate(mck);
+	if (!rate)
+		return;
+
+	t = onfi_async_timing_mode_to_sdr_timings(mode);
+	if (IS_ERR(t))
+		return;
+
+	if (le16_to_cpu(chip->onfi_params.opt_cmd) &
+	    ONFI_OPT_CMD_SET_GET_FEATURES) {
+		u8 feature[ONFI_SUBFEATURE_PARAM_LEN] = { mode };
+
+		chip->select_chip(mtd, 0);
+		ret = chip->onfi_set_features(mtd, chip,
+				ONFI_FEATURE_ADDR_TIMING_MODE, feature);
+		chip->select_chip(mtd, -1);
+		if (ret) {
+			dev_warn(host->dev, "failed to select ONFI timing mode %d\n",
+				 mode);
+			return;
+		}
+	}
+
+	atmel_nand_smc_set_timings(host, t, rate);
+	dev_info(host->dev, "Using ONFI timing mode %d\n", mode);
+}
+
 static inline u32 nfc_read_status(struct atmel_nand_host *host)
 {
 	u32 err_flags = NFC_SR_DTOE | NFC_SR_UNDEF | NFC_SR_AWB | NFC_SR_ASE;
@@ -1783,6 +2266,11 @@ static int nfc_send_command(struct atmel_nand_host *host,
 	nfc_prepare_interrupt(host, flag);
 	nfc_writel(host->nfc->hsmc_regs, CYCLE0, cycle0);
 	nfc_cmd_addr1234_writel(cmd, addr, host->nfc->base_cmd_regs);
+
+	/* A read-ahead transfer is waited for by nfc_read_ahead_wait() */
+	if (host->nfc->read_ahead_nowait)
+		flag &= ~NFC_SR_XFR_DONE;
+
 	return nfc_wait_interrupt(host, flag);
 }
 
@@ -1854,6 +2342,113 @@ static int nfc_make_addr(struct mtd_info *mtd, int command, int column,
 	return acycle << NFCADDR_CMD_ACYCLE_BIT_POS;
 }
 
+static bool nfc_same_block(struct nand_chip *chip, int page, int next)
+{
+	int shift = chip->phys_erase_shift - chip->page_shift;
+
+	return (page >> shift) == (next >> shift);
+}
+
+/* Leave cache read mode; the preloaded page is simply dropped */
+static void nfc_cache_read_end(struct atmel_nand_host *host)
+{
+	unsigned int cmd = (NAND_CMD_READCACHEEND << NFCADDR_CMD_CMD1_BIT_POS) |
+		NFCADDR_CMD_ACYCLE_NONE | NFCADDR_CMD_CSID_3 |
+		NFCADDR_CMD_DATADIS | NFCADDR_CMD_NFCRD;
+
+	nfc_send_command(host, cmd, 0, 0);
+	nfc_prepare_interrupt(host, NFC_SR_RB_EDGE);
+	nfc_wait_interrupt(host, NFC_SR_RB_EDGE);
+	host->nfc->cache_read_page = -1;
+}
+
+/*
+ * Sequential cache read: READ CACHE SEQUENTIAL moves the page in the
+ * data register to the cache register, which the NFC then copies to
+ * SRAM, while the array already loads the following page. Once a
+ * multi-page read gets going, every page after the first costs only a
+ * short cache busy time instead of a full tR.
+ *
+ * Returns true and sets @cmd1 when @page is to be fetched with a cache
+ * command carrying no address cycles, false for a regular READ0.
+ */
+static bool nfc_cache_read(struct atmel_nand_host *host, int page,
+			   unsigned int *cmd1)
+{
+	struct atmel_nfc *nfc = host->nfc;
+	struct nand_chip *chip = &host->nand_chip;
+	unsigned int cmd, addr1234 = 0, cycle0 = 0;
+	bool more;
+
+	more = page < nfc->cache_read_last &&
+		nfc_same_block(chip, page, page + 1);
+
+	if (nfc->cache_read_page == page) {
+		*cmd1 = (more ? NAND_CMD_READCACHESEQ : NAND_CMD_READCACHEEND)
+			<< NFCADDR_CMD_CMD1_BIT_POS;
+		nfc->cache_read_page = more ? page + 1 : -1;
+		return true;
+	}
+
+	if (nfc->cache_read_page >= 0)
+		nfc_cache_read_end(host);
+
+	if (!more)
+		return false;
+
+	/* Load @page into the data register, then start the pipeline */
+	cmd = (NAND_CMD_READ0 << NFCADDR_CMD_CMD1_BIT_POS) |
+		(NAND_CMD_READSTART << NFCADDR_CMD_CMD2_BIT_POS) |
+		NFCADDR_CMD_VCMD2 | NFCADDR_CMD_CSID_3 |
+		NFCADDR_CMD_DATADIS | NFCADDR_CMD_NFCRD;
+	cmd |= nfc_make_addr(&host->mtd, NAND_CMD_READ0, 0, page,
+			     &addr1234, &cycle0);
+	nfc_send_command(host, cmd, addr1234, cycle0);
+	nfc_prepare_interrupt(host, NFC_SR_RB_EDGE);
+	nfc_wait_interrupt(host, NFC_SR_RB_EDGE);
+
+	*cmd1 = NAND_CMD_READCACHESEQ << NFCADDR_CMD_CMD1_BIT_POS;
+	nfc->cache_read_page = page + 1;
+	return true;
+}
+
+/*
+ * Double-banked read-ahead: once the PMECC is done with a page, the next
+ * page of the read is loaded into the other SRAM bank while the CPU
+ * copies, and corrects if needed, the current one. The NAND array and
+ * bus time of the next page then overlaps the copy and ECC work.
+ */
+static void nfc_read_ahead(struct atmel_nand_host *host, int page)
+{
+	struct atmel_nfc *nfc = host->nfc;
+	void *data_in_sram = nfc->data_in_sram;
+	int next = page + 1;
+
+	if (!nfc->has_read_ahead || nfc->read_ahead_page >= 0 ||
+	    page < 0 || next > nfc->cache_read_last)
+		return;
+
+	nfc_set_sram_bank(host, !nfc_get_sram_off(host));
+
+	nfc->read_ahead_nowait = true;
+	host->nand_chip.cmdfunc(&host->mtd, NAND_CMD_READ0, 0, next);
+	nfc->read_ahead_nowait = false;
+
+	nfc->read_ahead_sram = nfc->data_in_sram;
+	nfc->data_in_sram = data_in_sram;
+	nfc->read_ahead_page = next;
+}
+
+/* Wait for the read-ahead page to be in SRAM */
+static int nfc_read_ahead_wait(struct atmel_nand_host *host)
+{
+	struct atmel_nfc *nfc = host->nfc;
+
+	nfc->read_ahead_page = -1;
+
+	return nfc_wait_interrupt(host, NFC_SR_XFR_DONE);
+}
+
 static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 				int column, int page_addr)
 {
@@ -1879,6 +2474,26 @@ static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 	dev_dbg(host->dev, "%s: cmd = 0x%02x, col = 0x%08x, page = 0x%08x\n",
 	     __func__, command, column, page_addr);
 
+	/* Anything but reading the page loaded ahead waits for it: drop it */
+	if (host->nfc->read_ahead_page >= 0) {
+		bool hit = command == NAND_CMD_READ0 && !column &&
+			page_addr == host->nfc->read_ahead_page;
+
+		if (!nfc_read_ahead_wait(host) && hit) {
+			host->nfc->data_in_sram = host->nfc->read_ahead_sram;
+			return;
+		}
+	}
+
+	/*
+	 * Column changes and status reads are fine while a cache read is
+	 * in flight, anything else but the next READ0 ends it first.
+	 */
+	if (host->nfc->has_cache_read && host->nfc->cache_read_page >= 0 &&
+	    command != NAND_CMD_READ0 && command != NAND_CMD_RNDOUT &&
+	    command != NAND_CMD_STATUS)
+		nfc_cache_read_end(host);
+
 	switch (command) {
 	case NAND_CMD_RESET:
 		nfc_addr_cmd = cmd1 | acycle | csid | dataen | nfcwr;
@@ -1898,6 +2513,10 @@ static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 	case NAND_CMD_STATUS:
 		do_addr = false;
 		break;
+	case NAND_CMD_SET_FEATURES:
+		nfcwr = NFCADDR_CMD_NFCWR;
+		/* fall through */
+	case NAND_CMD_GET_FEATURES:
 	case NAND_CMD_PARAM:
 	case NAND_CMD_READID:
 		do_addr = false;
@@ -1920,6 +2539,10 @@ static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 			/* Enable Data transfer to sram */
 			dataen = NFCADDR_CMD_DATAEN;
 
+			if (host->nfc->has_cache_read && !column &&
+			    nfc_cache_read(host, page_addr, &cmd1))
+				do_addr = false;
+
 			/* Need enable PMECC now, since NFC will transfer
 			 * data in bus after sending nfc read command.
 			 */
@@ -1927,10 +2550,13 @@ static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 				pmecc_enable(host, NAND_ECC_READ);
 		}
 
-		cmd2 = NAND_CMD_READSTART << NFCADDR_CMD_CMD2_BIT_POS;
-		vcmd2 = NFCADDR_CMD_VCMD2;
+		if (do_addr) {
+			cmd2 = NAND_CMD_READSTART << NFCADDR_CMD_CMD2_BIT_POS;
+			vcmd2 = NFCADDR_CMD_VCMD2;
+		}
 		break;
 	/* For prgramming command, the cmd need set to write enable */
+	case NAND_CMD_CACHEDPROG:
 	case NAND_CMD_PAGEPROG:
 	case NAND_CMD_SEQIN:
 	case NAND_CMD_RNDIN:
@@ -1963,6 +2589,7 @@ static void nfc_nand_command(struct mtd_info *mtd, unsigned int command,
 	case NAND_CMD_RNDOUT:
 	case NAND_CMD_SEQIN:
 	case NAND_CMD_READID:
+	case NAND_CMD_SET_FEATURES:
 		return;
 
 	case NAND_CMD_READ0:
@@ -2029,7 +2656,17 @@ static int nfc_sram_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 	if (status < 0)
 		return status;
 
-	chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
+	/*
+	 * Cache program only waits for the cache register to free up,
+	 * the array keeps programming while the next page is loaded.
+	 * Failures show up in the status with a one page delay, and the
+	 * final PAGEPROG of the sequence waits for the array to finish.
+	 */
+	if (cached && NAND_HAS_CACHEPROG(chip) &&
+	    nfc_same_block(chip, page, page + 1))
+		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
+	else
+		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
 	status = chip->waitfunc(mtd, chip);
 
 	if ((status & NAND_STATUS_FAIL) && (chip->errstat))
@@ -2086,6 +2723,21 @@ static int nfc_sram_init(struct mtd_info *mtd)
 	host->nfc->will_write_sram = false;
 	nfc_set_sram_bank(host, 0);
 
+	host->nfc->cache_read_page = -1;
+	host->nfc->cache_read_last = -1;
+	host->nfc->read_ahead_page = -1;
+	/* Only pages up to 2k fit in one of the two banks */
+	host->nfc->has_read_ahead = mtd->writesize <= 2048 &&
+		chip->ecc.mode == NAND_ECC_HW && host->has_pmecc;
+	if (chip->onfi_version) {
+		u16 opt_cmd = le16_to_cpu(chip->onfi_params.opt_cmd);
+
+		host->nfc->has_cache_read = opt_cmd & ONFI_OPT_CMD_READ_CACHE;
+		if (host->nfc->write_by_sram &&
+		    (opt_cmd & ONFI_OPT_CMD_CACHE_PROG))
+			chip->options |= NAND_CACHEPRG;
+	}
+
 	/* Use Write page with NFC SRAM only for PMECC or ECC NONE. */
 	if (host->nfc->write_by_sram) {
 		if ((chip->ecc.mode == NAND_ECC_HW && host->has_pmecc) ||
@@ -2100,6 +2752,152 @@ static int nfc_sram_init(struct mtd_info *mtd)
 	return 0;
 }
 
+/*
+ * Record where a read ends so that nfc_nand_command() only starts a
+ * cache read pipeline when the next page is actually wanted.
+ */
+static int nfc_cache_mtd_read(struct mtd_info *mtd, loff_t from, size_t len,
+			      size_t *retlen, u_char *buf)
+{
+	struct nand_chip *chip = mtd->priv;
+	struct atmel_nand_host *host = chip->priv;
+	int ret;
+
+	host->nfc->cache_read_last = ((from + len - 1) >> chip->page_shift) &
+		chip->pagemask;
+	ret = host->nfc->mtd_read(mtd, from, len, retlen, buf);
+	host->nfc->cache_read_last = -1;
+
+	/* The read may have stopped short of a page loaded ahead */
+	if (host->nfc->read_ahead_page >= 0)
+		nfc_read_ahead_wait(host);
+
+	return ret;
+}
+
+/* Request the extra dies' lines and switch to bus handover mode */
+static int atmel_nand_init_dies(struct atmel_nand_host *host)
+{
+	struct nand_chip *chip = &host->nand_chip;
+	int i, res;
+
+	if (!gpio_is_valid(host->board.rdy_pin)) {
+		dev_err(host->dev, "multiple dies need a ready pin per die\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < host->num_dies; i++) {
+		struct atmel_nand_die *die = &host->dies[i];
+
+		if (!gpio_is_valid(die->ce_pin) ||
+		    !gpio_is_valid(die->rdy_pin)) {
+			dev_err(host->dev, "invalid gpios for die %d\n", i + 1);
+			return -EINVAL;
+		}
+
+		res = devm_gpio_request_one(host->dev, die->ce_pin,
+					    GPIOF_OUT_INIT_HIGH, "nand_ce");
+		if (res < 0)
+			return res;
+
+		res = devm_gpio_request_one(host->dev, die->rdy_pin,
+					    GPIOF_IN, "nand_rdy");
+		if (res < 0)
+			return res;
+	}
+
+	mutex_init(&host->bus_lock);
+	chip->select_chip = atmel_nand_select_die;
+	chip->waitfunc = atmel_nand_die_wait;
+
+	return 0;
+}
+
+static void atmel_nand_release_dies(struct atmel_nand_host *host, int num)
+{
+	while (num--)
+		nand_release(&host->dies[num].mtd);
+}
+
+/*
+ * Scan the extra dies, which must be copies of the first one, give them
+ * the same ECC setup and glue everything into a single MTD device.
+ */
+static int atmel_nand_scan_dies(struct atmel_nand_host *host)
+{
+	struct nand_chip *first = &host->nand_chip;
+	struct mtd_info **subdev;
+	int i, res;
+
+	subdev = devm_kcalloc(host->dev, host->num_dies + 1, sizeof(*subdev),
+			      GFP_KERNEL);
+	if (!subdev)
+		return -ENOMEM;
+	subdev[0] = &host->mtd;
+
+	for (i = 0; i < host->num_dies; i++) {
+		struct atmel_nand_die *die = &host->dies[i];
+		struct nand_chip *chip = &die->nand_chip;
+		struct mtd_info *mtd = &die->mtd;
+
+		chip->priv = host;
+		mtd->priv = chip;
+		mtd->owner = THIS_MODULE;
+		mtd->name = host->mtd.name;
+
+		chip->IO_ADDR_R = first->IO_ADDR_R;
+		chip->IO_ADDR_W = first->IO_ADDR_W;
+		chip->cmd_ctrl = first->cmd_ctrl;
+		chip->dev_ready = atmel_nand_device_ready;
+		chip->select_chip = atmel_nand_select_die;
+		chip->waitfunc = atmel_nand_die_wait;
+		chip->read_buf = first->read_buf;
+		chip->write_buf = first->write_buf;
+		chip->chip_delay = first->chip_delay;
+		chip->options = first->options & NAND_BUSWIDTH_16;
+		chip->bbt_options = first->bbt_options;
+
+		if (nand_scan_ident(mtd, 1, NULL)) {
+			res = -ENXIO;
+			goto err;
+		}
+
+		if (mtd->size != host->mtd.size ||
+		    mtd->writesize != host->mtd.writesize ||
+		    mtd->oobsize != host->mtd.oobsize) {
+			dev_err(host->dev, "die %d differs from the first one\n",
+				i + 1);
+			res = -EINVAL;
+			goto err;
+		}
+
+		chip->ecc = first->ecc;
+		chip->options |= first->options & (NAND_NO_SUBPAGE_WRITE |
+				NAND_SUBPAGE_READ | NAND_USE_BOUNCE_BUFFER);
+
+		if (nand_scan_tail(mtd)) {
+			res = -ENXIO;
+			goto err;
+		}
+		subdev[i + 1] = mtd;
+	}
+
+	host->concat = mtd_concat_create(subdev, host->num_dies + 1,
+					 host->mtd.name);
+	if (!host->concat) {
+		res = -ENOMEM;
+		goto err;
+	}
+
+	dev_info(host->dev, "%d dies, interleaving busy periods\n",
+		 host->num_dies + 1);
+	return 0;
+
+err:
+	atmel_nand_release_dies(host, i);
+	return res;
+}
+
 static struct platform_driver atmel_nand_nfc_driver;
 /*
  * Probe for the NAND device.
@@ -2187,12 +2985,23 @@ static int atmel_nand_probe(struct platform_device *pdev)
 				irq);
 			goto err_nand_ioremap;
 		}
+
+		if (host->num_dies) {
+			dev_warn(&pdev->dev, "extra dies are not supported through the NFC\n");
+			host->num_dies = 0;
+		}
 	} else {
 		res = atmel_nand_set_enable_ready_pins(mtd);
 		if (res)
 			goto err_nand_ioremap;
 
 		nand_chip->cmd_ctrl = atmel_nand_cmd_ctrl;
+
+		if (host->num_dies) {
+			res = atmel_nand_init_dies(host);
+			if (res)
+				goto err_nand_ioremap;
+		}
 	}
 
 	nand_chip->ecc.mode = host->board.ecc_mode;
@@ -2263,6 +3072,18 @@ static int atmel_nand_probe(struct platform_device *pdev)
 		goto err_scan_ident;
 	}
 
+	/*
+	 * UBI hands us vmalloc'ed buffers which cannot be DMA mapped; let
+	 * the core bounce those through its own page buffer so the data
+	 * still moves by DMA. This flag shares its bit with
+	 * NAND_BUSWIDTH_AUTO, hence it is only set once identification
+	 * is over.
+	 */
+	if (use_dma)
+		nand_chip->options |= NAND_USE_BOUNCE_BUFFER;
+
+	atmel_nand_onfi_timings(host);
+
 	if (nand_chip->ecc.mode == NAND_ECC_HW) {
 		if (host->has_pmecc)
 			res = atmel_pmecc_nand_init_params(pdev, host);
@@ -2282,19 +3103,48 @@ static int atmel_nand_probe(struct platform_device *pdev)
 		}
 	}
 
+	/*
+	 * The NFC always moves whole pages into its SRAM, so subpage reads
+	 * only pay off when the data is clocked out of the NAND directly.
+	 */
+	if (nand_chip->ecc.mode == NAND_ECC_HW && host->has_pmecc &&
+	    !(host->nfc && host->nfc->use_nfc_sram))
+		nand_chip->options |= NAND_SUBPAGE_READ;
+
 	/* second phase scan */
 	if (nand_scan_tail(mtd)) {
 		res = -ENXIO;
 		goto err_scan_tail;
 	}
 
+	if (host->nfc && host->nfc->use_nfc_sram &&
+	    (host->nfc->has_cache_read || host->nfc->has_read_ahead)) {
+		host->nfc->mtd_read = mtd->_read;
+		mtd->_read = nfc_cache_mtd_read;
+		dev_info(host->dev, "Using NFC %s\n",
+			 host->nfc->has_cache_read ?
+			 "cache read" : "SRAM bank read-ahead");
+	}
+
 	mtd->name = "atmel_nand";
+
+	if (host->num_dies) {
+		res = atmel_nand_scan_dies(host);
+		if (res)
+			goto err_scan_tail;
+		mtd = host->concat;
+	}
+
 	ppdata.of_node = pdev->dev.of_node;
 	res = mtd_device_parse_register(mtd, NULL, &ppdata,
 			host->board.parts, host->board.num_parts);
 	if (!res)
 		return res;
 
+	if (host->concat) {
+		mtd_concat_destroy(host->concat);
+		atmel_nand_release_dies(host, host->num_dies);
+	}
 err_scan_tail:
 	if (host->has_pmecc && host->nand_chip.ecc.mode == NAND_ECC_HW)
 		pmecc_writel(host->ecc, CTRL, PMECC_CTRL_DISABLE);
@@ -2316,6 +3166,12 @@ static int atmel_nand_remove(struct platform_device *pdev)
 	struct atmel_nand_host *host = platform_get_drvdata(pdev);
 	struct mtd_info *mtd = &host->mtd;
 
+	if (host->concat) {
+		mtd_device_unregister(host->concat);
+		mtd_concat_destroy(host->concat);
+		atmel_nand_release_dies(host, host->num_dies);
+	}
+
 	nand_release(mtd);
 
 	atmel_nand_disable(host);
@@ -2346,18 +3202,24 @@ static struct atmel_nand_caps at91rm9200_caps = {
 	.pmecc_correct_erase_page = false,
 	.pmecc_max_correction = 24,
 	.has_hsmc_clk = false,
+	.smc_generic = AT91SAM9_SMC_GENERIC,
+	.smc_blk_sz = AT91SAM9_SMC_GENERIC_BLK_SZ,
 };
 
 static struct atmel_nand_caps sama5d3_caps = {
 	.pmecc_correct_erase_page = false,
 	.pmecc_max_correction = 24,
 	.has_hsmc_clk = true,
+	.smc_generic = SAMA5_SMC_GENERIC,
+	.smc_blk_sz = SAMA5_SMC_GENERIC_BLK_SZ,
 };
 
 static struct atmel_nand_caps sama5d4_caps = {
 	.pmecc_correct_erase_page = true,
 	.pmecc_max_correction = 24,
 	.has_hsmc_clk = true,
+	.smc_generic = SAMA5_SMC_GENERIC,
+	.smc_blk_sz = SAMA5_SMC_GENERIC_BLK_SZ,
 };
 
 /*
@@ -2368,6 +3230,8 @@ static const struct atmel_nand_caps sama5d2_caps = {
 	.pmecc_correct_erase_page = true,
 	.pmecc_max_correction = 32,
 	.has_hsmc_clk = true,
+	.smc_generic = SAMA5_SMC_GENERIC,
+	.smc_blk_sz = SAMA5_SMC_GENERIC_BLK_SZ,
 };
 
 static const struct of_device_id atmel_nand_dt_ids[] = {
@@ -2442,6 +3306,7 @@ static struct platform_driver atmel_nand_driver = {
 	.driver		= {
 		.name	= "atmel_nand",
 		.of_match_table	= of_match_ptr(atmel_nand_dt_ids),
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
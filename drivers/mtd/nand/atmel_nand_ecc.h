@@ -52,6 +52,8 @@
 #define		PMECC_CFG_PAGE_2SECTORS		(1 << 8)
 #define		PMECC_CFG_PAGE_4SECTORS		(2 << 8)
 #define		PMECC_CFG_PAGE_8SECTORS		(3 << 8)
+#define		PMECC_CFG_PAGE_SECTORS_MASK	(3 << 8)
+#define		PMECC_CFG_PAGE_SECTORS(n)	(ilog2(n) << 8)
 
 #define		PMECC_CFG_READ_OP		(0 << 12)
 #define		PMECC_CFG_WRITE_OP		(1 << 12)
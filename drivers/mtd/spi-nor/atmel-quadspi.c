@@ -25,8 +25,11 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
 #include <linux/err.h>
 #include <linux/interrupt.h>
+#include <linux/mtd/cfi.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/spi-nor.h>
@@ -151,13 +154,46 @@
 #define QSPI_WPSR_WPVSRC_MASK           GENMASK(15, 8)
 #define QSPI_WPSR_WPVSRC(src)           (((src) << 8) & QSPI_WPSR_WPVSRC)
 
+/* Reads at least this long are done by DMA when a memcpy channel exists */
+#define ATMEL_QSPI_DMA_MIN_BYTES	1024
+#define ATMEL_QSPI_DMA_TIMEOUT		(msecs_to_jiffies(1000))
+
+/* Bounds of the delay between status reads while the flash is busy */
+#define ATMEL_QSPI_POLL_MIN_US		16
+#define ATMEL_QSPI_POLL_MAX_US		2000
+
+/* Used to enter and leave the QPI mode of Macronix flashes */
+#define ATMEL_QSPI_OP_EQIO		0x35
+#define ATMEL_QSPI_OP_RSTQIO		0xf5
+#define ATMEL_QSPI_WRSR_TIMEOUT		(msecs_to_jiffies(100))
+
+/*
+ * The mode byte of the quad I/O fast reads takes two of their dummy cycles.
+ * 0xa5 keeps Macronix, Spansion and Winbond flashes in continuous read,
+ * 0xff makes them leave it.
+ */
+#define ATMEL_QSPI_CRM_MODE_CYCLES	2
+#define ATMEL_QSPI_CRM_ENTER		0xa5
+#define ATMEL_QSPI_CRM_EXIT		0xff
+#define ATMEL_QSPI_CRM_CHECK_BYTES	16
 
 struct atmel_qspi {
 	void __iomem		*regs;
 	void __iomem		*mem;
+	dma_addr_t		mem_phys;
+	struct dma_chan		*dmach;
+	struct completion	dma_completion;
+	size_t			mem_size;
+	unsigned int		mmap_users;	/* active mtd_point() */
+	unsigned int		poll_delay_us;	/* next busy status read */
+	bool			qpi;		/* QPI entered by the driver */
+	bool			crm;		/* continuous read enabled */
+	bool			crm_mapped;	/* its read frame is in QSPI_IFR */
+	bool			crm_entered;	/* the flash skips the opcode */
 	struct clk		*clk;
 	struct platform_device	*pdev;
 	u32			pending;
+	u32			wait_mask;
 
 	struct mtd_info		mtd;
 	struct spi_nor		nor;
@@ -191,6 +227,8 @@ struct atmel_qspi_command {
 	size_t		buf_len;
 	const void	*tx_buf;
 	void		*rx_buf;
+	bool		mmap;	/* leave the AHB window mapped for reads */
+	bool		crm;	/* continuous read */
 };
 
 /* Register access functions */
@@ -205,19 +243,104 @@ static inline void qspi_writel(struct atmel_qspi *aq, u32 reg, u32 value)
 }
 
 
+static void atmel_qspi_dma_callback(void *param)
+{
+	struct atmel_qspi *aq = param;
+
+	complete(&aq->dma_completion);
+}
+
+/*
+ * Copy len bytes from offset in the AHB window to buf with the memcpy
+ * channel. Returns -EAGAIN if the transfer could not be set up, so that the
+ * caller can fall back to PIO.
+ */
+static int atmel_qspi_dma_read(struct atmel_qspi *aq, void *buf, u32 offset,
+			       size_t len)
+{
+	struct device *dev = &aq->pdev->dev;
+	struct dma_chan *chan = aq->dmach;
+	struct dma_async_tx_descriptor *desc;
+	dma_addr_t dma_dst;
+	dma_cookie_t cookie;
+	int err = 0;
+
+	dma_dst = dma_map_single(dev, buf, len, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, dma_dst))
+		return -EAGAIN;
+
+	desc = chan->device->device_prep_dma_memcpy(chan, dma_dst,
+						    aq->mem_phys + offset, len,
+						    DMA_CTRL_ACK |
+						    DMA_PREP_INTERRUPT);
+	if (!desc) {
+		err = -EAGAIN;
+		goto unmap;
+	}
+
+	reinit_completion(&aq->dma_completion);
+	desc->callback = atmel_qspi_dma_callback;
+	desc->callback_param = aq;
+	cookie = dmaengine_submit(desc);
+	if (dma_submit_error(cookie)) {
+		err = -EAGAIN;
+		goto unmap;
+	}
+	dma_async_issue_pending(chan);
+
+	if (!wait_for_completion_timeout(&aq->dma_completion,
+					 ATMEL_QSPI_DMA_TIMEOUT)) {
+		dev_err(dev, "DMA read timeout\n");
+		dmaengine_terminate_all(chan);
+		err = -ETIMEDOUT;
+	}
+
+unmap:
+	dma_unmap_single(dev, dma_dst, len, DMA_FROM_DEVICE);
+	return err;
+}
+
 static int atmel_qspi_run_transfer(struct atmel_qspi *aq,
 				   const struct atmel_qspi_command *cmd)
 {
 	void __iomem *ahb_mem;
+	u32 offset = 0;
+	size_t head, bulk, len = cmd->buf_len;
+	u8 *rx_buf = cmd->rx_buf;
+	int err;
 
-	/* Then fallback to a PIO transfer */
-	ahb_mem = aq->mem;
 	if (cmd->enable.bits.address)
-		ahb_mem += cmd->address;
+		offset = cmd->address;
+	ahb_mem = aq->mem + offset;
+
+	/*
+	 * Large reads into linear memory go through DMA, leaving the CPU free.
+	 * The unaligned head and tail are copied by the CPU so that the DMA
+	 * buffer does not share a cache line with anything else.
+	 */
+	if (aq->dmach && rx_buf && len >= ATMEL_QSPI_DMA_MIN_BYTES &&
+	    virt_addr_valid(rx_buf)) {
+		head = PTR_ALIGN(rx_buf, dma_get_cache_alignment()) - rx_buf;
+		bulk = round_down(len - head, dma_get_cache_alignment());
+
+		memcpy_fromio(rx_buf, ahb_mem, head);
+		err = atmel_qspi_dma_read(aq, rx_buf + head, offset + head,
+					  bulk);
+		if (!err)
+			head += bulk;
+		else if (err != -EAGAIN)
+			return err;
+
+		/* Then the tail, or everything left if DMA failed, by PIO */
+		memcpy_fromio(rx_buf + head, ahb_mem + head, len - head);
+		return 0;
+	}
+
+	/* Then fallback to a PIO transfer */
 	if (cmd->tx_buf)
-		memcpy_toio(ahb_mem, cmd->tx_buf, cmd->buf_len);
+		memcpy_toio(ahb_mem, cmd->tx_buf, len);
 	else
-		memcpy_fromio(cmd->rx_buf, ahb_mem, cmd->buf_len);
+		memcpy_fromio(rx_buf, ahb_mem, len);
 
 	return 0;
 }
@@ -285,10 +408,32 @@ static void atmel_qspi_debug_command(struct atmel_qspi *aq,
 #define atmel_qspi_debug_command(aq, cmd)
 #endif
 
-static int atmel_qspi_run_command(struct atmel_qspi *aq,
-				  const struct atmel_qspi_command *cmd)
+/* Wait for all the status flags in mask, they are cleared when SR is read */
+static int atmel_qspi_wait(struct atmel_qspi *aq, u32 mask)
+{
+	u32 sr;
+	int err = 0;
+
+	sr = qspi_readl(aq, QSPI_SR);
+	if ((sr & mask) == mask)
+		return 0;
+
+	reinit_completion(&aq->cmd_completion);
+	aq->pending = sr & mask;
+	aq->wait_mask = mask;
+	qspi_writel(aq, QSPI_IER, mask);
+	if (!wait_for_completion_timeout(&aq->cmd_completion,
+					 msecs_to_jiffies(1000)))
+		err = -ETIMEDOUT;
+	qspi_writel(aq, QSPI_IDR, mask);
+
+	return err;
+}
+
+static int __atmel_qspi_run_command(struct atmel_qspi *aq,
+				    const struct atmel_qspi_command *cmd)
 {
-	u32 iar, icr, ifr, sr;
+	u32 iar, icr, ifr;
 	int err = 0;
 
 	iar = 0;
@@ -372,8 +517,8 @@ static int atmel_qspi_run_command(struct atmel_qspi *aq,
 	if (cmd->enable.bits.data) {
 		ifr |= QSPI_IFR_DATAEN;
 
-		/* Special case for Continuous Read Mode */
-		if (!cmd->tx_buf && !cmd->rx_buf)
+		/* The controller sends the instruction on the first read only */
+		if (cmd->crm)
 			ifr |= QSPI_IFR_CRM;
 	}
 
@@ -393,7 +538,7 @@ static int atmel_qspi_run_command(struct atmel_qspi *aq,
 	/* Dummy read of QSPI_IFR to synchronize APB and AHB accesses */
 	(void)qspi_readl(aq, QSPI_IFR);
 
-	/* Stop here for continuous read */
+	/* Stop here for continuous read and memory mapped reads */
 	if (!cmd->tx_buf && !cmd->rx_buf)
 		return 0;
 	/* Send/Receive data */
@@ -415,19 +560,32 @@ static int atmel_qspi_run_command(struct atmel_qspi *aq,
 			       32, 1, cmd->rx_buf, cmd->buf_len, false);
 #endif
 no_data:
-	/* Poll INSTRuction End and Chip Select Rise flags */
-	sr = qspi_readl(aq, QSPI_SR);
-	if ((sr & QSPI_SR_CMD_COMPLETED) == QSPI_SR_CMD_COMPLETED)
+	/* Wait for the INSTRuction End and Chip Select Rise flags */
+	return atmel_qspi_wait(aq, QSPI_SR_CMD_COMPLETED);
+}
+
+static int atmel_qspi_map_read(struct atmel_qspi *aq);
+static int atmel_qspi_crm_exit(struct atmel_qspi *aq);
+
+static int atmel_qspi_run_command(struct atmel_qspi *aq,
+				  const struct atmel_qspi_command *cmd)
+{
+	int err;
+
+	/* Take the flash out of continuous read before sending an opcode */
+	err = atmel_qspi_crm_exit(aq);
+	if (err)
 		return err;
 
-	/* Wait for INSTRuction End interrupt */
-	reinit_completion(&aq->cmd_completion);
-	aq->pending = sr & QSPI_SR_CMD_COMPLETED;
-	qspi_writel(aq, QSPI_IER, QSPI_SR_CMD_COMPLETED);
-	if (!wait_for_completion_timeout(&aq->cmd_completion,
-					 msecs_to_jiffies(1000)))
-		err = -ETIMEDOUT;
-	qspi_writel(aq, QSPI_IDR, QSPI_SR_CMD_COMPLETED);
+	/* Terminate the memory mapped read the AHB window may be serving */
+	if (aq->mmap_users && !cmd->mmap)
+		qspi_writel(aq, QSPI_CR, QSPI_CR_LASTXFER);
+
+	err = __atmel_qspi_run_command(aq, cmd);
+
+	/* Then make the window serve reads again for mtd_point() users */
+	if (aq->mmap_users && !cmd->mmap)
+		atmel_qspi_map_read(aq);
 
 	return err;
 }
@@ -487,7 +645,30 @@ static int atmel_qspi_read_reg(struct spi_nor *nor, u8 opcode,
 	if (ret)
 		return ret;
 
-	return atmel_qspi_run_command(aq, &cmd);
+	/*
+	 * The controller cannot poll the flash status on its own and the
+	 * spi-nor core re-reads it in a tight loop until an erase or program
+	 * is over. Sleep between reads that keep finding the flash busy,
+	 * backing off exponentially, so that a sector erase lets the CPU go.
+	 */
+	if ((opcode == SPINOR_OP_RDSR || opcode == SPINOR_OP_RDFSR) &&
+	    aq->poll_delay_us)
+		usleep_range(aq->poll_delay_us, aq->poll_delay_us * 5 / 4);
+
+	ret = atmel_qspi_run_command(aq, &cmd);
+	if (ret || len < 1)
+		return ret;
+
+	if ((opcode == SPINOR_OP_RDSR && (buf[0] & SR_WIP)) ||
+	    (opcode == SPINOR_OP_RDFSR && !(buf[0] & FSR_READY)))
+		aq->poll_delay_us = clamp_t(unsigned int,
+					    aq->poll_delay_us * 2,
+					    ATMEL_QSPI_POLL_MIN_US,
+					    ATMEL_QSPI_POLL_MAX_US);
+	else if (opcode == SPINOR_OP_RDSR || opcode == SPINOR_OP_RDFSR)
+		aq->poll_delay_us = 0;
+
+	return 0;
 }
 
 static int atmel_qspi_write_reg(struct spi_nor *nor, u8 opcode,
@@ -562,6 +743,97 @@ static int atmel_qspi_erase(struct spi_nor *nor, loff_t offs)
 	return atmel_qspi_run_command(aq, &cmd);
 }
 
+static int atmel_qspi_read_command(struct spi_nor *nor,
+				   struct atmel_qspi_command *cmd,
+				   loff_t from, size_t len, u_char *read_buf)
+{
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->enable.bits.instruction = 1;
+	cmd->enable.bits.address = nor->addr_width;
+	cmd->enable.bits.dummy = (nor->read_dummy > 0);
+	cmd->enable.bits.data = 1;
+	cmd->instruction = nor->read_opcode;
+	cmd->address = (u32)from;
+	cmd->num_dummy_cycles = nor->read_dummy;
+	cmd->rx_buf = read_buf;
+	cmd->buf_len = len;
+
+	return atmel_qspi_command_set_ifr(cmd,
+					  QSPI_IFR_TFRTYP_TRSFR_READ_MEM,
+					  nor->read_proto);
+}
+
+static void atmel_qspi_set_crm_mode(struct atmel_qspi_command *cmd, u8 mode)
+{
+	cmd->enable.bits.mode = 1;
+	cmd->mode = mode;
+	cmd->num_mode_cycles = ATMEL_QSPI_CRM_MODE_CYCLES;
+	cmd->num_dummy_cycles -= ATMEL_QSPI_CRM_MODE_CYCLES;
+	cmd->enable.bits.dummy = (cmd->num_dummy_cycles > 0);
+}
+
+/*
+ * Continuous read: the read frame is programmed once, then each access to
+ * the AHB window only sends the address, the mode byte and the dummy cycles
+ * before the data. This saves the opcode phase, 8 clock cycles in SPI mode,
+ * on every read.
+ */
+static int atmel_qspi_crm_read(struct atmel_qspi *aq, loff_t from, size_t len,
+			       u_char *read_buf)
+{
+	struct atmel_qspi_command cmd;
+	int err;
+
+	err = atmel_qspi_read_command(&aq->nor, &cmd, from, len, NULL);
+	if (err)
+		return err;
+	atmel_qspi_set_crm_mode(&cmd, ATMEL_QSPI_CRM_ENTER);
+	cmd.crm = true;
+
+	if (!aq->crm_mapped) {
+		err = __atmel_qspi_run_command(aq, &cmd);
+		if (err)
+			return err;
+		aq->crm_mapped = true;
+	}
+
+	/* Clear pending interrupts */
+	(void)qspi_readl(aq, QSPI_SR);
+
+	cmd.rx_buf = read_buf;
+	err = atmel_qspi_run_transfer(aq, &cmd);
+	qspi_writel(aq, QSPI_CR, QSPI_CR_LASTXFER);
+	aq->crm_entered = true;
+	if (err)
+		return err;
+
+	return atmel_qspi_wait(aq, QSPI_SR_CSR);
+}
+
+/*
+ * The flash only leaves continuous read on a read whose mode byte says so:
+ * it still takes the next opcode for the first address byte until then.
+ */
+static int atmel_qspi_crm_exit(struct atmel_qspi *aq)
+{
+	struct atmel_qspi_command cmd;
+	u8 dummy;
+	int err;
+
+	aq->crm_mapped = false;
+	if (!aq->crm_entered)
+		return 0;
+	aq->crm_entered = false;
+
+	err = atmel_qspi_read_command(&aq->nor, &cmd, 0, 1, &dummy);
+	if (err)
+		return err;
+	cmd.enable.bits.instruction = 0;
+	atmel_qspi_set_crm_mode(&cmd, ATMEL_QSPI_CRM_EXIT);
+
+	return __atmel_qspi_run_command(aq, &cmd);
+}
+
 static int atmel_qspi_read(struct spi_nor *nor, loff_t from, size_t len,
 			   size_t *retlen, u_char *read_buf)
 {
@@ -569,20 +841,17 @@ static int atmel_qspi_read(struct spi_nor *nor, loff_t from, size_t len,
 	struct atmel_qspi_command cmd;
 	int ret;
 
-	memset(&cmd, 0, sizeof(cmd));
-	cmd.enable.bits.instruction = 1;
-	cmd.enable.bits.address = nor->addr_width;
-	cmd.enable.bits.dummy = (nor->read_dummy > 0);
-	cmd.enable.bits.data = 1;
-	cmd.instruction = nor->read_opcode;
-	cmd.address = (u32)from;
-	cmd.num_dummy_cycles = nor->read_dummy;
-	cmd.rx_buf = read_buf;
-	cmd.buf_len = len;
+	/* mtd_point() users need the window to serve plain reads */
+	if (aq->crm && !aq->mmap_users) {
+		ret = atmel_qspi_crm_read(aq, from, len, read_buf);
+		if (ret)
+			return ret;
 
-	ret = atmel_qspi_command_set_ifr(&cmd,
-					 QSPI_IFR_TFRTYP_TRSFR_READ_MEM,
-					 nor->read_proto);
+		*retlen += len;
+		return 0;
+	}
+
+	ret = atmel_qspi_read_command(nor, &cmd, from, len, read_buf);
 	if (ret)
 		return ret;
 
@@ -594,6 +863,189 @@ static int atmel_qspi_read(struct spi_nor *nor, loff_t from, size_t len,
 	return 0;
 }
 
+/*
+ * Program the read instruction and leave it in place: every CPU or DMA
+ * access to the AHB window then reads the flash at the matching offset.
+ */
+static int atmel_qspi_map_read(struct atmel_qspi *aq)
+{
+	struct atmel_qspi_command cmd;
+	int ret;
+
+	ret = atmel_qspi_crm_exit(aq);
+	if (ret)
+		return ret;
+
+	ret = atmel_qspi_read_command(&aq->nor, &cmd, 0, 0, NULL);
+	if (ret)
+		return ret;
+
+	cmd.mmap = true;
+	return __atmel_qspi_run_command(aq, &cmd);
+}
+
+/*
+ * The mapping stays valid until the matching unpoint, except while an
+ * erase or a program is in progress, like with any memory mapped NOR.
+ */
+static int atmel_qspi_point(struct mtd_info *mtd, loff_t from, size_t len,
+			    size_t *retlen, void **virt, resource_size_t *phys)
+{
+	struct spi_nor *nor = mtd->priv;
+	struct atmel_qspi *aq = nor->priv;
+	int ret = 0;
+
+	if (from >= aq->mem_size)
+		return -EINVAL;
+
+	mutex_lock(&nor->lock);
+	if (!aq->mmap_users)
+		ret = atmel_qspi_map_read(aq);
+	if (!ret) {
+		aq->mmap_users++;
+		*retlen = min_t(size_t, len, aq->mem_size - from);
+		*virt = (void __force *)(aq->mem + from);
+		if (phys)
+			*phys = aq->mem_phys + from;
+	}
+	mutex_unlock(&nor->lock);
+
+	return ret;
+}
+
+static int atmel_qspi_unpoint(struct mtd_info *mtd, loff_t from, size_t len)
+{
+	struct spi_nor *nor = mtd->priv;
+	struct atmel_qspi *aq = nor->priv;
+
+	mutex_lock(&nor->lock);
+	if (aq->mmap_users && !--aq->mmap_users)
+		qspi_writel(aq, QSPI_CR, QSPI_CR_LASTXFER);
+	mutex_unlock(&nor->lock);
+
+	return 0;
+}
+
+/*
+ * Switch a Macronix flash to QPI before spi_nor_scan(): the Read ID in SPI
+ * mode then fails and the core detects the flash in SPI 4-4-4, using the
+ * quad I/O fast read for all reads.
+ */
+static int atmel_qspi_enter_qpi(struct atmel_qspi *aq)
+{
+	struct spi_nor *nor = &aq->nor;
+	unsigned long deadline;
+	u8 id, sr;
+	int ret;
+
+	ret = atmel_qspi_read_reg(nor, SPINOR_OP_RDID, &id, 1);
+	if (ret)
+		return ret;
+
+	/* Left in QPI by the bootloader: the core will find it so */
+	if (id == 0x00 || id == 0xff)
+		return 0;
+
+	if (id != CFI_MFR_MACRONIX) {
+		dev_warn(nor->dev, "QPI is only supported on Macronix flashes\n");
+		return 0;
+	}
+
+	/* The Quad Enable bit must be set for the QPI mode */
+	ret = atmel_qspi_read_reg(nor, SPINOR_OP_RDSR, &sr, 1);
+	if (ret)
+		return ret;
+
+	if (!(sr & SR_QUAD_EN_MX)) {
+		sr |= SR_QUAD_EN_MX;
+		ret = atmel_qspi_write_reg(nor, SPINOR_OP_WREN, NULL, 0, 0);
+		if (ret)
+			return ret;
+		ret = atmel_qspi_write_reg(nor, SPINOR_OP_WRSR, &sr, 1, 0);
+		if (ret)
+			return ret;
+
+		deadline = jiffies + ATMEL_QSPI_WRSR_TIMEOUT;
+		do {
+			ret = atmel_qspi_read_reg(nor, SPINOR_OP_RDSR, &sr, 1);
+			if (ret)
+				return ret;
+			if (!(sr & SR_WIP))
+				break;
+		} while (time_before(jiffies, deadline));
+
+		if (!(sr & SR_QUAD_EN_MX)) {
+			dev_err(nor->dev, "failed to set the Quad Enable bit\n");
+			return -EIO;
+		}
+	}
+
+	ret = atmel_qspi_write_reg(nor, ATMEL_QSPI_OP_EQIO, NULL, 0, 0);
+	if (ret)
+		return ret;
+
+	aq->qpi = true;
+	return 0;
+}
+
+/*
+ * Continuous read only works with the quad I/O fast reads, which have enough
+ * dummy cycles to carry the mode byte. Some flashes ignore the mode byte,
+ * or only take it into account once configured for XIP: check that the
+ * flash really skips the opcode before relying on it.
+ */
+static void atmel_qspi_crm_init(struct atmel_qspi *aq)
+{
+	struct spi_nor *nor = &aq->nor;
+	u8 ref[ATMEL_QSPI_CRM_CHECK_BYTES], buf[sizeof(ref)];
+	size_t retlen = 0;
+	int i, err;
+
+	if ((nor->read_opcode != SPINOR_OP_READ_1_4_4 &&
+	     nor->read_opcode != SPINOR_OP_READ_1_4_4_4B) ||
+	    nor->read_dummy < ATMEL_QSPI_CRM_MODE_CYCLES) {
+		dev_warn(nor->dev,
+			 "continuous read needs the quad I/O fast read\n");
+		return;
+	}
+
+	err = atmel_qspi_read(nor, 0, sizeof(ref), &retlen, ref);
+	if (err)
+		return;
+
+	/* The first read still sends the opcode, the next one doesn't */
+	for (i = 0; i < 2; i++) {
+		err = atmel_qspi_crm_read(aq, 0, sizeof(buf), buf);
+		if (err || memcmp(buf, ref, sizeof(buf)))
+			break;
+	}
+
+	if (i < 2) {
+		/* Harmless if the flash never entered continuous read */
+		atmel_qspi_crm_exit(aq);
+		dev_warn(nor->dev, "continuous read not supported\n");
+		return;
+	}
+
+	aq->crm = true;
+	dev_info(nor->dev, "using continuous read\n");
+}
+
+/* Give the flash back in SPI mode, as the boot ROM expects to find it */
+static void atmel_qspi_exit_modes(struct atmel_qspi *aq)
+{
+	struct spi_nor *nor = &aq->nor;
+
+	atmel_qspi_crm_exit(aq);
+	aq->crm = false;
+
+	if (aq->qpi) {
+		nor->reg_proto = SPI_PROTO_4_4_4;
+		atmel_qspi_write_reg(nor, ATMEL_QSPI_OP_RSTQIO, NULL, 0, 0);
+		aq->qpi = false;
+	}
+}
+
 static int atmel_qspi_init(struct atmel_qspi *aq)
 {
 	unsigned long src_rate;
@@ -636,7 +1088,7 @@ static irqreturn_t atmel_qspi_interrupt(int irq, void *dev_id)
 		return IRQ_NONE;
 
 	aq->pending |= pending;
-	if ((aq->pending & QSPI_SR_CMD_COMPLETED) == QSPI_SR_CMD_COMPLETED)
+	if ((aq->pending & aq->wait_mask) == aq->wait_mask)
 		complete(&aq->cmd_completion);
 
 	return IRQ_HANDLED;
@@ -650,6 +1102,7 @@ static int atmel_qspi_probe(struct platform_device *pdev)
 	struct resource *res;
 	struct spi_nor *nor;
 	struct mtd_info *mtd;
+	dma_cap_mask_t mask;
 	int irq, err = 0;
 
 	if (of_get_child_count(np) != 1)
@@ -664,6 +1117,7 @@ static int atmel_qspi_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, aq);
 	init_completion(&aq->cmd_completion);
+	init_completion(&aq->dma_completion);
 	aq->pdev = pdev;
 
 	/* Map the registers */
@@ -683,6 +1137,8 @@ static int atmel_qspi_probe(struct platform_device *pdev)
 		err = PTR_ERR(aq->regs);
 		goto exit;
 	}
+	aq->mem_phys = res->start;
+	aq->mem_size = resource_size(res);
 
 	/* Get the peripheral clock */
 	aq->clk = devm_clk_get(&pdev->dev, NULL);
@@ -711,6 +1167,14 @@ static int atmel_qspi_probe(struct platform_device *pdev)
 	if (err)
 		goto disable_clk;
 
+	/* Large reads use a memcpy DMA channel when one is available */
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	aq->dmach = dma_request_channel(mask, NULL, NULL);
+	if (aq->dmach)
+		dev_info(&pdev->dev, "using %s for DMA reads\n",
+			 dma_chan_name(aq->dmach));
+
 	/* Setup the spi-nor */
 	nor = &aq->nor;
 	mtd = &aq->mtd;
@@ -734,22 +1198,38 @@ static int atmel_qspi_probe(struct platform_device *pdev)
 	if (err)
 		goto disable_clk;
 
+	if (of_property_read_bool(child, "atmel,qpi")) {
+		err = atmel_qspi_enter_qpi(aq);
+		if (err)
+			goto disable_clk;
+	}
+
 	nor->dev->of_node = child;
 	err = spi_nor_scan(nor, NULL, SPI_NOR_QUAD);
 	nor->dev->of_node = np;
 	if (err)
-		goto disable_clk;
+		goto exit_modes;
+
+	if (of_property_read_bool(child, "atmel,continuous-read"))
+		atmel_qspi_crm_init(aq);
+
+	mtd->_point = atmel_qspi_point;
+	mtd->_unpoint = atmel_qspi_unpoint;
 
 	ppdata.of_node = child;
 	err = mtd_device_parse_register(mtd, NULL, &ppdata, NULL, 0);
 	if (err)
-		goto disable_clk;
+		goto exit_modes;
 
 	of_node_put(child);
 
 	return 0;
 
+exit_modes:
+	atmel_qspi_exit_modes(aq);
 disable_clk:
+	if (aq->dmach)
+		dma_release_channel(aq->dmach);
 	clk_disable_unprepare(aq->clk);
 exit:
 	of_node_put(child);
@@ -762,11 +1242,25 @@ static int atmel_qspi_remove(struct platform_device *pdev)
 	struct atmel_qspi *aq = platform_get_drvdata(pdev);
 
 	mtd_device_unregister(&aq->mtd);
+	mutex_lock(&aq->nor.lock);
+	atmel_qspi_exit_modes(aq);
+	mutex_unlock(&aq->nor.lock);
 	qspi_writel(aq, QSPI_CR, QSPI_CR_QSPIDIS);
+	if (aq->dmach)
+		dma_release_channel(aq->dmach);
 	clk_disable_unprepare(aq->clk);
 	return 0;
 }
 
+static void atmel_qspi_shutdown(struct platform_device *pdev)
+{
+	struct atmel_qspi *aq = platform_get_drvdata(pdev);
+
+	mutex_lock(&aq->nor.lock);
+	atmel_qspi_exit_modes(aq);
+	mutex_unlock(&aq->nor.lock);
+}
+
 
 static const struct of_device_id atmel_qspi_dt_ids[] = {
 	{ .compatible = "atmel,sama5d2-qspi" },
@@ -782,6 +1276,7 @@ static struct platform_driver atmel_qspi_driver = {
 	},
 	.probe		= atmel_qspi_probe,
 	.remove		= atmel_qspi_remove,
+	.shutdown	= atmel_qspi_shutdown,
 };
 module_platform_driver(atmel_qspi_driver);
 
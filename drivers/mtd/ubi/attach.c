@@ -87,6 +87,8 @@
 #include <linux/crc32.h>
 #include <linux/math64.h>
 #include <linux/random.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 #include "ubi.h"
 
 static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai);
@@ -95,6 +97,13 @@ static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai);
 static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
+/*
+ * How many PEBs ahead of the one being processed 'scan_all()' reads headers,
+ * and how many of these reads may be in flight at the same time.
+ */
+#define UBI_SCAN_READ_AHEAD 16
+#define UBI_SCAN_READERS 4
+
 /**
  * add_to_list - add physical eraseblock to a list.
  * @ai: attaching information
@@ -803,6 +812,57 @@ out_unlock:
 	return err;
 }
 
+/**
+ * struct scan_hdrs - UBI headers of a PEB read ahead of processing.
+ * @work: the read work
+ * @done: completed when the headers have been read
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock number
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read_ec_hdr()' returned
+ * @vid_err: what 'ubi_io_read_vid_hdr()' returned
+ * @ech: EC header of @pnum
+ * @vidh: VID header of @pnum
+ */
+struct scan_hdrs {
+	struct work_struct work;
+	struct completion done;
+	struct ubi_device *ubi;
+	int pnum;
+	int bad;
+	int ec_err;
+	int vid_err;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vidh;
+};
+
+/**
+ * read_ahead_work - read the UBI headers of a PEB.
+ * @work: the read work
+ *
+ * This function does the reads 'scan_peb()' would do for the PEB, so that
+ * they can be issued ahead of processing. The VID header is not read if the
+ * EC header says there is not going to be one.
+ */
+static void read_ahead_work(struct work_struct *work)
+{
+	struct scan_hdrs *h = container_of(work, struct scan_hdrs, work);
+	struct ubi_device *ubi = h->ubi;
+
+	h->bad = ubi_io_is_bad(ubi, h->pnum);
+	if (h->bad)
+		goto out;
+
+	h->ec_err = ubi_io_read_ec_hdr(ubi, h->pnum, h->ech, 0);
+	if (h->ec_err < 0 || h->ec_err == UBI_IO_FF ||
+	    h->ec_err == UBI_IO_FF_BITFLIPS)
+		goto out;
+
+	h->vid_err = ubi_io_read_vid_hdr(ubi, h->pnum, h->vidh, 0);
+out:
+	complete(&h->done);
+}
+
 /**
  * scan_peb - scan and process UBI headers of a PEB.
  * @ubi: UBI device description object
@@ -810,22 +870,27 @@ out_unlock:
  * @pnum: the physical eraseblock number
  * @vid: The volume ID of the found volume will be stored in this pointer
  * @sqnum: The sqnum of the found volume will be stored in this pointer
+ * @hdrs: headers of @pnum read ahead by 'read_ahead_work()', or %NULL
  *
  * This function reads UBI headers of PEB @pnum, checks them, and adds
  * information about this PEB to the corresponding list or RB-tree in the
- * "attaching info" structure. Returns zero if the physical eraseblock was
- * successfully handled and a negative error code in case of failure.
+ * "attaching info" structure. If @hdrs is not %NULL, the headers have already
+ * been read and are taken from there. Returns zero if the physical eraseblock
+ * was successfully handled and a negative error code in case of failure.
  */
 static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
-		    int pnum, int *vid, unsigned long long *sqnum)
+		    int pnum, int *vid, unsigned long long *sqnum,
+		    const struct scan_hdrs *hdrs)
 {
 	long long uninitialized_var(ec);
 	int err, bitflips = 0, vol_id = -1, ec_err = 0;
+	struct ubi_ec_hdr *ec_hdr = hdrs ? hdrs->ech : ech;
+	struct ubi_vid_hdr *vid_hdr = hdrs ? hdrs->vidh : vidh;
 
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = hdrs ? hdrs->bad : ubi_io_is_bad(ubi, pnum);
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -833,7 +898,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = hdrs ? hdrs->ec_err : ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -871,13 +936,13 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		int image_seq;
 
 		/* Make sure UBI version is OK */
-		if (ech->version != UBI_VERSION) {
+		if (ec_hdr->version != UBI_VERSION) {
 			ubi_err(ubi, "this UBI version is %d, image version is %d",
-				UBI_VERSION, (int)ech->version);
+				UBI_VERSION, (int)ec_hdr->version);
 			return -EINVAL;
 		}
 
-		ec = be64_to_cpu(ech->ec);
+		ec = be64_to_cpu(ec_hdr->ec);
 		if (ec > UBI_MAX_ERASECOUNTER) {
 			/*
 			 * Erase counter overflow. The EC headers have 64 bits
@@ -888,7 +953,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 			 */
 			ubi_err(ubi, "erase counter overflow, max is %d",
 				UBI_MAX_ERASECOUNTER);
-			ubi_dump_ec_hdr(ech);
+			ubi_dump_ec_hdr(ec_hdr);
 			return -EINVAL;
 		}
 
@@ -903,20 +968,20 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		 * sequence number, while other PEBs have non-zero sequence
 		 * number.
 		 */
-		image_seq = be32_to_cpu(ech->image_seq);
+		image_seq = be32_to_cpu(ec_hdr->image_seq);
 		if (!ubi->image_seq)
 			ubi->image_seq = image_seq;
 		if (image_seq && ubi->image_seq != image_seq) {
 			ubi_err(ubi, "bad image sequence number %d in PEB %d, expected %d",
 				image_seq, pnum, ubi->image_seq);
-			ubi_dump_ec_hdr(ech);
+			ubi_dump_ec_hdr(ec_hdr);
 			return -EINVAL;
 		}
 	}
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	err = hdrs ? hdrs->vid_err : ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -954,7 +1019,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 			 * The EC was OK, but the VID header is corrupted. We
 			 * have to check what is in the data area.
 			 */
-			err = check_corruption(ubi, vidh, pnum);
+			err = check_corruption(ubi, vid_hdr, pnum);
 
 		if (err < 0)
 			return err;
@@ -990,16 +1055,16 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		return -EINVAL;
 	}
 
-	vol_id = be32_to_cpu(vidh->vol_id);
+	vol_id = be32_to_cpu(vid_hdr->vol_id);
 	if (vid)
 		*vid = vol_id;
 	if (sqnum)
-		*sqnum = be64_to_cpu(vidh->sqnum);
+		*sqnum = be64_to_cpu(vid_hdr->sqnum);
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
-		int lnum = be32_to_cpu(vidh->lnum);
+		int lnum = be32_to_cpu(vid_hdr->lnum);
 
 		/* Unsupported internal volume */
-		switch (vidh->compat) {
+		switch (vid_hdr->compat) {
 		case UBI_COMPAT_DELETE:
 			if (vol_id != UBI_FM_SB_VOLUME_ID
 			    && vol_id != UBI_FM_DATA_VOLUME_ID) {
@@ -1037,7 +1102,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	if (ec_err)
 		ubi_warn(ubi, "valid VID header but corrupted EC header at PEB %d",
 			 pnum);
-	err = ubi_add_to_av(ubi, ai, pnum, ec, vidh, bitflips);
+	err = ubi_add_to_av(ubi, ai, pnum, ec, vid_hdr, bitflips);
 	if (err)
 		return err;
 
@@ -1215,6 +1280,142 @@ static void destroy_ai(struct ubi_attach_info *ai)
 	kfree(ai);
 }
 
+/**
+ * free_read_ahead - free read-ahead buffers.
+ * @ubi: UBI device description object
+ * @hdrs: array of %UBI_SCAN_READ_AHEAD read-ahead slots
+ */
+static void free_read_ahead(struct ubi_device *ubi, struct scan_hdrs *hdrs)
+{
+	int i;
+
+	for (i = 0; i < UBI_SCAN_READ_AHEAD; i++) {
+		kfree(hdrs[i].ech);
+		if (hdrs[i].vidh)
+			ubi_free_vid_hdr(ubi, hdrs[i].vidh);
+	}
+	kfree(hdrs);
+}
+
+/**
+ * alloc_read_ahead - allocate read-ahead buffers.
+ * @ubi: UBI device description object
+ *
+ * Returns an array of %UBI_SCAN_READ_AHEAD read-ahead slots or %NULL if there
+ * is not enough memory.
+ */
+static struct scan_hdrs *alloc_read_ahead(struct ubi_device *ubi)
+{
+	struct scan_hdrs *hdrs;
+	int i;
+
+	hdrs = kcalloc(UBI_SCAN_READ_AHEAD, sizeof(struct scan_hdrs),
+		       GFP_KERNEL);
+	if (!hdrs)
+		return NULL;
+
+	for (i = 0; i < UBI_SCAN_READ_AHEAD; i++) {
+		hdrs[i].ubi = ubi;
+		hdrs[i].ech = kzalloc(ubi->ec_hdr_alsize,
+				      GFP_KERNEL | __GFP_NOWARN);
+		hdrs[i].vidh = ubi_zalloc_vid_hdr(ubi,
+						  GFP_KERNEL | __GFP_NOWARN);
+		if (!hdrs[i].ech || !hdrs[i].vidh) {
+			free_read_ahead(ubi, hdrs);
+			return NULL;
+		}
+		INIT_WORK(&hdrs[i].work, read_ahead_work);
+	}
+
+	return hdrs;
+}
+
+/**
+ * queue_read_ahead - start reading the headers of a PEB.
+ * @wq: workqueue running the reads
+ * @h: read-ahead slot to use
+ * @pnum: physical eraseblock number
+ */
+static void queue_read_ahead(struct workqueue_struct *wq,
+			     struct scan_hdrs *h, int pnum)
+{
+	h->pnum = pnum;
+	h->bad = h->ec_err = h->vid_err = 0;
+	reinit_completion(&h->done);
+	queue_work(wq, &h->work);
+}
+
+/**
+ * scan_range - scan PEBs from @start to the end of the device.
+ * @ubi: UBI device description object
+ * @ai: attach info object
+ * @start: start scanning at this PEB
+ *
+ * Scanning is dominated by the two header reads of every PEB, so they are
+ * issued up to %UBI_SCAN_READ_AHEAD PEBs ahead by up to %UBI_SCAN_READERS
+ * workers while this function processes the headers in PEB order, exactly as
+ * a plain sequential scan would. Devices which can serve several reads at a
+ * time (e.g. several NAND dies) get them in parallel, and the others at least
+ * overlap the reads with processing. If the read-ahead resources cannot be
+ * allocated, PEBs are scanned one by one.
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int scan_range(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		      int start)
+{
+	struct workqueue_struct *wq = NULL;
+	struct scan_hdrs *hdrs;
+	int err = 0, pnum, next;
+
+	hdrs = alloc_read_ahead(ubi);
+	if (hdrs)
+		wq = alloc_workqueue("ubi_scan%d", WQ_UNBOUND,
+				     UBI_SCAN_READERS, ubi->ubi_num);
+	if (!wq) {
+		if (hdrs)
+			free_read_ahead(ubi, hdrs);
+
+		for (pnum = start; pnum < ubi->peb_count; pnum++) {
+			cond_resched();
+
+			dbg_gen("process PEB %d", pnum);
+			err = scan_peb(ubi, ai, pnum, NULL, NULL, NULL);
+			if (err < 0)
+				return err;
+		}
+		return 0;
+	}
+
+	for (next = 0; next < UBI_SCAN_READ_AHEAD; next++)
+		init_completion(&hdrs[next].done);
+
+	for (next = start; next < ubi->peb_count &&
+	     next < start + UBI_SCAN_READ_AHEAD; next++)
+		queue_read_ahead(wq, &hdrs[next % UBI_SCAN_READ_AHEAD], next);
+
+	for (pnum = start; pnum < ubi->peb_count; pnum++) {
+		struct scan_hdrs *h = &hdrs[pnum % UBI_SCAN_READ_AHEAD];
+
+		cond_resched();
+
+		wait_for_completion(&h->done);
+		dbg_gen("process PEB %d", pnum);
+		err = scan_peb(ubi, ai, pnum, NULL, NULL, h);
+		if (err < 0)
+			break;
+
+		if (next < ubi->peb_count)
+			queue_read_ahead(wq, h, next++);
+	}
+
+	/* Wait for the reads which are still in flight */
+	destroy_workqueue(wq);
+	free_read_ahead(ubi, hdrs);
+	return err < 0 ? err : 0;
+}
+
 /**
  * scan_all - scan entire MTD device.
  * @ubi: UBI device description object
@@ -1228,7 +1429,7 @@ static void destroy_ai(struct ubi_attach_info *ai)
 static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		    int start)
 {
-	int err, pnum;
+	int err;
 	struct rb_node *rb1, *rb2;
 	struct ubi_ainf_volume *av;
 	struct ubi_ainf_peb *aeb;
@@ -1243,14 +1444,9 @@ static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = start; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
-
-		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, ai, pnum, NULL, NULL);
-		if (err < 0)
-			goto out_vidh;
-	}
+	err = scan_range(ubi, ai, start);
+	if (err)
+		goto out_vidh;
 
 	ubi_msg(ubi, "scanning is finished");
 
@@ -1358,7 +1554,7 @@ static int scan_fast(struct ubi_device *ubi, struct ubi_attach_info **ai)
 		cond_resched();
 
 		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, *ai, pnum, &vol_id, &sqnum);
+		err = scan_peb(ubi, *ai, pnum, &vol_id, &sqnum, NULL);
 		if (err < 0)
 			goto out_vidh;
 
@@ -48,6 +48,7 @@
 #include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/scatterlist.h>
+#include <linux/vmalloc.h>
 #include <asm/div64.h>
 
 #include "ubi-media.h"
@@ -62,6 +63,9 @@
 /* Maximum number of comma-separated items in the 'block=' parameter */
 #define UBIBLOCK_PARAM_COUNT 2
 
+/* Number of LEBs cached per device when read-ahead is enabled */
+#define UBIBLOCK_RA_LEBS 2
+
 struct ubiblock_param {
 	int ubi_num;
 	int vol_id;
@@ -79,6 +83,16 @@ static int ubiblock_devs __initdata;
 /* MTD devices specification parameters */
 static struct ubiblock_param ubiblock_param[UBIBLOCK_MAX_DEVICES] __initdata;
 
+/* Whether block devices created from now on cache and read ahead LEBs */
+static bool ubiblock_readahead;
+
+struct ubiblock_ra_leb {
+	int leb;
+	int len;
+	unsigned long stamp;
+	void *buf;
+};
+
 struct ubiblock {
 	struct ubi_volume_desc *desc;
 	int ubi_num;
@@ -91,6 +105,13 @@ struct ubiblock {
 
 	struct workqueue_struct *wq;
 
+	bool readahead;
+	struct mutex ra_mutex;
+	struct ubiblock_ra_leb ra[UBIBLOCK_RA_LEBS];
+	unsigned long ra_stamp;
+	struct work_struct ra_work;
+	int ra_leb;
+
 	struct mutex dev_mutex;
 	struct list_head list;
 	struct blk_mq_tag_set tag_set;
@@ -175,6 +196,8 @@ MODULE_PARM_DESC(block, "Attach block devices to UBI volumes. Parameter format:
 			"ubi.block=0,rootfs\n"
 			"Using both UBI device number and UBI volume number:\n"
 			"ubi.block=0,0\n");
+module_param_named(block_readahead, ubiblock_readahead, bool, 0644);
+MODULE_PARM_DESC(block_readahead, "Read whole LEBs into a per-device cache and read the next LEB ahead. Applies to block devices created afterwards.");
 
 static struct ubiblock *find_dev_nolock(int ubi_num, int vol_id)
 {
@@ -186,6 +209,127 @@ static struct ubiblock *find_dev_nolock(int ubi_num, int vol_id)
 	return NULL;
 }
 
+static void ubiblock_copy_to_sgl(struct ubi_sgl *usgl, const void *buf,
+				 int len)
+{
+	struct scatterlist *sg;
+	int n;
+
+	while (len) {
+		ubi_assert(usgl->list_pos < UBI_MAX_SG_COUNT);
+		sg = &usgl->sg[usgl->list_pos];
+		n = min_t(int, len, sg->length - usgl->page_pos);
+		memcpy(sg_virt(sg) + usgl->page_pos, buf, n);
+
+		buf += n;
+		len -= n;
+		usgl->page_pos += n;
+		if (usgl->page_pos == sg->length) {
+			usgl->list_pos++;
+			usgl->page_pos = 0;
+		}
+	}
+}
+
+static struct ubiblock_ra_leb *ubiblock_ra_find(struct ubiblock *dev, int leb)
+{
+	int i;
+
+	for (i = 0; i < UBIBLOCK_RA_LEBS; i++)
+		if (dev->ra[i].leb == leb)
+			return &dev->ra[i];
+	return NULL;
+}
+
+static void ubiblock_ra_invalidate(struct ubiblock *dev)
+{
+	int i;
+
+	mutex_lock(&dev->ra_mutex);
+	for (i = 0; i < UBIBLOCK_RA_LEBS; i++)
+		dev->ra[i].leb = -1;
+	mutex_unlock(&dev->ra_mutex);
+}
+
+/*
+ * Return the cached copy of LEB @leb, reading the whole LEB into the least
+ * recently used cache entry if it is not there yet. Must be called with
+ * @dev->ra_mutex held.
+ */
+static struct ubiblock_ra_leb *ubiblock_ra_get(struct ubiblock *dev, int leb)
+{
+	struct ubiblock_ra_leb *ra;
+	struct ubi_volume_info vi;
+	u64 end;
+	int i, ret;
+
+	ra = ubiblock_ra_find(dev, leb);
+	if (ra)
+		goto out;
+
+	ra = &dev->ra[0];
+	for (i = 1; i < UBIBLOCK_RA_LEBS; i++)
+		if (time_before(dev->ra[i].stamp, ra->stamp))
+			ra = &dev->ra[i];
+
+	/* The last LEB of a static volume may be partially used */
+	ubi_get_volume_info(dev->desc, &vi);
+	end = (u64)(leb + 1) * dev->leb_size;
+	ra->len = dev->leb_size;
+	if (end > vi.used_bytes)
+		ra->len -= end - vi.used_bytes;
+
+	ra->leb = -1;
+	ret = ubi_read(dev->desc, leb, ra->buf, 0, ra->len);
+	if (ret < 0)
+		return ERR_PTR(ret);
+	ra->leb = leb;
+
+out:
+	ra->stamp = ++dev->ra_stamp;
+	return ra;
+}
+
+static void ubiblock_ra_work(struct work_struct *work)
+{
+	struct ubiblock *dev = container_of(work, struct ubiblock, ra_work);
+
+	mutex_lock(&dev->ra_mutex);
+	ubiblock_ra_get(dev, dev->ra_leb);
+	mutex_unlock(&dev->ra_mutex);
+}
+
+/*
+ * Serve a read from the LEB cache. Requests falling into the same LEB are
+ * served from a single read of the whole LEB, and the next LEB is read in
+ * the background, so that a sequential reader never waits for the flash
+ * at LEB boundaries.
+ */
+static int ubiblock_read_cached(struct ubiblock *dev, struct ubi_sgl *usgl,
+				int leb, int offset, int len)
+{
+	struct ubiblock_ra_leb *ra;
+	int next = leb + 1, ret = 0;
+
+	mutex_lock(&dev->ra_mutex);
+	ra = ubiblock_ra_get(dev, leb);
+	if (IS_ERR(ra)) {
+		ret = PTR_ERR(ra);
+	} else if (offset + len > ra->len) {
+		ret = -EINVAL;
+	} else {
+		ubiblock_copy_to_sgl(usgl, ra->buf + offset, len);
+		if ((u64)next * dev->leb_size < get_capacity(dev->gd) << 9 &&
+		    !ubiblock_ra_find(dev, next)) {
+			dev->ra_leb = next;
+			queue_work(dev->wq, &dev->ra_work);
+		}
+	}
+	mutex_unlock(&dev->ra_mutex);
+
+	return ret;
+}
+
 static int ubiblock_read(struct ubiblock_pdu *pdu)
 {
 	int ret, leb, offset, bytes_left, to_read;
@@ -209,7 +353,12 @@ static int ubiblock_read(struct ubiblock_pdu *pdu)
 		if (offset + to_read > dev->leb_size)
 			to_read = dev->leb_size - offset;
 
-		ret = ubi_read_sg(dev->desc, leb, &pdu->usgl, offset, to_read);
+		if (dev->readahead)
+			ret = ubiblock_read_cached(dev, &pdu->usgl, leb, offset,
+						   to_read);
+		else
+			ret = ubi_read_sg(dev->desc, leb, &pdu->usgl, offset,
+					  to_read);
 		if (ret < 0)
 			return ret;
 
@@ -271,6 +420,11 @@ static void ubiblock_release(struct gendisk *gd, fmode_t mode)
 	mutex_lock(&dev->dev_mutex);
 	dev->refcnt--;
 	if (dev->refcnt == 0) {
+		if (dev->readahead) {
+			/* The volume may change while nobody has it open */
+			flush_work(&dev->ra_work);
+			ubiblock_ra_invalidate(dev);
+		}
 		ubi_close_volume(dev->desc);
 		dev->desc = NULL;
 	}
@@ -347,6 +501,36 @@ static int ubiblock_init_request(void *data, struct request *req,
 	return 0;
 }
 
+static void ubiblock_ra_free(struct ubiblock *dev)
+{
+	int i;
+
+	for (i = 0; i < UBIBLOCK_RA_LEBS; i++)
+		vfree(dev->ra[i].buf);
+}
+
+static void ubiblock_ra_init(struct ubiblock *dev)
+{
+	int i;
+
+	mutex_init(&dev->ra_mutex);
+	INIT_WORK(&dev->ra_work, ubiblock_ra_work);
+
+	if (!ubiblock_readahead)
+		return;
+
+	for (i = 0; i < UBIBLOCK_RA_LEBS; i++) {
+		dev->ra[i].leb = -1;
+		dev->ra[i].buf = vmalloc(dev->leb_size);
+		if (!dev->ra[i].buf) {
+			pr_warn("UBI: block: cannot allocate read-ahead buffers, read-ahead disabled\n");
+			ubiblock_ra_free(dev);
+			return;
+		}
+	}
+	dev->readahead = true;
+}
+
 static struct blk_mq_ops ubiblock_mq_ops = {
 	.queue_rq       = ubiblock_queue_rq,
 	.init_request	= ubiblock_init_request,
@@ -379,6 +563,7 @@ int ubiblock_create(struct ubi_volume_info *vi)
 	dev->ubi_num = vi->ubi_num;
 	dev->vol_id = vi->vol_id;
 	dev->leb_size = vi->usable_leb_size;
+	ubiblock_ra_init(dev);
 
 	/* Initialize the gendisk of this ubiblock device */
 	gd = alloc_disk(1);
@@ -448,6 +633,7 @@ out_free_tags:
 out_put_disk:
 	put_disk(dev->gd);
 out_free_dev:
+	ubiblock_ra_free(dev);
 	kfree(dev);
 
 	return ret;
@@ -464,6 +650,7 @@ static void ubiblock_cleanup(struct ubiblock *dev)
 	blk_mq_free_tag_set(&dev->tag_set);
 	dev_info(disk_to_dev(dev->gd), "released");
 	put_disk(dev->gd);
+	ubiblock_ra_free(dev);
 }
 
 int ubiblock_remove(struct ubi_volume_info *vi)
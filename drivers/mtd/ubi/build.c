@@ -118,6 +118,9 @@ static struct class_attribute ubi_version =
 
 static ssize_t dev_attribute_show(struct device *dev,
 				  struct device_attribute *attr, char *buf);
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count);
 
 /* UBI device attributes (correspond to files in '/<sysfs>/class/ubi/ubiX') */
 static struct device_attribute dev_eraseblock_size =
@@ -142,6 +145,12 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_bgt_rate =
+	__ATTR(bgt_rate, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_bgt_max_defer_ms =
+	__ATTR(bgt_max_defer_ms, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -378,6 +387,10 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_bgt_rate)
+		ret = sprintf(buf, "%u\n", ubi->bgt_rate);
+	else if (attr == &dev_bgt_max_defer_ms)
+		ret = sprintf(buf, "%u\n", ubi->bgt_max_defer);
 	else
 		ret = -EINVAL;
 
@@ -385,6 +398,39 @@ static ssize_t dev_attribute_show(struct device *dev,
 	return ret;
 }
 
+/* "Store" method for the background thread budget files */
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct ubi_device *ubi;
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	ubi = container_of(dev, struct ubi_device, dev);
+	ubi = ubi_get_device(ubi->ubi_num);
+	if (!ubi)
+		return -ENODEV;
+
+	if (attr == &dev_bgt_rate)
+		ubi->bgt_rate = val;
+	else if (attr == &dev_bgt_max_defer_ms)
+		ubi->bgt_max_defer = val;
+	else
+		err = -EINVAL;
+
+	/* Let the thread re-evaluate the budget of held back work */
+	if (!err && ubi->bgt_thread)
+		wake_up_process(ubi->bgt_thread);
+
+	ubi_put_device(ubi);
+	return err ? err : count;
+}
+
 static void dev_release(struct device *dev)
 {
 	struct ubi_device *ubi = container_of(dev, struct ubi_device, dev);
@@ -445,6 +491,12 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bgt_rate);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bgt_max_defer_ms);
 	return err;
 }
 
@@ -454,6 +506,8 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_bgt_max_defer_ms);
+	device_remove_file(&ubi->dev, &dev_bgt_rate);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -936,6 +990,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num,
 	ubi->ubi_num = ubi_num;
 	ubi->vid_hdr_offset = vid_hdr_offset;
 	ubi->autoresize_vol_id = -1;
+	ubi->bgt_max_defer = UBI_BGT_MAX_DEFER_MS;
 
 #ifdef CONFIG_MTD_UBI_FASTMAP
 	ubi->fm_pool.used = ubi->fm_pool.size = 0;
@@ -1264,6 +1319,9 @@ static int __init ubi_init(void)
 	if (err)
 		goto out_slab;
 
+	/* The MTD drivers may be probing asynchronously */
+	if (mtd_devs)
+		wait_for_device_probe();
 
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
@@ -1274,6 +1274,14 @@ static int ubi_write_fastmap(struct ubi_device *ubi,
 	spin_unlock(&ubi->wl_lock);
 	spin_unlock(&ubi->volumes_lock);
 
+	/*
+	 * @ubi->fm_size is the worst case size, usually much more than what
+	 * the fastmap takes. Only the used part is written and the rest of
+	 * the blocks is left erased, so it is 0xFF in the buffer too, which
+	 * is what the CRC is checked against when reading the fastmap.
+	 */
+	memset(fm_raw + fm_pos, 0xFF, ubi->fm_size - fm_pos);
+
 	dbg_bld("writing fastmap SB to PEB %i", new_fm->e[0]->pnum);
 	ret = ubi_io_write_vid_hdr(ubi, new_fm->e[0]->pnum, avhdr);
 	if (ret) {
@@ -1305,8 +1313,14 @@ static int ubi_write_fastmap(struct ubi_device *ubi,
 	}
 
 	for (i = 0; i < new_fm->used_blocks; i++) {
+		int len = (int)fm_pos - i * ubi->leb_size;
+
+		if (len <= 0)
+			break;
+		len = ALIGN(min(len, ubi->leb_size), ubi->min_io_size);
+
 		ret = ubi_io_write(ubi, fm_raw + (i * ubi->leb_size),
-			new_fm->e[i]->pnum, ubi->leb_start, ubi->leb_size);
+			new_fm->e[i]->pnum, ubi->leb_start, len);
 		if (ret) {
 			ubi_err(ubi, "unable to write fastmap to PEB %i!",
 				new_fm->e[i]->pnum);
@@ -445,7 +445,9 @@ int ubi_leb_read(struct ubi_volume_desc *desc, int lnum, char *buf, int offset,
 	if (len == 0)
 		return 0;
 
+	ubi_fg_io_begin(ubi);
 	err = ubi_eba_read_leb(ubi, vol, lnum, buf, offset, len, check);
+	ubi_fg_io_end(ubi);
 	if (err && mtd_is_eccerr(err) && vol->vol_type == UBI_STATIC_VOLUME) {
 		ubi_warn(ubi, "mark volume %d as corrupted", vol_id);
 		vol->corrupted = 1;
@@ -485,7 +487,9 @@ int ubi_leb_read_sg(struct ubi_volume_desc *desc, int lnum, struct ubi_sgl *sgl,
 	if (len == 0)
 		return 0;
 
+	ubi_fg_io_begin(ubi);
 	err = ubi_eba_read_leb_sg(ubi, vol, sgl, lnum, offset, len, check);
+	ubi_fg_io_end(ubi);
 	if (err && mtd_is_eccerr(err) && vol->vol_type == UBI_STATIC_VOLUME) {
 		ubi_warn(ubi, "mark volume %d as corrupted", vol_id);
 		vol->corrupted = 1;
@@ -525,7 +529,7 @@ int ubi_leb_write(struct ubi_volume_desc *desc, int lnum, const void *buf,
 {
 	struct ubi_volume *vol = desc->vol;
 	struct ubi_device *ubi = vol->ubi;
-	int vol_id = vol->vol_id;
+	int err, vol_id = vol->vol_id;
 
 	dbg_gen("write %d bytes to LEB %d:%d:%d", len, vol_id, lnum, offset);
 
@@ -546,7 +550,11 @@ int ubi_leb_write(struct ubi_volume_desc *desc, int lnum, const void *buf,
 	if (len == 0)
 		return 0;
 
-	return ubi_eba_write_leb(ubi, vol, lnum, buf, offset, len);
+	ubi_fg_io_begin(ubi);
+	err = ubi_eba_write_leb(ubi, vol, lnum, buf, offset, len);
+	ubi_fg_io_end(ubi);
+
+	return err;
 }
 EXPORT_SYMBOL_GPL(ubi_leb_write);
 
@@ -570,7 +578,7 @@ int ubi_leb_change(struct ubi_volume_desc *desc, int lnum, const void *buf,
 {
 	struct ubi_volume *vol = desc->vol;
 	struct ubi_device *ubi = vol->ubi;
-	int vol_id = vol->vol_id;
+	int err, vol_id = vol->vol_id;
 
 	dbg_gen("atomically write %d bytes to LEB %d:%d", len, vol_id, lnum);
 
@@ -590,7 +598,11 @@ int ubi_leb_change(struct ubi_volume_desc *desc, int lnum, const void *buf,
 	if (len == 0)
 		return 0;
 
-	return ubi_eba_atomic_leb_change(ubi, vol, lnum, buf, len);
+	ubi_fg_io_begin(ubi);
+	err = ubi_eba_atomic_leb_change(ubi, vol, lnum, buf, len);
+	ubi_fg_io_end(ubi);
+
+	return err;
 }
 EXPORT_SYMBOL_GPL(ubi_leb_change);
 
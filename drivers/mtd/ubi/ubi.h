@@ -62,6 +62,12 @@
 /* Background thread name pattern */
 #define UBI_BGT_NAME_PATTERN "ubi_bgt%dd"
 
+/*
+ * Default limit, in milliseconds, of the time the background thread holds
+ * back non-urgent work while foreground reads and writes are in progress.
+ */
+#define UBI_BGT_MAX_DEFER_MS 100
+
 /*
  * This marker in the EBA table means that the LEB is um-mapped.
  * NOTE! It has to have the same value as %UBI_ALL.
@@ -489,6 +495,12 @@ struct ubi_debug_info {
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
+ * @bgt_rate: maximum count of works per second the background thread does
+ *	      when it is not urgent, %0 if unlimited
+ * @bgt_max_defer: how long, in milliseconds, non-urgent background work may
+ *		   be held back for foreground I/O, %0 to never hold it back
+ * @bgt_held: if the background thread waits for foreground I/O to finish
+ * @fg_io: count of foreground reads and writes in progress
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -592,6 +604,10 @@ struct ubi_device {
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	unsigned int bgt_rate;
+	unsigned int bgt_max_defer;
+	int bgt_held;
+	atomic_t fg_io;
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -1073,6 +1089,28 @@ static inline void ubi_ro_mode(struct ubi_device *ubi)
 	}
 }
 
+/**
+ * ubi_fg_io_begin - account the start of a foreground read or write.
+ * @ubi: UBI device description object
+ */
+static inline void ubi_fg_io_begin(struct ubi_device *ubi)
+{
+	atomic_inc(&ubi->fg_io);
+}
+
+/**
+ * ubi_fg_io_end - account the end of a foreground read or write.
+ * @ubi: UBI device description object
+ *
+ * Wakes the background thread up if it waits for the foreground I/O to
+ * finish.
+ */
+static inline void ubi_fg_io_end(struct ubi_device *ubi)
+{
+	if (atomic_dec_and_test(&ubi->fg_io) && ubi->bgt_held)
+		wake_up_process(ubi->bgt_thread);
+}
+
 /**
  * vol_id2idx - get table index by volume ID.
  * @ubi: UBI device description object
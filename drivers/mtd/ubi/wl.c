@@ -135,6 +135,16 @@
  */
 #define WL_MAX_FAILURES 32
 
+/*
+ * Below this count of free physical eraseblocks, not counting the ones
+ * reserved for bad block handling, background work is urgent and neither
+ * rate limited nor held back for foreground I/O.
+ */
+#define WL_BGT_URGENT_PEBS 16
+
+/* How often the background thread re-checks held back work, in jiffies */
+#define WL_BGT_POLL (HZ / 100 ? : 1)
+
 static int self_check_ec(struct ubi_device *ubi, int pnum, int ec);
 static int self_check_in_wl_tree(const struct ubi_device *ubi,
 				 struct ubi_wl_entry *e, struct rb_root *root);
@@ -1403,6 +1413,66 @@ static void tree_destroy(struct ubi_device *ubi, struct rb_root *root)
 	}
 }
 
+/**
+ * bgt_urgent - check if background work must be done without delay.
+ * @ubi: UBI device description object
+ */
+static int bgt_urgent(struct ubi_device *ubi)
+{
+	int free = ubi->free_count - ubi->beb_rsvd_pebs;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	free += ubi->fm_pool.size - ubi->fm_pool.used;
+#endif
+	return free < WL_BGT_URGENT_PEBS;
+}
+
+/**
+ * bgt_throttle - apply the background work budget.
+ * @ubi: UBI device description object
+ * @last: when the last work was done
+ * @held_since: set to when the pending work started to be held back for
+ *              foreground I/O
+ *
+ * Non-urgent work is done at most @ubi->bgt_rate times per second, and not
+ * while foreground I/O is in progress unless it has already been held back
+ * for @ubi->bgt_max_defer milliseconds. Returns how many jiffies to wait
+ * before the next work, or %0 if it may be done now.
+ */
+static long bgt_throttle(struct ubi_device *ubi, unsigned long last,
+			 unsigned long *held_since)
+{
+	unsigned long now = jiffies, next;
+
+	if (bgt_urgent(ubi)) {
+		ubi->bgt_held = 0;
+		return 0;
+	}
+
+	if (ubi->bgt_rate) {
+		next = last + msecs_to_jiffies(MSEC_PER_SEC / ubi->bgt_rate);
+		if (time_before(now, next))
+			return next - now;
+	}
+
+	if (!atomic_read(&ubi->fg_io) || !ubi->bgt_max_defer) {
+		ubi->bgt_held = 0;
+		return 0;
+	}
+
+	if (!ubi->bgt_held) {
+		ubi->bgt_held = 1;
+		*held_since = now;
+	}
+
+	next = *held_since + msecs_to_jiffies(ubi->bgt_max_defer);
+	if (time_before(now, next))
+		return min_t(long, next - now, WL_BGT_POLL);
+
+	ubi->bgt_held = 0;
+	return 0;
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1411,12 +1481,14 @@ int ubi_thread(void *u)
 {
 	int failures = 0;
 	struct ubi_device *ubi = u;
+	unsigned long last = jiffies, held_since = 0;
 
 	ubi_msg(ubi, "background thread \"%s\" started, PID %d",
 		ubi->bgt_name, task_pid_nr(current));
 
 	set_freezable();
 	for (;;) {
+		long delay;
 		int err;
 
 		if (kthread_should_stop())
@@ -1435,7 +1507,17 @@ int ubi_thread(void *u)
 		}
 		spin_unlock(&ubi->wl_lock);
 
+		/* Woken up by ubi_fg_io_end() if held back */
+		set_current_state(TASK_INTERRUPTIBLE);
+		delay = bgt_throttle(ubi, last, &held_since);
+		if (delay) {
+			schedule_timeout(delay);
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
 		err = do_work(ubi);
+		last = jiffies;
 		if (err) {
 			ubi_err(ubi, "%s: work failed with error code %d",
 				ubi->bgt_name, err);
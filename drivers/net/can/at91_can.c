@@ -20,7 +20,9 @@
  */
 
 #include <linux/clk.h>
+#include <linux/clocksource.h>
 #include <linux/errno.h>
+#include <linux/log2.h>
 #include <linux/if_arp.h>
 #include <linux/interrupt.h>
 #include <linux/kernel.h>
@@ -32,6 +34,7 @@
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <linux/string.h>
+#include <linux/timecounter.h>
 #include <linux/types.h>
 #include <linux/platform_data/atmel.h>
 
@@ -82,6 +85,7 @@ enum at91_reg {
 
 #define AT91_MID_MIDE		BIT(29)
 
+#define AT91_MSR_MTIMESTAMP	0xffff
 #define AT91_MSR_MRTR		BIT(20)
 #define AT91_MSR_MABT		BIT(22)
 #define AT91_MSR_MRDY		BIT(23)
@@ -152,6 +156,13 @@ struct at91_priv {
 	struct at91_can_data *pdata;
 
 	canid_t mb0_id;
+	canid_t rx_filter_id;
+	canid_t rx_filter_mask;
+
+	/* CAN timer, counting bit times, extended by TOVF */
+	struct cyclecounter cc;
+	struct timecounter tc;
+	spinlock_t tc_lock;
 };
 
 static const struct at91_devtype_data at91_at91sam9263_data = {
@@ -324,6 +335,31 @@ static inline u32 at91_can_id_to_reg_mid(canid_t can_id)
 	return reg_mid;
 }
 
+/*
+ * All RX mailboxes share the acceptance filter, so that they still work
+ * as a FIFO. A zero mask accepts every frame, of both formats.
+ */
+static inline u32 get_rx_filter_mid(const struct at91_priv *priv)
+{
+	if (!priv->rx_filter_mask)
+		return AT91_MID_MIDE;
+
+	return at91_can_id_to_reg_mid(priv->rx_filter_id);
+}
+
+static inline u32 get_rx_filter_mam(const struct at91_priv *priv)
+{
+	canid_t mask = priv->rx_filter_mask;
+
+	if (!mask)
+		return 0;
+
+	/* MIDE in MAM: the frame format must match the filter's */
+	return at91_can_id_to_reg_mid((mask & ~CAN_EFF_FLAG) |
+				      (priv->rx_filter_id & CAN_EFF_FLAG)) |
+		AT91_MID_MIDE;
+}
+
 /*
  * Swtich transceiver on or off
  */
@@ -357,13 +393,13 @@ static void at91_setup_mailboxes(struct net_device *dev)
 		set_mb_mode(priv, i, AT91_MB_MODE_RX);
 	set_mb_mode(priv, get_mb_rx_last(priv), AT91_MB_MODE_RX_OVRWR);
 
-	/* reset acceptance mask and id register */
+	/* set up acceptance mask and id register */
 	for (i = get_mb_rx_first(priv); i <= get_mb_rx_last(priv); i++) {
-		at91_write(priv, AT91_MAM(i), 0x0);
-		at91_write(priv, AT91_MID(i), AT91_MID_MIDE);
+		at91_write(priv, AT91_MAM(i), get_rx_filter_mam(priv));
+		at91_write(priv, AT91_MID(i), get_rx_filter_mid(priv));
 	}
 
-	/* The last 4 mailboxes are used for transmitting. */
+	/* The last get_mb_tx_num() mailboxes are used for transmitting. */
 	for (i = get_mb_tx_first(priv); i <= get_mb_tx_last(priv); i++)
 		set_mb_mode_prio(priv, i, AT91_MB_MODE_TX, 0);
 
@@ -402,6 +438,42 @@ static int at91_get_berr_counter(const struct net_device *dev,
 	return 0;
 }
 
+static cycle_t at91_cc_read(const struct cyclecounter *cc)
+{
+	const struct at91_priv *priv = container_of(cc, struct at91_priv, cc);
+
+	return at91_read(priv, AT91_TIM);
+}
+
+/*
+ * The CAN timer counts bit times from 0 when the controller is enabled,
+ * and wraps after 0x10000 of them: 65ms at 1Mbit/s. The TOVF interrupt,
+ * and each NAPI poll, read the timecounter faster than that.
+ */
+static void at91_timestamp_init(struct at91_priv *priv)
+{
+	u32 bitrate = priv->can.bittiming.bitrate;
+	unsigned long flags;
+
+	priv->cc.read = at91_cc_read;
+	priv->cc.mask = CYCLECOUNTER_MASK(16);
+	clocks_calc_mult_shift(&priv->cc.mult, &priv->cc.shift, bitrate,
+			       NSEC_PER_SEC, DIV_ROUND_UP(0x10000, bitrate));
+
+	spin_lock_irqsave(&priv->tc_lock, flags);
+	timecounter_init(&priv->tc, &priv->cc, ktime_to_ns(ktime_get_real()));
+	spin_unlock_irqrestore(&priv->tc_lock, flags);
+}
+
+static void at91_timestamp_update(struct at91_priv *priv)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->tc_lock, flags);
+	timecounter_read(&priv->tc);
+	spin_unlock_irqrestore(&priv->tc_lock, flags);
+}
+
 static void at91_chip_start(struct net_device *dev)
 {
 	struct at91_priv *priv = netdev_priv(dev);
@@ -424,11 +496,13 @@ static void at91_chip_start(struct net_device *dev)
 	else
 		reg_mr = AT91_MR_CANEN;
 	at91_write(priv, AT91_MR, reg_mr);
+	at91_timestamp_init(priv);
 
 	priv->can.state = CAN_STATE_ERROR_ACTIVE;
 
 	/* Enable interrupts */
-	reg_ier = get_irq_mb_rx(priv) | AT91_IRQ_ERRP | AT91_IRQ_ERR_FRAME;
+	reg_ier = get_irq_mb_rx(priv) | AT91_IRQ_ERRP | AT91_IRQ_ERR_FRAME |
+		AT91_IRQ_TOVF;
 	at91_write(priv, AT91_IDR, AT91_IRQ_ALL);
 	at91_write(priv, AT91_IER, reg_ier);
 }
@@ -588,12 +662,13 @@ static void at91_rx_overflow_err(struct net_device *dev)
  * @dev: net device
  * @mb: mailbox number to read from
  * @cf: can frame where to store message
+ * @timestamp: where to store the CAN timer value of the frame
  *
  * Reads a CAN message from the given mailbox and stores data into
  * given can frame. "mb" and "cf" must be valid.
  */
 static void at91_read_mb(struct net_device *dev, unsigned int mb,
-		struct can_frame *cf)
+		struct can_frame *cf, u16 *timestamp)
 {
 	const struct at91_priv *priv = netdev_priv(dev);
 	u32 reg_msr, reg_mid;
@@ -606,6 +681,7 @@ static void at91_read_mb(struct net_device *dev, unsigned int mb,
 
 	reg_msr = at91_read(priv, AT91_MSR(mb));
 	cf->can_dlc = get_can_dlc((reg_msr >> 16) & 0xf);
+	*timestamp = reg_msr & AT91_MSR_MTIMESTAMP;
 
 	if (reg_msr & AT91_MSR_MRTR)
 		cf->can_id |= CAN_RTR_FLAG;
@@ -614,8 +690,8 @@ static void at91_read_mb(struct net_device *dev, unsigned int mb,
 		*(u32 *)(cf->data + 4) = at91_read(priv, AT91_MDH(mb));
 	}
 
-	/* allow RX of extended frames */
-	at91_write(priv, AT91_MID(mb), AT91_MID_MIDE);
+	/* restore the acceptance id, allowing RX of extended frames */
+	at91_write(priv, AT91_MID(mb), get_rx_filter_mid(priv));
 
 	if (unlikely(mb == get_mb_rx_last(priv) && reg_msr & AT91_MSR_MMI))
 		at91_rx_overflow_err(dev);
@@ -631,9 +707,13 @@ static void at91_read_mb(struct net_device *dev, unsigned int mb,
  */
 static void at91_read_msg(struct net_device *dev, unsigned int mb)
 {
+	struct at91_priv *priv = netdev_priv(dev);
 	struct net_device_stats *stats = &dev->stats;
 	struct can_frame *cf;
 	struct sk_buff *skb;
+	unsigned long flags;
+	u16 timestamp;
+	u64 ns;
 
 	skb = alloc_can_skb(dev, &cf);
 	if (unlikely(!skb)) {
@@ -641,7 +721,13 @@ static void at91_read_msg(struct net_device *dev, unsigned int mb)
 		return;
 	}
 
-	at91_read_mb(dev, mb, cf);
+	at91_read_mb(dev, mb, cf, &timestamp);
+
+	spin_lock_irqsave(&priv->tc_lock, flags);
+	ns = timecounter_cyc2time(&priv->tc, timestamp);
+	spin_unlock_irqrestore(&priv->tc_lock, flags);
+	skb_hwtstamps(skb)->hwtstamp = ns_to_ktime(ns);
+
 	netif_receive_skb(skb);
 
 	stats->rx_packets++;
@@ -813,10 +899,13 @@ static int at91_poll_err(struct net_device *dev, int quota, u32 reg_sr)
 static int at91_poll(struct napi_struct *napi, int quota)
 {
 	struct net_device *dev = napi->dev;
-	const struct at91_priv *priv = netdev_priv(dev);
+	struct at91_priv *priv = netdev_priv(dev);
 	u32 reg_sr = at91_read(priv, AT91_SR);
 	int work_done = 0;
 
+	/* reading SR clears TOVF, which the irq handler may then miss */
+	at91_timestamp_update(priv);
+
 	if (reg_sr & get_irq_mb_rx(priv))
 		work_done += at91_poll_rx(dev, quota - work_done);
 
@@ -837,6 +926,8 @@ static int at91_poll(struct napi_struct *napi, int quota)
 		at91_write(priv, AT91_IER, reg_ier);
 	}
 
+	at91_timestamp_update(priv);
+
 	return work_done;
 }
 
@@ -1111,6 +1202,10 @@ static irqreturn_t at91_irq(int irq, void *dev_id)
 	if (reg_sr & get_irq_mb_tx(priv))
 		at91_irq_tx(dev, reg_sr);
 
+	/* CAN timer wrapped */
+	if (reg_sr & AT91_IRQ_TOVF)
+		at91_timestamp_update(priv);
+
 	at91_irq_err(dev);
 
  exit:
@@ -1247,13 +1342,133 @@ static ssize_t at91_sysfs_set_mb0_id(struct device *dev,
 static DEVICE_ATTR(mb0_id, S_IWUSR | S_IRUGO,
 	at91_sysfs_show_mb0_id, at91_sysfs_set_mb0_id);
 
+/*
+ * Hardware acceptance filter, as "<can_id>:<can_mask>" in the CAN_RAW
+ * filter notation, CAN_EFF_FLAG in can_id selecting extended frames.
+ * Frames which don't match never reach the RX mailboxes.
+ */
+static ssize_t at91_sysfs_show_rx_filter(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct at91_priv *priv = netdev_priv(to_net_dev(dev));
+
+	return snprintf(buf, PAGE_SIZE, "0x%08x:0x%08x\n",
+			priv->rx_filter_id, priv->rx_filter_mask);
+}
+
+static ssize_t at91_sysfs_set_rx_filter(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct net_device *ndev = to_net_dev(dev);
+	struct at91_priv *priv = netdev_priv(ndev);
+	canid_t can_id, can_mask;
+	ssize_t ret;
+
+	if (sscanf(buf, "%x:%x", &can_id, &can_mask) != 2)
+		return -EINVAL;
+
+	rtnl_lock();
+
+	if (ndev->flags & IFF_UP) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (can_id & CAN_EFF_FLAG) {
+		can_id &= CAN_EFF_MASK | CAN_EFF_FLAG;
+		can_mask &= CAN_EFF_MASK;
+	} else {
+		can_id &= CAN_SFF_MASK;
+		can_mask &= CAN_SFF_MASK;
+	}
+
+	priv->rx_filter_id = can_id;
+	priv->rx_filter_mask = can_mask;
+	ret = count;
+
+ out:
+	rtnl_unlock();
+	return ret;
+}
+
+static DEVICE_ATTR(rx_filter, S_IWUSR | S_IRUGO,
+	at91_sysfs_show_rx_filter, at91_sysfs_set_rx_filter);
+
+/*
+ * Number of TX mailboxes, a power of two up to the default. The mailboxes
+ * given up go to the lower RX group, for bursty receive traffic.
+ */
+static ssize_t at91_sysfs_show_tx_mailboxes(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct at91_priv *priv = netdev_priv(to_net_dev(dev));
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", get_mb_tx_num(priv));
+}
+
+static ssize_t at91_sysfs_set_tx_mailboxes(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct net_device *ndev = to_net_dev(dev);
+	struct at91_priv *priv = netdev_priv(ndev);
+	struct at91_devtype_data *data = &priv->devtype_data;
+	unsigned int num, high, mb_last;
+	ssize_t ret;
+	int err;
+
+	err = kstrtouint(buf, 0, &num);
+	if (err)
+		return err;
+
+	if (!num || !is_power_of_2(num) || num > priv->can.echo_skb_max)
+		return -EINVAL;
+
+	rtnl_lock();
+
+	if (ndev->flags & IFF_UP) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	/* keep the size of the upper group, the last mailbox stays TX */
+	high = data->rx_last + 1 - data->rx_split;
+	mb_last = get_mb_tx_last(priv);
+
+	data->tx_shift = ilog2(num);
+	data->rx_last = mb_last - num;
+	data->rx_split = data->rx_last + 1 - high;
+	ret = count;
+
+ out:
+	rtnl_unlock();
+	return ret;
+}
+
+static DEVICE_ATTR(tx_mailboxes, S_IWUSR | S_IRUGO,
+	at91_sysfs_show_tx_mailboxes, at91_sysfs_set_tx_mailboxes);
+
 static struct attribute *at91_sysfs_attrs[] = {
 	&dev_attr_mb0_id.attr,
+	&dev_attr_rx_filter.attr,
+	&dev_attr_tx_mailboxes.attr,
 	NULL,
 };
 
+static umode_t at91_sysfs_attr_is_visible(struct kobject *kobj,
+		struct attribute *attr, int n)
+{
+	struct at91_priv *priv = netdev_priv(to_net_dev(kobj_to_dev(kobj)));
+
+	/* only the sam9263 has the mailbox 0 bug */
+	if (attr == &dev_attr_mb0_id.attr && !at91_is_sam9263(priv))
+		return 0;
+
+	return attr->mode;
+}
+
 static struct attribute_group at91_sysfs_attr_group = {
 	.attrs = at91_sysfs_attrs,
+	.is_visible = at91_sysfs_attr_is_visible,
 };
 
 #if defined(CONFIG_OF)
@@ -1354,11 +1569,11 @@ static int at91_can_probe(struct platform_device *pdev)
 	priv->clk = clk;
 	priv->pdata = dev_get_platdata(&pdev->dev);
 	priv->mb0_id = 0x7ff;
+	spin_lock_init(&priv->tc_lock);
 
 	netif_napi_add(dev, &priv->napi, at91_poll, get_mb_rx_num(priv));
 
-	if (at91_is_sam9263(priv))
-		dev->sysfs_groups[0] = &at91_sysfs_attr_group;
+	dev->sysfs_groups[0] = &at91_sysfs_attr_group;
 
 	platform_set_drvdata(pdev, dev);
 	SET_NETDEV_DEV(dev, &pdev->dev);
@@ -10,6 +10,10 @@
 #ifndef _MACB_H
 #define _MACB_H
 
+#include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
+#include <linux/ptp_clock_kernel.h>
+
 #define MACB_GREGS_NBR 16
 #define MACB_GREGS_VERSION 2
 #define MACB_MAX_QUEUES 8
@@ -72,6 +76,7 @@
 #define GEM_USRIO		0x000c /* User IO */
 #define GEM_DMACFG		0x0010 /* DMA Configuration */
 #define GEM_JML			0x0048 /* Jumbo Max Length */
+#define GEM_IMOD		0x005C /* Interrupt Moderation */
 #define GEM_HRB			0x0080 /* Hash Bottom */
 #define GEM_HRT			0x0084 /* Hash Top */
 #define GEM_SA1B		0x0088 /* Specific1 Bottom */
@@ -129,6 +134,12 @@
 #define GEM_RXIPCCNT		0x01a8 /* IP header Checksum Error Counter */
 #define GEM_RXTCPCCNT		0x01ac /* TCP Checksum Error Counter */
 #define GEM_RXUDPCCNT		0x01b0 /* UDP Checksum Error Counter */
+#define GEM_TISUBN		0x01bc /* 1588 Timer Increment Sub-ns */
+#define GEM_TSH			0x01c0 /* 1588 Timer Seconds High */
+#define GEM_TSL			0x01d0 /* 1588 Timer Seconds Low */
+#define GEM_TN			0x01d4 /* 1588 Timer Nanoseconds */
+#define GEM_TA			0x01d8 /* 1588 Timer Adjust */
+#define GEM_TI			0x01dc /* 1588 Timer Increment */
 #define GEM_DCFG1		0x0280 /* Design Config 1 */
 #define GEM_DCFG2		0x0284 /* Design Config 2 */
 #define GEM_DCFG3		0x0288 /* Design Config 3 */
@@ -136,6 +147,7 @@
 #define GEM_DCFG5		0x0290 /* Design Config 5 */
 #define GEM_DCFG6		0x0294 /* Design Config 6 */
 #define GEM_DCFG7		0x0298 /* Design Config 7 */
+#define GEM_DCFG8		0x029C /* Design Config 8 */
 
 #define GEM_ISR(hw_q)		(0x0400 + ((hw_q) << 2))
 #define GEM_TBQP(hw_q)		(0x0440 + ((hw_q) << 2))
@@ -143,6 +155,18 @@
 #define GEM_IER(hw_q)		(0x0600 + ((hw_q) << 2))
 #define GEM_IDR(hw_q)		(0x0620 + ((hw_q) << 2))
 #define GEM_IMR(hw_q)		(0x0640 + ((hw_q) << 2))
+#define GEM_RBQS(hw_q)		(0x04A0 + ((hw_q) << 2))
+#define GEM_CBSCR		0x04bc /* Credit Based Shaping Control */
+#define GEM_CBSISQA		0x04c0 /* CBS IdleSlope Queue A */
+#define GEM_CBSISQB		0x04c4 /* CBS IdleSlope Queue B */
+#define GEM_TXBDCTRL		0x04cc /* TX Buffer Descriptor Control */
+#define GEM_RXBDCTRL		0x04d0 /* RX Buffer Descriptor Control */
+
+#define GEM_SCRT1(idx)		(0x0500 + ((idx) << 2)) /* Screener Type 1 */
+#define GEM_SCRT2(idx)		(0x0540 + ((idx) << 2)) /* Screener Type 2 */
+#define GEM_ETHT(idx)		(0x06E0 + ((idx) << 2)) /* Screener EtherType */
+#define GEM_T2CMPW0(idx)	(0x0700 + ((idx) << 3)) /* Screener Compare W0 */
+#define GEM_T2CMPW1(idx)	(0x0704 + ((idx) << 3)) /* Screener Compare W1 */
 
 /* Bitfields in NCR */
 #define MACB_LB_OFFSET		0 /* reserved */
@@ -244,7 +268,17 @@
 #define GEM_RXBS_SIZE		8
 #define GEM_DDRP_OFFSET		24 /* disc_when_no_ahb */
 #define GEM_DDRP_SIZE		1
-
+#define GEM_RXEXT_OFFSET	28 /* RX extended descriptor mode */
+#define GEM_RXEXT_SIZE		1
+#define GEM_TXEXT_OFFSET	29 /* TX extended descriptor mode */
+#define GEM_TXEXT_SIZE		1
+
+/* Bitfields in IMOD. */
+#define GEM_RXIMOD_OFFSET	0 /* RX interrupt moderation */
+#define GEM_RXIMOD_SIZE		8
+#define GEM_TXIMOD_OFFSET	16 /* TX interrupt moderation */
+#define GEM_TXIMOD_SIZE		8
+#define GEM_IMOD_NSECS		800 /* IMOD counter resolution */
 
 /* Bitfields in NSR */
 #define MACB_NSR_LINK_OFFSET	0 /* pcs_link_state */
@@ -289,6 +323,8 @@
 #define MACB_RXUBR_SIZE		1
 #define MACB_TXUBR_OFFSET	3 /* TX used bit read */
 #define MACB_TXUBR_SIZE		1
+#define MACB_RM9200_TBRE_OFFSET	3 /* AT91RM9200 only */
+#define MACB_RM9200_TBRE_SIZE	1 /* AT91RM9200 only */
 #define MACB_ISR_TUND_OFFSET	4 /* Enable TX buffer under run interrupt */
 #define MACB_ISR_TUND_SIZE	1
 #define MACB_ISR_RLE_OFFSET	5 /* EN retry exceeded/late coll interrupt */
@@ -370,6 +406,128 @@
 #define GEM_TX_PKT_BUFF_OFFSET			21
 #define GEM_TX_PKT_BUFF_SIZE			1
 
+/* Bitfields in DCFG5. */
+#define GEM_TSU_OFFSET				8
+#define GEM_TSU_SIZE				1
+
+/* Bitfields in DCFG6. */
+#define GEM_PBUF_LSO_OFFSET			27
+#define GEM_PBUF_LSO_SIZE			1
+
+/* Bitfields in TISUBN. */
+#define GEM_SUBNSINCR_OFFSET			0
+#define GEM_SUBNSINCR_SIZE			16
+
+/* Bitfields in TI. */
+#define GEM_NSINCR_OFFSET			0
+#define GEM_NSINCR_SIZE				8
+
+/* Bitfields in TSH. */
+#define GEM_TSH_OFFSET				0 /* seconds [47:32] */
+#define GEM_TSH_SIZE				16
+
+/* Bitfields in TSL. */
+#define GEM_TSL_OFFSET				0 /* seconds [31:0] */
+#define GEM_TSL_SIZE				32
+
+/* Bitfields in TN. */
+#define GEM_TN_OFFSET				0
+#define GEM_TN_SIZE				30
+
+/* Bitfields in TA. */
+#define GEM_ITDT_OFFSET				0 /* increment/decrement */
+#define GEM_ITDT_SIZE				30
+#define GEM_ADDSUB_OFFSET			31
+#define GEM_ADDSUB_SIZE				1
+
+/* Bitfields in TXBDCTRL/RXBDCTRL. */
+#define GEM_TXTSMODE_OFFSET			4
+#define GEM_TXTSMODE_SIZE			2
+#define GEM_RXTSMODE_OFFSET			4
+#define GEM_RXTSMODE_SIZE			2
+
+/* Timestamp modes of TXTSMODE/RXTSMODE */
+#define GEM_TSTAMP_DISABLED			0
+#define GEM_TSTAMP_PTP_EVENT_ONLY		1
+#define GEM_TSTAMP_ALL_PTP_FRAMES		2
+#define GEM_TSTAMP_ALL_FRAMES			3
+
+/* Bitfields in CBSCR. */
+#define GEM_QBE_OFFSET				0 /* Queue B CBS enable */
+#define GEM_QBE_SIZE				1
+#define GEM_QAE_OFFSET				1 /* Queue A CBS enable */
+#define GEM_QAE_SIZE				1
+
+/* Bitfields in DCFG8. */
+#define GEM_T1SCR_OFFSET			24 /* Type 1 screeners */
+#define GEM_T1SCR_SIZE				8
+#define GEM_T2SCR_OFFSET			16 /* Type 2 screeners */
+#define GEM_T2SCR_SIZE				8
+#define GEM_SCR2ETH_OFFSET			8 /* EtherType registers */
+#define GEM_SCR2ETH_SIZE			8
+#define GEM_SCR2CMP_OFFSET			0 /* Compare registers */
+#define GEM_SCR2CMP_SIZE			8
+
+/* Bitfields in SCRT1. */
+#define GEM_T1QUEUE_OFFSET			0 /* Queue number */
+#define GEM_T1QUEUE_SIZE			4
+#define GEM_DSTCM_OFFSET			4 /* IP DS / TC field match */
+#define GEM_DSTCM_SIZE				8
+#define GEM_UDPM_OFFSET				12 /* UDP port match */
+#define GEM_UDPM_SIZE				16
+#define GEM_DSTCE_OFFSET			28 /* DS / TC match enable */
+#define GEM_DSTCE_SIZE				1
+#define GEM_UDPE_OFFSET				29 /* UDP port match enable */
+#define GEM_UDPE_SIZE				1
+
+/* Bitfields in SCRT2. */
+#define GEM_T2QUEUE_OFFSET			0 /* Queue number */
+#define GEM_T2QUEUE_SIZE			4
+#define GEM_VLANPR_OFFSET			4 /* VLAN priority */
+#define GEM_VLANPR_SIZE				3
+#define GEM_VLANEN_OFFSET			8 /* VLAN priority enable */
+#define GEM_VLANEN_SIZE				1
+#define GEM_ETHT2IDX_OFFSET			9 /* EtherType register index */
+#define GEM_ETHT2IDX_SIZE			3
+#define GEM_ETHTEN_OFFSET			12 /* EtherType match enable */
+#define GEM_ETHTEN_SIZE				1
+#define GEM_CMPA_OFFSET				13 /* Compare A index */
+#define GEM_CMPA_SIZE				5
+#define GEM_CMPAEN_OFFSET			18 /* Compare A enable */
+#define GEM_CMPAEN_SIZE				1
+#define GEM_CMPB_OFFSET				19 /* Compare B index */
+#define GEM_CMPB_SIZE				5
+#define GEM_CMPBEN_OFFSET			24 /* Compare B enable */
+#define GEM_CMPBEN_SIZE				1
+#define GEM_CMPC_OFFSET				25 /* Compare C index */
+#define GEM_CMPC_SIZE				5
+#define GEM_CMPCEN_OFFSET			30 /* Compare C enable */
+#define GEM_CMPCEN_SIZE				1
+
+/* Bitfields in ETHT. */
+#define GEM_ETHTCMP_OFFSET			0 /* EtherType compare value */
+#define GEM_ETHTCMP_SIZE			16
+
+/* Bitfields in T2CMPW0. */
+#define GEM_T2MASK_OFFSET			0 /* 16-bit compare mask */
+#define GEM_T2MASK_SIZE				16
+#define GEM_T2CMP_OFFSET			16 /* 16-bit compare value */
+#define GEM_T2CMP_SIZE				16
+
+/* Bitfields in T2CMPW1. */
+#define GEM_T2OFST_OFFSET			0 /* Offset from T2CMPOFST */
+#define GEM_T2OFST_SIZE				7
+#define GEM_T2CMPOFST_OFFSET			7 /* Offset base */
+#define GEM_T2CMPOFST_SIZE			2
+#define GEM_T2DISMSK_OFFSET			9 /* 32-bit compare, no mask */
+#define GEM_T2DISMSK_SIZE			1
+
+/* Offset bases of T2CMPOFST */
+#define GEM_T2COMPOFST_SOF			0 /* start of frame */
+#define GEM_T2COMPOFST_ETYPE			1 /* after the EtherType */
+#define GEM_T2COMPOFST_IPHDR			2 /* after the IP header */
+#define GEM_T2COMPOFST_TCPUDP			3 /* after the TCP/UDP header */
+
 /* Constants for CLK */
 #define MACB_CLK_DIV8				0
 #define MACB_CLK_DIV16				1
@@ -400,6 +558,9 @@
 #define MACB_CAPS_SG_DISABLED			0x40000000
 #define MACB_CAPS_MACB_IS_GEM			0x80000000
 #define MACB_CAPS_JUMBO				0x00000010
+#define MACB_CAPS_INT_MODERATION		0x00000020
+#define MACB_CAPS_GEM_HAS_PTP			0x00000040
+#define MACB_CAPS_GEM_HAS_CBS			0x00000080
 
 /* Bit manipulation macros */
 #define MACB_BIT(name)					\
@@ -468,6 +629,27 @@ struct macb_dma_desc {
 	u32	ctrl;
 };
 
+/* Extension of the descriptor when timestamps are enabled */
+struct macb_dma_desc_ptp {
+	u32	ts_1;
+	u32	ts_2;
+};
+
+/* Timestamp fields of the extended descriptors */
+#define GEM_DMA_RXVALID_OFFSET			2 /* RX desc addr word */
+#define GEM_DMA_RXVALID_SIZE			1
+#define GEM_DMA_TXVALID_OFFSET			23 /* TX desc ctrl word */
+#define GEM_DMA_TXVALID_SIZE			1
+#define GEM_DMA_NSEC_OFFSET			0 /* ts_1 */
+#define GEM_DMA_NSEC_SIZE			30
+#define GEM_DMA_SECL_OFFSET			30 /* ts_1 */
+#define GEM_DMA_SECL_SIZE			2
+#define GEM_DMA_SECH_OFFSET			0 /* ts_2 */
+#define GEM_DMA_SECH_SIZE			4
+#define GEM_DMA_SEC_WIDTH		(GEM_DMA_SECH_SIZE + GEM_DMA_SECL_SIZE)
+#define GEM_DMA_SEC_TOP			(1 << GEM_DMA_SEC_WIDTH)
+#define GEM_DMA_SEC_MASK		(GEM_DMA_SEC_TOP - 1)
+
 /* DMA descriptor bitfields */
 #define MACB_RX_USED_OFFSET			0
 #define MACB_RX_USED_SIZE			1
@@ -542,6 +724,18 @@ struct macb_dma_desc {
 #define GEM_TX_FRMLEN_OFFSET			0
 #define GEM_TX_FRMLEN_SIZE			14
 
+/* GEM large send offload, header descriptor */
+#define MACB_TX_LSO_OFFSET			17
+#define MACB_TX_LSO_SIZE			2
+#define MACB_TX_TCP_SEQ_SRC_OFFSET		19
+#define MACB_TX_TCP_SEQ_SRC_SIZE		1
+/* GEM large send offload, payload descriptors */
+#define MACB_MSS_MFS_OFFSET			16
+#define MACB_MSS_MFS_SIZE			14
+
+#define MACB_LSO_UFO_ENABLE			0x01
+#define MACB_LSO_TSO_ENABLE			0x02
+
 /* Buffer descriptor constants */
 #define GEM_RX_CSUM_NONE			0
 #define GEM_RX_CSUM_IP_ONLY			1
@@ -742,13 +936,42 @@ static const struct gem_statistic gem_statistics[] = {
 
 #define GEM_STATS_LEN ARRAY_SIZE(gem_statistics)
 
+/* Software statistics kept for each queue */
+struct queue_stats {
+	unsigned long	tx_ring_hiwater;	/* most descriptors in use */
+	unsigned long	tx_napi_budget_exhausted;
+	unsigned long	tx_reclaims;		/* TX interrupts reclaimed */
+	unsigned long	tx_reclaim_ns;		/* hardirq to reclaim, total */
+	unsigned long	tx_reclaim_max_ns;
+	unsigned long	rx_refill_failures;
+	unsigned long	rx_napi_budget_exhausted;
+};
+
+#define QUEUE_STAT_TITLE(name) {				\
+	.stat_string = #name,					\
+	.offset = offsetof(struct queue_stats, name),		\
+}
+
+static const struct gem_statistic queue_statistics[] = {
+	QUEUE_STAT_TITLE(tx_ring_hiwater),
+	QUEUE_STAT_TITLE(tx_napi_budget_exhausted),
+	QUEUE_STAT_TITLE(tx_reclaims),
+	QUEUE_STAT_TITLE(tx_reclaim_ns),
+	QUEUE_STAT_TITLE(tx_reclaim_max_ns),
+	QUEUE_STAT_TITLE(rx_refill_failures),
+	QUEUE_STAT_TITLE(rx_napi_budget_exhausted),
+};
+
+#define QUEUE_STATS_LEN ARRAY_SIZE(queue_statistics)
+
 struct macb;
+struct macb_queue;
 
 struct macb_or_gem_ops {
 	int	(*mog_alloc_rx_buffers)(struct macb *bp);
 	void	(*mog_free_rx_buffers)(struct macb *bp);
 	void	(*mog_init_rings)(struct macb *bp);
-	int	(*mog_rx)(struct macb *bp, int budget);
+	int	(*mog_rx)(struct macb_queue *queue, int budget);
 };
 
 struct macb_config {
@@ -760,6 +983,18 @@ struct macb_config {
 	int	jumbo_max_len;
 };
 
+/* TSU timer increment: whole and 1/65536 nanoseconds per clock cycle */
+struct tsu_incr {
+	u32			sub_ns;
+	u32			ns;
+};
+
+/* ethtool RX flow rule, backed by a type 2 screener */
+struct gem_flow_rule {
+	struct ethtool_rx_flow_spec	fs;
+	struct list_head		list;
+};
+
 struct macb_queue {
 	struct macb		*bp;
 	int			irq;
@@ -769,12 +1004,41 @@ struct macb_queue {
 	unsigned int		IDR;
 	unsigned int		IMR;
 	unsigned int		TBQP;
+	unsigned int		RBQP;
+	unsigned int		RBQS;
 
 	unsigned int		tx_head, tx_tail;
+	unsigned int		tx_unkicked;	/* queued since last TSTART */
 	struct macb_dma_desc	*tx_ring;
 	struct macb_tx_skb	*tx_skb;
 	dma_addr_t		tx_ring_dma;
 	struct work_struct	tx_error_task;
+	struct napi_struct	napi_tx;
+
+	unsigned int		rx_tail;
+	unsigned int		rx_prepared_head;
+	struct macb_dma_desc	*rx_ring;
+	struct sk_buff		**rx_skbuff;
+	void			**rx_frags;	/* RX page mode buffers */
+	void			*rx_buffers;
+	dma_addr_t		rx_ring_dma;
+	dma_addr_t		rx_buffers_dma;
+	struct napi_struct	napi;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	atomic_t		poll_state;	/* NAPI or socket owns RX */
+#endif
+
+	/* interrupt coalescing */
+	struct hrtimer		coalesce_timer;	/* software fallback */
+	u32			coalesce_pending;
+	unsigned int		rx_coalesce_usecs;
+	unsigned int		rx_sample_pkts;
+	unsigned long		rx_sample_start;
+
+	struct queue_stats	stats;
+	u64			tx_irq_ns;	/* oldest unreclaimed TCOMP */
+
+	u32			tx_maxrate;	/* Mbps, CBS queues only */
 };
 
 struct macb {
@@ -785,12 +1049,22 @@ struct macb {
 	u32	(*macb_reg_readl)(struct macb *bp, int offset);
 	void	(*macb_reg_writel)(struct macb *bp, int offset, u32 value);
 
-	unsigned int		rx_tail;
-	unsigned int		rx_prepared_head;
-	struct macb_dma_desc	*rx_ring;
-	struct sk_buff		**rx_skbuff;
-	void			*rx_buffers;
+	unsigned int		rx_ring_size;
+	unsigned int		tx_ring_size;
+
 	size_t			rx_buffer_size;
+	unsigned int		rx_frag_size;	/* non zero in RX page mode */
+	unsigned int		rx_copybreak;
+	u32			priv_flags;
+
+	/* ethtool -C settings */
+	u32			rx_coalesce_usecs;
+	u32			tx_coalesce_usecs;
+	bool			use_adaptive_rx_coalesce;
+	u32			pkt_rate_low;
+	u32			pkt_rate_high;
+	u32			rx_coalesce_usecs_low;
+	u32			rx_coalesce_usecs_high;
 
 	unsigned int		num_queues;
 	unsigned int		queue_mask;
@@ -802,16 +1076,12 @@ struct macb {
 	struct clk		*hclk;
 	struct clk		*tx_clk;
 	struct net_device	*dev;
-	struct napi_struct	napi;
 	struct net_device_stats	stats;
 	union {
 		struct macb_stats	macb;
 		struct gem_stats	gem;
 	}			hw_stats;
 
-	dma_addr_t		rx_ring_dma;
-	dma_addr_t		rx_buffers_dma;
-
 	struct macb_or_gem_ops	macbgem_ops;
 
 	struct mii_bus		*mii_bus;
@@ -825,16 +1095,41 @@ struct macb {
 
 	phy_interface_t		phy_interface;
 
-	/* AT91RM9200 transmit */
-	struct sk_buff *skb;			/* holds skb until xmit interrupt completes */
-	dma_addr_t skb_physaddr;		/* phys addr from pci_map_single */
-	int skb_length;				/* saved skb length for pci_unmap_single */
+	/* AT91RM9200 transmit queue (1 on wire + 1 queued) */
+	struct macb_tx_skb	rm9200_txq[2];
+	unsigned int		rm9200_tx_tail;
+	unsigned int		rm9200_tx_len;
 	unsigned int		max_tx_length;
 
-	u64			ethtool_stats[GEM_STATS_LEN];
+	u64			ethtool_stats[GEM_STATS_LEN +
+					      QUEUE_STATS_LEN * MACB_MAX_QUEUES];
 
 	unsigned int		rx_frm_len_mask;
 	unsigned int		jumbo_max_len;
+
+	/* GEM RX flow steering screeners (from DCFG8) */
+	unsigned int		num_t1_screeners;
+	unsigned int		num_t2_screeners;
+	unsigned int		num_t2_ethertypes;
+	unsigned int		num_t2_compares;
+
+	/* ethtool RX flow rules, sorted by location (under RTNL) */
+	struct list_head	rx_fs_list;
+	unsigned int		rx_fs_count;
+	unsigned int		max_tuples;
+
+	/* GEM time stamp unit */
+	struct ptp_clock	*ptp_clock;
+	struct ptp_clock_info	ptp_clock_info;
+	struct tsu_incr		tsu_incr;
+	spinlock_t		tsu_clk_lock;	/* protects TSU registers */
+	unsigned long		tsu_rate;
+	struct hwtstamp_config	tstamp_config;
+
+	/* SRAM quota for the descriptor rings, NULL when they are in DDR */
+	struct gen_pool		*sram_pool;
+
+	struct dentry		*debugfs_dir;
 };
 
 static inline bool macb_is_gem(struct macb *bp)
@@ -842,4 +1137,55 @@ static inline bool macb_is_gem(struct macb *bp)
 	return !!(bp->caps & MACB_CAPS_MACB_IS_GEM);
 }
 
+static inline bool gem_has_ptp(struct macb *bp)
+{
+	return !!(bp->caps & MACB_CAPS_GEM_HAS_PTP);
+}
+
+#ifdef CONFIG_MACB_USE_HWSTAMP
+void gem_ptp_init(struct net_device *dev);
+void gem_ptp_remove(struct net_device *dev);
+void gem_ptp_txstamp(struct macb *bp, struct sk_buff *skb,
+		     struct macb_dma_desc *desc);
+void gem_ptp_rxstamp(struct macb *bp, struct sk_buff *skb,
+		     struct macb_dma_desc *desc);
+int gem_get_ts_info(struct net_device *dev, struct ethtool_ts_info *info);
+int gem_get_hwtst(struct net_device *dev, struct ifreq *rq);
+int gem_set_hwtst(struct net_device *dev, struct ifreq *rq);
+
+static inline bool gem_ptp_tx_wanted(struct macb *bp, struct sk_buff *skb)
+{
+	return bp->tstamp_config.tx_type == HWTSTAMP_TX_ON &&
+	       (skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP);
+}
+#else
+static inline void gem_ptp_init(struct net_device *dev) { }
+static inline void gem_ptp_remove(struct net_device *dev) { }
+static inline void gem_ptp_txstamp(struct macb *bp, struct sk_buff *skb,
+				   struct macb_dma_desc *desc) { }
+static inline void gem_ptp_rxstamp(struct macb *bp, struct sk_buff *skb,
+				   struct macb_dma_desc *desc) { }
+
+static inline int gem_get_ts_info(struct net_device *dev,
+				  struct ethtool_ts_info *info)
+{
+	return ethtool_op_get_ts_info(dev, info);
+}
+
+static inline int gem_get_hwtst(struct net_device *dev, struct ifreq *rq)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int gem_set_hwtst(struct net_device *dev, struct ifreq *rq)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline bool gem_ptp_tx_wanted(struct macb *bp, struct sk_buff *skb)
+{
+	return false;
+}
+#endif
+
 #endif /* _MACB_H */
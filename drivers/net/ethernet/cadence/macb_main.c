@@ -9,7 +9,9 @@
  */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/atmel-sram.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/kernel.h>
@@ -20,29 +22,47 @@
 #include <linux/io.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
+#include <linux/hrtimer.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/dma-mapping.h>
 #include <linux/platform_data/macb.h>
 #include <linux/platform_device.h>
 #include <linux/phy.h>
+#include <linux/seq_file.h>
+#include <linux/if_vlan.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/of_mdio.h>
 #include <linux/of_net.h>
+#include <net/busy_poll.h>
 
 #include "macb.h"
 
 #define MACB_RX_BUFFER_SIZE	128
+#define MACB_RX_COPYBREAK	256 /* bytes */
 #define RX_BUFFER_MULTIPLE	64  /* bytes */
-#define RX_RING_SIZE		512 /* must be power of 2 */
-#define RX_RING_BYTES		(sizeof(struct macb_dma_desc) * RX_RING_SIZE)
-
-#define TX_RING_SIZE		128 /* must be power of 2 */
-#define TX_RING_BYTES		(sizeof(struct macb_dma_desc) * TX_RING_SIZE)
+#define GEM_RX_SCATTER_SIZE	1536 /* bytes, larger frames span buffers */
+#define DEFAULT_RX_RING_SIZE	512 /* must be power of 2 */
+#define MIN_RX_RING_SIZE	64
+#define MAX_RX_RING_SIZE	8192
+#define RX_RING_BYTES(bp)	(macb_dma_desc_get_size(bp)	\
+				 * (bp)->rx_ring_size)
+
+#define DEFAULT_TX_RING_SIZE	128 /* must be power of 2 */
+#define MIN_TX_RING_SIZE	64
+#define MAX_TX_RING_SIZE	4096
+#define TX_RING_BYTES(bp)	(macb_dma_desc_get_size(bp)	\
+				 * (bp)->tx_ring_size)
 
 /* level of occupied TX descriptors under which we wake up TX process */
-#define MACB_TX_WAKEUP_THRESH	(3 * TX_RING_SIZE / 4)
+#define MACB_TX_WAKEUP_THRESH(bp)	(3 * (bp)->tx_ring_size / 4)
+
+/* descriptors queued under skb->xmit_more before TSTART is written anyway */
+#define MACB_TX_KICK_THRESH(bp)		((bp)->tx_ring_size / 4)
 
 #define MACB_RX_INT_FLAGS	(MACB_BIT(RCOMP) | MACB_BIT(RXUBR)	\
 				 | MACB_BIT(ISR_ROVR))
@@ -56,6 +76,22 @@
 
 #define GEM_MTU_MIN_SIZE	68
 
+#define MACB_NETIF_LSO		(NETIF_F_TSO | NETIF_F_UFO)
+#define MACB_TX_LEN_ALIGN	8
+
+/* ethtool private flags */
+#define MACB_PRIV_RX_PAGE_MODE	0x00000001
+#define MACB_PRIV_FLAGS_LEN	1
+
+/* Interrupt coalescing */
+#define MACB_MAX_COALESCE_USECS	1000
+#define GEM_MAX_IMOD_USECS	((((1 << GEM_RXIMOD_SIZE) - 1) *	\
+				  GEM_IMOD_NSECS) / NSEC_PER_USEC)
+#define MACB_PKT_RATE_LOW	10000	/* pkts/s */
+#define MACB_PKT_RATE_HIGH	50000	/* pkts/s */
+#define MACB_RX_COALESCE_HIGH	100	/* usecs */
+#define MACB_COALESCE_SAMPLE	(HZ / 20)
+
 /*
  * Graceful stop timeouts in us. We should allow up to
  * 1 frame time (10 Mbits/s, full-duplex, ignoring collisions)
@@ -63,45 +99,132 @@
 #define MACB_HALT_TIMEOUT	1230
 
 /* Ring buffer accessors */
-static unsigned int macb_tx_ring_wrap(unsigned int index)
+/* Descriptors are followed by two timestamp words when the GEM runs in
+ * extended descriptor mode.
+ */
+static unsigned int macb_dma_desc_get_size(struct macb *bp)
+{
+	if (gem_has_ptp(bp))
+		return sizeof(struct macb_dma_desc) +
+		       sizeof(struct macb_dma_desc_ptp);
+
+	return sizeof(struct macb_dma_desc);
+}
+
+static unsigned int macb_adj_dma_desc_idx(struct macb *bp, unsigned int idx)
+{
+	return idx * (macb_dma_desc_get_size(bp) /
+		      sizeof(struct macb_dma_desc));
+}
+
+static unsigned int macb_tx_ring_wrap(struct macb *bp, unsigned int index)
 {
-	return index & (TX_RING_SIZE - 1);
+	return index & (bp->tx_ring_size - 1);
 }
 
 static struct macb_dma_desc *macb_tx_desc(struct macb_queue *queue,
 					  unsigned int index)
 {
-	return &queue->tx_ring[macb_tx_ring_wrap(index)];
+	struct macb *bp = queue->bp;
+
+	index = macb_tx_ring_wrap(bp, index);
+	return &queue->tx_ring[macb_adj_dma_desc_idx(bp, index)];
 }
 
 static struct macb_tx_skb *macb_tx_skb(struct macb_queue *queue,
 				       unsigned int index)
 {
-	return &queue->tx_skb[macb_tx_ring_wrap(index)];
+	return &queue->tx_skb[macb_tx_ring_wrap(queue->bp, index)];
 }
 
 static dma_addr_t macb_tx_dma(struct macb_queue *queue, unsigned int index)
 {
 	dma_addr_t offset;
 
-	offset = macb_tx_ring_wrap(index) * sizeof(struct macb_dma_desc);
+	offset = macb_tx_ring_wrap(queue->bp, index) *
+		 macb_dma_desc_get_size(queue->bp);
 
 	return queue->tx_ring_dma + offset;
 }
 
-static unsigned int macb_rx_ring_wrap(unsigned int index)
+static unsigned int macb_rx_ring_wrap(struct macb *bp, unsigned int index)
+{
+	return index & (bp->rx_ring_size - 1);
+}
+
+static struct macb_dma_desc *macb_rx_desc(struct macb_queue *queue,
+					  unsigned int index)
+{
+	struct macb *bp = queue->bp;
+
+	index = macb_rx_ring_wrap(bp, index);
+	return &queue->rx_ring[macb_adj_dma_desc_idx(bp, index)];
+}
+
+static void *macb_rx_buffer(struct macb_queue *queue, unsigned int index)
+{
+	struct macb *bp = queue->bp;
+
+	if (bp->rx_frag_size)
+		return queue->rx_frags[macb_rx_ring_wrap(bp, index)];
+
+	return queue->rx_buffers +
+	       bp->rx_buffer_size * macb_rx_ring_wrap(bp, index);
+}
+
+/* RX page mode: receive buffers are page fragments mapped for streaming
+ * DMA. They are handed to the stack without copying the payload and are
+ * refilled from the page fragment cache, which recycles a page as soon
+ * as the stack has released all of its fragments. Frames up to
+ * rx_copybreak bytes are copied and their buffers are given straight
+ * back to the hardware.
+ */
+static unsigned int macb_rx_frag_headroom(struct macb *bp)
+{
+	/* GEM frames are turned into skbs with build_skb() */
+	return macb_is_gem(bp) ? NET_SKB_PAD : 0;
+}
+
+/* Buffer address of an RX descriptor, without the status bits */
+static dma_addr_t macb_rx_addr(struct macb *bp, u32 addr)
+{
+	addr = MACB_BF(RX_WADDR, MACB_BFEXT(RX_WADDR, addr));
+	if (gem_has_ptp(bp))
+		addr &= ~GEM_BIT(DMA_RXVALID);
+
+	return addr;
+}
+
+static dma_addr_t macb_rx_frag_dma(struct macb_queue *queue,
+				   unsigned int index)
 {
-	return index & (RX_RING_SIZE - 1);
+	return macb_rx_addr(queue->bp, macb_rx_desc(queue, index)->addr);
 }
 
-static struct macb_dma_desc *macb_rx_desc(struct macb *bp, unsigned int index)
+static void *macb_alloc_rx_frag(struct macb *bp, dma_addr_t *paddr)
 {
-	return &bp->rx_ring[macb_rx_ring_wrap(index)];
+	void *data;
+
+	data = netdev_alloc_frag(bp->rx_frag_size);
+	if (unlikely(!data))
+		return NULL;
+
+	*paddr = dma_map_single(&bp->pdev->dev,
+				data + macb_rx_frag_headroom(bp),
+				bp->rx_buffer_size, DMA_FROM_DEVICE);
+	if (dma_mapping_error(&bp->pdev->dev, *paddr)) {
+		put_page(virt_to_head_page(data));
+		return NULL;
+	}
+
+	return data;
 }
 
-static void *macb_rx_buffer(struct macb *bp, unsigned int index)
+static void macb_free_rx_frag(struct macb *bp, void *data, dma_addr_t paddr)
 {
-	return bp->rx_buffers + bp->rx_buffer_size * macb_rx_ring_wrap(index);
+	dma_unmap_single(&bp->pdev->dev, paddr, bp->rx_buffer_size,
+			 DMA_FROM_DEVICE);
+	put_page(virt_to_head_page(data));
 }
 
 /* I/O accessors */
@@ -562,12 +685,13 @@ static void macb_tx_error_task(struct work_struct *work)
 		    (unsigned int)(queue - bp->queues),
 		    queue->tx_tail, queue->tx_head);
 
-	/* Prevent the queue IRQ handlers from running: each of them may call
-	 * macb_tx_interrupt(), which in turn may call netif_wake_subqueue().
+	/* Prevent TX completion from running: it may call
+	 * netif_wake_subqueue() and it walks the ring without the lock.
 	 * As explained below, we have to halt the transmission before updating
 	 * TBQP registers so we call netif_tx_stop_all_queues() to notify the
 	 * network engine about the macb/gem being halted.
 	 */
+	napi_disable(&queue->napi_tx);
 	spin_lock_irqsave(&bp->lock, flags);
 
 	/* Make sure nobody is trying to queue up new packets */
@@ -608,7 +732,8 @@ static void macb_tx_error_task(struct work_struct *work)
 			 */
 			if (!(ctrl & MACB_BIT(TX_BUF_EXHAUSTED))) {
 				netdev_vdbg(bp->dev, "txerr skb %u (data %p) TX complete\n",
-					    macb_tx_ring_wrap(tail), skb->data);
+					    macb_tx_ring_wrap(bp, tail),
+					    skb->data);
 				bp->stats.tx_packets++;
 				bp->stats.tx_bytes += skb->len;
 			}
@@ -640,7 +765,10 @@ static void macb_tx_error_task(struct work_struct *work)
 	queue_writel(queue, TBQP, queue->tx_ring_dma);
 	/* Make TX ring reflect state of hardware */
 	queue->tx_head = 0;
+	queue->tx_unkicked = 0;
 	queue->tx_tail = 0;
+	netdev_tx_reset_queue(netdev_get_tx_queue(bp->dev,
+						  queue - bp->queues));
 
 	/* Housework before enabling TX IRQ */
 	macb_writel(bp, TSR, macb_readl(bp, TSR));
@@ -651,15 +779,22 @@ static void macb_tx_error_task(struct work_struct *work)
 	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
 
 	spin_unlock_irqrestore(&bp->lock, flags);
+	napi_enable(&queue->napi_tx);
 }
 
-static void macb_tx_interrupt(struct macb_queue *queue)
+/* Reclaim up to budget transmitted frames. This runs in the TX NAPI
+ * context only: macb_start_xmit() is the sole producer and publishes
+ * tx_head once the descriptors are set up, so the ring is walked without
+ * taking bp->lock.
+ */
+static int macb_tx_complete(struct macb_queue *queue, int budget)
 {
 	unsigned int tail;
 	unsigned int head;
 	u32 status;
 	struct macb *bp = queue->bp;
 	u16 queue_index = queue - bp->queues;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 
 	status = macb_readl(bp, TSR);
 	macb_writel(bp, TSR, status);
@@ -667,11 +802,14 @@ static void macb_tx_interrupt(struct macb_queue *queue)
 	if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
 		queue_writel(queue, ISR, MACB_BIT(TCOMP));
 
-	netdev_vdbg(bp->dev, "macb_tx_interrupt status = 0x%03lx\n",
+	netdev_vdbg(bp->dev, "macb_tx_complete status = 0x%03lx\n",
 		(unsigned long)status);
 
-	head = queue->tx_head;
-	for (tail = queue->tx_tail; tail != head; tail++) {
+	head = ACCESS_ONCE(queue->tx_head);
+	smp_rmb();
+
+	for (tail = queue->tx_tail; tail != head && pkts_compl < budget;
+	     tail++) {
 		struct macb_tx_skb	*tx_skb;
 		struct sk_buff		*skb;
 		struct macb_dma_desc	*desc;
@@ -697,10 +835,17 @@ static void macb_tx_interrupt(struct macb_queue *queue)
 
 			/* First, update TX stats if needed */
 			if (skb) {
+				if (unlikely(skb_shinfo(skb)->tx_flags &
+					     SKBTX_IN_PROGRESS))
+					gem_ptp_txstamp(bp, skb, desc);
+
 				netdev_vdbg(bp->dev, "skb %u (data %p) TX complete\n",
-					    macb_tx_ring_wrap(tail), skb->data);
+					    macb_tx_ring_wrap(bp, tail),
+					    skb->data);
 				bp->stats.tx_packets++;
 				bp->stats.tx_bytes += skb->len;
+				pkts_compl++;
+				bytes_compl += skb->len;
 			}
 
 			/* Now we can safely release resources */
@@ -715,33 +860,116 @@ static void macb_tx_interrupt(struct macb_queue *queue)
 		}
 	}
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(bp->dev, queue_index),
+				  pkts_compl, bytes_compl);
+
 	queue->tx_tail = tail;
+
+	/* Pairs with the barrier in macb_start_xmit() stopping the queue */
+	smp_mb();
 	if (__netif_subqueue_stopped(bp->dev, queue_index) &&
 	    CIRC_CNT(queue->tx_head, queue->tx_tail,
-		     TX_RING_SIZE) <= MACB_TX_WAKEUP_THRESH)
+		     bp->tx_ring_size) <= MACB_TX_WAKEUP_THRESH(bp))
 		netif_wake_subqueue(bp->dev, queue_index);
+
+	return pkts_compl;
+}
+
+static bool macb_tx_complete_pending(struct macb_queue *queue)
+{
+	if (queue->tx_tail == ACCESS_ONCE(queue->tx_head))
+		return false;
+
+	/* Make hw descriptor updates visible to CPU */
+	rmb();
+
+	return !!(macb_tx_desc(queue, queue->tx_tail)->ctrl &
+		  MACB_BIT(TX_USED));
+}
+
+static int macb_tx_poll(struct napi_struct *napi, int budget)
+{
+	struct macb_queue *queue = container_of(napi, struct macb_queue,
+						napi_tx);
+	struct macb *bp = queue->bp;
+	unsigned long lat;
+	int work_done;
+
+	work_done = macb_tx_complete(queue, budget);
+
+	if (queue->tx_irq_ns) {
+		lat = ktime_get_ns() - queue->tx_irq_ns;
+		queue->tx_irq_ns = 0;
+		queue->stats.tx_reclaims++;
+		queue->stats.tx_reclaim_ns += lat;
+		if (lat > queue->stats.tx_reclaim_max_ns)
+			queue->stats.tx_reclaim_max_ns = lat;
+	}
+
+	if (work_done == budget)
+		queue->stats.tx_napi_budget_exhausted++;
+
+	if (work_done < budget) {
+		napi_complete(napi);
+
+		queue_writel(queue, IER, MACB_BIT(TCOMP));
+
+		/* Frames may have completed after the ring was walked but
+		 * before TCOMP got unmasked: poll again rather than wait
+		 * for an interrupt that may not come.
+		 */
+		if (macb_tx_complete_pending(queue)) {
+			queue_writel(queue, IDR, MACB_BIT(TCOMP));
+			if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
+				queue_writel(queue, ISR, MACB_BIT(TCOMP));
+			napi_reschedule(napi);
+		}
+	}
+
+	return work_done;
 }
 
-static void gem_rx_refill(struct macb *bp)
+static void gem_rx_refill(struct macb_queue *queue)
 {
+	struct macb		*bp = queue->bp;
+	struct macb_dma_desc	*desc;
 	unsigned int		entry;
 	struct sk_buff		*skb;
 	dma_addr_t		paddr;
+	void			*data;
 
-	while (CIRC_SPACE(bp->rx_prepared_head, bp->rx_tail, RX_RING_SIZE) > 0) {
-		entry = macb_rx_ring_wrap(bp->rx_prepared_head);
+	while (CIRC_SPACE(queue->rx_prepared_head, queue->rx_tail,
+			  bp->rx_ring_size) > 0) {
+		entry = macb_rx_ring_wrap(bp, queue->rx_prepared_head);
+		desc = macb_rx_desc(queue, entry);
 
 		/* Make hw descriptor updates visible to CPU */
 		rmb();
 
-		bp->rx_prepared_head++;
+		queue->rx_prepared_head++;
+
+		if (bp->rx_frag_size && !queue->rx_frags[entry]) {
+			data = macb_alloc_rx_frag(bp, &paddr);
+			if (unlikely(!data)) {
+				netdev_err(bp->dev,
+					   "Unable to allocate RX buffer\n");
+				queue->stats.rx_refill_failures++;
+				break;
+			}
+
+			queue->rx_frags[entry] = data;
 
-		if (bp->rx_skbuff[entry] == NULL) {
+			if (entry == bp->rx_ring_size - 1)
+				paddr |= MACB_BIT(RX_WRAP);
+			desc->addr = paddr;
+			desc->ctrl = 0;
+		} else if (!bp->rx_frag_size && !queue->rx_skbuff[entry]) {
 			/* allocate sk_buff for this free entry in ring */
 			skb = netdev_alloc_skb(bp->dev, bp->rx_buffer_size);
 			if (unlikely(skb == NULL)) {
 				netdev_err(bp->dev,
 					   "Unable to allocate sk_buff\n");
+				queue->stats.rx_refill_failures++;
 				break;
 			}
 
@@ -750,39 +978,43 @@ static void gem_rx_refill(struct macb *bp)
 					       bp->rx_buffer_size, DMA_FROM_DEVICE);
 			if (dma_mapping_error(&bp->pdev->dev, paddr)) {
 				dev_kfree_skb(skb);
+				queue->stats.rx_refill_failures++;
 				break;
 			}
 
-			bp->rx_skbuff[entry] = skb;
+			queue->rx_skbuff[entry] = skb;
 
-			if (entry == RX_RING_SIZE - 1)
+			if (entry == bp->rx_ring_size - 1)
 				paddr |= MACB_BIT(RX_WRAP);
-			bp->rx_ring[entry].addr = paddr;
-			bp->rx_ring[entry].ctrl = 0;
+			desc->addr = paddr;
+			desc->ctrl = 0;
 
 			/* properly align Ethernet header */
 			skb_reserve(skb, NET_IP_ALIGN);
 		} else {
-			bp->rx_ring[entry].addr &= ~MACB_BIT(RX_USED);
-			bp->rx_ring[entry].ctrl = 0;
+			desc->addr &= ~MACB_BIT(RX_USED);
+			if (gem_has_ptp(bp))
+				desc->addr &= ~GEM_BIT(DMA_RXVALID);
+			desc->ctrl = 0;
 		}
 	}
 
 	/* Make descriptor updates visible to hardware */
 	wmb();
 
-	netdev_vdbg(bp->dev, "rx ring: prepared head %d, tail %d\n",
-		   bp->rx_prepared_head, bp->rx_tail);
+	netdev_vdbg(bp->dev, "rx ring %u: prepared head %d, tail %d\n",
+		    (unsigned int)(queue - bp->queues),
+		    queue->rx_prepared_head, queue->rx_tail);
 }
 
 /* Mark DMA descriptors from begin up to and not including end as unused */
-static void discard_partial_frame(struct macb *bp, unsigned int begin,
+static void discard_partial_frame(struct macb_queue *queue, unsigned int begin,
 				  unsigned int end)
 {
 	unsigned int frag;
 
 	for (frag = begin; frag != end; frag++) {
-		struct macb_dma_desc *desc = macb_rx_desc(bp, frag);
+		struct macb_dma_desc *desc = macb_rx_desc(queue, frag);
 		desc->addr &= ~MACB_BIT(RX_USED);
 	}
 
@@ -796,19 +1028,203 @@ static void discard_partial_frame(struct macb *bp, unsigned int begin,
 	 */
 }
 
-static int gem_rx(struct macb *bp, int budget)
+/* Build the skb for a frame received in a page mode buffer */
+static struct sk_buff *gem_rx_frag(struct macb_queue *queue,
+				   unsigned int entry, dma_addr_t addr,
+				   unsigned int len)
+{
+	struct macb *bp = queue->bp;
+	void *data = queue->rx_frags[entry];
+	struct sk_buff *skb;
+
+	if (len <= bp->rx_copybreak) {
+		skb = napi_alloc_skb(&queue->napi, len);
+		if (unlikely(!skb))
+			return NULL;
+
+		dma_sync_single_for_cpu(&bp->pdev->dev, addr,
+					len + NET_IP_ALIGN, DMA_FROM_DEVICE);
+		skb_copy_to_linear_data(skb, data + NET_SKB_PAD + NET_IP_ALIGN,
+					len);
+		dma_sync_single_for_device(&bp->pdev->dev, addr,
+					   len + NET_IP_ALIGN, DMA_FROM_DEVICE);
+		skb_put(skb, len);
+
+		/* the buffer stays in the ring and is reused on refill */
+		return skb;
+	}
+
+	skb = build_skb(data, bp->rx_frag_size);
+	if (unlikely(!skb))
+		return NULL;
+
+	dma_unmap_single(&bp->pdev->dev, addr, bp->rx_buffer_size,
+			 DMA_FROM_DEVICE);
+	queue->rx_frags[entry] = NULL;
+
+	skb_reserve(skb, NET_SKB_PAD + NET_IP_ALIGN);
+	skb_put(skb, len);
+
+	return skb;
+}
+
+/* Number of page mode buffers holding the frame that starts at rx_tail,
+ * or 0 if the hardware is still writing them. The last descriptor of
+ * the frame is returned in *last; it lacks EOF if the frame was cut
+ * short by the start of another one.
+ */
+static unsigned int gem_rx_frame_frags(struct macb_queue *queue,
+				       struct macb_dma_desc **last)
+{
+	unsigned int frag = queue->rx_tail + 1;
+	struct macb_dma_desc *desc;
+
+	for (; frag != queue->rx_prepared_head; frag++) {
+		desc = macb_rx_desc(queue, frag);
+
+		/* Make hw descriptor updates visible to CPU */
+		rmb();
+
+		if (!(desc->addr & MACB_BIT(RX_USED)))
+			return 0;
+		if (desc->ctrl & MACB_BIT(RX_SOF))
+			return frag - queue->rx_tail;
+
+		*last = desc;
+		if (desc->ctrl & MACB_BIT(RX_EOF))
+			return frag - queue->rx_tail + 1;
+	}
+
+	return 0;
+}
+
+/* Build the skb for a jumbo frame scattered over several page mode
+ * buffers: the first buffer becomes the skb head and the following
+ * ones are attached as page fragments, so the payload is not copied.
+ */
+static struct sk_buff *gem_rx_frags(struct macb_queue *queue,
+				    unsigned int entry, dma_addr_t addr,
+				    unsigned int frags, unsigned int len)
+{
+	struct macb *bp = queue->bp;
+	unsigned int frag, frag_len, offset;
+	struct sk_buff *skb;
+	struct page *page;
+	void *data;
+
+	offset = bp->rx_buffer_size - NET_IP_ALIGN;
+	skb = gem_rx_frag(queue, entry, addr, offset);
+	if (unlikely(!skb))
+		return NULL;
+
+	for (frag = 1; frag < frags && offset < len; frag++) {
+		entry = macb_rx_ring_wrap(bp, entry + 1);
+		frag_len = min_t(unsigned int, len - offset,
+				 bp->rx_buffer_size);
+		data = queue->rx_frags[entry];
+
+		dma_unmap_single(&bp->pdev->dev, macb_rx_frag_dma(queue, entry),
+				 bp->rx_buffer_size, DMA_FROM_DEVICE);
+		queue->rx_frags[entry] = NULL;
+
+		page = virt_to_head_page(data);
+		skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags, page,
+				data + NET_SKB_PAD - page_address(page),
+				frag_len, bp->rx_frag_size);
+		offset += frag_len;
+	}
+
+	return skb;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* RX ring ownership between NAPI and socket busy polling */
+enum macb_poll_state {
+	MACB_POLL_IDLE,
+	MACB_POLL_NAPI,
+	MACB_POLL_SOCKET,
+	MACB_POLL_DISABLED,
+};
+
+static void macb_poll_init(struct macb_queue *queue)
+{
+	atomic_set(&queue->poll_state, MACB_POLL_IDLE);
+}
+
+static bool macb_poll_lock(struct macb_queue *queue, int owner)
+{
+	return atomic_cmpxchg(&queue->poll_state, MACB_POLL_IDLE,
+			      owner) == MACB_POLL_IDLE;
+}
+
+static void macb_poll_unlock(struct macb_queue *queue)
+{
+	atomic_set(&queue->poll_state, MACB_POLL_IDLE);
+}
+
+static bool macb_busy_polling(struct macb_queue *queue)
+{
+	return atomic_read(&queue->poll_state) == MACB_POLL_SOCKET;
+}
+
+/* Wait for a busy polling socket to leave the ring, then keep it out */
+static void macb_poll_disable(struct macb_queue *queue)
+{
+	while (!macb_poll_lock(queue, MACB_POLL_DISABLED))
+		usleep_range(100, 200);
+}
+#else
+#define MACB_POLL_NAPI	0
+
+static inline void macb_poll_init(struct macb_queue *queue)
+{
+}
+
+static inline bool macb_poll_lock(struct macb_queue *queue, int owner)
+{
+	return true;
+}
+
+static inline void macb_poll_unlock(struct macb_queue *queue)
+{
+}
+
+static inline bool macb_busy_polling(struct macb_queue *queue)
+{
+	return false;
+}
+
+static inline void macb_poll_disable(struct macb_queue *queue)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
+/* GRO only pays off when NAPI flushes it at the end of the poll */
+static void macb_rx_skb(struct macb_queue *queue, struct sk_buff *skb)
+{
+	skb_mark_napi_id(skb, &queue->napi);
+
+	if (macb_busy_polling(queue))
+		netif_receive_skb(skb);
+	else
+		napi_gro_receive(&queue->napi, skb);
+}
+
+static int gem_rx(struct macb_queue *queue, int budget)
 {
+	struct macb		*bp = queue->bp;
 	unsigned int		len;
 	unsigned int		entry;
+	unsigned int		frags;
 	struct sk_buff		*skb;
-	struct macb_dma_desc	*desc;
+	struct macb_dma_desc	*desc, *last;
 	int			count = 0;
 
 	while (count < budget) {
 		u32 addr, ctrl;
 
-		entry = macb_rx_ring_wrap(bp->rx_tail);
-		desc = &bp->rx_ring[entry];
+		entry = macb_rx_ring_wrap(bp, queue->rx_tail);
+		desc = macb_rx_desc(queue, entry);
 
 		/* Make hw descriptor updates visible to CPU */
 		rmb();
@@ -819,32 +1235,60 @@ static int gem_rx(struct macb *bp, int budget)
 		if (!(addr & MACB_BIT(RX_USED)))
 			break;
 
-		bp->rx_tail++;
+		/* Jumbo frames are scattered over several page mode buffers */
+		frags = 1;
+		last = desc;
+		if (bp->rx_frag_size && ctrl & MACB_BIT(RX_SOF) &&
+		    !(ctrl & MACB_BIT(RX_EOF))) {
+			frags = gem_rx_frame_frags(queue, &last);
+			if (!frags)
+				break;
+		}
+
+		queue->rx_tail += frags;
 		count++;
 
-		if (!(ctrl & MACB_BIT(RX_SOF) && ctrl & MACB_BIT(RX_EOF))) {
+		if (!(ctrl & MACB_BIT(RX_SOF) &&
+		      last->ctrl & MACB_BIT(RX_EOF))) {
 			netdev_err(bp->dev,
 				   "not whole frame pointed by descriptor\n");
 			bp->stats.rx_dropped++;
 			break;
 		}
-		skb = bp->rx_skbuff[entry];
-		if (unlikely(!skb)) {
-			netdev_err(bp->dev,
-				   "inconsistent Rx descriptor chain\n");
-			bp->stats.rx_dropped++;
-			break;
-		}
-		/* now everything is ready for receiving packet */
-		bp->rx_skbuff[entry] = NULL;
+		ctrl = last->ctrl;
 		len = ctrl & bp->rx_frm_len_mask;
+		addr = macb_rx_addr(bp, addr);
 
-		netdev_vdbg(bp->dev, "gem_rx %u (len %u)\n", entry, len);
+		netdev_vdbg(bp->dev, "gem_rx %u (len %u, %u buffers)\n",
+			    entry, len, frags);
 
-		skb_put(skb, len);
-		addr = MACB_BF(RX_WADDR, MACB_BFEXT(RX_WADDR, addr));
-		dma_unmap_single(&bp->pdev->dev, addr,
-				 bp->rx_buffer_size, DMA_FROM_DEVICE);
+		if (frags > 1) {
+			skb = gem_rx_frags(queue, entry, addr, frags, len);
+			if (unlikely(!skb)) {
+				bp->stats.rx_dropped++;
+				continue;
+			}
+		} else if (bp->rx_frag_size) {
+			skb = gem_rx_frag(queue, entry, addr, len);
+			if (unlikely(!skb)) {
+				bp->stats.rx_dropped++;
+				continue;
+			}
+		} else {
+			skb = queue->rx_skbuff[entry];
+			if (unlikely(!skb)) {
+				netdev_err(bp->dev,
+					   "inconsistent Rx descriptor chain\n");
+				bp->stats.rx_dropped++;
+				break;
+			}
+			/* now everything is ready for receiving packet */
+			queue->rx_skbuff[entry] = NULL;
+
+			skb_put(skb, len);
+			dma_unmap_single(&bp->pdev->dev, addr,
+					 bp->rx_buffer_size, DMA_FROM_DEVICE);
+		}
 
 		skb->protocol = eth_type_trans(skb, bp->dev);
 		skb_checksum_none_assert(skb);
@@ -853,6 +1297,9 @@ static int gem_rx(struct macb *bp, int budget)
 		    GEM_BFEXT(RX_CSUM, ctrl) & GEM_RX_CSUM_CHECKED_MASK)
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
 
+		if (gem_has_ptp(bp))
+			gem_ptp_rxstamp(bp, skb, last);
+
 		bp->stats.rx_packets++;
 		bp->stats.rx_bytes += skb->len;
 
@@ -865,29 +1312,121 @@ static int gem_rx(struct macb *bp, int budget)
 			       skb->data, 32, true);
 #endif
 
-		netif_receive_skb(skb);
+		macb_rx_skb(queue, skb);
 	}
 
-	gem_rx_refill(bp);
+	gem_rx_refill(queue);
 
 	return count;
 }
 
-static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
+/* Page mode receive of a frame spanning several buffers: the first
+ * buffer, which holds the headers, is copied into the skb linear area
+ * and the following ones are attached as page fragments and replaced
+ * by fresh buffers in the ring.
+ */
+static int macb_rx_frame_frags(struct macb_queue *queue,
+			       unsigned int first_frag,
+			       unsigned int last_frag, unsigned int len)
+{
+	struct macb *bp = queue->bp;
+	unsigned int frag = first_frag;
+	unsigned int frag_len, offset;
+	struct macb_dma_desc *desc;
+	struct sk_buff *skb;
+	struct page *page;
+	dma_addr_t paddr;
+	void *data, *buf;
+
+	skb = napi_alloc_skb(&queue->napi, bp->rx_buffer_size);
+	if (!skb)
+		goto drop;
+
+	frag_len = min_t(unsigned int, len + NET_IP_ALIGN, bp->rx_buffer_size);
+	paddr = macb_rx_frag_dma(queue, frag);
+	dma_sync_single_for_cpu(&bp->pdev->dev, paddr, frag_len,
+				DMA_FROM_DEVICE);
+	memcpy(skb_put(skb, frag_len - NET_IP_ALIGN),
+	       macb_rx_buffer(queue, frag) + NET_IP_ALIGN,
+	       frag_len - NET_IP_ALIGN);
+	dma_sync_single_for_device(&bp->pdev->dev, paddr, frag_len,
+				   DMA_FROM_DEVICE);
+	macb_rx_desc(queue, frag)->addr &= ~MACB_BIT(RX_USED);
+	offset = frag_len;
+
+	while (frag != last_frag) {
+		frag++;
+		frag_len = min_t(unsigned int, len + NET_IP_ALIGN - offset,
+				 bp->rx_buffer_size);
+
+		data = macb_alloc_rx_frag(bp, &paddr);
+		if (unlikely(!data)) {
+			queue->stats.rx_refill_failures++;
+			dev_kfree_skb_any(skb);
+			goto drop;
+		}
+
+		buf = macb_rx_buffer(queue, frag);
+		dma_unmap_single(&bp->pdev->dev, macb_rx_frag_dma(queue, frag),
+				 bp->rx_buffer_size, DMA_FROM_DEVICE);
+		page = virt_to_head_page(buf);
+		skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags, page,
+				buf - page_address(page), frag_len,
+				bp->rx_frag_size);
+
+		queue->rx_frags[macb_rx_ring_wrap(bp, frag)] = data;
+		desc = macb_rx_desc(queue, frag);
+		desc->addr = paddr | (desc->addr & MACB_BIT(RX_WRAP));
+		offset += frag_len;
+	}
+
+	/* Make descriptor updates visible to hardware */
+	wmb();
+
+	skb->protocol = eth_type_trans(skb, bp->dev);
+
+	bp->stats.rx_packets++;
+	bp->stats.rx_bytes += skb->len;
+	netdev_vdbg(bp->dev, "received paged skb of length %u\n", skb->len);
+	macb_rx_skb(queue, skb);
+
+	return 0;
+
+drop:
+	bp->stats.rx_dropped++;
+	for (; ; frag++) {
+		desc = macb_rx_desc(queue, frag);
+		desc->addr &= ~MACB_BIT(RX_USED);
+		if (frag == last_frag)
+			break;
+	}
+
+	/* Make descriptor updates visible to hardware */
+	wmb();
+
+	return 1;
+}
+
+static int macb_rx_frame(struct macb_queue *queue, unsigned int first_frag,
 			 unsigned int last_frag)
 {
+	struct macb *bp = queue->bp;
 	unsigned int len;
 	unsigned int frag;
 	unsigned int offset;
 	struct sk_buff *skb;
 	struct macb_dma_desc *desc;
 
-	desc = macb_rx_desc(bp, last_frag);
+	desc = macb_rx_desc(queue, last_frag);
 	len = desc->ctrl & bp->rx_frm_len_mask;
 
 	netdev_vdbg(bp->dev, "macb_rx_frame frags %u - %u (len %u)\n",
-		macb_rx_ring_wrap(first_frag),
-		macb_rx_ring_wrap(last_frag), len);
+		macb_rx_ring_wrap(bp, first_frag),
+		macb_rx_ring_wrap(bp, last_frag), len);
+
+	if (bp->rx_frag_size && len > bp->rx_copybreak &&
+	    last_frag - first_frag <= MAX_SKB_FRAGS)
+		return macb_rx_frame_frags(queue, first_frag, last_frag, len);
 
 	/*
 	 * The ethernet header starts NET_IP_ALIGN bytes into the
@@ -902,7 +1441,7 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	if (!skb) {
 		bp->stats.rx_dropped++;
 		for (frag = first_frag; ; frag++) {
-			desc = macb_rx_desc(bp, frag);
+			desc = macb_rx_desc(queue, frag);
 			desc->addr &= ~MACB_BIT(RX_USED);
 			if (frag == last_frag)
 				break;
@@ -926,10 +1465,18 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 			BUG_ON(frag != last_frag);
 			frag_len = len - offset;
 		}
+		if (bp->rx_frag_size)
+			dma_sync_single_for_cpu(&bp->pdev->dev,
+						macb_rx_frag_dma(queue, frag),
+						frag_len, DMA_FROM_DEVICE);
 		skb_copy_to_linear_data_offset(skb, offset,
-				macb_rx_buffer(bp, frag), frag_len);
+				macb_rx_buffer(queue, frag), frag_len);
+		if (bp->rx_frag_size)
+			dma_sync_single_for_device(&bp->pdev->dev,
+						   macb_rx_frag_dma(queue, frag),
+						   frag_len, DMA_FROM_DEVICE);
 		offset += bp->rx_buffer_size;
-		desc = macb_rx_desc(bp, frag);
+		desc = macb_rx_desc(queue, frag);
 		desc->addr &= ~MACB_BIT(RX_USED);
 
 		if (frag == last_frag)
@@ -946,19 +1493,19 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	bp->stats.rx_bytes += skb->len;
 	netdev_vdbg(bp->dev, "received skb of length %u, csum: %08x\n",
 		   skb->len, skb->csum);
-	netif_receive_skb(skb);
+	macb_rx_skb(queue, skb);
 
 	return 0;
 }
 
-static int macb_rx(struct macb *bp, int budget)
+static int macb_rx(struct macb_queue *queue, int budget)
 {
 	int received = 0;
 	unsigned int tail;
 	int first_frag = -1;
 
-	for (tail = bp->rx_tail; budget > 0; tail++) {
-		struct macb_dma_desc *desc = macb_rx_desc(bp, tail);
+	for (tail = queue->rx_tail; budget > 0; tail++) {
+		struct macb_dma_desc *desc = macb_rx_desc(queue, tail);
 		u32 addr, ctrl;
 
 		/* Make hw descriptor updates visible to CPU */
@@ -972,7 +1519,7 @@ static int macb_rx(struct macb *bp, int budget)
 
 		if (ctrl & MACB_BIT(RX_SOF)) {
 			if (first_frag != -1)
-				discard_partial_frame(bp, first_frag, tail);
+				discard_partial_frame(queue, first_frag, tail);
 			first_frag = tail;
 		}
 
@@ -980,7 +1527,7 @@ static int macb_rx(struct macb *bp, int budget)
 			int dropped;
 			BUG_ON(first_frag == -1);
 
-			dropped = macb_rx_frame(bp, first_frag, tail);
+			dropped = macb_rx_frame(queue, first_frag, tail);
 			first_frag = -1;
 			if (!dropped) {
 				received++;
@@ -990,55 +1537,185 @@ static int macb_rx(struct macb *bp, int budget)
 	}
 
 	if (first_frag != -1)
-		bp->rx_tail = first_frag;
+		queue->rx_tail = first_frag;
 	else
-		bp->rx_tail = tail;
+		queue->rx_tail = tail;
 
 	return received;
 }
 
-static int macb_poll(struct napi_struct *napi, int budget)
+static bool macb_has_imod(struct macb *bp)
 {
-	struct macb *bp = container_of(napi, struct macb, napi);
-	int work_done;
-	u32 status;
+	return !!(bp->caps & MACB_CAPS_INT_MODERATION);
+}
 
-	status = macb_readl(bp, RSR);
-	macb_writel(bp, RSR, status);
+static unsigned int macb_max_coalesce_usecs(struct macb *bp)
+{
+	return macb_has_imod(bp) ? GEM_MAX_IMOD_USECS : MACB_MAX_COALESCE_USECS;
+}
 
-	work_done = 0;
+/* The moderation register is shared by all the queues: only its RX delay
+ * can follow the adaptive mode, and queue 0 is the one driving it.
+ */
+static void gem_write_imod(struct macb *bp, unsigned int rx_usecs)
+{
+	u32 rx, tx;
 
-	netdev_vdbg(bp->dev, "poll: status = %08lx, budget = %d\n",
-		   (unsigned long)status, budget);
+	rx = DIV_ROUND_UP(rx_usecs * NSEC_PER_USEC, GEM_IMOD_NSECS);
+	tx = DIV_ROUND_UP(bp->tx_coalesce_usecs * NSEC_PER_USEC,
+			  GEM_IMOD_NSECS);
 
-	work_done = bp->macbgem_ops.mog_rx(bp, budget);
-	if (work_done < budget) {
-		napi_complete(napi);
+	gem_writel(bp, IMOD, GEM_BF(RXIMOD, rx) | GEM_BF(TXIMOD, tx));
+}
 
-		/* Packets received while interrupts were disabled */
-		status = macb_readl(bp, RSR);
-		if (status) {
-			if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
-				macb_writel(bp, ISR, MACB_BIT(RCOMP));
-			napi_reschedule(napi);
-		} else {
-			macb_writel(bp, IER, MACB_RX_INT_FLAGS);
-		}
-	}
+/* Software fallback for controllers without interrupt moderation: the
+ * interrupt source stays masked and its handling is delayed until the
+ * coalescing timer expires.
+ */
+static void macb_coalesce_defer(struct macb_queue *queue, u32 events,
+				unsigned int usecs)
+{
+	queue->coalesce_pending |= events;
+	if (!hrtimer_active(&queue->coalesce_timer))
+		hrtimer_start(&queue->coalesce_timer,
+			      ns_to_ktime(usecs * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+}
 
-	/* TODO: Handle errors */
+static enum hrtimer_restart macb_coalesce_timer(struct hrtimer *timer)
+{
+	struct macb_queue *queue = container_of(timer, struct macb_queue,
+						coalesce_timer);
+	struct macb *bp = queue->bp;
+	unsigned long flags;
+	u32 pending;
 
-	return work_done;
+	spin_lock_irqsave(&bp->lock, flags);
+	pending = queue->coalesce_pending;
+	queue->coalesce_pending = 0;
+	spin_unlock_irqrestore(&bp->lock, flags);
+
+	/* Interrupts are enabled again once NAPI is done */
+	if (pending & MACB_BIT(TCOMP))
+		napi_schedule(&queue->napi_tx);
+	if (pending & MACB_BIT(RCOMP))
+		napi_schedule(&queue->napi);
+
+	return HRTIMER_NORESTART;
 }
 
-static irqreturn_t macb_interrupt(int irq, void *dev_id)
+static void macb_adapt_rx_coalesce(struct macb_queue *queue, int work_done)
 {
-	struct macb_queue *queue = dev_id;
 	struct macb *bp = queue->bp;
-	struct net_device *dev = bp->dev;
-	u32 status, ctrl;
+	unsigned long elapsed;
+	unsigned int usecs;
+	u32 rate;
 
-	status = queue_readl(queue, ISR);
+	queue->rx_sample_pkts += work_done;
+
+	elapsed = jiffies - queue->rx_sample_start;
+	if (elapsed < MACB_COALESCE_SAMPLE)
+		return;
+
+	rate = queue->rx_sample_pkts * HZ / elapsed;
+	queue->rx_sample_pkts = 0;
+	queue->rx_sample_start = jiffies;
+
+	if (rate < bp->pkt_rate_low)
+		usecs = bp->rx_coalesce_usecs_low;
+	else if (rate > bp->pkt_rate_high)
+		usecs = bp->rx_coalesce_usecs_high;
+	else
+		usecs = bp->rx_coalesce_usecs;
+
+	if (usecs == queue->rx_coalesce_usecs)
+		return;
+
+	netdev_vdbg(bp->dev, "queue %u: %u pkts/s, rx delay %u us\n",
+		    (unsigned int)(queue - bp->queues), rate, usecs);
+
+	queue->rx_coalesce_usecs = usecs;
+	if (macb_has_imod(bp) && queue == bp->queues)
+		gem_write_imod(bp, usecs);
+}
+
+static int macb_poll(struct napi_struct *napi, int budget)
+{
+	struct macb_queue *queue = container_of(napi, struct macb_queue, napi);
+	struct macb *bp = queue->bp;
+	int work_done;
+	u32 status;
+
+	/* A socket is busy polling the ring: come back later */
+	if (!macb_poll_lock(queue, MACB_POLL_NAPI))
+		return budget;
+
+	status = macb_readl(bp, RSR);
+	macb_writel(bp, RSR, status);
+
+	work_done = 0;
+
+	netdev_vdbg(bp->dev, "poll: status = %08lx, budget = %d\n",
+		   (unsigned long)status, budget);
+
+	work_done = bp->macbgem_ops.mog_rx(queue, budget);
+	if (bp->use_adaptive_rx_coalesce)
+		macb_adapt_rx_coalesce(queue, work_done);
+
+	if (work_done == budget)
+		queue->stats.rx_napi_budget_exhausted++;
+
+	macb_poll_unlock(queue);
+
+	if (work_done < budget) {
+		napi_complete(napi);
+
+		/* Packets received while interrupts were disabled */
+		status = macb_readl(bp, RSR);
+		if (status) {
+			if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
+				queue_writel(queue, ISR, MACB_BIT(RCOMP));
+			napi_reschedule(napi);
+		} else {
+			queue_writel(queue, IER, MACB_RX_INT_FLAGS);
+		}
+	}
+
+	/* TODO: Handle errors */
+
+	return work_done;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* Called by low latency sockets, with bottom halves disabled */
+static int macb_busy_poll(struct napi_struct *napi)
+{
+	struct macb_queue *queue = container_of(napi, struct macb_queue, napi);
+	struct macb *bp = queue->bp;
+	int work_done;
+
+	if (!netif_running(bp->dev))
+		return LL_FLUSH_FAILED;
+
+	if (!macb_poll_lock(queue, MACB_POLL_SOCKET))
+		return LL_FLUSH_BUSY;
+
+	work_done = bp->macbgem_ops.mog_rx(queue, 4);
+
+	macb_poll_unlock(queue);
+
+	return work_done;
+}
+#endif
+
+static irqreturn_t macb_interrupt(int irq, void *dev_id)
+{
+	struct macb_queue *queue = dev_id;
+	struct macb *bp = queue->bp;
+	struct net_device *dev = bp->dev;
+	u32 status, ctrl;
+
+	status = queue_readl(queue, ISR);
 
 	if (unlikely(!status))
 		return IRQ_NONE;
@@ -1068,9 +1745,12 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 			if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
 				queue_writel(queue, ISR, MACB_BIT(RCOMP));
 
-			if (napi_schedule_prep(&bp->napi)) {
+			if (!macb_has_imod(bp) && queue->rx_coalesce_usecs) {
+				macb_coalesce_defer(queue, MACB_BIT(RCOMP),
+						    queue->rx_coalesce_usecs);
+			} else if (napi_schedule_prep(&queue->napi)) {
 				netdev_vdbg(bp->dev, "scheduling RX softirq\n");
-				__napi_schedule(&bp->napi);
+				__napi_schedule(&queue->napi);
 			}
 		}
 
@@ -1084,8 +1764,21 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 			break;
 		}
 
-		if (status & MACB_BIT(TCOMP))
-			macb_tx_interrupt(queue);
+		if (status & MACB_BIT(TCOMP)) {
+			/* TX completion is handled in its own NAPI context */
+			queue_writel(queue, IDR, MACB_BIT(TCOMP));
+			if (bp->caps & MACB_CAPS_ISR_CLEAR_ON_WRITE)
+				queue_writel(queue, ISR, MACB_BIT(TCOMP));
+
+			if (!queue->tx_irq_ns)
+				queue->tx_irq_ns = ktime_get_ns();
+
+			if (!macb_has_imod(bp) && bp->tx_coalesce_usecs)
+				macb_coalesce_defer(queue, MACB_BIT(TCOMP),
+						    bp->tx_coalesce_usecs);
+			else
+				napi_schedule(&queue->napi_tx);
+		}
 
 		/*
 		 * Link change detection isn't possible with RMII, so we'll
@@ -1157,6 +1850,20 @@ static void macb_poll_controller(struct net_device *dev)
 }
 #endif
 
+/* Size of the first TX buffer: with LSO the hardware wants the protocol
+ * headers alone in the first descriptor.
+ */
+static unsigned int macb_tx_hdrlen(struct macb *bp, struct sk_buff *skb)
+{
+	if (!skb_is_gso(skb))
+		return min(skb_headlen(skb), bp->max_tx_length);
+
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP)
+		return skb_transport_offset(skb);
+
+	return skb_transport_offset(skb) + tcp_hdrlen(skb);
+}
+
 static unsigned int macb_tx_map(struct macb *bp,
 				struct macb_queue *queue,
 				struct sk_buff *skb)
@@ -1168,14 +1875,29 @@ static unsigned int macb_tx_map(struct macb *bp,
 	unsigned int offset, size, count = 0;
 	unsigned int f, nr_frags = skb_shinfo(skb)->nr_frags;
 	unsigned int eof = 1;
+	u32 lso_ctrl = 0, mss_mfs = 0;
 	u32 ctrl;
 
+	if (skb_is_gso(skb)) {
+		if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP) {
+			lso_ctrl = MACB_LSO_UFO_ENABLE;
+			/* UDP checksum is not computed by hardware for UFO */
+			udp_hdr(skb)->check = 0;
+			/* MFS includes header and FCS */
+			mss_mfs = skb_shinfo(skb)->gso_size +
+				  skb_transport_offset(skb) + ETH_FCS_LEN;
+		} else {
+			lso_ctrl = MACB_LSO_TSO_ENABLE;
+			mss_mfs = skb_shinfo(skb)->gso_size;
+		}
+	}
+
 	/* First, map non-paged data */
 	len = skb_headlen(skb);
+	size = macb_tx_hdrlen(bp, skb);
 	offset = 0;
 	while (len) {
-		size = min(len, bp->max_tx_length);
-		entry = macb_tx_ring_wrap(tx_head);
+		entry = macb_tx_ring_wrap(bp, tx_head);
 		tx_skb = &queue->tx_skb[entry];
 
 		mapping = dma_map_single(&bp->pdev->dev,
@@ -1194,6 +1916,8 @@ static unsigned int macb_tx_map(struct macb *bp,
 		offset += size;
 		count++;
 		tx_head++;
+
+		size = min(len, bp->max_tx_length);
 	}
 
 	/* Then, map paged data from fragments */
@@ -1204,7 +1928,7 @@ static unsigned int macb_tx_map(struct macb *bp,
 		offset = 0;
 		while (len) {
 			size = min(len, bp->max_tx_length);
-			entry = macb_tx_ring_wrap(tx_head);
+			entry = macb_tx_ring_wrap(bp, tx_head);
 			tx_skb = &queue->tx_skb[entry];
 
 			mapping = skb_frag_dma_map(&bp->pdev->dev, frag,
@@ -1242,25 +1966,34 @@ static unsigned int macb_tx_map(struct macb *bp,
 	 * to set the end of TX queue
 	 */
 	i = tx_head;
-	entry = macb_tx_ring_wrap(i);
+	entry = macb_tx_ring_wrap(bp, i);
 	ctrl = MACB_BIT(TX_USED);
-	desc = &queue->tx_ring[entry];
+	desc = macb_tx_desc(queue, entry);
 	desc->ctrl = ctrl;
 
 	do {
 		i--;
-		entry = macb_tx_ring_wrap(i);
+		entry = macb_tx_ring_wrap(bp, i);
 		tx_skb = &queue->tx_skb[entry];
-		desc = &queue->tx_ring[entry];
+		desc = macb_tx_desc(queue, entry);
 
 		ctrl = (u32)tx_skb->size;
 		if (eof) {
 			ctrl |= MACB_BIT(TX_LAST);
 			eof = 0;
 		}
-		if (unlikely(entry == (TX_RING_SIZE - 1)))
+		if (unlikely(entry == (bp->tx_ring_size - 1)))
 			ctrl |= MACB_BIT(TX_WRAP);
 
+		/* The first descriptor carries the LSO mode, the payload
+		 * ones the MSS (TSO) or MFS (UFO). TCP sequence numbers are
+		 * taken from the header (TX_TCP_SEQ_SRC left to 0).
+		 */
+		if (i == queue->tx_head)
+			ctrl |= MACB_BF(TX_LSO, lso_ctrl);
+		else
+			ctrl |= MACB_BF(MSS_MFS, mss_mfs);
+
 		/* Set TX buffer descriptor */
 		desc->addr = tx_skb->mapping;
 		/* desc->addr must be visible to hardware before clearing
@@ -1286,13 +2019,59 @@ dma_error:
 	return 0;
 }
 
+static netdev_features_t macb_features_check(struct sk_buff *skb,
+					     struct net_device *dev,
+					     netdev_features_t features)
+{
+	unsigned int nr_frags, f;
+	unsigned int hdrlen;
+
+	/* Validate LSO compatibility: only UFO has constraints */
+	if (!skb_is_gso(skb) || !(skb_shinfo(skb)->gso_type & SKB_GSO_UDP))
+		return features;
+
+	/* Hardware UFO only handles IPv4 */
+	if (vlan_get_protocol(skb) != htons(ETH_P_IP))
+		return features & ~MACB_NETIF_LSO;
+
+	if (!skb_is_nonlinear(skb))
+		return features;
+
+	/* When there are several payload buffers, all of them but the last
+	 * one must have a size multiple of 8 bytes.
+	 */
+	hdrlen = skb_transport_offset(skb);
+	if (!IS_ALIGNED(skb_headlen(skb) - hdrlen, MACB_TX_LEN_ALIGN))
+		return features & ~MACB_NETIF_LSO;
+
+	nr_frags = skb_shinfo(skb)->nr_frags;
+	/* No need to check the last fragment */
+	for (f = 0; f + 1 < nr_frags; f++) {
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[f];
+
+		if (!IS_ALIGNED(skb_frag_size(frag), MACB_TX_LEN_ALIGN))
+			return features & ~MACB_NETIF_LSO;
+	}
+
+	return features;
+}
+
+/* Must be called with bp->lock held */
+static void macb_tx_kick(struct macb *bp, struct macb_queue *queue)
+{
+	queue->tx_unkicked = 0;
+	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
+}
+
 static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	u16 queue_index = skb_get_queue_mapping(skb);
 	struct macb *bp = netdev_priv(dev);
 	struct macb_queue *queue = &bp->queues[queue_index];
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, queue_index);
+	bool more = skb->xmit_more;
 	unsigned long flags;
-	unsigned int count, nr_frags, frag_size, f;
+	unsigned int count, nr_frags, frag_size, f, hdrlen, used;
 
 #if defined(DEBUG) && defined(VERBOSE_DEBUG)
 	netdev_vdbg(bp->dev,
@@ -1303,11 +2082,22 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		       skb->data, 16, true);
 #endif
 
+	hdrlen = macb_tx_hdrlen(bp, skb);
+	if (unlikely(skb_headlen(skb) < hdrlen)) {
+		/* LSO headers must fit in the first buffer */
+		netdev_err(bp->dev, "LSO headers fragmented, dropping\n");
+		dev_kfree_skb_any(skb);
+		bp->stats.tx_dropped++;
+		spin_lock_irqsave(&bp->lock, flags);
+		goto kick;
+	}
+
 	/* Count how many TX buffer descriptors are needed to send this
 	 * socket buffer: skb fragments of jumbo frames may need to be
-	 * splitted into many buffer descriptors.
+	 * splitted into many buffer descriptors, and LSO headers use a
+	 * descriptor of their own.
 	 */
-	count = DIV_ROUND_UP(skb_headlen(skb), bp->max_tx_length);
+	count = 1 + DIV_ROUND_UP(skb_headlen(skb) - hdrlen, bp->max_tx_length);
 	nr_frags = skb_shinfo(skb)->nr_frags;
 	for (f = 0; f < nr_frags; f++) {
 		frag_size = skb_frag_size(&skb_shinfo(skb)->frags[f]);
@@ -1317,8 +2107,11 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	spin_lock_irqsave(&bp->lock, flags);
 
 	/* This is a hard error, log it. */
-	if (CIRC_SPACE(queue->tx_head, queue->tx_tail, TX_RING_SIZE) < count) {
+	if (CIRC_SPACE(queue->tx_head, queue->tx_tail,
+		       bp->tx_ring_size) < count) {
 		netif_stop_subqueue(dev, queue_index);
+		if (queue->tx_unkicked)
+			macb_tx_kick(bp, queue);
 		spin_unlock_irqrestore(&bp->lock, flags);
 		netdev_dbg(bp->dev, "tx_head = %u, tx_tail = %u\n",
 			   queue->tx_head, queue->tx_tail);
@@ -1328,20 +2121,43 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	/* Map socket buffer for DMA transfer */
 	if (!macb_tx_map(bp, queue, skb)) {
 		dev_kfree_skb_any(skb);
-		goto unlock;
+		goto kick;
 	}
 
 	/* Make newly initialized descriptor visible to hardware */
 	wmb();
 
-	skb_tx_timestamp(skb);
+	used = CIRC_CNT(queue->tx_head, queue->tx_tail, bp->tx_ring_size);
+	if (used > queue->stats.tx_ring_hiwater)
+		queue->stats.tx_ring_hiwater = used;
 
-	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
+	if (unlikely(gem_ptp_tx_wanted(bp, skb)))
+		skb_shinfo(skb)->tx_flags |= SKBTX_IN_PROGRESS;
+	skb_tx_timestamp(skb);
+	netdev_tx_sent_queue(txq, skb->len);
+	queue->tx_unkicked += count;
 
-	if (CIRC_SPACE(queue->tx_head, queue->tx_tail, TX_RING_SIZE) < 1)
+	if (CIRC_SPACE(queue->tx_head, queue->tx_tail, bp->tx_ring_size) < 1) {
 		netif_stop_subqueue(dev, queue_index);
 
-unlock:
+		/* TX completion may have freed the ring meanwhile */
+		smp_mb();
+		if (CIRC_SPACE(queue->tx_head, queue->tx_tail,
+			       bp->tx_ring_size) >= 1)
+			netif_start_subqueue(dev, queue_index);
+	}
+
+kick:
+	/* Under xmit_more the stack calls again, unless it stopped the queue
+	 * (BQL) or we did: only then is TSTART actually needed.  A long burst
+	 * gets a kick every MACB_TX_KICK_THRESH descriptors, not to leave the
+	 * transmitter idle while the ring fills.
+	 */
+	if (queue->tx_unkicked &&
+	    (!more || netif_xmit_stopped(txq) ||
+	     queue->tx_unkicked >= MACB_TX_KICK_THRESH(bp)))
+		macb_tx_kick(bp, queue);
+
 	spin_unlock_irqrestore(&bp->lock, flags);
 
 	return NETDEV_TX_OK;
@@ -1349,8 +2165,15 @@ unlock:
 
 static void macb_init_rx_buffer_size(struct macb *bp, size_t size)
 {
+	unsigned int frag_size;
+
 	if (!macb_is_gem(bp)) {
 		bp->rx_buffer_size = MACB_RX_BUFFER_SIZE;
+	} else if (size > GEM_RX_SCATTER_SIZE) {
+		/* Jumbo frames are received into a chain of page mode
+		 * buffers rather than one frame sized buffer per slot.
+		 */
+		bp->rx_buffer_size = GEM_RX_SCATTER_SIZE;
 	} else {
 		bp->rx_buffer_size = size;
 
@@ -1363,46 +2186,125 @@ static void macb_init_rx_buffer_size(struct macb *bp, size_t size)
 		}
 	}
 
-	netdev_dbg(bp->dev, "mtu [%u] rx_buffer_size [%Zu]\n",
-		   bp->dev->mtu, bp->rx_buffer_size);
+	/* Page mode needs each buffer to fit in a page fragment; GEM jumbo
+	 * frames always use it.
+	 */
+	bp->rx_frag_size = 0;
+	if (bp->priv_flags & MACB_PRIV_RX_PAGE_MODE ||
+	    (macb_is_gem(bp) && bp->rx_buffer_size < size)) {
+		frag_size = SKB_DATA_ALIGN(macb_rx_frag_headroom(bp) +
+					   bp->rx_buffer_size);
+		if (macb_is_gem(bp))
+			frag_size +=
+				SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+		if (frag_size <= PAGE_SIZE)
+			bp->rx_frag_size = frag_size;
+	}
+
+	netdev_dbg(bp->dev, "mtu [%u] rx_buffer_size [%Zu] rx_frag_size [%u]\n",
+		   bp->dev->mtu, bp->rx_buffer_size, bp->rx_frag_size);
+}
+
+static void macb_free_rx_frags(struct macb_queue *queue)
+{
+	struct macb *bp = queue->bp;
+	unsigned int i;
+
+	if (!queue->rx_frags)
+		return;
+
+	for (i = 0; i < bp->rx_ring_size; i++) {
+		if (!queue->rx_frags[i])
+			continue;
+
+		macb_free_rx_frag(bp, queue->rx_frags[i],
+				  macb_rx_frag_dma(queue, i));
+		queue->rx_frags[i] = NULL;
+	}
+
+	kfree(queue->rx_frags);
+	queue->rx_frags = NULL;
 }
 
 static void gem_free_rx_buffers(struct macb *bp)
 {
+	struct macb_queue	*queue;
 	struct sk_buff		*skb;
 	struct macb_dma_desc	*desc;
 	dma_addr_t		addr;
+	unsigned int		q;
 	int i;
 
-	if (!bp->rx_skbuff)
-		return;
-
-	for (i = 0; i < RX_RING_SIZE; i++) {
-		skb = bp->rx_skbuff[i];
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		macb_free_rx_frags(queue);
 
-		if (skb == NULL)
+		if (!queue->rx_skbuff)
 			continue;
 
-		desc = &bp->rx_ring[i];
-		addr = MACB_BF(RX_WADDR, MACB_BFEXT(RX_WADDR, desc->addr));
-		dma_unmap_single(&bp->pdev->dev, addr, bp->rx_buffer_size,
-				 DMA_FROM_DEVICE);
-		dev_kfree_skb_any(skb);
-		skb = NULL;
-	}
+		for (i = 0; i < bp->rx_ring_size; i++) {
+			skb = queue->rx_skbuff[i];
+
+			if (skb == NULL)
+				continue;
 
-	kfree(bp->rx_skbuff);
-	bp->rx_skbuff = NULL;
+			desc = macb_rx_desc(queue, i);
+			addr = macb_rx_addr(bp, desc->addr);
+			dma_unmap_single(&bp->pdev->dev, addr,
+					 bp->rx_buffer_size, DMA_FROM_DEVICE);
+			dev_kfree_skb_any(skb);
+			skb = NULL;
+		}
+
+		kfree(queue->rx_skbuff);
+		queue->rx_skbuff = NULL;
+	}
 }
 
 static void macb_free_rx_buffers(struct macb *bp)
 {
-	if (bp->rx_buffers) {
+	struct macb_queue *queue = &bp->queues[0];
+
+	macb_free_rx_frags(queue);
+
+	if (queue->rx_buffers) {
 		dma_free_coherent(&bp->pdev->dev,
-				  RX_RING_SIZE * bp->rx_buffer_size,
-				  bp->rx_buffers, bp->rx_buffers_dma);
-		bp->rx_buffers = NULL;
+				  bp->rx_ring_size * bp->rx_buffer_size,
+				  queue->rx_buffers, queue->rx_buffers_dma);
+		queue->rx_buffers = NULL;
+	}
+}
+
+/*
+ * The MAC fetches and writes back a descriptor for each buffer it
+ * transmits or receives, and the CPU polls them: from the on-chip SRAM,
+ * these accesses are cheaper and leave the DDR to the frame data. The rings
+ * that don't fit in the SRAM quota go to DDR.
+ */
+static void *macb_alloc_ring(struct macb *bp, size_t size, dma_addr_t *dma)
+{
+	void *ring = NULL;
+
+	if (IS_ENABLED(CONFIG_ATMEL_SRAM) && bp->sram_pool) {
+		/* Zeroed, as dma_alloc_coherent() memory is */
+		ring = gen_pool_dma_alloc(bp->sram_pool, size, dma);
+		if (ring)
+			memset(ring, 0, size);
 	}
+	if (!ring)
+		ring = dma_alloc_coherent(&bp->pdev->dev, size, dma,
+					  GFP_KERNEL);
+
+	return ring;
+}
+
+static void macb_free_ring(struct macb *bp, size_t size, void *ring,
+			   dma_addr_t dma)
+{
+	if (IS_ENABLED(CONFIG_ATMEL_SRAM) && bp->sram_pool &&
+	    addr_in_gen_pool(bp->sram_pool, (unsigned long)ring, size))
+		gen_pool_free(bp->sram_pool, (unsigned long)ring, size);
+	else
+		dma_free_coherent(&bp->pdev->dev, size, ring, dma);
 }
 
 static void macb_free_consistent(struct macb *bp)
@@ -1411,51 +2313,93 @@ static void macb_free_consistent(struct macb *bp)
 	unsigned int q;
 
 	bp->macbgem_ops.mog_free_rx_buffers(bp);
-	if (bp->rx_ring) {
-		dma_free_coherent(&bp->pdev->dev, RX_RING_BYTES,
-				  bp->rx_ring, bp->rx_ring_dma);
-		bp->rx_ring = NULL;
-	}
 
 	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
 		kfree(queue->tx_skb);
 		queue->tx_skb = NULL;
 		if (queue->tx_ring) {
-			dma_free_coherent(&bp->pdev->dev, TX_RING_BYTES,
-					  queue->tx_ring, queue->tx_ring_dma);
+			macb_free_ring(bp, TX_RING_BYTES(bp), queue->tx_ring,
+				       queue->tx_ring_dma);
 			queue->tx_ring = NULL;
 		}
+		if (queue->rx_ring) {
+			macb_free_ring(bp, RX_RING_BYTES(bp), queue->rx_ring,
+				       queue->rx_ring_dma);
+			queue->rx_ring = NULL;
+		}
 	}
 }
 
 static int gem_alloc_rx_buffers(struct macb *bp)
 {
+	struct macb_queue *queue;
+	unsigned int q;
 	int size;
 
-	size = RX_RING_SIZE * sizeof(struct sk_buff *);
-	bp->rx_skbuff = kzalloc(size, GFP_KERNEL);
-	if (!bp->rx_skbuff)
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		if (bp->rx_frag_size) {
+			/* filled by gem_rx_refill() */
+			size = bp->rx_ring_size * sizeof(void *);
+			queue->rx_frags = kzalloc(size, GFP_KERNEL);
+			if (!queue->rx_frags)
+				return -ENOMEM;
+			continue;
+		}
+
+		size = bp->rx_ring_size * sizeof(struct sk_buff *);
+		queue->rx_skbuff = kzalloc(size, GFP_KERNEL);
+		if (!queue->rx_skbuff)
+			return -ENOMEM;
+		else
+			netdev_dbg(bp->dev,
+				   "Allocated %d RX struct sk_buff entries for queue %u at %p\n",
+				   bp->rx_ring_size, q, queue->rx_skbuff);
+	}
+	return 0;
+}
+
+static int macb_alloc_rx_frags(struct macb *bp)
+{
+	struct macb_queue *queue = &bp->queues[0];
+	dma_addr_t paddr;
+	int i;
+
+	queue->rx_frags = kcalloc(bp->rx_ring_size, sizeof(void *),
+				  GFP_KERNEL);
+	if (!queue->rx_frags)
 		return -ENOMEM;
-	else
-		netdev_dbg(bp->dev,
-			   "Allocated %d RX struct sk_buff entries at %p\n",
-			   RX_RING_SIZE, bp->rx_skbuff);
+
+	for (i = 0; i < bp->rx_ring_size; i++) {
+		queue->rx_frags[i] = macb_alloc_rx_frag(bp, &paddr);
+		if (!queue->rx_frags[i])
+			return -ENOMEM;
+		queue->rx_ring[i].addr = paddr;
+	}
+
+	netdev_dbg(bp->dev, "Allocated %d RX page mode buffers of %u bytes\n",
+		   bp->rx_ring_size, bp->rx_frag_size);
 	return 0;
 }
 
 static int macb_alloc_rx_buffers(struct macb *bp)
 {
+	struct macb_queue *queue = &bp->queues[0];
 	int size;
 
-	size = RX_RING_SIZE * bp->rx_buffer_size;
-	bp->rx_buffers = dma_alloc_coherent(&bp->pdev->dev, size,
-					    &bp->rx_buffers_dma, GFP_KERNEL);
-	if (!bp->rx_buffers)
+	if (bp->rx_frag_size)
+		return macb_alloc_rx_frags(bp);
+
+	size = bp->rx_ring_size * bp->rx_buffer_size;
+	queue->rx_buffers = dma_alloc_coherent(&bp->pdev->dev, size,
+					       &queue->rx_buffers_dma,
+					       GFP_KERNEL);
+	if (!queue->rx_buffers)
 		return -ENOMEM;
 	else
 		netdev_dbg(bp->dev,
 			   "Allocated RX buffers of %d bytes at %08lx (mapped %p)\n",
-			   size, (unsigned long)bp->rx_buffers_dma, bp->rx_buffers);
+			   size, (unsigned long)queue->rx_buffers_dma,
+			   queue->rx_buffers);
 	return 0;
 }
 
@@ -1466,10 +2410,9 @@ static int macb_alloc_consistent(struct macb *bp)
 	int size;
 
 	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
-		size = TX_RING_BYTES;
-		queue->tx_ring = dma_alloc_coherent(&bp->pdev->dev, size,
-						    &queue->tx_ring_dma,
-						    GFP_KERNEL);
+		size = TX_RING_BYTES(bp);
+		queue->tx_ring = macb_alloc_ring(bp, size,
+						 &queue->tx_ring_dma);
 		if (!queue->tx_ring)
 			goto out_err;
 		netdev_dbg(bp->dev,
@@ -1477,20 +2420,21 @@ static int macb_alloc_consistent(struct macb *bp)
 			   q, size, (unsigned long)queue->tx_ring_dma,
 			   queue->tx_ring);
 
-		size = TX_RING_SIZE * sizeof(struct macb_tx_skb);
+		size = bp->tx_ring_size * sizeof(struct macb_tx_skb);
 		queue->tx_skb = kmalloc(size, GFP_KERNEL);
 		if (!queue->tx_skb)
 			goto out_err;
-	}
 
-	size = RX_RING_BYTES;
-	bp->rx_ring = dma_alloc_coherent(&bp->pdev->dev, size,
-					 &bp->rx_ring_dma, GFP_KERNEL);
-	if (!bp->rx_ring)
-		goto out_err;
-	netdev_dbg(bp->dev,
-		   "Allocated RX ring of %d bytes at %08lx (mapped %p)\n",
-		   size, (unsigned long)bp->rx_ring_dma, bp->rx_ring);
+		size = RX_RING_BYTES(bp);
+		queue->rx_ring = macb_alloc_ring(bp, size,
+						 &queue->rx_ring_dma);
+		if (!queue->rx_ring)
+			goto out_err;
+		netdev_dbg(bp->dev,
+			   "Allocated RX ring for queue %u of %d bytes at %08lx (mapped %p)\n",
+			   q, size, (unsigned long)queue->rx_ring_dma,
+			   queue->rx_ring);
+	}
 
 	if (bp->macbgem_ops.mog_alloc_rx_buffers(bp))
 		goto out_err;
@@ -1505,47 +2449,55 @@ out_err:
 static void gem_init_rings(struct macb *bp)
 {
 	struct macb_queue *queue;
+	struct macb_dma_desc *desc;
 	unsigned int q;
 	int i;
 
 	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
-		for (i = 0; i < TX_RING_SIZE; i++) {
-			queue->tx_ring[i].addr = 0;
-			queue->tx_ring[i].ctrl = MACB_BIT(TX_USED);
+		for (i = 0; i < bp->tx_ring_size; i++) {
+			desc = macb_tx_desc(queue, i);
+			desc->addr = 0;
+			desc->ctrl = MACB_BIT(TX_USED);
 		}
-		queue->tx_ring[TX_RING_SIZE - 1].ctrl |= MACB_BIT(TX_WRAP);
+		desc->ctrl |= MACB_BIT(TX_WRAP);
 		queue->tx_head = 0;
+		queue->tx_unkicked = 0;
 		queue->tx_tail = 0;
-	}
 
-	bp->rx_tail = 0;
-	bp->rx_prepared_head = 0;
+		queue->rx_tail = 0;
+		queue->rx_prepared_head = 0;
 
-	gem_rx_refill(bp);
+		gem_rx_refill(queue);
+	}
 }
 
 static void macb_init_rings(struct macb *bp)
 {
+	struct macb_queue *queue = &bp->queues[0];
 	int i;
 	dma_addr_t addr;
 
-	addr = bp->rx_buffers_dma;
-	for (i = 0; i < RX_RING_SIZE; i++) {
-		bp->rx_ring[i].addr = addr;
-		bp->rx_ring[i].ctrl = 0;
+	addr = queue->rx_buffers_dma;
+	for (i = 0; i < bp->rx_ring_size; i++) {
+		if (bp->rx_frag_size)
+			/* page mode buffers are mapped one by one */
+			addr = macb_rx_frag_dma(queue, i);
+		queue->rx_ring[i].addr = addr;
+		queue->rx_ring[i].ctrl = 0;
 		addr += bp->rx_buffer_size;
 	}
-	bp->rx_ring[RX_RING_SIZE - 1].addr |= MACB_BIT(RX_WRAP);
+	queue->rx_ring[bp->rx_ring_size - 1].addr |= MACB_BIT(RX_WRAP);
 
-	for (i = 0; i < TX_RING_SIZE; i++) {
-		bp->queues[0].tx_ring[i].addr = 0;
-		bp->queues[0].tx_ring[i].ctrl = MACB_BIT(TX_USED);
+	for (i = 0; i < bp->tx_ring_size; i++) {
+		queue->tx_ring[i].addr = 0;
+		queue->tx_ring[i].ctrl = MACB_BIT(TX_USED);
 	}
-	bp->queues[0].tx_head = 0;
-	bp->queues[0].tx_tail = 0;
-	bp->queues[0].tx_ring[TX_RING_SIZE - 1].ctrl |= MACB_BIT(TX_WRAP);
+	queue->tx_head = 0;
+	queue->tx_unkicked = 0;
+	queue->tx_tail = 0;
+	queue->tx_ring[bp->tx_ring_size - 1].ctrl |= MACB_BIT(TX_WRAP);
 
-	bp->rx_tail = 0;
+	queue->rx_tail = 0;
 }
 
 static void macb_reset_hw(struct macb *bp)
@@ -1646,11 +2598,19 @@ static u32 macb_dbw(struct macb *bp)
  */
 static void macb_configure_dma(struct macb *bp)
 {
+	struct macb_queue *queue;
+	u32 buffer_size;
+	unsigned int q;
 	u32 dmacfg;
 
 	if (macb_is_gem(bp)) {
+		buffer_size = bp->rx_buffer_size / RX_BUFFER_MULTIPLE;
 		dmacfg = gem_readl(bp, DMACFG) & ~GEM_BF(RXBS, -1L);
-		dmacfg |= GEM_BF(RXBS, bp->rx_buffer_size / RX_BUFFER_MULTIPLE);
+		dmacfg |= GEM_BF(RXBS, buffer_size);
+		/* priority queues have their own buffer size register */
+		for (q = 1, queue = bp->queues + 1; q < bp->num_queues;
+		     ++q, ++queue)
+			queue_writel(queue, RBQS, buffer_size);
 		if (bp->dma_burst_length)
 			dmacfg = GEM_BFINS(FBLDO, bp->dma_burst_length, dmacfg);
 		dmacfg |= GEM_BIT(TXPBMS) | GEM_BF(RXBMS, -1L);
@@ -1665,71 +2625,379 @@ static void macb_configure_dma(struct macb *bp)
 			dmacfg |= GEM_BIT(TXCOEN);
 		else
 			dmacfg &= ~GEM_BIT(TXCOEN);
+
+		if (gem_has_ptp(bp))
+			dmacfg |= GEM_BIT(RXEXT) | GEM_BIT(TXEXT);
+		else
+			dmacfg &= ~(GEM_BIT(RXEXT) | GEM_BIT(TXEXT));
 		netdev_dbg(bp->dev, "Cadence configure DMA with 0x%08x\n",
 			   dmacfg);
 		gem_writel(bp, DMACFG, dmacfg);
 	}
 }
 
-static void macb_init_hw(struct macb *bp)
+/* Network control traffic steered away from the bulk RX queue: the
+ * CS6, CS7 and EF classes of the IP DS field, and ARP and PTP frames.
+ */
+static const u8 gem_ctrl_dstc[] = { 0xc0, 0xe0, 0xb8 };
+static const u16 gem_ctrl_ethertypes[] = { ETH_P_ARP, ETH_P_1588 };
+
+/* Number of type 2 screeners, and EtherType registers, used to steer
+ * control traffic. ethtool flow rules use the ones after them.
+ */
+static unsigned int gem_ctrl_t2_screeners(struct macb *bp)
 {
-	struct macb_queue *queue;
-	unsigned int q;
+	if (bp->num_queues < 2)
+		return 0;
 
-	u32 config;
+	return min3((unsigned int)ARRAY_SIZE(gem_ctrl_ethertypes),
+		    bp->num_t2_screeners, bp->num_t2_ethertypes);
+}
 
-	macb_reset_hw(bp);
-	macb_set_hwaddr(bp);
+/* Hardware index of a linux queue */
+static unsigned int macb_hw_queue(struct macb *bp, unsigned int q)
+{
+	unsigned int hw_q;
 
-	config = macb_mdc_clk_div(bp);
-	config |= MACB_BF(RBOF, NET_IP_ALIGN);	/* Make eth data aligned */
-	config |= MACB_BIT(PAE);		/* PAuse Enable */
-	config |= MACB_BIT(DRFCS);		/* Discard Rx FCS */
-	if (bp->caps & MACB_CAPS_JUMBO)
-		config |= MACB_BIT(JFRAME);	/* Enable jumbo frames */
-	else
-		config |= MACB_BIT(BIG);	/* Receive oversized frames */
-	if (bp->dev->flags & IFF_PROMISC)
-		config |= MACB_BIT(CAF);	/* Copy All Frames */
-	else if (macb_is_gem(bp) && bp->dev->features & NETIF_F_RXCSUM)
-		config |= GEM_BIT(RXCOEN);
-	if (!(bp->dev->flags & IFF_BROADCAST))
-		config |= MACB_BIT(NBC);	/* No BroadCast */
-	config |= macb_dbw(bp);
-	macb_writel(bp, NCFGR, config);
-	if ((bp->caps & MACB_CAPS_JUMBO) && bp->jumbo_max_len)
-		gem_writel(bp, JML, bp->jumbo_max_len);
-	bp->speed = SPEED_10;
-	bp->duplex = DUPLEX_HALF;
-	bp->rx_frm_len_mask = MACB_RX_FRMLEN_MASK;
-	if (bp->caps & MACB_CAPS_JUMBO)
-		bp->rx_frm_len_mask = MACB_RX_JFRMLEN_MASK;
+	for (hw_q = 0; hw_q < MACB_MAX_QUEUES; hw_q++)
+		if (bp->queue_mask & (1 << hw_q) && !q--)
+			break;
 
-	macb_configure_dma(bp);
+	return hw_q;
+}
 
-	/* Initialize TX and RX buffers */
-	macb_writel(bp, RBQP, bp->rx_ring_dma);
-	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
-		queue_writel(queue, TBQP, queue->tx_ring_dma);
+/* Type 2 compare words matching frame bytes at a given offset; values
+ * and masks are in host order, the screener wants the first frame byte
+ * in the lowest byte.
+ */
+struct gem_t2_cmp {
+	u32	w0;
+	u32	w1;
+};
 
-		/* Enable interrupts */
-		queue_writel(queue, IER,
-			     MACB_RX_INT_FLAGS |
-			     MACB_TX_INT_FLAGS |
-			     MACB_BIT(HRESP));
-	}
+static void gem_t2_cmp16(struct gem_t2_cmp *cmp, unsigned int base,
+			 unsigned int offset, u16 value, u16 mask)
+{
+	cmp->w0 = GEM_BF(T2CMP, swab16(value)) | GEM_BF(T2MASK, swab16(mask));
+	cmp->w1 = GEM_BF(T2CMPOFST, base) | GEM_BF(T2OFST, offset);
+}
 
-	/* Enable TX and RX */
-	macb_writel(bp, NCR, MACB_BIT(RE) | MACB_BIT(TE) | MACB_BIT(MPE));
+static void gem_t2_cmp32(struct gem_t2_cmp *cmp, unsigned int base,
+			 unsigned int offset, u32 value)
+{
+	cmp->w0 = swab32(value);
+	cmp->w1 = GEM_BF(T2CMPOFST, base) | GEM_BF(T2OFST, offset) |
+		  GEM_BIT(T2DISMSK);
 }
 
-/*
- * The hash address register is 64 bits long and takes up two
- * locations in the memory map.  The least significant bits are stored
- * in EMAC_HSL and the most significant bits in EMAC_HSH.
- *
- * The unicast hash enable and the multicast hash enable bits in the
- * network configuration register enable the reception of hash matched
+/* Offsets in the IPv4 header, from the end of the EtherType */
+#define GEM_IPHDR_PROTO		8	/* TTL and protocol */
+#define GEM_IPHDR_SRCIP		12
+#define GEM_IPHDR_DSTIP		16
+
+/* An IPv4 address needs a 32-bit compare when fully masked, or a 16-bit
+ * one when only its upper half is.
+ */
+static int gem_t2_cmp_ip4(struct gem_t2_cmp *cmp, unsigned int offset,
+			  __be32 value, __be32 mask)
+{
+	u32 v = be32_to_cpu(value), m = be32_to_cpu(mask);
+
+	if (!m)
+		return 0;
+
+	if (m == 0xffffffff)
+		gem_t2_cmp32(cmp, GEM_T2COMPOFST_ETYPE, offset, v);
+	else if (!(m & 0xffff))
+		gem_t2_cmp16(cmp, GEM_T2COMPOFST_ETYPE, offset,
+			     v >> 16, m >> 16);
+	else
+		return -EINVAL;
+
+	return 1;
+}
+
+/* Translate a flow spec into at most three type 2 compares. Returns the
+ * number of compares used or -EINVAL if the screener cannot match it.
+ */
+static int gem_flow_cmps(const struct ethtool_rx_flow_spec *fs,
+			 struct gem_t2_cmp *cmp)
+{
+	const struct ethtool_tcpip4_spec *l4v = &fs->h_u.tcp_ip4_spec;
+	const struct ethtool_tcpip4_spec *l4m = &fs->m_u.tcp_ip4_spec;
+	const struct ethtool_usrip4_spec *ipv = &fs->h_u.usr_ip4_spec;
+	const struct ethtool_usrip4_spec *ipm = &fs->m_u.usr_ip4_spec;
+	struct gem_t2_cmp tmp[5];
+	u16 psrc, pdst;
+	int n = 0, ret;
+	u8 proto;
+
+	if (fs->flow_type & (FLOW_EXT | FLOW_MAC_EXT))
+		return -EINVAL;
+
+	switch (fs->flow_type) {
+	case TCP_V4_FLOW:
+	case UDP_V4_FLOW:
+	case SCTP_V4_FLOW:
+		if (l4m->tos)
+			return -EINVAL;
+		proto = fs->flow_type == TCP_V4_FLOW ? IPPROTO_TCP :
+			fs->flow_type == UDP_V4_FLOW ? IPPROTO_UDP :
+			IPPROTO_SCTP;
+		gem_t2_cmp16(&tmp[n++], GEM_T2COMPOFST_ETYPE, GEM_IPHDR_PROTO,
+			     proto, 0x00ff);
+		break;
+	case IP_USER_FLOW:
+		if (ipm->tos || ipm->l4_4_bytes ||
+		    (ipm->ip_ver && ipv->ip_ver != ETH_RX_NFC_IP4))
+			return -EINVAL;
+		if (ipm->proto == 0xff)
+			gem_t2_cmp16(&tmp[n++], GEM_T2COMPOFST_ETYPE,
+				     GEM_IPHDR_PROTO, ipv->proto, 0x00ff);
+		else if (ipm->proto)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* tcp_ip4_spec and usr_ip4_spec share the address layout */
+	ret = gem_t2_cmp_ip4(&tmp[n], GEM_IPHDR_SRCIP,
+			     l4v->ip4src, l4m->ip4src);
+	if (ret < 0)
+		return ret;
+	n += ret;
+
+	ret = gem_t2_cmp_ip4(&tmp[n], GEM_IPHDR_DSTIP,
+			     l4v->ip4dst, l4m->ip4dst);
+	if (ret < 0)
+		return ret;
+	n += ret;
+
+	if (fs->flow_type != IP_USER_FLOW) {
+		psrc = be16_to_cpu(l4m->psrc);
+		pdst = be16_to_cpu(l4m->pdst);
+
+		if (psrc == 0xffff && pdst == 0xffff) {
+			gem_t2_cmp32(&tmp[n++], GEM_T2COMPOFST_IPHDR, 0,
+				     be16_to_cpu(l4v->psrc) << 16 |
+				     be16_to_cpu(l4v->pdst));
+		} else {
+			if (psrc)
+				gem_t2_cmp16(&tmp[n++], GEM_T2COMPOFST_IPHDR,
+					     0, be16_to_cpu(l4v->psrc), psrc);
+			if (pdst)
+				gem_t2_cmp16(&tmp[n++], GEM_T2COMPOFST_IPHDR,
+					     2, be16_to_cpu(l4v->pdst), pdst);
+		}
+	}
+
+	if (n > 3)
+		return -EINVAL;
+
+	if (cmp)
+		memcpy(cmp, tmp, n * sizeof(*cmp));
+
+	return n;
+}
+
+/* Program the type 2 screener of an ethtool flow rule. Rule n uses the
+ * screener after the control ones and compare registers 3n to 3n + 2.
+ */
+static void gem_prog_flow_rule(struct macb *bp,
+			       const struct ethtool_rx_flow_spec *fs)
+{
+	unsigned int base = gem_ctrl_t2_screeners(bp);
+	unsigned int idx = 3 * fs->location;
+	struct gem_t2_cmp cmp[3];
+	u32 scrt2;
+	int i, n;
+
+	n = gem_flow_cmps(fs, cmp);
+	if (n < 0)
+		return;
+
+	scrt2 = GEM_BF(T2QUEUE, macb_hw_queue(bp, fs->ring_cookie)) |
+		GEM_BF(ETHT2IDX, base) | GEM_BIT(ETHTEN);
+
+	for (i = 0; i < n; i++) {
+		gem_writel(bp, T2CMPW0(idx + i), cmp[i].w0);
+		gem_writel(bp, T2CMPW1(idx + i), cmp[i].w1);
+	}
+	if (n > 0)
+		scrt2 |= GEM_BF(CMPA, idx) | GEM_BIT(CMPAEN);
+	if (n > 1)
+		scrt2 |= GEM_BF(CMPB, idx + 1) | GEM_BIT(CMPBEN);
+	if (n > 2)
+		scrt2 |= GEM_BF(CMPC, idx + 2) | GEM_BIT(CMPCEN);
+
+	gem_writel(bp, SCRT2(base + fs->location), scrt2);
+}
+
+static void gem_enable_flow_rules(struct macb *bp, bool enable)
+{
+	unsigned int base = gem_ctrl_t2_screeners(bp);
+	struct gem_flow_rule *rule;
+
+	if (!bp->max_tuples)
+		return;
+
+	gem_writel(bp, ETHT(base), GEM_BF(ETHTCMP, ETH_P_IP));
+
+	list_for_each_entry(rule, &bp->rx_fs_list, list) {
+		if (enable)
+			gem_prog_flow_rule(bp, &rule->fs);
+		else
+			gem_writel(bp, SCRT2(base + rule->fs.location), 0);
+	}
+}
+
+/*
+ * Configure the RX flow steering screeners of a multi-queue GEM.
+ * Frames not matched by any screener are received on queue 0; control
+ * traffic is matched by the type 1 (DS/TC field) and type 2 (EtherType)
+ * screeners and steered to the highest priority queue so that it does
+ * not share a ring and a NAPI context with bulk traffic. The remaining
+ * type 2 screeners back the ethtool flow rules.
+ */
+static void gem_init_screeners(struct macb *bp)
+{
+	unsigned int hw_q, i;
+
+	if (!macb_is_gem(bp))
+		return;
+
+	for (i = 0; i < bp->num_t1_screeners; i++)
+		gem_writel(bp, SCRT1(i), 0);
+	for (i = 0; i < bp->num_t2_screeners; i++)
+		gem_writel(bp, SCRT2(i), 0);
+
+	if (bp->num_queues < 2)
+		return;
+
+	/* the last linux queue is the highest hardware queue */
+	hw_q = fls(bp->queue_mask) - 1;
+
+	for (i = 0; i < ARRAY_SIZE(gem_ctrl_dstc) &&
+		    i < bp->num_t1_screeners; i++)
+		gem_writel(bp, SCRT1(i), GEM_BF(T1QUEUE, hw_q) |
+					 GEM_BF(DSTCM, gem_ctrl_dstc[i]) |
+					 GEM_BIT(DSTCE));
+
+	for (i = 0; i < gem_ctrl_t2_screeners(bp); i++) {
+		gem_writel(bp, ETHT(i), GEM_BF(ETHTCMP,
+					       gem_ctrl_ethertypes[i]));
+		gem_writel(bp, SCRT2(i), GEM_BF(T2QUEUE, hw_q) |
+					 GEM_BF(ETHT2IDX, i) |
+					 GEM_BIT(ETHTEN));
+	}
+
+	netdev_dbg(bp->dev, "steering control traffic to hw queue %u\n", hw_q);
+
+	gem_enable_flow_rules(bp, bp->dev->features & NETIF_F_NTUPLE);
+}
+
+/* Credit based shaping applies to the two highest priority queues only:
+ * queue A is the last one, queue B the one before it.  Queue 0 carries
+ * best effort traffic and is never shaped.
+ */
+static void gem_write_cbs(struct macb *bp)
+{
+	struct macb_queue *queue;
+	u32 ctrl = 0;
+
+	if (!(bp->caps & MACB_CAPS_GEM_HAS_CBS))
+		return;
+
+	/* IdleSlope is written with shaping off, in bytes per second */
+	gem_writel(bp, CBSCR, 0);
+
+	queue = &bp->queues[bp->num_queues - 1];
+	if (queue->tx_maxrate) {
+		gem_writel(bp, CBSISQA, queue->tx_maxrate * 125000);
+		ctrl |= GEM_BIT(QAE);
+	}
+
+	if (bp->num_queues > 2) {
+		queue = &bp->queues[bp->num_queues - 2];
+		if (queue->tx_maxrate) {
+			gem_writel(bp, CBSISQB, queue->tx_maxrate * 125000);
+			ctrl |= GEM_BIT(QBE);
+		}
+	}
+
+	gem_writel(bp, CBSCR, ctrl);
+}
+
+static void macb_init_hw(struct macb *bp)
+{
+	struct macb_queue *queue;
+	unsigned int q;
+
+	u32 config;
+
+	macb_reset_hw(bp);
+	macb_set_hwaddr(bp);
+
+	config = macb_mdc_clk_div(bp);
+	config |= MACB_BF(RBOF, NET_IP_ALIGN);	/* Make eth data aligned */
+	config |= MACB_BIT(PAE);		/* PAuse Enable */
+	config |= MACB_BIT(DRFCS);		/* Discard Rx FCS */
+	if (bp->caps & MACB_CAPS_JUMBO)
+		config |= MACB_BIT(JFRAME);	/* Enable jumbo frames */
+	else
+		config |= MACB_BIT(BIG);	/* Receive oversized frames */
+	if (bp->dev->flags & IFF_PROMISC)
+		config |= MACB_BIT(CAF);	/* Copy All Frames */
+	else if (macb_is_gem(bp) && bp->dev->features & NETIF_F_RXCSUM)
+		config |= GEM_BIT(RXCOEN);
+	if (!(bp->dev->flags & IFF_BROADCAST))
+		config |= MACB_BIT(NBC);	/* No BroadCast */
+	config |= macb_dbw(bp);
+	macb_writel(bp, NCFGR, config);
+	if ((bp->caps & MACB_CAPS_JUMBO) && bp->jumbo_max_len)
+		gem_writel(bp, JML, bp->jumbo_max_len);
+	bp->speed = SPEED_10;
+	bp->duplex = DUPLEX_HALF;
+	bp->rx_frm_len_mask = MACB_RX_FRMLEN_MASK;
+	if (bp->caps & MACB_CAPS_JUMBO)
+		bp->rx_frm_len_mask = MACB_RX_JFRMLEN_MASK;
+
+	macb_configure_dma(bp);
+	gem_init_screeners(bp);
+
+	/* Initialize TX and RX buffers */
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		queue_writel(queue, RBQP, queue->rx_ring_dma);
+		queue_writel(queue, TBQP, queue->tx_ring_dma);
+
+		queue->coalesce_pending = 0;
+		queue->rx_coalesce_usecs = bp->rx_coalesce_usecs;
+		queue->rx_sample_pkts = 0;
+		queue->rx_sample_start = jiffies;
+
+		/* Enable interrupts */
+		queue_writel(queue, IER,
+			     MACB_RX_INT_FLAGS |
+			     MACB_TX_INT_FLAGS |
+			     MACB_BIT(HRESP));
+	}
+
+	if (macb_has_imod(bp))
+		gem_write_imod(bp, bp->rx_coalesce_usecs);
+	gem_write_cbs(bp);
+
+	/* Enable TX and RX */
+	macb_writel(bp, NCR, MACB_BIT(RE) | MACB_BIT(TE) | MACB_BIT(MPE));
+}
+
+/*
+ * The hash address register is 64 bits long and takes up two
+ * locations in the memory map.  The least significant bits are stored
+ * in EMAC_HSL and the most significant bits in EMAC_HSH.
+ *
+ * The unicast hash enable and the multicast hash enable bits in the
+ * network configuration register enable the reception of hash matched
  * frames. The destination address is reduced to a 6 bit index into
  * the 64 bit hash register using the following hash function.  The
  * hash function is an exclusive or of every sixth bit of the
@@ -1852,6 +3120,8 @@ static int macb_open(struct net_device *dev)
 {
 	struct macb *bp = netdev_priv(dev);
 	size_t bufsz = dev->mtu + ETH_HLEN + ETH_FCS_LEN + NET_IP_ALIGN;
+	struct macb_queue *queue;
+	unsigned int q;
 	int err;
 
 	netdev_dbg(bp->dev, "open\n");
@@ -1873,7 +3143,13 @@ static int macb_open(struct net_device *dev)
 		return err;
 	}
 
-	napi_enable(&bp->napi);
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		macb_poll_init(queue);
+		napi_hash_add(&queue->napi);
+		napi_enable(&queue->napi);
+		napi_enable(&queue->napi_tx);
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, q));
+	}
 
 	bp->macbgem_ops.mog_init_rings(bp);
 	macb_init_hw(bp);
@@ -1889,10 +3165,17 @@ static int macb_open(struct net_device *dev)
 static int macb_close(struct net_device *dev)
 {
 	struct macb *bp = netdev_priv(dev);
+	struct macb_queue *queue;
 	unsigned long flags;
+	unsigned int q;
 
 	netif_tx_stop_all_queues(dev);
-	napi_disable(&bp->napi);
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		napi_disable(&queue->napi);
+		macb_poll_disable(queue);
+		napi_hash_del(&queue->napi);
+		napi_disable(&queue->napi_tx);
+	}
 
 	if (bp->phy_dev)
 		phy_stop(bp->phy_dev);
@@ -1902,6 +3185,9 @@ static int macb_close(struct net_device *dev)
 	netif_carrier_off(dev);
 	spin_unlock_irqrestore(&bp->lock, flags);
 
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue)
+		hrtimer_cancel(&queue->coalesce_timer);
+
 	macb_free_consistent(bp);
 
 	return 0;
@@ -1989,18 +3275,36 @@ static struct net_device_stats *gem_get_stats(struct macb *bp)
 static void gem_get_ethtool_stats(struct net_device *dev,
 				  struct ethtool_stats *stats, u64 *data)
 {
+	struct macb_queue *queue;
+	unsigned int i, q, idx;
 	struct macb *bp;
 
 	bp = netdev_priv(dev);
 	gem_update_stats(bp);
-	memcpy(data, &bp->ethtool_stats, sizeof(u64) * GEM_STATS_LEN);
+
+	idx = GEM_STATS_LEN;
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue)
+		for (i = 0; i < QUEUE_STATS_LEN; ++i)
+			bp->ethtool_stats[idx++] =
+				*(unsigned long *)((void *)&queue->stats +
+						   queue_statistics[i].offset);
+
+	memcpy(data, &bp->ethtool_stats, sizeof(u64) * idx);
 }
 
+static const char macb_priv_flags_strings[][ETH_GSTRING_LEN] = {
+	"rx-page-mode",
+};
+
 static int gem_get_sset_count(struct net_device *dev, int sset)
 {
+	struct macb *bp = netdev_priv(dev);
+
 	switch (sset) {
 	case ETH_SS_STATS:
-		return GEM_STATS_LEN;
+		return GEM_STATS_LEN + QUEUE_STATS_LEN * bp->num_queues;
+	case ETH_SS_PRIV_FLAGS:
+		return MACB_PRIV_FLAGS_LEN;
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -2008,121 +3312,469 @@ static int gem_get_sset_count(struct net_device *dev, int sset)
 
 static void gem_get_ethtool_strings(struct net_device *dev, u32 sset, u8 *p)
 {
-	unsigned int i;
+	struct macb *bp = netdev_priv(dev);
+	unsigned int i, q;
 
 	switch (sset) {
 	case ETH_SS_STATS:
 		for (i = 0; i < GEM_STATS_LEN; i++, p += ETH_GSTRING_LEN)
 			memcpy(p, gem_statistics[i].stat_string,
 			       ETH_GSTRING_LEN);
+
+		for (q = 0; q < bp->num_queues; q++)
+			for (i = 0; i < QUEUE_STATS_LEN; i++,
+			     p += ETH_GSTRING_LEN)
+				snprintf(p, ETH_GSTRING_LEN, "q%u_%s", q,
+					 queue_statistics[i].stat_string);
+		break;
+	case ETH_SS_PRIV_FLAGS:
+		memcpy(p, macb_priv_flags_strings,
+		       sizeof(macb_priv_flags_strings));
+		break;
+	}
+}
+
+static int macb_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_PRIV_FLAGS:
+		return MACB_PRIV_FLAGS_LEN;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void macb_get_ethtool_strings(struct net_device *dev, u32 sset, u8 *p)
+{
+	switch (sset) {
+	case ETH_SS_PRIV_FLAGS:
+		memcpy(p, macb_priv_flags_strings,
+		       sizeof(macb_priv_flags_strings));
 		break;
 	}
 }
 
-static struct net_device_stats *macb_get_stats(struct net_device *dev)
-{
-	struct macb *bp = netdev_priv(dev);
-	struct net_device_stats *nstat = &bp->stats;
-	struct macb_stats *hwstat = &bp->hw_stats.macb;
+static u32 macb_get_priv_flags(struct net_device *dev)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	return bp->priv_flags;
+}
+
+static int macb_set_priv_flags(struct net_device *dev, u32 flags)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (flags & ~MACB_PRIV_RX_PAGE_MODE)
+		return -EINVAL;
+
+	/* the RX buffer layout only changes when the rings are allocated */
+	if (netif_running(dev) && flags != bp->priv_flags)
+		return -EBUSY;
+
+	bp->priv_flags = flags;
+
+	return 0;
+}
+
+static int macb_get_tunable(struct net_device *dev,
+			    const struct ethtool_tunable *tuna, void *data)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		*(u32 *)data = bp->rx_copybreak;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int macb_set_tunable(struct net_device *dev,
+			    const struct ethtool_tunable *tuna,
+			    const void *data)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		bp->rx_copybreak = *(u32 *)data;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static struct net_device_stats *macb_get_stats(struct net_device *dev)
+{
+	struct macb *bp = netdev_priv(dev);
+	struct net_device_stats *nstat = &bp->stats;
+	struct macb_stats *hwstat = &bp->hw_stats.macb;
+
+	if (macb_is_gem(bp))
+		return gem_get_stats(bp);
+
+	/* read stats from hardware */
+	macb_update_stats(bp);
+
+	/* Convert HW stats into netdevice stats */
+	nstat->rx_errors = (hwstat->rx_fcs_errors +
+			    hwstat->rx_align_errors +
+			    hwstat->rx_resource_errors +
+			    hwstat->rx_overruns +
+			    hwstat->rx_oversize_pkts +
+			    hwstat->rx_jabbers +
+			    hwstat->rx_undersize_pkts +
+			    hwstat->rx_length_mismatch);
+	nstat->tx_errors = (hwstat->tx_late_cols +
+			    hwstat->tx_excessive_cols +
+			    hwstat->tx_underruns +
+			    hwstat->tx_carrier_errors +
+			    hwstat->sqe_test_errors);
+	nstat->collisions = (hwstat->tx_single_cols +
+			     hwstat->tx_multiple_cols +
+			     hwstat->tx_excessive_cols);
+	nstat->rx_length_errors = (hwstat->rx_oversize_pkts +
+				   hwstat->rx_jabbers +
+				   hwstat->rx_undersize_pkts +
+				   hwstat->rx_length_mismatch);
+	nstat->rx_over_errors = hwstat->rx_resource_errors +
+				   hwstat->rx_overruns;
+	nstat->rx_crc_errors = hwstat->rx_fcs_errors;
+	nstat->rx_frame_errors = hwstat->rx_align_errors;
+	nstat->rx_fifo_errors = hwstat->rx_overruns;
+	/* XXX: What does "missed" mean? */
+	nstat->tx_aborted_errors = hwstat->tx_excessive_cols;
+	nstat->tx_carrier_errors = hwstat->tx_carrier_errors;
+	nstat->tx_fifo_errors = hwstat->tx_underruns;
+	/* Don't know about heartbeat or window errors... */
+
+	return nstat;
+}
+
+static int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+{
+	struct macb *bp = netdev_priv(dev);
+	struct phy_device *phydev = bp->phy_dev;
+
+	if (!phydev)
+		return -ENODEV;
+
+	return phy_ethtool_gset(phydev, cmd);
+}
+
+static int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+{
+	struct macb *bp = netdev_priv(dev);
+	struct phy_device *phydev = bp->phy_dev;
+
+	if (!phydev)
+		return -ENODEV;
+
+	return phy_ethtool_sset(phydev, cmd);
+}
+
+static int macb_get_regs_len(struct net_device *netdev)
+{
+	return MACB_GREGS_NBR * sizeof(u32);
+}
+
+static void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
+			  void *p)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned int tail, head;
+	u32 *regs_buff = p;
+
+	regs->version = (macb_readl(bp, MID) & ((1 << MACB_REV_SIZE) - 1))
+			| MACB_GREGS_VERSION;
+
+	tail = macb_tx_ring_wrap(bp, bp->queues[0].tx_tail);
+	head = macb_tx_ring_wrap(bp, bp->queues[0].tx_head);
+
+	regs_buff[0]  = macb_readl(bp, NCR);
+	regs_buff[1]  = macb_or_gem_readl(bp, NCFGR);
+	regs_buff[2]  = macb_readl(bp, NSR);
+	regs_buff[3]  = macb_readl(bp, TSR);
+	regs_buff[4]  = macb_readl(bp, RBQP);
+	regs_buff[5]  = macb_readl(bp, TBQP);
+	regs_buff[6]  = macb_readl(bp, RSR);
+	regs_buff[7]  = macb_readl(bp, IMR);
+
+	regs_buff[8]  = tail;
+	regs_buff[9]  = head;
+	regs_buff[10] = macb_tx_dma(&bp->queues[0], tail);
+	regs_buff[11] = macb_tx_dma(&bp->queues[0], head);
+
+	regs_buff[12] = macb_or_gem_readl(bp, USRIO);
+	if (macb_is_gem(bp)) {
+		regs_buff[13] = gem_readl(bp, DMACFG);
+	}
+}
+
+static void macb_get_ringparam(struct net_device *netdev,
+			       struct ethtool_ringparam *ring)
+{
+	struct macb *bp = netdev_priv(netdev);
+
+	ring->rx_max_pending = MAX_RX_RING_SIZE;
+	ring->tx_max_pending = MAX_TX_RING_SIZE;
+
+	ring->rx_pending = bp->rx_ring_size;
+	ring->tx_pending = bp->tx_ring_size;
+}
+
+static int macb_set_ringparam(struct net_device *netdev,
+			      struct ethtool_ringparam *ring)
+{
+	struct macb *bp = netdev_priv(netdev);
+	u32 new_rx_size, new_tx_size;
+	unsigned int reset = 0;
+
+	if ((ring->rx_mini_pending) || (ring->rx_jumbo_pending))
+		return -EINVAL;
+
+	new_rx_size = clamp_t(u32, ring->rx_pending,
+			      MIN_RX_RING_SIZE, MAX_RX_RING_SIZE);
+	new_rx_size = roundup_pow_of_two(new_rx_size);
+
+	new_tx_size = clamp_t(u32, ring->tx_pending,
+			      MIN_TX_RING_SIZE, MAX_TX_RING_SIZE);
+	new_tx_size = roundup_pow_of_two(new_tx_size);
+
+	if ((new_tx_size == bp->tx_ring_size) &&
+	    (new_rx_size == bp->rx_ring_size)) {
+		/* nothing to do */
+		return 0;
+	}
+
+	if (netif_running(netdev)) {
+		reset = 1;
+		netdev->netdev_ops->ndo_stop(netdev);
+	}
+
+	bp->rx_ring_size = new_rx_size;
+	bp->tx_ring_size = new_tx_size;
+
+	if (reset)
+		return netdev->netdev_ops->ndo_open(netdev);
+
+	return 0;
+}
+
+static int macb_get_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = bp->rx_coalesce_usecs;
+	ec->tx_coalesce_usecs = bp->tx_coalesce_usecs;
+	ec->use_adaptive_rx_coalesce = bp->use_adaptive_rx_coalesce;
+	ec->pkt_rate_low = bp->pkt_rate_low;
+	ec->rx_coalesce_usecs_low = bp->rx_coalesce_usecs_low;
+	ec->pkt_rate_high = bp->pkt_rate_high;
+	ec->rx_coalesce_usecs_high = bp->rx_coalesce_usecs_high;
+
+	return 0;
+}
+
+static int macb_set_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned int max_usecs = macb_max_coalesce_usecs(bp);
+	struct macb_queue *queue;
+	unsigned long flags;
+	unsigned int q;
+
+	/* Only time based coalescing is supported */
+	if (ec->rx_max_coalesced_frames || ec->tx_max_coalesced_frames ||
+	    ec->use_adaptive_tx_coalesce)
+		return -EINVAL;
+
+	if (ec->rx_coalesce_usecs > max_usecs ||
+	    ec->tx_coalesce_usecs > max_usecs ||
+	    ec->rx_coalesce_usecs_low > max_usecs ||
+	    ec->rx_coalesce_usecs_high > max_usecs)
+		return -EINVAL;
+
+	if (ec->use_adaptive_rx_coalesce &&
+	    ec->pkt_rate_low > ec->pkt_rate_high)
+		return -EINVAL;
+
+	spin_lock_irqsave(&bp->lock, flags);
+
+	bp->rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	bp->tx_coalesce_usecs = ec->tx_coalesce_usecs;
+	bp->use_adaptive_rx_coalesce = !!ec->use_adaptive_rx_coalesce;
+	bp->pkt_rate_low = ec->pkt_rate_low;
+	bp->rx_coalesce_usecs_low = ec->rx_coalesce_usecs_low;
+	bp->pkt_rate_high = ec->pkt_rate_high;
+	bp->rx_coalesce_usecs_high = ec->rx_coalesce_usecs_high;
+
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		queue->rx_coalesce_usecs = bp->rx_coalesce_usecs;
+		queue->rx_sample_pkts = 0;
+		queue->rx_sample_start = jiffies;
+	}
+
+	if (macb_has_imod(bp))
+		gem_write_imod(bp, bp->rx_coalesce_usecs);
+
+	spin_unlock_irqrestore(&bp->lock, flags);
+
+	return 0;
+}
+
+static int gem_get_flow_rule(struct macb *bp, struct ethtool_rxnfc *cmd)
+{
+	struct gem_flow_rule *rule;
+
+	list_for_each_entry(rule, &bp->rx_fs_list, list) {
+		if (rule->fs.location == cmd->fs.location) {
+			memcpy(&cmd->fs, &rule->fs, sizeof(cmd->fs));
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int gem_get_all_flow_rules(struct macb *bp, struct ethtool_rxnfc *cmd,
+				  u32 *rule_locs)
+{
+	struct gem_flow_rule *rule;
+	unsigned int cnt = 0;
+
+	list_for_each_entry(rule, &bp->rx_fs_list, list) {
+		if (cnt == cmd->rule_cnt)
+			return -EMSGSIZE;
+		rule_locs[cnt++] = rule->fs.location;
+	}
+
+	cmd->data = bp->max_tuples;
+	cmd->rule_cnt = cnt;
+
+	return 0;
+}
+
+static int gem_add_flow_rule(struct macb *bp, struct ethtool_rxnfc *cmd)
+{
+	struct ethtool_rx_flow_spec *fs = &cmd->fs;
+	struct gem_flow_rule *rule, *new;
+	struct list_head *pos;
+
+	if (fs->location >= bp->max_tuples)
+		return -EINVAL;
+
+	/* the screeners can only steer, not discard */
+	if (fs->ring_cookie == RX_CLS_FLOW_DISC)
+		return -EOPNOTSUPP;
 
-	if (macb_is_gem(bp))
-		return gem_get_stats(bp);
+	if (fs->ring_cookie >= bp->num_queues)
+		return -EINVAL;
 
-	/* read stats from hardware */
-	macb_update_stats(bp);
+	if (gem_flow_cmps(fs, NULL) < 0)
+		return -EINVAL;
 
-	/* Convert HW stats into netdevice stats */
-	nstat->rx_errors = (hwstat->rx_fcs_errors +
-			    hwstat->rx_align_errors +
-			    hwstat->rx_resource_errors +
-			    hwstat->rx_overruns +
-			    hwstat->rx_oversize_pkts +
-			    hwstat->rx_jabbers +
-			    hwstat->rx_undersize_pkts +
-			    hwstat->rx_length_mismatch);
-	nstat->tx_errors = (hwstat->tx_late_cols +
-			    hwstat->tx_excessive_cols +
-			    hwstat->tx_underruns +
-			    hwstat->tx_carrier_errors +
-			    hwstat->sqe_test_errors);
-	nstat->collisions = (hwstat->tx_single_cols +
-			     hwstat->tx_multiple_cols +
-			     hwstat->tx_excessive_cols);
-	nstat->rx_length_errors = (hwstat->rx_oversize_pkts +
-				   hwstat->rx_jabbers +
-				   hwstat->rx_undersize_pkts +
-				   hwstat->rx_length_mismatch);
-	nstat->rx_over_errors = hwstat->rx_resource_errors +
-				   hwstat->rx_overruns;
-	nstat->rx_crc_errors = hwstat->rx_fcs_errors;
-	nstat->rx_frame_errors = hwstat->rx_align_errors;
-	nstat->rx_fifo_errors = hwstat->rx_overruns;
-	/* XXX: What does "missed" mean? */
-	nstat->tx_aborted_errors = hwstat->tx_excessive_cols;
-	nstat->tx_carrier_errors = hwstat->tx_carrier_errors;
-	nstat->tx_fifo_errors = hwstat->tx_underruns;
-	/* Don't know about heartbeat or window errors... */
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	memcpy(&new->fs, fs, sizeof(new->fs));
 
-	return nstat;
-}
+	/* keep the list sorted, replacing the rule at the same location */
+	pos = &bp->rx_fs_list;
+	list_for_each_entry(rule, &bp->rx_fs_list, list) {
+		if (rule->fs.location >= fs->location) {
+			pos = &rule->list;
+			break;
+		}
+	}
+	list_add_tail(&new->list, pos);
 
-static int macb_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
-{
-	struct macb *bp = netdev_priv(dev);
-	struct phy_device *phydev = bp->phy_dev;
+	if (pos != &bp->rx_fs_list && rule->fs.location == fs->location) {
+		list_del(&rule->list);
+		kfree(rule);
+	} else {
+		bp->rx_fs_count++;
+	}
 
-	if (!phydev)
-		return -ENODEV;
+	if (bp->dev->features & NETIF_F_NTUPLE)
+		gem_prog_flow_rule(bp, &new->fs);
 
-	return phy_ethtool_gset(phydev, cmd);
+	netdev_dbg(bp->dev, "added RX flow rule %u to queue %llu\n",
+		   fs->location, fs->ring_cookie);
+
+	return 0;
 }
 
-static int macb_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+static int gem_del_flow_rule(struct macb *bp, struct ethtool_rxnfc *cmd)
 {
-	struct macb *bp = netdev_priv(dev);
-	struct phy_device *phydev = bp->phy_dev;
+	struct gem_flow_rule *rule;
 
-	if (!phydev)
-		return -ENODEV;
+	list_for_each_entry(rule, &bp->rx_fs_list, list) {
+		if (rule->fs.location != cmd->fs.location)
+			continue;
 
-	return phy_ethtool_sset(phydev, cmd);
+		gem_writel(bp, SCRT2(gem_ctrl_t2_screeners(bp) +
+				     rule->fs.location), 0);
+		list_del(&rule->list);
+		kfree(rule);
+		bp->rx_fs_count--;
+		return 0;
+	}
+
+	return -EINVAL;
 }
 
-static int macb_get_regs_len(struct net_device *netdev)
+static void gem_free_flow_rules(struct macb *bp)
 {
-	return MACB_GREGS_NBR * sizeof(u32);
+	struct gem_flow_rule *rule, *tmp;
+
+	list_for_each_entry_safe(rule, tmp, &bp->rx_fs_list, list) {
+		list_del(&rule->list);
+		kfree(rule);
+	}
+	bp->rx_fs_count = 0;
 }
 
-static void macb_get_regs(struct net_device *dev, struct ethtool_regs *regs,
-			  void *p)
+static int gem_get_rxnfc(struct net_device *netdev, struct ethtool_rxnfc *cmd,
+			 u32 *rule_locs)
 {
-	struct macb *bp = netdev_priv(dev);
-	unsigned int tail, head;
-	u32 *regs_buff = p;
-
-	regs->version = (macb_readl(bp, MID) & ((1 << MACB_REV_SIZE) - 1))
-			| MACB_GREGS_VERSION;
+	struct macb *bp = netdev_priv(netdev);
 
-	tail = macb_tx_ring_wrap(bp->queues[0].tx_tail);
-	head = macb_tx_ring_wrap(bp->queues[0].tx_head);
+	switch (cmd->cmd) {
+	case ETHTOOL_GRXRINGS:
+		cmd->data = bp->num_queues;
+		return 0;
+	case ETHTOOL_GRXCLSRLCNT:
+		cmd->rule_cnt = bp->rx_fs_count;
+		cmd->data = bp->max_tuples;
+		return 0;
+	case ETHTOOL_GRXCLSRULE:
+		return gem_get_flow_rule(bp, cmd);
+	case ETHTOOL_GRXCLSRLALL:
+		return gem_get_all_flow_rules(bp, cmd, rule_locs);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
 
-	regs_buff[0]  = macb_readl(bp, NCR);
-	regs_buff[1]  = macb_or_gem_readl(bp, NCFGR);
-	regs_buff[2]  = macb_readl(bp, NSR);
-	regs_buff[3]  = macb_readl(bp, TSR);
-	regs_buff[4]  = macb_readl(bp, RBQP);
-	regs_buff[5]  = macb_readl(bp, TBQP);
-	regs_buff[6]  = macb_readl(bp, RSR);
-	regs_buff[7]  = macb_readl(bp, IMR);
+static int gem_set_rxnfc(struct net_device *netdev, struct ethtool_rxnfc *cmd)
+{
+	struct macb *bp = netdev_priv(netdev);
 
-	regs_buff[8]  = tail;
-	regs_buff[9]  = head;
-	regs_buff[10] = macb_tx_dma(&bp->queues[0], tail);
-	regs_buff[11] = macb_tx_dma(&bp->queues[0], head);
+	if (!bp->max_tuples)
+		return -EOPNOTSUPP;
 
-	regs_buff[12] = macb_or_gem_readl(bp, USRIO);
-	if (macb_is_gem(bp)) {
-		regs_buff[13] = gem_readl(bp, DMACFG);
+	switch (cmd->cmd) {
+	case ETHTOOL_SRXCLSRLINS:
+		return gem_add_flow_rule(bp, cmd);
+	case ETHTOOL_SRXCLSRLDEL:
+		return gem_del_flow_rule(bp, cmd);
+	default:
+		return -EOPNOTSUPP;
 	}
 }
 
@@ -2133,6 +3785,16 @@ static const struct ethtool_ops macb_ethtool_ops = {
 	.get_regs		= macb_get_regs,
 	.get_link		= ethtool_op_get_link,
 	.get_ts_info		= ethtool_op_get_ts_info,
+	.get_strings		= macb_get_ethtool_strings,
+	.get_sset_count		= macb_get_sset_count,
+	.get_coalesce		= macb_get_coalesce,
+	.set_coalesce		= macb_set_coalesce,
+	.get_ringparam		= macb_get_ringparam,
+	.set_ringparam		= macb_set_ringparam,
+	.get_priv_flags		= macb_get_priv_flags,
+	.set_priv_flags		= macb_set_priv_flags,
+	.get_tunable		= macb_get_tunable,
+	.set_tunable		= macb_set_tunable,
 };
 
 static const struct ethtool_ops gem_ethtool_ops = {
@@ -2141,10 +3803,20 @@ static const struct ethtool_ops gem_ethtool_ops = {
 	.get_regs_len		= macb_get_regs_len,
 	.get_regs		= macb_get_regs,
 	.get_link		= ethtool_op_get_link,
-	.get_ts_info		= ethtool_op_get_ts_info,
+	.get_ts_info		= gem_get_ts_info,
 	.get_ethtool_stats	= gem_get_ethtool_stats,
 	.get_strings		= gem_get_ethtool_strings,
 	.get_sset_count		= gem_get_sset_count,
+	.get_coalesce		= macb_get_coalesce,
+	.set_coalesce		= macb_set_coalesce,
+	.get_ringparam		= macb_get_ringparam,
+	.set_ringparam		= macb_set_ringparam,
+	.get_priv_flags		= macb_get_priv_flags,
+	.set_priv_flags		= macb_set_priv_flags,
+	.get_tunable		= macb_get_tunable,
+	.set_tunable		= macb_set_tunable,
+	.get_rxnfc		= gem_get_rxnfc,
+	.set_rxnfc		= gem_set_rxnfc,
 };
 
 static int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
@@ -2155,6 +3827,15 @@ static int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 	if (!netif_running(dev))
 		return -EINVAL;
 
+	if (gem_has_ptp(bp)) {
+		switch (cmd) {
+		case SIOCSHWTSTAMP:
+			return gem_set_hwtst(dev, rq);
+		case SIOCGHWTSTAMP:
+			return gem_get_hwtst(dev, rq);
+		}
+	}
+
 	if (!phydev)
 		return -ENODEV;
 
@@ -2192,6 +3873,145 @@ static int macb_set_features(struct net_device *netdev,
 		gem_writel(bp, NCFGR, netcfg);
 	}
 
+	/* RX flow rules */
+	if (changed & NETIF_F_NTUPLE)
+		gem_enable_flow_rules(bp, !!(features & NETIF_F_NTUPLE));
+
+	return 0;
+}
+
+#ifdef CONFIG_DEBUG_FS
+/* Dump the ring indices and descriptors of every queue */
+static int macb_rings_show(struct seq_file *s, void *unused)
+{
+	struct macb *bp = s->private;
+	struct macb_dma_desc *desc;
+	struct macb_queue *queue;
+	unsigned int q, i;
+
+	/* keep the rings from being freed under us */
+	rtnl_lock();
+
+	if (!netif_running(bp->dev)) {
+		seq_puts(s, "interface is down\n");
+		goto out;
+	}
+
+	for (q = 0, queue = bp->queues; q < bp->num_queues; ++q, ++queue) {
+		seq_printf(s, "queue %u: tx head %u tail %u used %u/%u hiwater %lu\n",
+			   q, queue->tx_head, queue->tx_tail,
+			   CIRC_CNT(queue->tx_head, queue->tx_tail,
+				    bp->tx_ring_size),
+			   bp->tx_ring_size, queue->stats.tx_ring_hiwater);
+		seq_printf(s, "queue %u: rx tail %u prepared head %u size %u\n",
+			   q, queue->rx_tail, queue->rx_prepared_head,
+			   bp->rx_ring_size);
+
+		for (i = 0; queue->tx_ring && i < bp->tx_ring_size; i++) {
+			desc = macb_tx_desc(queue, i);
+			seq_printf(s, "  tx %4u: %08x %08x\n",
+				   i, desc->addr, desc->ctrl);
+		}
+
+		for (i = 0; queue->rx_ring && i < bp->rx_ring_size; i++) {
+			desc = macb_rx_desc(queue, i);
+			seq_printf(s, "  rx %4u: %08x %08x\n",
+				   i, desc->addr, desc->ctrl);
+		}
+	}
+
+out:
+	rtnl_unlock();
+
+	return 0;
+}
+
+static int macb_rings_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, macb_rings_show, inode->i_private);
+}
+
+static const struct file_operations macb_rings_fops = {
+	.owner		= THIS_MODULE,
+	.open		= macb_rings_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void macb_debugfs_init(struct macb *bp)
+{
+	bp->debugfs_dir = debugfs_create_dir(dev_name(&bp->pdev->dev), NULL);
+	if (IS_ERR_OR_NULL(bp->debugfs_dir)) {
+		bp->debugfs_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("rings", S_IRUSR, bp->debugfs_dir, bp,
+			    &macb_rings_fops);
+}
+
+static void macb_debugfs_exit(struct macb *bp)
+{
+	debugfs_remove_recursive(bp->debugfs_dir);
+	bp->debugfs_dir = NULL;
+}
+#else
+static inline void macb_debugfs_init(struct macb *bp) { }
+static inline void macb_debugfs_exit(struct macb *bp) { }
+#endif
+
+/* mqprio offload: the GEM serves its TX queues in strict priority order,
+ * the highest numbered first.  Traffic class 0 goes to queue 0 and each
+ * other class gets a queue of its own, the highest class the highest
+ * priority queue, so that the top classes can also be shaped with
+ * tx_maxrate.  Queues left between are unused.
+ */
+static int macb_setup_tc(struct net_device *dev, u8 num_tc)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned int tc;
+
+	if (!num_tc) {
+		netdev_reset_tc(dev);
+		return 0;
+	}
+
+	if (num_tc > bp->num_queues)
+		return -EINVAL;
+
+	netdev_set_num_tc(dev, num_tc);
+	netdev_set_tc_queue(dev, 0, 1, 0);
+	for (tc = 1; tc < num_tc; tc++)
+		netdev_set_tc_queue(dev, tc, 1, bp->num_queues - num_tc + tc);
+
+	return 0;
+}
+
+static int macb_set_tx_maxrate(struct net_device *dev, int queue_index,
+			       u32 maxrate)
+{
+	struct macb *bp = netdev_priv(dev);
+	unsigned long flags;
+
+	if (!(bp->caps & MACB_CAPS_GEM_HAS_CBS))
+		return -EOPNOTSUPP;
+
+	/* Only queues A and B have a shaper */
+	if (queue_index == 0 || queue_index + 2 < bp->num_queues)
+		return -EINVAL;
+
+	if (maxrate > SPEED_1000)
+		return -EINVAL;
+
+	bp->queues[queue_index].tx_maxrate = maxrate;
+
+	if (netif_running(dev)) {
+		spin_lock_irqsave(&bp->lock, flags);
+		gem_write_cbs(bp);
+		spin_unlock_irqrestore(&bp->lock, flags);
+	}
+
 	return 0;
 }
 
@@ -2209,6 +4029,12 @@ static const struct net_device_ops macb_netdev_ops = {
 	.ndo_poll_controller	= macb_poll_controller,
 #endif
 	.ndo_set_features	= macb_set_features,
+	.ndo_features_check	= macb_features_check,
+	.ndo_setup_tc		= macb_setup_tc,
+	.ndo_set_tx_maxrate	= macb_set_tx_maxrate,
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= macb_busy_poll,
+#endif
 };
 
 /*
@@ -2231,8 +4057,23 @@ static void macb_configure_caps(struct macb *bp, const struct macb_config *dt_co
 		dcfg = gem_readl(bp, DCFG2);
 		if ((dcfg & (GEM_BIT(RX_PKT_BUFF) | GEM_BIT(TX_PKT_BUFF))) == 0)
 			bp->caps |= MACB_CAPS_FIFO_MODE;
+		dcfg = gem_readl(bp, DCFG8);
+		bp->num_t1_screeners = GEM_BFEXT(T1SCR, dcfg);
+		bp->num_t2_screeners = GEM_BFEXT(T2SCR, dcfg);
+		bp->num_t2_ethertypes = GEM_BFEXT(SCR2ETH, dcfg);
+		bp->num_t2_compares = GEM_BFEXT(SCR2CMP, dcfg);
+		dcfg = gem_readl(bp, DCFG5);
+		if (!IS_ENABLED(CONFIG_MACB_USE_HWSTAMP) ||
+		    !GEM_BFEXT(TSU, dcfg))
+			bp->caps &= ~MACB_CAPS_GEM_HAS_PTP;
+	} else {
+		bp->caps &= ~MACB_CAPS_GEM_HAS_PTP;
 	}
 
+	/* Queue A is never the best effort queue 0 */
+	if (bp->num_queues < 2)
+		bp->caps &= ~MACB_CAPS_GEM_HAS_CBS;
+
 	dev_dbg(&bp->pdev->dev, "Cadence caps 0x%08x\n", bp->caps);
 }
 
@@ -2342,6 +4183,8 @@ static int macb_init(struct platform_device *pdev)
 			queue->IDR  = GEM_IDR(hw_q - 1);
 			queue->IMR  = GEM_IMR(hw_q - 1);
 			queue->TBQP = GEM_TBQP(hw_q - 1);
+			queue->RBQP = GEM_RBQP(hw_q - 1);
+			queue->RBQS = GEM_RBQS(hw_q - 1);
 		} else {
 			/* queue0 uses legacy registers */
 			queue->ISR  = MACB_ISR;
@@ -2349,6 +4192,7 @@ static int macb_init(struct platform_device *pdev)
 			queue->IDR  = MACB_IDR;
 			queue->IMR  = MACB_IMR;
 			queue->TBQP = MACB_TBQP;
+			queue->RBQP = MACB_RBQP;
 		}
 
 		/* get irq: here we use the linux queue index, not the hardware
@@ -2367,11 +4211,23 @@ static int macb_init(struct platform_device *pdev)
 		}
 
 		INIT_WORK(&queue->tx_error_task, macb_tx_error_task);
+		netif_napi_add(dev, &queue->napi, macb_poll, 64);
+		netif_napi_add(dev, &queue->napi_tx, macb_tx_poll, 64);
+		hrtimer_init(&queue->coalesce_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		queue->coalesce_timer.function = macb_coalesce_timer;
 		q++;
 	}
 
 	dev->netdev_ops = &macb_netdev_ops;
-	netif_napi_add(dev, &bp->napi, macb_poll, 64);
+
+	bp->rx_ring_size = DEFAULT_RX_RING_SIZE;
+	bp->tx_ring_size = DEFAULT_TX_RING_SIZE;
+	bp->priv_flags = MACB_PRIV_RX_PAGE_MODE;
+	bp->rx_copybreak = MACB_RX_COPYBREAK;
+	bp->pkt_rate_low = MACB_PKT_RATE_LOW;
+	bp->pkt_rate_high = MACB_PKT_RATE_HIGH;
+	bp->rx_coalesce_usecs_high = MACB_RX_COALESCE_HIGH;
 
 	/* setup appropriated routines according to adapter type */
 	if (macb_is_gem(bp)) {
@@ -2395,10 +4251,26 @@ static int macb_init(struct platform_device *pdev)
 	/* Checksum offload is only available on gem with packet buffer */
 	if (macb_is_gem(bp) && !(bp->caps & MACB_CAPS_FIFO_MODE))
 		dev->hw_features |= NETIF_F_HW_CSUM | NETIF_F_RXCSUM;
+	/* LSO needs the packet buffer too, then it is a synthesis option */
+	if (macb_is_gem(bp) && !(bp->caps & MACB_CAPS_FIFO_MODE) &&
+	    GEM_BFEXT(PBUF_LSO, gem_readl(bp, DCFG6)))
+		dev->hw_features |= MACB_NETIF_LSO;
 	if (bp->caps & MACB_CAPS_SG_DISABLED)
 		dev->hw_features &= ~NETIF_F_SG;
 	dev->features = dev->hw_features;
 
+	/* RX flow rules use the type 2 screeners left by control traffic,
+	 * an EtherType register for IPv4 and three compare registers each.
+	 */
+	if (macb_is_gem(bp) && bp->num_queues > 1 &&
+	    gem_ctrl_t2_screeners(bp) < bp->num_t2_ethertypes) {
+		bp->max_tuples = min(bp->num_t2_screeners -
+				     gem_ctrl_t2_screeners(bp),
+				     bp->num_t2_compares / 3);
+		if (bp->max_tuples)
+			dev->hw_features |= NETIF_F_NTUPLE;
+	}
+
 	val = 0;
 	if (bp->phy_interface == PHY_INTERFACE_MODE_RGMII)
 		val = GEM_BIT(RGMII);
@@ -2424,52 +4296,62 @@ static int macb_init(struct platform_device *pdev)
 #if defined(CONFIG_OF)
 /* 1518 rounded up */
 #define AT91ETHER_MAX_RBUFF_SZ	0x600
-/* max number of receive buffers */
-#define AT91ETHER_MAX_RX_DESCR	9
+/* default number of receive buffers, must be power of 2 */
+#define AT91ETHER_RX_RING_SIZE	MIN_RX_RING_SIZE
+
+#define AT91ETHER_INT_FLAGS	(MACB_BIT(RCOMP)	| \
+				 MACB_BIT(RXUBR)	| \
+				 MACB_BIT(RM9200_TBRE)	| \
+				 MACB_BIT(ISR_TUND)	| \
+				 MACB_BIT(ISR_RLE)	| \
+				 MACB_BIT(TCOMP)	| \
+				 MACB_BIT(ISR_ROVR)	| \
+				 MACB_BIT(HRESP))
 
 /* Initialize and start the Receiver and Transmit subsystems */
 static int at91ether_start(struct net_device *dev)
 {
 	struct macb *lp = netdev_priv(dev);
+	struct macb_queue *q = &lp->queues[0];
+	struct macb_dma_desc *desc;
 	dma_addr_t addr;
 	u32 ctl;
 	int i;
 
-	lp->rx_ring = dma_alloc_coherent(&lp->pdev->dev,
-					 (AT91ETHER_MAX_RX_DESCR *
-					  sizeof(struct macb_dma_desc)),
-					 &lp->rx_ring_dma, GFP_KERNEL);
-	if (!lp->rx_ring)
+	q->rx_ring = macb_alloc_ring(lp, lp->rx_ring_size *
+				     sizeof(struct macb_dma_desc),
+				     &q->rx_ring_dma);
+	if (!q->rx_ring)
 		return -ENOMEM;
 
-	lp->rx_buffers = dma_alloc_coherent(&lp->pdev->dev,
-					    AT91ETHER_MAX_RX_DESCR *
-					    AT91ETHER_MAX_RBUFF_SZ,
-					    &lp->rx_buffers_dma, GFP_KERNEL);
-	if (!lp->rx_buffers) {
-		dma_free_coherent(&lp->pdev->dev,
-				  AT91ETHER_MAX_RX_DESCR *
-				  sizeof(struct macb_dma_desc),
-				  lp->rx_ring, lp->rx_ring_dma);
-		lp->rx_ring = NULL;
+	q->rx_buffers = dma_alloc_coherent(&lp->pdev->dev,
+					   lp->rx_ring_size *
+					   lp->rx_buffer_size,
+					   &q->rx_buffers_dma, GFP_KERNEL);
+	if (!q->rx_buffers) {
+		macb_free_ring(lp, lp->rx_ring_size *
+			       sizeof(struct macb_dma_desc),
+			       q->rx_ring, q->rx_ring_dma);
+		q->rx_ring = NULL;
 		return -ENOMEM;
 	}
 
-	addr = lp->rx_buffers_dma;
-	for (i = 0; i < AT91ETHER_MAX_RX_DESCR; i++) {
-		lp->rx_ring[i].addr = addr;
-		lp->rx_ring[i].ctrl = 0;
-		addr += AT91ETHER_MAX_RBUFF_SZ;
+	addr = q->rx_buffers_dma;
+	for (i = 0; i < lp->rx_ring_size; i++) {
+		desc = macb_rx_desc(q, i);
+		desc->addr = addr;
+		desc->ctrl = 0;
+		addr += lp->rx_buffer_size;
 	}
 
 	/* Set the Wrap bit on the last descriptor */
-	lp->rx_ring[AT91ETHER_MAX_RX_DESCR - 1].addr |= MACB_BIT(RX_WRAP);
+	desc->addr |= MACB_BIT(RX_WRAP);
 
 	/* Reset buffer index */
-	lp->rx_tail = 0;
+	q->rx_tail = 0;
 
 	/* Program address of descriptor list in Rx Buffer Queue register */
-	macb_writel(lp, RBQP, lp->rx_ring_dma);
+	macb_writel(lp, RBQP, q->rx_ring_dma);
 
 	/* Enable Receive and Transmit */
 	ctl = macb_readl(lp, NCR);
@@ -2495,14 +4377,13 @@ static int at91ether_open(struct net_device *dev)
 	if (ret)
 		return ret;
 
+	lp->rm9200_tx_tail = 0;
+	lp->rm9200_tx_len = 0;
+
+	napi_enable(&lp->queues[0].napi);
+
 	/* Enable MAC interrupts */
-	macb_writel(lp, IER, MACB_BIT(RCOMP)	|
-			     MACB_BIT(RXUBR)	|
-			     MACB_BIT(ISR_TUND)	|
-			     MACB_BIT(ISR_RLE)	|
-			     MACB_BIT(TCOMP)	|
-			     MACB_BIT(ISR_ROVR)	|
-			     MACB_BIT(HRESP));
+	macb_writel(lp, IER, AT91ETHER_INT_FLAGS);
 
 	/* schedule a link state check */
 	phy_start(lp->phy_dev);
@@ -2516,6 +4397,9 @@ static int at91ether_open(struct net_device *dev)
 static int at91ether_close(struct net_device *dev)
 {
 	struct macb *lp = netdev_priv(dev);
+	struct macb_queue *q = &lp->queues[0];
+	struct macb_tx_skb *tx_skb;
+	unsigned long flags;
 	u32 ctl;
 
 	/* Disable Receiver and Transmitter */
@@ -2523,95 +4407,198 @@ static int at91ether_close(struct net_device *dev)
 	macb_writel(lp, NCR, ctl & ~(MACB_BIT(TE) | MACB_BIT(RE)));
 
 	/* Disable MAC interrupts */
-	macb_writel(lp, IDR, MACB_BIT(RCOMP)	|
-			     MACB_BIT(RXUBR)	|
-			     MACB_BIT(ISR_TUND)	|
-			     MACB_BIT(ISR_RLE)	|
-			     MACB_BIT(TCOMP)	|
-			     MACB_BIT(ISR_ROVR) |
-			     MACB_BIT(HRESP));
+	macb_writel(lp, IDR, AT91ETHER_INT_FLAGS);
 
 	netif_stop_queue(dev);
+	napi_disable(&q->napi);
+
+	/* Release the frames the transmitter did not get to */
+	spin_lock_irqsave(&lp->lock, flags);
+	while (lp->rm9200_tx_len) {
+		tx_skb = &lp->rm9200_txq[(lp->rm9200_tx_tail -
+					  lp->rm9200_tx_len) & 1];
+		dma_unmap_single(&lp->pdev->dev, tx_skb->mapping,
+				 tx_skb->size, DMA_TO_DEVICE);
+		dev_kfree_skb_any(tx_skb->skb);
+		tx_skb->skb = NULL;
+		lp->rm9200_tx_len--;
+	}
+	spin_unlock_irqrestore(&lp->lock, flags);
 
-	dma_free_coherent(&lp->pdev->dev,
-			  AT91ETHER_MAX_RX_DESCR *
-			  sizeof(struct macb_dma_desc),
-			  lp->rx_ring, lp->rx_ring_dma);
-	lp->rx_ring = NULL;
+	macb_free_ring(lp, lp->rx_ring_size * sizeof(struct macb_dma_desc),
+		       q->rx_ring, q->rx_ring_dma);
+	q->rx_ring = NULL;
 
 	dma_free_coherent(&lp->pdev->dev,
-			  AT91ETHER_MAX_RX_DESCR * AT91ETHER_MAX_RBUFF_SZ,
-			  lp->rx_buffers, lp->rx_buffers_dma);
-	lp->rx_buffers = NULL;
+			  lp->rx_ring_size * lp->rx_buffer_size,
+			  q->rx_buffers, q->rx_buffers_dma);
+	q->rx_buffers = NULL;
 
 	return 0;
 }
 
-/* Transmit packet */
+/* Transmit packet
+ *
+ * The EMAC holds one frame on the wire and one more in the TAR/TCR
+ * registers, so keep up to two frames in flight and only stop the
+ * queue once both slots are taken.
+ */
 static int at91ether_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct macb *lp = netdev_priv(dev);
+	struct macb_tx_skb *tx_skb;
+	unsigned long flags;
+	dma_addr_t mapping;
 
-	if (macb_readl(lp, TSR) & MACB_BIT(RM9200_BNQ)) {
+	if (lp->rm9200_tx_len >= 2) {
 		netif_stop_queue(dev);
-
-		/* Store packet information (to free when Tx completed) */
-		lp->skb = skb;
-		lp->skb_length = skb->len;
-		lp->skb_physaddr = dma_map_single(NULL, skb->data, skb->len,
-							DMA_TO_DEVICE);
-
-		/* Set address of the data in the Transmit Address register */
-		macb_writel(lp, TAR, lp->skb_physaddr);
-		/* Set length of the packet in the Transmit Control register */
-		macb_writel(lp, TCR, skb->len);
-
-	} else {
 		netdev_err(dev, "%s called, but device is busy!\n", __func__);
 		return NETDEV_TX_BUSY;
 	}
 
+	mapping = dma_map_single(&lp->pdev->dev, skb->data, skb->len,
+				 DMA_TO_DEVICE);
+	if (dma_mapping_error(&lp->pdev->dev, mapping)) {
+		dev_kfree_skb_any(skb);
+		lp->stats.tx_dropped++;
+		netdev_err(dev, "%s: DMA mapping error\n", __func__);
+		return NETDEV_TX_OK;
+	}
+
+	spin_lock_irqsave(&lp->lock, flags);
+
+	/* Store packet information (to free when Tx completed) */
+	tx_skb = &lp->rm9200_txq[lp->rm9200_tx_tail];
+	tx_skb->skb = skb;
+	tx_skb->mapping = mapping;
+	tx_skb->size = skb->len;
+
+	lp->rm9200_tx_tail = (lp->rm9200_tx_tail + 1) & 1;
+	lp->rm9200_tx_len++;
+	if (lp->rm9200_tx_len > 1)
+		netif_stop_queue(dev);
+
+	/* Set address of the data in the Transmit Address register */
+	macb_writel(lp, TAR, mapping);
+	/* Set length of the packet in the Transmit Control register */
+	macb_writel(lp, TCR, skb->len);
+
+	spin_unlock_irqrestore(&lp->lock, flags);
+
 	return NETDEV_TX_OK;
 }
 
-/* Extract received frame from buffer descriptors and sent to upper layers.
- * (Called from interrupt context)
+/* Extract received frames from buffer descriptors and send them to upper
+ * layers. (Called from NAPI context)
  */
-static void at91ether_rx(struct net_device *dev)
+static int at91ether_rx(struct net_device *dev, int budget)
 {
 	struct macb *lp = netdev_priv(dev);
+	struct macb_queue *q = &lp->queues[0];
+	struct macb_dma_desc *desc;
 	unsigned char *p_recv;
 	struct sk_buff *skb;
 	unsigned int pktlen;
+	int received = 0;
+
+	while (received < budget) {
+		desc = macb_rx_desc(q, q->rx_tail);
+		if (!(desc->addr & MACB_BIT(RX_USED)))
+			break;
+
+		/* Ensure ctrl is at least as up-to-date as addr */
+		rmb();
 
-	while (lp->rx_ring[lp->rx_tail].addr & MACB_BIT(RX_USED)) {
-		p_recv = lp->rx_buffers + lp->rx_tail * AT91ETHER_MAX_RBUFF_SZ;
-		pktlen = MACB_BF(RX_FRMLEN, lp->rx_ring[lp->rx_tail].ctrl);
-		skb = netdev_alloc_skb(dev, pktlen + 2);
+		p_recv = macb_rx_buffer(q, q->rx_tail);
+		pktlen = MACB_BF(RX_FRMLEN, desc->ctrl);
+		skb = napi_alloc_skb(&q->napi, pktlen);
 		if (skb) {
-			skb_reserve(skb, 2);
 			memcpy(skb_put(skb, pktlen), p_recv, pktlen);
 
 			skb->protocol = eth_type_trans(skb, dev);
 			lp->stats.rx_packets++;
 			lp->stats.rx_bytes += pktlen;
-			netif_rx(skb);
+			napi_gro_receive(&q->napi, skb);
 		} else {
 			lp->stats.rx_dropped++;
 		}
 
-		if (lp->rx_ring[lp->rx_tail].ctrl & MACB_BIT(RX_MHASH_MATCH))
+		if (desc->ctrl & MACB_BIT(RX_MHASH_MATCH))
 			lp->stats.multicast++;
 
 		/* reset ownership bit */
-		lp->rx_ring[lp->rx_tail].addr &= ~MACB_BIT(RX_USED);
+		desc->addr &= ~MACB_BIT(RX_USED);
+
+		q->rx_tail++;
+		received++;
+	}
+
+	return received;
+}
+
+static int at91ether_poll(struct napi_struct *napi, int budget)
+{
+	struct macb_queue *q = container_of(napi, struct macb_queue, napi);
+	struct macb *lp = q->bp;
+	int work_done;
+	u32 status;
+
+	status = macb_readl(lp, RSR);
+	macb_writel(lp, RSR, status);
 
-		/* wrap after last buffer */
-		if (lp->rx_tail == AT91ETHER_MAX_RX_DESCR - 1)
-			lp->rx_tail = 0;
+	work_done = at91ether_rx(lp->dev, budget);
+	if (work_done < budget) {
+		napi_complete(napi);
+
+		/* Packets received while interrupts were disabled */
+		status = macb_readl(lp, RSR);
+		if (status)
+			napi_reschedule(napi);
 		else
-			lp->rx_tail++;
+			macb_writel(lp, IER, MACB_BIT(RCOMP));
+	}
+
+	return work_done;
+}
+
+/* Release the frames the transmitter is done with */
+static void at91ether_tx_complete(struct net_device *dev)
+{
+	struct macb *lp = netdev_priv(dev);
+	struct macb_tx_skb *tx_skb;
+	unsigned int qlen;
+	u32 tsr;
+
+	spin_lock(&lp->lock);
+
+	/* The transmitter is either idle with everything sent (TGO, which
+	 * the RM9200 calls IDLE), busy with the last frame queued (BNQ),
+	 * or busy with a second frame still waiting in TAR/TCR.
+	 */
+	tsr = macb_readl(lp, TSR);
+	if (tsr & MACB_BIT(TGO))
+		qlen = 0;
+	else if (tsr & MACB_BIT(RM9200_BNQ))
+		qlen = 1;
+	else
+		qlen = 2;
+
+	while (lp->rm9200_tx_len > qlen) {
+		tx_skb = &lp->rm9200_txq[(lp->rm9200_tx_tail -
+					  lp->rm9200_tx_len) & 1];
+		dma_unmap_single(&lp->pdev->dev, tx_skb->mapping,
+				 tx_skb->size, DMA_TO_DEVICE);
+		dev_consume_skb_irq(tx_skb->skb);
+		tx_skb->skb = NULL;
+		lp->stats.tx_packets++;
+		lp->stats.tx_bytes += tx_skb->size;
+		lp->rm9200_tx_len--;
 	}
+
+	if (lp->rm9200_tx_len < 2 && netif_queue_stopped(dev))
+		netif_wake_queue(dev);
+
+	spin_unlock(&lp->lock);
 }
 
 /* MAC interrupt handler */
@@ -2619,6 +4606,7 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = dev_id;
 	struct macb *lp = netdev_priv(dev);
+	struct macb_queue *q = &lp->queues[0];
 	u32 intstatus, ctl;
 
 	/* MAC Interrupt Status register indicates what interrupts are pending.
@@ -2627,24 +4615,18 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 	intstatus = macb_readl(lp, ISR);
 
 	/* Receive complete */
-	if (intstatus & MACB_BIT(RCOMP))
-		at91ether_rx(dev);
+	if ((intstatus & MACB_BIT(RCOMP)) && napi_schedule_prep(&q->napi)) {
+		macb_writel(lp, IDR, MACB_BIT(RCOMP));
+		__napi_schedule(&q->napi);
+	}
 
 	/* Transmit complete */
-	if (intstatus & MACB_BIT(TCOMP)) {
+	if (intstatus & (MACB_BIT(TCOMP) | MACB_BIT(RM9200_TBRE))) {
 		/* The TCOM bit is set even if the transmission failed */
 		if (intstatus & (MACB_BIT(ISR_TUND) | MACB_BIT(ISR_RLE)))
 			lp->stats.tx_errors++;
 
-		if (lp->skb) {
-			dev_kfree_skb_irq(lp->skb);
-			lp->skb = NULL;
-			dma_unmap_single(NULL, lp->skb_physaddr,
-					 lp->skb_length, DMA_TO_DEVICE);
-			lp->stats.tx_packets++;
-			lp->stats.tx_bytes += lp->skb_length;
-		}
-		netif_wake_queue(dev);
+		at91ether_tx_complete(dev);
 	}
 
 	/* Work-around for EMAC Errata section 41.3.1 */
@@ -2717,6 +4699,11 @@ static int at91ether_init(struct platform_device *pdev)
 	dev->netdev_ops = &at91ether_netdev_ops;
 	dev->ethtool_ops = &macb_ethtool_ops;
 
+	bp->queues[0].bp = bp;
+	bp->rx_ring_size = AT91ETHER_RX_RING_SIZE;
+	bp->rx_buffer_size = AT91ETHER_MAX_RBUFF_SZ;
+	netif_napi_add(dev, &bp->queues[0].napi, at91ether_poll, 64);
+
 	err = devm_request_irq(&pdev->dev, dev->irq, at91ether_interrupt,
 			       0, dev->name, dev);
 	if (err)
@@ -2747,7 +4734,8 @@ static const struct macb_config pc302gem_config = {
 };
 
 static const struct macb_config sama5d2_config = {
-	.caps = MACB_CAPS_USRIO_DEFAULT_IS_MII_GMII,
+	.caps = MACB_CAPS_USRIO_DEFAULT_IS_MII_GMII | MACB_CAPS_GEM_HAS_PTP
+	      | MACB_CAPS_GEM_HAS_CBS,
 	.dma_burst_length = 16,
 	.clk_init = macb_clk_init,
 	.init = macb_init,
@@ -2774,7 +4762,9 @@ static const struct macb_config emac_config = {
 };
 
 static const struct macb_config zynqmp_config = {
-	.caps = MACB_CAPS_GIGABIT_MODE_AVAILABLE | MACB_CAPS_JUMBO,
+	.caps = MACB_CAPS_GIGABIT_MODE_AVAILABLE | MACB_CAPS_JUMBO
+	      | MACB_CAPS_INT_MODERATION | MACB_CAPS_GEM_HAS_PTP
+	      | MACB_CAPS_GEM_HAS_CBS,
 	.dma_burst_length = 16,
 	.clk_init = macb_clk_init,
 	.init = macb_init,
@@ -2882,6 +4872,7 @@ static int macb_probe(struct platform_device *pdev)
 		bp->jumbo_max_len = macb_config->jumbo_max_len;
 
 	spin_lock_init(&bp->lock);
+	INIT_LIST_HEAD(&bp->rx_fs_list);
 
 	/* setup capabilities */
 	macb_configure_caps(bp, macb_config);
@@ -2916,6 +4907,11 @@ static int macb_probe(struct platform_device *pdev)
 	if (err)
 		goto err_out_free_netdev;
 
+	/* By default, room for the rings of the first queue */
+	bp->sram_pool = devm_atmel_sram_pool(&pdev->dev,
+					     RX_RING_BYTES(bp) +
+					     TX_RING_BYTES(bp));
+
 	err = register_netdev(dev);
 	if (err) {
 		dev_err(&pdev->dev, "Cannot register net device, aborting.\n");
@@ -2928,6 +4924,11 @@ static int macb_probe(struct platform_device *pdev)
 
 	netif_carrier_off(dev);
 
+	if (gem_has_ptp(bp))
+		gem_ptp_init(dev);
+
+	macb_debugfs_init(bp);
+
 	netdev_info(dev, "Cadence %s rev 0x%08x at 0x%08lx irq %d (%pM)\n",
 		    macb_is_gem(bp) ? "GEM" : "MACB", macb_readl(bp, MID),
 		    dev->base_addr, dev->irq, dev->dev_addr);
@@ -2961,6 +4962,10 @@ static int macb_remove(struct platform_device *pdev)
 
 	if (dev) {
 		bp = netdev_priv(dev);
+		macb_debugfs_exit(bp);
+		gem_free_flow_rules(bp);
+		if (gem_has_ptp(bp))
+			gem_ptp_remove(dev);
 		if (bp->phy_dev)
 			phy_disconnect(bp->phy_dev);
 		mdiobus_unregister(bp->mii_bus);
@@ -3016,6 +5021,7 @@ static struct platform_driver macb_driver = {
 		.name		= "macb",
 		.of_match_table	= of_match_ptr(macb_dt_ids),
 		.pm	= &macb_pm_ops,
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
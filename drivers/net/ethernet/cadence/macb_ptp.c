@@ -0,0 +1,424 @@
+/*
+ * IEEE 1588 PTP support for the Cadence GEM time stamp unit
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/clk.h>
+#include <linux/device.h>
+#include <linux/etherdevice.h>
+#include <linux/platform_device.h>
+#include <linux/time64.h>
+#include <linux/net_tstamp.h>
+#include <linux/ptp_clock_kernel.h>
+#include <linux/io.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+
+#include "macb.h"
+
+#define GEM_PTP_TIMER_NAME	"gem-ptp-timer"
+#define GEM_PTP_MAX_ADJ		64000000 /* ppb */
+
+#define TSU_SEC_MAX_VAL		(((u64)1 << (GEM_TSH_SIZE + GEM_TSL_SIZE)) - 1)
+#define TSU_NSEC_MAX_VAL	((1 << GEM_ITDT_SIZE) - 1)
+
+static struct macb_dma_desc_ptp *macb_ptp_desc(struct macb_dma_desc *desc)
+{
+	/* the timestamp words follow the descriptor in extended mode */
+	return (struct macb_dma_desc_ptp *)(desc + 1);
+}
+
+static int gem_tsu_get_time(struct ptp_clock_info *ptp, struct timespec64 *ts)
+{
+	struct macb *bp = container_of(ptp, struct macb, ptp_clock_info);
+	unsigned long flags;
+	u32 first, second;
+	u32 secl, sech;
+
+	spin_lock_irqsave(&bp->tsu_clk_lock, flags);
+	first = gem_readl(bp, TN);
+	secl = gem_readl(bp, TSL);
+	sech = gem_readl(bp, TSH);
+	second = gem_readl(bp, TN);
+
+	/* The seconds are not latched with the nanoseconds: if the latter
+	 * wrapped meanwhile, read the seconds again.
+	 */
+	if (first > second) {
+		ts->tv_nsec = gem_readl(bp, TN);
+		secl = gem_readl(bp, TSL);
+		sech = gem_readl(bp, TSH);
+	} else {
+		ts->tv_nsec = first;
+	}
+	spin_unlock_irqrestore(&bp->tsu_clk_lock, flags);
+
+	ts->tv_sec = (((u64)sech << GEM_TSL_SIZE) | secl) & TSU_SEC_MAX_VAL;
+
+	return 0;
+}
+
+static int gem_tsu_set_time(struct ptp_clock_info *ptp,
+			    const struct timespec64 *ts)
+{
+	struct macb *bp = container_of(ptp, struct macb, ptp_clock_info);
+	unsigned long flags;
+	u32 ns, sech, secl;
+
+	secl = (u32)ts->tv_sec;
+	sech = (ts->tv_sec >> GEM_TSL_SIZE) & ((1 << GEM_TSH_SIZE) - 1);
+	ns = ts->tv_nsec;
+
+	spin_lock_irqsave(&bp->tsu_clk_lock, flags);
+	/* clear the nanoseconds first so that no carry happens meanwhile */
+	gem_writel(bp, TN, 0);
+	gem_writel(bp, TSH, sech);
+	/* writing the lower seconds register updates the whole value */
+	gem_writel(bp, TSL, secl);
+	gem_writel(bp, TN, ns);
+	spin_unlock_irqrestore(&bp->tsu_clk_lock, flags);
+
+	return 0;
+}
+
+static void gem_tsu_incr_set(struct macb *bp, struct tsu_incr *incr_spec)
+{
+	unsigned long flags;
+
+	/* The sub nanoseconds increment only takes effect once the
+	 * increment register is written.
+	 */
+	spin_lock_irqsave(&bp->tsu_clk_lock, flags);
+	gem_writel(bp, TISUBN, GEM_BF(SUBNSINCR, incr_spec->sub_ns));
+	gem_writel(bp, TI, GEM_BF(NSINCR, incr_spec->ns));
+	spin_unlock_irqrestore(&bp->tsu_clk_lock, flags);
+}
+
+static int gem_ptp_adjfreq(struct ptp_clock_info *ptp, s32 ppb)
+{
+	struct macb *bp = container_of(ptp, struct macb, ptp_clock_info);
+	struct tsu_incr incr_spec;
+	bool neg_adj = false;
+	u64 word, adj;
+
+	if (ppb < 0) {
+		neg_adj = true;
+		ppb = -ppb;
+	}
+
+	/* Adjustment is relative to the nominal increment, expressed as
+	 * ns (8 bits) | fractions of ns (16 bits).
+	 */
+	word = ((u64)bp->tsu_incr.ns << GEM_SUBNSINCR_SIZE) +
+	       bp->tsu_incr.sub_ns;
+	adj = div_u64(word * ppb + (NSEC_PER_SEC >> 1), NSEC_PER_SEC);
+	word = neg_adj ? word - adj : word + adj;
+
+	incr_spec.ns = (word >> GEM_SUBNSINCR_SIZE) &
+		       ((1 << GEM_NSINCR_SIZE) - 1);
+	incr_spec.sub_ns = word & ((1 << GEM_SUBNSINCR_SIZE) - 1);
+	gem_tsu_incr_set(bp, &incr_spec);
+
+	return 0;
+}
+
+static int gem_ptp_adjtime(struct ptp_clock_info *ptp, s64 delta)
+{
+	struct macb *bp = container_of(ptp, struct macb, ptp_clock_info);
+	struct timespec64 now, then;
+	u32 adj, sign = 0;
+
+	if (delta < 0) {
+		sign = 1;
+		delta = -delta;
+	}
+
+	if (delta > TSU_NSEC_MAX_VAL) {
+		/* too large for the adjust register */
+		then = ns_to_timespec64(delta);
+		gem_tsu_get_time(ptp, &now);
+		if (sign)
+			now = timespec64_sub(now, then);
+		else
+			now = timespec64_add(now, then);
+		gem_tsu_set_time(ptp, &now);
+	} else {
+		adj = GEM_BF(ADDSUB, sign) | GEM_BF(ITDT, delta);
+		gem_writel(bp, TA, adj);
+	}
+
+	return 0;
+}
+
+static int gem_ptp_enable(struct ptp_clock_info *ptp,
+			  struct ptp_clock_request *rq, int on)
+{
+	return -EOPNOTSUPP;
+}
+
+static const struct ptp_clock_info gem_ptp_caps_template = {
+	.owner		= THIS_MODULE,
+	.name		= GEM_PTP_TIMER_NAME,
+	.max_adj	= GEM_PTP_MAX_ADJ,
+	.n_alarm	= 0,
+	.n_ext_ts	= 0,
+	.n_per_out	= 0,
+	.n_pins		= 0,
+	.pps		= 0,
+	.adjfreq	= gem_ptp_adjfreq,
+	.adjtime	= gem_ptp_adjtime,
+	.gettime64	= gem_tsu_get_time,
+	.settime64	= gem_tsu_set_time,
+	.enable		= gem_ptp_enable,
+};
+
+static void gem_ptp_init_timer(struct macb *bp)
+{
+	u32 rem = 0;
+	u64 adj;
+
+	bp->tsu_incr.ns = div_u64_rem(NSEC_PER_SEC, bp->tsu_rate, &rem);
+	if (rem) {
+		adj = rem;
+		adj <<= GEM_SUBNSINCR_SIZE;
+		bp->tsu_incr.sub_ns = div_u64(adj, bp->tsu_rate);
+	} else {
+		bp->tsu_incr.sub_ns = 0;
+	}
+}
+
+static void gem_ptp_init_tsu(struct macb *bp)
+{
+	struct timespec64 ts;
+
+	/* start from the system time with the nominal increment */
+	ts = ktime_to_timespec64(ktime_get_real());
+	gem_tsu_set_time(&bp->ptp_clock_info, &ts);
+	gem_tsu_incr_set(bp, &bp->tsu_incr);
+	gem_writel(bp, TA, 0);
+}
+
+static void gem_ptp_clear_timer(struct macb *bp)
+{
+	bp->tsu_incr.sub_ns = 0;
+	bp->tsu_incr.ns = 0;
+
+	gem_writel(bp, TISUBN, GEM_BF(SUBNSINCR, 0));
+	gem_writel(bp, TI, GEM_BF(NSINCR, 0));
+	gem_writel(bp, TA, 0);
+}
+
+static void gem_hw_timestamp(struct macb *bp, u32 dma_desc_ts_1,
+			     u32 dma_desc_ts_2, struct timespec64 *ts)
+{
+	struct timespec64 tsu;
+
+	ts->tv_sec = (GEM_BFEXT(DMA_SECH, dma_desc_ts_2) << GEM_DMA_SECL_SIZE) |
+		     GEM_BFEXT(DMA_SECL, dma_desc_ts_1);
+	ts->tv_nsec = GEM_BFEXT(DMA_NSEC, dma_desc_ts_1);
+
+	/* The descriptor only holds the low bits of the seconds: take the
+	 * upper ones from the timer, unless they rolled over since the
+	 * frame was stamped.
+	 */
+	gem_tsu_get_time(&bp->ptp_clock_info, &tsu);
+
+	if ((ts->tv_sec & (GEM_DMA_SEC_TOP >> 1)) &&
+	    !(tsu.tv_sec & (GEM_DMA_SEC_TOP >> 1)))
+		ts->tv_sec -= GEM_DMA_SEC_TOP;
+
+	ts->tv_sec += ((~GEM_DMA_SEC_MASK) & tsu.tv_sec);
+}
+
+void gem_ptp_rxstamp(struct macb *bp, struct sk_buff *skb,
+		     struct macb_dma_desc *desc)
+{
+	struct skb_shared_hwtstamps *shhwtstamps = skb_hwtstamps(skb);
+	struct macb_dma_desc_ptp *desc_ptp;
+	struct timespec64 ts;
+
+	if (!GEM_BFEXT(DMA_RXVALID, desc->addr))
+		return;
+
+	desc_ptp = macb_ptp_desc(desc);
+	gem_hw_timestamp(bp, desc_ptp->ts_1, desc_ptp->ts_2, &ts);
+	memset(shhwtstamps, 0, sizeof(struct skb_shared_hwtstamps));
+	shhwtstamps->hwtstamp = ktime_set(ts.tv_sec, ts.tv_nsec);
+}
+
+void gem_ptp_txstamp(struct macb *bp, struct sk_buff *skb,
+		     struct macb_dma_desc *desc)
+{
+	struct skb_shared_hwtstamps shhwtstamps;
+	struct macb_dma_desc_ptp *desc_ptp;
+	struct timespec64 ts;
+
+	if (!GEM_BFEXT(DMA_TXVALID, desc->ctrl)) {
+		dev_warn_ratelimited(&bp->pdev->dev,
+				     "Timestamp not set in TX BD as expected\n");
+		return;
+	}
+
+	desc_ptp = macb_ptp_desc(desc);
+	gem_hw_timestamp(bp, desc_ptp->ts_1, desc_ptp->ts_2, &ts);
+	memset(&shhwtstamps, 0, sizeof(shhwtstamps));
+	shhwtstamps.hwtstamp = ktime_set(ts.tv_sec, ts.tv_nsec);
+	skb_tstamp_tx(skb, &shhwtstamps);
+}
+
+void gem_ptp_init(struct net_device *dev)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	bp->ptp_clock_info = gem_ptp_caps_template;
+	spin_lock_init(&bp->tsu_clk_lock);
+
+	bp->tsu_rate = clk_get_rate(bp->pclk);
+	if (!bp->tsu_rate) {
+		netdev_err(dev, "unknown TSU clock rate, PTP disabled\n");
+		bp->caps &= ~MACB_CAPS_GEM_HAS_PTP;
+		return;
+	}
+
+	gem_ptp_init_timer(bp);
+	gem_ptp_init_tsu(bp);
+
+	bp->ptp_clock = ptp_clock_register(&bp->ptp_clock_info,
+					   &bp->pdev->dev);
+	if (IS_ERR(bp->ptp_clock)) {
+		netdev_err(dev, "ptp_clock_register failed (%ld)\n",
+			   PTR_ERR(bp->ptp_clock));
+		bp->ptp_clock = NULL;
+		gem_ptp_clear_timer(bp);
+		return;
+	}
+
+	netdev_info(dev, "%s ptp clock registered, %lu Hz\n",
+		    GEM_PTP_TIMER_NAME, bp->tsu_rate);
+}
+
+void gem_ptp_remove(struct net_device *dev)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (!bp->ptp_clock)
+		return;
+
+	ptp_clock_unregister(bp->ptp_clock);
+	bp->ptp_clock = NULL;
+	gem_ptp_clear_timer(bp);
+}
+
+int gem_get_ts_info(struct net_device *dev, struct ethtool_ts_info *info)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (!gem_has_ptp(bp))
+		return ethtool_op_get_ts_info(dev, info);
+
+	info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE |
+				SOF_TIMESTAMPING_RX_SOFTWARE |
+				SOF_TIMESTAMPING_SOFTWARE |
+				SOF_TIMESTAMPING_TX_HARDWARE |
+				SOF_TIMESTAMPING_RX_HARDWARE |
+				SOF_TIMESTAMPING_RAW_HARDWARE;
+	info->tx_types = (1 << HWTSTAMP_TX_OFF) |
+			 (1 << HWTSTAMP_TX_ON);
+	info->rx_filters = (1 << HWTSTAMP_FILTER_NONE) |
+			   (1 << HWTSTAMP_FILTER_PTP_V1_L4_EVENT) |
+			   (1 << HWTSTAMP_FILTER_PTP_V2_EVENT) |
+			   (1 << HWTSTAMP_FILTER_ALL);
+	info->phc_index = bp->ptp_clock ? ptp_clock_index(bp->ptp_clock) : -1;
+
+	return 0;
+}
+
+int gem_get_hwtst(struct net_device *dev, struct ifreq *rq)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (copy_to_user(rq->ifr_data, &bp->tstamp_config,
+			 sizeof(bp->tstamp_config)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static void gem_ptp_set_ts_mode(struct macb *bp, u32 tx_mode, u32 rx_mode)
+{
+	gem_writel(bp, TXBDCTRL, GEM_BF(TXTSMODE, tx_mode));
+	gem_writel(bp, RXBDCTRL, GEM_BF(RXTSMODE, rx_mode));
+}
+
+int gem_set_hwtst(struct net_device *dev, struct ifreq *rq)
+{
+	struct macb *bp = netdev_priv(dev);
+	struct hwtstamp_config config;
+	u32 tx_mode = GEM_TSTAMP_DISABLED;
+	u32 rx_mode = GEM_TSTAMP_DISABLED;
+
+	if (!bp->ptp_clock)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&config, rq->ifr_data, sizeof(config)))
+		return -EFAULT;
+
+	/* reserved for future extensions */
+	if (config.flags)
+		return -EINVAL;
+
+	switch (config.tx_type) {
+	case HWTSTAMP_TX_OFF:
+		break;
+	case HWTSTAMP_TX_ON:
+		tx_mode = GEM_TSTAMP_ALL_FRAMES;
+		break;
+	default:
+		return -ERANGE;
+	}
+
+	switch (config.rx_filter) {
+	case HWTSTAMP_FILTER_NONE:
+		break;
+	case HWTSTAMP_FILTER_PTP_V1_L4_EVENT:
+	case HWTSTAMP_FILTER_PTP_V1_L4_SYNC:
+	case HWTSTAMP_FILTER_PTP_V1_L4_DELAY_REQ:
+		rx_mode = GEM_TSTAMP_ALL_PTP_FRAMES;
+		config.rx_filter = HWTSTAMP_FILTER_PTP_V1_L4_EVENT;
+		break;
+	case HWTSTAMP_FILTER_PTP_V2_L4_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_L4_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_L4_DELAY_REQ:
+	case HWTSTAMP_FILTER_PTP_V2_L2_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_L2_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_L2_DELAY_REQ:
+	case HWTSTAMP_FILTER_PTP_V2_EVENT:
+	case HWTSTAMP_FILTER_PTP_V2_SYNC:
+	case HWTSTAMP_FILTER_PTP_V2_DELAY_REQ:
+		rx_mode = GEM_TSTAMP_ALL_PTP_FRAMES;
+		config.rx_filter = HWTSTAMP_FILTER_PTP_V2_EVENT;
+		break;
+	case HWTSTAMP_FILTER_ALL:
+		rx_mode = GEM_TSTAMP_ALL_FRAMES;
+		break;
+	default:
+		/* timestamp everything rather than nothing */
+		rx_mode = GEM_TSTAMP_ALL_FRAMES;
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+		break;
+	}
+
+	gem_ptp_set_ts_mode(bp, tx_mode, rx_mode);
+	bp->tstamp_config = config;
+
+	if (copy_to_user(rq->ifr_data, &config, sizeof(config)))
+		return -EFAULT;
+
+	return 0;
+}
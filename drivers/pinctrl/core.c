@@ -840,6 +840,7 @@ static struct pinctrl *create_pinctrl(struct device *dev)
 		if (ret == -EPROBE_DEFER) {
 			pinctrl_free(p, false);
 			mutex_unlock(&pinctrl_maps_mutex);
+			driver_deferred_probe_wait(dev, PROBE_DEFER_PINCTRL);
 			return ERR_PTR(ret);
 		}
 	}
@@ -1778,6 +1779,8 @@ struct pinctrl_dev *pinctrl_register(struct pinctrl_desc *pctldesc,
 
 	pinctrl_init_device_debugfs(pctldev);
 
+	driver_deferred_probe_supplier(PROBE_DEFER_PINCTRL);
+
 	return pctldev;
 
 out_err:
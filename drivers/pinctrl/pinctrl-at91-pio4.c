@@ -64,6 +64,16 @@
 #define ATMEL_PIO_ISR		0x002C
 #define ATMEL_PIO_IOFR		0x003C
 
+/* Offset in the secure registers */
+#define ATMEL_PIO_S_SCDR	0x0500
+#define		ATMEL_PIO_S_SCDR_DIV_MASK	GENMASK(13, 0)
+
+#define ATMEL_PIO_SLCK_RATE	32768
+/* Debounce period with the reset value of the slow clock divider */
+#define ATMEL_PIO_DEBOUNCE_MIN	DIV_ROUND_UP(USEC_PER_SEC, ATMEL_PIO_SLCK_RATE)
+
+#define ATMEL_PIN_CONFIG_GLITCH_FILTER	(PIN_CONFIG_END + 1)
+
 #define ATMEL_PIO_NPINS_PER_BANK	32
 #define ATMEL_PIO_BANK(pin_id)		(pin_id / ATMEL_PIO_NPINS_PER_BANK)
 #define ATMEL_PIO_LINE(pin_id)		(pin_id % ATMEL_PIO_NPINS_PER_BANK)
@@ -94,6 +104,9 @@ struct atmel_pin {
 /**
  * struct atmel_pioctrl - Atmel PIO controller (pinmux + gpio)
  * @reg_base: base address of the controller.
+ * @secure_base: base address of the secure registers, NULL if they are not
+ *     described.
+ * @debounce: debounce period shared by all the pins, in us.
  * @clk: clock of the controller.
  * @nbanks: number of PIO groups, it can vary depending on the SoC.
  * @pinctrl_dev: pinctrl device registered.
@@ -113,6 +126,8 @@ struct atmel_pin {
  */
 struct atmel_pioctrl {
 	void __iomem		*reg_base;
+	void __iomem		*secure_base;
+	unsigned		debounce;
 	struct clk		*clk;
 	unsigned		nbanks;
 	struct pinctrl_dev	*pinctrl_dev;
@@ -279,14 +294,75 @@ static void atmel_gpio_irq_handler(unsigned int irq, struct irq_desc *desc)
 		if (!isr)
 			break;
 
+		/*
+		 * Straight to the linear domain: gpio_to_irq() would walk
+		 * the gpiochip list under its lock for every pending pin.
+		 */
 		for_each_set_bit(n, &isr, BITS_PER_LONG)
-			generic_handle_irq(gpio_to_irq(bank *
-					ATMEL_PIO_NPINS_PER_BANK + n));
+			generic_handle_irq(irq_find_mapping(
+					atmel_pioctrl->irq_domain,
+					bank * ATMEL_PIO_NPINS_PER_BANK + n));
 	}
 
 	chained_irq_exit(chip, desc);
 }
 
+/*
+ * The debounce filter drops pulses shorter than (DIV + 1) slow clock
+ * periods, DIV being set in a secure register common to all the pins. It
+ * is only ever made longer, so that no pin gets less than it asked for.
+ */
+static void atmel_pio_set_debounce_period(struct atmel_pioctrl *atmel_pioctrl,
+					  unsigned debounce)
+{
+	u32 div;
+
+	if (debounce <= atmel_pioctrl->debounce)
+		return;
+
+	if (!atmel_pioctrl->secure_base) {
+		dev_warn(atmel_pioctrl->dev,
+			 "debounce period fixed to %u us\n",
+			 atmel_pioctrl->debounce);
+		return;
+	}
+
+	div = DIV_ROUND_UP_ULL((u64)debounce * ATMEL_PIO_SLCK_RATE,
+			       USEC_PER_SEC) - 1;
+	div = min_t(u32, div, ATMEL_PIO_S_SCDR_DIV_MASK);
+	writel_relaxed(div, atmel_pioctrl->secure_base + ATMEL_PIO_S_SCDR);
+
+	atmel_pioctrl->debounce = DIV_ROUND_UP((div + 1) * USEC_PER_SEC,
+					       ATMEL_PIO_SLCK_RATE);
+}
+
+static u32 atmel_pin_config_debounce(struct atmel_pioctrl *atmel_pioctrl,
+				     u32 conf, unsigned debounce)
+{
+	if (!debounce)
+		return conf & ~(ATMEL_PIO_IFEN_MASK | ATMEL_PIO_IFSCEN_MASK);
+
+	atmel_pio_set_debounce_period(atmel_pioctrl, debounce);
+
+	return conf | ATMEL_PIO_IFEN_MASK | ATMEL_PIO_IFSCEN_MASK;
+}
+
+static int atmel_gpio_set_debounce(struct gpio_chip *chip, unsigned offset,
+				   unsigned debounce)
+{
+	struct atmel_pioctrl *atmel_pioctrl = dev_get_drvdata(chip->dev);
+	struct atmel_pin *pin = atmel_pioctrl->pins[offset];
+	unsigned reg;
+
+	atmel_gpio_write(atmel_pioctrl, pin->bank, ATMEL_PIO_MSKR,
+			 BIT(pin->line));
+	reg = atmel_gpio_read(atmel_pioctrl, pin->bank, ATMEL_PIO_CFGR);
+	reg = atmel_pin_config_debounce(atmel_pioctrl, reg, debounce);
+	atmel_gpio_write(atmel_pioctrl, pin->bank, ATMEL_PIO_CFGR, reg);
+
+	return 0;
+}
+
 static int atmel_gpio_direction_input(struct gpio_chip *chip, unsigned offset)
 {
 	struct atmel_pioctrl *atmel_pioctrl = dev_get_drvdata(chip->dev);
@@ -343,6 +419,32 @@ static void atmel_gpio_set(struct gpio_chip *chip, unsigned offset, int val)
 			 BIT(pin->line));
 }
 
+/*
+ * GPIO offsets map to bank * 32 + line, so each bank is a 32-bit slice of
+ * @mask and @bits: set and cleared lines take one write each per bank.
+ */
+static void atmel_gpio_set_multiple(struct gpio_chip *chip,
+				    unsigned long *mask, unsigned long *bits)
+{
+	struct atmel_pioctrl *atmel_pioctrl = dev_get_drvdata(chip->dev);
+	unsigned int bank, first, shift;
+	u32 msk, val;
+
+	for (bank = 0; bank < atmel_pioctrl->nbanks; bank++) {
+		first = bank * ATMEL_PIO_NPINS_PER_BANK;
+		shift = first % BITS_PER_LONG;
+		msk = mask[BIT_WORD(first)] >> shift;
+		val = bits[BIT_WORD(first)] >> shift;
+
+		if (msk & val)
+			atmel_gpio_write(atmel_pioctrl, bank, ATMEL_PIO_SODR,
+					 msk & val);
+		if (msk & ~val)
+			atmel_gpio_write(atmel_pioctrl, bank, ATMEL_PIO_CODR,
+					 msk & ~val);
+	}
+}
+
 static int atmel_gpio_to_irq(struct gpio_chip *chip, unsigned offset)
 {
 	struct atmel_pioctrl *atmel_pioctrl = dev_get_drvdata(chip->dev);
@@ -355,6 +457,8 @@ static struct gpio_chip atmel_gpio_chip = {
 	.get                    = atmel_gpio_get,
 	.direction_output       = atmel_gpio_direction_output,
 	.set                    = atmel_gpio_set,
+	.set_multiple           = atmel_gpio_set_multiple,
+	.set_debounce           = atmel_gpio_set_debounce,
 	.to_irq                 = atmel_gpio_to_irq,
 	.base                   = 0,
 };
@@ -681,6 +785,18 @@ static int atmel_conf_pin_config_group_get(struct pinctrl_dev *pctldev,
 			return -EINVAL;
 		arg = 1;
 		break;
+	case PIN_CONFIG_INPUT_DEBOUNCE:
+		if (!(res & ATMEL_PIO_IFEN_MASK) ||
+		    !(res & ATMEL_PIO_IFSCEN_MASK))
+			return -EINVAL;
+		arg = atmel_pioctrl->debounce;
+		break;
+	case ATMEL_PIN_CONFIG_GLITCH_FILTER:
+		if (!(res & ATMEL_PIO_IFEN_MASK) ||
+		    (res & ATMEL_PIO_IFSCEN_MASK))
+			return -EINVAL;
+		arg = 1;
+		break;
 	default:
 		return -ENOTSUPP;
 	}
@@ -735,20 +851,16 @@ static int atmel_conf_pin_config_group_set(struct pinctrl_dev *pctldev,
 				conf &= (~ATMEL_PIO_SCHMITT_MASK);
 			break;
 		case PIN_CONFIG_INPUT_DEBOUNCE:
-			if (arg == 0) {
+			conf = atmel_pin_config_debounce(atmel_pioctrl, conf,
+							 arg);
+			break;
+		case ATMEL_PIN_CONFIG_GLITCH_FILTER:
+			/* Pulses shorter than half a master clock period */
+			conf &= (~ATMEL_PIO_IFSCEN_MASK);
+			if (arg == 0)
 				conf &= (~ATMEL_PIO_IFEN_MASK);
-				conf &= (~ATMEL_PIO_IFSCEN_MASK);
-			} else {
-				/*
-				 * We don't care about the debounce value for several reasons:
-				 * - can't have different debounce periods inside a same group,
-				 * - the register to configure this period is a secure register.
-				 * The debouncing filter can filter a pulse with a duration of less
-				 * than 1/2 slow clock period.
-				 */
+			else
 				conf |= ATMEL_PIO_IFEN_MASK;
-				conf |= ATMEL_PIO_IFSCEN_MASK;
-			}
 			break;
 		case PIN_CONFIG_OUTPUT:
 			conf |= ATMEL_PIO_DIR_MASK;
@@ -800,7 +912,8 @@ static void atmel_conf_pin_config_dbg_show(struct pinctrl_dev *pctldev,
 	if (conf & ATMEL_PIO_PDEN_MASK)
 		seq_printf(s, "%s ", "pull-down");
 	if (conf & ATMEL_PIO_IFEN_MASK)
-		seq_printf(s, "%s ", "debounce");
+		seq_printf(s, "%s ", conf & ATMEL_PIO_IFSCEN_MASK ?
+			   "debounce" : "glitch-filter");
 	if (conf & ATMEL_PIO_OPD_MASK)
 		seq_printf(s, "%s ", "open-drain");
 	if (conf & ATMEL_PIO_SCHMITT_MASK)
@@ -813,11 +926,26 @@ static const struct pinconf_ops atmel_confops = {
 	.pin_config_dbg_show	= atmel_conf_pin_config_dbg_show,
 };
 
+static const struct pinconf_generic_params atmel_custom_bindings[] = {
+	{ "atmel,glitch-filter", ATMEL_PIN_CONFIG_GLITCH_FILTER, 1 },
+};
+
+#ifdef CONFIG_DEBUG_FS
+static const struct pin_config_item atmel_conf_items[] = {
+	PCONFDUMP(ATMEL_PIN_CONFIG_GLITCH_FILTER, "glitch filter", NULL, false),
+};
+#endif
+
 static struct pinctrl_desc atmel_pinctrl_desc = {
 	.name		= "atmel_pinctrl",
 	.confops	= &atmel_confops,
 	.pctlops	= &atmel_pctlops,
 	.pmxops		= &atmel_pmxops,
+	.num_custom_params = ARRAY_SIZE(atmel_custom_bindings),
+	.custom_params	= atmel_custom_bindings,
+#ifdef CONFIG_DEBUG_FS
+	.custom_conf_items = atmel_conf_items,
+#endif
 };
 
 static int atmel_pctrl_suspend(struct device *dev)
@@ -911,6 +1039,15 @@ static int atmel_pinctrl_probe(struct platform_device *pdev)
 	if (IS_ERR(atmel_pioctrl->reg_base))
 		return -EINVAL;
 
+	/* Optional, needed to set the debounce period */
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 1);
+	if (res) {
+		atmel_pioctrl->secure_base = devm_ioremap_resource(dev, res);
+		if (IS_ERR(atmel_pioctrl->secure_base))
+			return PTR_ERR(atmel_pioctrl->secure_base);
+	}
+	atmel_pioctrl->debounce = ATMEL_PIO_DEBOUNCE_MIN;
+
 	atmel_pioctrl->clk = devm_clk_get(dev, NULL);
 	if (IS_ERR(atmel_pioctrl->clk)) {
 		dev_err(dev, "failed to get clock\n");
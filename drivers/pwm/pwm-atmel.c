@@ -7,7 +7,9 @@
  * Licensed under GPLv2.
  */
 
+#include <linux/atmel_pwm.h>
 #include <linux/clk.h>
+#include <linux/dmaengine.h>
 #include <linux/err.h>
 #include <linux/io.h>
 #include <linux/module.h>
@@ -24,6 +26,14 @@
 /* Bit field in SR */
 #define PWM_SR_ALL_CH_ON	0x0F
 
+/* The following registers are for synchronous channels, PWM v2 only */
+#define PWM_SCM			0x20
+/* Bit field in SCM */
+#define PWM_SCM_SYNC(ch)	(1 << (ch))
+#define PWM_SCM_UPDM_DMA	(2 << 16)
+#define PWM_DMAR		0x24
+#define PWM_SCUP		0x2C
+
 /* The following register is PWM channel related registers */
 #define PWM_CH_REG_OFFSET	0x200
 #define PWM_CH_REG_SIZE		0x20
@@ -59,6 +69,8 @@ struct atmel_pwm_chip {
 	struct pwm_chip chip;
 	struct clk *clk;
 	void __iomem *base;
+	phys_addr_t phys_base;
+	struct dma_chan *dma;
 
 	void (*config)(struct pwm_chip *chip, struct pwm_device *pwm,
 		       unsigned long dty, unsigned long prd);
@@ -248,6 +260,117 @@ static void atmel_pwm_disable(struct pwm_chip *chip, struct pwm_device *pwm)
 	clk_disable(atmel_pwm->clk);
 }
 
+/**
+ * atmel_pwm_duty_to_reg - duty cycle register value for streaming
+ * @pwm: PWM device, configured and enabled
+ * @duty_ns: duty cycle, in nanoseconds
+ */
+u32 atmel_pwm_duty_to_reg(struct pwm_device *pwm, unsigned int duty_ns)
+{
+	struct atmel_pwm_chip *atmel_pwm = to_atmel_pwm_chip(pwm->chip);
+	unsigned long long div;
+	u32 prd;
+
+	if (!pwm->period)
+		return 0;
+
+	prd = atmel_pwm_ch_readl(atmel_pwm, pwm->hwpwm, PWMV2_CPRD);
+	div = (unsigned long long)prd * min(duty_ns, pwm->period);
+	do_div(div, pwm->period);
+
+	/* as in atmel_pwm_config(), the counter runs against CPOL */
+	return prd - div;
+}
+EXPORT_SYMBOL_GPL(atmel_pwm_duty_to_reg);
+
+/**
+ * atmel_pwm_stream_start - stream duty cycles from memory
+ * @pwm: the first PWM of the controller, configured and enabled
+ * @buf: DMA address of @count u32 values from atmel_pwm_duty_to_reg()
+ * @count: number of periods in @buf
+ * @cyclic: loop over @buf until atmel_pwm_stream_stop()
+ * @callback: called once @buf has been loaded, at each loop when @cyclic
+ * @param: argument of @callback
+ *
+ * The PWM becomes a synchronous channel whose duty cycle is updated by
+ * the DMA controller at each period, so that the waveform no longer
+ * depends on the CPU's latency.
+ */
+int atmel_pwm_stream_start(struct pwm_device *pwm, dma_addr_t buf,
+			   unsigned int count, bool cyclic,
+			   dma_async_tx_callback callback, void *param)
+{
+	struct atmel_pwm_chip *atmel_pwm = to_atmel_pwm_chip(pwm->chip);
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config cfg = {
+		.direction = DMA_MEM_TO_DEV,
+		.dst_addr = atmel_pwm->phys_base + PWM_DMAR,
+		.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.dst_maxburst = 1,
+	};
+	size_t len = count * sizeof(u32);
+	int ret;
+
+	/* channel 0 is the reference of the synchronous channels */
+	if (!atmel_pwm->dma || pwm->hwpwm != 0)
+		return -ENODEV;
+
+	if (!count || !test_bit(PWMF_ENABLED, &pwm->flags))
+		return -EINVAL;
+
+	dmaengine_terminate_all(atmel_pwm->dma);
+
+	ret = dmaengine_slave_config(atmel_pwm->dma, &cfg);
+	if (ret)
+		return ret;
+
+	if (cyclic)
+		desc = dmaengine_prep_dma_cyclic(atmel_pwm->dma, buf, len, len,
+						 DMA_MEM_TO_DEV,
+						 DMA_PREP_INTERRUPT |
+						 DMA_CTRL_ACK);
+	else
+		desc = dmaengine_prep_slave_single(atmel_pwm->dma, buf, len,
+						   DMA_MEM_TO_DEV,
+						   DMA_PREP_INTERRUPT |
+						   DMA_CTRL_ACK);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = callback;
+	desc->callback_param = param;
+
+	/* the synchronous mode is only changed with the channel stopped */
+	atmel_pwm_writel(atmel_pwm, PWM_DIS, 1 << pwm->hwpwm);
+	atmel_pwm_writel(atmel_pwm, PWM_SCUP, 0);
+	atmel_pwm_writel(atmel_pwm, PWM_SCM,
+			 PWM_SCM_SYNC(pwm->hwpwm) | PWM_SCM_UPDM_DMA);
+
+	dmaengine_submit(desc);
+	dma_async_issue_pending(atmel_pwm->dma);
+
+	atmel_pwm_writel(atmel_pwm, PWM_ENA, 1 << pwm->hwpwm);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(atmel_pwm_stream_start);
+
+/**
+ * atmel_pwm_stream_stop - stop streaming, keeping the last duty cycle
+ * @pwm: the PWM given to atmel_pwm_stream_start()
+ */
+void atmel_pwm_stream_stop(struct pwm_device *pwm)
+{
+	struct atmel_pwm_chip *atmel_pwm = to_atmel_pwm_chip(pwm->chip);
+
+	if (!atmel_pwm->dma || pwm->hwpwm != 0)
+		return;
+
+	dmaengine_terminate_all(atmel_pwm->dma);
+	atmel_pwm_writel(atmel_pwm, PWM_SCM, 0);
+}
+EXPORT_SYMBOL_GPL(atmel_pwm_stream_stop);
+
 static const struct pwm_ops atmel_pwm_ops = {
 	.config = atmel_pwm_config,
 	.set_polarity = atmel_pwm_set_polarity,
@@ -259,6 +382,7 @@ static const struct pwm_ops atmel_pwm_ops = {
 struct atmel_pwm_data {
 	void (*config)(struct pwm_chip *chip, struct pwm_device *pwm,
 		       unsigned long dty, unsigned long prd);
+	bool has_sync_dma;
 };
 
 static const struct atmel_pwm_data atmel_pwm_data_v1 = {
@@ -267,6 +391,7 @@ static const struct atmel_pwm_data atmel_pwm_data_v1 = {
 
 static const struct atmel_pwm_data atmel_pwm_data_v2 = {
 	.config = atmel_pwm_config_v2,
+	.has_sync_dma = true,
 };
 
 static const struct platform_device_id atmel_pwm_devtypes[] = {
@@ -334,15 +459,27 @@ static int atmel_pwm_probe(struct platform_device *pdev)
 	atmel_pwm->base = devm_ioremap_resource(&pdev->dev, res);
 	if (IS_ERR(atmel_pwm->base))
 		return PTR_ERR(atmel_pwm->base);
+	atmel_pwm->phys_base = res->start;
 
 	atmel_pwm->clk = devm_clk_get(&pdev->dev, NULL);
 	if (IS_ERR(atmel_pwm->clk))
 		return PTR_ERR(atmel_pwm->clk);
 
+	/* optional, for duty cycle streaming */
+	if (data->has_sync_dma && pdev->dev.of_node) {
+		atmel_pwm->dma = dma_request_slave_channel_reason(&pdev->dev,
+								  "tx");
+		if (IS_ERR(atmel_pwm->dma)) {
+			if (PTR_ERR(atmel_pwm->dma) == -EPROBE_DEFER)
+				return -EPROBE_DEFER;
+			atmel_pwm->dma = NULL;
+		}
+	}
+
 	ret = clk_prepare(atmel_pwm->clk);
 	if (ret) {
 		dev_err(&pdev->dev, "failed to prepare PWM clock\n");
-		return ret;
+		goto release_dma;
 	}
 
 	atmel_pwm->chip.dev = &pdev->dev;
@@ -370,6 +507,9 @@ static int atmel_pwm_probe(struct platform_device *pdev)
 
 unprepare_clk:
 	clk_unprepare(atmel_pwm->clk);
+release_dma:
+	if (atmel_pwm->dma)
+		dma_release_channel(atmel_pwm->dma);
 	return ret;
 }
 
@@ -377,6 +517,11 @@ static int atmel_pwm_remove(struct platform_device *pdev)
 {
 	struct atmel_pwm_chip *atmel_pwm = platform_get_drvdata(pdev);
 
+	if (atmel_pwm->dma) {
+		dmaengine_terminate_all(atmel_pwm->dma);
+		dma_release_channel(atmel_pwm->dma);
+	}
+
 	clk_unprepare(atmel_pwm->clk);
 
 	return pwmchip_remove(&atmel_pwm->chip);
@@ -1429,6 +1429,9 @@ static struct regulator *_regulator_get(struct device *dev, const char *id,
 	}
 
 	mutex_unlock(&regulator_list_mutex);
+
+	if (regulator == ERR_PTR(-EPROBE_DEFER))
+		driver_deferred_probe_wait(dev, PROBE_DEFER_REGULATOR);
 	return regulator;
 
 found:
@@ -1472,6 +1475,8 @@ found:
 out:
 	mutex_unlock(&regulator_list_mutex);
 
+	if (regulator == ERR_PTR(-EPROBE_DEFER))
+		driver_deferred_probe_wait(dev, PROBE_DEFER_REGULATOR);
 	return regulator;
 }
 
@@ -3738,6 +3743,9 @@ regulator_register(const struct regulator_desc *regulator_desc,
 out:
 	mutex_unlock(&regulator_list_mutex);
 	kfree(config);
+
+	if (!IS_ERR(rdev))
+		driver_deferred_probe_supplier(PROBE_DEFER_REGULATOR);
 	return rdev;
 
 unset_supplies:
@@ -26,6 +26,7 @@
 #include <linux/gpio.h>
 #include <linux/pinctrl/consumer.h>
 #include <linux/pm_runtime.h>
+#include <linux/ktime.h>
 
 /* SPI register offsets */
 #define SPI_CR					0x0000
@@ -257,11 +258,15 @@
 #endif
 /* use PIO for small transfers, avoiding DMA setup/teardown overhead and
  * cache operations; better heuristics consider wordsize and bitrate.
+ * The crossover can be tuned through the dma_min_bytes sysfs attribute.
  */
 #define DMA_MIN_BYTES	16
 
 #define SPI_DMA_TIMEOUT		(msecs_to_jiffies(1000))
 
+/* most transfers of a message sent with a single pair of DMA descriptors */
+#define SPI_DMA_MAX_CHAIN	8
+
 #define AUTOSUSPEND_TIMEOUT	2000
 
 struct atmel_spi_dma {
@@ -269,12 +274,25 @@ struct atmel_spi_dma {
 	struct dma_chan			*chan_tx;
 	struct scatterlist		sgrx;
 	struct scatterlist		sgtx;
+	struct scatterlist		sgrx_chain[SPI_DMA_MAX_CHAIN];
+	struct scatterlist		sgtx_chain[SPI_DMA_MAX_CHAIN];
 	struct dma_async_tx_descriptor	*data_desc_rx;
 	struct dma_async_tx_descriptor	*data_desc_tx;
 
 	struct at_dma_slave	dma_slave;
 };
 
+/* Transfers completed without error, split by the PIO/DMA decision */
+struct atmel_spi_stats {
+	u64	pio_transfers;
+	u64	pio_bytes;
+	u64	pio_ns;
+	u64	dma_transfers;
+	u64	dma_bytes;
+	u64	dma_ns;
+	u64	dma_chained;	/* DMA transfers sent as part of a chain */
+};
+
 struct atmel_spi_caps {
 	bool	is_spi2;
 	bool	has_wdrbt;
@@ -297,6 +315,7 @@ struct atmel_spi {
 	struct platform_device	*pdev;
 
 	struct spi_transfer	*current_transfer;
+	struct spi_transfer	*premapped_transfer;
 	int			current_remaining_bytes;
 	int			done_status;
 
@@ -318,12 +337,22 @@ struct atmel_spi {
 	bool			cs_active;
 
 	u32			fifo_size;
+
+	/* register values last written, to skip redundant writes */
+	u32			mr;
+	u32			csr[4];
+	unsigned long		spi_clk;
+
+	unsigned int		dma_min_bytes;	/* 0: automatic */
+	unsigned int		msg_dma_min_bytes;
+	struct atmel_spi_stats	stats;
 };
 
 /* Controller-specific per-slave state */
 struct atmel_spi_device {
 	unsigned int		npcs_pin;
 	u32			csr;
+	u32			speed_hz;	/* rate SCBR in csr was set for */
 };
 
 #define BUFFER_SIZE		PAGE_SIZE
@@ -362,6 +391,29 @@ static bool atmel_spi_is_v2(struct atmel_spi *as)
  * and (c) will trigger that first erratum in some cases.
  */
 
+/*
+ * All CSR and MR writes go through these so that the cached values always
+ * match the hardware.
+ */
+static void atmel_spi_write_csr(struct atmel_spi *as, unsigned int cs,
+				u32 csr)
+{
+	if (cs >= ARRAY_SIZE(as->csr)) {
+		spi_writel(as, CSR0 + 4 * cs, csr);
+	} else if (as->csr[cs] != csr) {
+		spi_writel(as, CSR0 + 4 * cs, csr);
+		as->csr[cs] = csr;
+	}
+}
+
+static void atmel_spi_write_mr(struct atmel_spi *as, u32 mr)
+{
+	if (as->mr != mr) {
+		spi_writel(as, MR, mr);
+		as->mr = mr;
+	}
+}
+
 static void cs_activate(struct atmel_spi *as, struct spi_device *spi)
 {
 	struct atmel_spi_device *asd = spi->controller_state;
@@ -369,25 +421,18 @@ static void cs_activate(struct atmel_spi *as, struct spi_device *spi)
 	u32 mr;
 
 	if (atmel_spi_is_v2(as)) {
-		spi_writel(as, CSR0 + 4 * spi->chip_select, asd->csr);
+		atmel_spi_write_csr(as, spi->chip_select, asd->csr);
 		/* For the low SPI version, there is a issue that PDC transfer
 		 * on CS1,2,3 needs SPI_CSR0.BITS config as SPI_CSR1,2,3.BITS
 		 */
-		spi_writel(as, CSR0, asd->csr);
-		if (as->caps.has_wdrbt) {
-			spi_writel(as, MR,
-					SPI_BF(PCS, ~(0x01 << spi->chip_select))
-					| SPI_BIT(WDRBT)
-					| SPI_BIT(MODFDIS)
-					| SPI_BIT(MSTR));
-		} else {
-			spi_writel(as, MR,
-					SPI_BF(PCS, ~(0x01 << spi->chip_select))
-					| SPI_BIT(MODFDIS)
-					| SPI_BIT(MSTR));
-		}
+		atmel_spi_write_csr(as, 0, asd->csr);
+		mr = SPI_BF(PCS, ~(0x01 << spi->chip_select))
+			| SPI_BIT(MODFDIS)
+			| SPI_BIT(MSTR);
+		if (as->caps.has_wdrbt)
+			mr |= SPI_BIT(WDRBT);
+		atmel_spi_write_mr(as, mr);
 
-		mr = spi_readl(as, MR);
 		if (as->use_cs_gpios)
 			gpio_set_value(asd->npcs_pin, active);
 	} else {
@@ -396,18 +441,17 @@ static void cs_activate(struct atmel_spi *as, struct spi_device *spi)
 		u32 csr;
 
 		/* Make sure clock polarity is correct */
-		for (i = 0; i < spi->master->num_chipselect; i++) {
-			csr = spi_readl(as, CSR0 + 4 * i);
+		for (i = 0; i < ARRAY_SIZE(as->csr); i++) {
+			csr = as->csr[i];
 			if ((csr ^ cpol) & SPI_BIT(CPOL))
-				spi_writel(as, CSR0 + 4 * i,
-						csr ^ SPI_BIT(CPOL));
+				atmel_spi_write_csr(as, i,
+						    csr ^ SPI_BIT(CPOL));
 		}
 
-		mr = spi_readl(as, MR);
-		mr = SPI_BFINS(PCS, ~(1 << spi->chip_select), mr);
+		mr = SPI_BFINS(PCS, ~(1 << spi->chip_select), as->mr);
 		if (as->use_cs_gpios && spi->chip_select != 0)
 			gpio_set_value(asd->npcs_pin, active);
-		spi_writel(as, MR, mr);
+		atmel_spi_write_mr(as, mr);
 	}
 
 	dev_dbg(&spi->dev, "activate %u%s, mr %08x\n",
@@ -424,10 +468,10 @@ static void cs_deactivate(struct atmel_spi *as, struct spi_device *spi)
 	/* only deactivate *this* device; sometimes transfers to
 	 * another device may be active when this routine is called.
 	 */
-	mr = spi_readl(as, MR);
+	mr = as->mr;
 	if (~SPI_BFEXT(PCS, mr) & (1 << spi->chip_select)) {
 		mr = SPI_BFINS(PCS, 0xf, mr);
-		spi_writel(as, MR, mr);
+		atmel_spi_write_mr(as, mr);
 	}
 
 	dev_dbg(&spi->dev, "DEactivate %u%s, mr %08x\n",
@@ -450,10 +494,48 @@ static void atmel_spi_unlock(struct atmel_spi *as) __releases(&as->lock)
 	spin_unlock_irqrestore(&as->lock, as->flags);
 }
 
+/*
+ * The threshold is sampled once per message so that a transfer is unmapped
+ * the way it was mapped. When it is automatic, transfers that fit in the
+ * FIFO stay in PIO: they complete with a single interrupt, which is cheaper
+ * than setting up both DMA channels.
+ */
 static inline bool atmel_spi_use_dma(struct atmel_spi *as,
 				struct spi_transfer *xfer)
 {
-	return as->use_dma && xfer->len >= DMA_MIN_BYTES;
+	unsigned int min_bytes = as->msg_dma_min_bytes;
+
+	if (!as->use_dma)
+		return false;
+
+	if (!min_bytes) {
+		min_bytes = DMA_MIN_BYTES;
+		if (as->fifo_size)
+			min_bytes = max(min_bytes, as->fifo_size *
+					(xfer->bits_per_word > 8 ? 2 : 1) + 1);
+	}
+
+	return xfer->len >= min_bytes;
+}
+
+static void atmel_spi_stats_add(struct atmel_spi *as, bool dma,
+				unsigned int n, unsigned int bytes,
+				ktime_t start)
+{
+	struct atmel_spi_stats *stats = &as->stats;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (dma) {
+		stats->dma_transfers += n;
+		stats->dma_bytes += bytes;
+		stats->dma_ns += ns;
+		if (n > 1)
+			stats->dma_chained += n;
+	} else {
+		stats->pio_transfers += n;
+		stats->pio_bytes += bytes;
+		stats->pio_ns += ns;
+	}
 }
 
 static int atmel_spi_dma_slave_config(struct atmel_spi *as,
@@ -824,6 +906,106 @@ err_exit:
 	return -ENOMEM;
 }
 
+/*
+ * Submit several transfers of a message as a single pair of DMA
+ * descriptors, one scatterlist entry per transfer, so that the bus does
+ * not go idle between them (see atmel_spi_dma_chain_len()).
+ */
+static int atmel_spi_chain_dma_submit(struct spi_master *master,
+				      struct spi_transfer *first,
+				      unsigned int n)
+{
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+	struct dma_chan		*rxchan = as->dma.chan_rx;
+	struct dma_chan		*txchan = as->dma.chan_tx;
+	struct dma_async_tx_descriptor *rxdesc;
+	struct dma_async_tx_descriptor *txdesc;
+	struct dma_slave_config	slave_config;
+	struct spi_transfer	*xfer = first;
+	dma_cookie_t		cookie;
+	unsigned int		i;
+
+	dev_vdbg(master->dev.parent, "atmel_spi_chain_dma_submit\n");
+
+	/* Check that the channels are available */
+	if (!rxchan || !txchan)
+		return -ENODEV;
+
+	/* release lock for DMA operations */
+	atmel_spi_unlock(as);
+
+	sg_init_table(as->dma.sgrx_chain, n);
+	sg_init_table(as->dma.sgtx_chain, n);
+	for (i = 0; i < n; i++) {
+		if (xfer->rx_buf)
+			sg_dma_address(&as->dma.sgrx_chain[i]) = xfer->rx_dma;
+		else
+			sg_dma_address(&as->dma.sgrx_chain[i]) = as->buffer_dma;
+
+		if (xfer->tx_buf) {
+			sg_dma_address(&as->dma.sgtx_chain[i]) = xfer->tx_dma;
+		} else {
+			sg_dma_address(&as->dma.sgtx_chain[i]) = as->buffer_dma;
+			memset(as->buffer, 0, xfer->len);
+		}
+
+		sg_dma_len(&as->dma.sgrx_chain[i]) = xfer->len;
+		sg_dma_len(&as->dma.sgtx_chain[i]) = xfer->len;
+
+		dev_dbg(master->dev.parent,
+			"  chain dma xfer %p: len %u tx %p/%08llx rx %p/%08llx\n",
+			xfer, xfer->len, xfer->tx_buf,
+			(unsigned long long)xfer->tx_dma,
+			xfer->rx_buf, (unsigned long long)xfer->rx_dma);
+
+		xfer = list_next_entry(xfer, transfer_list);
+	}
+
+	if (atmel_spi_dma_slave_config(as, &slave_config,
+				       first->bits_per_word))
+		goto err_exit;
+
+	rxdesc = dmaengine_prep_slave_sg(rxchan, as->dma.sgrx_chain, n,
+					 DMA_DEV_TO_MEM,
+					 DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!rxdesc)
+		goto err_dma;
+
+	txdesc = dmaengine_prep_slave_sg(txchan, as->dma.sgtx_chain, n,
+					 DMA_MEM_TO_DEV,
+					 DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!txdesc)
+		goto err_dma;
+
+	/* Enable relevant interrupts */
+	spi_writel(as, IER, SPI_BIT(OVRES));
+
+	/* Put the callback on the RX transfer only, that should finish last */
+	rxdesc->callback = dma_callback;
+	rxdesc->callback_param = master;
+
+	/* Submit and fire RX and TX with TX last so we're ready to read! */
+	cookie = rxdesc->tx_submit(rxdesc);
+	if (dma_submit_error(cookie))
+		goto err_dma;
+	cookie = txdesc->tx_submit(txdesc);
+	if (dma_submit_error(cookie))
+		goto err_dma;
+	rxchan->device->device_issue_pending(rxchan);
+	txchan->device->device_issue_pending(txchan);
+
+	/* take back lock */
+	atmel_spi_lock(as);
+	return 0;
+
+err_dma:
+	spi_writel(as, IDR, SPI_BIT(OVRES));
+	atmel_spi_stop_dma(as);
+err_exit:
+	atmel_spi_lock(as);
+	return -ENOMEM;
+}
+
 static void atmel_spi_next_xfer_data(struct spi_master *master,
 				struct spi_transfer *xfer,
 				dma_addr_t *tx_dma,
@@ -860,11 +1042,18 @@ static int atmel_spi_set_xfer_speed(struct atmel_spi *as,
 				    struct spi_device *spi,
 				    struct spi_transfer *xfer)
 {
-	u32			scbr, csr;
+	struct atmel_spi_device	*asd = spi->controller_state;
+	u32			scbr;
 	unsigned long		bus_hz;
 
+	/* Same rate as the last transfer to this device: nothing to compute */
+	if (asd->speed_hz && asd->speed_hz == xfer->speed_hz) {
+		atmel_spi_write_csr(as, spi->chip_select, asd->csr);
+		return 0;
+	}
+
 	/* v1 chips start out at half the peripheral bus speed. */
-	bus_hz = clk_get_rate(as->clk);
+	bus_hz = as->spi_clk;
 	if (!atmel_spi_is_v2(as))
 		bus_hz /= 2;
 
@@ -897,9 +1086,9 @@ static int atmel_spi_set_xfer_speed(struct atmel_spi *as,
 			xfer->speed_hz, scbr, bus_hz);
 		return -EINVAL;
 	}
-	csr = spi_readl(as, CSR0 + 4 * spi->chip_select);
-	csr = SPI_BFINS(SCBR, scbr, csr);
-	spi_writel(as, CSR0 + 4 * spi->chip_select, csr);
+	asd->csr = SPI_BFINS(SCBR, scbr, asd->csr);
+	asd->speed_hz = xfer->speed_hz;
+	atmel_spi_write_csr(as, spi->chip_select, asd->csr);
 
 	return 0;
 }
@@ -1270,31 +1459,23 @@ static int atmel_spi_setup(struct spi_device *spi)
 	}
 
 	asd->csr = csr;
+	asd->speed_hz = 0;
 
 	dev_dbg(&spi->dev,
 		"setup: bpw %u mode 0x%x -> csr%d %08x\n",
 		bits, spi->mode, spi->chip_select, csr);
 
 	if (!atmel_spi_is_v2(as))
-		spi_writel(as, CSR0 + 4 * spi->chip_select, csr);
+		atmel_spi_write_csr(as, spi->chip_select, csr);
 
 	return 0;
 }
 
-static int atmel_spi_one_transfer(struct spi_master *master,
-					struct spi_message *msg,
-					struct spi_transfer *xfer)
+static int atmel_spi_check_xfer(struct spi_device *spi,
+				struct spi_transfer *xfer)
 {
-	struct atmel_spi	*as;
-	struct spi_device	*spi = msg->spi;
-	u8			bits;
-	u32			len;
 	struct atmel_spi_device	*asd;
-	int			timeout;
-	int			ret;
-	unsigned long		dma_timeout;
-
-	as = spi_master_get_devdata(master);
+	u8			bits;
 
 	if (!(xfer->tx_buf || xfer->rx_buf) && xfer->len) {
 		dev_dbg(&spi->dev, "missing rx or tx buf\n");
@@ -1311,16 +1492,243 @@ static int atmel_spi_one_transfer(struct spi_master *master,
 		}
 	}
 
-	/*
-	 * DMA map early, for performance (empties dcache ASAP) and
-	 * better fault reporting.
-	 */
-	if ((!msg->is_dma_mapped)
-		&& (atmel_spi_use_dma(as, xfer)	|| as->use_pdc)) {
-		if (atmel_spi_dma_map_xfer(as, xfer) < 0)
-			return -ENOMEM;
+	return 0;
+}
+
+static bool atmel_spi_needs_mapping(struct atmel_spi *as,
+				    struct spi_message *msg,
+				    struct spi_transfer *xfer)
+{
+	return !msg->is_dma_mapped &&
+	       (atmel_spi_use_dma(as, xfer) || as->use_pdc);
+}
+
+/*
+ * DMA map early, for performance (empties dcache ASAP) and better fault
+ * reporting. The transfer may already have been mapped while the previous
+ * one was running.
+ */
+static int atmel_spi_map_xfer(struct atmel_spi *as, struct spi_message *msg,
+			      struct spi_transfer *xfer)
+{
+	if (!atmel_spi_needs_mapping(as, msg, xfer))
+		return 0;
+
+	if (as->premapped_transfer == xfer) {
+		as->premapped_transfer = NULL;
+		return 0;
+	}
+
+	return atmel_spi_dma_map_xfer(as, xfer);
+}
+
+/*
+ * Map the transfer following xfer while xfer is on the wire, so that its
+ * cache maintenance does not add to the gap between the two.
+ */
+static void atmel_spi_premap_next(struct atmel_spi *as,
+				  struct spi_message *msg,
+				  struct spi_transfer *xfer)
+{
+	struct spi_transfer	*next;
+
+	if (as->premapped_transfer ||
+	    list_is_last(&xfer->transfer_list, &msg->transfers))
+		return;
+
+	next = list_next_entry(xfer, transfer_list);
+	if (!atmel_spi_needs_mapping(as, msg, next) ||
+	    atmel_spi_check_xfer(msg->spi, next))
+		return;
+
+	if (!atmel_spi_dma_map_xfer(as, next))
+		as->premapped_transfer = next;
+}
+
+static void atmel_spi_unmap_premapped(struct spi_master *master)
+{
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+
+	if (as->premapped_transfer) {
+		atmel_spi_dma_unmap_xfer(master, as->premapped_transfer);
+		as->premapped_transfer = NULL;
+	}
+}
+
+/* Apply the delay and chip select change requested after a transfer */
+static void atmel_spi_xfer_done(struct atmel_spi *as,
+				struct spi_message *msg,
+				struct spi_transfer *xfer)
+{
+	if (xfer->delay_usecs)
+		udelay(xfer->delay_usecs);
+
+	if (xfer->cs_change) {
+		if (list_is_last(&xfer->transfer_list,
+				 &msg->transfers)) {
+			as->keep_cs = true;
+		} else {
+			as->cs_active = !as->cs_active;
+			if (as->cs_active)
+				cs_activate(as, msg->spi);
+			else
+				cs_deactivate(as, msg->spi);
+		}
+	}
+}
+
+/*
+ * Number of transfers, starting at xfer, that can go out back to back in
+ * a single DMA submission: same speed and word size, no chip select change
+ * or delay in between, and at most one direction using the scratch buffer,
+ * which must then hold the whole transfer.
+ */
+static unsigned int atmel_spi_dma_chain_len(struct atmel_spi *as,
+					    struct spi_message *msg,
+					    struct spi_transfer *xfer)
+{
+	struct spi_transfer	*next = xfer;
+	bool			rx_scratch = false, tx_scratch = false;
+	unsigned int		n = 0;
+
+	while (n < SPI_DMA_MAX_CHAIN) {
+		if (!atmel_spi_use_dma(as, next) ||
+		    atmel_spi_check_xfer(msg->spi, next) ||
+		    next->speed_hz != xfer->speed_hz ||
+		    next->bits_per_word != xfer->bits_per_word)
+			break;
+
+		if (!next->rx_buf)
+			rx_scratch = true;
+		if (!next->tx_buf)
+			tx_scratch = true;
+		if ((rx_scratch && tx_scratch) ||
+		    (!(next->rx_buf && next->tx_buf) &&
+		     next->len > BUFFER_SIZE))
+			break;
+
+		n++;
+		if (next->cs_change || next->delay_usecs ||
+		    list_is_last(&next->transfer_list, &msg->transfers))
+			break;
+		next = list_next_entry(next, transfer_list);
+	}
+
+	return n;
+}
+
+static int atmel_spi_one_transfer(struct spi_master *master,
+					struct spi_message *msg,
+					struct spi_transfer *xfer);
+
+/*
+ * Send the n transfers found by atmel_spi_dma_chain_len() with a single
+ * DMA submission.
+ */
+static int atmel_spi_chain_transfers(struct spi_master *master,
+				     struct spi_message *msg,
+				     struct spi_transfer *first,
+				     unsigned int n)
+{
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+	struct spi_transfer	*xfer, *last = NULL;
+	unsigned long		dma_timeout;
+	unsigned int		i, bytes = 0;
+	ktime_t			start = ktime_get();
+	int			ret;
+
+	for (i = 0, xfer = first; i < n;
+	     i++, xfer = list_next_entry(xfer, transfer_list)) {
+		ret = atmel_spi_map_xfer(as, msg, xfer);
+		if (ret) {
+			while (i--) {
+				xfer = list_prev_entry(xfer, transfer_list);
+				if (atmel_spi_needs_mapping(as, msg, xfer))
+					atmel_spi_dma_unmap_xfer(master, xfer);
+			}
+			return ret;
+		}
+		last = xfer;
+	}
+
+	atmel_spi_set_xfer_speed(as, msg->spi, first);
+
+	as->done_status = 0;
+	as->current_transfer = first;
+	as->current_remaining_bytes = 0;
+	reinit_completion(&as->xfer_completion);
+
+	ret = atmel_spi_chain_dma_submit(master, first, n);
+	if (ret) {
+		dev_err(&msg->spi->dev,
+			"unable to chain DMA transfers, sending them one by one\n");
+		for (i = 0, xfer = first; i < n;
+		     i++, xfer = list_next_entry(xfer, transfer_list))
+			if (atmel_spi_needs_mapping(as, msg, xfer))
+				atmel_spi_dma_unmap_xfer(master, xfer);
+
+		for (i = 0, xfer = first; i < n;
+		     i++, xfer = list_next_entry(xfer, transfer_list)) {
+			ret = atmel_spi_one_transfer(master, msg, xfer);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	/* interrupts are disabled, so free the lock for schedule */
+	atmel_spi_unlock(as);
+	atmel_spi_premap_next(as, msg, last);
+	dma_timeout = wait_for_completion_timeout(&as->xfer_completion,
+						  SPI_DMA_TIMEOUT);
+	atmel_spi_lock(as);
+	if (WARN_ON(dma_timeout == 0)) {
+		dev_err(&msg->spi->dev, "spi transfer timeout\n");
+		as->done_status = -EIO;
+	}
+
+	if (as->done_status)
+		atmel_spi_stop_dma(as);
+
+	for (i = 0, xfer = first; i < n;
+	     i++, xfer = list_next_entry(xfer, transfer_list)) {
+		/* only update length if no error */
+		if (!as->done_status)
+			msg->actual_length += xfer->len;
+		bytes += xfer->len;
+		if (atmel_spi_needs_mapping(as, msg, xfer))
+			atmel_spi_dma_unmap_xfer(master, xfer);
+	}
+
+	if (!as->done_status) {
+		atmel_spi_stats_add(as, true, n, bytes, start);
+		atmel_spi_xfer_done(as, msg, last);
 	}
 
+	return 0;
+}
+
+static int atmel_spi_one_transfer(struct spi_master *master,
+					struct spi_message *msg,
+					struct spi_transfer *xfer)
+{
+	struct atmel_spi	*as;
+	struct spi_device	*spi = msg->spi;
+	u32			len;
+	int			timeout;
+	int			ret;
+	unsigned long		dma_timeout;
+	ktime_t			start = ktime_get();
+
+	as = spi_master_get_devdata(master);
+
+	ret = atmel_spi_check_xfer(spi, xfer);
+	if (ret)
+		return ret;
+
+	if (atmel_spi_map_xfer(as, msg, xfer) < 0)
+		return -ENOMEM;
+
 	atmel_spi_set_xfer_speed(as, msg->spi, xfer);
 
 	as->done_status = 0;
@@ -1350,6 +1758,7 @@ static int atmel_spi_one_transfer(struct spi_master *master,
 
 		/* interrupts are disabled, so free the lock for schedule */
 		atmel_spi_unlock(as);
+		atmel_spi_premap_next(as, msg, xfer);
 		dma_timeout = wait_for_completion_timeout(&as->xfer_completion,
 							  SPI_DMA_TIMEOUT);
 		atmel_spi_lock(as);
@@ -1392,8 +1801,7 @@ static int atmel_spi_one_transfer(struct spi_master *master,
 			atmel_spi_stop_dma(as);
 		}
 
-		if (!msg->is_dma_mapped
-			&& (atmel_spi_use_dma(as, xfer) || as->use_pdc))
+		if (atmel_spi_needs_mapping(as, msg, xfer))
 			atmel_spi_dma_unmap_xfer(master, xfer);
 
 		return 0;
@@ -1401,27 +1809,14 @@ static int atmel_spi_one_transfer(struct spi_master *master,
 	} else {
 		/* only update length if no error */
 		msg->actual_length += xfer->len;
+		atmel_spi_stats_add(as, atmel_spi_use_dma(as, xfer) ||
+				    as->use_pdc, 1, xfer->len, start);
 	}
 
-	if (!msg->is_dma_mapped
-		&& (atmel_spi_use_dma(as, xfer) || as->use_pdc))
+	if (atmel_spi_needs_mapping(as, msg, xfer))
 		atmel_spi_dma_unmap_xfer(master, xfer);
 
-	if (xfer->delay_usecs)
-		udelay(xfer->delay_usecs);
-
-	if (xfer->cs_change) {
-		if (list_is_last(&xfer->transfer_list,
-				 &msg->transfers)) {
-			as->keep_cs = true;
-		} else {
-			as->cs_active = !as->cs_active;
-			if (as->cs_active)
-				cs_activate(as, msg->spi);
-			else
-				cs_deactivate(as, msg->spi);
-		}
-	}
+	atmel_spi_xfer_done(as, msg, xfer);
 
 	return 0;
 }
@@ -1432,6 +1827,7 @@ static int atmel_spi_transfer_one_message(struct spi_master *master,
 	struct atmel_spi *as;
 	struct spi_transfer *xfer;
 	struct spi_device *spi = msg->spi;
+	unsigned int n;
 	int ret = 0;
 
 	as = spi_master_get_devdata(master);
@@ -1448,8 +1844,17 @@ static int atmel_spi_transfer_one_message(struct spi_master *master,
 	msg->status = 0;
 	msg->actual_length = 0;
 
+	as->msg_dma_min_bytes = ACCESS_ONCE(as->dma_min_bytes);
+
 	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
-		ret = atmel_spi_one_transfer(master, msg, xfer);
+		n = atmel_spi_dma_chain_len(as, msg, xfer);
+		if (n > 1) {
+			ret = atmel_spi_chain_transfers(master, msg, xfer, n);
+			while (--n)
+				xfer = list_next_entry(xfer, transfer_list);
+		} else {
+			ret = atmel_spi_one_transfer(master, msg, xfer);
+		}
 		if (ret)
 			goto msg_done;
 	}
@@ -1466,6 +1871,8 @@ static int atmel_spi_transfer_one_message(struct spi_master *master,
 	}
 
 msg_done:
+	atmel_spi_unmap_premapped(master);
+
 	if (!as->keep_cs)
 		cs_deactivate(as, msg->spi);
 
@@ -1507,6 +1914,89 @@ static void atmel_get_caps(struct atmel_spi *as)
 	as->caps.has_dma_support = version >= 0x212;
 }
 
+static ssize_t dma_min_bytes_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct atmel_spi *as = spi_master_get_devdata(dev_get_drvdata(dev));
+
+	return sprintf(buf, "%u\n", as->dma_min_bytes);
+}
+
+/* 0 restores the automatic choice, see atmel_spi_use_dma() */
+static ssize_t dma_min_bytes_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct atmel_spi *as = spi_master_get_devdata(dev_get_drvdata(dev));
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	as->dma_min_bytes = val;
+
+	return count;
+}
+static DEVICE_ATTR_RW(dma_min_bytes);
+
+static struct attribute *atmel_spi_attrs[] = {
+	&dev_attr_dma_min_bytes.attr,
+	NULL,
+};
+
+static const struct attribute_group atmel_spi_attr_group = {
+	.attrs	= atmel_spi_attrs,
+};
+
+#define ATMEL_SPI_STATS_ATTR(field)					\
+static ssize_t field##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct spi_master *master = dev_get_drvdata(dev);		\
+	struct atmel_spi *as = spi_master_get_devdata(master);		\
+	unsigned long flags;						\
+	u64 val;							\
+									\
+	spin_lock_irqsave(&as->lock, flags);				\
+	val = as->stats.field;						\
+	spin_unlock_irqrestore(&as->lock, flags);			\
+									\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);		\
+}									\
+static DEVICE_ATTR_RO(field)
+
+ATMEL_SPI_STATS_ATTR(pio_transfers);
+ATMEL_SPI_STATS_ATTR(pio_bytes);
+ATMEL_SPI_STATS_ATTR(pio_ns);
+ATMEL_SPI_STATS_ATTR(dma_transfers);
+ATMEL_SPI_STATS_ATTR(dma_bytes);
+ATMEL_SPI_STATS_ATTR(dma_ns);
+ATMEL_SPI_STATS_ATTR(dma_chained);
+
+static struct attribute *atmel_spi_stats_attrs[] = {
+	&dev_attr_pio_transfers.attr,
+	&dev_attr_pio_bytes.attr,
+	&dev_attr_pio_ns.attr,
+	&dev_attr_dma_transfers.attr,
+	&dev_attr_dma_bytes.attr,
+	&dev_attr_dma_ns.attr,
+	&dev_attr_dma_chained.attr,
+	NULL,
+};
+
+static const struct attribute_group atmel_spi_stats_attr_group = {
+	.name	= "statistics",
+	.attrs	= atmel_spi_stats_attrs,
+};
+
+static const struct attribute_group *atmel_spi_attr_groups[] = {
+	&atmel_spi_attr_group,
+	&atmel_spi_stats_attr_group,
+	NULL,
+};
+
 /*-------------------------------------------------------------------------*/
 
 static int atmel_spi_probe(struct platform_device *pdev)
@@ -1616,12 +2106,15 @@ static int atmel_spi_probe(struct platform_device *pdev)
 		goto out_free_irq;
 	spi_writel(as, CR, SPI_BIT(SWRST));
 	spi_writel(as, CR, SPI_BIT(SWRST)); /* AT91SAM9263 Rev B workaround */
+	/* the reset cleared the chip select registers */
+	memset(as->csr, 0, sizeof(as->csr));
 	if (as->caps.has_wdrbt) {
-		spi_writel(as, MR, SPI_BIT(WDRBT) | SPI_BIT(MODFDIS)
-				| SPI_BIT(MSTR));
+		as->mr = SPI_BIT(WDRBT) | SPI_BIT(MODFDIS) | SPI_BIT(MSTR);
 	} else {
-		spi_writel(as, MR, SPI_BIT(MSTR) | SPI_BIT(MODFDIS));
+		as->mr = SPI_BIT(MSTR) | SPI_BIT(MODFDIS);
 	}
+	spi_writel(as, MR, as->mr);
+	as->spi_clk = clk_get_rate(clk);
 
 	if (as->use_pdc)
 		spi_writel(as, PTCR, SPI_BIT(RXTDIS) | SPI_BIT(TXTDIS));
@@ -1643,12 +2136,18 @@ static int atmel_spi_probe(struct platform_device *pdev)
 	pm_runtime_set_active(&pdev->dev);
 	pm_runtime_enable(&pdev->dev);
 
-	ret = devm_spi_register_master(&pdev->dev, master);
+	ret = sysfs_create_groups(&pdev->dev.kobj, atmel_spi_attr_groups);
 	if (ret)
 		goto out_free_dma;
 
+	ret = devm_spi_register_master(&pdev->dev, master);
+	if (ret)
+		goto out_remove_groups;
+
 	return 0;
 
+out_remove_groups:
+	sysfs_remove_groups(&pdev->dev.kobj, atmel_spi_attr_groups);
 out_free_dma:
 	pm_runtime_disable(&pdev->dev);
 	pm_runtime_set_suspended(&pdev->dev);
@@ -1676,6 +2175,8 @@ static int atmel_spi_remove(struct platform_device *pdev)
 
 	pm_runtime_get_sync(&pdev->dev);
 
+	sysfs_remove_groups(&pdev->dev.kobj, atmel_spi_attr_groups);
+
 	/* reset the hardware and block queue progress */
 	spin_lock_irq(&as->lock);
 	if (as->use_dma) {
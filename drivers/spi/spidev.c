@@ -24,6 +24,8 @@
 #include <linux/err.h>
 #include <linux/list.h>
 #include <linux/errno.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/compat.h>
@@ -93,6 +95,11 @@ static unsigned bufsiz = 4096;
 module_param(bufsiz, uint, S_IRUGO);
 MODULE_PARM_DESC(bufsiz, "data bytes in biggest supported SPI message");
 
+static unsigned zerocopy_min = 1024;
+module_param(zerocopy_min, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(zerocopy_min,
+		 "smallest transfer done straight from user pages, 0 disables");
+
 /*-------------------------------------------------------------------------*/
 
 /*
@@ -216,6 +223,130 @@ spidev_write(struct file *filp, const char __user *buf,
 	return status;
 }
 
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Large transfers skip the bounce buffers: the user pages are pinned and
+ * each physically contiguous run becomes its own spi_transfer, addressed
+ * through the kernel linear mapping so that the controller driver can
+ * map it for DMA like any other buffer.  Chipselect stays active between
+ * the pieces; only the last one carries the delay and cs_change.
+ */
+struct spidev_cursor {
+	struct page		**pages;
+	unsigned		offset;
+};
+
+static unsigned spidev_npages(u64 ubuf, unsigned len)
+{
+	return ((ubuf & ~PAGE_MASK) + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+}
+
+static bool spidev_can_pin(struct spidev_data *spidev,
+		struct spi_ioc_transfer *u_tmp)
+{
+	unsigned bpw = u_tmp->bits_per_word ? : spidev->spi->bits_per_word;
+	unsigned align = roundup_pow_of_two(DIV_ROUND_UP(bpw ? : 8, 8)) - 1;
+
+	/* pieces split at page boundaries must hold whole words */
+	return zerocopy_min && u_tmp->len >= zerocopy_min &&
+	       !((u_tmp->tx_buf | u_tmp->rx_buf | u_tmp->len) & align);
+}
+
+static int spidev_pin(u64 ubuf, unsigned len, int write, struct page **pages)
+{
+	unsigned nr = spidev_npages(ubuf, len);
+	long got;
+	int i, ret;
+
+	got = get_user_pages_unlocked(current, current->mm,
+				      (uintptr_t)ubuf & PAGE_MASK, nr,
+				      write, 0, pages);
+	if (got < 0)
+		return got;
+
+	for (i = 0; i < got; i++)
+		if (PageHighMem(pages[i]))
+			break;
+
+	if (got == nr && i == got)
+		return nr;
+
+	ret = i < got ? -EINVAL : -EFAULT;
+	while (got--)
+		put_page(pages[got]);
+	return ret;
+}
+
+static void spidev_unpin(struct page **pages, unsigned n, bool dirty)
+{
+	while (n--) {
+		if (dirty)
+			set_page_dirty_lock(pages[n]);
+		put_page(pages[n]);
+	}
+}
+
+/* bytes at the cursor in one physically contiguous run */
+static unsigned spidev_run(struct spidev_cursor *c, unsigned len)
+{
+	unsigned run = PAGE_SIZE - c->offset;
+	unsigned i = 0;
+
+	while (run < len &&
+	       page_to_pfn(c->pages[i + 1]) == page_to_pfn(c->pages[i]) + 1) {
+		run += PAGE_SIZE;
+		i++;
+	}
+	return min(run, len);
+}
+
+static void *spidev_advance(struct spidev_cursor *c, unsigned len)
+{
+	void *buf = page_address(c->pages[0]) + c->offset;
+
+	c->pages += (c->offset + len) >> PAGE_SHIFT;
+	c->offset = (c->offset + len) & ~PAGE_MASK;
+	return buf;
+}
+
+static struct spi_transfer *spidev_split(struct spi_transfer *k_tmp,
+		struct spi_message *msg, struct spi_ioc_transfer *u_tmp,
+		struct page **tx_pages, struct page **rx_pages)
+{
+	struct spidev_cursor	tx = { tx_pages, u_tmp->tx_buf & ~PAGE_MASK };
+	struct spidev_cursor	rx = { rx_pages, u_tmp->rx_buf & ~PAGE_MASK };
+	struct spi_transfer	*last = k_tmp;
+	unsigned		left = u_tmp->len;
+
+	while (left) {
+		unsigned len = left;
+
+		*k_tmp = *last;
+		k_tmp->cs_change = 0;
+		k_tmp->delay_usecs = 0;
+
+		if (tx_pages)
+			len = spidev_run(&tx, len);
+		if (rx_pages)
+			len = spidev_run(&rx, len);
+		k_tmp->len = len;
+		if (tx_pages)
+			k_tmp->tx_buf = spidev_advance(&tx, len);
+		if (rx_pages)
+			k_tmp->rx_buf = spidev_advance(&rx, len);
+
+		spi_message_add_tail(k_tmp, msg);
+		last = k_tmp++;
+		left -= len;
+	}
+
+	last->cs_change = !!u_tmp->cs_change;
+	last->delay_usecs = u_tmp->delay_usecs;
+
+	return k_tmp;
+}
+
 static int spidev_message(struct spidev_data *spidev,
 		struct spi_ioc_transfer *u_xfers, unsigned n_xfers)
 {
@@ -224,14 +355,46 @@ static int spidev_message(struct spidev_data *spidev,
 	struct spi_transfer	*k_tmp;
 	struct spi_ioc_transfer *u_tmp;
 	unsigned		n, total, tx_total, rx_total;
+	unsigned		n_k, n_tx_pages, n_rx_pages;
+	unsigned		tx_pinned, rx_pinned;
+	struct page		**pages = NULL;
+	struct page		**tx_pages = NULL;
+	struct page		**rx_pages = NULL;
 	u8			*tx_buf, *rx_buf;
 	int			status = -EFAULT;
 
+	/* Size the transfer and page arrays for the worst case split */
+	n_k = n_tx_pages = n_rx_pages = 0;
+	for (n = n_xfers, u_tmp = u_xfers; n; n--, u_tmp++) {
+		if (!spidev_can_pin(spidev, u_tmp)) {
+			n_k++;
+			continue;
+		}
+		if (u_tmp->tx_buf)
+			n_tx_pages += spidev_npages(u_tmp->tx_buf, u_tmp->len);
+		if (u_tmp->rx_buf)
+			n_rx_pages += spidev_npages(u_tmp->rx_buf, u_tmp->len);
+		n_k += spidev_npages(u_tmp->tx_buf, u_tmp->len) +
+		       spidev_npages(u_tmp->rx_buf, u_tmp->len);
+	}
+
 	spi_message_init(&msg);
-	k_xfers = kcalloc(n_xfers, sizeof(*k_tmp), GFP_KERNEL);
+	k_xfers = kcalloc(n_k, sizeof(*k_tmp), GFP_KERNEL);
 	if (k_xfers == NULL)
 		return -ENOMEM;
 
+	if (n_tx_pages + n_rx_pages) {
+		pages = kcalloc(n_tx_pages + n_rx_pages, sizeof(*pages),
+				GFP_KERNEL);
+		if (!pages) {
+			kfree(k_xfers);
+			return -ENOMEM;
+		}
+		tx_pages = pages;
+		rx_pages = pages + n_tx_pages;
+	}
+	tx_pinned = rx_pinned = 0;
+
 	/* Construct spi_message, copying any tx data to bounce buffer.
 	 * We walk the array of user-provided transfers, using each one
 	 * to initialize a kernel version of the same transfer.
@@ -243,7 +406,7 @@ static int spidev_message(struct spidev_data *spidev,
 	rx_total = 0;
 	for (n = n_xfers, k_tmp = k_xfers, u_tmp = u_xfers;
 			n;
-			n--, k_tmp++, u_tmp++) {
+			n--, u_tmp++) {
 		k_tmp->len = u_tmp->len;
 
 		total += k_tmp->len;
@@ -257,6 +420,44 @@ static int spidev_message(struct spidev_data *spidev,
 			goto done;
 		}
 
+		if (spidev_can_pin(spidev, u_tmp)) {
+			struct page **tx = NULL, **rx = NULL;
+			int ret = 0;
+
+			if (u_tmp->tx_buf) {
+				tx = tx_pages + tx_pinned;
+				ret = spidev_pin(u_tmp->tx_buf, u_tmp->len,
+						 0, tx);
+				if (ret > 0)
+					tx_pinned += ret;
+			}
+			if (ret >= 0 && u_tmp->rx_buf) {
+				rx = rx_pages + rx_pinned;
+				ret = spidev_pin(u_tmp->rx_buf, u_tmp->len,
+						 1, rx);
+				if (ret > 0)
+					rx_pinned += ret;
+			}
+			if (ret < 0 && ret != -EINVAL) {
+				status = ret;
+				goto done;
+			}
+
+			/* highmem pages fall back to the bounce buffers */
+			if (ret >= 0) {
+				k_tmp->tx_nbits = u_tmp->tx_nbits;
+				k_tmp->rx_nbits = u_tmp->rx_nbits;
+				k_tmp->bits_per_word = u_tmp->bits_per_word;
+				k_tmp->speed_hz = u_tmp->speed_hz ? :
+						  spidev->speed_hz;
+				k_tmp = spidev_split(k_tmp, &msg, u_tmp,
+						     tx, rx);
+				/* nothing to copy back */
+				u_tmp->rx_buf = 0;
+				continue;
+			}
+		}
+
 		if (u_tmp->rx_buf) {
 			/* this transfer needs space in RX bounce buffer */
 			rx_total += k_tmp->len;
@@ -306,6 +507,7 @@ static int spidev_message(struct spidev_data *spidev,
 			u_tmp->speed_hz ? : spidev->spi->max_speed_hz);
 #endif
 		spi_message_add_tail(k_tmp, &msg);
+		k_tmp++;
 	}
 
 	status = spidev_sync(spidev, &msg);
@@ -328,6 +530,9 @@ static int spidev_message(struct spidev_data *spidev,
 	status = total;
 
 done:
+	spidev_unpin(tx_pages, tx_pinned, false);
+	spidev_unpin(rx_pages, rx_pinned, true);
+	kfree(pages);
 	kfree(k_xfers);
 	return status;
 }
@@ -48,13 +48,17 @@
 #include <linux/err.h>
 #include <linux/irq.h>
 #include <linux/suspend.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 
 #include <asm/io.h>
 #include <asm/ioctls.h>
 
 #define PDC_BUFFER_SIZE		512
 /* Revisit: We should calculate this based on the actual port settings */
-#define PDC_RX_TIMEOUT		(3 * 10)		/* 3 bytes */
+#define PDC_RX_TIMEOUT		(3 * 10)		/* 3 bytes, default */
 
 /* The minium number of data FIFOs should be able to contain */
 #define ATMEL_MIN_FIFO_SIZE	8
@@ -117,6 +121,38 @@ struct atmel_uart_char {
  */
 #define ATMEL_SERIAL_RINGSIZE 1024
 
+/*
+ * The cyclic RX DMA transfer raises a callback at the end of each period of
+ * the ring buffer. With hardware flow control, RTS is deasserted when the
+ * data not yet pushed to the tty layer reaches the last period.
+ */
+#define ATMEL_RX_DMA_PERIODS	4
+
+/*
+ * Console output queued by atmel_console_write() in buffered mode, drained
+ * by the TX tasklet ahead of the tty transmit buffer.
+ */
+#define ATMEL_CONSOLE_RINGSIZE 4096
+
+#define ATMEL_STATS_BUCKETS	16
+
+/*
+ * Performance counters, exported through debugfs. They are updated without
+ * locking from the interrupt handler and the tasklets, so treat them as
+ * estimates.
+ */
+struct atmel_uart_stats {
+	unsigned long	rx_drains;		/* RX drains requested */
+	unsigned long	rx_timer_drains;	/* ... of those, by uart_timer */
+	unsigned long	rx_dma_restarts;	/* DMA RX status errors */
+	unsigned long	rx_dma_throttles;	/* RTS deasserted on fill level */
+	unsigned int	rx_drain_max;		/* most bytes pushed at once */
+	ktime_t		rx_stamp;		/* first drain request pending */
+	/* log2 histograms: TX DMA chunk bytes, RX request to push usecs */
+	unsigned long	tx_dma_len[ATMEL_STATS_BUCKETS];
+	unsigned long	rx_latency[ATMEL_STATS_BUCKETS];
+};
+
 /*
  * We wrap our port structure around the generic uart_port.
  */
@@ -128,6 +164,8 @@ struct atmel_uart_port {
 	int			break_active;	/* break being received */
 
 	bool			use_dma_rx;	/* enable DMA receiver */
+	bool			rx_dma_rts;	/* RTS follows the DMA fill level */
+	bool			rx_dma_throttled; /* RTS deasserted for it */
 	bool			use_pdc_rx;	/* enable PDC receiver */
 	short			pdc_rx_idx;	/* current PDC RX buffer */
 	struct atmel_dma_buffer	pdc_rx[2];	/* PDC receier */
@@ -153,6 +191,10 @@ struct atmel_uart_port {
 	unsigned int		tx_len;
 
 	struct circ_buf		rx_ring;
+	struct circ_buf		console_ring;
+	bool			console_buffered;	/* queue console output */
+	struct atmel_uart_stats	stats;
+	struct dentry		*debugfs;
 
 	struct mctrl_gpios	*gpios;
 	int			gpio_irq[UART_GPIO_MAX];
@@ -160,8 +202,13 @@ struct atmel_uart_port {
 	u32			fifo_size;
 	u32			rts_high;
 	u32			rts_low;
+	u32			rx_fifo_thres;	/* data in RX FIFO raising RXRDY */
+	u32			tx_fifo_thres;	/* free TX FIFO slots raising TXRDY */
+	bool			rx_fifo_batch;	/* PIO RX on threshold and timeout */
 	bool			ms_irq_enabled;
 	u32			rtor;		/* address of receiver timeout register if it exists */
+	u32			rx_timeout;	/* receiver timeout, in bit periods */
+	bool			rx_low_latency;	/* drain RX from the IRQ thread */
 	struct timer_list	uart_timer;	/* uart timer */
 
 	bool			suspended;
@@ -284,6 +331,16 @@ static bool atmel_use_fifo(struct uart_port *port)
 	return atmel_port->fifo_size;
 }
 
+/* Interrupts used to receive in PIO mode */
+static unsigned int atmel_pio_rx_irqs(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+
+	if (atmel_port->rx_fifo_batch)
+		return ATMEL_US_RXRDY | ATMEL_US_TIMEOUT;
+	return ATMEL_US_RXRDY;
+}
+
 static void atmel_tasklet_schedule(struct atmel_uart_port *atmel_port,
 				   struct tasklet_struct *t)
 {
@@ -291,6 +348,60 @@ static void atmel_tasklet_schedule(struct atmel_uart_port *atmel_port,
 		tasklet_schedule(t);
 }
 
+/*
+ * Low latency ports drain RX from the threaded interrupt handler rather than
+ * from the RX tasklet, saving a softirq round trip before the data reaches
+ * the tty buffers.
+ */
+static bool atmel_rx_use_thread(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+
+	return atmel_port->rx_low_latency || (port->flags & UPF_LOW_LATENCY);
+}
+
+static void atmel_schedule_rx(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+
+	if (atomic_read(&atmel_port->tasklet_shutdown))
+		return;
+
+	atmel_port->stats.rx_drains++;
+	if (!atmel_port->stats.rx_stamp.tv64)
+		atmel_port->stats.rx_stamp = ktime_get();
+
+	if (atmel_rx_use_thread(port))
+		irq_wake_thread(port->irq, port);
+	else
+		tasklet_schedule(&atmel_port->tasklet_rx);
+}
+
+static void atmel_stats_hist(unsigned long *hist, unsigned long val)
+{
+	hist[val ? min_t(int, ilog2(val), ATMEL_STATS_BUCKETS - 1) : 0]++;
+}
+
+/*
+ * Account for a drain about to push count bytes to the tty layer. The
+ * latency runs from the first drain request (interrupt, DMA callback or
+ * timer) since the previous push, so it does not include the receiver
+ * timeout the bytes waited for before being noticed.
+ */
+static void atmel_stats_rx_push(struct uart_port *port, unsigned int count)
+{
+	struct atmel_uart_stats *stats = &to_atmel_uart_port(port)->stats;
+
+	if (count > stats->rx_drain_max)
+		stats->rx_drain_max = count;
+
+	if (stats->rx_stamp.tv64) {
+		atmel_stats_hist(stats->rx_latency,
+				 ktime_us_delta(ktime_get(), stats->rx_stamp));
+		stats->rx_stamp.tv64 = 0;
+	}
+}
+
 static unsigned int atmel_get_lines_status(struct uart_port *port)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
@@ -335,6 +446,28 @@ static unsigned int atmel_get_lines_status(struct uart_port *port)
 	return status;
 }
 
+/*
+ * In RS485 mode the transmitter drives RTS itself and keeps it asserted
+ * until the last stop bit and the timeguard are out, so DMA can be fed on
+ * TXRDY just like in RS232 mode. PIO and PDC wait for TXEMPTY.
+ */
+static unsigned int atmel_rs485_tx_done_mask(struct uart_port *port)
+{
+	return atmel_use_dma_tx(port) ? ATMEL_US_TXRDY : ATMEL_US_TXEMPTY;
+}
+
+/*
+ * Turn a half-duplex RS485 bus around once a DMA transmission is over: the
+ * receiver is re-enabled straight from the TXEMPTY interrupt, which the
+ * USART only raises after the timeguard has elapsed.
+ */
+static void atmel_rs485_rearm_rx(struct uart_port *port)
+{
+	if ((port->rs485.flags & SER_RS485_ENABLED) &&
+	    !(port->rs485.flags & SER_RS485_RX_DURING_TX))
+		atmel_uart_writel(port, ATMEL_US_IER, ATMEL_US_TXEMPTY);
+}
+
 /* Enable or disable the rs485 support */
 static int atmel_config_rs485(struct uart_port *port,
 			      struct serial_rs485 *rs485conf)
@@ -354,7 +487,7 @@ static int atmel_config_rs485(struct uart_port *port,
 
 	if (rs485conf->flags & SER_RS485_ENABLED) {
 		dev_dbg(port->dev, "Setting UART to RS485\n");
-		atmel_port->tx_done_mask = ATMEL_US_TXEMPTY;
+		atmel_port->tx_done_mask = atmel_rs485_tx_done_mask(port);
 		atmel_uart_writel(port, ATMEL_US_TTGR,
 				  rs485conf->delay_rts_after_send);
 		mode |= ATMEL_US_USMODE_RS485;
@@ -417,7 +550,7 @@ static void atmel_set_mctrl(struct uart_port *port, u_int mctrl)
 		rts_ready = ATMEL_US_RTSEN;
 	}
 
-	if (mctrl & TIOCM_RTS)
+	if ((mctrl & TIOCM_RTS) && !atmel_port->rx_dma_throttled)
 		control |= rts_ready;
 	else
 		control |= rts_paused;
@@ -528,7 +661,7 @@ static void atmel_start_rx(struct uart_port *port)
 				  port->read_status_mask);
 		atmel_uart_writel(port, ATMEL_PDC_PTCR, ATMEL_PDC_RXTEN);
 	} else {
-		atmel_uart_writel(port, ATMEL_US_IER, ATMEL_US_RXRDY);
+		atmel_uart_writel(port, ATMEL_US_IER, atmel_pio_rx_irqs(port));
 	}
 }
 
@@ -546,7 +679,7 @@ static void atmel_stop_rx(struct uart_port *port)
 				  ATMEL_US_ENDRX | ATMEL_US_TIMEOUT |
 				  port->read_status_mask);
 	} else {
-		atmel_uart_writel(port, ATMEL_US_IDR, ATMEL_US_RXRDY);
+		atmel_uart_writel(port, ATMEL_US_IDR, atmel_pio_rx_irqs(port));
 	}
 }
 
@@ -687,16 +820,30 @@ static void atmel_pdc_rxerr(struct uart_port *port, unsigned int status)
 		port->icount.overrun++;
 }
 
+/*
+ * Number of characters that can be read before checking the status again:
+ * the RX FIFO level when the FIFO is enabled, a single one otherwise.
+ */
+static unsigned int atmel_rx_fifo_level(struct uart_port *port,
+					unsigned int status)
+{
+	if (atmel_use_fifo(port))
+		return ATMEL_US_RXFL(atmel_uart_readl(port, ATMEL_US_FLR));
+
+	return (status & ATMEL_US_RXRDY) ? 1 : 0;
+}
+
 /*
  * Characters received (called from interrupt handler)
  */
 static void atmel_rx_chars(struct uart_port *port)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
-	unsigned int status, ch;
+	unsigned int status, ch, count;
 
 	status = atmel_uart_readl(port, ATMEL_US_CSR);
-	while (status & ATMEL_US_RXRDY) {
+	count = atmel_rx_fifo_level(port, status);
+	while (count) {
 		ch = atmel_uart_read_char(port);
 
 		/*
@@ -731,10 +878,71 @@ static void atmel_rx_chars(struct uart_port *port)
 		}
 
 		atmel_buffer_rx_char(port, status, ch);
+
+		/* The sticky error flags go with the first data of a batch. */
+		if (--count) {
+			status &= ~(ATMEL_US_PARE | ATMEL_US_FRAME
+				    | ATMEL_US_OVRE | ATMEL_US_RXBRK);
+			continue;
+		}
+
 		status = atmel_uart_readl(port, ATMEL_US_CSR);
+		count = atmel_rx_fifo_level(port, status);
+	}
+
+	atmel_schedule_rx(port);
+}
+
+/*
+ * Number of characters that can be written before checking the status
+ * again: the free room in the TX FIFO when the FIFO is enabled and
+ * characters are sent on TXRDY, a single one otherwise.
+ */
+static unsigned int atmel_tx_fifo_room(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned int level;
+
+	if (atmel_use_fifo(port) && atmel_port->tx_done_mask == ATMEL_US_TXRDY) {
+		level = ATMEL_US_TXFL(atmel_uart_readl(port, ATMEL_US_FLR));
+		return level < atmel_port->fifo_size ?
+		       atmel_port->fifo_size - level : 0;
+	}
+
+	return (atmel_uart_readl(port, ATMEL_US_CSR) &
+		atmel_port->tx_done_mask) ? 1 : 0;
+}
+
+/*
+ * Push queued console output into the transmitter as far as it has room.
+ * Returns true if some output is still waiting. Called with port->lock held.
+ */
+static bool atmel_tx_console_chars(struct uart_port *port)
+{
+	struct circ_buf *ring = &to_atmel_uart_port(port)->console_ring;
+	unsigned int room;
+
+	while (CIRC_CNT(ring->head, ring->tail, ATMEL_CONSOLE_RINGSIZE) &&
+	       (room = atmel_tx_fifo_room(port))) {
+		while (room-- &&
+		       CIRC_CNT(ring->head, ring->tail, ATMEL_CONSOLE_RINGSIZE)) {
+			atmel_uart_write_char(port, ring->buf[ring->tail]);
+			ring->tail = (ring->tail + 1) &
+				     (ATMEL_CONSOLE_RINGSIZE - 1);
+		}
 	}
 
-	atmel_tasklet_schedule(atmel_port, &atmel_port->tasklet_rx);
+	return CIRC_CNT(ring->head, ring->tail, ATMEL_CONSOLE_RINGSIZE) != 0;
+}
+
+/*
+ * Synchronously write out queued console output. Called with port->lock
+ * held.
+ */
+static void atmel_flush_console_chars(struct uart_port *port)
+{
+	while (atmel_tx_console_chars(port))
+		cpu_relax();
 }
 
 /*
@@ -745,6 +953,7 @@ static void atmel_tx_chars(struct uart_port *port)
 {
 	struct circ_buf *xmit = &port->state->xmit;
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned int room;
 
 	if (port->x_char &&
 	    (atmel_uart_readl(port, ATMEL_US_CSR) & atmel_port->tx_done_mask)) {
@@ -752,14 +961,23 @@ static void atmel_tx_chars(struct uart_port *port)
 		port->icount.tx++;
 		port->x_char = 0;
 	}
+
+	/* Kernel messages go first, come back on TXRDY for the rest */
+	if (atmel_tx_console_chars(port)) {
+		atmel_uart_writel(port, ATMEL_US_IER,
+				  atmel_port->tx_done_mask);
+		return;
+	}
+
 	if (uart_circ_empty(xmit) || uart_tx_stopped(port))
 		return;
 
-	while (atmel_uart_readl(port, ATMEL_US_CSR) &
-	       atmel_port->tx_done_mask) {
-		atmel_uart_write_char(port, xmit->buf[xmit->tail]);
-		xmit->tail = (xmit->tail + 1) & (UART_XMIT_SIZE - 1);
-		port->icount.tx++;
+	while ((room = atmel_tx_fifo_room(port))) {
+		while (room-- && !uart_circ_empty(xmit)) {
+			atmel_uart_write_char(port, xmit->buf[xmit->tail]);
+			xmit->tail = (xmit->tail + 1) & (UART_XMIT_SIZE - 1);
+			port->icount.tx++;
+		}
 		if (uart_circ_empty(xmit))
 			break;
 	}
@@ -806,6 +1024,8 @@ static void atmel_complete_tx_dma(void *arg)
 	 */
 	if (!uart_circ_empty(xmit))
 		atmel_tasklet_schedule(atmel_port, &atmel_port->tasklet_tx);
+	else
+		atmel_rs485_rearm_rx(port);
 
 	spin_unlock_irqrestore(&port->lock, flags);
 }
@@ -890,6 +1110,7 @@ static void atmel_tx_dma(struct uart_port *port)
 		 * xmit->tail correctly
 		 */
 		atmel_port->tx_len = tx_len;
+		atmel_stats_hist(atmel_port->stats.tx_dma_len, tx_len);
 
 		desc = dmaengine_prep_slave_sg(chan,
 					       sgl,
@@ -910,10 +1131,8 @@ static void atmel_tx_dma(struct uart_port *port)
 		atmel_port->cookie_tx = dmaengine_submit(desc);
 
 	} else {
-		if (port->rs485.flags & SER_RS485_ENABLED) {
-			/* DMA done, stop TX, start RX for RS485 */
-			atmel_start_rx(port);
-		}
+		/* DMA done, start RX for RS485 once the line is idle */
+		atmel_rs485_rearm_rx(port);
 	}
 
 	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
@@ -980,17 +1199,56 @@ static int atmel_prepare_tx_dma(struct uart_port *port)
 chan_err:
 	dev_err(port->dev, "TX channel not available, switch to pio\n");
 	atmel_port->use_dma_tx = 0;
+	if (port->rs485.flags & SER_RS485_ENABLED)
+		atmel_port->tx_done_mask = atmel_rs485_tx_done_mask(port);
 	if (atmel_port->chan_tx)
 		atmel_release_tx_dma(port);
 	return -EINVAL;
 }
 
+/*
+ * Without FIFO, the USART only deasserts RTS in hardware handshake mode when
+ * the PDC receive buffer is full, which never happens with the DMA. Pause
+ * the sender from the fill level of the ring instead, while the last period
+ * still leaves room for the characters it sends before noticing.
+ */
+static void atmel_rx_dma_throttle(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	struct circ_buf *ring = &atmel_port->rx_ring;
+	size_t len = sg_dma_len(&atmel_port->sg_rx);
+	struct dma_tx_state state;
+	unsigned long flags;
+	size_t head;
+
+	if (dmaengine_tx_status(atmel_port->chan_rx, atmel_port->cookie_rx,
+				&state) == DMA_ERROR)
+		return;
+
+	spin_lock_irqsave(&port->lock, flags);
+
+	head = (len - state.residue) & (len - 1);
+	if (!atmel_port->rx_dma_throttled &&
+	    CIRC_CNT(head, ring->tail, len) >=
+	    len - len / ATMEL_RX_DMA_PERIODS) {
+		/* RTSEN forces RTS high in hardware handshake mode */
+		atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_RTSEN);
+		atmel_port->rx_dma_throttled = true;
+		atmel_port->stats.rx_dma_throttles++;
+	}
+
+	spin_unlock_irqrestore(&port->lock, flags);
+}
+
 static void atmel_complete_rx_dma(void *arg)
 {
 	struct uart_port *port = arg;
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 
-	atmel_tasklet_schedule(atmel_port, &atmel_port->tasklet_rx);
+	if (atmel_port->rx_dma_rts)
+		atmel_rx_dma_throttle(port);
+
+	atmel_schedule_rx(port);
 }
 
 static void atmel_release_rx_dma(struct uart_port *port)
@@ -1018,9 +1276,9 @@ static void atmel_rx_from_dma(struct uart_port *port)
 	struct dma_chan *chan = atmel_port->chan_rx;
 	struct dma_tx_state state;
 	enum dma_status dmastat;
+	__u32 rx = port->icount.rx;
 	size_t count;
 
-
 	/* Reset the UART timeout early so that we don't miss one */
 	atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
 	dmastat = dmaengine_tx_status(chan,
@@ -1029,8 +1287,9 @@ static void atmel_rx_from_dma(struct uart_port *port)
 	/* Restart a new tasklet if DMA status is error */
 	if (dmastat == DMA_ERROR) {
 		dev_dbg(port->dev, "Get residue error, restart tasklet\n");
+		atmel_port->stats.rx_dma_restarts++;
 		atmel_uart_writel(port, ATMEL_US_IER, ATMEL_US_TIMEOUT);
-		atmel_tasklet_schedule(atmel_port, &atmel_port->tasklet_rx);
+		atmel_schedule_rx(port);
 		return;
 	}
 
@@ -1087,6 +1346,15 @@ static void atmel_rx_from_dma(struct uart_port *port)
 			       1,
 			       DMA_FROM_DEVICE);
 
+	atmel_stats_rx_push(port, port->icount.rx - rx);
+
+	/* The ring is empty: let the sender go on, unless the tty throttled */
+	if (atmel_port->rx_dma_throttled) {
+		atmel_port->rx_dma_throttled = false;
+		if (port->mctrl & TIOCM_RTS)
+			atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_RTSDIS);
+	}
+
 	/*
 	 * Drop the lock here since it might end up calling
 	 * uart_start(), which takes the lock.
@@ -1155,13 +1423,14 @@ static int atmel_prepare_rx_dma(struct uart_port *port)
 		goto chan_err;
 	}
 	/*
-	 * Prepare a cyclic dma transfer, assign 2 descriptors,
-	 * each one is half ring buffer size
+	 * Prepare a cyclic dma transfer, assign ATMEL_RX_DMA_PERIODS
+	 * descriptors, each one is a fraction of the ring buffer size
 	 */
 	desc = dmaengine_prep_dma_cyclic(atmel_port->chan_rx,
 					 sg_dma_address(&atmel_port->sg_rx),
 					 sg_dma_len(&atmel_port->sg_rx),
-					 sg_dma_len(&atmel_port->sg_rx)/2,
+					 sg_dma_len(&atmel_port->sg_rx) /
+					 ATMEL_RX_DMA_PERIODS,
 					 DMA_DEV_TO_MEM,
 					 DMA_PREP_INTERRUPT);
 	desc->callback = atmel_complete_rx_dma;
@@ -1185,7 +1454,8 @@ static void atmel_uart_timer_callback(unsigned long data)
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 
 	if (!atomic_read(&atmel_port->tasklet_shutdown)) {
-		tasklet_schedule(&atmel_port->tasklet_rx);
+		atmel_port->stats.rx_timer_drains++;
+		atmel_schedule_rx(port);
 		mod_timer(&atmel_port->uart_timer,
 			  jiffies + uart_poll_timeout(port));
 	}
@@ -1210,8 +1480,7 @@ atmel_handle_receive(struct uart_port *port, unsigned int pending)
 		if (pending & (ATMEL_US_ENDRX | ATMEL_US_TIMEOUT)) {
 			atmel_uart_writel(port, ATMEL_US_IDR,
 					  (ATMEL_US_ENDRX | ATMEL_US_TIMEOUT));
-			atmel_tasklet_schedule(atmel_port,
-					       &atmel_port->tasklet_rx);
+			atmel_schedule_rx(port);
 		}
 
 		if (pending & (ATMEL_US_RXBRK | ATMEL_US_OVRE |
@@ -1223,11 +1492,16 @@ atmel_handle_receive(struct uart_port *port, unsigned int pending)
 		if (pending & ATMEL_US_TIMEOUT) {
 			atmel_uart_writel(port, ATMEL_US_IDR,
 					  ATMEL_US_TIMEOUT);
-			atmel_tasklet_schedule(atmel_port,
-					       &atmel_port->tasklet_rx);
+			atmel_schedule_rx(port);
 		}
 	}
 
+	/* Flush what is left in the RX FIFO below the RXRDY threshold */
+	if (atmel_port->rx_fifo_batch && (pending & ATMEL_US_TIMEOUT)) {
+		atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
+		pending |= ATMEL_US_RXRDY;
+	}
+
 	/* Interrupt receive */
 	if (pending & ATMEL_US_RXRDY)
 		atmel_rx_chars(port);
@@ -1250,6 +1524,12 @@ atmel_handle_transmit(struct uart_port *port, unsigned int pending)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 
+	/* RS485 DMA transmission fully on the wire, see atmel_rs485_rearm_rx() */
+	if (atmel_use_dma_tx(port) && (pending & ATMEL_US_TXEMPTY)) {
+		atmel_uart_writel(port, ATMEL_US_IDR, ATMEL_US_TXEMPTY);
+		atmel_start_rx(port);
+	}
+
 	if (pending & atmel_port->tx_done_mask) {
 		/* Either PDC or interrupt transmission */
 		atmel_uart_writel(port, ATMEL_US_IDR,
@@ -1345,6 +1625,19 @@ static irqreturn_t atmel_interrupt(int irq, void *dev_id)
 	return pass_counter ? IRQ_HANDLED : IRQ_NONE;
 }
 
+static irqreturn_t atmel_rx_thread(int irq, void *dev_id)
+{
+	struct uart_port *port = dev_id;
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+
+	/* Same context as the RX tasklet, the lock may be dropped inside */
+	spin_lock_bh(&port->lock);
+	atmel_port->schedule_rx(port);
+	spin_unlock_bh(&port->lock);
+
+	return IRQ_HANDLED;
+}
+
 static void atmel_release_tx_pdc(struct uart_port *port)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
@@ -1431,6 +1724,7 @@ static void atmel_rx_from_ring(struct uart_port *port)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 	struct circ_buf *ring = &atmel_port->rx_ring;
+	__u32 rx = port->icount.rx;
 	unsigned int flg;
 	unsigned int status;
 
@@ -1486,6 +1780,8 @@ static void atmel_rx_from_ring(struct uart_port *port)
 		uart_insert_char(port, status, ATMEL_US_OVRE, c.ch, flg);
 	}
 
+	atmel_stats_rx_push(port, port->icount.rx - rx);
+
 	/*
 	 * Drop the lock here since it might end up calling
 	 * uart_start(), which takes the lock.
@@ -1517,6 +1813,7 @@ static void atmel_rx_from_pdc(struct uart_port *port)
 	struct tty_port *tport = &port->state->port;
 	struct atmel_dma_buffer *pdc;
 	int rx_idx = atmel_port->pdc_rx_idx;
+	__u32 rx = port->icount.rx;
 	unsigned int head;
 	unsigned int tail;
 	unsigned int count;
@@ -1577,6 +1874,8 @@ static void atmel_rx_from_pdc(struct uart_port *port)
 		}
 	} while (head >= pdc->dma_size);
 
+	atmel_stats_rx_push(port, port->icount.rx - rx);
+
 	/*
 	 * Drop the lock here since it might end up calling
 	 * uart_start(), which takes the lock.
@@ -1660,6 +1959,8 @@ static void atmel_init_property(struct atmel_uart_port *atmel_port,
 	struct device_node *np = pdev->dev.of_node;
 	struct atmel_uart_data *pdata = dev_get_platdata(&pdev->dev);
 
+	atmel_port->rx_timeout = PDC_RX_TIMEOUT;
+
 	if (np) {
 		/* DMA/PDC usage specification */
 		if (of_get_property(np, "atmel,use-dma-rx", NULL)) {
@@ -1688,6 +1989,15 @@ static void atmel_init_property(struct atmel_uart_port *atmel_port,
 			atmel_port->use_pdc_tx  = false;
 		}
 
+		/* Receiver timeout used to flush partial DMA/PDC buffers */
+		if (!of_property_read_u32(np, "atmel,rx-timeout-bits",
+					  &atmel_port->rx_timeout) &&
+		    (!atmel_port->rx_timeout ||
+		     atmel_port->rx_timeout > ATMEL_US_TO)) {
+			dev_err(&pdev->dev, "Invalid receiver timeout\n");
+			atmel_port->rx_timeout = PDC_RX_TIMEOUT;
+		}
+
 	} else {
 		atmel_port->use_pdc_rx  = pdata->use_dma_rx;
 		atmel_port->use_pdc_tx  = pdata->use_dma_tx;
@@ -1862,8 +2172,8 @@ static int atmel_startup(struct uart_port *port)
 	/*
 	 * Allocate the IRQ
 	 */
-	retval = request_irq(port->irq, atmel_interrupt,
-			IRQF_SHARED | IRQF_COND_SUSPEND,
+	retval = request_threaded_irq(port->irq, atmel_interrupt,
+			atmel_rx_thread, IRQF_SHARED | IRQF_COND_SUSPEND,
 			tty ? tty->name : "atmel_serial", port);
 	if (retval) {
 		dev_err(port->dev, "atmel_startup - Can't get irq\n");
@@ -1904,8 +2214,9 @@ static int atmel_startup(struct uart_port *port)
 	/*
 	 * Enable FIFO when available
 	 */
+	atmel_port->rx_fifo_batch = false;
 	if (atmel_port->fifo_size) {
-		unsigned int txrdym = ATMEL_US_ONE_DATA;
+		unsigned int txrdym = ilog2(atmel_port->tx_fifo_thres);
 		unsigned int rxrdym = ATMEL_US_ONE_DATA;
 		unsigned int fmr;
 
@@ -1917,6 +2228,16 @@ static int atmel_startup(struct uart_port *port)
 		if (atmel_use_dma_tx(port))
 			txrdym = ATMEL_US_FOUR_DATA;
 
+		/*
+		 * In PIO mode, only raise RXRDY once several data are in the
+		 * FIFO and let the receiver timeout flush the remaining ones.
+		 */
+		if (!atmel_use_pdc_rx(port) && !atmel_use_dma_rx(port) &&
+		    atmel_port->rtor && atmel_port->rx_fifo_thres > 1) {
+			rxrdym = ilog2(atmel_port->rx_fifo_thres);
+			atmel_port->rx_fifo_batch = true;
+		}
+
 		fmr = ATMEL_US_TXRDYM(txrdym) | ATMEL_US_RXRDYM(rxrdym);
 		if (atmel_port->rts_high &&
 		    atmel_port->rts_low)
@@ -1948,7 +2269,8 @@ static int atmel_startup(struct uart_port *port)
 					jiffies + uart_poll_timeout(port));
 		/* set USART timeout */
 		} else {
-			atmel_uart_writel(port, atmel_port->rtor, PDC_RX_TIMEOUT);
+			atmel_uart_writel(port, atmel_port->rtor,
+					  atmel_port->rx_timeout);
 			atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
 
 			atmel_uart_writel(port, ATMEL_US_IER,
@@ -1963,15 +2285,21 @@ static int atmel_startup(struct uart_port *port)
 					jiffies + uart_poll_timeout(port));
 		/* set USART timeout */
 		} else {
-			atmel_uart_writel(port, atmel_port->rtor, PDC_RX_TIMEOUT);
+			atmel_uart_writel(port, atmel_port->rtor,
+					  atmel_port->rx_timeout);
 			atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
 
 			atmel_uart_writel(port, ATMEL_US_IER,
 					  ATMEL_US_TIMEOUT);
 		}
 	} else {
+		if (atmel_port->rx_fifo_batch) {
+			atmel_uart_writel(port, atmel_port->rtor,
+					  atmel_port->rx_timeout);
+			atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
+		}
 		/* enable receive only */
-		atmel_uart_writel(port, ATMEL_US_IER, ATMEL_US_RXRDY);
+		atmel_uart_writel(port, ATMEL_US_IER, atmel_pio_rx_irqs(port));
 	}
 
 	return 0;
@@ -2025,6 +2353,11 @@ static void atmel_shutdown(struct uart_port *port)
 	tasklet_kill(&atmel_port->tasklet_rx);
 	tasklet_kill(&atmel_port->tasklet_tx);
 
+	/* Don't lose kernel messages queued by the console */
+	spin_lock_irq(&port->lock);
+	atmel_flush_console_chars(port);
+	spin_unlock_irq(&port->lock);
+
 	/*
 	 * Ensure everything is stopped and
 	 * disable port and break condition.
@@ -2100,6 +2433,7 @@ static void atmel_serial_pm(struct uart_port *port, unsigned int state,
 static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 			      struct ktermios *old)
 {
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 	unsigned long flags;
 	unsigned int old_mode, mode, imr, quot, baud;
 
@@ -2197,23 +2531,27 @@ static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 	atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_TXDIS | ATMEL_US_RXDIS);
 
 	/* mode */
+	atmel_port->rx_dma_rts = false;
 	if (port->rs485.flags & SER_RS485_ENABLED) {
 		atmel_uart_writel(port, ATMEL_US_TTGR,
 				  port->rs485.delay_rts_after_send);
 		mode |= ATMEL_US_USMODE_RS485;
 	} else if (termios->c_cflag & CRTSCTS) {
 		/* RS232 with hardware handshake (RTS/CTS) */
-		if (atmel_use_dma_rx(port) && !atmel_use_fifo(port)) {
-			dev_info(port->dev, "not enabling hardware flow control because DMA is used");
-			termios->c_cflag &= ~CRTSCTS;
-		} else {
-			mode |= ATMEL_US_USMODE_HWHS;
-		}
+		mode |= ATMEL_US_USMODE_HWHS;
+
+		/* the RX FIFO thresholds drive RTS when there is a FIFO */
+		atmel_port->rx_dma_rts = atmel_use_dma_rx(port) &&
+					 !atmel_use_fifo(port);
 	} else {
 		/* RS232 without hadware handshake */
 		mode |= ATMEL_US_USMODE_NORMAL;
 	}
 
+	/* leaving hardware handshake: the mode switch below sets RTS */
+	if (!atmel_port->rx_dma_rts)
+		atmel_port->rx_dma_throttled = false;
+
 	/* set the mode, clock divisor, parity, stop bits and data size */
 	atmel_uart_writel(port, ATMEL_US_MR, mode);
 
@@ -2396,6 +2734,237 @@ static struct uart_ops atmel_pops = {
 /*
  * Configure the port from the platform device resource info.
  */
+static struct uart_port *atmel_dev_to_port(struct device *dev)
+{
+	struct tty_port *tport = dev_get_drvdata(dev);
+	struct uart_state *state = container_of(tport, struct uart_state, port);
+
+	return state->uart_port;
+}
+
+static ssize_t atmel_rx_timeout_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct uart_port *port = atmel_dev_to_port(dev);
+
+	return sprintf(buf, "%u\n", to_atmel_uart_port(port)->rx_timeout);
+}
+
+/*
+ * The receiver timeout, in bit periods, flushes partially filled DMA/PDC
+ * buffers once the line has been idle that long. Make it short for
+ * request/response protocols, long to save wakeups on busy links.
+ */
+static ssize_t atmel_rx_timeout_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct tty_port *tport = dev_get_drvdata(dev);
+	struct uart_port *port = atmel_dev_to_port(dev);
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned int bits;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &bits);
+	if (ret)
+		return ret;
+
+	if (!bits || bits > ATMEL_US_TO)
+		return -EINVAL;
+
+	mutex_lock(&tport->mutex);
+	atmel_port->rx_timeout = bits;
+	if (test_bit(ASYNCB_INITIALIZED, &tport->flags) && atmel_port->rtor &&
+	    (atmel_use_pdc_rx(port) || atmel_use_dma_rx(port) ||
+	     atmel_port->rx_fifo_batch)) {
+		spin_lock_irq(&port->lock);
+		atmel_uart_writel(port, atmel_port->rtor, bits);
+		atmel_uart_writel(port, ATMEL_US_CR, ATMEL_US_STTTO);
+		spin_unlock_irq(&port->lock);
+	}
+	mutex_unlock(&tport->mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(rx_timeout, S_IRUGO | S_IWUSR, atmel_rx_timeout_show,
+		   atmel_rx_timeout_store);
+
+static ssize_t atmel_rx_low_latency_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct uart_port *port = atmel_dev_to_port(dev);
+
+	return sprintf(buf, "%d\n", to_atmel_uart_port(port)->rx_low_latency);
+}
+
+static ssize_t atmel_rx_low_latency_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct uart_port *port = atmel_dev_to_port(dev);
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	to_atmel_uart_port(port)->rx_low_latency = enable;
+
+	return count;
+}
+
+static DEVICE_ATTR(rx_low_latency, S_IRUGO | S_IWUSR,
+		   atmel_rx_low_latency_show, atmel_rx_low_latency_store);
+
+/*
+ * FIFO thresholds, in data, at which RXRDY and TXRDY are raised in PIO mode:
+ * 1, 2 or 4. They are applied the next time the port is opened.
+ */
+static ssize_t atmel_fifo_thres_show(struct device *dev, char *buf, bool rx)
+{
+	struct atmel_uart_port *atmel_port =
+		to_atmel_uart_port(atmel_dev_to_port(dev));
+
+	if (!atmel_port->fifo_size)
+		return -ENODEV;
+
+	return sprintf(buf, "%u\n", rx ? atmel_port->rx_fifo_thres :
+					 atmel_port->tx_fifo_thres);
+}
+
+static ssize_t atmel_fifo_thres_store(struct device *dev, const char *buf,
+				      size_t count, bool rx)
+{
+	struct tty_port *tport = dev_get_drvdata(dev);
+	struct atmel_uart_port *atmel_port =
+		to_atmel_uart_port(atmel_dev_to_port(dev));
+	unsigned int thres;
+	int ret;
+
+	if (!atmel_port->fifo_size)
+		return -ENODEV;
+
+	ret = kstrtouint(buf, 0, &thres);
+	if (ret)
+		return ret;
+
+	if (thres != 1 && thres != 2 && thres != 4)
+		return -EINVAL;
+
+	mutex_lock(&tport->mutex);
+	if (rx)
+		atmel_port->rx_fifo_thres = thres;
+	else
+		atmel_port->tx_fifo_thres = thres;
+	mutex_unlock(&tport->mutex);
+
+	return count;
+}
+
+static ssize_t atmel_rx_fifo_threshold_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	return atmel_fifo_thres_show(dev, buf, true);
+}
+
+static ssize_t atmel_rx_fifo_threshold_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	return atmel_fifo_thres_store(dev, buf, count, true);
+}
+
+static DEVICE_ATTR(rx_fifo_threshold, S_IRUGO | S_IWUSR,
+		   atmel_rx_fifo_threshold_show, atmel_rx_fifo_threshold_store);
+
+static ssize_t atmel_tx_fifo_threshold_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	return atmel_fifo_thres_show(dev, buf, false);
+}
+
+static ssize_t atmel_tx_fifo_threshold_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	return atmel_fifo_thres_store(dev, buf, count, false);
+}
+
+static DEVICE_ATTR(tx_fifo_threshold, S_IRUGO | S_IWUSR,
+		   atmel_tx_fifo_threshold_show, atmel_tx_fifo_threshold_store);
+
+static ssize_t atmel_console_buffered_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct uart_port *port = atmel_dev_to_port(dev);
+
+	return sprintf(buf, "%d\n", to_atmel_uart_port(port)->console_buffered);
+}
+
+/*
+ * In buffered mode, the console copies kernel messages into a ring drained
+ * by the TX tasklet instead of polling TXRDY with interrupts masked. Only
+ * used while the port is open in PIO TX mode; oopses are always synchronous.
+ */
+static ssize_t atmel_console_buffered_store(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct tty_port *tport = dev_get_drvdata(dev);
+	struct uart_port *port = atmel_dev_to_port(dev);
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	char *data = NULL;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&tport->mutex);
+	if (enable && !atmel_port->console_ring.buf) {
+		data = kmalloc(ATMEL_CONSOLE_RINGSIZE, GFP_KERNEL);
+		if (!data) {
+			mutex_unlock(&tport->mutex);
+			return -ENOMEM;
+		}
+	}
+
+	spin_lock_irq(&port->lock);
+	if (data) {
+		atmel_port->console_ring.head = 0;
+		atmel_port->console_ring.tail = 0;
+		atmel_port->console_ring.buf = data;
+	}
+	atmel_port->console_buffered = enable;
+	spin_unlock_irq(&port->lock);
+	mutex_unlock(&tport->mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(console_buffered, S_IRUGO | S_IWUSR,
+		   atmel_console_buffered_show, atmel_console_buffered_store);
+
+static struct attribute *atmel_serial_dev_attrs[] = {
+	&dev_attr_rx_timeout.attr,
+	&dev_attr_rx_low_latency.attr,
+	&dev_attr_rx_fifo_threshold.attr,
+	&dev_attr_tx_fifo_threshold.attr,
+	&dev_attr_console_buffered.attr,
+	NULL,
+};
+
+static struct attribute_group atmel_serial_dev_attr_group = {
+	.attrs = atmel_serial_dev_attrs,
+};
+
 static int atmel_init_port(struct atmel_uart_port *atmel_port,
 				      struct platform_device *pdev)
 {
@@ -2416,6 +2985,7 @@ static int atmel_init_port(struct atmel_uart_port *atmel_port,
 	port->mapbase	= pdev->resource[0].start;
 	port->irq	= pdev->resource[1].start;
 	port->rs485_config	= atmel_config_rs485;
+	port->attr_group	= &atmel_serial_dev_attr_group;
 
 	memset(&atmel_port->rx_ring, 0, sizeof(atmel_port->rx_ring));
 
@@ -2446,9 +3016,12 @@ static int atmel_init_port(struct atmel_uart_port *atmel_port,
 		/* only enable clock when USART is in use */
 	}
 
-	/* Use TXEMPTY for interrupt when rs485 else TXRDY or ENDTX|TXBUFE */
+	/*
+	 * Use TXEMPTY for interrupt when rs485 (TXRDY with DMA) else TXRDY or
+	 * ENDTX|TXBUFE
+	 */
 	if (port->rs485.flags & SER_RS485_ENABLED)
-		atmel_port->tx_done_mask = ATMEL_US_TXEMPTY;
+		atmel_port->tx_done_mask = atmel_rs485_tx_done_mask(port);
 	else if (atmel_use_pdc_tx(port)) {
 		port->fifosize = PDC_BUFFER_SIZE;
 		atmel_port->tx_done_mask = ATMEL_US_ENDTX | ATMEL_US_TXBUFE;
@@ -2469,6 +3042,62 @@ static void atmel_console_putchar(struct uart_port *port, int ch)
 	atmel_uart_write_char(port, ch);
 }
 
+/*
+ * Queue a console message for the TX tasklet, converting LF to CRLF like
+ * uart_console_write() does. Returns false if it has to be written
+ * synchronously instead: buffered mode off, oops in progress, port not open
+ * in PIO TX mode, port lock contended or ring full.
+ */
+static bool atmel_console_queue(struct uart_port *port, const char *s,
+				unsigned int count)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	struct circ_buf *ring = &atmel_port->console_ring;
+	unsigned int i, needed = count;
+	bool queued = false;
+
+	if (!atmel_port->console_buffered || oops_in_progress ||
+	    atmel_use_pdc_tx(port) || atmel_use_dma_tx(port))
+		return false;
+
+	/* printk from under the port lock must not deadlock */
+	if (!spin_trylock(&port->lock))
+		return false;
+
+	if (!port->state ||
+	    !test_bit(ASYNCB_INITIALIZED, &port->state->port.flags) ||
+	    !atmel_port->console_buffered)
+		goto out;
+
+	for (i = 0; i < count; i++)
+		if (s[i] == '\n')
+			needed++;
+
+	if (CIRC_SPACE(ring->head, ring->tail, ATMEL_CONSOLE_RINGSIZE) < needed) {
+		/* Keep messages in order: write out what's queued first */
+		atmel_flush_console_chars(port);
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (s[i] == '\n') {
+			ring->buf[ring->head] = '\r';
+			ring->head = (ring->head + 1) &
+				     (ATMEL_CONSOLE_RINGSIZE - 1);
+		}
+		ring->buf[ring->head] = s[i];
+		ring->head = (ring->head + 1) & (ATMEL_CONSOLE_RINGSIZE - 1);
+	}
+
+	/* The TXRDY interrupt schedules the tasklet which drains the ring */
+	atmel_uart_writel(port, ATMEL_US_IER, atmel_port->tx_done_mask);
+	queued = true;
+out:
+	spin_unlock(&port->lock);
+
+	return queued;
+}
+
 /*
  * Interrupts are disabled on entering
  */
@@ -2479,6 +3108,9 @@ static void atmel_console_write(struct console *co, const char *s, u_int count)
 	unsigned int status, imr;
 	unsigned int pdc_tx;
 
+	if (atmel_console_queue(port, s, count))
+		return;
+
 	/*
 	 * First, save IMR and then disable interrupts
 	 */
@@ -2747,6 +3379,8 @@ static void atmel_serial_probe_fifos(struct atmel_uart_port *port,
 	port->fifo_size = 0;
 	port->rts_low = 0;
 	port->rts_high = 0;
+	port->rx_fifo_thres = 1;
+	port->tx_fifo_thres = 4;
 
 	if (of_property_read_u32(pdev->dev.of_node,
 				 "atmel,fifo-size",
@@ -2783,6 +3417,116 @@ static void atmel_serial_probe_fifos(struct atmel_uart_port *port,
 		port->rts_low);
 }
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *atmel_serial_debugfs_root;
+
+static void atmel_stats_show_hist(struct seq_file *s, const char *name,
+				  const unsigned long *hist)
+{
+	int i;
+
+	seq_printf(s, "%s:", name);
+	for (i = 0; i < ATMEL_STATS_BUCKETS; i++)
+		seq_printf(s, " %lu", hist[i]);
+	seq_putc(s, '\n');
+}
+
+static int atmel_stats_show(struct seq_file *s, void *data)
+{
+	struct atmel_uart_port *atmel_port = s->private;
+	struct atmel_uart_stats *stats = &atmel_port->stats;
+	struct uart_port *port = &atmel_port->uart;
+
+	seq_printf(s, "rx: %u\n", port->icount.rx);
+	seq_printf(s, "overrun: %u\n", port->icount.overrun);
+	seq_printf(s, "buf_overrun: %u\n", port->icount.buf_overrun);
+	seq_printf(s, "rx_irq_drains: %lu\n",
+		   stats->rx_drains - stats->rx_timer_drains);
+	seq_printf(s, "rx_timer_drains: %lu\n", stats->rx_timer_drains);
+	seq_printf(s, "rx_dma_restarts: %lu\n", stats->rx_dma_restarts);
+	seq_printf(s, "rx_dma_throttles: %lu\n", stats->rx_dma_throttles);
+	seq_printf(s, "rx_drain_max: %u\n", stats->rx_drain_max);
+	/* bucket n counts values in [2^n, 2^(n+1)), the last one is open */
+	atmel_stats_show_hist(s, "tx_dma_len_log2", stats->tx_dma_len);
+	atmel_stats_show_hist(s, "rx_latency_us_log2", stats->rx_latency);
+
+	return 0;
+}
+
+static int atmel_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, atmel_stats_show, inode->i_private);
+}
+
+/* Any write clears the counters */
+static ssize_t atmel_stats_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct atmel_uart_port *atmel_port = s->private;
+
+	memset(&atmel_port->stats, 0, sizeof(atmel_port->stats));
+
+	return count;
+}
+
+static const struct file_operations atmel_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= atmel_stats_open,
+	.read		= seq_read,
+	.write		= atmel_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void atmel_serial_debugfs_add(struct atmel_uart_port *atmel_port)
+{
+	char name[16];
+
+	if (!atmel_serial_debugfs_root)
+		return;
+
+	snprintf(name, sizeof(name), "%s%d", atmel_uart.dev_name,
+		 atmel_port->uart.line);
+	atmel_port->debugfs = debugfs_create_file(name, S_IRUGO | S_IWUSR,
+						  atmel_serial_debugfs_root,
+						  atmel_port,
+						  &atmel_stats_fops);
+}
+
+static void atmel_serial_debugfs_remove(struct atmel_uart_port *atmel_port)
+{
+	debugfs_remove(atmel_port->debugfs);
+	atmel_port->debugfs = NULL;
+}
+
+static void atmel_serial_debugfs_init(void)
+{
+	atmel_serial_debugfs_root = debugfs_create_dir("atmel_serial", NULL);
+}
+
+static void atmel_serial_debugfs_exit(void)
+{
+	debugfs_remove_recursive(atmel_serial_debugfs_root);
+}
+#else
+static void atmel_serial_debugfs_add(struct atmel_uart_port *atmel_port)
+{
+}
+
+static void atmel_serial_debugfs_remove(struct atmel_uart_port *atmel_port)
+{
+}
+
+static void atmel_serial_debugfs_init(void)
+{
+}
+
+static void atmel_serial_debugfs_exit(void)
+{
+}
+#endif
+
 static int atmel_serial_probe(struct platform_device *pdev)
 {
 	struct atmel_uart_port *port;
@@ -2886,6 +3630,8 @@ static int atmel_serial_probe(struct platform_device *pdev)
 	 */
 	clk_disable_unprepare(port->clk);
 
+	atmel_serial_debugfs_add(port);
+
 	return 0;
 
 err_add_port:
@@ -2913,9 +3659,12 @@ static int atmel_serial_remove(struct platform_device *pdev)
 
 	device_init_wakeup(&pdev->dev, 0);
 
+	atmel_serial_debugfs_remove(atmel_port);
+
 	ret = uart_remove_one_port(&atmel_uart, port);
 
 	kfree(atmel_port->rx_ring.buf);
+	kfree(atmel_port->console_ring.buf);
 
 	/* "port" is allocated statically, so we shouldn't free it */
 
@@ -2945,9 +3694,13 @@ static int __init atmel_serial_init(void)
 	if (ret)
 		return ret;
 
+	atmel_serial_debugfs_init();
+
 	ret = platform_driver_register(&atmel_serial_driver);
-	if (ret)
+	if (ret) {
+		atmel_serial_debugfs_exit();
 		uart_unregister_driver(&atmel_uart);
+	}
 
 	return ret;
 }
@@ -2955,6 +3708,7 @@ static int __init atmel_serial_init(void)
 static void __exit atmel_serial_exit(void)
 {
 	platform_driver_unregister(&atmel_serial_driver);
+	atmel_serial_debugfs_exit();
 	uart_unregister_driver(&atmel_uart);
 }
 
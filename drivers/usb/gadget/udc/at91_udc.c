@@ -272,8 +272,12 @@ static void done(struct at91_ep *ep, struct at91_request *req, int status)
 	spin_lock(&udc->lock);
 	ep->stopped = stopped;
 
-	/* ep0 is always ready; other endpoints need a non-empty queue */
-	if (list_empty(&ep->queue) && ep->int_mask != (1 << 0))
+	/*
+	 * ep0 is always ready; other endpoints need a non-empty queue,
+	 * or a pingpong bank still waiting to be sent
+	 */
+	if (list_empty(&ep->queue) && ep->int_mask != (1 << 0)
+			&& !ep->fifo_loaded)
 		at91_udp_write(udc, AT91_UDP_IDR, ep->int_mask);
 }
 
@@ -378,38 +382,19 @@ rescan:
 	return is_done;
 }
 
-/* load fifo for an IN packet */
-static int write_fifo(struct at91_ep *ep, struct at91_request *req)
+/*
+ * copy the next IN packet of @req into the fifo, and hand it to the
+ * hardware unless it is being loaded into the second pingpong bank.
+ */
+static int load_fifo(struct at91_ep *ep, struct at91_request *req,
+		int validate)
 {
 	u32 __iomem	*creg = ep->creg;
-	u32		csr = __raw_readl(creg);
 	u8 __iomem	*dreg = ep->creg + (AT91_UDP_FDR(0) - AT91_UDP_CSR(0));
 	unsigned	total, count, is_last;
+	u32		csr;
 	u8		*buf;
 
-	/*
-	 * TODO: allow for writing two packets to the fifo ... that'll
-	 * reduce the amount of IN-NAKing, but probably won't affect
-	 * throughput much.  (Unlike preventing OUT-NAKing!)
-	 */
-
-	/*
-	 * If ep_queue() calls us, the queue is empty and possibly in
-	 * odd states like TXCOMP not yet cleared (we do it, saving at
-	 * least one IRQ) or the fifo not yet being free.  Those aren't
-	 * issues normally (IRQ handler fast path).
-	 */
-	if (unlikely(csr & (AT91_UDP_TXCOMP | AT91_UDP_TXPKTRDY))) {
-		if (csr & AT91_UDP_TXCOMP) {
-			csr |= CLR_FX;
-			csr &= ~(SET_FX | AT91_UDP_TXCOMP);
-			__raw_writel(csr, creg);
-			csr = __raw_readl(creg);
-		}
-		if (csr & AT91_UDP_TXPKTRDY)
-			return 0;
-	}
-
 	buf = req->req.buf + req->req.actual;
 	prefetch(buf);
 	total = req->req.length - req->req.actual;
@@ -435,18 +420,76 @@ static int write_fifo(struct at91_ep *ep, struct at91_request *req)
 	 * and Measurement Class devices).
 	 */
 	__raw_writesb(dreg, buf, count);
-	csr &= ~SET_FX;
-	csr |= CLR_FX | AT91_UDP_TXPKTRDY;
-	__raw_writel(csr, creg);
+	if (validate) {
+		csr = __raw_readl(creg);
+		csr &= ~SET_FX;
+		csr |= CLR_FX | AT91_UDP_TXPKTRDY;
+		__raw_writel(csr, creg);
+	} else
+		ep->fifo_loaded = 1;
 	req->req.actual += count;
 
-	PACKET("%s %p in/%d%s\n", ep->ep.name, &req->req, count,
+	PACKET("%s %p in/%d%s%s\n", ep->ep.name, &req->req, count,
+			validate ? "" : " (pong)",
 			is_last ? " (done)" : "");
 	if (is_last)
 		done(ep, req, 0);
 	return is_last;
 }
 
+/*
+ * load fifo for an IN packet.  on pingpong endpoints the other bank is
+ * filled right away, and sent as soon as TXCOMP reports the first one
+ * went out:  the host no longer gets NAKed while we refill the fifo.
+ * @req may be NULL when only a preloaded bank is left to send.
+ */
+static int write_fifo(struct at91_ep *ep, struct at91_request *req)
+{
+	u32 __iomem	*creg = ep->creg;
+	u32		csr = __raw_readl(creg);
+	int		is_last = 0;
+
+	/*
+	 * If ep_queue() calls us, the queue is empty and possibly in
+	 * odd states like TXCOMP not yet cleared (we do it, saving at
+	 * least one IRQ) or the fifo not yet being free.  Those aren't
+	 * issues normally (IRQ handler fast path).
+	 */
+	if (unlikely(csr & (AT91_UDP_TXCOMP | AT91_UDP_TXPKTRDY))) {
+		if (csr & AT91_UDP_TXCOMP) {
+			csr |= CLR_FX;
+			csr &= ~(SET_FX | AT91_UDP_TXCOMP);
+			__raw_writel(csr, creg);
+			csr = __raw_readl(creg);
+		}
+		if (csr & AT91_UDP_TXPKTRDY)
+			return 0;
+	}
+
+	if (ep->fifo_loaded) {
+		/* the bank loaded last time goes out now ... */
+		csr |= CLR_FX;
+		csr &= ~SET_FX;
+		csr |= AT91_UDP_TXPKTRDY;
+		__raw_writel(csr, creg);
+		ep->fifo_loaded = 0;
+	} else if (req) {
+		is_last = load_fifo(ep, req, 1);
+	} else
+		return 0;
+
+	/* ... while the other one gets the next packet, maybe queued later */
+	if (!ep->is_pingpong)
+		return is_last;
+	if (req && !is_last)
+		return load_fifo(ep, req, 0);
+	if (!list_empty(&ep->queue)) {
+		req = list_entry(ep->queue.next, struct at91_request, queue);
+		load_fifo(ep, req, 0);
+	}
+	return is_last;
+}
+
 static void nuke(struct at91_ep *ep, int status)
 {
 	struct at91_request *req;
@@ -538,6 +581,7 @@ ok:
 	 */
 	at91_udp_write(udc, AT91_UDP_RST_EP, ep->int_mask);
 	at91_udp_write(udc, AT91_UDP_RST_EP, 0);
+	ep->fifo_loaded = 0;
 
 	spin_unlock_irqrestore(&udc->lock, flags);
 	return 0;
@@ -566,6 +610,7 @@ static int at91_ep_disable (struct usb_ep * _ep)
 		at91_udp_write(udc, AT91_UDP_RST_EP, 0);
 		__raw_writel(0, ep->creg);
 	}
+	ep->fifo_loaded = 0;
 
 	spin_unlock_irqrestore(&udc->lock, flags);
 	return 0;
@@ -692,7 +737,8 @@ ep0_in_status:
 	if (req && !status) {
 		list_add_tail (&req->queue, &ep->queue);
 		at91_udp_write(udc, AT91_UDP_IER, ep->int_mask);
-	}
+	} else if (ep->fifo_loaded)
+		at91_udp_write(udc, AT91_UDP_IER, ep->int_mask);
 done:
 	spin_unlock_irqrestore(&udc->lock, flags);
 	return (status < 0) ? status : 0;
@@ -750,7 +796,8 @@ static int at91_ep_set_halt(struct usb_ep *_ep, int value)
 	 * of data tx then stall.  note that the fifo rx bytecount isn't
 	 * completely accurate as a tx bytecount.
 	 */
-	if (ep->is_in && (!list_empty(&ep->queue) || (csr >> 16) != 0))
+	if (ep->is_in && (!list_empty(&ep->queue) || (csr >> 16) != 0
+			|| ep->fifo_loaded))
 		status = -EAGAIN;
 	else {
 		csr |= CLR_FX;
@@ -761,6 +808,7 @@ static int at91_ep_set_halt(struct usb_ep *_ep, int value)
 		} else {
 			at91_udp_write(udc, AT91_UDP_RST_EP, ep->int_mask);
 			at91_udp_write(udc, AT91_UDP_RST_EP, 0);
+			ep->fifo_loaded = 0;
 			csr &= ~AT91_UDP_FORCESTALL;
 		}
 		__raw_writel(csr, creg);
@@ -834,6 +882,7 @@ static void udc_reinit(struct at91_udc *udc)
 		ep->ep.desc = NULL;
 		ep->stopped = 0;
 		ep->fifo_bank = 0;
+		ep->fifo_loaded = 0;
 		usb_ep_set_maxpacket_limit(&ep->ep, ep->maxpacket);
 		ep->creg = (void __iomem *) udc->udp_baseaddr + AT91_UDP_CSR(i);
 		/* initialize one queue per endpoint */
@@ -1015,7 +1064,7 @@ static int handle_ep(struct at91_ep *ep)
 			csr &= ~(SET_FX | AT91_UDP_STALLSENT | AT91_UDP_TXCOMP);
 			__raw_writel(csr, creg);
 		}
-		if (req)
+		if (req || ep->fifo_loaded)
 			return write_fifo(ep, req);
 
 	} else {
@@ -1225,6 +1274,7 @@ static void handle_setup(struct at91_udc *udc, struct at91_ep *ep, u32 csr)
 
 		at91_udp_write(udc, AT91_UDP_RST_EP, ep->int_mask);
 		at91_udp_write(udc, AT91_UDP_RST_EP, 0);
+		ep->fifo_loaded = 0;
 		tmp = __raw_readl(ep->creg);
 		tmp |= CLR_FX;
 		tmp &= ~(SET_FX | AT91_UDP_FORCESTALL);
@@ -105,6 +105,7 @@ struct at91_ep {
 	unsigned			is_in:1;
 	unsigned			is_iso:1;
 	unsigned			fifo_bank:1;
+	unsigned			fifo_loaded:1;	/* IN bank awaits TXPKTRDY */
 };
 
 struct at91_udc_caps {
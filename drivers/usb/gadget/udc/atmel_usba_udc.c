@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
 #include <linux/list.h>
 #include <linux/mfd/syscon.h>
 #include <linux/platform_device.h>
@@ -32,8 +33,13 @@
 
 #include "atmel_usba_udc.h"
 
+#define CREATE_TRACE_POINTS
+#include "atmel_usba_udc_trace.h"
+
 #ifdef CONFIG_USB_GADGET_DEBUG_FS
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
 #include <linux/uaccess.h>
 
 static int queue_dbg_open(struct inode *inode, struct file *file)
@@ -187,6 +193,94 @@ static int regs_dbg_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static int stats_dbg_show(struct seq_file *m, void *v)
+{
+	struct usba_ep *ep = m->private;
+	struct usba_ep_stats stats;
+	u64 now = ktime_get_ns();
+
+	spin_lock_irq(&ep->udc->lock);
+	stats = ep->stats;
+	spin_unlock_irq(&ep->udc->lock);
+
+	if (stats.idle_since)
+		stats.idle_ns += now - stats.idle_since;
+
+	seq_printf(m, "bytes:         %llu\n", stats.bytes);
+	seq_printf(m, "requests:      %u\n", stats.requests);
+	seq_printf(m, "dma_requests:  %u\n", stats.dma_requests);
+	seq_printf(m, "pio_requests:  %u\n", stats.pio_requests);
+	seq_printf(m, "short_packets: %u\n", stats.short_packets);
+	seq_printf(m, "errors:        %u\n", stats.errors);
+	seq_printf(m, "idle_us:       %llu\n", div_u64(stats.idle_ns,
+							  NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int stats_dbg_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_dbg_show, inode->i_private);
+}
+
+/* Writing anything to the file clears the counters */
+static ssize_t stats_dbg_write(struct file *file, const char __user *buf,
+		size_t nbytes, loff_t *ppos)
+{
+	struct usba_ep *ep = file_inode(file)->i_private;
+	bool idle;
+
+	spin_lock_irq(&ep->udc->lock);
+	idle = ep->stats.idle_since;
+	memset(&ep->stats, 0, sizeof(ep->stats));
+	if (idle)
+		ep->stats.idle_since = ktime_get_ns();
+	spin_unlock_irq(&ep->udc->lock);
+
+	return nbytes;
+}
+
+/* The queue of @ep is about to get @req: it is no longer idle */
+static void usba_ep_stats_queue(struct usba_ep *ep)
+{
+	struct usba_ep_stats *stats = &ep->stats;
+
+	if (stats->idle_since) {
+		stats->idle_ns += ktime_get_ns() - stats->idle_since;
+		stats->idle_since = 0;
+	}
+}
+
+static void usba_ep_stats_complete(struct usba_ep *ep,
+		struct usba_request *req)
+{
+	struct usba_ep_stats *stats = &ep->stats;
+	unsigned int actual = req->req.actual;
+
+	stats->requests++;
+	stats->bytes += actual;
+	if (req->using_dma)
+		stats->dma_requests++;
+	else
+		stats->pio_requests++;
+	if (req->req.status)
+		stats->errors++;
+	else if ((ep->ep.maxpacket && actual % ep->ep.maxpacket)
+			|| (ep->is_in ? req->req.zero : actual < req->req.length))
+		stats->short_packets++;
+
+	if (ep->ep.desc && list_empty(&ep->queue) && !stats->idle_since)
+		stats->idle_since = ktime_get_ns();
+}
+
+/* Called with @enabled set once @ep is enabled, and clear once disabled */
+static void usba_ep_stats_enable(struct usba_ep *ep, bool enabled)
+{
+	usba_ep_stats_queue(ep);
+	if (enabled)
+		ep->stats.idle_since = ktime_get_ns();
+}
+
 const struct file_operations queue_dbg_fops = {
 	.owner		= THIS_MODULE,
 	.open		= queue_dbg_open,
@@ -203,6 +297,15 @@ const struct file_operations regs_dbg_fops = {
 	.release	= regs_dbg_release,
 };
 
+const struct file_operations stats_dbg_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stats_dbg_open,
+	.read		= seq_read,
+	.write		= stats_dbg_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static void usba_ep_init_debugfs(struct usba_udc *udc,
 		struct usba_ep *ep)
 {
@@ -218,6 +321,11 @@ static void usba_ep_init_debugfs(struct usba_udc *udc,
 	if (!ep->debugfs_queue)
 		goto err_queue;
 
+	ep->debugfs_stats = debugfs_create_file("stats", 0600, ep_root,
+						ep, &stats_dbg_fops);
+	if (!ep->debugfs_stats)
+		goto err_stats;
+
 	if (ep->can_dma) {
 		ep->debugfs_dma_status
 			= debugfs_create_u32("dma_status", 0400, ep_root,
@@ -239,6 +347,8 @@ err_state:
 	if (ep->can_dma)
 		debugfs_remove(ep->debugfs_dma_status);
 err_dma_status:
+	debugfs_remove(ep->debugfs_stats);
+err_stats:
 	debugfs_remove(ep->debugfs_queue);
 err_queue:
 	debugfs_remove(ep_root);
@@ -250,9 +360,11 @@ err_root:
 static void usba_ep_cleanup_debugfs(struct usba_ep *ep)
 {
 	debugfs_remove(ep->debugfs_queue);
+	debugfs_remove(ep->debugfs_stats);
 	debugfs_remove(ep->debugfs_dma_status);
 	debugfs_remove(ep->debugfs_state);
 	debugfs_remove(ep->debugfs_dir);
+	ep->debugfs_stats = NULL;
 	ep->debugfs_dma_status = NULL;
 	ep->debugfs_dir = NULL;
 }
@@ -299,6 +411,22 @@ static void usba_cleanup_debugfs(struct usba_udc *udc)
 	udc->debugfs_root = NULL;
 }
 #else
+static inline void usba_ep_stats_queue(struct usba_ep *ep)
+{
+
+}
+
+static inline void usba_ep_stats_complete(struct usba_ep *ep,
+		struct usba_request *req)
+{
+
+}
+
+static inline void usba_ep_stats_enable(struct usba_ep *ep, bool enabled)
+{
+
+}
+
 static inline void usba_ep_init_debugfs(struct usba_udc *udc,
 					 struct usba_ep *ep)
 {
@@ -379,13 +507,57 @@ static void next_fifo_transaction(struct usba_ep *ep, struct usba_request *req)
 	req->req.actual += transaction_len;
 }
 
+/*
+ * Load @d into the channel registers. IN descriptors have LINK set, so
+ * the controller then follows the chain from NXT_DSC on its own.
+ */
+static void usba_dma_start(struct usba_ep *ep, struct usba_desc *d)
+{
+	usba_dma_writel(ep, NXT_DSC, d->hw.next);
+	usba_dma_writel(ep, ADDRESS, d->hw.addr);
+	usba_dma_writel(ep, CONTROL, d->hw.ctrl);
+}
+
+/*
+ * Append the descriptors of @req to those of @prev, the last request
+ * the channel was given. The controller copies the next pointer of a
+ * descriptor into NXT_DSC when it loads it, so if NXT_DSC still holds
+ * the null descriptor once the new link is visible, the tail of @prev
+ * was already loaded and @req has to wait for submit_next_request().
+ */
+static bool usba_dma_chain(struct usba_ep *ep, struct usba_request *prev,
+		struct usba_request *req)
+{
+	struct usba_udc *udc = ep->udc;
+
+	/* Zero-length requests and SHORT_PACKET changes need the CPU */
+	if (!prev->req.length || !req->req.length
+			|| prev->req.zero != req->req.zero)
+		return false;
+
+	prev->desc_tail->hw.next = req->desc_head->phys;
+	wmb();
+
+	if (usba_dma_readl(ep, NXT_DSC) == udc->null_desc_phys) {
+		prev->desc_tail->hw.next = udc->null_desc_phys;
+		return false;
+	}
+
+	req->submitted = 1;
+	trace_usba_submit_request(ep, req, true);
+	return true;
+}
+
 static void submit_request(struct usba_ep *ep, struct usba_request *req)
 {
+	struct usba_request *next;
+
 	DBG(DBG_QUEUE, "%s: submit_request: req %p (length %d)\n",
 		ep->ep.name, req, req->req.length);
 
 	req->req.actual = 0;
 	req->submitted = 1;
+	trace_usba_submit_request(ep, req, false);
 
 	if (req->using_dma) {
 		if (req->req.length == 0) {
@@ -398,8 +570,20 @@ static void submit_request(struct usba_ep *ep, struct usba_request *req)
 		else
 			usba_ep_writel(ep, CTL_DIS, USBA_SHORT_PACKET);
 
-		usba_dma_writel(ep, ADDRESS, req->req.dma);
-		usba_dma_writel(ep, CONTROL, req->ctrl);
+		req->desc_tail->hw.next = ep->udc->null_desc_phys;
+		req->desc_cur = req->desc_head;
+		usba_dma_start(ep, req->desc_head);
+
+		if (!ep->is_in)
+			return;
+
+		/* Let the controller move on to the requests queued behind */
+		next = req;
+		list_for_each_entry_continue(next, &ep->queue, queue) {
+			if (!usba_dma_chain(ep, req, next))
+				break;
+			req = next;
+		}
 	} else {
 		next_fifo_transaction(ep, req);
 		if (req->last_transaction) {
@@ -474,6 +658,8 @@ static void receive_data(struct usba_ep *ep)
 			req->req.status = 0;
 			list_del_init(&req->queue);
 			usba_ep_writel(ep, CTL_DIS, USBA_RX_BK_RDY);
+			trace_usba_request_complete(ep, req);
+			usba_ep_stats_complete(ep, req);
 			spin_unlock(&udc->lock);
 			usb_gadget_giveback_request(&ep->ep, &req->req);
 			spin_lock(&udc->lock);
@@ -489,6 +675,20 @@ static void receive_data(struct usba_ep *ep)
 	}
 }
 
+static void usba_dma_free_desc(struct usba_udc *udc, struct usba_request *req)
+{
+	struct usba_desc *d, *next;
+
+	for (d = req->desc_head; d; d = next) {
+		next = d->next;
+		dma_pool_free(udc->desc_pool, d, d->phys);
+	}
+
+	req->desc_head = NULL;
+	req->desc_tail = NULL;
+	req->desc_cur = NULL;
+}
+
 static void
 request_complete(struct usba_ep *ep, struct usba_request *req, int status)
 {
@@ -499,13 +699,18 @@ request_complete(struct usba_ep *ep, struct usba_request *req, int status)
 	if (req->req.status == -EINPROGRESS)
 		req->req.status = status;
 
-	if (req->using_dma)
+	if (req->using_dma) {
+		usba_dma_free_desc(udc, req);
 		usb_gadget_unmap_request(&udc->gadget, &req->req, ep->is_in);
+	}
 
 	DBG(DBG_GADGET | DBG_REQ,
 		"%s: req %p complete: status %d, actual %u\n",
 		ep->ep.name, req, req->req.status, req->req.actual);
 
+	trace_usba_request_complete(ep, req);
+	usba_ep_stats_complete(ep, req);
+
 	spin_unlock(&udc->lock);
 	usb_gadget_giveback_request(&ep->ep, &req->req);
 	spin_lock(&udc->lock);
@@ -580,11 +785,29 @@ usba_ep_enable(struct usb_ep *_ep, const struct usb_endpoint_descriptor *desc)
 		if (nr_trans > 3)
 			return -EINVAL;
 
+		/*
+		 * High-bandwidth transfers only exist at high speed, and
+		 * every transaction of a microframe needs a bank of its own.
+		 */
+		if (nr_trans > 1 && udc->gadget.speed != USB_SPEED_HIGH) {
+			DBG(DBG_ERR, "ep_enable: %s: %u transactions at %s\n",
+					ep->ep.name, nr_trans,
+					usb_speed_string(udc->gadget.speed));
+			return -EINVAL;
+		}
+		if (nr_trans > ep->nr_banks) {
+			DBG(DBG_ERR, "ep_enable: %s: %u banks, %u needed\n",
+					ep->ep.name, ep->nr_banks, nr_trans);
+			return -EINVAL;
+		}
+
 		ep->is_isoc = 1;
 		ept_cfg |= USBA_BF(EPT_TYPE, USBA_EPT_TYPE_ISO);
 
 		/*
-		 * Do triple-buffering on high-bandwidth iso endpoints.
+		 * Do triple-buffering on high-bandwidth iso endpoints, so
+		 * that the banks of a microframe can be filled or drained
+		 * while the previous ones are on the bus.
 		 */
 		if (nr_trans > 1 && ep->nr_banks == 3)
 			ept_cfg |= USBA_BF(BK_NUMBER, USBA_BK_NUMBER_TRIPLE);
@@ -605,6 +828,7 @@ usba_ep_enable(struct usb_ep *_ep, const struct usb_endpoint_descriptor *desc)
 	spin_lock_irqsave(&ep->udc->lock, flags);
 
 	ep->ep.desc = desc;
+	usba_ep_stats_enable(ep, true);
 	ep->ep.maxpacket = maxpacket;
 
 	usba_ep_writel(ep, CFG, ept_cfg);
@@ -656,6 +880,7 @@ static int usba_ep_disable(struct usb_ep *_ep)
 		return -EINVAL;
 	}
 	ep->ep.desc = NULL;
+	usba_ep_stats_enable(ep, false);
 
 	list_splice_init(&ep->queue, &req_list);
 	if (ep->can_dma) {
@@ -700,9 +925,104 @@ usba_ep_free_request(struct usb_ep *_ep, struct usb_request *_req)
 	kfree(req);
 }
 
+/*
+ * Append descriptors of at most 64 KiB covering @len bytes at @addr to
+ * the chain of @req. IN descriptors are linked, OUT descriptors are
+ * started one at a time from usba_dma_irq(): a short packet ends the
+ * transfer in whichever descriptor is loaded, and the received length
+ * could no longer be read back once the controller had moved on to the
+ * next one.
+ */
+static int usba_dma_add_buf(struct usba_udc *udc, struct usba_ep *ep,
+		struct usba_request *req, dma_addr_t addr, unsigned int left,
+		gfp_t gfp_flags)
+{
+	struct usba_desc *d, *prev = req->desc_tail;
+	dma_addr_t phys;
+	u32 len;
+
+	while (left) {
+		d = dma_pool_alloc(udc->desc_pool, gfp_flags, &phys);
+		if (!d)
+			return -ENOMEM;
+
+		len = min_t(unsigned int, left, USBA_DMA_MAX_LEN);
+
+		d->phys = phys;
+		d->len = len;
+		d->next = NULL;
+		d->hw.next = udc->null_desc_phys;
+		d->hw.addr = addr;
+		d->hw.ctrl = USBA_BF(DMA_BUF_LEN, len) | USBA_DMA_CH_EN;
+		if (ep->is_in)
+			d->hw.ctrl |= USBA_DMA_LINK;
+		else
+			d->hw.ctrl |= USBA_DMA_END_TR_EN | USBA_DMA_END_TR_IE
+					| USBA_DMA_END_BUF_IE;
+
+		if (prev) {
+			prev->next = d;
+			prev->hw.next = phys;
+		} else {
+			req->desc_head = d;
+		}
+
+		req->desc_tail = d;
+		prev = d;
+		addr += len;
+		left -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * Build the descriptor chain of @req, from its scatterlist if it has
+ * one. Packets may straddle two descriptors, so only the end of the
+ * last buffer is allowed to close a packet, and for IN to interrupt.
+ */
+static int usba_dma_prep(struct usba_udc *udc, struct usba_ep *ep,
+		struct usba_request *req, gfp_t gfp_flags)
+{
+	struct scatterlist *sg;
+	unsigned int i;
+	int ret = 0;
+
+	req->desc_head = NULL;
+	req->desc_tail = NULL;
+
+	if (req->req.num_mapped_sgs) {
+		for_each_sg(req->req.sg, sg, req->req.num_mapped_sgs, i) {
+			ret = usba_dma_add_buf(udc, ep, req, sg_dma_address(sg),
+					       sg_dma_len(sg), gfp_flags);
+			if (ret)
+				break;
+		}
+	} else {
+		ret = usba_dma_add_buf(udc, ep, req, req->req.dma,
+				       req->req.length, gfp_flags);
+	}
+
+	if (ret) {
+		usba_dma_free_desc(udc, req);
+		return ret;
+	}
+
+	if (req->desc_tail) {
+		req->desc_tail->hw.ctrl |= USBA_DMA_END_BUF_EN;
+		if (ep->is_in)
+			req->desc_tail->hw.ctrl |= USBA_DMA_END_BUF_IE;
+	}
+
+	req->desc_cur = req->desc_head;
+
+	return 0;
+}
+
 static int queue_dma(struct usba_udc *udc, struct usba_ep *ep,
 		struct usba_request *req, gfp_t gfp_flags)
 {
+	struct usba_request *prev;
 	unsigned long flags;
 	int ret;
 
@@ -712,23 +1032,17 @@ static int queue_dma(struct usba_udc *udc, struct usba_ep *ep,
 		req->req.short_not_ok ? 'S' : 's',
 		req->req.no_interrupt ? 'I' : 'i');
 
-	if (req->req.length > 0x10000) {
-		/* Lengths from 0 to 65536 (inclusive) are supported */
-		DBG(DBG_ERR, "invalid request length %u\n", req->req.length);
-		return -EINVAL;
-	}
-
 	ret = usb_gadget_map_request(&udc->gadget, &req->req, ep->is_in);
 	if (ret)
 		return ret;
 
-	req->using_dma = 1;
-	req->ctrl = USBA_BF(DMA_BUF_LEN, req->req.length)
-			| USBA_DMA_CH_EN | USBA_DMA_END_BUF_IE
-			| USBA_DMA_END_BUF_EN;
+	ret = usba_dma_prep(udc, ep, req, gfp_flags);
+	if (ret) {
+		usb_gadget_unmap_request(&udc->gadget, &req->req, ep->is_in);
+		return ret;
+	}
 
-	if (!ep->is_in)
-		req->ctrl |= USBA_DMA_END_TR_EN | USBA_DMA_END_TR_IE;
+	req->using_dma = 1;
 
 	/*
 	 * Add this request to the queue and submit for DMA if
@@ -738,14 +1052,23 @@ static int queue_dma(struct usba_udc *udc, struct usba_ep *ep,
 	ret = -ESHUTDOWN;
 	spin_lock_irqsave(&udc->lock, flags);
 	if (ep->ep.desc) {
-		if (list_empty(&ep->queue))
-			submit_request(ep, req);
-
+		usba_ep_stats_queue(ep);
 		list_add_tail(&req->queue, &ep->queue);
+
+		prev = list_entry(req->queue.prev, struct usba_request, queue);
+		if (ep->queue.next == &req->queue)
+			submit_request(ep, req);
+		else if (ep->is_in && prev->submitted)
+			usba_dma_chain(ep, prev, req);
 		ret = 0;
 	}
 	spin_unlock_irqrestore(&udc->lock, flags);
 
+	if (ret) {
+		usba_dma_free_desc(udc, req);
+		usb_gadget_unmap_request(&udc->gadget, &req->req, ep->is_in);
+	}
+
 	return ret;
 }
 
@@ -765,6 +1088,10 @@ usba_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 	    !ep->ep.desc)
 		return -ESHUTDOWN;
 
+	/* The FIFO copies only know about req->buf */
+	if (_req->num_sgs && !ep->can_dma)
+		return -EINVAL;
+
 	req->submitted = 0;
 	req->using_dma = 0;
 	req->last_transaction = 0;
@@ -779,6 +1106,7 @@ usba_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 	ret = -ESHUTDOWN;
 	spin_lock_irqsave(&udc->lock, flags);
 	if (ep->ep.desc) {
+		usba_ep_stats_queue(ep);
 		list_add_tail(&req->queue, &ep->queue);
 
 		if ((!ep_is_control(ep) && ep->is_in) ||
@@ -798,7 +1126,10 @@ usba_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 static void
 usba_update_req(struct usba_ep *ep, struct usba_request *req, u32 status)
 {
-	req->req.actual = req->req.length - USBA_BFEXT(DMA_BUF_LEN, status);
+	struct usba_desc *d = req->desc_cur;
+
+	if (d)
+		req->req.actual += d->len - USBA_BFEXT(DMA_BUF_LEN, status);
 }
 
 static int stop_dma(struct usba_ep *ep, u32 *pstatus)
@@ -833,11 +1164,117 @@ static int stop_dma(struct usba_ep *ep, u32 *pstatus)
 	return 0;
 }
 
+/*
+ * Move the IN requests the channel is done with to @done. Unless it is
+ * @idle, the channel is working on the descriptor whose next pointer it
+ * loaded into NXT_DSC; that one is recorded in desc_cur of its request.
+ */
+static void usba_dma_collect(struct usba_ep *ep, bool idle,
+		struct list_head *done)
+{
+	struct usba_request *req, *tmp_req;
+	struct usba_desc *d;
+	u32 nxt = usba_dma_readl(ep, NXT_DSC);
+
+	list_for_each_entry_safe(req, tmp_req, &ep->queue, queue) {
+		if (!req->submitted || !req->req.length)
+			break;
+
+		if (!idle) {
+			for (d = req->desc_head; d; d = d->next)
+				if (d->hw.next == nxt)
+					break;
+			if (d) {
+				req->desc_cur = d;
+				break;
+			}
+		}
+
+		req->req.actual = req->req.length;
+		req->submitted = 0;
+		list_move_tail(&req->queue, done);
+	}
+}
+
+/*
+ * Take the submitted IN request @req off the channel. Requests it had
+ * already finished go to @done, and the channel resumes with the rest
+ * of the chain unless @req was the one in progress.
+ */
+static void usba_dma_dequeue(struct usba_ep *ep, struct usba_request *req,
+		struct list_head *done)
+{
+	struct usba_udc *udc = ep->udc;
+	struct usba_request *cur, *prev;
+	struct usba_desc *d, *t;
+	u32 status, remaining;
+	bool idle;
+
+	status = usba_dma_readl(ep, STATUS);
+	idle = !(status & USBA_DMA_CH_EN);
+	if (!idle)
+		stop_dma(ep, &status);
+
+#ifdef CONFIG_USB_GADGET_DEBUG_FS
+	ep->last_dma_status = status;
+#endif
+
+	usba_dma_collect(ep, idle, done);
+	if (idle || list_empty(&ep->queue))
+		return;
+
+	cur = list_entry(ep->queue.next, struct usba_request, queue);
+	if (!cur->submitted)
+		return;
+
+	d = cur->desc_cur;
+	remaining = USBA_BFEXT(DMA_BUF_LEN, status);
+	/* BUF_LEN reads 0 for an unstarted 64 KiB buffer, too */
+	if (!remaining && usba_dma_readl(ep, ADDRESS) == d->hw.addr)
+		remaining = d->len;
+
+	if (cur == req) {
+		req->req.actual = d->len - remaining;
+		for (t = req->desc_head; t != d; t = t->next)
+			req->req.actual += t->len;
+		usba_writel(udc, EPT_RST, 1 << ep->index);
+
+		/* The requests chained behind it start over */
+		list_for_each_entry_continue(cur, &ep->queue, queue)
+			cur->submitted = 0;
+		return;
+	}
+
+	if (req->submitted) {
+		prev = list_entry(req->queue.prev, struct usba_request, queue);
+		prev->desc_tail->hw.next = req->desc_tail->hw.next;
+		if (d == prev->desc_tail)
+			usba_dma_writel(ep, NXT_DSC, prev->desc_tail->hw.next);
+		req->submitted = 0;
+	}
+
+	if (remaining) {
+		usba_dma_writel(ep, CONTROL,
+				USBA_BFINS(DMA_BUF_LEN, remaining, d->hw.ctrl));
+	} else if (d->next) {
+		cur->desc_cur = d->next;
+		usba_dma_start(ep, d->next);
+	} else {
+		/* Stopped right at the end of cur, restart from the next one */
+		cur->req.actual = cur->req.length;
+		cur->submitted = 0;
+		list_move_tail(&cur->queue, done);
+		list_for_each_entry(cur, &ep->queue, queue)
+			cur->submitted = 0;
+	}
+}
+
 static int usba_ep_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 {
 	struct usba_ep *ep = to_usba_ep(_ep);
 	struct usba_udc *udc = ep->udc;
 	struct usba_request *req;
+	LIST_HEAD(req_list);
 	unsigned long flags;
 	u32 status;
 
@@ -861,7 +1298,9 @@ static int usba_ep_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 		 * If this request is currently being transferred,
 		 * stop the DMA controller and reset the FIFO.
 		 */
-		if (ep->queue.next == &req->queue) {
+		if (ep->is_in && req->submitted && req->req.length) {
+			usba_dma_dequeue(ep, req, &req_list);
+		} else if (ep->queue.next == &req->queue) {
 			status = usba_dma_readl(ep, STATUS);
 			if (status & USBA_DMA_CH_EN)
 				stop_dma(ep, &status);
@@ -882,6 +1321,7 @@ static int usba_ep_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 	 */
 	list_del_init(&req->queue);
 
+	request_complete_list(ep, &req_list, 0);
 	request_complete(ep, req, -ECONNRESET);
 
 	/* Process the next request if any */
@@ -1030,6 +1470,7 @@ static struct usb_endpoint_descriptor usba_ep0_desc = {
 static struct usb_gadget usba_gadget_template = {
 	.ops		= &usba_udc_ops,
 	.max_speed	= USB_SPEED_HIGH,
+	.sg_supported	= true,
 	.name		= "atmel_usba_udc",
 };
 
@@ -1589,6 +2030,8 @@ static void usba_ep_irq(struct usba_udc *udc, struct usba_ep *ep)
 static void usba_dma_irq(struct usba_udc *udc, struct usba_ep *ep)
 {
 	struct usba_request *req;
+	struct usba_desc *d;
+	LIST_HEAD(req_list);
 	u32 status, control, pending;
 
 	status = usba_dma_readl(ep, STATUS);
@@ -1596,10 +2039,12 @@ static void usba_dma_irq(struct usba_udc *udc, struct usba_ep *ep)
 #ifdef CONFIG_USB_GADGET_DEBUG_FS
 	ep->last_dma_status = status;
 #endif
+	trace_usba_dma_irq(ep, status, control);
 	pending = status & control;
 	DBG(DBG_INT | DBG_DMA, "dma irq, s/%#08x, c/%#08x\n", status, control);
 
-	if (status & USBA_DMA_CH_EN) {
+	/* A chained IN channel keeps running into the next request */
+	if (!ep->is_in && (status & USBA_DMA_CH_EN)) {
 		dev_err(&udc->pdev->dev,
 			"DMA_CH_EN is set after transfer is finished!\n");
 		dev_err(&udc->pdev->dev,
@@ -1616,10 +2061,34 @@ static void usba_dma_irq(struct usba_udc *udc, struct usba_ep *ep)
 		/* Might happen if a reset comes along at the right moment */
 		return;
 
+	/*
+	 * CONTROL holds whichever IN descriptor got loaded last, possibly
+	 * the null one, so its interrupt enables say nothing about what
+	 * just ended.
+	 */
+	if (ep->is_in) {
+		if (!(status & USBA_DMA_END_BUF_ST))
+			return;
+
+		usba_dma_collect(ep, !(status & USBA_DMA_CH_EN), &req_list);
+		if (!(status & USBA_DMA_CH_EN))
+			submit_next_request(ep);
+		request_complete_list(ep, &req_list, 0);
+		return;
+	}
+
 	if (pending & (USBA_DMA_END_TR_ST | USBA_DMA_END_BUF_ST)) {
 		req = list_entry(ep->queue.next, struct usba_request, queue);
 		usba_update_req(ep, req, status);
 
+		/* Buffer full without a short packet, go on with the next one */
+		d = req->desc_cur;
+		if (!(pending & USBA_DMA_END_TR_ST) && d && d->next) {
+			req->desc_cur = d->next;
+			usba_dma_start(ep, d->next);
+			return;
+		}
+
 		list_del_init(&req->queue);
 		submit_next_request(ep);
 		request_complete(ep, req, 0);
@@ -2107,6 +2576,22 @@ static int usba_udc_probe(struct platform_device *pdev)
 	udc->hclk = hclk;
 	udc->vbus_pin = -ENODEV;
 
+	udc->desc_pool = dmam_pool_create("atmel_usba_desc", &pdev->dev,
+					  sizeof(struct usba_desc), 16, 0);
+	if (!udc->desc_pool)
+		return -ENOMEM;
+
+	udc->null_desc = dmam_alloc_coherent(&pdev->dev,
+					     sizeof(*udc->null_desc),
+					     &udc->null_desc_phys, GFP_KERNEL);
+	if (!udc->null_desc)
+		return -ENOMEM;
+
+	/* Loading it clears CH_EN, and it must never be linked to anything */
+	udc->null_desc->next = udc->null_desc_phys;
+	udc->null_desc->addr = 0;
+	udc->null_desc->ctrl = 0;
+
 	ret = -ENOMEM;
 	udc->regs = devm_ioremap(&pdev->dev, regs->start, resource_size(regs));
 	if (!udc->regs) {
@@ -275,6 +275,36 @@ struct usba_dma_desc {
 	u32 ctrl;
 };
 
+/* Lengths from 1 to 65536 (inclusive) fit in a descriptor */
+#define USBA_DMA_MAX_LEN	0x10000
+
+/*
+ * A descriptor as fetched by the DMA controller, followed by what the
+ * driver needs to walk and free the chain of a request.
+ */
+struct usba_desc {
+	struct usba_dma_desc			hw;
+	dma_addr_t				phys;
+	u32					len;
+	struct usba_desc			*next;
+};
+
+/*
+ * Per-endpoint counters, in the "stats" debugfs file. @idle_ns is the time
+ * the endpoint was enabled with no request queued, when the controller NAKs
+ * the host: the gadget function is the one holding the transfers back then.
+ */
+struct usba_ep_stats {
+	u64					bytes;
+	u64					idle_ns;
+	u64					idle_since;
+	u32					requests;
+	u32					dma_requests;
+	u32					pio_requests;
+	u32					short_packets;
+	u32					errors;
+};
+
 struct usba_ep {
 	int					state;
 	void __iomem				*ep_regs;
@@ -299,6 +329,8 @@ struct usba_ep {
 	struct dentry				*debugfs_queue;
 	struct dentry				*debugfs_dma_status;
 	struct dentry				*debugfs_state;
+	struct dentry				*debugfs_stats;
+	struct usba_ep_stats			stats;
 #endif
 };
 
@@ -306,7 +338,10 @@ struct usba_request {
 	struct usb_request			req;
 	struct list_head			queue;
 
-	u32					ctrl;
+	/* DMA descriptors, desc_cur is the one an OUT transfer is at */
+	struct usba_desc			*desc_head;
+	struct usba_desc			*desc_tail;
+	struct usba_desc			*desc_cur;
 
 	unsigned int				submitted:1;
 	unsigned int				last_transaction:1;
@@ -356,6 +391,11 @@ struct usba_udc {
 #endif
 
 	struct regmap *pmc;
+
+	struct dma_pool *desc_pool;
+	/* IN chains end on this disabled descriptor, see usba_dma_chain() */
+	struct usba_dma_desc *null_desc;
+	dma_addr_t null_desc_phys;
 };
 
 static inline struct usba_ep *to_usba_ep(struct usb_ep *ep)
@@ -0,0 +1,110 @@
+/*
+ * Tracepoints for the Atmel USBA high speed USB device controller
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM usba_udc
+
+#if !defined(__ATMEL_USBA_UDC_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __ATMEL_USBA_UDC_TRACE_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include "atmel_usba_udc.h"
+
+TRACE_EVENT(usba_submit_request,
+
+	TP_PROTO(struct usba_ep *ep, struct usba_request *req, bool chained),
+
+	TP_ARGS(ep, req, chained),
+
+	TP_STRUCT__entry(
+		__string(	name,		ep->ep.name	)
+		__field(	void *,		req		)
+		__field(	unsigned int,	length		)
+		__field(	bool,		dma		)
+		__field(	bool,		zero		)
+		__field(	bool,		chained		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, ep->ep.name);
+		__entry->req = req;
+		__entry->length = req->req.length;
+		__entry->dma = req->using_dma;
+		__entry->zero = req->req.zero;
+		__entry->chained = chained;
+	),
+
+	TP_printk("%s: req %p length %u%s%s%s", __get_str(name),
+		  __entry->req, __entry->length,
+		  __entry->dma ? " dma" : " pio",
+		  __entry->zero ? " zlp" : "",
+		  __entry->chained ? " chained" : "")
+);
+
+TRACE_EVENT(usba_dma_irq,
+
+	TP_PROTO(struct usba_ep *ep, u32 status, u32 control),
+
+	TP_ARGS(ep, status, control),
+
+	TP_STRUCT__entry(
+		__string(	name,		ep->ep.name	)
+		__field(	u32,		status		)
+		__field(	u32,		control		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, ep->ep.name);
+		__entry->status = status;
+		__entry->control = control;
+	),
+
+	TP_printk("%s: status %08x control %08x", __get_str(name),
+		  __entry->status, __entry->control)
+);
+
+TRACE_EVENT(usba_request_complete,
+
+	TP_PROTO(struct usba_ep *ep, struct usba_request *req),
+
+	TP_ARGS(ep, req),
+
+	TP_STRUCT__entry(
+		__string(	name,		ep->ep.name	)
+		__field(	void *,		req		)
+		__field(	unsigned int,	actual		)
+		__field(	unsigned int,	length		)
+		__field(	int,		status		)
+		__field(	bool,		dma		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, ep->ep.name);
+		__entry->req = req;
+		__entry->actual = req->req.actual;
+		__entry->length = req->req.length;
+		__entry->status = req->req.status;
+		__entry->dma = req->using_dma;
+	),
+
+	TP_printk("%s: req %p %u/%u status %d%s", __get_str(name),
+		  __entry->req, __entry->actual, __entry->length,
+		  __entry->status, __entry->dma ? " dma" : " pio")
+);
+
+#endif /* __ATMEL_USBA_UDC_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE atmel_usba_udc_trace
+
+#include <trace/define_trace.h>
@@ -15,6 +15,7 @@
 #include <linux/dma-mapping.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_platform.h>
@@ -36,12 +37,45 @@ struct atmel_ehci_priv {
 	struct clk *iclk;
 	struct clk *uclk;
 	bool clocked;
+	u32 irq_thresh;		/* microframes, 0 keeps the ehci-hcd default */
+	u32 park;		/* async park count, 0 keeps the default */
 };
 
 static struct hc_driver __read_mostly ehci_atmel_hc_driver;
 
+/*
+ * Apply the board's interrupt threshold and async park mode on top of
+ * what ehci_setup() derived from the ehci-hcd module parameters.  Fewer
+ * interrupts per microframe matter with network dongles and storage.
+ */
+static int ehci_atmel_setup(struct usb_hcd *hcd)
+{
+	struct ehci_hcd *ehci = hcd_to_ehci(hcd);
+	struct atmel_ehci_priv *atmel_ehci = hcd_to_atmel_ehci_priv(hcd);
+	u32 hcc_params;
+	int retval;
+
+	retval = ehci_setup(hcd);
+	if (retval)
+		return retval;
+
+	if (atmel_ehci->irq_thresh) {
+		ehci->command &= ~(0xff << 16);
+		ehci->command |= atmel_ehci->irq_thresh << 16;
+	}
+
+	hcc_params = ehci_readl(ehci, &ehci->caps->hcc_params);
+	if (atmel_ehci->park && HCC_CANPARK(hcc_params)) {
+		ehci->command &= ~(CMD_PARK | (3 << 8));
+		ehci->command |= CMD_PARK | (atmel_ehci->park << 8);
+	}
+
+	return 0;
+}
+
 static const struct ehci_driver_overrides ehci_atmel_drv_overrides __initconst = {
 	.extra_priv_size = sizeof(struct atmel_ehci_priv),
+	.reset = ehci_atmel_setup,
 };
 
 /*-------------------------------------------------------------------------*/
@@ -84,6 +118,32 @@ static void atmel_stop_ehci(struct platform_device *pdev)
 	atmel_stop_clock(atmel_ehci);
 }
 
+static void atmel_ehci_of_init(struct platform_device *pdev,
+			       struct atmel_ehci_priv *atmel_ehci)
+{
+	struct device_node *np = pdev->dev.of_node;
+	u32 val;
+
+	if (!np)
+		return;
+
+	/* ITC only takes 1, 2, 4, 8, 16, 32 or 64 microframes */
+	if (!of_property_read_u32(np, "atmel,irq-threshold-uframes", &val)) {
+		if (val && val <= 64 && is_power_of_2(val))
+			atmel_ehci->irq_thresh = val;
+		else
+			dev_warn(&pdev->dev, "invalid irq threshold %u\n", val);
+	}
+
+	if (!of_property_read_u32(np, "atmel,async-park", &val)) {
+		if (val && val <= 3)
+			atmel_ehci->park = val;
+		else
+			dev_warn(&pdev->dev, "invalid async park count %u\n",
+				 val);
+	}
+}
+
 /*-------------------------------------------------------------------------*/
 
 static int ehci_atmel_drv_probe(struct platform_device *pdev)
@@ -124,6 +184,7 @@ static int ehci_atmel_drv_probe(struct platform_device *pdev)
 		goto fail_create_hcd;
 	}
 	atmel_ehci = hcd_to_atmel_ehci_priv(hcd);
+	atmel_ehci_of_init(pdev, atmel_ehci);
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	hcd->regs = devm_ioremap_resource(&pdev->dev, res);
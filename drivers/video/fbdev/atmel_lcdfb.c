@@ -25,6 +25,7 @@
 #include <linux/of_gpio.h>
 #include <video/of_display_timing.h>
 #include <linux/regulator/consumer.h>
+#include <linux/wait.h>
 #include <video/videomode.h>
 
 #include <asm/gpio.h>
@@ -45,6 +46,11 @@ struct atmel_lcdfb_info {
 	int			irq_base;
 	struct work_struct	task;
 
+	/* end of frame interrupt, enabled while someone waits for it */
+	wait_queue_head_t	vsync_wait;
+	unsigned int		vsync_count;
+	unsigned int		vsync_users;
+
 	unsigned int		smem_len;
 	struct platform_device	*pdev;
 	struct clk		*bus_clk;
@@ -78,6 +84,9 @@ struct atmel_lcdfb_power_ctrl_gpio {
 #define ATMEL_LCDC_DMA_BURST_LEN	8	/* words */
 #define ATMEL_LCDC_FIFO_SIZE		512	/* words */
 
+#define ATMEL_LCDC_ERROR_IRQS	(ATMEL_LCDC_UFLWI | ATMEL_LCDC_OWRI \
+				 | ATMEL_LCDC_MERI)
+
 static struct atmel_lcdfb_config at91sam9261_config = {
 	.have_hozval		= true,
 	.have_intensity_bit	= true,
@@ -758,8 +767,9 @@ static int atmel_lcdfb_set_par(struct fb_info *info)
 
 	/* Disable all interrupts */
 	lcdc_writel(sinfo, ATMEL_LCDC_IDR, ~0UL);
-	/* Enable FIFO & DMA errors */
-	lcdc_writel(sinfo, ATMEL_LCDC_IER, ATMEL_LCDC_UFLWI | ATMEL_LCDC_OWRI | ATMEL_LCDC_MERI);
+	/* Enable FIFO & DMA errors, and end of frame for vsync waiters */
+	lcdc_writel(sinfo, ATMEL_LCDC_IER, ATMEL_LCDC_ERROR_IRQS
+		    | (sinfo->vsync_users ? ATMEL_LCDC_EOFI : 0));
 
 	/* ...wait for DMA engine to become idle... */
 	while (lcdc_readl(sinfo, ATMEL_LCDC_DMACON) & ATMEL_LCDC_DMABUSY)
@@ -875,6 +885,38 @@ static int atmel_lcdfb_setcolreg(unsigned int regno, unsigned int red,
 	return ret;
 }
 
+/*
+ * The DMA controller latches its base address when it starts fetching a
+ * frame, so once the end of frame that follows an address update has been
+ * seen, the previous buffer is no longer scanned out.
+ */
+static int atmel_lcdfb_wait_for_vsync(struct atmel_lcdfb_info *sinfo)
+{
+	unsigned int count;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&sinfo->lock, flags);
+	count = sinfo->vsync_count;
+	if (!sinfo->vsync_users++)
+		lcdc_writel(sinfo, ATMEL_LCDC_IER, ATMEL_LCDC_EOFI);
+	spin_unlock_irqrestore(&sinfo->lock, flags);
+
+	ret = wait_event_interruptible_timeout(sinfo->vsync_wait,
+					       count != ACCESS_ONCE(sinfo->vsync_count),
+					       msecs_to_jiffies(100));
+
+	spin_lock_irqsave(&sinfo->lock, flags);
+	if (!--sinfo->vsync_users)
+		lcdc_writel(sinfo, ATMEL_LCDC_IDR, ATMEL_LCDC_EOFI);
+	spin_unlock_irqrestore(&sinfo->lock, flags);
+
+	if (ret < 0)
+		return ret;
+
+	return ret ? 0 : -ETIMEDOUT;
+}
+
 static int atmel_lcdfb_pan_display(struct fb_var_screeninfo *var,
 			       struct fb_info *info)
 {
@@ -882,9 +924,32 @@ static int atmel_lcdfb_pan_display(struct fb_var_screeninfo *var,
 
 	atmel_lcdfb_update_dma(info, var);
 
+	/* Double buffering: return once the new buffer is scanned out */
+	if (var->activate & FB_ACTIVATE_VBL)
+		return atmel_lcdfb_wait_for_vsync(info->par);
+
 	return 0;
 }
 
+static int atmel_lcdfb_ioctl(struct fb_info *info, unsigned int cmd,
+			     unsigned long arg)
+{
+	u32 crtc;
+
+	switch (cmd) {
+	case FBIO_WAITFORVSYNC:
+		if (get_user(crtc, (u32 __user *)arg))
+			return -EFAULT;
+
+		if (crtc)
+			return -ENODEV;
+
+		return atmel_lcdfb_wait_for_vsync(info->par);
+	}
+
+	return -ENOIOCTLCMD;
+}
+
 static int atmel_lcdfb_blank(int blank_mode, struct fb_info *info)
 {
 	struct atmel_lcdfb_info *sinfo = info->par;
@@ -915,6 +980,7 @@ static struct fb_ops atmel_lcdfb_ops = {
 	.fb_setcolreg	= atmel_lcdfb_setcolreg,
 	.fb_blank	= atmel_lcdfb_blank,
 	.fb_pan_display	= atmel_lcdfb_pan_display,
+	.fb_ioctl	= atmel_lcdfb_ioctl,
 	.fb_fillrect	= cfb_fillrect,
 	.fb_copyarea	= cfb_copyarea,
 	.fb_imageblit	= cfb_imageblit,
@@ -932,6 +998,10 @@ static irqreturn_t atmel_lcdfb_interrupt(int irq, void *dev_id)
 		/* reset DMA and FIFO to avoid screen shifting */
 		schedule_work(&sinfo->task);
 	}
+	if (status & ATMEL_LCDC_EOFI) {
+		sinfo->vsync_count++;
+		wake_up_interruptible(&sinfo->vsync_wait);
+	}
 	lcdc_writel(sinfo, ATMEL_LCDC_ICR, status);
 	return IRQ_HANDLED;
 }
@@ -1316,6 +1386,8 @@ static int __init atmel_lcdfb_probe(struct platform_device *pdev)
 	/* Some operations on the LCDC might sleep and
 	 * require a preemptible task context */
 	INIT_WORK(&sinfo->task, atmel_lcdfb_task);
+	spin_lock_init(&sinfo->lock);
+	init_waitqueue_head(&sinfo->vsync_wait);
 
 	ret = atmel_lcdfb_init_fbinfo(sinfo);
 	if (ret < 0) {
@@ -1448,8 +1520,7 @@ static int atmel_lcdfb_resume(struct platform_device *pdev)
 	lcdc_writel(sinfo, ATMEL_LCDC_CONTRAST_CTR, sinfo->saved_lcdcon);
 
 	/* Enable FIFO & DMA errors */
-	lcdc_writel(sinfo, ATMEL_LCDC_IER, ATMEL_LCDC_UFLWI
-			| ATMEL_LCDC_OWRI | ATMEL_LCDC_MERI);
+	lcdc_writel(sinfo, ATMEL_LCDC_IER, ATMEL_LCDC_ERROR_IRQS);
 
 	return 0;
 }
@@ -497,7 +497,73 @@ out:
 	return 0;
 }
 
+#ifdef CONFIG_SQUASHFS_FILE_DIRECT
+/*
+ * The read-ahead window is handed over a datablock at a time: its pages
+ * are added to the page cache and decompressed into together, rather
+ * than through one readpage call grabbing its neighbours.  Fragments,
+ * sparse blocks and failed reads go page by page through readpage.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	struct page **batch;
+	int i, n;
+
+	batch = kmalloc_array(1 << shift, sizeof(*batch), GFP_KERNEL);
+	if (batch == NULL)
+		return -ENOMEM;
+
+	/* pages are listed in descending index order */
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+		int index = page->index >> shift;
+		int bsize = 0;
+		u64 block = 0;
+
+		for (n = 0; !list_empty(pages); ) {
+			page = list_entry(pages->prev, struct page, lru);
+			if (page->index >> shift != index)
+				break;
+
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+						  GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+			batch[n++] = page;
+		}
+
+		if (n == 0)
+			continue;
+
+		if (index < file_end || squashfs_i(inode)->fragment_block ==
+						SQUASHFS_INVALID_BLK)
+			bsize = read_blocklist(inode, index, &block);
+
+		if (bsize <= 0 ||
+		    squashfs_readpages_block(batch, n, block, bsize))
+			for (i = 0; i < n; i++)
+				squashfs_readpage(file, batch[i]);
+
+		for (i = 0; i < n; i++)
+			page_cache_release(batch[i]);
+	}
+
+	kfree(batch);
+	return 0;
+}
+#endif
+
 
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+#ifdef CONFIG_SQUASHFS_FILE_DIRECT
+	.readpages = squashfs_readpages,
+#endif
 };
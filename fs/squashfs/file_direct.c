@@ -20,22 +20,31 @@
 #include "squashfs.h"
 #include "page_actor.h"
 
-static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
+static int squashfs_read_cache(struct inode *inode, u64 block, int bsize,
 	int pages, struct page **page);
 
-/* Read separately compressed datablock directly into page cache */
-int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
-
+/*
+ * Read separately compressed datablock directly into page cache.
+ *
+ * The caller's pages, locked, in ascending index order and all within the
+ * block, are filled together with every other page of the block not in
+ * the page cache yet.  Pages which can't be had (reclaimed, uptodate, or
+ * locked by someone racing with us) are decompressed into a scratch page,
+ * so there is no need for an intermediate buffer.  On success all the
+ * pages are uptodate and unlocked; on error the caller's pages are left
+ * locked for it to deal with.  The caller's references are not dropped.
+ */
+static int squashfs_read_direct(struct inode *inode, u64 block, int bsize,
+	struct page **own, int n_own)
 {
-	struct inode *inode = target_page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
-
+	struct address_space *mapping = own[0]->mapping;
 	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
 	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
-	int start_index = target_page->index & ~mask;
+	int start_index = own[0]->index & ~mask;
 	int end_index = start_index | mask;
-	int i, n, pages, missing_pages, bytes, res = -ENOMEM;
-	struct page **page;
+	int i, n, o, pages, missing_pages, bytes, res = -ENOMEM;
+	struct page **page, *hole = NULL;
 	struct squashfs_page_actor *actor;
 	void *pageaddr;
 
@@ -56,37 +65,40 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 	if (actor == NULL)
 		goto out;
 
-	/* Try to grab all the pages covered by the Squashfs block */
-	for (missing_pages = 0, i = 0, n = start_index; i < pages; i++, n++) {
-		page[i] = (n == target_page->index) ? target_page :
-			grab_cache_page_nowait(target_page->mapping, n);
-
-		if (page[i] == NULL) {
-			missing_pages++;
+	/*
+	 * Try to grab all the pages covered by the Squashfs block, each
+	 * holding a reference dropped below, the caller's too.
+	 */
+	for (missing_pages = 0, o = 0, i = 0, n = start_index; i < pages;
+			i++, n++) {
+		if (o < n_own && own[o]->index == n) {
+			page[i] = own[o++];
+			page_cache_get(page[i]);
 			continue;
 		}
 
-		if (PageUptodate(page[i])) {
+		page[i] = grab_cache_page_nowait(mapping, n);
+		if (page[i] && PageUptodate(page[i])) {
 			unlock_page(page[i]);
 			page_cache_release(page[i]);
 			page[i] = NULL;
-			missing_pages++;
+		}
+
+		if (page[i] == NULL) {
+			if (missing_pages++ == 0)
+				hole = alloc_page(GFP_KERNEL);
+			page[i] = hole;
 		}
 	}
 
-	if (missing_pages) {
+	if (missing_pages && hole == NULL) {
 		/*
-		 * Couldn't get one or more pages, this page has either
-		 * been VM reclaimed, but others are still in the page cache
-		 * and uptodate, or we're racing with another thread in
-		 * squashfs_readpage also trying to grab them.  Fall back to
+		 * No scratch page for the missing ones, fall back to
 		 * using an intermediate buffer.
 		 */
-		res = squashfs_read_cache(target_page, block, bsize, pages,
-								page);
+		res = squashfs_read_cache(inode, block, bsize, pages, page);
 		if (res < 0)
 			goto mark_errored;
-
 		goto out;
 	}
 
@@ -97,7 +109,7 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 
 	/* Last page may have trailing bytes not filled */
 	bytes = res % PAGE_CACHE_SIZE;
-	if (bytes) {
+	if (bytes && page[pages - 1] != hole) {
 		pageaddr = kmap_atomic(page[pages - 1]);
 		memset(pageaddr + bytes, 0, PAGE_CACHE_SIZE - bytes);
 		kunmap_atomic(pageaddr);
@@ -105,25 +117,30 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 
 	/* Mark pages as uptodate, unlock and release */
 	for (i = 0; i < pages; i++) {
+		if (page[i] == hole)
+			continue;
 		flush_dcache_page(page[i]);
 		SetPageUptodate(page[i]);
 		unlock_page(page[i]);
-		if (page[i] != target_page)
-			page_cache_release(page[i]);
+		page_cache_release(page[i]);
 	}
 
-	kfree(actor);
-	kfree(page);
-
-	return 0;
+	res = 0;
+	goto out;
 
 mark_errored:
-	/* Decompression failed, mark pages as errored.  Target_page is
-	 * dealt with by the caller
+	/*
+	 * Decompression failed, mark pages as errored.  The caller's
+	 * pages are dealt with by the caller
 	 */
-	for (i = 0; i < pages; i++) {
-		if (page[i] == NULL || page[i] == target_page)
+	for (o = 0, i = 0; i < pages; i++) {
+		if (page[i] == NULL || page[i] == hole)
 			continue;
+		if (o < n_own && page[i] == own[o]) {
+			o++;
+			page_cache_release(page[i]);
+			continue;
+		}
 		flush_dcache_page(page[i]);
 		SetPageError(page[i]);
 		unlock_page(page[i]);
@@ -131,16 +148,34 @@ mark_errored:
 	}
 
 out:
+	if (hole)
+		__free_page(hole);
 	kfree(actor);
 	kfree(page);
 	return res;
 }
 
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+{
+	return squashfs_read_direct(target_page->mapping->host, block, bsize,
+				    &target_page, 1);
+}
+
+/*
+ * Read-ahead: fill the pages of the read-ahead window falling into one
+ * datablock with a single decompression.
+ */
+int squashfs_readpages_block(struct page **page, int pages, u64 block,
+	int bsize)
+{
+	return squashfs_read_direct(page[0]->mapping->host, block, bsize,
+				    page, pages);
+}
+
 
-static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
+static int squashfs_read_cache(struct inode *i, u64 block, int bsize,
 	int pages, struct page **page)
 {
-	struct inode *i = target_page->mapping->host;
 	struct squashfs_cache_entry *buffer = squashfs_get_datablock(i->i_sb,
 						 block, bsize);
 	int bytes = buffer->length, res = buffer->error, n, offset = 0;
@@ -166,8 +201,7 @@ static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
 		flush_dcache_page(page[n]);
 		SetPageUptodate(page[n]);
 		unlock_page(page[n]);
-		if (page[n] != target_page)
-			page_cache_release(page[n]);
+		page_cache_release(page[n]);
 	}
 
 out:
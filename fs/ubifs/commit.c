@@ -279,10 +279,9 @@ out:
  * This function implements various file-system background activities:
  * o when a write-buffer timer expires it synchronizes the appropriate
  *   write-buffer;
- * o when the journal is about to be full, it starts in-advance commit.
- *
- * Note, other stuff like background garbage collection may be added here in
- * future.
+ * o when the journal is about to be full, it starts in-advance commit;
+ * o when few LEBs are empty, it garbage-collects dirty LEBs in advance, if
+ *   background GC is enabled.
  */
 int ubifs_bg_thread(void *info)
 {
@@ -302,7 +301,7 @@ int ubifs_bg_thread(void *info)
 
 		set_current_state(TASK_INTERRUPTIBLE);
 		/* Check if there is something to do */
-		if (!c->need_bgt) {
+		if (!c->need_bgt && !c->bg_gc_active) {
 			/*
 			 * Nothing prevents us from going sleep now and
 			 * be never woken up and block the task which
@@ -310,17 +309,31 @@ int ubifs_bg_thread(void *info)
 			 */
 			if (kthread_should_stop())
 				break;
-			schedule();
-			continue;
+			if (!c->bg_gc_low) {
+				schedule();
+				continue;
+			}
+			/* Wake up periodically to check the GC watermarks */
+			schedule_timeout(UBIFS_BG_GC_PERIOD);
 		} else
 			__set_current_state(TASK_RUNNING);
 
-		c->need_bgt = 0;
-		err = ubifs_bg_wbufs_sync(c);
-		if (err)
-			ubifs_ro_mode(c, err);
+		if (c->need_bgt) {
+			c->need_bgt = 0;
+			err = ubifs_bg_wbufs_sync(c);
+			if (err)
+				ubifs_ro_mode(c, err);
 
-		run_bg_commit(c);
+			run_bg_commit(c);
+		}
+
+		/*
+		 * One LEB at a time, so that write-buffer synchronization and
+		 * commit requests are not delayed for long.
+		 */
+		err = ubifs_bg_gc(c);
+		if (err < 0)
+			ubifs_err(c, "background GC failed, error %d", err);
 		cond_resched();
 	}
 
@@ -71,46 +71,54 @@ static struct ubifs_compressor zlib_compr = {
 };
 #endif
 
+#ifdef CONFIG_UBIFS_FS_LZ4
+static DEFINE_MUTEX(lz4_mutex);
+
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.comp_mutex = &lz4_mutex,
+	.name = "lz4",
+	.capi_name = "lz4",
+};
+#else
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.name = "lz4",
+};
+#endif
+
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
 /**
- * ubifs_compress - compress data.
+ * do_compress - compress data with a given compressor instance.
+ * @c: UBIFS file-system description object
+ * @compr: compressor description object
+ * @cc: cryptoapi compressor handle to use
+ * @mutex: mutex serializing users of @cc (may be %NULL)
  * @in_buf: data to compress
  * @in_len: length of the data to compress
  * @out_buf: output buffer where compressed data should be stored
  * @out_len: output buffer length is returned here
- * @compr_type: type of compression to use on enter, actually used compression
- *              type on exit
- *
- * This function compresses input buffer @in_buf of length @in_len and stores
- * the result in the output buffer @out_buf and the resulting length in
- * @out_len. If the input buffer does not compress, it is just copied to the
- * @out_buf. The same happens if @compr_type is %UBIFS_COMPR_NONE or if
- * compression error occurred.
- *
- * Note, if the input buffer was not compressed, it is copied to the output
- * buffer and %UBIFS_COMPR_NONE is returned in @compr_type.
+ * @compr_type: actually used compression type is returned here
  */
-void ubifs_compress(const struct ubifs_info *c, const void *in_buf,
-		    int in_len, void *out_buf, int *out_len, int *compr_type)
+static void do_compress(const struct ubifs_info *c,
+			struct ubifs_compressor *compr, struct crypto_comp *cc,
+			struct mutex *mutex, const void *in_buf, int in_len,
+			void *out_buf, int *out_len, int *compr_type)
 {
 	int err;
-	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
-
-	if (*compr_type == UBIFS_COMPR_NONE)
-		goto no_compr;
 
 	/* If the input data is small, do not even try to compress it */
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	if (mutex)
+		mutex_lock(mutex);
+	err = crypto_comp_compress(cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	if (mutex)
+		mutex_unlock(mutex);
 	if (unlikely(err)) {
 		ubifs_warn(c, "cannot compress %d bytes, compressor %s, error %d, leave data uncompressed",
 			   in_len, compr->name, err);
@@ -132,6 +140,71 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/**
+ * ubifs_compress - compress data.
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * This function compresses input buffer @in_buf of length @in_len and stores
+ * the result in the output buffer @out_buf and the resulting length in
+ * @out_len. If the input buffer does not compress, it is just copied to the
+ * @out_buf. The same happens if @compr_type is %UBIFS_COMPR_NONE or if
+ * compression error occurred.
+ *
+ * Note, if the input buffer was not compressed, it is copied to the output
+ * buffer and %UBIFS_COMPR_NONE is returned in @compr_type.
+ */
+void ubifs_compress(const struct ubifs_info *c, const void *in_buf,
+		    int in_len, void *out_buf, int *out_len, int *compr_type)
+{
+	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+
+	if (*compr_type == UBIFS_COMPR_NONE) {
+		memcpy(out_buf, in_buf, in_len);
+		*out_len = in_len;
+		return;
+	}
+
+	do_compress(c, compr, compr->cc, compr->comp_mutex, in_buf, in_len,
+		    out_buf, out_len, compr_type);
+}
+
+/**
+ * ubifs_compress_parallel - compress data using the private compressor pool.
+ * @c: UBIFS file-system description object
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * This is the same as 'ubifs_compress()', but it picks one of the private
+ * compressor instances of @c, so that several write-back workers do not
+ * serialize on the single global compressor. If @c has no pool for
+ * @compr_type, this falls back to 'ubifs_compress()'.
+ */
+void ubifs_compress_parallel(const struct ubifs_info *c, const void *in_buf,
+			     int in_len, void *out_buf, int *out_len,
+			     int *compr_type)
+{
+	struct ubifs_compr_pool *pool = c->compr_pool;
+	struct ubifs_compr_slot *slot;
+
+	if (!pool || pool->compr_type != *compr_type) {
+		ubifs_compress(c, in_buf, in_len, out_buf, out_len, compr_type);
+		return;
+	}
+
+	slot = &pool->slots[raw_smp_processor_id() % pool->cnt];
+	do_compress(c, ubifs_compressors[*compr_type], slot->cc, &slot->mutex,
+		    in_buf, in_len, out_buf, out_len, compr_type);
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -181,6 +254,78 @@ int ubifs_decompress(const struct ubifs_info *c, const void *in_buf,
 	return err;
 }
 
+/**
+ * ubifs_compr_pool_init - allocate private compressors for write-back.
+ * @c: UBIFS file-system description object
+ *
+ * This function allocates one instance of the default compressor of @c per
+ * online CPU (but not more than %UBIFS_MAX_COMPR_WORKERS), which are then
+ * used by 'ubifs_compress_parallel()'. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubifs_compr_pool_init(struct ubifs_info *c)
+{
+	struct ubifs_compressor *compr = ubifs_compressors[c->default_compr];
+	struct ubifs_compr_pool *pool;
+	int i, cnt;
+
+	/*
+	 * Write-back may be using the pool right now, so it is only freed when
+	 * un-mounting. If "compr=" changed on re-mount, the old pool simply
+	 * stops matching and 'ubifs_compress_parallel()' falls back.
+	 */
+	if (c->compr_pool)
+		return 0;
+
+	if (c->default_compr == UBIFS_COMPR_NONE || !compr->capi_name)
+		return 0;
+
+	cnt = clamp_t(int, num_online_cpus(), 1, UBIFS_MAX_COMPR_WORKERS);
+	pool = kzalloc(sizeof(struct ubifs_compr_pool) +
+		       cnt * sizeof(struct ubifs_compr_slot), GFP_KERNEL);
+	if (!pool)
+		return -ENOMEM;
+
+	pool->compr_type = c->default_compr;
+	for (i = 0; i < cnt; i++) {
+		struct crypto_comp *cc;
+
+		cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(cc)) {
+			ubifs_err(c, "cannot initialize compressor %s, error %ld",
+				  compr->name, PTR_ERR(cc));
+			while (i--)
+				crypto_free_comp(pool->slots[i].cc);
+			kfree(pool);
+			return PTR_ERR(cc);
+		}
+		pool->slots[i].cc = cc;
+		mutex_init(&pool->slots[i].mutex);
+	}
+	pool->cnt = cnt;
+
+	c->compr_pool = pool;
+	return 0;
+}
+
+/**
+ * ubifs_compr_pool_exit - free private compressors.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_compr_pool_exit(struct ubifs_info *c)
+{
+	struct ubifs_compr_pool *pool = c->compr_pool;
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->cnt; i++)
+		crypto_free_comp(pool->slots[i].cc);
+	kfree(pool);
+	c->compr_pool = NULL;
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
@@ -232,9 +377,15 @@ int __init ubifs_compressors_init(void)
 	if (err)
 		goto out_lzo;
 
+	err = compr_init(&lz4_compr);
+	if (err)
+		goto out_zlib;
+
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
 	return 0;
 
+out_zlib:
+	compr_exit(&zlib_compr);
 out_lzo:
 	compr_exit(&lzo_compr);
 	return err;
@@ -247,4 +398,5 @@ void ubifs_compressors_exit(void)
 {
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
+	compr_exit(&lz4_compr);
 }
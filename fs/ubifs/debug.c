@@ -2799,6 +2799,32 @@ static const struct file_operations dfs_fops = {
 	.llseek = no_llseek,
 };
 
+static ssize_t dfs_bu_stats_read(struct file *file, char __user *u,
+				 size_t count, loff_t *ppos)
+{
+	struct ubifs_info *c = file->private_data;
+	struct ubifs_bu_stats *st = &c->bu_stats;
+	char buf[160];
+	int len;
+
+	len = snprintf(buf, sizeof(buf),
+		       "hits:   %ld\nmisses: %ld\nreads:  %ld\npages:  %ld\nresets: %ld\n",
+		       atomic_long_read(&st->hits),
+		       atomic_long_read(&st->misses),
+		       atomic_long_read(&st->reads),
+		       atomic_long_read(&st->pages),
+		       atomic_long_read(&st->resets));
+
+	return simple_read_from_buffer(u, count, ppos, buf, len);
+}
+
+static const struct file_operations dfs_bu_stats_fops = {
+	.open = dfs_file_open,
+	.read = dfs_bu_stats_read,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
 /**
  * dbg_debugfs_init_fs - initialize debugfs for UBIFS instance.
  * @c: UBIFS file-system description object
@@ -2903,6 +2929,13 @@ int dbg_debugfs_init_fs(struct ubifs_info *c)
 		goto out_remove;
 	d->dfs_ro_error = dent;
 
+	fname = "bulk_read_stats";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, c,
+				   &dfs_bu_stats_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_bu_stats = dent;
+
 	return 0;
 
 out_remove:
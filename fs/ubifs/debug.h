@@ -83,6 +83,7 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  *                re-mounting to R/O mode because it does not flush any buffers
  *                and UBIFS just starts returning -EROFS on all write
  *               operations)
+ * @dfs_bu_stats: bulk-read statistics
  */
 struct ubifs_debug_info {
 	struct ubifs_zbranch old_zroot;
@@ -127,6 +128,7 @@ struct ubifs_debug_info {
 	struct dentry *dfs_chk_fs;
 	struct dentry *dfs_tst_rcvry;
 	struct dentry *dfs_ro_error;
+	struct dentry *dfs_bu_stats;
 };
 
 /**
@@ -53,6 +53,8 @@
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -703,6 +705,20 @@ out_err:
 	return -EINVAL;
 }
 
+/**
+ * bulk_read_off - stop bulk-reading an inode.
+ * @c: UBIFS file-system description object
+ * @ui: UBIFS inode
+ */
+static void bulk_read_off(struct ubifs_info *c, struct ubifs_inode *ui)
+{
+	if (ui->bulk_read)
+		atomic_long_inc(&c->bu_stats.resets);
+	ui->read_in_a_row = 1;
+	ui->bulk_read = 0;
+	ui->bu_rounds = 0;
+}
+
 /**
  * ubifs_do_bulk_read - do bulk-read.
  * @c: UBIFS file-system description object
@@ -726,11 +742,9 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	if (err)
 		goto out_warn;
 
-	if (bu->eof) {
+	if (bu->eof)
 		/* Turn off bulk-read at the end of the file */
-		ui->read_in_a_row = 1;
-		ui->bulk_read = 0;
-	}
+		bulk_read_off(c, ui);
 
 	page_cnt = bu->blk_cnt >> UBIFS_BLOCKS_PER_PAGE_SHIFT;
 	if (!page_cnt) {
@@ -795,10 +809,14 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	}
 
 	ui->last_page_read = offset + page_idx - 1;
+	atomic_long_inc(&c->bu_stats.reads);
+	atomic_long_add(page_idx, &c->bu_stats.pages);
 
 out_free:
-	if (allocate)
+	if (allocate) {
 		kfree(bu->buf);
+		bu->buf = NULL;
+	}
 	return ret;
 
 out_warn:
@@ -806,10 +824,65 @@ out_warn:
 	goto out_free;
 
 out_bu_off:
-	ui->read_in_a_row = ui->bulk_read = 0;
+	bulk_read_off(c, ui);
+	ui->read_in_a_row = 0;
 	goto out_free;
 }
 
+/**
+ * ubifs_bulk_read_more - continue bulk-reading after the first bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @inode: inode being read
+ *
+ * One bulk-read stops where the data nodes stop being consecutive in the same
+ * LEB, e.g. at a LEB boundary or wherever the file is fragmented. For inodes
+ * read sequentially for a while, this function goes on with up to
+ * @ui->bu_rounds - 1 more bulk-reads starting right after the pages read so
+ * far, which gives UBIFS read-ahead comparable to a block file-system.
+ */
+static void ubifs_bulk_read_more(struct ubifs_info *c, struct bu_info *bu,
+				 struct inode *inode)
+{
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct address_space *mapping = inode->i_mapping;
+	loff_t isize = i_size_read(inode);
+	pgoff_t index, end_index;
+	struct page *page;
+	int round;
+
+	if (!isize)
+		return;
+	end_index = (isize - 1) >> PAGE_CACHE_SHIFT;
+
+	for (round = 1; round < ui->bu_rounds && ui->bulk_read; round++) {
+		index = ui->last_page_read + 1;
+		if (index > end_index)
+			break;
+
+		page = find_or_create_page(mapping, index,
+					   GFP_NOFS | __GFP_COLD);
+		if (!page)
+			break;
+		if (PageUptodate(page)) {
+			/* Somebody has already read it */
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+
+		bu->buf_len = c->max_bu_buf_len;
+		data_key_init(c, &bu->key, inode->i_ino,
+			      index << UBIFS_BLOCKS_PER_PAGE_SHIFT);
+		if (!ubifs_do_bulk_read(c, bu, page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+		page_cache_release(page);
+	}
+}
+
 /**
  * ubifs_bulk_read - determine whether to bulk-read and, if so, do it.
  * @page: page from which to start bulk-read.
@@ -818,6 +891,13 @@ out_bu_off:
  * bulk-read facility is designed to take advantage of that, by reading in one
  * go consecutive data nodes that are also located consecutively in the same
  * LEB. This function returns %1 if a bulk-read is done and %0 otherwise.
+ *
+ * Bulk-read is switched on after three reads in a row, where reads which
+ * skip forward by up to %UBIFS_BULK_READ_STRIDE pages still count as being in
+ * a row. While the inode keeps being read this way, the number of bulk-reads
+ * done per page cache miss doubles up to %UBIFS_BULK_READ_MAX_ROUNDS. A read
+ * elsewhere in the file halves it, and only switches bulk-read off when it
+ * drops to zero, so an occasional seek does not stop a streaming reader.
  */
 static int ubifs_bulk_read(struct page *page)
 {
@@ -839,20 +919,22 @@ static int ubifs_bulk_read(struct page *page)
 	if (!mutex_trylock(&ui->ui_mutex))
 		return 0;
 
-	if (index != last_page_read + 1) {
-		/* Turn off bulk-read if we stop reading sequentially */
-		ui->read_in_a_row = 1;
+	if (index <= last_page_read ||
+	    index - last_page_read > UBIFS_BULK_READ_STRIDE) {
+		/* Back off if we stop reading sequentially */
 		if (ui->bulk_read)
-			ui->bulk_read = 0;
-		goto out_unlock;
-	}
-
-	if (!ui->bulk_read) {
+			ui->bu_rounds >>= 1;
+		if (!ui->bu_rounds) {
+			bulk_read_off(c, ui);
+			goto out_unlock;
+		}
+	} else if (!ui->bulk_read) {
 		ui->read_in_a_row += 1;
 		if (ui->read_in_a_row < 3)
 			goto out_unlock;
 		/* Three reads in a row, so switch on bulk-read */
 		ui->bulk_read = 1;
+		ui->bu_rounds = 1;
 	}
 
 	/*
@@ -874,6 +956,13 @@ static int ubifs_bulk_read(struct page *page)
 	data_key_init(c, &bu->key, inode->i_ino,
 		      page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT);
 	err = ubifs_do_bulk_read(c, bu, page);
+	if (err) {
+		atomic_long_inc(&c->bu_stats.hits);
+		if (ui->bulk_read &&
+		    ui->bu_rounds < UBIFS_BULK_READ_MAX_ROUNDS)
+			ui->bu_rounds <<= 1;
+		ubifs_bulk_read_more(c, bu, inode);
+	}
 
 	if (!allocated)
 		mutex_unlock(&c->bu_mutex);
@@ -882,6 +971,8 @@ static int ubifs_bulk_read(struct page *page)
 
 out_unlock:
 	mutex_unlock(&ui->ui_mutex);
+	if (!err)
+		atomic_long_inc(&c->bu_stats.misses);
 	return err;
 }
 
@@ -894,7 +985,41 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
-static int do_writepage(struct page *page, int len)
+/**
+ * struct wb_blk - a data block compressed ahead of write-back.
+ * @work: compression work
+ * @c: UBIFS file-system description object
+ * @inode: inode the block belongs to
+ * @addr: block contents
+ * @block: block number
+ * @len: amount of uncompressed bytes in the block
+ * @node: the prepared data node (%NULL if there is none)
+ * @dlen: length of @node
+ */
+struct wb_blk {
+	struct work_struct work;
+	struct ubifs_info *c;
+	struct inode *inode;
+	const void *addr;
+	unsigned int block;
+	int len;
+	struct ubifs_data_node *node;
+	int dlen;
+};
+
+/**
+ * struct wb_batch - pages collected by batched write-back.
+ * @cnt: count of pages in @pages
+ * @pages: locked dirty pages, in the order they are to be written
+ * @blks: data blocks of @pages, %UBIFS_BLOCKS_PER_PAGE per page
+ */
+struct wb_batch {
+	int cnt;
+	struct page *pages[UBIFS_WB_BATCH_PAGES];
+	struct wb_blk blks[UBIFS_WB_BATCH_PAGES * UBIFS_BLOCKS_PER_PAGE];
+};
+
+static int do_writepage(struct page *page, int len, struct wb_blk *blks)
 {
 	int err = 0, i, blen;
 	unsigned int block;
@@ -919,7 +1044,11 @@ static int do_writepage(struct page *page, int len)
 	while (len) {
 		blen = min_t(int, len, UBIFS_BLOCK_SIZE);
 		data_key_init(c, &key, inode->i_ino, block);
-		err = ubifs_jnl_write_data(c, inode, &key, addr, blen);
+		if (blks && blks[i].node && blks[i].len == blen)
+			err = ubifs_jnl_write_data_node(c, &key, blks[i].node,
+							blks[i].dlen);
+		else
+			err = ubifs_jnl_write_data(c, inode, &key, addr, blen);
 		if (err)
 			break;
 		if (++i >= UBIFS_BLOCKS_PER_PAGE)
@@ -997,7 +1126,8 @@ static int do_writepage(struct page *page, int len)
  * on the page lock and it would not write the truncated inode node to the
  * journal before we have finished.
  */
-static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+static int __ubifs_writepage(struct page *page, struct writeback_control *wbc,
+			     struct wb_blk *blks)
 {
 	struct inode *inode = page->mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
@@ -1035,7 +1165,7 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			 * with this.
 			 */
 		}
-		return do_writepage(page, PAGE_CACHE_SIZE);
+		return do_writepage(page, PAGE_CACHE_SIZE, blks);
 	}
 
 	/*
@@ -1056,13 +1186,177 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			goto out_unlock;
 	}
 
-	return do_writepage(page, len);
+	return do_writepage(page, len, blks);
 
 out_unlock:
 	unlock_page(page);
 	return err;
 }
 
+static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+{
+	return __ubifs_writepage(page, wbc, NULL);
+}
+
+/*
+ * Batched write-back.
+ *
+ * With the "batch_compr" mount option, 'ubifs_writepages()' does not write
+ * dirty pages one by one. It collects up to %UBIFS_WB_BATCH_PAGES locked pages
+ * and hands compression of all their data blocks to @ubifs_compr_wq, so the
+ * blocks are compressed in parallel while the pages are journalled, in order,
+ * by 'ubifs_writepage()'. The journal and the index only ever see the same
+ * nodes in the same order as without batching.
+ *
+ * The pages stay locked from the moment they are collected until they are
+ * written, so their contents cannot change under the compressors. The amount
+ * of bytes to compress is taken from @inode->i_size when the batch is
+ * submitted; if 'ubifs_writepage()' later decides to write a different amount
+ * (truncation raced with us), or a node buffer could not be allocated, the
+ * block is compressed again the usual way.
+ */
+
+static void wb_compress_blk(struct work_struct *work)
+{
+	struct wb_blk *blk = container_of(work, struct wb_blk, work);
+	union ubifs_key key;
+
+	data_key_init(blk->c, &key, blk->inode->i_ino, blk->block);
+	blk->dlen = ubifs_prepare_data_node(blk->c, blk->inode, &key, blk->addr,
+					    blk->len, blk->node, 1);
+}
+
+/**
+ * wb_batch_submit - start compressing the blocks of a batch.
+ * @c: UBIFS file-system description object
+ * @inode: inode the pages belong to
+ * @wb: the batch
+ */
+static void wb_batch_submit(struct ubifs_info *c, struct inode *inode,
+			    struct wb_batch *wb)
+{
+	loff_t i_size = i_size_read(inode);
+	pgoff_t end_index = i_size >> PAGE_CACHE_SHIFT;
+	int n, i, len;
+
+	for (n = 0; n < wb->cnt; n++) {
+		struct page *page = wb->pages[n];
+		struct wb_blk *blk = &wb->blks[n * UBIFS_BLOCKS_PER_PAGE];
+		unsigned int block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+		void *addr;
+
+		for (i = 0; i < UBIFS_BLOCKS_PER_PAGE; i++)
+			blk[i].node = NULL;
+
+		if (page->index < end_index)
+			len = PAGE_CACHE_SIZE;
+		else if (page->index == end_index)
+			len = i_size & (PAGE_CACHE_SIZE - 1);
+		else
+			len = 0;
+
+		addr = kmap(page);
+		for (i = 0; len; i++, blk++) {
+			blk->len = min_t(int, len, UBIFS_BLOCK_SIZE);
+			blk->node = kmalloc(COMPRESSED_DATA_NODE_BUF_SZ,
+					    GFP_NOFS | __GFP_NOWARN);
+			if (!blk->node)
+				break;
+
+			blk->c = c;
+			blk->inode = inode;
+			blk->addr = addr;
+			blk->block = block + i;
+			INIT_WORK(&blk->work, wb_compress_blk);
+			queue_work(ubifs_compr_wq, &blk->work);
+
+			if (i + 1 >= UBIFS_BLOCKS_PER_PAGE)
+				break;
+			addr += blk->len;
+			len -= blk->len;
+		}
+	}
+}
+
+/**
+ * wb_batch_write - write out the pages of a batch.
+ * @wb: the batch
+ * @wbc: write-back control
+ *
+ * This function waits for the compression of each page and journals it. All
+ * pages are unlocked on return, as required by 'write_cache_pages()'. Returns
+ * the first error which occurred.
+ */
+static int wb_batch_write(struct wb_batch *wb, struct writeback_control *wbc)
+{
+	int n, i, err, ret = 0;
+
+	for (n = 0; n < wb->cnt; n++) {
+		struct page *page = wb->pages[n];
+		struct wb_blk *blk = &wb->blks[n * UBIFS_BLOCKS_PER_PAGE];
+
+		for (i = 0; i < UBIFS_BLOCKS_PER_PAGE; i++)
+			if (blk[i].node)
+				flush_work(&blk[i].work);
+
+		err = __ubifs_writepage(page, wbc, blk);
+		if (err && !ret)
+			ret = err;
+
+		for (i = 0; i < UBIFS_BLOCKS_PER_PAGE; i++)
+			kfree(blk[i].node);
+		kunmap(page);
+	}
+
+	wb->cnt = 0;
+	return ret;
+}
+
+static int wb_batch_add(struct page *page, struct writeback_control *wbc,
+			void *data)
+{
+	struct wb_batch *wb = data;
+	struct inode *inode = page->mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+
+	wb->pages[wb->cnt++] = page;
+	if (wb->cnt < UBIFS_WB_BATCH_PAGES)
+		return 0;
+
+	wb_batch_submit(c, inode, wb);
+	return wb_batch_write(wb, wbc);
+}
+
+static int ubifs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct wb_batch *wb;
+	int err, ret;
+
+	if (!c->batch_compr || !(ui->flags & UBIFS_COMPR_FL) ||
+	    ui->compr_type == UBIFS_COMPR_NONE)
+		return generic_writepages(mapping, wbc);
+
+	wb = kmalloc(sizeof(struct wb_batch), GFP_NOFS | __GFP_NOWARN);
+	if (!wb)
+		return generic_writepages(mapping, wbc);
+
+	wb->cnt = 0;
+	err = write_cache_pages(mapping, wbc, wb_batch_add, wb);
+	if (wb->cnt) {
+		wb_batch_submit(c, inode, wb);
+		ret = wb_batch_write(wb, wbc);
+		if (!err)
+			err = ret;
+	}
+
+	kfree(wb);
+	return err;
+}
+
 /**
  * do_attr_changes - change inode attributes.
  * @inode: inode to change attributes for
@@ -1159,7 +1453,7 @@ static int do_truncation(struct ubifs_info *c, struct inode *inode,
 				if (UBIFS_BLOCKS_PER_PAGE_SHIFT)
 					offset = new_size &
 						 (PAGE_CACHE_SIZE - 1);
-				err = do_writepage(page, offset);
+				err = do_writepage(page, offset, NULL);
 				page_cache_release(page);
 				if (err)
 					goto out_budg;
@@ -1552,6 +1846,7 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 const struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
 	.writepage      = ubifs_writepage,
+	.writepages     = ubifs_writepages,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
 	.invalidatepage = ubifs_invalidatepage,
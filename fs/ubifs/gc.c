@@ -825,6 +825,70 @@ out:
 	return ret;
 }
 
+/**
+ * ubifs_bg_gc - background garbage collection.
+ * @c: UBIFS file-system description object
+ *
+ * This function is called by the background thread. Once fewer than
+ * @c->bg_gc_low percent of the main area LEBs are empty, it garbage-collects
+ * one LEB per call until @c->bg_gc_high percent are, so that writers find
+ * free space without running GC themselves. Returns %1 if there is more to
+ * collect, %0 if not, and a negative error code in case of failure.
+ */
+int ubifs_bg_gc(struct ubifs_info *c)
+{
+	int lnum, err;
+	unsigned int empty;
+
+	if (!c->bg_gc_low || c->ro_mount || c->ro_error)
+		return 0;
+
+	empty = c->lst.empty_lebs * 100 / c->main_lebs;
+	if (!c->bg_gc_active) {
+		if (empty >= c->bg_gc_low)
+			return 0;
+		dbg_gc("background GC starts, %u%% of LEBs empty", empty);
+		c->bg_gc_active = 1;
+	} else if (empty >= c->bg_gc_high) {
+		dbg_gc("background GC stops, %u%% of LEBs empty", empty);
+		c->bg_gc_active = 0;
+		return 0;
+	}
+
+	down_read(&c->commit_sem);
+	lnum = ubifs_garbage_collect(c, 1);
+	up_read(&c->commit_sem);
+
+	if (lnum == -EAGAIN) {
+		err = ubifs_run_commit(c);
+		if (err)
+			goto out;
+		return 1;
+	}
+
+	if (lnum == -ENOSPC) {
+		/* Nothing worth collecting, check again next period */
+		dbg_gc("background GC found no dirty LEBs");
+		c->bg_gc_active = 0;
+		return 0;
+	}
+
+	if (lnum < 0) {
+		err = lnum;
+		goto out;
+	}
+
+	err = ubifs_return_leb(c, lnum);
+	if (err)
+		goto out;
+
+	return 1;
+
+out:
+	c->bg_gc_active = 0;
+	return err;
+}
+
 /**
  * ubifs_gc_start_commit - garbage collection at start of commit.
  * @c: UBIFS file-system description object
@@ -547,7 +547,9 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 	wbuf->avail = wbuf->size;
 	wbuf->used = 0;
 	wbuf->next_ino = 0;
+	wbuf->sync_seq += 1;
 	spin_unlock(&wbuf->lock);
+	wake_up_all(&wbuf->sync_wq);
 
 	if (wbuf->sync_callback)
 		err = wbuf->sync_callback(c, wbuf->lnum,
@@ -1056,6 +1058,9 @@ int ubifs_wbuf_init(struct ubifs_info *c, struct ubifs_wbuf *wbuf)
 	spin_lock_init(&wbuf->lock);
 	wbuf->c = c;
 	wbuf->next_ino = 0;
+	wbuf->sync_seq = 0;
+	init_waitqueue_head(&wbuf->sync_wq);
+	wbuf->last_fsync_pid = 0;
 
 	hrtimer_init(&wbuf->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	wbuf->timer.function = wbuf_timer_callback_nolock;
@@ -1108,6 +1113,47 @@ static int wbuf_has_ino(struct ubifs_wbuf *wbuf, ino_t inum)
 	return ret;
 }
 
+/**
+ * wbuf_group_commit - give concurrent 'fsync()' calls a chance to join in.
+ * @c: UBIFS file-system description object
+ * @wbuf: the write-buffer which is about to be synchronized
+ *
+ * Every write-buffer synchronization is a separate flash program operation.
+ * When several processes call 'fsync()' at the same time, it is much cheaper
+ * to let them add their nodes to the write-buffer and synchronize it once.
+ * So, if the previous 'fsync()' on @wbuf came from a different process, this
+ * function waits up to @c->fsync_window microseconds for somebody else to
+ * synchronize @wbuf. The wait is skipped if the write-buffer is already
+ * half-full, because then the next node is likely to flush it anyway, and
+ * for single-threaded workloads, which would gain nothing from it.
+ *
+ * The caller has to re-check whether the write-buffer still has its nodes,
+ * so the durability guarantees of 'fsync()' do not change.
+ */
+static void wbuf_group_commit(struct ubifs_info *c, struct ubifs_wbuf *wbuf)
+{
+	unsigned long seq;
+	pid_t pid = current->pid;
+	int half_full;
+
+	if (!c->fsync_window)
+		return;
+
+	spin_lock(&wbuf->lock);
+	seq = wbuf->sync_seq;
+	half_full = wbuf->used >= wbuf->size / 2;
+	if (wbuf->last_fsync_pid == pid)
+		half_full = 1;
+	wbuf->last_fsync_pid = pid;
+	spin_unlock(&wbuf->lock);
+
+	if (half_full)
+		return;
+
+	wait_event_hrtimeout(wbuf->sync_wq, wbuf->sync_seq != seq,
+			     ns_to_ktime((u64)c->fsync_window * NSEC_PER_USEC));
+}
+
 /**
  * ubifs_sync_wbufs_by_inode - synchronize write-buffers for an inode.
  * @c: UBIFS file-system description object
@@ -1136,6 +1182,11 @@ int ubifs_sync_wbufs_by_inode(struct ubifs_info *c, struct inode *inode)
 		if (!wbuf_has_ino(wbuf, inode->i_ino))
 			continue;
 
+		wbuf_group_commit(c, wbuf);
+		if (!wbuf_has_ino(wbuf, inode->i_ino))
+			/* Somebody else has synchronized it for us */
+			continue;
+
 		mutex_lock_nested(&wbuf->io_mutex, wbuf->jhead);
 		if (wbuf_has_ino(wbuf, inode->i_ino))
 			err = ubifs_wbuf_sync_nolock(wbuf);
@@ -61,6 +61,29 @@ static inline int ubifs_zn_cow(const struct ubifs_znode *znode)
 	return !!test_bit(COW_ZNODE, &znode->flags);
 }
 
+/**
+ * ubifs_zn_compact - check if znode is compact.
+ * @znode: znode to check
+ *
+ * This helper function returns %1 if @znode only has room for its current
+ * branches and %0 otherwise.
+ */
+static inline int ubifs_zn_compact(const struct ubifs_znode *znode)
+{
+	return !!test_bit(COMPACT_ZNODE, &znode->flags);
+}
+
+/**
+ * ubifs_znode_sz - size of a znode.
+ * @c: UBIFS file-system description object
+ * @child_cnt: count of branches the znode has room for
+ */
+static inline int ubifs_znode_sz(const struct ubifs_info *c, int child_cnt)
+{
+	return sizeof(struct ubifs_znode) +
+	       child_cnt * sizeof(struct ubifs_zbranch);
+}
+
 /**
  * ubifs_wake_up_bgt - wake up background thread.
  * @c: UBIFS file-system description object
@@ -47,6 +47,9 @@
 /* Slab cache for UBIFS inodes */
 struct kmem_cache *ubifs_inode_slab;
 
+/* Workqueue running the compression workers of batched write-back */
+struct workqueue_struct *ubifs_compr_wq;
+
 /* UBIFS TNC shrinker description */
 static struct shrinker ubifs_shrinker_info = {
 	.scan_objects = ubifs_shrink_scan,
@@ -430,11 +433,28 @@ static int ubifs_show_options(struct seq_file *s, struct dentry *root)
 	else if (c->mount_opts.bulk_read == 1)
 		seq_puts(s, ",no_bulk_read");
 
+	if (c->mount_opts.batch_compr == 2)
+		seq_puts(s, ",batch_compr");
+	else if (c->mount_opts.batch_compr == 1)
+		seq_puts(s, ",no_batch_compr");
+
+	if (c->fsync_window)
+		seq_printf(s, ",fsync_window=%u", c->fsync_window);
+
+	if (c->bg_gc_low)
+		seq_printf(s, ",bg_gc_low=%u,bg_gc_high=%u", c->bg_gc_low,
+			   c->bg_gc_high);
+
 	if (c->mount_opts.chk_data_crc == 2)
 		seq_puts(s, ",chk_data_crc");
 	else if (c->mount_opts.chk_data_crc == 1)
 		seq_puts(s, ",no_chk_data_crc");
 
+	if (c->mount_opts.compact_tnc == 2)
+		seq_puts(s, ",compact_tnc");
+	else if (c->mount_opts.compact_tnc == 1)
+		seq_puts(s, ",no_compact_tnc");
+
 	if (c->mount_opts.override_compr) {
 		seq_printf(s, ",compr=%s",
 			   ubifs_compr_name(c->mount_opts.compr_type));
@@ -912,9 +932,16 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_norm_unmount: run a journal commit before un-mounting
  * Opt_bulk_read: enable bulk-reads
  * Opt_no_bulk_read: disable bulk-reads
+ * Opt_batch_compr: compress write-back data in batches, in parallel
+ * Opt_no_batch_compr: compress write-back data one node at a time
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
+ * Opt_compact_tnc: keep clean znodes without room for more branches
+ * Opt_no_compact_tnc: allocate all znodes with room for the full fanout
  * Opt_override_compr: override default compressor
+ * Opt_fsync_window: 'fsync()' group-commit window in microseconds
+ * Opt_bg_gc_low: percentage of empty LEBs below which background GC starts
+ * Opt_bg_gc_high: percentage of empty LEBs at which background GC stops
  * Opt_err: just end of array marker
  */
 enum {
@@ -922,9 +949,16 @@ enum {
 	Opt_norm_unmount,
 	Opt_bulk_read,
 	Opt_no_bulk_read,
+	Opt_batch_compr,
+	Opt_no_batch_compr,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
+	Opt_compact_tnc,
+	Opt_no_compact_tnc,
 	Opt_override_compr,
+	Opt_fsync_window,
+	Opt_bg_gc_low,
+	Opt_bg_gc_high,
 	Opt_err,
 };
 
@@ -933,9 +967,16 @@ static const match_table_t tokens = {
 	{Opt_norm_unmount, "norm_unmount"},
 	{Opt_bulk_read, "bulk_read"},
 	{Opt_no_bulk_read, "no_bulk_read"},
+	{Opt_batch_compr, "batch_compr"},
+	{Opt_no_batch_compr, "no_batch_compr"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
+	{Opt_compact_tnc, "compact_tnc"},
+	{Opt_no_compact_tnc, "no_compact_tnc"},
 	{Opt_override_compr, "compr=%s"},
+	{Opt_fsync_window, "fsync_window=%u"},
+	{Opt_bg_gc_low, "bg_gc_low=%u"},
+	{Opt_bg_gc_high, "bg_gc_high=%u"},
 	{Opt_err, NULL},
 };
 
@@ -1006,6 +1047,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.bulk_read = 1;
 			c->bulk_read = 0;
 			break;
+		case Opt_batch_compr:
+			c->mount_opts.batch_compr = 2;
+			c->batch_compr = 1;
+			break;
+		case Opt_no_batch_compr:
+			c->mount_opts.batch_compr = 1;
+			c->batch_compr = 0;
+			break;
 		case Opt_chk_data_crc:
 			c->mount_opts.chk_data_crc = 2;
 			c->no_chk_data_crc = 0;
@@ -1014,6 +1063,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.chk_data_crc = 1;
 			c->no_chk_data_crc = 1;
 			break;
+		case Opt_compact_tnc:
+			c->mount_opts.compact_tnc = 2;
+			c->compact_tnc = 1;
+			break;
+		case Opt_no_compact_tnc:
+			c->mount_opts.compact_tnc = 1;
+			c->compact_tnc = 0;
+			break;
 		case Opt_override_compr:
 		{
 			char *name = match_strdup(&args[0]);
@@ -1026,6 +1083,8 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 				c->mount_opts.compr_type = UBIFS_COMPR_LZO;
 			else if (!strcmp(name, "zlib"))
 				c->mount_opts.compr_type = UBIFS_COMPR_ZLIB;
+			else if (!strcmp(name, "lz4"))
+				c->mount_opts.compr_type = UBIFS_COMPR_LZ4;
 			else {
 				ubifs_err(c, "unknown compressor \"%s\"", name); //FIXME: is c ready?
 				kfree(name);
@@ -1036,6 +1095,36 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->default_compr = c->mount_opts.compr_type;
 			break;
 		}
+		case Opt_fsync_window:
+		{
+			int window;
+
+			if (match_int(&args[0], &window) || window < 0 ||
+			    window > UBIFS_MAX_FSYNC_WINDOW) {
+				ubifs_err(c, "bad fsync_window value, max. is %d",
+					  UBIFS_MAX_FSYNC_WINDOW);
+				return -EINVAL;
+			}
+			c->fsync_window = window;
+			break;
+		}
+		case Opt_bg_gc_low:
+		case Opt_bg_gc_high:
+		{
+			int pct;
+
+			if (match_int(&args[0], &pct) || pct < 0 || pct > 100) {
+				ubifs_err(c, "bad %s value, max. is 100",
+					  token == Opt_bg_gc_low ? "bg_gc_low" :
+					  "bg_gc_high");
+				return -EINVAL;
+			}
+			if (token == Opt_bg_gc_low)
+				c->bg_gc_low = pct;
+			else
+				c->bg_gc_high = pct;
+			break;
+		}
 		default:
 		{
 			unsigned long flag;
@@ -1053,6 +1142,10 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 		}
 	}
 
+	/* Without a high watermark, collect a little past the low one */
+	if (c->bg_gc_high <= c->bg_gc_low)
+		c->bg_gc_high = min(c->bg_gc_low * 2, 100U);
+
 	return 0;
 }
 
@@ -1114,6 +1207,26 @@ again:
 	}
 }
 
+/**
+ * batch_compr_init - initialize batched write-back compression.
+ * @c: UBIFS file-system description object
+ */
+static void batch_compr_init(struct ubifs_info *c)
+{
+	int err;
+
+	ubifs_assert(c->batch_compr == 1);
+
+	err = ubifs_compr_pool_init(c);
+	if (err) {
+		/* Just disable batched compression */
+		ubifs_warn(c, "cannot allocate compressors for batched write-back, error %d, disabling it",
+			   err);
+		c->mount_opts.batch_compr = 1;
+		c->batch_compr = 0;
+	}
+}
+
 /**
  * check_free_space - check if there is enough free space to mount.
  * @c: UBIFS file-system description object
@@ -1228,6 +1341,9 @@ static int mount_ubifs(struct ubifs_info *c)
 		goto out_free;
 	}
 
+	if (c->batch_compr == 1)
+		batch_compr_init(c);
+
 	err = init_constants_sb(c);
 	if (err)
 		goto out_free;
@@ -1486,6 +1602,7 @@ out_cbuf:
 out_free:
 	kfree(c->write_reserve_buf);
 	kfree(c->bu.buf);
+	ubifs_compr_pool_exit(c);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
 	kfree(c->bottom_up_buf);
@@ -1525,6 +1642,7 @@ static void ubifs_umount(struct ubifs_info *c)
 	kfree(c->mst_node);
 	kfree(c->write_reserve_buf);
 	kfree(c->bu.buf);
+	ubifs_compr_pool_exit(c);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
 	kfree(c->bottom_up_buf);
@@ -1866,6 +1984,13 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		c->bu.buf = NULL;
 	}
 
+	if (c->batch_compr == 1)
+		batch_compr_init(c);
+
+	/* Let the background thread pick up new GC watermarks */
+	if (c->bgt)
+		wake_up_process(c->bgt);
+
 	ubifs_assert(c->lst.taken_empty_lebs > 0);
 	return 0;
 }
@@ -2251,9 +2376,16 @@ static int __init ubifs_init(void)
 	if (err)
 		goto out_shrinker;
 
+	ubifs_compr_wq = alloc_workqueue("ubifs_compr",
+					 WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!ubifs_compr_wq) {
+		err = -ENOMEM;
+		goto out_compr;
+	}
+
 	err = dbg_debugfs_init();
 	if (err)
-		goto out_compr;
+		goto out_wq;
 
 	err = register_filesystem(&ubifs_fs_type);
 	if (err) {
@@ -2265,6 +2397,8 @@ static int __init ubifs_init(void)
 
 out_dbg:
 	dbg_debugfs_exit();
+out_wq:
+	destroy_workqueue(ubifs_compr_wq);
 out_compr:
 	ubifs_compressors_exit();
 out_shrinker:
@@ -2281,6 +2415,7 @@ static void __exit ubifs_exit(void)
 	ubifs_assert(atomic_long_read(&ubifs_clean_zn_cnt) == 0);
 
 	dbg_debugfs_exit();
+	destroy_workqueue(ubifs_compr_wq);
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
 
@@ -198,6 +198,9 @@ static struct ubifs_znode *copy_znode(struct ubifs_info *c,
 {
 	struct ubifs_znode *zn;
 
+	/* Only dirty znodes are committed, and those are never compact */
+	ubifs_assert(!ubifs_zn_compact(znode));
+
 	zn = kmalloc(c->max_znode_sz, GFP_NOFS);
 	if (unlikely(!zn))
 		return ERR_PTR(-ENOMEM);
@@ -227,6 +230,43 @@ static struct ubifs_znode *copy_znode(struct ubifs_info *c,
 	return zn;
 }
 
+/**
+ * grow_znode - re-allocate a compact znode with room for @c->fanout branches.
+ * @c: UBIFS file-system description object
+ * @zbr: branch of the znode
+ *
+ * The compact znode is freed and replaced by the new one in @zbr. Returns the
+ * new znode or a negative error code in case of failure.
+ */
+static struct ubifs_znode *grow_znode(struct ubifs_info *c,
+				      struct ubifs_zbranch *zbr)
+{
+	struct ubifs_znode *znode = zbr->znode, *zn;
+
+	zn = kzalloc(c->max_znode_sz, GFP_NOFS);
+	if (unlikely(!zn))
+		return ERR_PTR(-ENOMEM);
+
+	memcpy(zn, znode, ubifs_znode_sz(c, znode->child_cnt));
+	__clear_bit(COMPACT_ZNODE, &zn->flags);
+
+	if (zn->level != 0) {
+		int i;
+
+		/* The children now have new parent */
+		for (i = 0; i < zn->child_cnt; i++) {
+			struct ubifs_zbranch *zbr = &zn->zbranch[i];
+
+			if (zbr->znode)
+				zbr->znode->parent = zn;
+		}
+	}
+
+	zbr->znode = zn;
+	kfree(znode);
+	return zn;
+}
+
 /**
  * add_idx_dirt - add dirt due to a dirty znode.
  * @c: UBIFS file-system description object
@@ -257,6 +297,11 @@ static struct ubifs_znode *dirty_cow_znode(struct ubifs_info *c,
 
 	if (!ubifs_zn_cow(znode)) {
 		/* znode is not being committed */
+		if (ubifs_zn_compact(znode)) {
+			znode = grow_znode(c, zbr);
+			if (IS_ERR(znode))
+				return znode;
+		}
 		if (!test_and_set_bit(DIRTY_ZNODE, &znode->flags)) {
 			atomic_long_inc(&c->dirty_zn_cnt);
 			atomic_long_dec(&c->clean_zn_cnt);
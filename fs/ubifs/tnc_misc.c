@@ -423,6 +423,23 @@ struct ubifs_znode *ubifs_load_znode(struct ubifs_info *c,
 	if (err)
 		goto out;
 
+	/*
+	 * On low memory systems clean znodes, which make most of the TNC, are
+	 * kept without room for more branches. They are re-allocated when
+	 * dirtied, see 'dirty_cow_znode()'.
+	 */
+	if (c->compact_tnc && znode->child_cnt < c->fanout) {
+		struct ubifs_znode *zn;
+
+		zn = kmemdup(znode, ubifs_znode_sz(c, znode->child_cnt),
+			     GFP_NOFS);
+		if (zn) {
+			kfree(znode);
+			znode = zn;
+			__set_bit(COMPACT_ZNODE, &znode->flags);
+		}
+	}
+
 	atomic_long_inc(&c->clean_zn_cnt);
 
 	/*
@@ -110,6 +110,12 @@
 #define WBUF_TIMEOUT_SOFTLIMIT 3
 #define WBUF_TIMEOUT_HARDLIMIT 5
 
+/* Maximum 'fsync()' group-commit window in microseconds */
+#define UBIFS_MAX_FSYNC_WINDOW 20000
+
+/* How often the background thread checks the background GC watermarks */
+#define UBIFS_BG_GC_PERIOD HZ
+
 /* Maximum possible inode number (only 32-bit inodes are supported now) */
 #define MAX_INUM 0xFFFFFFFF
 
@@ -173,6 +179,27 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * Maximum number of bulk-reads done back to back for one page cache miss, and
+ * maximum distance (in pages) between two reads which are still considered
+ * sequential.
+ */
+#define UBIFS_BULK_READ_MAX_ROUNDS 4
+#define UBIFS_BULK_READ_STRIDE 4
+
+/* Maximum number of private compressors used by batched write-back */
+#define UBIFS_MAX_COMPR_WORKERS 8
+
+/* Maximum number of pages compressed together by batched write-back */
+#define UBIFS_WB_BATCH_PAGES 16
+
+/*
+ * After this many data nodes of an inode in a row did not compress, the next
+ * %UBIFS_COMPR_SKIP_BLOCKS ones are written uncompressed without trying.
+ */
+#define UBIFS_COMPR_MAX_FAILS 4
+#define UBIFS_COMPR_SKIP_BLOCKS 64
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -191,11 +218,15 @@ enum {
  * OBSOLETE_ZNODE: znode is obsolete, which means it was deleted, but it is
  *                 still in the commit list and the ongoing commit operation
  *                 will commit it, and delete this znode after it is done
+ * COMPACT_ZNODE: znode is clean and only has room for its @child_cnt
+ *                branches, a full size instance has to be created before
+ *                changing it
  */
 enum {
 	DIRTY_ZNODE    = 0,
 	COW_ZNODE      = 1,
 	OBSOLETE_ZNODE = 2,
+	COMPACT_ZNODE  = 3,
 };
 
 /*
@@ -358,6 +389,7 @@ struct ubifs_gced_idx_leb {
  * @dirty: non-zero if the inode is dirty
  * @xattr: non-zero if this is an extended attribute inode
  * @bulk_read: non-zero if bulk-read should be used
+ * @bu_rounds: how many bulk-reads to do back to back (for bulk read)
  * @ui_mutex: serializes inode write-back with the rest of VFS operations,
  *            serializes "clean <-> dirty" state changes, serializes bulk-read,
  *            protects @dirty, @bulk_read, @ui_size, and @xattr_size
@@ -368,6 +400,8 @@ struct ubifs_gced_idx_leb {
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_fails: number of data nodes in a row which did not compress
+ * @compr_skip: number of data nodes to write without trying to compress them
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
@@ -412,7 +446,10 @@ struct ubifs_inode {
 	unsigned int dirty:1;
 	unsigned int xattr:1;
 	unsigned int bulk_read:1;
+	unsigned int bu_rounds:3;
 	unsigned int compr_type:2;
+	unsigned int compr_fails;
+	unsigned int compr_skip;
 	struct mutex ui_mutex;
 	spinlock_t ui_lock;
 	loff_t synced_i_size;
@@ -675,6 +712,9 @@ typedef int (*ubifs_lpt_scan_callback)(struct ubifs_info *c,
  * @need_sync: non-zero if the timer expired and the wbuf needs sync'ing
  * @next_ino: points to the next position of the following inode number
  * @inodes: stores the inode numbers of the nodes which are in wbuf
+ * @sync_seq: incremented every time the write-buffer has been synchronized
+ * @sync_wq: wait queue to sleep on for the next synchronization
+ * @last_fsync_pid: process which did the last 'fsync()' on this write-buffer
  *
  * The write-buffer synchronization callback is called when the write-buffer is
  * synchronized in order to notify how much space was wasted due to
@@ -705,6 +745,9 @@ struct ubifs_wbuf {
 	unsigned int need_sync:1;
 	int next_ino;
 	ino_t *inodes;
+	unsigned long sync_seq;
+	wait_queue_head_t sync_wq;
+	pid_t last_fsync_pid;
 };
 
 /**
@@ -760,7 +803,8 @@ struct ubifs_zbranch {
  * struct ubifs_znode - in-memory representation of an indexing node.
  * @parent: parent znode or NULL if it is the root
  * @cnext: next znode to commit
- * @flags: znode flags (%DIRTY_ZNODE, %COW_ZNODE or %OBSOLETE_ZNODE)
+ * @flags: znode flags (%DIRTY_ZNODE, %COW_ZNODE, %OBSOLETE_ZNODE or
+ *         %COMPACT_ZNODE)
  * @time: last access time (seconds)
  * @level: level of the entry in the TNC tree
  * @child_cnt: count of child znodes
@@ -769,7 +813,8 @@ struct ubifs_zbranch {
  * @lnum: LEB number of the corresponding indexing node
  * @offs: offset of the corresponding indexing node
  * @len: length  of the corresponding indexing node
- * @zbranch: array of znode branches (@c->fanout elements)
+ * @zbranch: array of znode branches (@c->fanout elements, or @child_cnt if
+ *           the znode is compact)
  *
  * Note! The @lnum, @offs, and @len fields are not really needed - we have them
  * only for internal consistency check. They could be removed to save some RAM.
@@ -827,6 +872,23 @@ struct ubifs_node_range {
 	int max_len;
 };
 
+/**
+ * struct ubifs_bu_stats - bulk-read statistics.
+ * @hits: page cache misses served by bulk-read
+ * @misses: page cache misses served by reading one page, while bulk-read is
+ *          enabled
+ * @reads: bulk-reads done (there may be several per hit)
+ * @pages: page cache pages filled by bulk-read
+ * @resets: how many times an inode stopped being bulk-read
+ */
+struct ubifs_bu_stats {
+	atomic_long_t hits;
+	atomic_long_t misses;
+	atomic_long_t reads;
+	atomic_long_t pages;
+	atomic_long_t resets;
+};
+
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
@@ -845,6 +907,32 @@ struct ubifs_compressor {
 	const char *capi_name;
 };
 
+/**
+ * struct ubifs_compr_slot - private compressor instance.
+ * @cc: cryptoapi compressor handle
+ * @mutex: serializes users of @cc
+ */
+struct ubifs_compr_slot {
+	struct crypto_comp *cc;
+	struct mutex mutex;
+};
+
+/**
+ * struct ubifs_compr_pool - private compressors of a file-system.
+ * @compr_type: compressor type of all the instances (%UBIFS_COMPR_LZO, etc)
+ * @cnt: count of compressor instances in @slots
+ * @slots: compressor instances
+ *
+ * Batched write-back compresses several data nodes at the same time. The
+ * global compressors are serialized by a mutex, so each file-system using
+ * batched write-back has a few compressor instances of its own.
+ */
+struct ubifs_compr_pool {
+	int compr_type;
+	int cnt;
+	struct ubifs_compr_slot slots[];
+};
+
 /**
  * struct ubifs_budget_req - budget requirements of an operation.
  *
@@ -935,8 +1023,12 @@ struct ubifs_orphan {
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
  * @bulk_read: enable/disable bulk-reads (%0 default, %1 disable, %2 enable)
+ * @batch_compr: enable/disable batched write-back compression (%0 default,
+ *               %1 disable, %2 enable)
  * @chk_data_crc: enable/disable CRC data checking when reading data nodes
  *                (%0 default, %1 disable, %2 enable)
+ * @compact_tnc: enable/disable compact clean znodes (%0 default, %1 disable,
+ *               %2 enable)
  * @override_compr: override default compressor (%0 - do not override and use
  *                  superblock compressor, %1 - override and use compressor
  *                  specified in @compr_type)
@@ -946,7 +1038,9 @@ struct ubifs_orphan {
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
+	unsigned int batch_compr:2;
 	unsigned int chk_data_crc:2;
+	unsigned int compact_tnc:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
 };
@@ -1032,8 +1126,18 @@ struct ubifs_debug_info;
  * @no_chk_data_crc: do not check CRCs when reading data nodes (except during
  *                   recovery)
  * @bulk_read: enable bulk-reads
+ * @batch_compr: compress write-back data in batches, in parallel
+ * @compact_tnc: allocate clean znodes read from the media with room for their
+ *               branches only
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
  * @rw_incompat: the media is not R/W compatible
+ * @fsync_window: how long (in microseconds) 'fsync()' waits for concurrent
+ *                'fsync()' calls to share one write-buffer synchronization
+ * @bg_gc_low: background GC starts when fewer main area LEBs than this
+ *             percentage are empty, %0 if background GC is disabled
+ * @bg_gc_high: background GC stops when this percentage of main area LEBs
+ *              is empty
+ * @bg_gc_active: background GC is running, between the two watermarks
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
@@ -1058,6 +1162,8 @@ struct ubifs_debug_info;
  * @max_bu_buf_len: maximum bulk-read buffer length
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
+ * @bu_stats: bulk-read statistics
+ * @compr_pool: private compressors used by batched write-back
  *
  * @write_reserve_mutex: protects @write_reserve_buf
  * @write_reserve_buf: on the write path we allocate memory, which might
@@ -1273,8 +1379,14 @@ struct ubifs_info {
 	unsigned int space_fixup:1;
 	unsigned int no_chk_data_crc:1;
 	unsigned int bulk_read:1;
+	unsigned int batch_compr:1;
+	unsigned int compact_tnc:1;
 	unsigned int default_compr:2;
 	unsigned int rw_incompat:1;
+	unsigned int fsync_window;
+	unsigned int bg_gc_low;
+	unsigned int bg_gc_high;
+	unsigned int bg_gc_active:1;
 
 	struct mutex tnc_mutex;
 	struct ubifs_zbranch zroot;
@@ -1298,6 +1410,8 @@ struct ubifs_info {
 	int max_bu_buf_len;
 	struct mutex bu_mutex;
 	struct bu_info bu;
+	struct ubifs_bu_stats bu_stats;
+	struct ubifs_compr_pool *compr_pool;
 
 	struct mutex write_reserve_mutex;
 	void *write_reserve_buf;
@@ -1479,6 +1593,7 @@ extern const struct inode_operations ubifs_dir_inode_operations;
 extern const struct inode_operations ubifs_symlink_inode_operations;
 extern struct backing_dev_info ubifs_backing_dev_info;
 extern struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
+extern struct workqueue_struct *ubifs_compr_wq;
 
 /* io.c */
 void ubifs_ro_mode(struct ubifs_info *c, int err);
@@ -1540,6 +1655,12 @@ int ubifs_consolidate_log(struct ubifs_info *c);
 int ubifs_jnl_update(struct ubifs_info *c, const struct inode *dir,
 		     const struct qstr *nm, const struct inode *inode,
 		     int deletion, int xent);
+int ubifs_prepare_data_node(const struct ubifs_info *c,
+			    const struct inode *inode,
+			    const union ubifs_key *key, const void *buf,
+			    int len, struct ubifs_data_node *data, int parallel);
+int ubifs_jnl_write_data_node(struct ubifs_info *c, const union ubifs_key *key,
+			      struct ubifs_data_node *data, int dlen);
 int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len);
 int ubifs_jnl_write_inode(struct ubifs_info *c, const struct inode *inode);
@@ -1668,6 +1789,7 @@ int ubifs_replay_journal(struct ubifs_info *c);
 
 /* gc.c */
 int ubifs_garbage_collect(struct ubifs_info *c, int anyway);
+int ubifs_bg_gc(struct ubifs_info *c);
 int ubifs_gc_start_commit(struct ubifs_info *c);
 int ubifs_gc_end_commit(struct ubifs_info *c);
 void ubifs_destroy_idx_gc(struct ubifs_info *c);
@@ -1793,6 +1915,11 @@ int __init ubifs_compressors_init(void);
 void ubifs_compressors_exit(void);
 void ubifs_compress(const struct ubifs_info *c, const void *in_buf, int in_len,
 		    void *out_buf, int *out_len, int *compr_type);
+void ubifs_compress_parallel(const struct ubifs_info *c, const void *in_buf,
+			     int in_len, void *out_buf, int *out_len,
+			     int *compr_type);
+int ubifs_compr_pool_init(struct ubifs_info *c);
+void ubifs_compr_pool_exit(struct ubifs_info *c);
 int ubifs_decompress(const struct ubifs_info *c, const void *buf, int len,
 		     void *out, int *out_len, int compr_type);
 
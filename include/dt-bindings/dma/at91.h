@@ -42,6 +42,19 @@
 #define AT91_XDMAC_DT_GET_PER_IF(cfg)	(((cfg) >> AT91_XDMAC_DT_PER_IF_OFFSET) \
 					& AT91_XDMAC_DT_PER_IF_MASK)
 
+/*
+ * Arbitration weight requested by the channel (0: default). The controller
+ * arbitrates between pools of transfers rather than between channels, so the
+ * highest weight requested by a peripheral channel is applied to the
+ * peripheral transfer pools.
+ */
+#define AT91_XDMAC_DT_PRIO_MASK		(0xf)
+#define AT91_XDMAC_DT_PRIO_OFFSET	(16)
+#define AT91_XDMAC_DT_PRIO(prio)	(((prio) & AT91_XDMAC_DT_PRIO_MASK) \
+					<< AT91_XDMAC_DT_PRIO_OFFSET)
+#define AT91_XDMAC_DT_GET_PRIO(cfg)	(((cfg) >> AT91_XDMAC_DT_PRIO_OFFSET) \
+					& AT91_XDMAC_DT_PRIO_MASK)
+
 #define AT91_XDMAC_DT_PERID_MASK	(0x7f)
 #define AT91_XDMAC_DT_PERID_OFFSET	(24)
 #define AT91_XDMAC_DT_PERID(perid)	(((perid) & AT91_XDMAC_DT_PERID_MASK) \
@@ -0,0 +1,32 @@
+#ifndef __INCLUDE_ATMEL_SRAM_H
+#define __INCLUDE_ATMEL_SRAM_H
+
+#include <linux/device.h>
+#include <linux/genalloc.h>
+
+#ifdef CONFIG_ATMEL_SRAM
+struct gen_pool *atmel_sram_get_pool(void);
+struct gen_pool *devm_atmel_sram_pool(struct device *dev, size_t size);
+void *devm_atmel_sram_alloc(struct device *dev, struct gen_pool *pool,
+			    size_t size, dma_addr_t *dma);
+#else
+static inline struct gen_pool *atmel_sram_get_pool(void)
+{
+	return NULL;
+}
+
+static inline struct gen_pool *devm_atmel_sram_pool(struct device *dev,
+						    size_t size)
+{
+	return NULL;
+}
+
+static inline void *devm_atmel_sram_alloc(struct device *dev,
+					  struct gen_pool *pool, size_t size,
+					  dma_addr_t *dma)
+{
+	return NULL;
+}
+#endif
+
+#endif /* __INCLUDE_ATMEL_SRAM_H */
@@ -0,0 +1,20 @@
+#ifndef __INCLUDE_ATMEL_PWM_H
+#define __INCLUDE_ATMEL_PWM_H
+
+#include <linux/dmaengine.h>
+#include <linux/pwm.h>
+#include <linux/types.h>
+
+/*
+ * Duty cycle streaming, on PWM controllers with synchronous channels and
+ * a DMA channel ("tx" in the device tree).  At each period of the first
+ * PWM, the DMA controller loads the next duty cycle of a buffer of u32
+ * register values, built with atmel_pwm_duty_to_reg().
+ */
+u32 atmel_pwm_duty_to_reg(struct pwm_device *pwm, unsigned int duty_ns);
+int atmel_pwm_stream_start(struct pwm_device *pwm, dma_addr_t buf,
+			   unsigned int count, bool cyclic,
+			   dma_async_tx_callback callback, void *param);
+void atmel_pwm_stream_stop(struct pwm_device *pwm);
+
+#endif /* __INCLUDE_ATMEL_PWM_H */
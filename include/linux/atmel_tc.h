@@ -136,6 +136,7 @@ extern const u8 atmel_tc_divisors[5];
 #define     ATMEL_TC_SWTRG	(1 << 2)	/* software trigger */
 
 #define ATMEL_TC_CMR	0x04		/* Channel Mode Register */
+#define ATMEL_TC_RAB	0x0c		/* RA/RB in load order [some SAM only] */
 
 /* Both modes share some CMR bits */
 #define     ATMEL_TC_TCCLKS	(7 << 0)	/* clock source */
@@ -195,6 +195,35 @@ extern int bus_unregister_notifier(struct bus_type *bus,
 extern struct kset *bus_get_kset(struct bus_type *bus);
 extern struct klist *bus_get_device_klist(struct bus_type *bus);
 
+/**
+ * enum probe_type - device driver probe type to try
+ *	Device drivers may opt in for special handling of their
+ *	respective probe routines. This tells the core what to
+ *	expect and prefer.
+ *
+ * @PROBE_DEFAULT_STRATEGY: Used by drivers that work equally well
+ *	whether probed synchronously or asynchronously. They are probed
+ *	synchronously unless named in the "driver_async_probe=" kernel
+ *	command line parameter.
+ * @PROBE_PREFER_ASYNCHRONOUS: Drivers for "slow" devices which
+ *	probing order is not essential for booting the system may
+ *	opt into executing their probes asynchronously.
+ * @PROBE_FORCE_SYNCHRONOUS: Use this to annotate drivers that need
+ *	their probe routines to run synchronously with driver and
+ *	device registration.
+ *
+ * Note that the end goal is to switch the kernel to use asynchronous
+ * probing by default, so annotating drivers with
+ * %PROBE_PREFER_ASYNCHRONOUS is a temporary measure that allows us
+ * to speed up boot process while we are validating the rest of the
+ * drivers.
+ */
+enum probe_type {
+	PROBE_DEFAULT_STRATEGY,
+	PROBE_PREFER_ASYNCHRONOUS,
+	PROBE_FORCE_SYNCHRONOUS,
+};
+
 /**
  * struct device_driver - The basic device driver structure
  * @name:	Name of the device driver.
@@ -202,6 +231,7 @@ extern struct klist *bus_get_device_klist(struct bus_type *bus);
  * @owner:	The module owner.
  * @mod_name:	Used for built-in modules.
  * @suppress_bind_attrs: Disables bind/unbind via sysfs.
+ * @probe_type:	Type of the probe (synchronous or asynchronous) to use.
  * @of_match_table: The open firmware table.
  * @acpi_match_table: The ACPI match table.
  * @probe:	Called to query the existence of a specific device,
@@ -235,6 +265,7 @@ struct device_driver {
 	const char		*mod_name;	/* used for built-in modules */
 
 	bool suppress_bind_attrs;	/* disables bind/unbind via sysfs */
+	enum probe_type probe_type;
 
 	const struct of_device_id	*of_match_table;
 	const struct acpi_device_id	*acpi_match_table;
@@ -260,6 +291,33 @@ extern struct device_driver *driver_find(const char *name,
 extern int driver_probe_done(void);
 extern void wait_for_device_probe(void);
 
+/**
+ * enum probe_defer_supplier - what a deferred device is waiting for
+ * @PROBE_DEFER_UNKNOWN: not recorded; retried whenever a driver binds.
+ * @PROBE_DEFER_CLK: a clock provider.
+ * @PROBE_DEFER_REGULATOR: a regulator.
+ * @PROBE_DEFER_PINCTRL: a pin controller.
+ * @PROBE_DEFER_GPIO: a GPIO chip.
+ * @PROBE_DEFER_ALL: for triggers only, retry every deferred device.
+ *
+ * Supplier frameworks note the kind of supplier a lookup missed with
+ * driver_deferred_probe_wait(), and call driver_deferred_probe_supplier()
+ * when they register a new one: only the devices waiting for that kind
+ * are retried then.
+ */
+enum probe_defer_supplier {
+	PROBE_DEFER_UNKNOWN,
+	PROBE_DEFER_CLK,
+	PROBE_DEFER_REGULATOR,
+	PROBE_DEFER_PINCTRL,
+	PROBE_DEFER_GPIO,
+	PROBE_DEFER_ALL,
+};
+
+extern void driver_deferred_probe_wait(struct device *dev,
+				       enum probe_defer_supplier supplier);
+extern void driver_deferred_probe_supplier(enum probe_defer_supplier supplier);
+
 
 /* sysfs interface for exporting driver attributes */
 
@@ -184,6 +184,10 @@ struct dma_interleaved_template {
  *  operation it continues the calculation with new sources
  * @DMA_PREP_FENCE - tell the driver that subsequent operations depend
  *  on the result of this operation
+ * @DMA_PREP_IRQ_CALLBACK - hint that the completion callback may be invoked
+ *  from hard interrupt context instead of being deferred to a tasklet; the
+ *  callback must then be safe to run with interrupts disabled. Drivers that
+ *  do not support it keep their usual completion context.
  */
 enum dma_ctrl_flags {
 	DMA_PREP_INTERRUPT = (1 << 0),
@@ -192,6 +196,7 @@ enum dma_ctrl_flags {
 	DMA_PREP_PQ_DISABLE_Q = (1 << 3),
 	DMA_PREP_CONTINUE = (1 << 4),
 	DMA_PREP_FENCE = (1 << 5),
+	DMA_PREP_IRQ_CALLBACK = (1 << 6),
 };
 
 /**
@@ -322,6 +327,10 @@ enum dma_slave_buswidth {
  * @slave_id: Slave requester id. Only valid for slave channels. The dma
  * slave peripheral will have unique id as dma requester which need to be
  * pass as slave config.
+ * @periods_per_callback: for cyclic transfers, number of periods between two
+ * callbacks, 0 meaning every period. Clients that need a finer position
+ * than the callback rate read the residue. Drivers that don't support it
+ * call back after every period.
  *
  * This struct is passed in as configuration data to a DMA engine
  * in order to set up a certain channel for DMA transport at runtime.
@@ -345,6 +354,7 @@ struct dma_slave_config {
 	u32 dst_maxburst;
 	bool device_fc;
 	unsigned int slave_id;
+	unsigned int periods_per_callback;
 };
 
 /**
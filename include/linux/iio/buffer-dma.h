@@ -0,0 +1,115 @@
+/*
+ * Industrial I/O - DMA block buffer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef __LINUX_IIO_BUFFER_DMA_H__
+#define __LINUX_IIO_BUFFER_DMA_H__
+
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/iio/buffer.h>
+
+struct device;
+struct iio_dma_buffer_queue;
+
+/**
+ * enum iio_dma_buffer_block_state - owner of a block
+ * @IIO_BLOCK_STATE_DEQUEUED:	userspace, or the read() path
+ * @IIO_BLOCK_STATE_QUEUED:	waiting for the buffer to be enabled
+ * @IIO_BLOCK_STATE_ACTIVE:	submitted to the driver
+ * @IIO_BLOCK_STATE_DONE:	filled, waiting to be dequeued
+ */
+enum iio_dma_buffer_block_state {
+	IIO_BLOCK_STATE_DEQUEUED,
+	IIO_BLOCK_STATE_QUEUED,
+	IIO_BLOCK_STATE_ACTIVE,
+	IIO_BLOCK_STATE_DONE,
+};
+
+/**
+ * struct iio_dma_buffer_block - a DMA-able block of the buffer
+ * @head:	entry in the incoming or outgoing list of the queue
+ * @queue:	queue the block belongs to
+ * @vaddr:	CPU address of the block
+ * @phys_addr:	bus address of the block
+ * @block:	descriptor userspace sees, @block.size is the size of the block
+ *		and the driver sets @block.bytes_used before completing it
+ * @state:	owner of the block, protected by the list lock of the queue
+ */
+struct iio_dma_buffer_block {
+	struct list_head		head;
+	struct iio_dma_buffer_queue	*queue;
+	void				*vaddr;
+	dma_addr_t			phys_addr;
+	struct iio_buffer_block		block;
+	enum iio_dma_buffer_block_state	state;
+};
+
+/**
+ * struct iio_dma_buffer_ops - driver side of a DMA block buffer
+ * @submit:	start filling @block, iio_dma_buffer_block_done() is to be
+ *		called once it is. Called from process context, with the
+ *		buffer enabled.
+ * @abort:	stop all the transfers, called when the buffer is disabled.
+ *		Blocks the driver had not completed go back to the queue.
+ */
+struct iio_dma_buffer_ops {
+	int (*submit)(struct iio_dma_buffer_queue *queue,
+		      struct iio_dma_buffer_block *block);
+	void (*abort)(struct iio_dma_buffer_queue *queue);
+};
+
+/**
+ * struct iio_dma_buffer_queue - DMA block buffer
+ * @buffer:	IIO buffer of the queue
+ * @dev:	device the blocks are allocated for, the DMA controller
+ * @ops:	driver callbacks
+ * @driver_data: private data of the driver
+ * @lock:	protects the blocks, @active and @fileio against each other
+ * @list_lock:	protects the lists and the block states against completions
+ * @incoming:	blocks waiting for the buffer to be enabled
+ * @outgoing:	filled blocks, oldest first
+ * @blocks:	all the blocks, indexed by id
+ * @num_blocks:	number of blocks
+ * @mapped:	number of userspace mappings of the blocks
+ * @active:	the buffer is enabled
+ * @fileio:	the blocks were allocated for read(), not by userspace
+ * @fileio_pos:	bytes of the first outgoing block already read()
+ */
+struct iio_dma_buffer_queue {
+	struct iio_buffer		buffer;
+	struct device			*dev;
+	const struct iio_dma_buffer_ops	*ops;
+	void				*driver_data;
+
+	struct mutex			lock;
+	spinlock_t			list_lock;
+	struct list_head		incoming;
+	struct list_head		outgoing;
+
+	struct iio_dma_buffer_block	**blocks;
+	unsigned int			num_blocks;
+	atomic_t			mapped;
+	bool				active;
+	bool				fileio;
+	size_t				fileio_pos;
+};
+
+struct iio_buffer *iio_dma_buffer_alloc(struct device *dev,
+					const struct iio_dma_buffer_ops *ops,
+					void *driver_data);
+void iio_dma_buffer_free(struct iio_buffer *buffer);
+
+int iio_dma_buffer_enable(struct iio_buffer *buffer);
+void iio_dma_buffer_disable(struct iio_buffer *buffer);
+
+void iio_dma_buffer_block_done(struct iio_dma_buffer_block *block);
+
+#endif
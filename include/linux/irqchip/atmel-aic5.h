@@ -0,0 +1,16 @@
+/*
+ * Atmel AIC5 FIQ routing
+ *
+ * This file is licensed under the terms of the GNU General Public
+ * License version 2.  This program is licensed "as is" without any
+ * warranty of any kind, whether express or implied.
+ */
+
+#ifndef __INCLUDE_LINUX_IRQCHIP_ATMEL_AIC5_H
+#define __INCLUDE_LINUX_IRQCHIP_ATMEL_AIC5_H
+
+#include <linux/types.h>
+
+int aic5_set_fast_forcing(unsigned int irq, bool on);
+
+#endif /* __INCLUDE_LINUX_IRQCHIP_ATMEL_AIC5_H */
@@ -188,7 +188,8 @@ struct sdio_cccr {
 				wide_bus:1,
 				high_power:1,
 				high_speed:1,
-				disable_cd:1;
+				disable_cd:1,
+				irq_4bit_data:1;
 };
 
 struct sdio_cis {
@@ -285,6 +285,7 @@ struct mmc_host {
 				 MMC_CAP2_HS400_1_2V)
 #define MMC_CAP2_HSX00_1_2V	(MMC_CAP2_HS200_1_2V_SDR | MMC_CAP2_HS400_1_2V)
 #define MMC_CAP2_SDIO_IRQ_NOTHREAD (1 << 17)
+#define MMC_CAP2_SDIO_IRQ_4BIT_DATA (1 << 18)	/* Card IRQs during 4-bit data */
 
 	mmc_pm_flag_t		pm_caps;	/* supported pm features */
 
@@ -21,6 +21,7 @@
 #define __MTD_MTD_H__
 
 #include <linux/types.h>
+#include <linux/atomic.h>
 #include <linux/uio.h>
 #include <linux/notifier.h>
 #include <linux/device.h>
@@ -37,6 +38,38 @@
 
 #define MTD_FAIL_ADDR_UNKNOWN -1LL
 
+enum mtd_io_op {
+	MTD_IO_READ,
+	MTD_IO_WRITE,
+	MTD_IO_ERASE,
+	MTD_IO_NR_OPS,
+};
+
+/* Power of two buckets of microseconds, the last one catches the rest */
+#define MTD_IO_LAT_BUCKETS	16
+#define MTD_IO_BITFLIP_BUCKETS	16
+
+/**
+ * struct mtd_io_stats - I/O statistics of mtd_read(), mtd_write() and
+ *			 mtd_erase(), listed in debugfs
+ * @lat: latency histograms, bucket N counts the calls which took less than
+ *	 2^N microseconds
+ * @bitflips: reads by maximum number of bitflips corrected in one ECC step
+ * @bytes: bytes transferred or erased
+ * @errors: calls which failed, not counting -EUCLEAN reads
+ */
+struct mtd_io_stats {
+	atomic_long_t lat[MTD_IO_NR_OPS][MTD_IO_LAT_BUCKETS];
+	atomic_long_t bitflips[MTD_IO_BITFLIP_BUCKETS];
+	atomic64_t bytes[MTD_IO_NR_OPS];
+	atomic_long_t errors[MTD_IO_NR_OPS];
+};
+
+struct mtd_debug_info {
+	struct dentry *dfs_dir;
+	struct mtd_io_stats io_stats;
+};
+
 /*
  * If the erase fails, fail_addr might indicate exactly which block failed. If
  * fail_addr = MTD_FAIL_ADDR_UNKNOWN, the failure was not at the device level
@@ -252,6 +285,9 @@ struct mtd_info {
 	struct module *owner;
 	struct device dev;
 	int usecount;
+#ifdef CONFIG_DEBUG_FS
+	struct mtd_debug_info dbg;
+#endif
 };
 
 int mtd_erase(struct mtd_info *mtd, struct erase_info *instr);
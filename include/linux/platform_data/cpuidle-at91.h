@@ -0,0 +1,36 @@
+/*
+ * AT91 cpuidle platform data
+ *
+ * This file is licensed under the terms of the GNU General Public
+ * License version 2.  This program is licensed "as is" without any
+ * warranty of any kind, whether express or implied.
+ */
+
+#ifndef __CPUIDLE_AT91_H
+#define __CPUIDLE_AT91_H
+
+/**
+ * struct at91_cpuidle_state - one idle state of the SoC
+ * @standby:		enters the state and returns on the next interrupt
+ * @exit_latency:	worst case wakeup latency, in microseconds
+ * @target_residency:	minimum idle time, in microseconds, for the state
+ *			to save power over the previous one
+ */
+struct at91_cpuidle_state {
+	void (*standby)(void);
+	unsigned int exit_latency;
+	unsigned int target_residency;
+};
+
+/**
+ * struct at91_cpuidle_data - idle states handed over by the PM code
+ * @sr:		WFI and RAM self-refresh, always present
+ * @mck:	as @sr, with the master clock running from the main clock;
+ *		optional, @mck.standby is NULL when unavailable
+ */
+struct at91_cpuidle_data {
+	struct at91_cpuidle_state sr;
+	struct at91_cpuidle_state mck;
+};
+
+#endif /* __CPUIDLE_AT91_H */
@@ -0,0 +1,45 @@
+/*
+ * Tracepoints for the AT91 PMC clock drivers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM at91_pmc
+
+#if !defined(_TRACE_AT91_PMC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_AT91_PMC_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(at91_pmc_wait_ready,
+
+	TP_PROTO(const char *name, u32 mask, s64 duration_ns, bool slept),
+
+	TP_ARGS(name, mask, duration_ns, slept),
+
+	TP_STRUCT__entry(
+		__string(	name,		name		)
+		__field(	u32,		mask		)
+		__field(	s64,		duration_ns	)
+		__field(	bool,		slept		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->mask = mask;
+		__entry->duration_ns = duration_ns;
+		__entry->slept = slept;
+	),
+
+	TP_printk("%s mask=0x%08x duration=%lldns%s", __get_str(name),
+		  __entry->mask, (long long)__entry->duration_ns,
+		  __entry->slept ? " irq" : "")
+);
+
+#endif /* _TRACE_AT91_PMC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,113 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dd
+
+#if !defined(_TRACE_DD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_DD_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+#define show_defer_supplier(supplier)					\
+	__print_symbolic(supplier,					\
+		{ PROBE_DEFER_UNKNOWN,		"unknown" },		\
+		{ PROBE_DEFER_CLK,		"clk" },		\
+		{ PROBE_DEFER_REGULATOR,	"regulator" },		\
+		{ PROBE_DEFER_PINCTRL,		"pinctrl" },		\
+		{ PROBE_DEFER_GPIO,		"gpio" },		\
+		{ PROBE_DEFER_ALL,		"all" })
+
+TRACE_EVENT(dd_probe_start,
+
+	TP_PROTO(struct device *dev, struct device_driver *drv),
+
+	TP_ARGS(dev, drv),
+
+	TP_STRUCT__entry(
+		__string(	device,		dev_name(dev)	)
+		__string(	driver,		drv->name	)
+	),
+
+	TP_fast_assign(
+		__assign_str(device, dev_name(dev));
+		__assign_str(driver, drv->name);
+	),
+
+	TP_printk("device=%s driver=%s", __get_str(device), __get_str(driver))
+);
+
+TRACE_EVENT(dd_probe_end,
+
+	TP_PROTO(struct device *dev, struct device_driver *drv, int ret,
+		 s64 duration_ns),
+
+	TP_ARGS(dev, drv, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__string(	device,		dev_name(dev)	)
+		__string(	driver,		drv->name	)
+		__field(	int,		ret		)
+		__field(	s64,		duration_ns	)
+	),
+
+	TP_fast_assign(
+		__assign_str(device, dev_name(dev));
+		__assign_str(driver, drv->name);
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("device=%s driver=%s ret=%d duration=%lldns",
+		  __get_str(device), __get_str(driver), __entry->ret,
+		  __entry->duration_ns)
+);
+
+TRACE_EVENT(dd_probe_defer,
+
+	TP_PROTO(struct device *dev, struct device_driver *drv, int supplier,
+		 unsigned int defers),
+
+	TP_ARGS(dev, drv, supplier, defers),
+
+	TP_STRUCT__entry(
+		__string(	device,		dev_name(dev)	)
+		__string(	driver,		drv->name	)
+		__field(	int,		supplier	)
+		__field(	unsigned int,	defers		)
+	),
+
+	TP_fast_assign(
+		__assign_str(device, dev_name(dev));
+		__assign_str(driver, drv->name);
+		__entry->supplier = supplier;
+		__entry->defers = defers;
+	),
+
+	TP_printk("device=%s driver=%s waits=%s defers=%u",
+		  __get_str(device), __get_str(driver),
+		  show_defer_supplier(__entry->supplier), __entry->defers)
+);
+
+TRACE_EVENT(dd_deferred_trigger,
+
+	TP_PROTO(int supplier, unsigned int retried),
+
+	TP_ARGS(supplier, retried),
+
+	TP_STRUCT__entry(
+		__field(	int,		supplier	)
+		__field(	unsigned int,	retried		)
+	),
+
+	TP_fast_assign(
+		__entry->supplier = supplier;
+		__entry->retried = retried;
+	),
+
+	TP_printk("supplier=%s retried=%u",
+		  show_defer_supplier(__entry->supplier), __entry->retried)
+);
+
+#endif /* _TRACE_DD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,85 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dmaengine
+
+#if !defined(_TRACE_DMAENGINE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_DMAENGINE_H
+
+#include <linux/dmaengine.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(dma_tx,
+
+	TP_PROTO(struct dma_chan *chan, dma_cookie_t cookie, size_t len),
+
+	TP_ARGS(chan, cookie, len),
+
+	TP_STRUCT__entry(
+		__string(chan, dma_chan_name(chan))
+		__field(dma_cookie_t, cookie)
+		__field(size_t, len)
+	),
+
+	TP_fast_assign(
+		__assign_str(chan, dma_chan_name(chan));
+		__entry->cookie = cookie;
+		__entry->len = len;
+	),
+
+	TP_printk("%s cookie=%d len=%zu", __get_str(chan), __entry->cookie,
+		  __entry->len)
+);
+
+DEFINE_EVENT(dma_tx, dma_tx_submit,
+
+	TP_PROTO(struct dma_chan *chan, dma_cookie_t cookie, size_t len),
+
+	TP_ARGS(chan, cookie, len)
+);
+
+DEFINE_EVENT(dma_tx, dma_callback,
+
+	TP_PROTO(struct dma_chan *chan, dma_cookie_t cookie, size_t len),
+
+	TP_ARGS(chan, cookie, len)
+);
+
+TRACE_EVENT(dma_issue_pending,
+
+	TP_PROTO(struct dma_chan *chan),
+
+	TP_ARGS(chan),
+
+	TP_STRUCT__entry(
+		__string(chan, dma_chan_name(chan))
+	),
+
+	TP_fast_assign(
+		__assign_str(chan, dma_chan_name(chan));
+	),
+
+	TP_printk("%s", __get_str(chan))
+);
+
+TRACE_EVENT(dma_irq,
+
+	TP_PROTO(struct dma_chan *chan, u32 status),
+
+	TP_ARGS(chan, status),
+
+	TP_STRUCT__entry(
+		__string(chan, dma_chan_name(chan))
+		__field(u32, status)
+	),
+
+	TP_fast_assign(
+		__assign_str(chan, dma_chan_name(chan));
+		__entry->status = status;
+	),
+
+	TP_printk("%s status=0x%08x", __get_str(chan), __entry->status)
+);
+
+#endif /* if !defined(_TRACE_DMAENGINE_H) || defined(TRACE_HEADER_MULTI_READ) */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,68 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mtd
+
+#if !defined(_TRACE_MTD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MTD_H
+
+#include <linux/mtd/mtd.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mtd_io,
+
+	TP_PROTO(struct mtd_info *mtd, loff_t ofs, u64 len, int ret,
+		 unsigned int bitflips, s64 duration_ns),
+
+	TP_ARGS(mtd, ofs, len, ret, bitflips, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(	int,		index		)
+		__field(	loff_t,		ofs		)
+		__field(	u64,		len		)
+		__field(	int,		ret		)
+		__field(	unsigned int,	bitflips	)
+		__field(	s64,		duration_ns	)
+	),
+
+	TP_fast_assign(
+		__entry->index = mtd->index;
+		__entry->ofs = ofs;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->bitflips = bitflips;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("mtd%d ofs=0x%llx len=%llu ret=%d bitflips=%u duration=%lldns",
+		  __entry->index, (unsigned long long)__entry->ofs,
+		  (unsigned long long)__entry->len, __entry->ret,
+		  __entry->bitflips, (long long)__entry->duration_ns)
+);
+
+DEFINE_EVENT(mtd_io, mtd_io_read,
+
+	TP_PROTO(struct mtd_info *mtd, loff_t ofs, u64 len, int ret,
+		 unsigned int bitflips, s64 duration_ns),
+
+	TP_ARGS(mtd, ofs, len, ret, bitflips, duration_ns)
+);
+
+DEFINE_EVENT(mtd_io, mtd_io_write,
+
+	TP_PROTO(struct mtd_info *mtd, loff_t ofs, u64 len, int ret,
+		 unsigned int bitflips, s64 duration_ns),
+
+	TP_ARGS(mtd, ofs, len, ret, bitflips, duration_ns)
+);
+
+DEFINE_EVENT(mtd_io, mtd_io_erase,
+
+	TP_PROTO(struct mtd_info *mtd, loff_t ofs, u64 len, int ret,
+		 unsigned int bitflips, s64 duration_ns),
+
+	TP_ARGS(mtd, ofs, len, ret, bitflips, duration_ns)
+);
+
+#endif /* _TRACE_MTD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
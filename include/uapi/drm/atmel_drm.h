@@ -22,8 +22,51 @@
 #include <drm/drm.h>
 
 #define DRM_ATMEL_GEM_GET		0x00
+#define DRM_ATMEL_BLIT			0x01
+
+#define DRM_ATMEL_BLIT_COPY		0
+#define DRM_ATMEL_BLIT_FILL		1
+
+/**
+ * struct drm_atmel_blit - rectangle copy or fill between GEM buffers
+ * @op: DRM_ATMEL_BLIT_COPY or DRM_ATMEL_BLIT_FILL
+ * @cpp: bytes per pixel, up to 4; 1, 2 or 4 for fills
+ * @width: rectangle width, in pixels
+ * @height: rectangle height, in lines
+ * @dst_handle: destination GEM object
+ * @dst_pitch: destination line length, in bytes
+ * @dst_x: destination left column
+ * @dst_y: destination top line
+ * @src_handle: source GEM object, for copies
+ * @src_pitch: source line length, in bytes
+ * @src_x: source left column
+ * @src_y: source top line
+ * @color: fill value, in the pixel format of the destination
+ * @pad: must be zero
+ *
+ * The ioctl returns once the operation is done. Source and destination
+ * must not overlap.
+ */
+struct drm_atmel_blit {
+	__u32 op;
+	__u32 cpp;
+	__u32 width;
+	__u32 height;
+	__u32 dst_handle;
+	__u32 dst_pitch;
+	__u32 dst_x;
+	__u32 dst_y;
+	__u32 src_handle;
+	__u32 src_pitch;
+	__u32 src_x;
+	__u32 src_y;
+	__u32 color;
+	__u32 pad;
+};
 
 #define DRM_IOCTL_ATMEL_GEM_GET		DRM_IOWR(DRM_COMMAND_BASE + \
 					DRM_ATMEL_GEM_GET, struct drm_mode_map_dumb)
+#define DRM_IOCTL_ATMEL_BLIT		DRM_IOW(DRM_COMMAND_BASE + \
+					DRM_ATMEL_BLIT, struct drm_atmel_blit)
 
 #endif /* _UAPI_ATMEL_DRM_H_ */
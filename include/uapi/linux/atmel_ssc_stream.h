@@ -0,0 +1,38 @@
+/*
+ * Atmel SSC streaming device
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef _UAPI_LINUX_ATMEL_SSC_STREAM_H
+#define _UAPI_LINUX_ATMEL_SSC_STREAM_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct ssc_stream_status - positions of the DMA in the rings
+ * @rx_pos:		bytes written into the receive ring since open
+ * @tx_pos:		bytes taken from the transmit ring since open
+ * @ring_size:		size of each ring; the receive ring is mapped at
+ *			offset 0, the transmit ring at offset @ring_size
+ * @rx_overruns:	times read() found unread data overwritten
+ * @tx_underruns:	times write() found the ring sent before it was filled
+ * @reserved:		zero
+ *
+ * A position modulo @ring_size is an offset into its ring.
+ */
+struct ssc_stream_status {
+	__u64	rx_pos;
+	__u64	tx_pos;
+	__u32	ring_size;
+	__u32	rx_overruns;
+	__u32	tx_underruns;
+	__u32	reserved;
+};
+
+#define SSC_STREAM_IOC_STATUS	_IOR(0xb5, 0x00, struct ssc_stream_status)
+
+#endif /* _UAPI_LINUX_ATMEL_SSC_STREAM_H */
@@ -30,6 +30,7 @@
  * unsigned long, except for:
  *	- I2C_FUNCS, takes pointer to an unsigned long
  *	- I2C_RDWR, takes pointer to struct i2c_rdwr_ioctl_data
+ *	- I2C_BATCH, takes pointer to struct i2c_batch_ioctl_data
  *	- I2C_SMBUS, takes pointer to struct i2c_smbus_ioctl_data
  */
 #define I2C_RETRIES	0x0701	/* number of times a device address should
@@ -49,6 +50,7 @@
 #define I2C_RDWR	0x0707	/* Combined R/W transfer (one STOP only) */
 
 #define I2C_PEC		0x0708	/* != 0 to use PEC with SMBus */
+#define I2C_BATCH	0x0709	/* Independent I2C_RDWR transfers, queued */
 #define I2C_SMBUS	0x0720	/* SMBus transfer */
 
 
@@ -68,5 +70,20 @@ struct i2c_rdwr_ioctl_data {
 
 #define  I2C_RDRW_IOCTL_MAX_MSGS	42
 
+/* One combined transfer of the I2C_BATCH ioctl call */
+struct i2c_batch_xfer {
+	struct i2c_msg __user *msgs;	/* pointers to i2c_msgs */
+	__u32 nmsgs;			/* number of i2c_msgs */
+	__s32 result;			/* out: i2c_transfer() return value */
+};
+
+/* This is the structure as used in the I2C_BATCH ioctl call */
+struct i2c_batch_ioctl_data {
+	struct i2c_batch_xfer __user *xfers;	/* pointers to transfers */
+	__u32 nxfers;				/* number of transfers */
+};
+
+#define  I2C_BATCH_IOCTL_MAX_XFERS	32
+
 
 #endif /* _UAPI_LINUX_I2C_DEV_H */
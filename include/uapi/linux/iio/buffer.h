@@ -0,0 +1,64 @@
+/* The industrial I/O - block access to the buffer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+#ifndef _UAPI_IIO_BUFFER_H_
+#define _UAPI_IIO_BUFFER_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct iio_buffer_block_alloc_req - request to allocate the buffer blocks
+ * @type:	reserved, must be 0
+ * @size:	size of each block, in bytes
+ * @count:	number of blocks wanted, updated with the number allocated
+ * @id:		reserved, must be 0
+ *
+ * A count of 0 frees the blocks. Blocks can only be allocated or freed while
+ * the buffer is disabled, and freed once they are all unmapped.
+ */
+struct iio_buffer_block_alloc_req {
+	__u32 type;
+	__u32 size;
+	__u32 count;
+	__u32 id;
+};
+
+/**
+ * struct iio_buffer_block - descriptor of a buffer block
+ * @id:		index of the block, from 0 to count - 1
+ * @size:	size of the block, in bytes
+ * @bytes_used:	bytes of samples the device stored into the block
+ * @type:	reserved, must be 0
+ * @flags:	reserved, must be 0
+ * @data.offset: offset to pass to mmap() to map the block
+ * @timestamp:	time the block was filled
+ *
+ * A block either belongs to userspace or to the device. Allocated and
+ * dequeued blocks belong to userspace, IIO_BUFFER_BLOCK_ENQUEUE_IOCTL hands a
+ * block to the device, IIO_BUFFER_BLOCK_DEQUEUE_IOCTL gets the oldest filled
+ * block back. The samples are laid out as read() would return them.
+ */
+struct iio_buffer_block {
+	__u32 id;
+	__u32 size;
+	__u32 bytes_used;
+	__u32 type;
+	__u32 flags;
+	union {
+		__u32 offset;
+	} data;
+	__s64 timestamp;
+};
+
+#define IIO_BUFFER_BLOCK_ALLOC_IOCTL	_IOWR('i', 0xa0, \
+					      struct iio_buffer_block_alloc_req)
+#define IIO_BUFFER_BLOCK_FREE_IOCTL	_IO('i', 0xa1)
+#define IIO_BUFFER_BLOCK_QUERY_IOCTL	_IOWR('i', 0xa2, struct iio_buffer_block)
+#define IIO_BUFFER_BLOCK_ENQUEUE_IOCTL	_IOWR('i', 0xa3, struct iio_buffer_block)
+#define IIO_BUFFER_BLOCK_DEQUEUE_IOCTL	_IOWR('i', 0xa4, struct iio_buffer_block)
+
+#endif /* _UAPI_IIO_BUFFER_H_ */
@@ -174,6 +174,14 @@ enum v4l2_colorfx {
  * We reserve 16 controls for this driver. */
 #define V4L2_CID_USER_ADV7180_BASE		(V4L2_CID_USER_BASE + 0x1070)
 
+/* The base for the Hantro G1 video decoder driver controls.
+ * We reserve 16 controls for this driver. */
+#define V4L2_CID_USER_VDEC_G1_BASE		(V4L2_CID_USER_BASE + 0x1080)
+
+/* The base for the Atmel ISC driver controls.
+ * We reserve 16 controls for this driver. */
+#define V4L2_CID_USER_ATMEL_ISC_BASE		(V4L2_CID_USER_BASE + 0x1090)
+
 /* MPEG-class control IDs */
 /* The MPEG controls are applicable to all codec controls
  * and the 'MPEG' part of the define is historical */
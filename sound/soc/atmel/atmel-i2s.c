@@ -26,6 +26,7 @@
 #include <linux/delay.h>
 #include <linux/io.h>
 #include <linux/clk.h>
+#include <linux/dmaengine.h>
 #include <linux/mfd/syscon.h>
 
 #include <sound/core.h>
@@ -206,6 +207,17 @@ struct atmel_i2s_caps {
 	int	(*mck_init)(struct atmel_i2s_dev *, struct device_node *np);
 };
 
+/*
+ * Per audio channel DMA: each channel has its own DMA request and fills its
+ * own part of a non-interleaved buffer.
+ */
+struct atmel_i2s_mch {
+	struct dma_chan		*chan[ATMEL_I2SC_MAX_TDM_CHANNELS];
+	dma_cookie_t		cookie[ATMEL_I2SC_MAX_TDM_CHANNELS];
+	unsigned int		nchan;
+	unsigned int		nactive;
+};
+
 struct atmel_i2s_dev {
 	struct device				*dev;
 	struct regmap				*regmap;
@@ -217,6 +229,9 @@ struct atmel_i2s_dev {
 	unsigned int				fmt;
 	const struct atmel_i2s_gck_param	*gck_param;
 	const struct atmel_i2s_caps		*caps;
+	struct snd_soc_dai_driver		dai_drv;
+	struct atmel_i2s_mch			mch[2];
+	bool					multi_dma;
 };
 
 
@@ -331,14 +346,40 @@ static int atmel_i2s_hw_params(struct snd_pcm_substream *substream,
 {
 	struct atmel_i2s_dev *dev = snd_soc_dai_get_drvdata(dai);
 	bool is_playback = (substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
+	struct snd_dmaengine_dai_dma_data *dma_data;
+	bool stereo = (params_channels(params) == 2);
 	unsigned int mr = 0;
 	int ret;
 
+	/*
+	 * The I2SC has no FIFO, so the DMA has to keep doing single data
+	 * transfers. In compact mode, a stereo pair of 8 or 16-bit samples
+	 * goes through one holding register access, which halves the number
+	 * of DMA requests.
+	 */
+	dma_data = is_playback ? &dev->playback : &dev->capture;
+	dma_data->addr_width = DMA_SLAVE_BUSWIDTH_UNDEFINED;
+
+	/* Each channel has its own DMA, so there's no pair to compact */
+	if (dev->multi_dma) {
+		mr |= is_playback ? ATMEL_I2SC_MR_TXDME_MULTIPLE :
+				    ATMEL_I2SC_MR_RXDMA_MULTIPLE;
+		stereo = false;
+	}
+
 	switch (dev->fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
 	case SND_SOC_DAIFMT_I2S:
 		mr |= ATMEL_I2SC_MR_FORMAT_I2S;
 		break;
 
+	case SND_SOC_DAIFMT_DSP_A:
+		mr |= ATMEL_I2SC_MR_FORMAT_TDM;
+		break;
+
+	case SND_SOC_DAIFMT_DSP_B:
+		mr |= ATMEL_I2SC_MR_FORMAT_TDMLJ;
+		break;
+
 	default:
 		dev_err(dev->dev, "unsupported bus format\n");
 		return -EINVAL;
@@ -371,17 +412,33 @@ static int atmel_i2s_hw_params(struct snd_pcm_substream *substream,
 	case 2:
 		break;
 	default:
-		dev_err(dev->dev, "unsupported number of audio channels\n");
+		/* More than two channels need a TDM frame */
+		if ((mr & ATMEL_I2SC_MR_FORMAT_MASK) != ATMEL_I2SC_MR_FORMAT_TDM &&
+		    (mr & ATMEL_I2SC_MR_FORMAT_MASK) != ATMEL_I2SC_MR_FORMAT_TDMLJ) {
+			dev_err(dev->dev,
+				"unsupported number of audio channels\n");
+			return -EINVAL;
+		}
 		break;
 	}
 
 	switch (params_format(params)) {
 	case SNDRV_PCM_FORMAT_S8:
-		mr |= ATMEL_I2SC_MR_DATALENGTH_8_BITS;
+		if (stereo) {
+			mr |= ATMEL_I2SC_MR_DATALENGTH_8_BITS_COMPACT;
+			dma_data->addr_width = DMA_SLAVE_BUSWIDTH_2_BYTES;
+		} else {
+			mr |= ATMEL_I2SC_MR_DATALENGTH_8_BITS;
+		}
 		break;
 
 	case SNDRV_PCM_FORMAT_S16_LE:
-		mr |= ATMEL_I2SC_MR_DATALENGTH_16_BITS;
+		if (stereo) {
+			mr |= ATMEL_I2SC_MR_DATALENGTH_16_BITS_COMPACT;
+			dma_data->addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+		} else {
+			mr |= ATMEL_I2SC_MR_DATALENGTH_16_BITS;
+		}
 		break;
 
 	case SNDRV_PCM_FORMAT_S18_3LE:
@@ -573,6 +630,284 @@ static const struct snd_soc_component_driver atmel_i2s_component = {
 };
 
 
+/*
+ * ---- Multi-channel PCM ----
+ *
+ * Used instead of the generic dmaengine PCM when the device tree gives one
+ * DMA channel per audio channel ("rx0", "rx1", ... and/or "tx0", ...). The
+ * I2SC then raises a separate DMA request for each audio channel, so the DMA
+ * de-interleaves the TDM frame into a non-interleaved ALSA buffer. Channel i
+ * uses the i-th 1/channels of the buffer, as ALSA expects.
+ */
+static const struct snd_pcm_hardware atmel_i2s_mch_hardware = {
+	.info			= SNDRV_PCM_INFO_MMAP |
+				  SNDRV_PCM_INFO_MMAP_VALID |
+				  SNDRV_PCM_INFO_NONINTERLEAVED |
+				  SNDRV_PCM_INFO_RESUME |
+				  SNDRV_PCM_INFO_PAUSE,
+	.period_bytes_min	= 256,
+	.period_bytes_max	= 256 * 1024,
+	.periods_min		= 2,
+	.periods_max		= 1024,
+	.buffer_bytes_max	= 512 * 1024,
+};
+
+static struct atmel_i2s_mch *atmel_i2s_substream_to_mch(
+	struct snd_pcm_substream *substream)
+{
+	struct snd_soc_pcm_runtime *rtd = substream->private_data;
+	struct atmel_i2s_dev *dev = snd_soc_dai_get_drvdata(rtd->cpu_dai);
+
+	return &dev->mch[substream->stream];
+}
+
+static int atmel_i2s_mch_open(struct snd_pcm_substream *substream)
+{
+	struct atmel_i2s_mch *mch = atmel_i2s_substream_to_mch(substream);
+	int ret;
+
+	if (!mch->nchan)
+		return -ENODEV;
+
+	ret = snd_soc_set_runtime_hwparams(substream, &atmel_i2s_mch_hardware);
+	if (ret)
+		return ret;
+
+	/* Each channel runs its own cyclic transfer over whole periods */
+	return snd_pcm_hw_constraint_integer(substream->runtime,
+					     SNDRV_PCM_HW_PARAM_PERIODS);
+}
+
+static int atmel_i2s_mch_hw_params(struct snd_pcm_substream *substream,
+				   struct snd_pcm_hw_params *params)
+{
+	struct snd_soc_pcm_runtime *rtd = substream->private_data;
+	struct atmel_i2s_dev *dev = snd_soc_dai_get_drvdata(rtd->cpu_dai);
+	struct atmel_i2s_mch *mch = &dev->mch[substream->stream];
+	struct dma_slave_config config;
+	unsigned int i;
+	int ret;
+
+	if (params_channels(params) > mch->nchan)
+		return -EINVAL;
+
+	memset(&config, 0, sizeof(config));
+	ret = snd_hwparams_to_dma_slave_config(substream, params, &config);
+	if (ret)
+		return ret;
+
+	config.dst_addr = dev->playback.addr;
+	config.dst_maxburst = 1;
+	config.src_addr = dev->capture.addr;
+	config.src_maxburst = 1;
+
+	for (i = 0; i < params_channels(params); i++) {
+		ret = dmaengine_slave_config(mch->chan[i], &config);
+		if (ret)
+			return ret;
+	}
+	mch->nactive = params_channels(params);
+
+	return snd_pcm_lib_malloc_pages(substream, params_buffer_bytes(params));
+}
+
+static void atmel_i2s_mch_dma_complete(void *arg)
+{
+	struct snd_pcm_substream *substream = arg;
+
+	snd_pcm_period_elapsed(substream);
+}
+
+static void atmel_i2s_mch_terminate(struct atmel_i2s_mch *mch)
+{
+	unsigned int i;
+
+	for (i = 0; i < mch->nactive; i++)
+		dmaengine_terminate_all(mch->chan[i]);
+}
+
+static int atmel_i2s_mch_start(struct snd_pcm_substream *substream,
+			       struct atmel_i2s_mch *mch)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	enum dma_transfer_direction dir;
+	struct dma_async_tx_descriptor *desc;
+	size_t buf_len, period_len;
+	unsigned int i;
+
+	dir = snd_pcm_substream_to_dma_direction(substream);
+	buf_len = runtime->dma_bytes / runtime->channels;
+	period_len = snd_pcm_lib_period_bytes(substream) / runtime->channels;
+
+	for (i = 0; i < mch->nactive; i++) {
+		desc = dmaengine_prep_dma_cyclic(mch->chan[i],
+						 runtime->dma_addr + i * buf_len,
+						 buf_len, period_len, dir,
+						 i ? 0 : DMA_PREP_INTERRUPT);
+		if (!desc) {
+			atmel_i2s_mch_terminate(mch);
+			return -ENOMEM;
+		}
+
+		/* All channels move in lockstep, the first one clocks ALSA */
+		if (!i) {
+			desc->callback = atmel_i2s_mch_dma_complete;
+			desc->callback_param = substream;
+		}
+		mch->cookie[i] = dmaengine_submit(desc);
+	}
+
+	/* No request is raised before the DAI trigger enables the I2SC */
+	for (i = 0; i < mch->nactive; i++)
+		dma_async_issue_pending(mch->chan[i]);
+
+	return 0;
+}
+
+static int atmel_i2s_mch_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct atmel_i2s_mch *mch = atmel_i2s_substream_to_mch(substream);
+	unsigned int i;
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		return atmel_i2s_mch_start(substream, mch);
+
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		for (i = 0; i < mch->nactive; i++)
+			dmaengine_resume(mch->chan[i]);
+		break;
+
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		for (i = 0; i < mch->nactive; i++)
+			dmaengine_pause(mch->chan[i]);
+		break;
+
+	case SNDRV_PCM_TRIGGER_STOP:
+		atmel_i2s_mch_terminate(mch);
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static snd_pcm_uframes_t atmel_i2s_mch_pointer(
+	struct snd_pcm_substream *substream)
+{
+	struct atmel_i2s_mch *mch = atmel_i2s_substream_to_mch(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct dma_tx_state state;
+	size_t buf_len = runtime->dma_bytes / runtime->channels;
+	size_t pos = 0;
+
+	dmaengine_tx_status(mch->chan[0], mch->cookie[0], &state);
+	if (state.residue > 0 && state.residue <= buf_len)
+		pos = buf_len - state.residue;
+
+	return bytes_to_samples(runtime, pos);
+}
+
+static const struct snd_pcm_ops atmel_i2s_mch_ops = {
+	.open		= atmel_i2s_mch_open,
+	.ioctl		= snd_pcm_lib_ioctl,
+	.hw_params	= atmel_i2s_mch_hw_params,
+	.hw_free	= snd_pcm_lib_free_pages,
+	.trigger	= atmel_i2s_mch_trigger,
+	.pointer	= atmel_i2s_mch_pointer,
+};
+
+static int atmel_i2s_mch_pcm_new(struct snd_soc_pcm_runtime *rtd)
+{
+	struct atmel_i2s_dev *dev = snd_soc_dai_get_drvdata(rtd->cpu_dai);
+	struct snd_pcm_substream *substream;
+	int i, ret;
+
+	for (i = SNDRV_PCM_STREAM_PLAYBACK; i <= SNDRV_PCM_STREAM_CAPTURE; i++) {
+		substream = rtd->pcm->streams[i].substream;
+		if (!substream || !dev->mch[i].nchan)
+			continue;
+
+		ret = snd_pcm_lib_preallocate_pages(substream,
+				SNDRV_DMA_TYPE_DEV,
+				dev->mch[i].chan[0]->device->dev,
+				64 * 1024,
+				atmel_i2s_mch_hardware.buffer_bytes_max);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void atmel_i2s_mch_pcm_free(struct snd_pcm *pcm)
+{
+	snd_pcm_lib_preallocate_free_for_all(pcm);
+}
+
+static struct snd_soc_platform_driver atmel_i2s_mch_platform = {
+	.ops		= &atmel_i2s_mch_ops,
+	.pcm_new	= atmel_i2s_mch_pcm_new,
+	.pcm_free	= atmel_i2s_mch_pcm_free,
+};
+
+static void atmel_i2s_mch_release(void *data)
+{
+	struct atmel_i2s_dev *dev = data;
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(dev->mch); i++) {
+		for (j = 0; j < dev->mch[i].nchan; j++)
+			dma_release_channel(dev->mch[i].chan[j]);
+		dev->mch[i].nchan = 0;
+	}
+}
+
+static int atmel_i2s_mch_request(struct atmel_i2s_dev *dev)
+{
+	static const char * const prefix[] = {
+		[SNDRV_PCM_STREAM_PLAYBACK] = "tx",
+		[SNDRV_PCM_STREAM_CAPTURE] = "rx",
+	};
+	struct atmel_i2s_mch *mch;
+	struct dma_chan *chan;
+	char name[8];
+	int i, j, err;
+
+	for (i = 0; i < ARRAY_SIZE(dev->mch); i++) {
+		mch = &dev->mch[i];
+
+		for (j = 0; j < ATMEL_I2SC_MAX_TDM_CHANNELS; j++) {
+			snprintf(name, sizeof(name), "%s%d", prefix[i], j);
+			chan = dma_request_slave_channel_reason(dev->dev, name);
+			if (IS_ERR(chan)) {
+				err = PTR_ERR(chan);
+				if (err == -ENODEV)
+					break;
+				atmel_i2s_mch_release(dev);
+				return err;
+			}
+			mch->chan[mch->nchan++] = chan;
+		}
+	}
+
+	dev->multi_dma = dev->mch[SNDRV_PCM_STREAM_PLAYBACK].nchan ||
+			 dev->mch[SNDRV_PCM_STREAM_CAPTURE].nchan;
+	if (!dev->multi_dma)
+		return 0;
+
+	err = devm_add_action(dev->dev, atmel_i2s_mch_release, dev);
+	if (err)
+		atmel_i2s_mch_release(dev);
+
+	return err;
+}
+
+
 static int atmel_i2s_sama5d2_mck_init(struct atmel_i2s_dev *dev,
 				      struct device_node *np)
 {
@@ -709,9 +1044,24 @@ static int atmel_i2s_probe(struct platform_device *pdev)
 	regmap_write(dev->regmap, ATMEL_I2SC_IER,
 		     ATMEL_I2SC_INT_RXOR | ATMEL_I2SC_INT_TXUR);
 
+	/* Get per audio channel DMAs, if any. */
+	err = atmel_i2s_mch_request(dev);
+	if (err) {
+		clk_disable_unprepare(dev->pclk);
+		return err;
+	}
+
+	dev->dai_drv = atmel_i2s_dai;
+	if (dev->mch[SNDRV_PCM_STREAM_PLAYBACK].nchan > 2)
+		dev->dai_drv.playback.channels_max =
+			dev->mch[SNDRV_PCM_STREAM_PLAYBACK].nchan;
+	if (dev->mch[SNDRV_PCM_STREAM_CAPTURE].nchan > 2)
+		dev->dai_drv.capture.channels_max =
+			dev->mch[SNDRV_PCM_STREAM_CAPTURE].nchan;
+
 	err = devm_snd_soc_register_component(&pdev->dev,
 					      &atmel_i2s_component,
-					      &atmel_i2s_dai, 1);
+					      &dev->dai_drv, 1);
 	if (err) {
 		dev_err(&pdev->dev, "failed to register DAI: %d\n", err);
 		clk_disable_unprepare(dev->pclk);
@@ -724,9 +1074,15 @@ static int atmel_i2s_probe(struct platform_device *pdev)
 	dev->capture.addr	= (dma_addr_t)mem->start + ATMEL_I2SC_RHR;
 	dev->capture.maxburst	= 1;
 
-	if (of_property_match_string(np, "dma-names", "rx-tx") == 0)
-		pcm_flags |= SND_DMAENGINE_PCM_FLAG_HALF_DUPLEX;
-	err = devm_snd_dmaengine_pcm_register(&pdev->dev, NULL, pcm_flags);
+	if (dev->multi_dma) {
+		err = devm_snd_soc_register_platform(&pdev->dev,
+						     &atmel_i2s_mch_platform);
+	} else {
+		if (of_property_match_string(np, "dma-names", "rx-tx") == 0)
+			pcm_flags |= SND_DMAENGINE_PCM_FLAG_HALF_DUPLEX;
+		err = devm_snd_dmaengine_pcm_register(&pdev->dev, NULL,
+						      pcm_flags);
+	}
 	if (err) {
 		dev_err(&pdev->dev, "failed to register PCM: %d\n", err);
 		clk_disable_unprepare(dev->pclk);
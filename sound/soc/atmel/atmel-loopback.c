@@ -0,0 +1,410 @@
+/* Atmel ASoC capture to playback loopback
+ *
+ * Copyright (C) 2015 Atmel
+ *
+ * Runs a monitor path from a capture PCM (PDMIC, SSC) to a playback PCM
+ * (CLASSD, I2S, SSC) without any application: both PCMs are opened from
+ * the kernel with the same format and buffer geometry, and the playback
+ * DMA reads the ring the capture DMA writes, one period behind it. Once
+ * started, no sample goes through the CPU.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 or later
+ * as published by the Free Software Foundation.
+ */
+
+#include <linux/delay.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include <sound/soc.h>
+
+#define ATMEL_LOOPBACK_RATE		16000
+#define ATMEL_LOOPBACK_CHANNELS		1
+#define ATMEL_LOOPBACK_PERIOD_FRAMES	64
+#define ATMEL_LOOPBACK_PERIODS		4
+
+struct atmel_loopback_stream {
+	struct device_node *card_np;
+	u32 link;
+	struct file *filp;
+	struct snd_pcm_substream *substream;
+	unsigned char *dma_area;
+	dma_addr_t dma_addr;
+};
+
+struct atmel_loopback {
+	struct device *dev;
+	struct mutex lock;
+	bool enabled;
+	u32 rate;
+	u32 channels;
+	u32 period_frames;
+	u32 periods;
+	struct atmel_loopback_stream streams[2];
+};
+
+/* Find the PCM of a DAI link of the card bound to @s->card_np */
+static struct snd_pcm *atmel_loopback_get_pcm(struct atmel_loopback *lb,
+					      struct atmel_loopback_stream *s)
+{
+	struct platform_device *pdev;
+	struct snd_soc_card *card;
+	struct snd_pcm *pcm = NULL;
+
+	pdev = of_find_device_by_node(s->card_np);
+	if (!pdev)
+		return NULL;
+
+	card = platform_get_drvdata(pdev);
+	if (card && card->instantiated && s->link < card->num_rtd)
+		pcm = card->rtd[s->link].pcm;
+
+	put_device(&pdev->dev);
+
+	return pcm;
+}
+
+static void atmel_loopback_hw_param_set(struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t var,
+					unsigned int val)
+{
+	if (hw_is_mask(var)) {
+		struct snd_mask *m = hw_param_mask(params, var);
+
+		snd_mask_none(m);
+		snd_mask_set(m, val);
+	} else {
+		struct snd_interval *i = hw_param_interval(params, var);
+
+		i->min = val;
+		i->max = val;
+		i->openmin = 0;
+		i->openmax = 0;
+		i->integer = 1;
+		i->empty = 0;
+	}
+}
+
+static int atmel_loopback_open(struct atmel_loopback *lb, int stream)
+{
+	struct atmel_loopback_stream *s = &lb->streams[stream];
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_runtime *runtime;
+	struct snd_pcm_hw_params *params;
+	struct snd_pcm_sw_params swparams;
+	struct snd_pcm_file *pcm_file;
+	struct snd_pcm *pcm;
+	char path[32];
+	int ret;
+
+	pcm = atmel_loopback_get_pcm(lb, s);
+	if (!pcm)
+		return -ENODEV;
+
+	snprintf(path, sizeof(path), "/dev/snd/pcmC%dD%d%c",
+		 pcm->card->number, pcm->device,
+		 stream == SNDRV_PCM_STREAM_PLAYBACK ? 'p' : 'c');
+
+	s->filp = filp_open(path, stream == SNDRV_PCM_STREAM_PLAYBACK ?
+			    O_WRONLY : O_RDONLY, 0);
+	if (IS_ERR(s->filp)) {
+		ret = PTR_ERR(s->filp);
+		dev_err(lb->dev, "can't open %s: %d\n", path, ret);
+		s->filp = NULL;
+		return ret;
+	}
+
+	pcm_file = s->filp->private_data;
+	substream = pcm_file->substream;
+	runtime = substream->runtime;
+	s->substream = substream;
+
+	params = kzalloc(sizeof(*params), GFP_KERNEL);
+	if (!params) {
+		ret = -ENOMEM;
+		goto err_close;
+	}
+
+	_snd_pcm_hw_params_any(params);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_ACCESS,
+				    SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_FORMAT,
+				    SNDRV_PCM_FORMAT_S16_LE);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_CHANNELS,
+				    lb->channels);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_RATE,
+				    lb->rate);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+				    lb->period_frames);
+	atmel_loopback_hw_param_set(params, SNDRV_PCM_HW_PARAM_PERIODS,
+				    lb->periods);
+
+	ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_HW_PARAMS,
+				   params);
+	kfree(params);
+	if (ret) {
+		dev_err(lb->dev, "%s: unsupported parameters: %d\n", path, ret);
+		goto err_close;
+	}
+
+	/*
+	 * Nobody reads or writes the buffer: the streams must never stop on
+	 * an xrun and must only start when told to.
+	 */
+	memset(&swparams, 0, sizeof(swparams));
+	swparams.period_step = 1;
+	swparams.avail_min = runtime->period_size;
+	swparams.start_threshold = runtime->boundary;
+	swparams.stop_threshold = runtime->boundary;
+	ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_SW_PARAMS,
+				   &swparams);
+	if (ret)
+		goto err_close;
+
+	ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_PREPARE, NULL);
+	if (ret)
+		goto err_close;
+
+	s->dma_area = runtime->dma_area;
+	s->dma_addr = runtime->dma_addr;
+
+	return 0;
+
+err_close:
+	filp_close(s->filp, NULL);
+	s->filp = NULL;
+	s->substream = NULL;
+	return ret;
+}
+
+static void atmel_loopback_close(struct atmel_loopback *lb, int stream)
+{
+	struct atmel_loopback_stream *s = &lb->streams[stream];
+
+	if (!s->filp)
+		return;
+
+	snd_pcm_kernel_ioctl(s->substream, SNDRV_PCM_IOCTL_DROP, NULL);
+
+	/* Give the playback substream its own buffer back before hw_free */
+	s->substream->runtime->dma_area = s->dma_area;
+	s->substream->runtime->dma_addr = s->dma_addr;
+
+	filp_close(s->filp, NULL);
+	s->filp = NULL;
+	s->substream = NULL;
+}
+
+static int atmel_loopback_start(struct atmel_loopback *lb)
+{
+	struct snd_pcm_substream *capture, *playback;
+	unsigned long period_us;
+	int ret;
+
+	ret = atmel_loopback_open(lb, SNDRV_PCM_STREAM_CAPTURE);
+	if (ret)
+		return ret;
+
+	ret = atmel_loopback_open(lb, SNDRV_PCM_STREAM_PLAYBACK);
+	if (ret)
+		goto err_close_capture;
+
+	capture = lb->streams[SNDRV_PCM_STREAM_CAPTURE].substream;
+	playback = lb->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+
+	if (snd_pcm_lib_buffer_bytes(capture) !=
+	    snd_pcm_lib_buffer_bytes(playback)) {
+		dev_err(lb->dev, "capture and playback buffers differ\n");
+		ret = -EINVAL;
+		goto err_close_playback;
+	}
+
+	/* Both DMA channels go around the capture ring */
+	playback->runtime->dma_area = capture->runtime->dma_area;
+	playback->runtime->dma_addr = capture->runtime->dma_addr;
+
+	ret = snd_pcm_kernel_ioctl(capture, SNDRV_PCM_IOCTL_START, NULL);
+	if (ret)
+		goto err_close_playback;
+
+	/* Playback follows one period behind, that is the path latency */
+	period_us = DIV_ROUND_UP((unsigned long)lb->period_frames * 1000000,
+				 lb->rate);
+	usleep_range(period_us, period_us + 100);
+
+	ret = snd_pcm_kernel_ioctl(playback, SNDRV_PCM_IOCTL_START, NULL);
+	if (ret)
+		goto err_close_playback;
+
+	return 0;
+
+err_close_playback:
+	atmel_loopback_close(lb, SNDRV_PCM_STREAM_PLAYBACK);
+err_close_capture:
+	atmel_loopback_close(lb, SNDRV_PCM_STREAM_CAPTURE);
+	return ret;
+}
+
+static void atmel_loopback_stop(struct atmel_loopback *lb)
+{
+	atmel_loopback_close(lb, SNDRV_PCM_STREAM_PLAYBACK);
+	atmel_loopback_close(lb, SNDRV_PCM_STREAM_CAPTURE);
+}
+
+static ssize_t enable_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct atmel_loopback *lb = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", lb->enabled);
+}
+
+static ssize_t enable_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct atmel_loopback *lb = dev_get_drvdata(dev);
+	bool enable;
+	int ret = 0;
+
+	if (strtobool(buf, &enable))
+		return -EINVAL;
+
+	mutex_lock(&lb->lock);
+	if (enable && !lb->enabled)
+		ret = atmel_loopback_start(lb);
+	else if (!enable && lb->enabled)
+		atmel_loopback_stop(lb);
+	if (!ret)
+		lb->enabled = enable;
+	mutex_unlock(&lb->lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(enable);
+
+static int atmel_loopback_parse_stream(struct atmel_loopback *lb, int stream,
+				       const char *card, const char *link)
+{
+	struct atmel_loopback_stream *s = &lb->streams[stream];
+	struct device_node *np = lb->dev->of_node;
+
+	s->card_np = of_parse_phandle(np, card, 0);
+	if (!s->card_np) {
+		dev_err(lb->dev, "%s is missing\n", card);
+		return -EINVAL;
+	}
+
+	of_property_read_u32(np, link, &s->link);
+
+	/* The PCM is only looked up when the loopback starts */
+	if (!atmel_loopback_get_pcm(lb, s)) {
+		of_node_put(s->card_np);
+		return -EPROBE_DEFER;
+	}
+
+	return 0;
+}
+
+static int atmel_loopback_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct device_node *np = dev->of_node;
+	struct atmel_loopback *lb;
+	int ret;
+
+	lb = devm_kzalloc(dev, sizeof(*lb), GFP_KERNEL);
+	if (!lb)
+		return -ENOMEM;
+
+	lb->dev = dev;
+	mutex_init(&lb->lock);
+
+	lb->rate = ATMEL_LOOPBACK_RATE;
+	lb->channels = ATMEL_LOOPBACK_CHANNELS;
+	lb->period_frames = ATMEL_LOOPBACK_PERIOD_FRAMES;
+	lb->periods = ATMEL_LOOPBACK_PERIODS;
+	of_property_read_u32(np, "atmel,rate", &lb->rate);
+	of_property_read_u32(np, "atmel,channels", &lb->channels);
+	of_property_read_u32(np, "atmel,period-frames", &lb->period_frames);
+	of_property_read_u32(np, "atmel,periods", &lb->periods);
+	if (!lb->rate || !lb->channels || !lb->period_frames ||
+	    lb->periods < 2) {
+		dev_err(dev, "invalid stream parameters\n");
+		return -EINVAL;
+	}
+
+	ret = atmel_loopback_parse_stream(lb, SNDRV_PCM_STREAM_CAPTURE,
+					  "atmel,capture-card",
+					  "atmel,capture-link");
+	if (ret)
+		return ret;
+
+	ret = atmel_loopback_parse_stream(lb, SNDRV_PCM_STREAM_PLAYBACK,
+					  "atmel,playback-card",
+					  "atmel,playback-link");
+	if (ret)
+		goto err_put_capture;
+
+	platform_set_drvdata(pdev, lb);
+
+	ret = device_create_file(dev, &dev_attr_enable);
+	if (ret)
+		goto err_put_playback;
+
+	return 0;
+
+err_put_playback:
+	of_node_put(lb->streams[SNDRV_PCM_STREAM_PLAYBACK].card_np);
+err_put_capture:
+	of_node_put(lb->streams[SNDRV_PCM_STREAM_CAPTURE].card_np);
+	return ret;
+}
+
+static int atmel_loopback_remove(struct platform_device *pdev)
+{
+	struct atmel_loopback *lb = platform_get_drvdata(pdev);
+
+	device_remove_file(&pdev->dev, &dev_attr_enable);
+
+	mutex_lock(&lb->lock);
+	if (lb->enabled)
+		atmel_loopback_stop(lb);
+	lb->enabled = false;
+	mutex_unlock(&lb->lock);
+
+	of_node_put(lb->streams[SNDRV_PCM_STREAM_PLAYBACK].card_np);
+	of_node_put(lb->streams[SNDRV_PCM_STREAM_CAPTURE].card_np);
+
+	return 0;
+}
+
+static const struct of_device_id atmel_loopback_of_match[] = {
+	{
+		.compatible = "atmel,asoc-loopback",
+	}, {
+		/* sentinel */
+	}
+};
+MODULE_DEVICE_TABLE(of, atmel_loopback_of_match);
+
+static struct platform_driver atmel_loopback_driver = {
+	.driver	= {
+		.name		= "atmel-loopback",
+		.of_match_table	= of_match_ptr(atmel_loopback_of_match),
+	},
+	.probe	= atmel_loopback_probe,
+	.remove	= atmel_loopback_remove,
+};
+module_platform_driver(atmel_loopback_driver);
+
+MODULE_DESCRIPTION("Atmel ASoC capture to playback loopback");
+MODULE_LICENSE("GPL v2");
@@ -122,10 +122,14 @@ static const struct snd_dmaengine_pcm_config atmel_dmaengine_pcm_config = {
 	.prealloc_buffer_size = 64 * 1024,
 };
 
+/*
+ * Both at_hdmac and at_xdmac report the residue of cyclic transfers, so let
+ * the generic code use it for pointer(). It falls back to period accounting
+ * on its own when the channel can't report residue.
+ */
 int atmel_pcm_dma_platform_register(struct device *dev)
 {
-	return snd_dmaengine_pcm_register(dev, &atmel_dmaengine_pcm_config,
-			SND_DMAENGINE_PCM_FLAG_NO_RESIDUE);
+	return snd_dmaengine_pcm_register(dev, &atmel_dmaengine_pcm_config, 0);
 }
 EXPORT_SYMBOL(atmel_pcm_dma_platform_register);
 
@@ -35,6 +35,7 @@ struct atmel_pdmic {
 	int irq;
 	struct snd_pcm_substream *substream;
 	const struct atmel_pdmic_pdata *pdata;
+	unsigned int decimation;
 };
 
 static const struct of_device_id atmel_pdmic_of_match[] = {
@@ -333,6 +334,51 @@ static int pdmic_put_mic_volsw(struct snd_kcontrol *kcontrol,
 	return 0;
 }
 
+/* Oversampling ratio of the decimation filter, see PDMIC_DSPR0_OSR */
+enum {
+	PDMIC_DECIMATION_AUTO,
+	PDMIC_DECIMATION_64,
+	PDMIC_DECIMATION_128,
+};
+
+static const char * const pdmic_decimation_text[] = {
+	"Auto", "64", "128",
+};
+
+static SOC_ENUM_SINGLE_EXT_DECL(pdmic_decimation_enum, pdmic_decimation_text);
+
+static int pdmic_get_decimation(struct snd_kcontrol *kcontrol,
+	struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct snd_soc_card *card = snd_soc_codec_get_drvdata(codec);
+	struct atmel_pdmic *dd = snd_soc_card_get_drvdata(card);
+
+	ucontrol->value.enumerated.item[0] = dd->decimation;
+
+	return 0;
+}
+
+static int pdmic_put_decimation(struct snd_kcontrol *kcontrol,
+	struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct snd_soc_card *card = snd_soc_codec_get_drvdata(codec);
+	struct atmel_pdmic *dd = snd_soc_card_get_drvdata(card);
+	unsigned int val = ucontrol->value.enumerated.item[0];
+
+	if (val >= ARRAY_SIZE(pdmic_decimation_text))
+		return -EINVAL;
+
+	if (dd->decimation == val)
+		return 0;
+
+	/* Applies from the next hw_params() on */
+	dd->decimation = val;
+
+	return 1;
+}
+
 static const struct snd_kcontrol_new atmel_pdmic_snd_controls[] = {
 SOC_SINGLE_EXT_TLV("Mic Capture Volume", PDMIC_DSPR1, PDMIC_DSPR1_DGAIN_SHIFT,
 		   ARRAY_SIZE(mic_gain_table)-1, 0,
@@ -342,6 +388,9 @@ SOC_SINGLE("High Pass Filter Switch", PDMIC_DSPR0,
 	   PDMIC_DSPR0_HPFBYP_SHIFT, 1, 1),
 
 SOC_SINGLE("SINCC Filter Switch", PDMIC_DSPR0, PDMIC_DSPR0_SINBYP_SHIFT, 1, 1),
+
+SOC_ENUM_EXT("Decimation Ratio", pdmic_decimation_enum,
+	     pdmic_get_decimation, pdmic_put_decimation),
 };
 
 static int atmel_pdmic_codec_probe(struct snd_soc_codec *codec)
@@ -364,6 +413,23 @@ static struct snd_soc_codec_driver soc_codec_dev_pdmic = {
 /* codec dai component */
 #define PDMIC_MR_PRESCAL_MAX_VAL 127
 
+/*
+ * PRESCAL = SELCK/(2*f_pdmic) - 1, rounded to the closest value. Returns the
+ * distance between f_pdmic and the frequency actually obtained.
+ */
+static unsigned long atmel_pdmic_prescal(unsigned long clk_rate,
+					 unsigned int f_pdmic, u32 *prescal)
+{
+	unsigned long div = DIV_ROUND_CLOSEST(clk_rate, f_pdmic << 1);
+	unsigned long rate;
+
+	div = clamp_t(unsigned long, div, 1, PDMIC_MR_PRESCAL_MAX_VAL + 1);
+	*prescal = div - 1;
+	rate = clk_rate / (div << 1);
+
+	return rate > f_pdmic ? rate - f_pdmic : f_pdmic - rate;
+}
+
 static int
 atmel_pdmic_codec_dai_hw_params(struct snd_pcm_substream *substream,
 			    struct snd_pcm_hw_params *params,
@@ -376,8 +442,8 @@ atmel_pdmic_codec_dai_hw_params(struct snd_pcm_substream *substream,
 	unsigned int rate_max = substream->runtime->hw.rate_max;
 	int fs = params_rate(params);
 	int bits = params_width(params);
-	unsigned long pclk_rate, gclk_rate;
-	unsigned int f_pdmic;
+	unsigned long pclk_err, gclk_err;
+	unsigned int f_pdmic, osr;
 	u32 mr_val, dspr0_val, pclk_prescal, gclk_prescal;
 
 	if (params_channels(params) != 1) {
@@ -407,24 +473,44 @@ atmel_pdmic_codec_dai_hw_params(struct snd_pcm_substream *substream,
 		return -EINVAL;
 	}
 
-	if ((fs << 7) > (rate_max << 6)) {
-		f_pdmic = fs << 6;
-		dspr0_val |= PDMIC_DSPR0_OSR_64 << PDMIC_DSPR0_OSR_SHIFT;
-	} else {
-		f_pdmic = fs << 7;
-		dspr0_val |= PDMIC_DSPR0_OSR_128 << PDMIC_DSPR0_OSR_SHIFT;
+	/*
+	 * The decimation filter outputs fs directly, so there is no need for
+	 * resampling as long as the microphone clock fs * OSR is in range.
+	 * Auto prefers the 128 ratio, which filters better.
+	 */
+	switch (dd->decimation) {
+	case PDMIC_DECIMATION_64:
+		osr = 64;
+		break;
+	case PDMIC_DECIMATION_128:
+		osr = 128;
+		break;
+	default:
+		osr = ((fs << 7) > (rate_max << 6)) ? 64 : 128;
+		break;
 	}
 
-	pclk_rate = clk_get_rate(dd->pclk);
-	gclk_rate = clk_get_rate(dd->gclk);
+	f_pdmic = fs * osr;
+	if ((f_pdmic < dd->pdata->mic_min_freq) ||
+	    (f_pdmic > dd->pdata->mic_max_freq)) {
+		dev_err(codec->dev,
+			"microphone clock %uHz out of range for %dHz with OSR %u\n",
+			f_pdmic, fs, osr);
+		return -EINVAL;
+	}
+
+	if (osr == 64)
+		dspr0_val |= PDMIC_DSPR0_OSR_64 << PDMIC_DSPR0_OSR_SHIFT;
+	else
+		dspr0_val |= PDMIC_DSPR0_OSR_128 << PDMIC_DSPR0_OSR_SHIFT;
 
-	/* PRESCAL = SELCK/(2*f_pdmic) - 1*/
-	pclk_prescal = (u32)(pclk_rate/(f_pdmic << 1)) - 1;
-	gclk_prescal = (u32)(gclk_rate/(f_pdmic << 1)) - 1;
+	/* Use the clock that gets the closest to f_pdmic */
+	pclk_err = atmel_pdmic_prescal(clk_get_rate(dd->pclk), f_pdmic,
+				       &pclk_prescal);
+	gclk_err = atmel_pdmic_prescal(clk_get_rate(dd->gclk), f_pdmic,
+				       &gclk_prescal);
 
-	if ((pclk_prescal > PDMIC_MR_PRESCAL_MAX_VAL) ||
-	    (gclk_rate/((gclk_prescal + 1) << 1) <
-	     pclk_rate/((pclk_prescal + 1) << 1))) {
+	if (gclk_err < pclk_err) {
 		mr_val = gclk_prescal << PDMIC_MR_PRESCAL_SHIFT;
 		mr_val |= PDMIC_MR_CLKS_GCK << PDMIC_MR_CLKS_SHIFT;
 	} else {
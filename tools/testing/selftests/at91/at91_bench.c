@@ -0,0 +1,953 @@
+/*
+ * Throughput and latency benchmark for the AT91 peripheral drivers
+ *
+ * Each run goes through the standard user interface of one device:
+ *
+ *	serial <tty>		atmel_serial, TX looped back to RX
+ *	spi <spidev>		spi-atmel, MOSI looped back to MISO
+ *	i2c <i2c-dev>		i2c-at91, reads from the device at -a
+ *	mtd <mtd char dev>	atmel_nand, atmel-quadspi
+ *	blk <block dev>		atmel-mci, sdhci-of-at91
+ *	skcipher <alg>		atmel-aes, atmel-tdes, through AF_ALG
+ *	hash <alg>		atmel-sha, through AF_ALG
+ *
+ * and prints one JSON object per measured operation on stdout: bytes,
+ * MB/s, per-operation latency percentiles in microseconds and, with -i,
+ * the number of interrupts of the /proc/interrupts lines matching the
+ * given name. Writes to mtd and block devices destroy their content, they
+ * are only done with -w.
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <linux/fs.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/if_alg.h>
+#include <linux/spi/spidev.h>
+#include <mtd/mtd-user.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG			279
+#endif
+
+#define SERIAL_TIMEOUT_MS	1000
+
+struct bench_opts {
+	const char *test;
+	const char *dev;
+	const char *irq;
+	size_t size;
+	unsigned int count;
+	unsigned int speed;
+	const char *addr;
+	int write;
+	int flow;
+	int nocheck;
+};
+
+struct bench {
+	const struct bench_opts *opts;
+	const char *op;
+	uint64_t *lat;
+	unsigned int ops;
+	uint64_t bytes;
+	uint64_t start;
+	uint64_t elapsed;
+	long long irqs;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Sum over all the CPUs of the interrupts whose line contains @name */
+static long long irq_count(const char *name)
+{
+	char line[1024];
+	long long total = 0;
+	int ncpus = 0;
+	FILE *f;
+
+	if (!name)
+		return -1;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return -1;
+
+	if (fgets(line, sizeof(line), f)) {
+		char *p = line;
+
+		while ((p = strstr(p, "CPU"))) {
+			ncpus++;
+			p += 3;
+		}
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p, *end;
+		int i;
+
+		if (!strstr(line, name))
+			continue;
+
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		p++;
+
+		for (i = 0; i < ncpus; i++) {
+			long long n = strtoll(p, &end, 10);
+
+			if (end == p)
+				break;
+			total += n;
+			p = end;
+		}
+	}
+
+	fclose(f);
+	return total;
+}
+
+static int bench_start(struct bench *b, const struct bench_opts *opts,
+		       const char *op)
+{
+	memset(b, 0, sizeof(*b));
+	b->opts = opts;
+	b->op = op;
+	b->lat = calloc(opts->count, sizeof(*b->lat));
+	if (!b->lat) {
+		perror("calloc");
+		return -1;
+	}
+	b->irqs = irq_count(opts->irq);
+	b->start = now_ns();
+
+	return 0;
+}
+
+static void bench_add(struct bench *b, uint64_t t0, size_t bytes)
+{
+	b->lat[b->ops++] = now_ns() - t0;
+	b->bytes += bytes;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct bench *b, unsigned int p)
+{
+	if (!b->ops)
+		return 0;
+
+	return b->lat[(b->ops - 1) * p / 100] / 1000.0;
+}
+
+static void bench_end(struct bench *b)
+{
+	double secs;
+	long long irqs;
+
+	b->elapsed = now_ns() - b->start;
+	irqs = irq_count(b->opts->irq);
+	if (irqs >= 0 && b->irqs >= 0)
+		b->irqs = irqs - b->irqs;
+	else
+		b->irqs = -1;
+
+	qsort(b->lat, b->ops, sizeof(*b->lat), cmp_u64);
+	secs = b->elapsed / 1e9;
+
+	printf("{\"test\":\"%s\",\"device\":\"%s\",\"op\":\"%s\","
+	       "\"size\":%zu,\"ops\":%u,\"bytes\":%llu,\"seconds\":%.6f,"
+	       "\"mbps\":%.3f,",
+	       b->opts->test, b->opts->dev, b->op, b->opts->size, b->ops,
+	       (unsigned long long)b->bytes, secs,
+	       secs > 0 ? b->bytes / secs / 1e6 : 0);
+	if (b->irqs >= 0)
+		printf("\"irqs\":%lld,\"irqs_per_op\":%.2f,", b->irqs,
+		       b->ops ? (double)b->irqs / b->ops : 0);
+	else
+		printf("\"irqs\":null,\"irqs_per_op\":null,");
+	printf("\"lat_us\":{\"min\":%.1f,\"p50\":%.1f,\"p90\":%.1f,"
+	       "\"p99\":%.1f,\"max\":%.1f}}\n",
+	       percentile_us(b, 0), percentile_us(b, 50),
+	       percentile_us(b, 90), percentile_us(b, 99),
+	       percentile_us(b, 100));
+	fflush(stdout);
+
+	free(b->lat);
+}
+
+static void fill_pattern(unsigned char *buf, size_t len, unsigned int seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)(i * 7 + seed);
+}
+
+static int check_data(const struct bench_opts *opts, const void *a,
+		      const void *b, size_t len)
+{
+	if (opts->nocheck || !memcmp(a, b, len))
+		return 0;
+
+	fprintf(stderr, "%s: data mismatch on %s\n", opts->test, opts->dev);
+	return -1;
+}
+
+/* --- serial --- */
+
+static speed_t tty_speed(unsigned int baud)
+{
+	static const struct {
+		unsigned int baud;
+		speed_t speed;
+	} speeds[] = {
+		{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+		{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+		{ 460800, B460800 }, { 921600, B921600 },
+		{ 1000000, B1000000 }, { 1500000, B1500000 },
+		{ 2000000, B2000000 }, { 3000000, B3000000 },
+		{ 4000000, B4000000 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+		if (speeds[i].baud == baud)
+			return speeds[i].speed;
+
+	return 0;
+}
+
+static int bench_serial(const struct bench_opts *opts)
+{
+	unsigned char *tx, *rx;
+	struct termios tio;
+	struct bench b;
+	speed_t speed;
+	unsigned int i;
+	int fd, ret = -1;
+
+	speed = tty_speed(opts->speed ? opts->speed : 115200);
+	if (!speed) {
+		fprintf(stderr, "serial: unsupported baud rate %u\n",
+			opts->speed);
+		return -1;
+	}
+
+	fd = open(opts->dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(opts->dev);
+		return -1;
+	}
+
+	if (tcgetattr(fd, &tio)) {
+		perror("tcgetattr");
+		goto out_close;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag |= CLOCAL | CREAD;
+	if (opts->flow)
+		tio.c_cflag |= CRTSCTS;
+	else
+		tio.c_cflag &= ~CRTSCTS;
+	if (tcsetattr(fd, TCSANOW, &tio)) {
+		perror("tcsetattr");
+		goto out_close;
+	}
+	tcflush(fd, TCIOFLUSH);
+
+	tx = malloc(opts->size);
+	rx = malloc(opts->size);
+	if (!tx || !rx) {
+		perror("malloc");
+		goto out_free;
+	}
+
+	if (bench_start(&b, opts, "loopback"))
+		goto out_free;
+
+	for (i = 0; i < opts->count; i++) {
+		size_t sent = 0, received = 0;
+		uint64_t t0 = now_ns();
+
+		fill_pattern(tx, opts->size, i);
+
+		/* Keep the transmitter fed while reading back */
+		while (received < opts->size) {
+			struct pollfd pfd = {
+				.fd = fd,
+				.events = POLLIN |
+					  (sent < opts->size ? POLLOUT : 0),
+			};
+			ssize_t n;
+
+			n = poll(&pfd, 1, SERIAL_TIMEOUT_MS);
+			if (n <= 0) {
+				fprintf(stderr, "serial: %s after %zu bytes\n",
+					n ? strerror(errno) : "timeout",
+					received);
+				goto out_bench;
+			}
+
+			if (pfd.revents & POLLOUT) {
+				n = write(fd, tx + sent, opts->size - sent);
+				if (n < 0 && errno != EAGAIN) {
+					perror("write");
+					goto out_bench;
+				}
+				if (n > 0)
+					sent += n;
+			}
+
+			if (pfd.revents & POLLIN) {
+				n = read(fd, rx + received,
+					 opts->size - received);
+				if (n < 0 && errno != EAGAIN) {
+					perror("read");
+					goto out_bench;
+				}
+				if (n > 0)
+					received += n;
+			}
+		}
+
+		bench_add(&b, t0, opts->size);
+		if (check_data(opts, tx, rx, opts->size))
+			goto out_bench;
+	}
+	ret = 0;
+
+out_bench:
+	bench_end(&b);
+out_free:
+	free(tx);
+	free(rx);
+out_close:
+	close(fd);
+	return ret;
+}
+
+/* --- spi --- */
+
+static int bench_spi(const struct bench_opts *opts)
+{
+	struct spi_ioc_transfer xfer;
+	unsigned char *tx, *rx;
+	struct bench b;
+	unsigned int i;
+	int fd, ret = -1;
+
+	fd = open(opts->dev, O_RDWR);
+	if (fd < 0) {
+		perror(opts->dev);
+		return -1;
+	}
+
+	tx = malloc(opts->size);
+	rx = malloc(opts->size);
+	if (!tx || !rx) {
+		perror("malloc");
+		goto out_free;
+	}
+
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.tx_buf = (unsigned long)tx;
+	xfer.rx_buf = (unsigned long)rx;
+	xfer.len = opts->size;
+	xfer.speed_hz = opts->speed;
+	xfer.bits_per_word = 8;
+
+	if (bench_start(&b, opts, "transfer"))
+		goto out_free;
+
+	for (i = 0; i < opts->count; i++) {
+		uint64_t t0;
+
+		fill_pattern(tx, opts->size, i);
+		t0 = now_ns();
+		if (ioctl(fd, SPI_IOC_MESSAGE(1), &xfer) < 0) {
+			perror("SPI_IOC_MESSAGE");
+			goto out_bench;
+		}
+		bench_add(&b, t0, opts->size);
+
+		if (check_data(opts, tx, rx, opts->size))
+			goto out_bench;
+	}
+	ret = 0;
+
+out_bench:
+	bench_end(&b);
+out_free:
+	free(tx);
+	free(rx);
+	close(fd);
+	return ret;
+}
+
+/* --- i2c --- */
+
+static int bench_i2c(const struct bench_opts *opts)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+	struct i2c_msg msgs[2];
+	unsigned char offset = 0;
+	unsigned char *buf;
+	struct bench b;
+	unsigned long addr;
+	unsigned int i;
+	int fd, ret = -1;
+
+	if (!opts->addr) {
+		fprintf(stderr, "i2c: the device address is needed (-a)\n");
+		return -1;
+	}
+	addr = strtoul(opts->addr, NULL, 0);
+
+	fd = open(opts->dev, O_RDWR);
+	if (fd < 0) {
+		perror(opts->dev);
+		return -1;
+	}
+
+	buf = malloc(opts->size);
+	if (!buf) {
+		perror("malloc");
+		goto out_close;
+	}
+
+	/* Register offset write, then a repeated start read */
+	msgs[0].addr = addr;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &offset;
+	msgs[1].addr = addr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = opts->size;
+	msgs[1].buf = buf;
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = 2;
+
+	if (bench_start(&b, opts, "read"))
+		goto out_free;
+
+	for (i = 0; i < opts->count; i++) {
+		uint64_t t0 = now_ns();
+
+		if (ioctl(fd, I2C_RDWR, &rdwr) < 0) {
+			perror("I2C_RDWR");
+			goto out_bench;
+		}
+		bench_add(&b, t0, opts->size);
+	}
+	ret = 0;
+
+out_bench:
+	bench_end(&b);
+out_free:
+	free(buf);
+out_close:
+	close(fd);
+	return ret;
+}
+
+/* --- mtd --- */
+
+static int bench_mtd(const struct bench_opts *opts)
+{
+	struct mtd_info_user info;
+	unsigned char *wbuf, *rbuf;
+	unsigned int i, nblocks;
+	struct bench b;
+	int fd, ret = -1;
+
+	fd = open(opts->dev, opts->write ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		perror(opts->dev);
+		return -1;
+	}
+
+	if (ioctl(fd, MEMGETINFO, &info)) {
+		perror("MEMGETINFO");
+		goto out_close;
+	}
+
+	/* One eraseblock per operation */
+	nblocks = info.size / info.erasesize;
+	if (opts->count < nblocks)
+		nblocks = opts->count;
+
+	wbuf = malloc(info.erasesize);
+	rbuf = malloc(info.erasesize);
+	if (!wbuf || !rbuf) {
+		perror("malloc");
+		goto out_free;
+	}
+
+	if (opts->write) {
+		if (bench_start(&b, opts, "erase"))
+			goto out_free;
+		for (i = 0; i < nblocks; i++) {
+			struct erase_info_user ei = {
+				.start = i * info.erasesize,
+				.length = info.erasesize,
+			};
+			loff_t ofs = ei.start;
+			uint64_t t0;
+
+			if (ioctl(fd, MEMGETBADBLOCK, &ofs) > 0)
+				continue;
+
+			t0 = now_ns();
+			if (ioctl(fd, MEMERASE, &ei)) {
+				perror("MEMERASE");
+				bench_end(&b);
+				goto out_free;
+			}
+			bench_add(&b, t0, info.erasesize);
+		}
+		bench_end(&b);
+
+		if (bench_start(&b, opts, "write"))
+			goto out_free;
+		for (i = 0; i < nblocks; i++) {
+			loff_t ofs = (loff_t)i * info.erasesize;
+			uint64_t t0;
+
+			if (ioctl(fd, MEMGETBADBLOCK, &ofs) > 0)
+				continue;
+
+			fill_pattern(wbuf, info.erasesize, i);
+			t0 = now_ns();
+			if (pwrite(fd, wbuf, info.erasesize, ofs) !=
+			    info.erasesize) {
+				perror("write");
+				bench_end(&b);
+				goto out_free;
+			}
+			bench_add(&b, t0, info.erasesize);
+		}
+		bench_end(&b);
+	}
+
+	if (bench_start(&b, opts, "read"))
+		goto out_free;
+	for (i = 0; i < nblocks; i++) {
+		loff_t ofs = (loff_t)i * info.erasesize;
+		uint64_t t0;
+
+		if (ioctl(fd, MEMGETBADBLOCK, &ofs) > 0)
+			continue;
+
+		t0 = now_ns();
+		if (pread(fd, rbuf, info.erasesize, ofs) != info.erasesize) {
+			perror("read");
+			bench_end(&b);
+			goto out_free;
+		}
+		bench_add(&b, t0, info.erasesize);
+
+		if (opts->write) {
+			fill_pattern(wbuf, info.erasesize, i);
+			if (check_data(opts, wbuf, rbuf, info.erasesize)) {
+				bench_end(&b);
+				goto out_free;
+			}
+		}
+	}
+	bench_end(&b);
+	ret = 0;
+
+out_free:
+	free(wbuf);
+	free(rbuf);
+out_close:
+	close(fd);
+	return ret;
+}
+
+/* --- block --- */
+
+static int bench_blk_op(const struct bench_opts *opts, int fd,
+			unsigned char *buf, int write)
+{
+	struct bench b;
+	unsigned int i;
+	int ret = 0;
+
+	if (bench_start(&b, opts, write ? "write" : "read"))
+		return -1;
+
+	for (i = 0; i < opts->count; i++) {
+		off_t ofs = (off_t)i * opts->size;
+		uint64_t t0 = now_ns();
+		ssize_t n;
+
+		if (write)
+			n = pwrite(fd, buf, opts->size, ofs);
+		else
+			n = pread(fd, buf, opts->size, ofs);
+		if (n != (ssize_t)opts->size) {
+			perror(write ? "write" : "read");
+			ret = -1;
+			break;
+		}
+		bench_add(&b, t0, opts->size);
+	}
+
+	if (write && !ret && fsync(fd)) {
+		perror("fsync");
+		ret = -1;
+	}
+
+	bench_end(&b);
+	return ret;
+}
+
+static int bench_blk(const struct bench_opts *opts)
+{
+	unsigned long long size;
+	void *buf;
+	int fd, ret = -1;
+
+	/* O_DIRECT: measure the controller, not the page cache */
+	fd = open(opts->dev, (opts->write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0) {
+		perror(opts->dev);
+		return -1;
+	}
+
+	if (ioctl(fd, BLKGETSIZE64, &size)) {
+		perror("BLKGETSIZE64");
+		goto out_close;
+	}
+	if ((unsigned long long)opts->size * opts->count > size) {
+		fprintf(stderr, "blk: %s is too small\n", opts->dev);
+		goto out_close;
+	}
+
+	if (posix_memalign(&buf, 4096, opts->size)) {
+		perror("posix_memalign");
+		goto out_close;
+	}
+	fill_pattern(buf, opts->size, 0);
+
+	ret = 0;
+	if (opts->write)
+		ret = bench_blk_op(opts, fd, buf, 1);
+	if (!ret)
+		ret = bench_blk_op(opts, fd, buf, 0);
+
+	free(buf);
+out_close:
+	close(fd);
+	return ret;
+}
+
+/* --- crypto --- */
+
+static int alg_open(const char *type, const char *name, const void *key,
+		    unsigned int keylen)
+{
+	struct sockaddr_alg sa = {
+		.salg_family = AF_ALG,
+	};
+	int tfm, fd;
+
+	strncpy((char *)sa.salg_type, type, sizeof(sa.salg_type) - 1);
+	strncpy((char *)sa.salg_name, name, sizeof(sa.salg_name) - 1);
+
+	tfm = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	if (tfm < 0) {
+		perror("AF_ALG");
+		return -1;
+	}
+
+	if (bind(tfm, (struct sockaddr *)&sa, sizeof(sa))) {
+		fprintf(stderr, "%s: %s: %s\n", type, name, strerror(errno));
+		close(tfm);
+		return -1;
+	}
+
+	if (key && setsockopt(tfm, SOL_ALG, ALG_SET_KEY, key, keylen)) {
+		perror("ALG_SET_KEY");
+		close(tfm);
+		return -1;
+	}
+
+	fd = accept(tfm, NULL, 0);
+	if (fd < 0)
+		perror("accept");
+	close(tfm);
+
+	return fd;
+}
+
+static int skcipher_op(int fd, const unsigned char *in, unsigned char *out,
+		       size_t len, unsigned int ivlen)
+{
+	char cbuf[CMSG_SPACE(sizeof(__u32)) +
+		  CMSG_SPACE(sizeof(struct af_alg_iv) + 16)];
+	struct af_alg_iv *iv;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+
+	memset(cbuf, 0, sizeof(cbuf));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = cbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(__u32));
+	if (ivlen)
+		msg.msg_controllen +=
+			CMSG_SPACE(sizeof(struct af_alg_iv) + ivlen);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_ALG;
+	cmsg->cmsg_type = ALG_SET_OP;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(__u32));
+	*(__u32 *)CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+
+	if (ivlen) {
+		cmsg = CMSG_NXTHDR(&msg, cmsg);
+		cmsg->cmsg_level = SOL_ALG;
+		cmsg->cmsg_type = ALG_SET_IV;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + ivlen);
+		iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+		iv->ivlen = ivlen;
+	}
+
+	iov.iov_base = (void *)in;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (sendmsg(fd, &msg, 0) != (ssize_t)len) {
+		perror("sendmsg");
+		return -1;
+	}
+
+	if (read(fd, out, len) != (ssize_t)len) {
+		perror("read");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_skcipher(const struct bench_opts *opts)
+{
+	static const unsigned char key[32] = { 0x2b, 0x7e, 0x15, 0x16 };
+	unsigned int keylen = 16, ivlen = 16;
+	unsigned char *in, *out;
+	struct bench b;
+	unsigned int i;
+	int fd, ret = -1;
+
+	/* DES has 8 byte keys and IVs, DES3 24 byte keys, ECB no IV */
+	if (strstr(opts->dev, "tdes") || strstr(opts->dev, "des3")) {
+		keylen = 24;
+		ivlen = 8;
+	} else if (strstr(opts->dev, "des")) {
+		keylen = 8;
+		ivlen = 8;
+	}
+	if (strstr(opts->dev, "ecb"))
+		ivlen = 0;
+
+	fd = alg_open("skcipher", opts->dev, key, keylen);
+	if (fd < 0)
+		return -1;
+
+	in = malloc(opts->size);
+	out = malloc(opts->size);
+	if (!in || !out) {
+		perror("malloc");
+		goto out_free;
+	}
+	fill_pattern(in, opts->size, 0);
+
+	if (bench_start(&b, opts, "encrypt"))
+		goto out_free;
+
+	for (i = 0; i < opts->count; i++) {
+		uint64_t t0 = now_ns();
+
+		if (skcipher_op(fd, in, out, opts->size, ivlen))
+			goto out_bench;
+		bench_add(&b, t0, opts->size);
+	}
+	ret = 0;
+
+out_bench:
+	bench_end(&b);
+out_free:
+	free(in);
+	free(out);
+	close(fd);
+	return ret;
+}
+
+static int bench_hash(const struct bench_opts *opts)
+{
+	unsigned char digest[64];
+	unsigned char *in;
+	struct bench b;
+	unsigned int i;
+	int fd, ret = -1;
+
+	fd = alg_open("hash", opts->dev, NULL, 0);
+	if (fd < 0)
+		return -1;
+
+	in = malloc(opts->size);
+	if (!in) {
+		perror("malloc");
+		goto out_close;
+	}
+	fill_pattern(in, opts->size, 0);
+
+	if (bench_start(&b, opts, "digest"))
+		goto out_free;
+
+	for (i = 0; i < opts->count; i++) {
+		uint64_t t0 = now_ns();
+
+		if (write(fd, in, opts->size) != (ssize_t)opts->size ||
+		    read(fd, digest, sizeof(digest)) <= 0) {
+			perror("hash");
+			goto out_bench;
+		}
+		bench_add(&b, t0, opts->size);
+	}
+	ret = 0;
+
+out_bench:
+	bench_end(&b);
+out_free:
+	free(in);
+out_close:
+	close(fd);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(const struct bench_opts *opts);
+	size_t size;
+} tests[] = {
+	{ "serial",	bench_serial,	4096 },
+	{ "spi",	bench_spi,	4096 },
+	{ "i2c",	bench_i2c,	32 },
+	{ "mtd",	bench_mtd,	0 },
+	{ "blk",	bench_blk,	65536 },
+	{ "skcipher",	bench_skcipher,	4096 },
+	{ "hash",	bench_hash,	4096 },
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <test> <device|algorithm>\n"
+		"tests: serial spi i2c mtd blk skcipher hash\n"
+		"  -s <bytes>   size of each operation\n"
+		"  -n <count>   number of operations (default 100)\n"
+		"  -b <rate>    baud rate (serial) or clock rate in Hz (spi)\n"
+		"  -a <addr>    i2c device address\n"
+		"  -i <name>    count the interrupts of this /proc/interrupts name\n"
+		"  -f           hardware flow control (serial)\n"
+		"  -k           don't check the data read back\n"
+		"  -w           write tests, destroy the device content (mtd, blk)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts = {
+		.count = 100,
+	};
+	unsigned int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:n:b:a:i:fkw")) != -1) {
+		switch (c) {
+		case 's':
+			opts.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opts.speed = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			opts.addr = optarg;
+			break;
+		case 'i':
+			opts.irq = optarg;
+			break;
+		case 'f':
+			opts.flow = 1;
+			break;
+		case 'k':
+			opts.nocheck = 1;
+			break;
+		case 'w':
+			opts.write = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (argc - optind != 2 || !opts.count) {
+		usage(argv[0]);
+		return 2;
+	}
+	opts.test = argv[optind];
+	opts.dev = argv[optind + 1];
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		if (strcmp(tests[i].name, opts.test))
+			continue;
+
+		if (!opts.size)
+			opts.size = tests[i].size;
+
+		return tests[i].run(&opts) ? 1 : 0;
+	}
+
+	usage(argv[0]);
+	return 2;
+}
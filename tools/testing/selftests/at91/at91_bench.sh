@@ -0,0 +1,91 @@
+#!/bin/sh
+# Runs at91_bench on the AT91 peripherals given in the environment, e.g.
+#
+#	AT91_BENCH_SERIAL=/dev/ttyS1	TX looped back to RX
+#	AT91_BENCH_SPI=/dev/spidev1.0	MOSI looped back to MISO
+#	AT91_BENCH_I2C="/dev/i2c-0 0x50"
+#	AT91_BENCH_MTD=/dev/mtd5
+#	AT91_BENCH_BLK=/dev/mmcblk0
+#
+# Interrupts are counted for the /proc/interrupts names set in
+# AT91_BENCH_SERIAL_IRQ, AT91_BENCH_SPI_IRQ and so on. The mtd and block
+# devices are only written with AT91_BENCH_WRITE=1, which destroys their
+# content. The crypto engines are always measured when they are there.
+
+BENCH=./at91_bench
+ret=0
+
+if ! grep -qs "atmel," /proc/device-tree/compatible; then
+	echo "at91_bench: not an AT91 SoC [SKIP]"
+	exit 0
+fi
+
+write=
+[ "$AT91_BENCH_WRITE" = 1 ] && write=-w
+
+run()
+{
+	name=$1
+	irq=$2
+	shift 2
+
+	if $BENCH ${irq:+-i "$irq"} "$@"; then
+		echo "at91_bench: $name [PASS]" >&2
+	else
+		echo "at91_bench: $name [FAIL]" >&2
+		ret=1
+	fi
+}
+
+skip()
+{
+	echo "at91_bench: $1 [SKIP]" >&2
+}
+
+for test in serial spi i2c mtd blk; do
+	var=$(echo "AT91_BENCH_$test" | tr a-z A-Z)
+	eval dev=\$$var
+	eval irq=\$${var}_IRQ
+
+	if [ -z "$dev" ]; then
+		skip "$test"
+		continue
+	fi
+
+	case $test in
+	i2c)
+		set -- $dev
+		run $test "$irq" -a "$2" $test "$1"
+		;;
+	mtd|blk)
+		run $test "$irq" $write $test "$dev"
+		;;
+	*)
+		run $test "$irq" $test "$dev"
+		;;
+	esac
+done
+
+for alg in atmel-cbc-aes atmel-cbc-tdes; do
+	if grep -qs "driver *: $alg\$" /proc/crypto; then
+		for size in 16 256 4096 65536; do
+			run "$alg-$size" "$AT91_BENCH_CRYPTO_IRQ" -s $size \
+				skcipher $alg
+		done
+	else
+		skip "$alg"
+	fi
+done
+
+for alg in atmel-sha1 atmel-sha256; do
+	if grep -qs "driver *: $alg\$" /proc/crypto; then
+		for size in 64 4096 65536; do
+			run "$alg-$size" "$AT91_BENCH_CRYPTO_IRQ" -s $size \
+				hash $alg
+		done
+	else
+		skip "$alg"
+	fi
+done
+
+exit $ret